@@ -35,6 +35,9 @@ uint32_t BIOSGetROMSize(void);
 // Read a byte from the BIOS ROM.
 uint8_t BIOSReadROMByte(uint32_t offset);
 
+// Get a pointer to the BIOS ROM data, which is BIOSGetROMSize() bytes long.
+const uint8_t* BIOSGetROMData(void);
+
 #endif  // YAX86_BIOS_PUBLIC_H
 
 
@@ -625,6 +628,10 @@ uint8_t BIOSReadROMByte(uint32_t offset) {
   return kBIOSROMData[offset];
 }
 
+const uint8_t* BIOSGetROMData(void) {
+  return kBIOSROMData;
+}
+
 
 // ==============================================================================
 // src/bios/bios.c end
@@ -19,8 +19,23 @@ extern "C" {
 #define YAX86_CPU_PUBLIC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// The JIT backend is only available on x86-64 Linux hosts. Define
+// YAX86_DISABLE_JIT to build the pure interpreter on such hosts as well.
+#if defined(__x86_64__) && defined(__linux__) && !defined(YAX86_DISABLE_JIT)
+#define YAX86_CPU_HAS_JIT 1
+#endif  // defined(__x86_64__) && defined(__linux__) && ...
+
+// CPURun() dispatches opcodes with computed gotos on compilers that support
+// them. Define YAX86_DISABLE_THREADED_DISPATCH to always use the portable
+// dispatch through the opcode table.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(YAX86_DISABLE_THREADED_DISPATCH)
+#define YAX86_CPU_HAS_THREADED_DISPATCH 1
+#endif  // (defined(__GNUC__) || defined(__clang__)) && ...
+
 // ============================================================================
 // CPU state
 // ============================================================================
@@ -66,6 +81,8 @@ typedef enum RegisterIndex {
 enum {
   // Number of registers.
   kNumRegisters = kIP + 1,
+  // Number of segment registers, from kES to kDS.
+  kNumSegmentRegisters = kDS - kES + 1,
 };
 
 // CPU flag masks.
@@ -93,8 +110,44 @@ typedef enum Flag {
 enum {
   // CPU flags value on reset.
   kInitialFlags = (1 << 1),  // Reserved_1 is always 1.
+  // Flags produced by arithmetic and logic instructions, which may be
+  // evaluated lazily.
+  kArithmeticFlags = kCF | kPF | kAF | kZF | kSF | kOF,
 };
 
+// Kind of the last flag-producing operation, used to lazily evaluate flags.
+typedef enum CPULazyFlagsOp {
+  // ADD and ADC. Produces all arithmetic flags.
+  kLazyFlagsAdd = 0,
+  // INC. Produces all arithmetic flags except CF.
+  kLazyFlagsInc,
+  // SUB, SBB, CMP and NEG. Produces all arithmetic flags.
+  kLazyFlagsSub,
+  // DEC. Produces all arithmetic flags except CF.
+  kLazyFlagsDec,
+  // AND, OR, XOR and TEST. Produces all arithmetic flags except AF.
+  kLazyFlagsBoolean,
+} CPULazyFlagsOp;
+
+// The last flag-producing operation, from which flags are evaluated on demand.
+typedef struct CPULazyFlags {
+  // Flags that have not been written to CPUState.flags yet and must be
+  // evaluated from this operation, or 0 if there is no pending operation.
+  uint16_t pending;
+  // Kind of the operation, as a CPULazyFlagsOp.
+  uint8_t op;
+  // Data width of the operation, as a Width.
+  uint8_t width;
+  // Whether the operation included a carry or borrow.
+  bool did_carry;
+  // First operand.
+  uint32_t op1;
+  // Second operand.
+  uint32_t op2;
+  // Result, before truncating to the operation's data width.
+  uint32_t result;
+} CPULazyFlags;
+
 // Standard interrupts.
 typedef enum InterruptNumber {
   kInterruptDivideError = 0,
@@ -121,6 +174,18 @@ typedef enum ExecuteStatus {
 
 struct CPUState;
 struct Instruction;
+struct CPUInstructionCache;
+struct CPUBlockCache;
+struct CPUJIT;
+
+enum {
+  // Size of the 8088's physical address space in bytes.
+  kCPUMemoryAddressSpaceSize = 1024 * 1024,
+  // Granularity of direct host memory access in bytes.
+  kCPUMemoryPageSize = 4 * 1024,
+  // Number of pages in the physical address space.
+  kCPUNumMemoryPages = kCPUMemoryAddressSpaceSize / kCPUMemoryPageSize,
+};
 
 // Caller-provided runtime configuration.
 typedef struct CPUConfig {
@@ -148,6 +213,29 @@ typedef struct CPUConfig {
   void (*write_memory_byte)(
       struct CPUState* cpu, uint32_t address, uint8_t value);
 
+  // Optional callback to read a word from memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word reads are split into two
+  // calls to read_memory_byte.
+  uint16_t (*read_memory_word)(struct CPUState* cpu, uint32_t address);
+
+  // Optional callback to write a word to memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word writes are split into
+  // two calls to write_memory_byte.
+  void (*write_memory_word)(
+      struct CPUState* cpu, uint32_t address, uint16_t value);
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for reading. Reads from a page with a
+  // non-NULL pointer are served directly from host memory; reads from other
+  // pages go through read_memory_byte.
+  const uint8_t* const* read_memory_pages;
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for writing. Writes to a page with a
+  // non-NULL pointer go directly to host memory; writes to other pages go
+  // through write_memory_byte.
+  uint8_t* const* write_memory_pages;
+
   // Callback to handle an interrupt.
   //   - Return kExecuteSuccess if the interrupt was handled and execution
   //     should continue.
@@ -190,6 +278,61 @@ typedef struct CPUConfig {
   // For simplicity, we use a single 8-bit interface for memory access, similar
   // to the real-life 8088.
   void (*write_port)(struct CPUState* cpu, uint16_t port, uint8_t value);
+
+  // Optional callback to read a word from an I/O port, with the low byte from
+  // port and the high byte from port + 1. If not set, word reads are split into
+  // two calls to read_port.
+  uint16_t (*read_port_word)(struct CPUState* cpu, uint16_t port);
+
+  // Optional callback to write a word to an I/O port, with the low byte to port
+  // and the high byte to port + 1. If not set, word writes are split into two
+  // calls to write_port.
+  void (*write_port_word)(struct CPUState* cpu, uint16_t port, uint16_t value);
+
+  // Optional callback that returns whether reads from an I/O port have no side
+  // effects, and return the same value until the CPU writes to memory or to a
+  // port. Reads from ports whose value depends on the passage of time within a
+  // call to CPUTickBlock() or CPURun(), such as timer counters, are not
+  // stable. Translated loops that make no progress while only reading stable
+  // ports and memory are fast-forwarded to the end of the instruction budget.
+  // If not set, loops that read from ports are never fast-forwarded. Memory
+  // reads are assumed to never have side effects.
+  bool (*is_port_stable)(struct CPUState* cpu, uint16_t port);
+
+  // Optional cache of decoded instructions. If set, the cache must be
+  // initialized with CPUInitInstructionCache() before use.
+  struct CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated basic blocks, used by CPUTickBlock(). If set,
+  // the cache must be initialized with CPUInitBlockCache() before use.
+  struct CPUBlockCache* block_cache;
+
+  // Optional JIT compiler state. If set, hot blocks in block_cache are
+  // translated to native code when running CPUTickBlock(). The JIT must be
+  // initialized with CPUInitJIT() before CPUInit(), and is only used on hosts
+  // where YAX86_CPU_HAS_JIT is defined.
+  struct CPUJIT* jit;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // instruction cycle, or 0 for no limit. An instruction with iterations left
+  // is executed again in the next instruction cycle, with progress saved in
+  // CX, SI and DI, so that interrupts and devices are serviced in between.
+  // Smaller values reduce interrupt latency, larger values increase
+  // throughput.
+  uint16_t max_string_iterations;
+
+  // Whether CPURun() should dispatch opcodes through the opcode table even on
+  // hosts where YAX86_CPU_HAS_THREADED_DISPATCH is defined. This is mainly
+  // useful for comparing the two.
+  bool use_portable_dispatch;
+
+  // Whether each instruction cycle should advance CPUState.cycles by the
+  // number of clock cycles the instruction takes on the 8088, instead of by 1,
+  // so that the execution functions' budgets are in clock cycles. The last
+  // instruction run by CPUTickBlock() or CPURun() may then exceed the budget.
+  // Translated blocks store the clock cycles of their instructions, so the
+  // block cache and the JIT still apply.
+  bool use_clock_cycles;
 } CPUConfig;
 
 // State of the emulated CPU.
@@ -199,8 +342,13 @@ typedef struct CPUState {
 
   // Register values
   uint16_t registers[kNumRegisters];
-  // Flag values
+  // Flag values. Arithmetic flags are evaluated lazily while instructions are
+  // executing, but this is always exact between calls to CPUTick() and other
+  // execution functions, and when invoking the instruction and interrupt
+  // callbacks. Use CPUGetFlag() / CPUGetFlags() from other callbacks.
   uint16_t flags;
+  // The last flag-producing operation whose flags have not been evaluated yet.
+  CPULazyFlags lazy_flags;
 
   // Whether there is an active interrupt.
   bool has_pending_interrupt;
@@ -211,17 +359,70 @@ typedef struct CPUState {
   // or execute any instructions until an external event (e.g., an interrupt)
   // clears this state.
   bool is_halted;
+
+  // Whether the host or a callback has asked CPURun() to return after the
+  // current instruction. Cleared when CPURun() returns.
+  bool stop_requested;
+
+  // Number of instruction cycles started so far by CPUTick() and the other
+  // execution functions, including cycles spent halted. While an instruction
+  // is executing, this includes the instruction's own cycle. Wraps around.
+  uint32_t cycles;
+
+  // Linear base addresses of the segment registers, indexed by register index
+  // minus kES. These are derived from registers again at the start of
+  // CPUTick() and the other execution functions and after the instruction and
+  // interrupt callbacks return, so the host may write segment registers
+  // directly at those points. Use CPUSetSegmentRegister() from other
+  // callbacks.
+  uint32_t segment_bases[kNumSegmentRegisters];
+
+  // Number of reads from I/O ports that are not known to be stable according
+  // to the is_port_stable callback. Wraps around.
+  uint32_t num_unstable_port_reads;
+
+  // Number of cycles, out of cycles, that were spent idle: halted, or in loop
+  // iterations that were fast-forwarded because they make no progress until
+  // an interrupt arrives. Wraps around.
+  uint32_t idle_cycles;
+
+  // Number of 8088 clock cycles run so far, including one per cycle spent
+  // halted. Only counted if CPUConfig.use_clock_cycles is set.
+  uint64_t clock_cycles;
 } CPUState;
 
 // Initialize CPU state.
 void CPUInit(CPUState* cpu, CPUConfig* config);
 
+// Evaluate a pending lazily evaluated flag.
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag);
+// Evaluate all pending lazily evaluated flags and write them to cpu->flags.
+void CPUMaterializeFlags(CPUState* cpu);
+
 // Get the value of a CPU flag.
 static inline bool CPUGetFlag(const CPUState* cpu, Flag flag) {
+  if (cpu->lazy_flags.pending & flag) {
+    return CPUGetLazyFlag(cpu, flag);
+  }
   return (cpu->flags & flag) != 0;
 }
+// Get the value of the flags register.
+static inline uint16_t CPUGetFlags(CPUState* cpu) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
+  return cpu->flags;
+}
+// Set the value of the flags register.
+static inline void CPUSetFlags(CPUState* cpu, uint16_t flags) {
+  cpu->lazy_flags.pending = 0;
+  cpu->flags = flags;
+}
 // Set a CPU flag.
 static inline void CPUSetFlag(CPUState* cpu, Flag flag, bool value) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
   if (value) {
     cpu->flags |= flag;
   } else {
@@ -242,6 +443,23 @@ static inline void CPUClearPendingInterrupt(CPUState* cpu) {
   cpu->pending_interrupt_number = 0;
 }
 
+// Get the linear base address of a segment register.
+static inline uint32_t CPUGetSegmentBase(
+    const CPUState* cpu, RegisterIndex segment_register_index) {
+  return cpu->segment_bases[segment_register_index - kES];
+}
+// Set the value of a segment register, updating its linear base address.
+static inline void CPUSetSegmentRegister(
+    CPUState* cpu, RegisterIndex segment_register_index, uint16_t value) {
+  cpu->registers[segment_register_index] = value;
+  cpu->segment_bases[segment_register_index - kES] = ((uint32_t)value) << 4;
+}
+
+// Ask CPURun() to return at the end of the current instruction cycle. This can
+// be called from callbacks, e.g. when a device raises an interrupt that the
+// host must deliver before the next instruction.
+static inline void CPURequestStop(CPUState* cpu) { cpu->stop_requested = true; }
+
 // ============================================================================
 // Instructions
 // ============================================================================
@@ -311,8 +529,254 @@ typedef struct Instruction {
 
   // Total length of the original encoded instruction in bytes.
   uint8_t size;
+
+  // Memory operand addressing, resolved from the fields above by the decoder.
+
+  // Sign-extended displacement of the ModR/M memory operand.
+  uint16_t displacement_value;
+  // Base and index registers of the ModR/M memory operand, as mod * 8 + rm.
+  uint8_t effective_address_mode;
+  // Segment register of the ModR/M memory operand, or of the source operand
+  // of string instructions and XLAT, after applying segment override prefixes.
+  uint8_t segment_register_index;
 } Instruction;
 
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+enum {
+  // Number of entries in the decoded instruction cache.
+  kCPUInstructionCacheSize = 1024,
+  // Granularity of instruction cache invalidation in bytes.
+  kCPUInstructionCachePageSize = 1024,
+  // Number of invalidation pages in the physical address space.
+  kCPUInstructionCacheNumPages =
+      kCPUMemoryAddressSpaceSize / kCPUInstructionCachePageSize,
+};
+
+// An entry in the decoded instruction cache.
+typedef struct CPUInstructionCacheEntry {
+  // Linear address of the instruction.
+  uint32_t address;
+  // Generation of the page containing the instruction at the time it was
+  // decoded. The entry is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Opcode metadata for the instruction, or NULL if the entry is empty.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+} CPUInstructionCacheEntry;
+
+// A direct-mapped cache of decoded instructions, keyed by the linear address of
+// CS:IP.
+//
+// Any write to memory through the CPU invalidates cached instructions in the
+// same page by bumping the page's generation, so self-modifying code behaves
+// correctly. Memory modified outside the CPU, such as by DMA or by the host,
+// must be reported via CPUInvalidateInstructionCache().
+typedef struct CPUInstructionCache {
+  // Cache entries, indexed by linear address modulo kCPUInstructionCacheSize.
+  CPUInstructionCacheEntry entries[kCPUInstructionCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached instructions. Used to skip bumping
+  // the generation counter on writes to pages that contain no code.
+  bool page_has_instructions[kCPUInstructionCacheNumPages];
+
+  // Number of instruction fetches served from the cache.
+  uint64_t num_hits;
+  // Number of instruction fetches that had to be decoded from memory.
+  uint64_t num_misses;
+} CPUInstructionCache;
+
+// Initialize or reset an instruction cache.
+void CPUInitInstructionCache(CPUInstructionCache* cache);
+
+// Invalidate any cached instructions or translated blocks covering a memory
+// address. This must be called when memory is modified without going through
+// the CPU, such as by DMA.
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address);
+
+// ============================================================================
+// Block cache
+// ============================================================================
+
+enum {
+  // Number of blocks in the block cache.
+  kCPUBlockCacheSize = 256,
+  // Maximum number of instructions in a block.
+  kCPUMaxBlockInstructions = 16,
+  // Number of successor links kept per block. Most blocks end in a conditional
+  // jump or loop, which has a taken and a not-taken successor.
+  kCPUNumBlockSuccessors = 2,
+};
+
+// Common instruction sequences that are recognized when translating a block,
+// and executed as a single step when there are no instruction callbacks.
+typedef enum CPUFusionKind {
+  // Not the start of a fused sequence.
+  kCPUFusionNone = 0,
+  // CMP or TEST followed by a conditional jump.
+  kCPUFusionCompareJump,
+  // INC or DEC of a register followed by a conditional jump.
+  kCPUFusionIncDecJump,
+  // LODSB followed by STOSB, or LODSW followed by STOSW.
+  kCPUFusionLoadStore,
+  // XOR or SUB of a register with itself.
+  kCPUFusionZeroRegister,
+  // A block ending in a short branch back to its own start, such as a LOOP
+  // over a short body.
+  kCPUFusionLoop,
+  kCPUNumFusionKinds,
+} CPUFusionKind;
+
+struct CPUBlock;
+
+// A decoded instruction in a translated block, along with its pre-resolved
+// opcode metadata and handler.
+typedef struct CPUBlockInstruction {
+  // Opcode metadata for the instruction.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+  // Kind of fused sequence starting at this instruction, as a CPUFusionKind.
+  uint8_t fusion;
+  // Whether the instruction may take more clock cycles than clock_cycles,
+  // depending on the CPU state.
+  bool has_variable_clock_cycles;
+  // Number of 8088 clock cycles the instruction takes regardless of the CPU
+  // state.
+  uint16_t clock_cycles;
+  // Sum of clock_cycles of the instructions before this one in the block.
+  uint16_t block_clock_cycles;
+} CPUBlockInstruction;
+
+// A translated basic block - a straight-line run of instructions ending at the
+// first control transfer, or at the end of an invalidation page.
+typedef struct CPUBlock {
+  // Linear address of the first instruction.
+  uint32_t address;
+  // Generation of the page containing the block at the time it was translated.
+  // The block is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Total size of the block's instructions in bytes.
+  uint16_t size;
+  // Number of instructions in the block, or 0 if the entry is empty.
+  uint8_t num_instructions;
+  // Index of the successor link to replace next.
+  uint8_t next_successor;
+  // Whether the block ends in a short branch back to its own start.
+  bool is_loop;
+  // Whether the block's instructions only write to registers and flags, so
+  // that running it from the same CPU state always has the same effect as
+  // long as the memory and ports it reads don't change.
+  bool is_read_only;
+  // Links to blocks that previously followed this block. A link is only
+  // followed after checking that the linked block is still valid and starts
+  // at the next CS:IP.
+  struct CPUBlock* successors[kCPUNumBlockSuccessors];
+#ifdef YAX86_CPU_HAS_JIT
+  // Number of times the block has been entered, used to detect hot blocks.
+  uint16_t execution_count;
+  // JIT epoch in which native_code was generated. The native code is stale if
+  // the JIT's code buffer has since been flushed.
+  uint32_t jit_epoch;
+  // Native code for the block, or NULL if the block has not been compiled.
+  uint8_t* native_code;
+#endif  // YAX86_CPU_HAS_JIT
+  // The block's instructions.
+  CPUBlockInstruction instructions[kCPUMaxBlockInstructions];
+} CPUBlock;
+
+// A direct-mapped cache of translated basic blocks, keyed by the linear address
+// of the first instruction.
+//
+// Blocks are invalidated in the same way as the instruction cache: any write
+// to memory through the CPU bumps the generation of the page written to, and
+// memory modified outside the CPU must be reported via
+// CPUInvalidateInstructionCache().
+typedef struct CPUBlockCache {
+  // Cached blocks, indexed by linear address modulo kCPUBlockCacheSize.
+  CPUBlock blocks[kCPUBlockCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached blocks. Used to skip bumping the
+  // generation counter on writes to pages that contain no code.
+  bool page_has_blocks[kCPUInstructionCacheNumPages];
+
+  // Number of blocks found in the cache or through a successor link.
+  uint64_t num_hits;
+  // Number of blocks that had to be translated.
+  uint64_t num_misses;
+  // Number of block transitions that followed a successor link.
+  uint64_t num_chained;
+  // Number of times each kind of fused sequence was executed as a single
+  // step, indexed by CPUFusionKind.
+  uint64_t fusion_counts[kCPUNumFusionKinds];
+  // Number of loop iterations skipped by fast-forwarding delay loops and
+  // loops that make no progress.
+  uint64_t num_skipped_loop_iterations;
+} CPUBlockCache;
+
+// Initialize or reset a block cache.
+void CPUInitBlockCache(CPUBlockCache* cache);
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+enum {
+  // Number of times a block must be entered before it is compiled.
+  kCPUJITHotBlockThreshold = 16,
+  // Maximum size of the native code for a single block in bytes.
+  kCPUJITMaxBlockCodeSize = 2048,
+};
+
+// State of the JIT compiler, which translates hot blocks into native x86-64
+// code. Register moves, register ALU instructions and a conditional jump that
+// follows one are translated directly, recording flags in
+// CPUState.lazy_flags like the interpreter. Other instructions are compiled
+// into calls to the interpreter's opcode handlers, so translated blocks access
+// memory through the same callbacks and direct page tables.
+typedef struct CPUJIT {
+  // Caller-provided executable buffer for native code, such as memory mapped
+  // with PROT_READ | PROT_WRITE | PROT_EXEC.
+  uint8_t* code;
+  // Size of the code buffer in bytes.
+  uint32_t code_size;
+  // Number of bytes of the code buffer in use.
+  uint32_t code_used;
+  // Incremented whenever the code buffer is flushed.
+  uint32_t epoch;
+
+  // Block being executed natively.
+  CPUBlock* current_block;
+  // Value of CPUState.cycles before the current block started.
+  uint32_t current_block_start_cycles;
+  // Budget of CPUState.cycles for the current block. Only used if
+  // CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_max_cycles;
+  // Clock cycles taken by the current block's instructions so far on top of
+  // their base clock cycles. Only used if CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_variable_clock_cycles;
+  // Status of the last instruction executed natively.
+  ExecuteStatus status;
+  // Whether native execution of the current block stopped early.
+  bool stopped;
+
+  // Number of blocks compiled.
+  uint64_t num_compiled_blocks;
+  // Number of times the code buffer was flushed because it was full.
+  uint64_t num_flushes;
+  // Number of block executions that ran native code.
+  uint64_t num_native_executions;
+} CPUJIT;
+
+// Initialize or reset a JIT with a caller-provided executable code buffer.
+// The code buffer must be at least kCPUJITMaxBlockCodeSize bytes.
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size);
+
 // ============================================================================
 // Execution
 // ============================================================================
@@ -335,6 +799,33 @@ ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction);
 // instruction at CS:IP, and handling interrupts.
 ExecuteStatus CPUTick(CPUState* cpu);
 
+// Run up to max_instructions instruction cycles from translated blocks,
+// following links between blocks without decoding again. Each instruction is
+// executed with the same semantics as CPUTick(), but execution stops early
+// after an instruction that leaves the CPU halted, raises an interrupt or sets
+// the trap flag, so external interrupts only need to be checked between calls.
+// The number of instruction cycles run is stored in num_instructions. If
+// CPUConfig.use_clock_cycles is set, max_instructions and num_instructions are
+// in clock cycles instead, as in CPURun().
+//
+// If no block cache is configured, or the code at CS:IP cannot be translated,
+// this runs a single CPUTick().
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions);
+
+// Run up to max_cycles instruction cycles with the same semantics as calling
+// CPUTick() max_cycles times, using translated blocks if a block cache is
+// configured. The number of instruction cycles run is stored in num_cycles.
+// If CPUConfig.use_clock_cycles is set, max_cycles and num_cycles are in clock
+// cycles instead, and num_cycles may exceed max_cycles by up to the length of
+// the last instruction.
+//
+// Execution returns early when an instruction halts the CPU, on error, or when
+// CPURequestStop() is called. If the CPU is already halted with no pending
+// interrupt, it stays halted for all remaining cycles. The instruction
+// callbacks in CPUConfig are only checked once per call.
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles);
+
 #endif  // YAX86_CPU_PUBLIC_H
 
 
@@ -474,6 +965,24 @@ enum {
   kNumOperandAddressTypes = kOperandAddressTypeMemory + 1,
 };
 
+// Registers that make up the effective address of a ModR/M memory operand,
+// before adding the displacement.
+typedef struct EffectiveAddressMode {
+  // Base register, masked by base_mask. A mask of 0 means no base register.
+  RegisterIndex base_register_index;
+  uint16_t base_mask;
+  // Index register, masked by index_mask. A mask of 0 means no index register.
+  RegisterIndex index_register_index;
+  uint16_t index_mask;
+  // Segment register used when there is no segment override prefix.
+  RegisterIndex default_segment_register_index;
+} EffectiveAddressMode;
+
+enum {
+  // Number of ModR/M memory addressing modes, indexed by mod * 8 + rm.
+  kNumEffectiveAddressModes = 3 * 8,
+};
+
 // Operand address.
 typedef struct OperandAddress {
   // Type of operand (register or memory).
@@ -518,6 +1027,19 @@ typedef struct {
 // Handler function for an opcode.
 typedef ExecuteStatus (*OpcodeHandler)(const InstructionContext* context);
 
+// Addressing mode of an instruction's ModR/M byte.
+typedef enum ModRMClass {
+  // The R/M field refers to a memory operand (mod != 3).
+  kModRMClassMemory = 0,
+  // The R/M field refers to a register operand (mod == 3).
+  kModRMClassRegister,
+} ModRMClass;
+
+enum {
+  // Number of ModR/M addressing mode classes.
+  kNumModRMClasses = kModRMClassRegister + 1,
+};
+
 // An entry in the opcode lookup table.
 typedef struct OpcodeMetadata {
   // Opcode.
@@ -533,8 +1055,48 @@ typedef struct OpcodeMetadata {
 
   // Handler function.
   OpcodeHandler handler;
+  // Optional handlers specialized for the instruction's width and the
+  // addressing mode of its ModR/M byte, indexed by ModRMClass. When NULL,
+  // handler is used instead.
+  OpcodeHandler specialized_handlers[kNumModRMClasses];
 } OpcodeMetadata;
 
+// CPU state at the point where a loop block branched back to its own start,
+// used to detect loops that make no progress.
+typedef struct LoopSnapshot {
+  // The loop block, or NULL if no snapshot has been taken.
+  const CPUBlock* block;
+  // Register values.
+  uint16_t registers[kNumRegisters];
+  // Flag values, with the pending flag-producing operation.
+  uint16_t flags;
+  CPULazyFlags lazy_flags;
+  // Value of CPUState.num_unstable_port_reads.
+  uint32_t num_unstable_port_reads;
+} LoopSnapshot;
+
+// Number of 8088 clock cycles taken by an instruction.
+typedef struct InstructionTiming {
+  // Clock cycles with a register operand, or without a ModR/M byte. For
+  // conditional branches, this is the time taken when not branching.
+  uint8_t register_cycles;
+  // Clock cycles with a memory operand, excluding the effective address
+  // calculation.
+  uint8_t memory_cycles;
+} InstructionTiming;
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// JIT types.
+
+// Interpreter callback invoked by native code to execute an instruction that
+// the JIT cannot translate directly. Returns true if native execution of the
+// block should stop after the instruction.
+typedef bool (*JITInstructionHandler)(
+    CPUState* cpu, const CPUBlockInstruction* entry);
+
+#endif  // YAX86_CPU_HAS_JIT
+
 #endif  // YAX86_CPU_TYPES_H
 
 
@@ -543,197 +1105,1789 @@ typedef struct OpcodeMetadata {
 // ==============================================================================
 
 // ==============================================================================
-// src/cpu/operands.h start
+// src/cpu/lazy_flags.h start
 // ==============================================================================
 
-#line 1 "./src/cpu/operands.h"
-#ifndef YAX86_CPU_OPERANDS_H
-#define YAX86_CPU_OPERANDS_H
+#line 1 "./src/cpu/lazy_flags.h"
+#ifndef YAX86_CPU_LAZY_FLAGS_H
+#define YAX86_CPU_LAZY_FLAGS_H
 
 #ifndef YAX86_IMPLEMENTATION
 #include "public.h"
 #include "types.h"
 
-// Helper function to construct an OperandValue for a byte.
-extern OperandValue ByteValue(uint8_t byte_value);
-
-// Helper function to construct OperandValue for a word.
-extern OperandValue WordValue(uint16_t word_value);
-
-// Helper function to construct OperandValue given a Width and a value.
-extern OperandValue ToOperandValue(Width width, uint32_t raw_value);
-
-// Helper function to zero-extend OperandValue to a 32-bit value. This makes it
-// simpler to do direct arithmetic without worrying about overflow.
-extern uint32_t FromOperandValue(const OperandValue* value);
-
-// Helper function to sign-extend OperandValue to a 32-bit value. This makes it
-// simpler to do direct arithmetic without worrying about overflow.
-extern int32_t FromSignedOperandValue(const OperandValue* value);
-
-// Helper function to extract a zero-extended value from an operand.
-extern uint32_t FromOperand(const Operand* operand);
-
-// Helper function to extract a sign-extended value from an operand.
-extern int32_t FromSignedOperand(const Operand* operand);
-
-// Computes the raw effective address corresponding to a MemoryAddress.
-extern uint32_t ToRawAddress(const CPUState* cpu, const MemoryAddress* address);
-
-// Read a byte from memory as a uint8_t.
-extern uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address);
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+extern const uint16_t kLazyFlagsProduced[];
 
-// Read a word from memory as a uint16_t.
-extern uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address);
+// Record a flag-producing operation, whose flags will be evaluated when they
+// are read. Pending flags from the previous operation that are not produced by
+// this operation are evaluated first.
+extern void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry);
 
-// Read a byte from memory as an OperandValue.
-extern OperandValue ReadMemoryOperandByte(
-    CPUState* cpu, const OperandAddress* address);
+// Prepare to set the flags in mask directly. Pending flags outside of mask are
+// evaluated, and pending flags in mask are discarded.
+extern void DiscardLazyFlags(CPUState* cpu, uint16_t mask);
 
-// Read a word from memory as an OperandValue.
-extern OperandValue ReadMemoryOperandWord(
-    CPUState* cpu, const OperandAddress* address);
+// Returns the value of the flags in mask, evaluating pending flags as needed.
+extern uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask);
 
-// Read a byte from a register as an OperandValue.
-extern OperandValue ReadRegisterOperandByte(
-    CPUState* cpu, const OperandAddress* address);
+#endif  // YAX86_IMPLEMENTATION
 
-// Read a word from a register as an OperandValue.
-extern OperandValue ReadRegisterOperandWord(
-    CPUState* cpu, const OperandAddress* address);
+#endif  // YAX86_CPU_LAZY_FLAGS_H
 
-// Write a byte as uint8_t to memory.
-extern void WriteRawMemoryByte(CPUState* cpu, uint32_t address, uint8_t value);
 
-// Write a word as uint16_t to memory.
-extern void WriteRawMemoryWord(CPUState* cpu, uint32_t address, uint16_t value);
+// ==============================================================================
+// src/cpu/lazy_flags.h end
+// ==============================================================================
 
-// Write a byte to memory.
-extern void WriteMemoryOperandByte(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ==============================================================================
+// src/cpu/lazy_flags.c start
+// ==============================================================================
 
-// Write a word to memory.
-extern void WriteMemoryOperandWord(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+#line 1 "./src/cpu/lazy_flags.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
 
-// Write a byte to a register.
-extern void WriteRegisterOperandByte(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ============================================================================
+// Lazy flags
+// ============================================================================
 
-// Write a word to a register.
-extern void WriteRegisterOperandWord(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+YAX86_PRIVATE const uint16_t kLazyFlagsProduced[] = {
+    // kLazyFlagsAdd
+    kArithmeticFlags,
+    // kLazyFlagsInc
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsSub
+    kArithmeticFlags,
+    // kLazyFlagsDec
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsBoolean
+    kArithmeticFlags & ~kAF,
+};
 
-// Add an 8-bit signed relative offset to a 16-bit unsigned base address.
-extern uint16_t AddSignedOffsetByte(uint16_t base, uint8_t raw_offset);
+// Returns whether the number of set bits in the least significant byte of a
+// value is even.
+static inline bool IsParityEven(uint32_t value) {
+  uint8_t parity = value & 0xFF;
+  parity ^= parity >> 4;
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  return (parity & 1) == 0;
+}
 
-// Add a 16-bit signed relative offset to a 16-bit unsigned base address.
-extern uint16_t AddSignedOffsetWord(uint16_t base, uint16_t raw_offset);
+// Returns whether an operation is an addition, as opposed to a subtraction.
+static inline bool IsLazyFlagsOpAdd(uint8_t op) {
+  return op == kLazyFlagsAdd || op == kLazyFlagsInc;
+}
 
-// Get the register operand for a byte instruction based on the ModR/M byte's
-// reg or R/M field.
-extern RegisterAddress GetRegisterAddressByte(CPUState* cpu, uint8_t reg_or_rm);
+// Carry Flag (CF) - Set when an addition overflows the maximum width, or a
+// subtraction generates a borrow.
+static bool EvaluateCarryFlag(const CPULazyFlags* lazy_flags) {
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  switch (lazy_flags->op) {
+    case kLazyFlagsAdd:
+      return lazy_flags->result > max_value;
+    case kLazyFlagsSub:
+      return lazy_flags->op1 < (lazy_flags->op2 & max_value) +
+                                   (lazy_flags->did_carry ? 1 : 0);
+    default:
+      return false;
+  }
+}
 
-// Get the register operand for a word instruction based on the ModR/M byte's
-// reg or R/M field.
-extern RegisterAddress GetRegisterAddressWord(CPUState* cpu, uint8_t reg_or_rm);
+// Overflow Flag (OF) - Set when the result has the wrong sign.
+static bool EvaluateOverflowFlag(const CPULazyFlags* lazy_flags) {
+  if (lazy_flags->op == kLazyFlagsBoolean) {
+    return false;
+  }
+  const uint32_t sign_bit = kSignBit[lazy_flags->width];
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  bool op1_sign = (lazy_flags->op1 & sign_bit) != 0;
+  bool result_sign = (lazy_flags->result & sign_bit) != 0;
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    // Both operands have the same sign but the result has a different sign.
+    bool op2_sign = (lazy_flags->op2 & sign_bit) != 0;
+    return (op1_sign == op2_sign) && (result_sign != op1_sign);
+  }
+  // The operands have different signs and the result has the sign of the
+  // value being subtracted, which is op2 + did_carry truncated to the width.
+  uint32_t val_being_subtracted =
+      (lazy_flags->op2 & max_value) + (lazy_flags->did_carry ? 1 : 0);
+  bool val_being_subtracted_sign =
+      ((val_being_subtracted & max_value) & sign_bit) != 0;
+  return (op1_sign != val_being_subtracted_sign) &&
+         (result_sign == val_being_subtracted_sign);
+}
 
-// Apply segment override prefixes to a MemoryAddress.
-extern void ApplySegmentOverride(
-    const Instruction* instruction, MemoryAddress* address);
+// Auxiliary Carry Flag (AF) - carry or borrow between bit 3 and bit 4.
+static bool EvaluateAuxiliaryCarryFlag(const CPULazyFlags* lazy_flags) {
+  uint32_t op1_low = lazy_flags->op1 & 0xF;
+  uint32_t op2_low = (lazy_flags->op2 & 0xF) + (lazy_flags->did_carry ? 1 : 0);
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    return op1_low + op2_low > 0xF;
+  }
+  return op1_low < op2_low;
+}
+
+// Evaluate a single flag produced by an operation.
+static bool EvaluateLazyFlag(const CPULazyFlags* lazy_flags, Flag flag) {
+  const uint32_t result = lazy_flags->result & kMaxValue[lazy_flags->width];
+  switch (flag) {
+    case kZF:
+      return result == 0;
+    case kSF:
+      return (result & kSignBit[lazy_flags->width]) != 0;
+    case kPF:
+      return IsParityEven(result);
+    case kCF:
+      return EvaluateCarryFlag(lazy_flags);
+    case kOF:
+      return EvaluateOverflowFlag(lazy_flags);
+    case kAF:
+      return EvaluateAuxiliaryCarryFlag(lazy_flags);
+    default:
+      return false;
+  }
+}
 
-// Compute the memory address for an instruction.
-extern MemoryAddress GetMemoryOperandAddress(
-    CPUState* cpu, const Instruction* instruction);
+// Evaluate the pending flags in mask and write them to cpu->flags.
+static void EvaluateLazyFlags(CPUState* cpu, uint16_t mask) {
+  static const Flag kFlags[] = {kCF, kPF, kAF, kZF, kSF, kOF};
+  mask &= cpu->lazy_flags.pending;
+  for (uint8_t i = 0; i < sizeof(kFlags) / sizeof(kFlags[0]); ++i) {
+    if (!(mask & kFlags[i])) {
+      continue;
+    }
+    if (EvaluateLazyFlag(&cpu->lazy_flags, kFlags[i])) {
+      cpu->flags |= kFlags[i];
+    } else {
+      cpu->flags &= ~kFlags[i];
+    }
+  }
+}
 
-// Get a register or memory operand address based on the ModR/M byte and
-// displacement.
-extern OperandAddress GetRegisterOrMemoryOperandAddress(
-    CPUState* cpu, const Instruction* instruction, Width width);
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag) {
+  return EvaluateLazyFlag(&cpu->lazy_flags, flag);
+}
 
-// Read an 8-bit immediate value.
-extern OperandValue ReadImmediateOperandByte(const Instruction* instruction);
+void CPUMaterializeFlags(CPUState* cpu) {
+  EvaluateLazyFlags(cpu, cpu->lazy_flags.pending);
+  cpu->lazy_flags.pending = 0;
+}
 
-// Read a 16-bit immediate value.
-extern OperandValue ReadImmediateOperandWord(const Instruction* instruction);
+YAX86_PRIVATE void DiscardLazyFlags(CPUState* cpu, uint16_t mask) {
+  if (cpu->lazy_flags.pending & ~mask) {
+    EvaluateLazyFlags(cpu, ~mask);
+  }
+  cpu->lazy_flags.pending = 0;
+}
+
+YAX86_PRIVATE void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry) {
+  const uint16_t produced = kLazyFlagsProduced[op];
+  DiscardLazyFlags(cpu, produced);
+  CPULazyFlags* lazy_flags = &cpu->lazy_flags;
+  lazy_flags->pending = produced;
+  lazy_flags->op = op;
+  lazy_flags->width = width;
+  lazy_flags->did_carry = did_carry;
+  lazy_flags->op1 = op1;
+  lazy_flags->op2 = op2;
+  lazy_flags->result = result;
+}
+
+YAX86_PRIVATE uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask) {
+  uint16_t flags = cpu->flags & mask & ~cpu->lazy_flags.pending;
+  uint16_t pending = cpu->lazy_flags.pending & mask;
+  for (uint16_t flag = 1; pending; flag <<= 1) {
+    if (pending & flag) {
+      pending &= ~flag;
+      if (EvaluateLazyFlag(&cpu->lazy_flags, (Flag)flag)) {
+        flags |= flag;
+      }
+    }
+  }
+  return flags;
+}
 
-// Table of GetRegisterAddress functions, indexed by Width.
-extern RegisterAddress (*const kGetRegisterAddressFn[kNumWidths])(
-    CPUState* cpu, uint8_t reg_or_rm);
 
-// Table of Read* functions, indexed by OperandAddressType and Width.
-extern OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
-    CPUState* cpu, const OperandAddress* address);
+// ==============================================================================
+// src/cpu/lazy_flags.c end
+// ==============================================================================
 
-// Table of Write* functions, indexed by OperandAddressType and Width.
-extern void (*const kWriteOperandFn[kNumOperandAddressTypes][kNumWidths])(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ==============================================================================
+// src/cpu/block_cache.h start
+// ==============================================================================
 
-// Table of ReadImmediate* functions, indexed by Width.
-extern OperandValue (*const kReadImmediateValueFn[kNumWidths])(
-    const Instruction* instruction);
+#line 1 "./src/cpu/block_cache.h"
+#ifndef YAX86_CPU_BLOCK_CACHE_H
+#define YAX86_CPU_BLOCK_CACHE_H
 
-// Read a value from an operand address.
-extern OperandValue ReadOperandValue(
-    const InstructionContext* ctx, const OperandAddress* address);
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
 
-// Get a register or memory operand for an instruction based on the ModR/M
-// byte and displacement.
-extern Operand ReadRegisterOrMemoryOperand(const InstructionContext* ctx);
+// Look up a translated block in the cache by linear address. ip is the offset
+// of the block within the code segment. Returns NULL if the block is not cached
+// or the cached block is stale.
+extern CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip);
 
-// Get a register operand for an instruction.
-extern Operand ReadRegisterOperandForRegisterIndex(
-    const InstructionContext* ctx, RegisterIndex register_index);
+// Returns the cache entry to translate a block at a linear address into. The
+// entry is cleared and any previous block in it is evicted.
+extern CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address);
 
-// Get a register operand for an instruction from the REG field of the Mod/RM
-// byte.
-extern Operand ReadRegisterOperand(const InstructionContext* ctx);
+// Mark a block filled in by the caller as valid.
+extern void CommitBlock(CPUBlockCache* cache, CPUBlock* block);
 
-// Get a segment register operand for an instruction from the REG field of the
-// Mod/RM byte.
-extern Operand ReadSegmentRegisterOperand(const InstructionContext* ctx);
+// Returns whether a block is still valid, i.e. its page has not been written to
+// since it was translated.
+extern bool IsBlockValid(const CPUBlockCache* cache, const CPUBlock* block);
 
-// Write a value to a register or memory operand address.
-extern void WriteOperandAddress(
-    const InstructionContext* ctx, const OperandAddress* address,
-    uint32_t raw_value);
+// Returns the block following a block at a linear address, using the block's
+// successor links if possible. Returns NULL if the successor has not been
+// translated yet.
+extern CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip);
 
-// Write a value to a register or memory operand.
-extern void WriteOperand(
-    const InstructionContext* ctx, const Operand* operand, uint32_t raw_value);
+// Record a link from a block to a successor block.
+extern void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor);
 
-// Read an immediate value from the instruction.
-extern OperandValue ReadImmediate(const InstructionContext* ctx);
+// Invalidate translated blocks in the page containing a memory address that is
+// about to be written.
+extern void InvalidateBlockCacheOnWrite(CPUState* cpu, uint32_t address);
 
 #endif  // YAX86_IMPLEMENTATION
 
-#endif  // YAX86_CPU_OPERANDS_H
+#endif  // YAX86_CPU_BLOCK_CACHE_H
 
 
 // ==============================================================================
-// src/cpu/operands.h end
+// src/cpu/block_cache.h end
 // ==============================================================================
 
 // ==============================================================================
-// src/cpu/operands.c start
+// src/cpu/block_cache.c start
 // ==============================================================================
 
-#line 1 "./src/cpu/operands.c"
+#line 1 "./src/cpu/block_cache.c"
 #ifndef YAX86_IMPLEMENTATION
-#include "operands.h"
-
 #include "../util/common.h"
+#include "block_cache.h"
+#include "public.h"
+#include "types.h"
 #endif  // YAX86_IMPLEMENTATION
 
-// Helper functions to construct OperandValue.
-YAX86_PRIVATE OperandValue ByteValue(uint8_t byte_value) {
-  OperandValue value = {
-      .width = kByte,
-      .value = {.byte_value = byte_value},
-  };
-  return value;
-}
-
+// ============================================================================
+// Block cache
+// ============================================================================
+
+void CPUInitBlockCache(CPUBlockCache* cache) {
+  for (uint32_t i = 0; i < kCPUBlockCacheSize; ++i) {
+    CPUBlock* block = &cache->blocks[i];
+    block->num_instructions = 0;
+    block->next_successor = 0;
+    for (uint8_t j = 0; j < kCPUNumBlockSuccessors; ++j) {
+      block->successors[j] = NULL;
+    }
+#ifdef YAX86_CPU_HAS_JIT
+    block->execution_count = 0;
+    block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_blocks[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+  cache->num_chained = 0;
+  for (uint8_t i = 0; i < kCPUNumFusionKinds; ++i) {
+    cache->fusion_counts[i] = 0;
+  }
+  cache->num_skipped_loop_iterations = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetBlockCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+YAX86_PRIVATE bool IsBlockValid(
+    const CPUBlockCache* cache, const CPUBlock* block) {
+  return block->num_instructions > 0 &&
+         block->generation ==
+             cache->page_generations[GetBlockCachePage(block->address)];
+}
+
+// Returns whether a block is valid and can be entered at a CS:IP, i.e. it does
+// not run past the end of the code segment.
+static inline bool IsBlockValidAt(
+    const CPUBlockCache* cache, const CPUBlock* block, uint32_t address,
+    uint16_t ip) {
+  return block->address == address && (uint32_t)ip + block->size <= 0x10000 &&
+         IsBlockValid(cache, block);
+}
+
+YAX86_PRIVATE CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  if (IsBlockValidAt(cache, block, address, ip)) {
+    ++cache->num_hits;
+    return block;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  block->address = address;
+  block->size = 0;
+  block->num_instructions = 0;
+  block->next_successor = 0;
+  block->is_loop = false;
+  block->is_read_only = false;
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    block->successors[i] = NULL;
+  }
+#ifdef YAX86_CPU_HAS_JIT
+  block->execution_count = 0;
+  block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  return block;
+}
+
+YAX86_PRIVATE void CommitBlock(CPUBlockCache* cache, CPUBlock* block) {
+  uint32_t page = GetBlockCachePage(block->address);
+  block->generation = cache->page_generations[page];
+  cache->page_has_blocks[page] = true;
+}
+
+YAX86_PRIVATE CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    CPUBlock* successor = block->successors[i];
+    if (successor && IsBlockValidAt(cache, successor, address, ip)) {
+      ++cache->num_hits;
+      ++cache->num_chained;
+      return successor;
+    }
+  }
+  return LookupBlockCache(cache, address, ip);
+}
+
+YAX86_PRIVATE void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    if (block->successors[i] == successor) {
+      return;
+    }
+  }
+  block->successors[block->next_successor] = successor;
+  block->next_successor = (block->next_successor + 1) % kCPUNumBlockSuccessors;
+}
+
+YAX86_PRIVATE void InvalidateBlockCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  if (!cache) {
+    return;
+  }
+  uint32_t page = GetBlockCachePage(address);
+  if (cache->page_has_blocks[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_blocks[page] = false;
+  }
+}
+
+
+// ==============================================================================
+// src/cpu/block_cache.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/instruction_cache.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/instruction_cache.h"
+#ifndef YAX86_CPU_INSTRUCTION_CACHE_H
+#define YAX86_CPU_INSTRUCTION_CACHE_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Look up a decoded instruction in the cache by linear address. Returns NULL
+// if the instruction is not cached or the cached entry is stale.
+extern const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address);
+
+// Add a decoded instruction to the cache. ip is the offset of the instruction
+// within the code segment.
+extern void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata);
+
+// Invalidate cached instructions in the page containing a memory address
+// that is about to be written.
+extern void InvalidateInstructionCacheOnWrite(CPUState* cpu, uint32_t address);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_INSTRUCTION_CACHE_H
+
+
+// ==============================================================================
+// src/cpu/instruction_cache.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/instruction_cache.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/instruction_cache.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+void CPUInitInstructionCache(CPUInstructionCache* cache) {
+  for (uint32_t i = 0; i < kCPUInstructionCacheSize; ++i) {
+    cache->entries[i].metadata = NULL;
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_instructions[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetInstructionCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+// Returns the cache entry for a linear address.
+static inline CPUInstructionCacheEntry* GetInstructionCacheEntry(
+    CPUInstructionCache* cache, uint32_t address) {
+  return &cache->entries[address % kCPUInstructionCacheSize];
+}
+
+static void InvalidateInstructionCachePage(
+    CPUInstructionCache* cache, uint32_t address) {
+  uint32_t page = GetInstructionCachePage(address);
+  if (cache->page_has_instructions[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_instructions[page] = false;
+  }
+}
+
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+  InvalidateBlockCacheOnWrite(cpu, address);
+}
+
+YAX86_PRIVATE void InvalidateInstructionCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+}
+
+YAX86_PRIVATE const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address) {
+  const CPUInstructionCacheEntry* entry =
+      GetInstructionCacheEntry(cache, address);
+  if (entry->metadata && entry->address == address &&
+      entry->generation ==
+          cache->page_generations[GetInstructionCachePage(address)]) {
+    ++cache->num_hits;
+    return entry;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata) {
+  // Don't cache instructions that wrap around the end of the code segment, as
+  // their bytes are not contiguous in memory, or that straddle two pages, as
+  // only the first page's generation is tracked.
+  if ((uint32_t)ip + instruction->size > 0x10000 ||
+      (address % kCPUInstructionCachePageSize) + instruction->size >
+          kCPUInstructionCachePageSize) {
+    return;
+  }
+  uint32_t page = GetInstructionCachePage(address);
+  CPUInstructionCacheEntry* entry = GetInstructionCacheEntry(cache, address);
+  entry->address = address;
+  entry->generation = cache->page_generations[page];
+  entry->metadata = metadata;
+  entry->instruction = *instruction;
+  cache->page_has_instructions[page] = true;
+}
+
+
+// ==============================================================================
+// src/cpu/instruction_cache.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/fusion.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/fusion.h"
+#ifndef YAX86_CPU_FUSION_H
+#define YAX86_CPU_FUSION_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Recognize fused sequences in a translated block, and set the fusion kind of
+// each instruction and whether the block is a loop.
+extern void FuseBlockInstructions(CPUBlock* block);
+
+// Returns the number of instructions in a fused sequence.
+extern uint8_t GetFusionLength(CPUFusionKind kind);
+
+// Evaluate the condition of a conditional jump directly from the operands of
+// the pending flag-producing operation. Returns false if the condition can't
+// be derived this way, in which case the jump must be executed normally.
+extern bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken);
+
+// Execute an XOR or SUB of a register with itself.
+extern void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width);
+
+// Fast-forward through up to max_iterations further iterations of a loop
+// block that just branched back to its own start, if their effect is known in
+// advance: a LOOP instruction branching to itself, or a read-only block whose
+// last iteration left the CPU state unchanged since the previous call with the
+// same snapshot. Otherwise, saves the CPU state in the snapshot. Each skipped
+// iteration advances CPUState.cycles by iteration_cycles, the number of cycles
+// taken by the iteration that just ran. Returns the number of iterations
+// skipped.
+extern uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_FUSION_H
+
+
+// ==============================================================================
+// src/cpu/fusion.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/fusion.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/fusion.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "fusion.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction fusion
+// ============================================================================
+
+// Number of instructions in each kind of fused sequence, indexed by
+// CPUFusionKind. Loops are not executed as a sequence of instructions.
+static const uint8_t kFusionLengths[kCPUNumFusionKinds] = {
+    1,  // kCPUFusionNone
+    2,  // kCPUFusionCompareJump
+    2,  // kCPUFusionIncDecJump
+    2,  // kCPUFusionLoadStore
+    1,  // kCPUFusionZeroRegister
+    0,  // kCPUFusionLoop
+};
+
+YAX86_PRIVATE uint8_t GetFusionLength(CPUFusionKind kind) {
+  return kFusionLengths[kind];
+}
+
+// Returns whether an instruction is a CMP or TEST instruction.
+static bool IsCompare(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // CMP r/m, reg; CMP reg, r/m; CMP AL/AX, imm
+    case 0x38:
+    case 0x39:
+    case 0x3A:
+    case 0x3B:
+    case 0x3C:
+    case 0x3D:
+    // TEST r/m, reg; TEST AL/AX, imm
+    case 0x84:
+    case 0x85:
+    case 0xA8:
+    case 0xA9:
+      return true;
+    // Group 1 - CMP r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      return instruction->mod_rm.reg == 7;
+    // Group 3 - TEST r/m, imm
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction is an INC or DEC of a 16-bit register.
+static bool IsIncDecRegister(const Instruction* instruction) {
+  return instruction->opcode >= 0x40 && instruction->opcode <= 0x4F;
+}
+
+// Returns whether an instruction is a conditional jump (Jcc rel8).
+static bool IsConditionalJump(const Instruction* instruction) {
+  return instruction->opcode >= 0x70 && instruction->opcode <= 0x7F;
+}
+
+// Returns whether an instruction is a short branch, i.e. a Jcc, LOOP, LOOPZ,
+// LOOPNZ, JCXZ or JMP with a rel8 operand.
+static bool IsShortBranch(const Instruction* instruction) {
+  return IsConditionalJump(instruction) ||
+         (instruction->opcode >= 0xE0 && instruction->opcode <= 0xE3) ||
+         instruction->opcode == 0xEB;
+}
+
+// Returns whether an instruction is an XOR or SUB of a register with itself.
+static bool IsZeroRegister(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // SUB r/m, reg; SUB reg, r/m
+    case 0x28:
+    case 0x29:
+    case 0x2A:
+    case 0x2B:
+    // XOR r/m, reg; XOR reg, r/m
+    case 0x30:
+    case 0x31:
+    case 0x32:
+    case 0x33:
+      return instruction->mod_rm.mod == 3 &&
+             instruction->mod_rm.reg == instruction->mod_rm.rm;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction only writes to registers other than segment
+// registers and SP, and to flags other than IF and TF.
+static bool IsReadOnlyInstruction(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const bool is_register = instruction->mod_rm.mod == 3;
+  // ALU instructions: op r/m, reg; op reg, r/m; op AL/AX, imm
+  if (opcode < 0x40 && (opcode & 0x07) < 6) {
+    // op r/m, reg writes to memory unless it is a CMP.
+    return (opcode & 0x06) != 0 || is_register || (opcode & 0x38) == 0x38;
+  }
+  // INC and DEC of a register
+  if (IsIncDecRegister(instruction) || IsShortBranch(instruction)) {
+    return true;
+  }
+  switch (opcode) {
+    // Group 1 - op r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      return is_register || instruction->mod_rm.reg == 7;
+    // XCHG r/m, reg; MOV r/m, reg; MOV r/m, imm
+    case 0x86:
+    case 0x87:
+    case 0x88:
+    case 0x89:
+    case 0xC6:
+    case 0xC7:
+    // Group 2 - shifts and rotates
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3:
+      return is_register;
+    // Group 3 - TEST r/m, imm; NOT; NEG
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0 ||
+             ((instruction->mod_rm.reg == 2 || instruction->mod_rm.reg == 3) &&
+              is_register);
+    // TEST r/m, reg; MOV reg, r/m; LEA
+    case 0x84:
+    case 0x85:
+    case 0x8A:
+    case 0x8B:
+    case 0x8D:
+    // XCHG AX, reg
+    case 0x90:
+    case 0x91:
+    case 0x92:
+    case 0x93:
+    case 0x94:
+    case 0x95:
+    case 0x96:
+    case 0x97:
+    // CBW; CWD; SAHF; LAHF
+    case 0x98:
+    case 0x99:
+    case 0x9E:
+    case 0x9F:
+    // MOV AL/AX, moffs; TEST AL/AX, imm
+    case 0xA0:
+    case 0xA1:
+    case 0xA8:
+    case 0xA9:
+    // XLAT
+    case 0xD7:
+    // IN AL/AX, imm8; IN AL/AX, DX
+    case 0xE4:
+    case 0xE5:
+    case 0xEC:
+    case 0xED:
+    // CMC; CLC; STC; CLD; STD
+    case 0xF5:
+    case 0xF8:
+    case 0xF9:
+    case 0xFC:
+    case 0xFD:
+      return true;
+    default:
+      // MOV reg, imm
+      return opcode >= 0xB0 && opcode <= 0xBF;
+  }
+}
+
+// Returns the kind of fused sequence starting with an instruction. next is the
+// following instruction in the block, or NULL if there is none.
+static CPUFusionKind GetFusionKind(
+    const Instruction* instruction, const Instruction* next) {
+  if (IsZeroRegister(instruction)) {
+    return kCPUFusionZeroRegister;
+  }
+  if (!next) {
+    return kCPUFusionNone;
+  }
+  if (IsConditionalJump(next)) {
+    if (IsCompare(instruction)) {
+      return kCPUFusionCompareJump;
+    }
+    if (IsIncDecRegister(instruction)) {
+      return kCPUFusionIncDecJump;
+    }
+  }
+  // The LODS may have a segment override prefix, but the STOS may not be
+  // repeated.
+  if (((instruction->opcode == 0xAC && next->opcode == 0xAA) ||
+       (instruction->opcode == 0xAD && next->opcode == 0xAB)) &&
+      next->prefix_size == 0) {
+    return kCPUFusionLoadStore;
+  }
+  return kCPUFusionNone;
+}
+
+YAX86_PRIVATE void FuseBlockInstructions(CPUBlock* block) {
+  block->is_read_only = true;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const Instruction* next = i + 1 < block->num_instructions
+                                  ? &block->instructions[i + 1].instruction
+                                  : NULL;
+    block->instructions[i].fusion =
+        GetFusionKind(&block->instructions[i].instruction, next);
+    if (!IsReadOnlyInstruction(&block->instructions[i].instruction)) {
+      block->is_read_only = false;
+    }
+  }
+  // The block branches back to its own start if the branch offset is minus
+  // the size of the block.
+  const Instruction* last =
+      &block->instructions[block->num_instructions - 1].instruction;
+  block->is_loop = IsShortBranch(last) &&
+                   (int32_t)(int8_t)last->immediate[0] == -(int32_t)block->size;
+}
+
+// Sign-extend a value of a given width.
+static inline int32_t SignExtend(uint32_t value, Width width) {
+  return (int32_t)((value & kMaxValue[width]) ^ kSignBit[width]) -
+         (int32_t)kSignBit[width];
+}
+
+YAX86_PRIVATE bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken) {
+  const Width width = (Width)lazy_flags->width;
+  const uint32_t result = lazy_flags->result & kMaxValue[width];
+  // CMP without borrow, or TEST.
+  const bool is_compare = lazy_flags->op == kLazyFlagsSub &&
+                          !lazy_flags->did_carry &&
+                          lazy_flags->pending == kArithmeticFlags;
+  const bool is_test = lazy_flags->op == kLazyFlagsBoolean &&
+                       lazy_flags->pending == (kArithmeticFlags & ~kAF);
+  const int32_t op1 = SignExtend(lazy_flags->op1, width);
+  const int32_t op2 = SignExtend(lazy_flags->op2, width);
+  bool condition;
+  switch (opcode & 0xFE) {
+    // JC / JNC
+    case 0x72:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition =
+          is_compare && lazy_flags->op1 < (lazy_flags->op2 & kMaxValue[width]);
+      break;
+    // JZ / JNZ
+    case 0x74:
+      if (!(lazy_flags->pending & kZF)) {
+        return false;
+      }
+      condition = result == 0;
+      break;
+    // JBE / JA
+    case 0x76:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? lazy_flags->op1 <=
+                                   (lazy_flags->op2 & kMaxValue[width])
+                             : result == 0;
+      break;
+    // JS / JNS
+    case 0x78:
+      if (!(lazy_flags->pending & kSF)) {
+        return false;
+      }
+      condition = (result & kSignBit[width]) != 0;
+      break;
+    // JL / JGE
+    case 0x7C:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 < op2 : (result & kSignBit[width]) != 0;
+      break;
+    // JLE / JG
+    case 0x7E:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 <= op2
+                             : result == 0 || (result & kSignBit[width]) != 0;
+      break;
+    // JO, JP and their negations
+    default:
+      return false;
+  }
+  // Even opcode => jump if the condition is true
+  // Odd opcode => jump if the condition is false
+  *is_taken = condition == ((opcode & 0x1) == 0);
+  return true;
+}
+
+YAX86_PRIVATE void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width) {
+  const uint8_t reg = instruction->mod_rm.reg;
+  if (width == kWord) {
+    cpu->registers[reg] = 0;
+  } else if (reg < 4) {
+    cpu->registers[reg] &= 0xFF00;
+  } else {
+    cpu->registers[reg - 4] &= 0x00FF;
+  }
+  // The flags of x - x and x ^ x don't depend on x.
+  SetLazyFlags(
+      cpu, instruction->opcode < 0x30 ? kLazyFlagsSub : kLazyFlagsBoolean,
+      width, 0, 0, 0, false);
+}
+
+// Returns whether the CPU state matches a loop snapshot.
+static bool MatchesLoopSnapshot(
+    const CPUState* cpu, const LoopSnapshot* snapshot) {
+  for (int i = 0; i < kNumRegisters; ++i) {
+    if (cpu->registers[i] != snapshot->registers[i]) {
+      return false;
+    }
+  }
+  const CPULazyFlags* a = &cpu->lazy_flags;
+  const CPULazyFlags* b = &snapshot->lazy_flags;
+  return cpu->flags == snapshot->flags && a->pending == b->pending &&
+         a->op == b->op && a->width == b->width &&
+         a->did_carry == b->did_carry && a->op1 == b->op1 &&
+         a->op2 == b->op2 && a->result == b->result &&
+         cpu->num_unstable_port_reads == snapshot->num_unstable_port_reads;
+}
+
+YAX86_PRIVATE uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles) {
+  // A LOOP instruction branching to itself only counts down CX. Skip all but
+  // the last iteration, which leaves the loop.
+  if (block->num_instructions == 1 &&
+      block->instructions[0].instruction.opcode == 0xE2) {
+    uint32_t num_iterations = (uint32_t)cpu->registers[kCX] - 1;
+    if (num_iterations > max_iterations) {
+      num_iterations = max_iterations;
+    }
+    cpu->registers[kCX] -= num_iterations;
+    cpu->cycles += num_iterations * iteration_cycles;
+    return num_iterations;
+  }
+  if (!block->is_read_only) {
+    return 0;
+  }
+  // If the last iteration left the CPU state unchanged, without reading from
+  // ports that may have changed, every further iteration does the same.
+  if (snapshot->block == block && MatchesLoopSnapshot(cpu, snapshot)) {
+    cpu->cycles += max_iterations * iteration_cycles;
+    cpu->idle_cycles += max_iterations * iteration_cycles;
+    return max_iterations;
+  }
+  snapshot->block = block;
+  for (int i = 0; i < kNumRegisters; ++i) {
+    snapshot->registers[i] = cpu->registers[i];
+  }
+  snapshot->flags = cpu->flags;
+  snapshot->lazy_flags = cpu->lazy_flags;
+  snapshot->num_unstable_port_reads = cpu->num_unstable_port_reads;
+  return 0;
+}
+
+
+// ==============================================================================
+// src/cpu/fusion.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/timing.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/timing.h"
+#ifndef YAX86_CPU_TIMING_H
+#define YAX86_CPU_TIMING_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed, given IP after the instruction was fetched and CX before it
+// was executed.
+extern uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles an instruction takes regardless of
+// the CPU state, i.e. when it does not branch and shifts by 0 bits. The time
+// of repeated string instructions other than their prefixes is all variable,
+// as they may run over several instruction cycles.
+extern uint32_t GetInstructionBaseClockCycles(const Instruction* instruction);
+
+// Returns whether an instruction may take more clock cycles than its base
+// clock cycles depending on the CPU state.
+extern bool HasVariableClockCycles(const Instruction* instruction);
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed on top of its base clock cycles, with the same arguments as
+// GetInstructionClockCycles().
+extern uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles a short branch takes on top of its
+// base clock cycles when it transfers control, or 0 if the instruction is not
+// a short branch.
+extern uint32_t GetBranchTakenVariableClockCycles(
+    const Instruction* instruction);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_TIMING_H
+
+
+// ==============================================================================
+// src/cpu/timing.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/timing.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/timing.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction timing
+// ============================================================================
+
+enum {
+  // Opcodes of the first and last conditional jumps, JO and JG.
+  kOpcodeJO = 0x70,
+  kOpcodeJG = 0x7F,
+  // Opcodes of the first and last string instructions, MOVSB and SCASW.
+  kOpcodeMOVSB = 0xA4,
+  kOpcodeSCASW = 0xAF,
+  // Opcode of INTO.
+  kOpcodeINTO = 0xCE,
+  // Opcodes of shifts and rotates by CL.
+  kOpcodeShiftByteByCL = 0xD2,
+  kOpcodeShiftWordByCL = 0xD3,
+  // Value of the ModR/M MOD field for register operands.
+  kModRMModRegister = 3,
+  // Value of the ModR/M REG field for CMP in Group 1 instructions.
+  kModRMRegCMP = 7,
+
+  // Clock cycles taken by a short conditional jump when it transfers control.
+  kConditionalJumpTakenCycles = 16,
+  // Clock cycles taken by each segment override or LOCK prefix.
+  kPrefixCycles = 2,
+  // Clock cycles taken by a repeated string instruction on top of the time
+  // per iteration.
+  kRepeatedStringBaseCycles = 9,
+  // Clock cycles taken per bit by shifts and rotates by CL.
+  kShiftByCLCyclesPerBit = 4,
+  // Clock cycles taken by CMP r/m8, imm8 and CMP r/m16, imm16 with a memory
+  // operand, which do not write back to memory.
+  kCompareImmediateByteMemoryCycles = 10,
+  kCompareImmediateWordMemoryCycles = 14,
+};
+
+// Clock cycles taken by each instruction on the 8088, indexed by opcode. These
+// are the 8086 timings from the Intel datasheet, plus 4 clock cycles for each
+// word transferred over the 8088's 8-bit bus. Conditional branches are listed
+// with the time taken when not branching.
+static const InstructionTiming kInstructionTimings[256] = {
+    {3, 16},   // 0x00 ADD r/m8, r8
+    {3, 24},   // 0x01 ADD r/m16, r16
+    {3, 9},    // 0x02 ADD r8, r/m8
+    {3, 13},   // 0x03 ADD r16, r/m16
+    {4, 4},    // 0x04 ADD AL, imm8
+    {4, 4},    // 0x05 ADD AX, imm16
+    {14, 14},  // 0x06 PUSH ES
+    {12, 12},  // 0x07 POP ES
+    {3, 16},   // 0x08 OR r/m8, r8
+    {3, 24},   // 0x09 OR r/m16, r16
+    {3, 9},    // 0x0A OR r8, r/m8
+    {3, 13},   // 0x0B OR r16, r/m16
+    {4, 4},    // 0x0C OR AL, imm8
+    {4, 4},    // 0x0D OR AX, imm16
+    {14, 14},  // 0x0E PUSH CS
+    {2, 2},    // 0x0F unsupported
+    {3, 16},   // 0x10 ADC r/m8, r8
+    {3, 24},   // 0x11 ADC r/m16, r16
+    {3, 9},    // 0x12 ADC r8, r/m8
+    {3, 13},   // 0x13 ADC r16, r/m16
+    {4, 4},    // 0x14 ADC AL, imm8
+    {4, 4},    // 0x15 ADC AX, imm16
+    {14, 14},  // 0x16 PUSH SS
+    {12, 12},  // 0x17 POP SS
+    {3, 16},   // 0x18 SBB r/m8, r8
+    {3, 24},   // 0x19 SBB r/m16, r16
+    {3, 9},    // 0x1A SBB r8, r/m8
+    {3, 13},   // 0x1B SBB r16, r/m16
+    {4, 4},    // 0x1C SBB AL, imm8
+    {4, 4},    // 0x1D SBB AX, imm16
+    {14, 14},  // 0x1E PUSH DS
+    {12, 12},  // 0x1F POP DS
+    {3, 16},   // 0x20 AND r/m8, r8
+    {3, 24},   // 0x21 AND r/m16, r16
+    {3, 9},    // 0x22 AND r8, r/m8
+    {3, 13},   // 0x23 AND r16, r/m16
+    {4, 4},    // 0x24 AND AL, imm8
+    {4, 4},    // 0x25 AND AX, imm16
+    {2, 2},    // 0x26 ES prefix
+    {4, 4},    // 0x27 DAA
+    {3, 16},   // 0x28 SUB r/m8, r8
+    {3, 24},   // 0x29 SUB r/m16, r16
+    {3, 9},    // 0x2A SUB r8, r/m8
+    {3, 13},   // 0x2B SUB r16, r/m16
+    {4, 4},    // 0x2C SUB AL, imm8
+    {4, 4},    // 0x2D SUB AX, imm16
+    {2, 2},    // 0x2E CS prefix
+    {4, 4},    // 0x2F DAS
+    {3, 16},   // 0x30 XOR r/m8, r8
+    {3, 24},   // 0x31 XOR r/m16, r16
+    {3, 9},    // 0x32 XOR r8, r/m8
+    {3, 13},   // 0x33 XOR r16, r/m16
+    {4, 4},    // 0x34 XOR AL, imm8
+    {4, 4},    // 0x35 XOR AX, imm16
+    {2, 2},    // 0x36 SS prefix
+    {4, 4},    // 0x37 AAA
+    {3, 9},    // 0x38 CMP r/m8, r8
+    {3, 13},   // 0x39 CMP r/m16, r16
+    {3, 9},    // 0x3A CMP r8, r/m8
+    {3, 13},   // 0x3B CMP r16, r/m16
+    {4, 4},    // 0x3C CMP AL, imm8
+    {4, 4},    // 0x3D CMP AX, imm16
+    {2, 2},    // 0x3E DS prefix
+    {4, 4},    // 0x3F AAS
+    {2, 2},    // 0x40 INC AX
+    {2, 2},    // 0x41 INC CX
+    {2, 2},    // 0x42 INC DX
+    {2, 2},    // 0x43 INC BX
+    {2, 2},    // 0x44 INC SP
+    {2, 2},    // 0x45 INC BP
+    {2, 2},    // 0x46 INC SI
+    {2, 2},    // 0x47 INC DI
+    {2, 2},    // 0x48 DEC AX
+    {2, 2},    // 0x49 DEC CX
+    {2, 2},    // 0x4A DEC DX
+    {2, 2},    // 0x4B DEC BX
+    {2, 2},    // 0x4C DEC SP
+    {2, 2},    // 0x4D DEC BP
+    {2, 2},    // 0x4E DEC SI
+    {2, 2},    // 0x4F DEC DI
+    {15, 15},  // 0x50 PUSH AX
+    {15, 15},  // 0x51 PUSH CX
+    {15, 15},  // 0x52 PUSH DX
+    {15, 15},  // 0x53 PUSH BX
+    {15, 15},  // 0x54 PUSH SP
+    {15, 15},  // 0x55 PUSH BP
+    {15, 15},  // 0x56 PUSH SI
+    {15, 15},  // 0x57 PUSH DI
+    {12, 12},  // 0x58 POP AX
+    {12, 12},  // 0x59 POP CX
+    {12, 12},  // 0x5A POP DX
+    {12, 12},  // 0x5B POP BX
+    {12, 12},  // 0x5C POP SP
+    {12, 12},  // 0x5D POP BP
+    {12, 12},  // 0x5E POP SI
+    {12, 12},  // 0x5F POP DI
+    {2, 2},    // 0x60 unsupported
+    {2, 2},    // 0x61 unsupported
+    {2, 2},    // 0x62 unsupported
+    {2, 2},    // 0x63 unsupported
+    {2, 2},    // 0x64 unsupported
+    {2, 2},    // 0x65 unsupported
+    {2, 2},    // 0x66 unsupported
+    {2, 2},    // 0x67 unsupported
+    {2, 2},    // 0x68 unsupported
+    {2, 2},    // 0x69 unsupported
+    {2, 2},    // 0x6A unsupported
+    {2, 2},    // 0x6B unsupported
+    {2, 2},    // 0x6C unsupported
+    {2, 2},    // 0x6D unsupported
+    {2, 2},    // 0x6E unsupported
+    {2, 2},    // 0x6F unsupported
+    {4, 4},    // 0x70 JO rel8
+    {4, 4},    // 0x71 JNO rel8
+    {4, 4},    // 0x72 JB/JNAE/JC rel8
+    {4, 4},    // 0x73 JNB/JAE/JNC rel8
+    {4, 4},    // 0x74 JE/JZ rel8
+    {4, 4},    // 0x75 JNE/JNZ rel8
+    {4, 4},    // 0x76 JBE/JNA rel8
+    {4, 4},    // 0x77 JNBE/JA rel8
+    {4, 4},    // 0x78 JS rel8
+    {4, 4},    // 0x79 JNS rel8
+    {4, 4},    // 0x7A JP/JPE rel8
+    {4, 4},    // 0x7B JNP/JPO rel8
+    {4, 4},    // 0x7C JL/JNGE rel8
+    {4, 4},    // 0x7D JNL/JGE rel8
+    {4, 4},    // 0x7E JLE/JNG rel8
+    {4, 4},    // 0x7F JNLE/JG rel8
+    {4, 17},   // 0x80 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x81 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm16 (Group 1)
+    {4, 17},   // 0x82 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x83 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm8 (Group 1)
+    {3, 9},    // 0x84 TEST r/m8, r8
+    {3, 13},   // 0x85 TEST r/m16, r16
+    {4, 17},   // 0x86 XCHG r/m8, r8
+    {4, 25},   // 0x87 XCHG r/m16, r16
+    {2, 9},    // 0x88 MOV r/m8, r8
+    {2, 13},   // 0x89 MOV r/m16, r16
+    {2, 8},    // 0x8A MOV r8, r/m8
+    {2, 12},   // 0x8B MOV r16, r/m16
+    {2, 13},   // 0x8C MOV r/m16, sreg
+    {2, 2},    // 0x8D LEA r16, m
+    {2, 12},   // 0x8E MOV sreg, r/m16
+    {12, 25},  // 0x8F POP r/m16
+    {3, 3},    // 0x90 XCHG AX, AX (NOP)
+    {3, 3},    // 0x91 XCHG AX, CX
+    {3, 3},    // 0x92 XCHG AX, DX
+    {3, 3},    // 0x93 XCHG AX, BX
+    {3, 3},    // 0x94 XCHG AX, SP
+    {3, 3},    // 0x95 XCHG AX, BP
+    {3, 3},    // 0x96 XCHG AX, SI
+    {3, 3},    // 0x97 XCHG AX, DI
+    {2, 2},    // 0x98 CBW
+    {5, 5},    // 0x99 CWD
+    {36, 36},  // 0x9A CALL ptr16:16
+    {4, 4},    // 0x9B WAIT
+    {14, 14},  // 0x9C PUSHF
+    {12, 12},  // 0x9D POPF
+    {4, 4},    // 0x9E SAHF
+    {4, 4},    // 0x9F LAHF
+    {10, 10},  // 0xA0 MOV AL, moffs16
+    {14, 14},  // 0xA1 MOV AX, moffs16
+    {10, 10},  // 0xA2 MOV moffs16, AL
+    {14, 14},  // 0xA3 MOV moffs16, AX
+    {18, 18},  // 0xA4 MOVSB
+    {26, 26},  // 0xA5 MOVSW
+    {22, 22},  // 0xA6 CMPSB
+    {30, 30},  // 0xA7 CMPSW
+    {4, 4},    // 0xA8 TEST AL, imm8
+    {4, 4},    // 0xA9 TEST AX, imm16
+    {11, 11},  // 0xAA STOSB
+    {15, 15},  // 0xAB STOSW
+    {12, 12},  // 0xAC LODSB
+    {16, 16},  // 0xAD LODSW
+    {15, 15},  // 0xAE SCASB
+    {19, 19},  // 0xAF SCASW
+    {4, 4},    // 0xB0 MOV AL, imm8
+    {4, 4},    // 0xB1 MOV CL, imm8
+    {4, 4},    // 0xB2 MOV DL, imm8
+    {4, 4},    // 0xB3 MOV BL, imm8
+    {4, 4},    // 0xB4 MOV AH, imm8
+    {4, 4},    // 0xB5 MOV CH, imm8
+    {4, 4},    // 0xB6 MOV DH, imm8
+    {4, 4},    // 0xB7 MOV BH, imm8
+    {4, 4},    // 0xB8 MOV AX, imm16
+    {4, 4},    // 0xB9 MOV CX, imm16
+    {4, 4},    // 0xBA MOV DX, imm16
+    {4, 4},    // 0xBB MOV BX, imm16
+    {4, 4},    // 0xBC MOV SP, imm16
+    {4, 4},    // 0xBD MOV BP, imm16
+    {4, 4},    // 0xBE MOV SI, imm16
+    {4, 4},    // 0xBF MOV DI, imm16
+    {2, 2},    // 0xC0 unsupported
+    {2, 2},    // 0xC1 unsupported
+    {24, 24},  // 0xC2 RET imm16
+    {20, 20},  // 0xC3 RET
+    {24, 24},  // 0xC4 LES r16, m32
+    {24, 24},  // 0xC5 LDS r16, m32
+    {4, 10},   // 0xC6 MOV r/m8, imm8
+    {4, 14},   // 0xC7 MOV r/m16, imm16
+    {2, 2},    // 0xC8 unsupported
+    {2, 2},    // 0xC9 unsupported
+    {33, 33},  // 0xCA RETF imm16
+    {34, 34},  // 0xCB RETF
+    {72, 72},  // 0xCC INT 3
+    {71, 71},  // 0xCD INT imm8
+    {4, 4},    // 0xCE INTO
+    {44, 44},  // 0xCF IRET
+    {2, 15},   // 0xD0 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, 1 (Group 2)
+    {2, 23},   // 0xD1 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, 1 (Group 2)
+    {8, 20},   // 0xD2 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, CL (Group 2)
+    {8, 28},   // 0xD3 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, CL (Group 2)
+    {83, 83},  // 0xD4 AAM
+    {60, 60},  // 0xD5 AAD
+    {2, 2},    // 0xD6 unsupported
+    {11, 11},  // 0xD7 XLAT/XLATB
+    {2, 8},    // 0xD8 ESC instruction 0xD8 for 8087 numeric coprocessor
+    {2, 8},    // 0xD9 ESC instruction 0xD9 for 8087 numeric coprocessor
+    {2, 8},    // 0xDA ESC instruction 0xDA for 8087 numeric coprocessor
+    {2, 8},    // 0xDB ESC instruction 0xDB for 8087 numeric coprocessor
+    {2, 8},    // 0xDC ESC instruction 0xDC for 8087 numeric coprocessor
+    {2, 8},    // 0xDD ESC instruction 0xDD for 8087 numeric coprocessor
+    {2, 8},    // 0xDE ESC instruction 0xDE for 8087 numeric coprocessor
+    {2, 8},    // 0xDF ESC instruction 0xDF for 8087 numeric coprocessor
+    {5, 5},    // 0xE0 LOOPNE/LOOPNZ rel8
+    {6, 6},    // 0xE1 LOOPE/LOOPZ rel8
+    {5, 5},    // 0xE2 LOOP rel8
+    {6, 6},    // 0xE3 JCXZ rel8
+    {10, 10},  // 0xE4 IN AL, imm8
+    {14, 14},  // 0xE5 IN AX, imm8
+    {10, 10},  // 0xE6 OUT imm8, AL
+    {14, 14},  // 0xE7 OUT imm8, AX
+    {23, 23},  // 0xE8 CALL rel16
+    {15, 15},  // 0xE9 JMP rel16
+    {15, 15},  // 0xEA JMP ptr16:16
+    {15, 15},  // 0xEB JMP rel8
+    {8, 8},    // 0xEC IN AL, DX
+    {12, 12},  // 0xED IN AX, DX
+    {8, 8},    // 0xEE OUT DX, AL
+    {12, 12},  // 0xEF OUT DX, AX
+    {2, 2},    // 0xF0 LOCK prefix
+    {2, 2},    // 0xF1 unsupported
+    {2, 2},    // 0xF2 REPNE prefix
+    {2, 2},    // 0xF3 REP/REPE prefix
+    {2, 2},    // 0xF4 HLT
+    {2, 2},    // 0xF5 CMC
+    {5, 11},   // 0xF6 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m8 (Group 3)
+    {5, 15},   // 0xF7 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m16 (Group 3)
+    {2, 2},    // 0xF8 CLC
+    {2, 2},    // 0xF9 STC
+    {2, 2},    // 0xFA CLI
+    {2, 2},    // 0xFB STI
+    {2, 2},    // 0xFC CLD
+    {2, 2},    // 0xFD STD
+    {3, 15},   // 0xFE INC/DEC r/m8 (Group 4)
+    {3, 23},   // 0xFF INC/DEC/CALL/JMP/PUSH r/m16 (Group 5)
+};
+
+// Clock cycles taken by group 3 instructions on byte operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3ByteTimings[8] = {
+    {5, 11},     // TEST r/m8, imm8
+    {5, 11},     // TEST r/m8, imm8
+    {3, 16},     // NOT r/m8
+    {3, 16},     // NEG r/m8
+    {77, 83},    // MUL r/m8
+    {98, 104},   // IMUL r/m8
+    {90, 96},    // DIV r/m8
+    {112, 118},  // IDIV r/m8
+};
+
+// Clock cycles taken by group 3 instructions on word operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3WordTimings[8] = {
+    {5, 15},     // TEST r/m16, imm16
+    {5, 15},     // TEST r/m16, imm16
+    {3, 24},     // NOT r/m16
+    {3, 24},     // NEG r/m16
+    {133, 143},  // MUL r/m16
+    {154, 164},  // IMUL r/m16
+    {162, 172},  // DIV r/m16
+    {184, 194},  // IDIV r/m16
+};
+
+// Clock cycles taken by group 5 instructions, indexed by the REG field of the
+// ModR/M byte.
+static const InstructionTiming kGroup5Timings[8] = {
+    {3, 23},   // INC r/m16
+    {3, 23},   // DEC r/m16
+    {20, 29},  // CALL r/m16
+    {53, 53},  // CALL m16:16
+    {11, 18},  // JMP r/m16
+    {24, 24},  // JMP m16:16
+    {15, 24},  // PUSH r/m16
+    {2, 2},    // unsupported
+};
+
+// Clock cycles taken to compute the effective address of a memory operand,
+// indexed by whether the operand has a displacement and by the R/M field of
+// the ModR/M byte.
+static const uint8_t kEffectiveAddressCycles[2][8] = {
+    // [BX+SI], [BX+DI], [BP+SI], [BP+DI], [SI], [DI], [disp16], [BX]
+    {7, 8, 8, 7, 5, 5, 6, 5},
+    // The same plus an 8-bit or 16-bit displacement, with [BP+disp] for 6.
+    {11, 12, 12, 11, 9, 9, 9, 9},
+};
+
+// Clock cycles taken per iteration of repeated string instructions, indexed by
+// opcode - kOpcodeMOVSB. A repeated string instruction takes
+// kRepeatedStringBaseCycles plus this per iteration.
+static const uint8_t kRepeatedStringCycles[kOpcodeSCASW - kOpcodeMOVSB + 1] = {
+    17, 25,  // MOVSB, MOVSW
+    22, 30,  // CMPSB, CMPSW
+    0,  0,   // TEST AL, imm8 and TEST AX, imm16
+    10, 14,  // STOSB, STOSW
+    13, 17,  // LODSB, LODSW
+    15, 19,  // SCASB, SCASW
+};
+
+// Returns the clock cycles taken by a short branch or INTO when it transfers
+// control, or 0 if the instruction is not one of them.
+static uint8_t GetBranchTakenCycles(uint8_t opcode) {
+  if (opcode >= kOpcodeJO && opcode <= kOpcodeJG) {
+    return kConditionalJumpTakenCycles;
+  }
+  switch (opcode) {
+    case kOpcodeINTO:
+      return 73;
+    case 0xE0:  // LOOPNZ
+      return 19;
+    case 0xE1:  // LOOPZ
+      return 18;
+    case 0xE2:  // LOOP
+      return 17;
+    case 0xE3:  // JCXZ
+      return 18;
+    default:
+      return 0;
+  }
+}
+
+// Returns whether an instruction has a REP or REPNZ prefix.
+static bool IsRepeated(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the clock cycles taken per iteration of a repeated string
+// instruction, or 0 if the instruction is not one.
+static uint8_t GetRepeatedStringCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  if (opcode < kOpcodeMOVSB || opcode > kOpcodeSCASW ||
+      !IsRepeated(instruction)) {
+    return 0;
+  }
+  return kRepeatedStringCycles[opcode - kOpcodeMOVSB];
+}
+
+YAX86_PRIVATE uint32_t GetInstructionBaseClockCycles(
+    const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  InstructionTiming timing = kInstructionTimings[opcode];
+  uint32_t cycles = 0;
+
+  // Segment override and LOCK prefixes take clock cycles of their own.
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] != kPrefixREP &&
+        instruction->prefix[i] != kPrefixREPNZ) {
+      cycles += kPrefixCycles;
+    }
+  }
+
+  // Repeated string instructions may run in several instruction cycles, so
+  // all of their time is counted as variable clock cycles.
+  if (GetRepeatedStringCycles(instruction)) {
+    return cycles;
+  }
+
+  // Instructions in groups take different times depending on the operation.
+  switch (opcode) {
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      // CMP r/m, imm does not write back to memory.
+      if (mod_rm->reg == kModRMRegCMP) {
+        timing.memory_cycles = (opcode & 1) ? kCompareImmediateWordMemoryCycles
+                                            : kCompareImmediateByteMemoryCycles;
+      }
+      break;
+    case 0xF6:
+      timing = kGroup3ByteTimings[mod_rm->reg];
+      break;
+    case 0xF7:
+      timing = kGroup3WordTimings[mod_rm->reg];
+      break;
+    case 0xFF:
+      timing = kGroup5Timings[mod_rm->reg];
+      break;
+    default:
+      break;
+  }
+
+  if (instruction->has_mod_rm && mod_rm->mod != kModRMModRegister) {
+    return cycles + timing.memory_cycles +
+           kEffectiveAddressCycles[mod_rm->mod != 0][mod_rm->rm];
+  }
+  return cycles + timing.register_cycles;
+}
+
+YAX86_PRIVATE bool HasVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  return GetBranchTakenCycles(opcode) || opcode == kOpcodeShiftByteByCL ||
+         opcode == kOpcodeShiftWordByCL || GetRepeatedStringCycles(instruction);
+}
+
+YAX86_PRIVATE uint32_t
+GetBranchTakenVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const uint8_t branch_taken_cycles = GetBranchTakenCycles(opcode);
+  if (!branch_taken_cycles) {
+    return 0;
+  }
+  return branch_taken_cycles - kInstructionTimings[opcode].register_cycles;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint8_t opcode = instruction->opcode;
+
+  // Repeated string instructions take time per iteration run, each of which
+  // decremented CX. A long one runs in several instruction cycles, rewinding
+  // IP to itself until the last, so its base time is only counted once it
+  // completes.
+  const uint8_t repeated_string_cycles = GetRepeatedStringCycles(instruction);
+  if (repeated_string_cycles) {
+    const uint32_t iteration_cycles = (uint16_t)(cx - cpu->registers[kCX]) *
+                                      (uint32_t)repeated_string_cycles;
+    return cpu->registers[kIP] == next_ip
+               ? kRepeatedStringBaseCycles + iteration_cycles
+               : iteration_cycles;
+  }
+
+  // Shifts and rotates by CL take time per bit.
+  if (opcode == kOpcodeShiftByteByCL || opcode == kOpcodeShiftWordByCL) {
+    return kShiftByCLCyclesPerBit * (uint32_t)(cx & 0xFF);
+  }
+
+  // Short branches that were taken, and INTO when it raised an interrupt, take
+  // longer than the table entries.
+  if (opcode == kOpcodeINTO ? cpu->has_pending_interrupt
+                     : cpu->registers[kIP] != next_ip) {
+    return GetBranchTakenVariableClockCycles(instruction);
+  }
+  return 0;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  return GetInstructionBaseClockCycles(instruction) +
+         GetInstructionVariableClockCycles(cpu, instruction, next_ip, cx);
+}
+
+
+// ==============================================================================
+// src/cpu/timing.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/operands.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/operands.h"
+#ifndef YAX86_CPU_OPERANDS_H
+#define YAX86_CPU_OPERANDS_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Helper function to construct an OperandValue for a byte.
+extern OperandValue ByteValue(uint8_t byte_value);
+
+// Helper function to construct OperandValue for a word.
+extern OperandValue WordValue(uint16_t word_value);
+
+// Helper function to construct OperandValue given a Width and a value.
+extern OperandValue ToOperandValue(Width width, uint32_t raw_value);
+
+// Helper function to zero-extend OperandValue to a 32-bit value. This makes it
+// simpler to do direct arithmetic without worrying about overflow.
+extern uint32_t FromOperandValue(const OperandValue* value);
+
+// Helper function to sign-extend OperandValue to a 32-bit value. This makes it
+// simpler to do direct arithmetic without worrying about overflow.
+extern int32_t FromSignedOperandValue(const OperandValue* value);
+
+// Helper function to extract a zero-extended value from an operand.
+extern uint32_t FromOperand(const Operand* operand);
+
+// Helper function to extract a sign-extended value from an operand.
+extern int32_t FromSignedOperand(const Operand* operand);
+
+// Computes the raw effective address corresponding to a MemoryAddress.
+extern uint32_t ToRawAddress(const CPUState* cpu, const MemoryAddress* address);
+
+// Read a byte from memory as a uint8_t.
+extern uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address);
+
+// Read a word from memory as a uint16_t.
+extern uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address);
+
+// Read a byte from memory as an OperandValue.
+extern OperandValue ReadMemoryOperandByte(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a word from memory as an OperandValue.
+extern OperandValue ReadMemoryOperandWord(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a byte from a register as an OperandValue.
+extern OperandValue ReadRegisterOperandByte(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a word from a register as an OperandValue.
+extern OperandValue ReadRegisterOperandWord(
+    CPUState* cpu, const OperandAddress* address);
+
+// Write a byte as uint8_t to memory.
+extern void WriteRawMemoryByte(CPUState* cpu, uint32_t address, uint8_t value);
+
+// Write a word as uint16_t to memory.
+extern void WriteRawMemoryWord(CPUState* cpu, uint32_t address, uint16_t value);
+
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for reading, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL.
+extern const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for writing, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL. The caller must invalidate cached code
+// with InvalidateCachesOnWrite() before writing.
+extern uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Invalidate cached instructions and blocks overlapping size bytes of memory
+// starting at a linear address.
+extern void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Write a byte to memory.
+extern void WriteMemoryOperandByte(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a word to memory.
+extern void WriteMemoryOperandWord(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a byte to a register.
+extern void WriteRegisterOperandByte(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a word to a register.
+extern void WriteRegisterOperandWord(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Add an 8-bit signed relative offset to a 16-bit unsigned base address.
+extern uint16_t AddSignedOffsetByte(uint16_t base, uint8_t raw_offset);
+
+// Add a 16-bit signed relative offset to a 16-bit unsigned base address.
+extern uint16_t AddSignedOffsetWord(uint16_t base, uint16_t raw_offset);
+
+// Get the register operand for a byte instruction based on the ModR/M byte's
+// reg or R/M field.
+extern RegisterAddress GetRegisterAddressByte(CPUState* cpu, uint8_t reg_or_rm);
+
+// Get the register operand for a word instruction based on the ModR/M byte's
+// reg or R/M field.
+extern RegisterAddress GetRegisterAddressWord(CPUState* cpu, uint8_t reg_or_rm);
+
+// Apply segment override prefixes to a MemoryAddress.
+extern void ApplySegmentOverride(
+    const Instruction* instruction, MemoryAddress* address);
+
+// Resolve the effective address mode, displacement and segment register of
+// an instruction's memory operand from its prefixes, ModR/M byte and
+// displacement bytes.
+extern void ResolveMemoryOperand(Instruction* instruction);
+
+// Compute the memory address for an instruction.
+extern MemoryAddress GetMemoryOperandAddress(
+    CPUState* cpu, const Instruction* instruction);
+
+// Get a register or memory operand address based on the ModR/M byte and
+// displacement.
+extern OperandAddress GetRegisterOrMemoryOperandAddress(
+    CPUState* cpu, const Instruction* instruction, Width width);
+
+// Read an 8-bit immediate value.
+extern OperandValue ReadImmediateOperandByte(const Instruction* instruction);
+
+// Read a 16-bit immediate value.
+extern OperandValue ReadImmediateOperandWord(const Instruction* instruction);
+
+// Table of GetRegisterAddress functions, indexed by Width.
+extern RegisterAddress (*const kGetRegisterAddressFn[kNumWidths])(
+    CPUState* cpu, uint8_t reg_or_rm);
+
+// Table of Read* functions, indexed by OperandAddressType and Width.
+extern OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
+    CPUState* cpu, const OperandAddress* address);
+
+// Table of Write* functions, indexed by OperandAddressType and Width.
+extern void (*const kWriteOperandFn[kNumOperandAddressTypes][kNumWidths])(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Table of ReadImmediate* functions, indexed by Width.
+extern OperandValue (*const kReadImmediateValueFn[kNumWidths])(
+    const Instruction* instruction);
+
+// Read a value from an operand address.
+extern OperandValue ReadOperandValue(
+    const InstructionContext* ctx, const OperandAddress* address);
+
+// Get a register or memory operand for an instruction based on the ModR/M
+// byte and displacement.
+extern Operand ReadRegisterOrMemoryOperand(const InstructionContext* ctx);
+
+// Get a register operand for an instruction.
+extern Operand ReadRegisterOperandForRegisterIndex(
+    const InstructionContext* ctx, RegisterIndex register_index);
+
+// Get a register operand for an instruction from the REG field of the Mod/RM
+// byte.
+extern Operand ReadRegisterOperand(const InstructionContext* ctx);
+
+// Get a segment register operand for an instruction from the REG field of the
+// Mod/RM byte.
+extern Operand ReadSegmentRegisterOperand(const InstructionContext* ctx);
+
+// Write a value to a register or memory operand address.
+extern void WriteOperandAddress(
+    const InstructionContext* ctx, const OperandAddress* address,
+    uint32_t raw_value);
+
+// Write a value to a register or memory operand.
+extern void WriteOperand(
+    const InstructionContext* ctx, const Operand* operand, uint32_t raw_value);
+
+// Read an immediate value from the instruction.
+extern OperandValue ReadImmediate(const InstructionContext* ctx);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_OPERANDS_H
+
+
+// ==============================================================================
+// src/cpu/operands.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/operands.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/operands.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "operands.h"
+
+#include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// Helper functions to construct OperandValue.
+YAX86_PRIVATE OperandValue ByteValue(uint8_t byte_value) {
+  OperandValue value = {
+      .width = kByte,
+      .value = {.byte_value = byte_value},
+  };
+  return value;
+}
+
 // Helper function to construct OperandValue for a word.
 YAX86_PRIVATE OperandValue WordValue(uint16_t word_value) {
   OperandValue value = {
@@ -794,12 +2948,20 @@ YAX86_PRIVATE int32_t FromSignedOperand(const Operand* operand) {
 // Computes the raw effective address corresponding to a MemoryAddress.
 YAX86_PRIVATE uint32_t
 ToRawAddress(const CPUState* cpu, const MemoryAddress* address) {
-  uint16_t segment = cpu->registers[address->segment_register_index];
-  return (((uint32_t)segment) << 4) + (uint32_t)(address->offset);
+  return CPUGetSegmentBase(cpu, address->segment_register_index) +
+         (uint32_t)(address->offset);
 }
 
 // Read a byte from memory as a uint8_t.
 YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return page[raw_address % kCPUMemoryPageSize];
+    }
+  }
   return cpu->config->read_memory_byte
              ? cpu->config->read_memory_byte(cpu, raw_address)
              : 0xFF;
@@ -807,6 +2969,20 @@ YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
 
 // Read a word from memory as a uint16_t.
 YAX86_PRIVATE uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address) {
+  uint32_t page_offset = raw_address % kCPUMemoryPageSize;
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return (((uint16_t)page[page_offset + 1]) << 8) |
+             (uint16_t)page[page_offset];
+    }
+  }
+  if (cpu->config->read_memory_word) {
+    return cpu->config->read_memory_word(cpu, raw_address);
+  }
   uint8_t low_byte_value = ReadRawMemoryByte(cpu, raw_address);
   uint8_t high_byte_value = ReadRawMemoryByte(cpu, raw_address + 1);
   return (((uint16_t)high_byte_value) << 8) | (uint16_t)low_byte_value;
@@ -858,17 +3034,101 @@ OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
 // Write a byte as uint8_t to memory.
 YAX86_PRIVATE void WriteRawMemoryByte(
     CPUState* cpu, uint32_t address, uint8_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[address % kCPUMemoryPageSize] = value;
+      return;
+    }
+  }
   if (!cpu->config->write_memory_byte) {
     return;
   }
   cpu->config->write_memory_byte(cpu, address, value);
 }
 
-// Write a word as uint16_t to memory.
-YAX86_PRIVATE void WriteRawMemoryWord(
-    CPUState* cpu, uint32_t address, uint16_t value) {
-  WriteRawMemoryByte(cpu, address, value & 0xFF);
-  WriteRawMemoryByte(cpu, address + 1, (value >> 8) & 0xFF);
+// Write a word as uint16_t to memory.
+YAX86_PRIVATE void WriteRawMemoryWord(
+    CPUState* cpu, uint32_t address, uint16_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateInstructionCacheOnWrite(cpu, address + 1);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address + 1);
+  uint32_t page_offset = address % kCPUMemoryPageSize;
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[page_offset] = value & 0xFF;
+      page[page_offset + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+  }
+  if (cpu->config->write_memory_word) {
+    cpu->config->write_memory_word(cpu, address, value);
+    return;
+  }
+  WriteRawMemoryByte(cpu, address, value & 0xFF);
+  WriteRawMemoryByte(cpu, address + 1, (value >> 8) & 0xFF);
+}
+
+// Returns a host pointer to size bytes of memory starting at a linear address
+// in a page table, if all pages in the range are mapped and contiguous in host
+// memory. Otherwise, returns NULL.
+static const uint8_t* GetDirectMemory(
+    const uint8_t* const* pages, uint32_t address, uint32_t size) {
+  if (!pages || size == 0 || address >= kCPUMemoryAddressSpaceSize ||
+      size > kCPUMemoryAddressSpaceSize - address) {
+    return NULL;
+  }
+  uint32_t first_page = address / kCPUMemoryPageSize;
+  uint32_t last_page = (address + size - 1) / kCPUMemoryPageSize;
+  const uint8_t* first_page_memory = pages[first_page];
+  if (!first_page_memory) {
+    return NULL;
+  }
+  for (uint32_t page = first_page + 1; page <= last_page; ++page) {
+    if (pages[page] !=
+        first_page_memory + (page - first_page) * kCPUMemoryPageSize) {
+      return NULL;
+    }
+  }
+  return first_page_memory + address % kCPUMemoryPageSize;
+}
+
+YAX86_PRIVATE const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return GetDirectMemory(cpu->config->read_memory_pages, address, size);
+}
+
+YAX86_PRIVATE uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return (uint8_t*)GetDirectMemory(
+      (const uint8_t* const*)cpu->config->write_memory_pages, address, size);
+}
+
+YAX86_PRIVATE void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+  // Invalidating one address in each cache page is sufficient.
+  uint32_t last_address = address + size - 1;
+  for (uint32_t page_address = address;
+       page_address / kCPUInstructionCachePageSize <
+       last_address / kCPUInstructionCachePageSize;
+       page_address += kCPUInstructionCachePageSize) {
+    InvalidateInstructionCacheOnWrite(cpu, page_address);
+    InvalidateBlockCacheOnWrite(cpu, page_address);
+  }
+  InvalidateInstructionCacheOnWrite(cpu, last_address);
+  InvalidateBlockCacheOnWrite(cpu, last_address);
 }
 
 // Write a byte to memory.
@@ -903,7 +3163,12 @@ YAX86_PRIVATE void WriteRegisterOperandByte(
 YAX86_PRIVATE void WriteRegisterOperandWord(
     CPUState* cpu, const OperandAddress* address, OperandValue value) {
   const RegisterAddress* register_address = &address->value.register_address;
-  cpu->registers[register_address->register_index] = value.value.word_value;
+  const RegisterIndex register_index = register_address->register_index;
+  if (register_index >= kES && register_index <= kDS) {
+    CPUSetSegmentRegister(cpu, register_index, value.value.word_value);
+  } else {
+    cpu->registers[register_index] = value.value.word_value;
+  }
 }
 
 // Table of Write* functions, indexed by OperandAddressType and Width.
@@ -995,82 +3260,109 @@ YAX86_PRIVATE void ApplySegmentOverride(
   }
 }
 
-// Compute the memory address for an instruction.
-YAX86_PRIVATE MemoryAddress
-GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
-  MemoryAddress address;
-  uint8_t mod = instruction->mod_rm.mod;
-  uint8_t rm = instruction->mod_rm.rm;
-  switch (rm) {
-    case 0:  // [BX + SI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 1:  // [BX + DI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 2:  // [BP + SI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kSI];
-      address.segment_register_index = kSS;
-      break;
-    case 3:  // [BP + DI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kDI];
-      address.segment_register_index = kSS;
-      break;
-    case 4:  // [SI]
-      address.offset = cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 5:  // [DI]
-      address.offset = cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 6:
-      if (mod == 0) {
-        // Direct memory address with 16-bit displacement
-        address.offset = 0;
-        address.segment_register_index = kDS;
-      } else {
-        // [BP]
-        address.offset = cpu->registers[kBP];
-        address.segment_register_index = kSS;
-      }
-      break;
-    case 7:  // [BX]
-      address.offset = cpu->registers[kBX];
-      address.segment_register_index = kDS;
-      break;
-    default:
-      // Not possible as RM field is 3 bits (0-7).
-      address.offset = 0xFFFF;
-      address.segment_register_index = kDS;  // Invalid RM field
-      break;
-  }
+// Registers and default segment of each ModR/M memory addressing mode,
+// indexed by mod * 8 + rm.
+static const EffectiveAddressMode
+    kEffectiveAddressModes[kNumEffectiveAddressModes] = {
+        // mod = 0, rm = 0: [BX + SI]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 0, rm = 1: [BX + DI]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 0, rm = 2: [BP + SI]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 0, rm = 3: [BP + DI]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 0, rm = 4: [SI]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 5: [DI]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 6: [disp16]
+        {kAX, 0, kAX, 0, kDS},
+        // mod = 0, rm = 7: [BX]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 0: [BX + SI + disp8]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 1, rm = 1: [BX + DI + disp8]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 1, rm = 2: [BP + SI + disp8]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 1, rm = 3: [BP + DI + disp8]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 1, rm = 4: [SI + disp8]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 5: [DI + disp8]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 6: [BP + disp8]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 1, rm = 7: [BX + disp8]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 0: [BX + SI + disp16]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 2, rm = 1: [BX + DI + disp16]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 2, rm = 2: [BP + SI + disp16]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 2, rm = 3: [BP + DI + disp16]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 2, rm = 4: [SI + disp16]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 5: [DI + disp16]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 6: [BP + disp16]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 2, rm = 7: [BX + disp16]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+};
 
-  // Apply segment override prefixes if present
+YAX86_PRIVATE void ResolveMemoryOperand(Instruction* instruction) {
+  MemoryAddress address = {
+      .segment_register_index = kDS,
+      .offset = 0,
+  };
+  if (instruction->has_mod_rm) {
+    // Register operands (mod = 3) have no memory operand, but resolve them like
+    // mod = 1 without a displacement for instructions that expect one.
+    uint8_t mod = instruction->mod_rm.mod == 3 ? 1 : instruction->mod_rm.mod;
+    instruction->effective_address_mode = mod * 8 + instruction->mod_rm.rm;
+    address.segment_register_index =
+        kEffectiveAddressModes[instruction->effective_address_mode]
+            .default_segment_register_index;
+  } else {
+    instruction->effective_address_mode = 0;
+  }
   ApplySegmentOverride(instruction, &address);
+  instruction->segment_register_index = address.segment_register_index;
 
-  // Add displacement if present
   switch (instruction->displacement_size) {
-    case 1: {
-      uint8_t raw_displacement = instruction->displacement[0];
-      address.offset = AddSignedOffsetByte(address.offset, raw_displacement);
+    case 1:
+      instruction->displacement_value =
+          AddSignedOffsetByte(0, instruction->displacement[0]);
       break;
-    }
-    case 2: {
-      // Concatenate the two displacement bytes as an unsigned 16-bit integer
-      uint16_t raw_displacement =
+    case 2:
+      instruction->displacement_value =
           ((uint16_t)instruction->displacement[0]) |
           (((uint16_t)instruction->displacement[1]) << 8);
-      address.offset = AddSignedOffsetWord(address.offset, raw_displacement);
       break;
-    }
     default:
-      // No displacement
+      instruction->displacement_value = 0;
       break;
   }
+}
 
+// Compute the memory address for an instruction.
+YAX86_PRIVATE MemoryAddress
+GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
+  const EffectiveAddressMode* mode =
+      &kEffectiveAddressModes[instruction->effective_address_mode];
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)instruction->segment_register_index,
+      .offset = (uint16_t)((cpu->registers[mode->base_register_index] &
+                            mode->base_mask) +
+                           (cpu->registers[mode->index_register_index] &
+                            mode->index_mask) +
+                           instruction->displacement_value),
+  };
   return address;
 }
 
@@ -1225,7 +3517,7 @@ extern ExecuteStatus ExecuteNoOp(const InstructionContext* ctx);
 // ============================================================================
 
 // Global opcode metadata lookup table.
-extern OpcodeMetadata opcode_table[256];
+extern const OpcodeMetadata opcode_table[256];
 
 // ============================================================================
 // Move instructions - instructions_mov.h
@@ -1649,6 +3941,42 @@ extern ExecuteStatus ExecuteGroup4Instruction(const InstructionContext* ctx);
 // Group 5 instruction handler.
 extern ExecuteStatus ExecuteGroup5Instruction(const InstructionContext* ctx);
 
+// ============================================================================
+// Specialized ALU and MOV instructions - instructions_specialized.c
+// ============================================================================
+
+// Declare the specialized handlers of an instruction for one width.
+#define YAX86_DECLARE_SPECIALIZED_HANDLERS(name, width)                    \
+  extern ExecuteStatus Execute##name##RegisterToRegister##width(           \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToMemory##width(             \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToRegisterReversed##width(   \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##MemoryToRegister##width(             \
+      const InstructionContext* ctx);
+
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Word)
+
+#undef YAX86_DECLARE_SPECIALIZED_HANDLERS
+
 #endif  // YAX86_IMPLEMENTATION
 
 #endif  // YAX86_CPU_INSTRUCTIONS_H
@@ -1666,6 +3994,7 @@ extern ExecuteStatus ExecuteGroup5Instruction(const InstructionContext* ctx);
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -1678,6 +4007,7 @@ YAX86_PRIVATE void SetCommonFlagsAfterInstruction(
     const InstructionContext* ctx, uint32_t result) {
   Width width = ctx->metadata->width;
   result &= kMaxValue[width];
+  DiscardLazyFlags(ctx->cpu, kZF | kSF | kPF);
   // Zero flag (ZF)
   CPUSetFlag(ctx->cpu, kZF, result == 0);
   // Sign flag (SF)
@@ -1891,12 +4221,15 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteTranslateByte(const InstructionContext* ctx) {
   // Read the AL register
   Operand al = ReadRegisterOperandForRegisterIndex(ctx, kAX);
+  // The table is in DS unless overridden by a segment override prefix, which
+  // the decoder resolves.
   OperandAddress src_address = {
       .type = kOperandAddressTypeMemory,
       .value =
           {.memory_address =
                {
-                   .segment_register_index = kDS,
+                   .segment_register_index =
+                       (RegisterIndex)ctx->instruction->segment_register_index,
                    .offset =
                        (uint16_t)(ctx->cpu->registers[kBX] + FromOperand(&al)),
                }},
@@ -1931,10 +4264,10 @@ ExecuteTranslateByte(const InstructionContext* ctx) {
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadEffectiveAddress(const InstructionContext* ctx) {
   Operand dest = ReadRegisterOperand(ctx);
+  // The result is the offset within the segment, without the segment base.
   MemoryAddress memory_address =
       GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
-  uint32_t raw_address = ToRawAddress(ctx->cpu, &memory_address);
-  WriteOperandAddress(ctx, &dest.address, raw_address);
+  WriteOperandAddress(ctx, &dest.address, memory_address.offset);
   return kExecuteSuccess;
 }
 
@@ -1989,6 +4322,7 @@ ExecuteLoadDSWithPointer(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2001,34 +4335,26 @@ ExecuteLoadDSWithPointer(const InstructionContext* ctx) {
 // Other than common flags, the INC instruction sets the following flags:
 // - Overflow Flag (OF) - Set when result has wrong sign
 // - Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterInc(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  // Overflow Flag (OF) Set when result has wrong sign (both operands have same
-  // sign but result has different sign)
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool op2_sign = (op2 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  CPUSetFlag(ctx->cpu, kOF, (op1_sign == op2_sign) && (result_sign != op1_sign));
-
-  // Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
-  CPUSetFlag(
-      ctx->cpu, kAF, ((op1 & 0xF) + (op2 & 0xF) + (did_carry ? 1 : 0)) > 0xF);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsInc, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Set CPU flags after an ADD or ADC instruction.
 // Other than the flags set by the INC instruction, the ADD instruction sets the
 // following flags:
 // - Carry Flag (CF) - Set when result overflows the maximum width
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterAdd(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetFlagsAfterInc(ctx, op1, op2, result, did_carry);
-  // Carry Flag (CF)
-  CPUSetFlag(ctx->cpu, kCF, result > kMaxValue[ctx->metadata->width]);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsAdd, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Common signature of SetFlagsAfterAdd and SetFlagsAfterInc.
@@ -2148,6 +4474,7 @@ YAX86_PRIVATE ExecuteStatus ExecuteIncRegister(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2156,50 +4483,29 @@ YAX86_PRIVATE ExecuteStatus ExecuteIncRegister(const InstructionContext* ctx) {
 // SUB, SBB, and DEC instructions
 // ============================================================================
 
-// Set CPU flags after a DEC or SUB/SBB operation (base function).
-// This function sets ZF, SF, PF, OF, AF. It does NOT affect CF.
+// Set CPU flags after a DEC operation.
+// This sets ZF, SF, PF, OF, AF. It does NOT affect CF.
 // - OF is for the full operation op1 - (op2 + did_borrow).
 // - AF is for the full operation op1 - (op2 + did_borrow).
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterDec(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  uint32_t max_val = kMaxValue[ctx->metadata->width];
-
-  // Overflow Flag (OF)
-  // OF is set if op1_sign != val_being_subtracted_sign AND result_sign ==
-  // val_being_subtracted_sign where val_being_subtracted = (op2 + did_borrow)
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  uint32_t val_being_subtracted = (op2 & max_val) + (did_borrow ? 1 : 0);
-  // Mask val_being_subtracted to current width before checking its sign,
-  // in case (op2 & max_val) + 1 caused a temporary overflow beyond max_val if
-  // op2 was max_val.
-  bool val_being_subtracted_sign =
-      ((val_being_subtracted & max_val) & sign_bit) != 0;
-  CPUSetFlag(
-      ctx->cpu, kOF,
-      (op1_sign != val_being_subtracted_sign) &&
-          (result_sign == val_being_subtracted_sign));
-
-  // Auxiliary Carry Flag (AF) - borrow from bit 3 to bit 4
-  CPUSetFlag(ctx->cpu, kAF, (op1 & 0xF) < ((op2 & 0xF) + (did_borrow ? 1 : 0)));
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsDec, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Set CPU flags after a SUB, SBB, CMP or NEG instruction.
-// This calls SetFlagsAfterDec and then sets the Carry Flag (CF).
+// This sets the same flags as SetFlagsAfterDec, as well as the Carry Flag (CF),
+// which is set if op1 < (op2 + did_borrow) (unsigned comparison).
+// The flags are evaluated lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterSub(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetFlagsAfterDec(ctx, op1, op2, result, did_borrow);
-
-  // Carry Flag (CF) - Set when a borrow is generated
-  // CF is set if op1 < (op2 + did_borrow) (unsigned comparison)
-  uint32_t val_being_subtracted =
-      (op2 & kMaxValue[ctx->metadata->width]) + (did_borrow ? 1 : 0);
-  CPUSetFlag(ctx->cpu, kCF, op1 < val_being_subtracted);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsSub, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Common signature of SetFlagsAfterSub and SetFlagsAfterDec.
@@ -2415,6 +4721,7 @@ ExecuteCmpImmediateToALOrAX(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2423,13 +4730,13 @@ ExecuteCmpImmediateToALOrAX(const InstructionContext* ctx) {
 // Boolean AND, OR and XOR instructions
 // ============================================================================
 
+// Set CPU flags after a boolean instruction. Other than common flags, the
+// Carry Flag (CF) and Overflow Flag (OF) are cleared. The flags are evaluated
+// lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterBooleanInstruction(
     const InstructionContext* ctx, uint32_t result) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-  // Carry Flag (CF) should be cleared
-  CPUSetFlag(ctx->cpu, kCF, false);
-  // Overflow Flag (OF) should be cleared
-  CPUSetFlag(ctx->cpu, kOF, false);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsBoolean, ctx->metadata->width, 0, 0, result, false);
 }
 
 // Common logic for AND instructions.
@@ -2586,6 +4893,7 @@ ExecuteTestImmediateToALOrAX(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2635,7 +4943,7 @@ ExecuteShortOrNearJump(const InstructionContext* ctx) {
 YAX86_PRIVATE ExecuteStatus ExecuteFarJump(
     const InstructionContext* ctx, const OperandValue* segment,
     const OperandValue* offset) {
-  ctx->cpu->registers[kCS] = FromOperandValue(segment);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(segment));
   ctx->cpu->registers[kIP] = FromOperandValue(offset);
   return kExecuteSuccess;
 }
@@ -2682,7 +4990,7 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteUnsignedConditionalJump(const InstructionContext* ctx) {
   uint16_t flag_mask = kUnsignedConditionalJumpFlagBitmasks
       [(ctx->instruction->opcode - 0x70) / 2];
-  bool flag_value = (ctx->cpu->flags & flag_mask) != 0;
+  bool flag_value = GetFlagsInMask(ctx->cpu, flag_mask) != 0;
   // Even opcode => jump if the flag is set
   // Odd opcode => jump if the flag is not set
   bool success_value = ((ctx->instruction->opcode & 0x1) == 0);
@@ -2795,7 +5103,7 @@ static ExecuteStatus ExecuteFarReturnCommon(
   OperandValue new_ip = Pop(ctx->cpu);
   OperandValue new_cs = Pop(ctx->cpu);
   ctx->cpu->registers[kIP] = FromOperandValue(&new_ip);
-  ctx->cpu->registers[kCS] = FromOperandValue(&new_cs);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(&new_cs));
   ctx->cpu->registers[kSP] += arg_size;
   return kExecuteSuccess;
 }
@@ -2821,9 +5129,9 @@ YAX86_PRIVATE ExecuteStatus ExecuteReturnFromInterrupt(CPUState* cpu) {
   OperandValue ip_value = Pop(cpu);
   cpu->registers[kIP] = FromOperandValue(&ip_value);
   OperandValue cs_value = Pop(cpu);
-  cpu->registers[kCS] = FromOperandValue(&cs_value);
+  CPUSetSegmentRegister(cpu, kCS, FromOperandValue(&cs_value));
   OperandValue flags_value = Pop(cpu);
-  cpu->flags = FromOperandValue(&flags_value);
+  CPUSetFlags(cpu, FromOperandValue(&flags_value));
   return kExecuteSuccess;
 }
 
@@ -2927,14 +5235,14 @@ ExecutePopSegmentRegister(const InstructionContext* ctx) {
 
 // PUSHF
 YAX86_PRIVATE ExecuteStatus ExecutePushFlags(const InstructionContext* ctx) {
-  Push(ctx->cpu, WordValue(ctx->cpu->flags));
+  Push(ctx->cpu, WordValue(CPUGetFlags(ctx->cpu)));
   return kExecuteSuccess;
 }
 
 // POPF
 YAX86_PRIVATE ExecuteStatus ExecutePopFlags(const InstructionContext* ctx) {
   OperandValue value = Pop(ctx->cpu);
-  ctx->cpu->flags = FromOperandValue(&value);
+  CPUSetFlags(ctx->cpu, FromOperandValue(&value));
   return kExecuteSuccess;
 }
 
@@ -2970,7 +5278,8 @@ static const OperandAddress* GetAHRegisterAddress(void) {
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadAHFromFlags(const InstructionContext* ctx) {
   WriteRegisterOperandByte(
-      ctx->cpu, GetAHRegisterAddress(), ByteValue(ctx->cpu->flags & 0x00FF));
+      ctx->cpu, GetAHRegisterAddress(),
+      ByteValue(CPUGetFlags(ctx->cpu) & 0x00FF));
   return kExecuteSuccess;
 }
 
@@ -2980,7 +5289,8 @@ ExecuteStoreAHToFlags(const InstructionContext* ctx) {
   OperandValue value =
       ReadRegisterOperandByte(ctx->cpu, GetAHRegisterAddress());
   // Clear the lower byte of flags and set it to the value in AH
-  ctx->cpu->flags = (ctx->cpu->flags & 0xFF00) | value.value.byte_value;
+  CPUSetFlags(
+      ctx->cpu, (CPUGetFlags(ctx->cpu) & 0xFF00) | value.value.byte_value);
   return kExecuteSuccess;
 }
 
@@ -3062,8 +5372,11 @@ static OperandValue ReadByteFromPort(CPUState* cpu, uint16_t port) {
 
 // Read a word from an I/O port as a uint16_t.
 static OperandValue ReadWordFromPort(CPUState* cpu, uint16_t port) {
+  if (cpu->config->read_port_word) {
+    return WordValue(cpu->config->read_port_word(cpu, port));
+  }
   uint8_t low = ReadByteFromPort(cpu, port).value.byte_value;
-  uint8_t high = ReadByteFromPort(cpu, port).value.byte_value;
+  uint8_t high = ReadByteFromPort(cpu, port + 1).value.byte_value;
   return WordValue((high << 8) | low);
 }
 
@@ -3073,8 +5386,19 @@ static OperandValue (*const kReadFromPortFns[])(CPUState*, uint16_t) = {
     ReadWordFromPort,  // kWord
 };
 
+// Count reads from I/O ports that are not known to be stable, so that loops
+// polling them are not fast-forwarded.
+static void CountPortRead(CPUState* cpu, uint16_t port, Width width) {
+  bool (*is_port_stable)(CPUState*, uint16_t) = cpu->config->is_port_stable;
+  if (!is_port_stable || !is_port_stable(cpu, port) ||
+      (width == kWord && !is_port_stable(cpu, port + 1))) {
+    ++cpu->num_unstable_port_reads;
+  }
+}
+
 // Common logic for IN instructions.
 static ExecuteStatus ExecuteIn(const InstructionContext* ctx, uint16_t port) {
+  CountPortRead(ctx->cpu, port, ctx->metadata->width);
   OperandValue value = kReadFromPortFns[ctx->metadata->width](ctx->cpu, port);
   Operand dest = ReadRegisterOperandForRegisterIndex(ctx, kAX);
   WriteOperand(ctx, &dest, FromOperandValue(&value));
@@ -3105,8 +5429,12 @@ static void WriteByteToPort(CPUState* cpu, uint16_t port, OperandValue value) {
 // Write a word to an I/O port.
 static void WriteWordToPort(CPUState* cpu, uint16_t port, OperandValue value) {
   uint32_t raw_value = FromOperandValue(&value);
+  if (cpu->config->write_port_word) {
+    cpu->config->write_port_word(cpu, port, raw_value);
+    return;
+  }
   WriteByteToPort(cpu, port, ByteValue(raw_value & 0xFF));
-  WriteByteToPort(cpu, port, ByteValue((raw_value >> 8) & 0xFF));
+  WriteByteToPort(cpu, port + 1, ByteValue((raw_value >> 8) & 0xFF));
 }
 
 // Table of functions to write to an I/O port, indexed by data width.
@@ -3172,21 +5500,34 @@ static uint8_t GetRepetitionPrefix(const InstructionContext* ctx) {
   return prefix;
 }
 
+// Get the source memory address for string instructions. Typically DS:SI but
+// can be overridden by a segment override prefix, which the decoder resolves.
+static MemoryAddress GetStringSourceAddress(const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)ctx->instruction->segment_register_index,
+      .offset = ctx->cpu->registers[kSI],
+  };
+  return address;
+}
+
+// Get the destination memory address for string instructions. Always ES:DI.
+static MemoryAddress GetStringDestinationAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index = kES,
+      .offset = ctx->cpu->registers[kDI],
+  };
+  return address;
+}
+
 // Get the source operand for string instructions. Typically DS:SI but can be
 // overridden by a segment override prefix.
 static Operand GetStringSourceOperand(const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kDS,
-                      .offset = ctx->cpu->registers[kSI],
-                  },
-          },
+      .value = {.memory_address = GetStringSourceAddress(ctx)},
   };
-  ApplySegmentOverride(ctx->instruction, &address.value.memory_address);
   Operand operand = {
       .address = address,
       .value = ReadOperandValue(ctx, &address),
@@ -3199,14 +5540,7 @@ static OperandAddress GetStringDestinationOperandAddress(
     const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kES,
-                      .offset = ctx->cpu->registers[kDI],
-                  },
-          },
+      .value = {.memory_address = GetStringDestinationAddress(ctx)},
   };
   return address;
 }
@@ -3239,21 +5573,304 @@ static void UpdateStringDestinationAddress(const InstructionContext* ctx) {
   }
 }
 
-// Execute a string instruction with optional REP prefix.
+// ============================================================================
+// Bulk string operations
+// ============================================================================
+
+// When the memory operands of a repeated string instruction are directly
+// accessible host memory, the iterations can be run in bulk without going
+// through the operand helpers. Each bulk function below runs up to count
+// iterations, where count is at most CX, updates SI, DI and CX accordingly,
+// and returns the number of iterations run. The remaining iterations, if any,
+// are run one at a time.
+
+// Get the linear address of count elements of a string operand starting at
+// offset and proceeding in the direction given by DF, i.e. the lowest linear
+// address touched. Returns false if the elements wrap around the end of the
+// segment.
+static bool GetStringOperandRange(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count, uint32_t* linear_address) {
+  uint32_t element_size = kNumBytes[ctx->metadata->width];
+  uint32_t size = count * element_size;
+  uint32_t low_offset = address->offset;
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    if (low_offset + element_size < size) {
+      return false;
+    }
+    low_offset = low_offset + element_size - size;
+  }
+  if (low_offset + size > 0x10000) {
+    return false;
+  }
+  MemoryAddress low_address = {
+      .segment_register_index = address->segment_register_index,
+      .offset = (uint16_t)low_offset,
+  };
+  *linear_address = ToRawAddress(ctx->cpu, &low_address);
+  return true;
+}
+
+// Get a host pointer to count elements of a string operand for reading, or
+// NULL if they are not all directly accessible.
+static const uint8_t* GetDirectStringOperandForReading(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  return GetDirectReadMemory(
+      ctx->cpu, linear_address, count * kNumBytes[ctx->metadata->width]);
+}
+
+// Get a host pointer to count elements of a string operand for writing, or
+// NULL if they are not all directly accessible. Invalidates cached code in the
+// range.
+static uint8_t* GetDirectStringOperandForWriting(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  uint8_t* memory = GetDirectWriteMemory(ctx->cpu, linear_address, size);
+  if (memory) {
+    InvalidateCachesOnWrite(ctx->cpu, linear_address, size);
+  }
+  return memory;
+}
+
+// Advance an address register (SI or DI) by count elements in the direction
+// given by DF.
+static void AdvanceStringAddress(
+    const InstructionContext* ctx, RegisterIndex register_index,
+    uint16_t count) {
+  uint16_t delta = (uint16_t)(count * kNumBytes[ctx->metadata->width]);
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    ctx->cpu->registers[register_index] -= delta;
+  } else {
+    ctx->cpu->registers[register_index] += delta;
+  }
+}
+
+// Read the element at an index from a host pointer to a string operand, where
+// the pointer points to the lowest addressed element.
+static inline uint16_t ReadStringElement(
+    const InstructionContext* ctx, const uint8_t* memory, uint32_t index) {
+  if (ctx->metadata->width == kByte) {
+    return memory[index];
+  }
+  return (uint16_t)(memory[index * 2] | (memory[index * 2 + 1] << 8));
+}
+
+// Returns the index of the iteration in host memory order, where the pointers
+// to string operands point to the lowest addressed element.
+static inline uint32_t GetStringElementIndex(
+    const InstructionContext* ctx, uint16_t count, uint32_t iteration) {
+  return CPUGetFlag(ctx->cpu, kDF) ? count - 1 - iteration : iteration;
+}
+
+// Bulk MOVS, running all iterations.
+static uint16_t ExecuteMovsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint32_t src_linear_address, dest_linear_address;
+  if (!GetStringOperandRange(ctx, &src_address, count, &src_linear_address) ||
+      !GetStringOperandRange(
+          ctx, &dest_address, count, &dest_linear_address)) {
+    return 0;
+  }
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  if (!src) {
+    return 0;
+  }
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  bool backward = CPUGetFlag(ctx->cpu, kDF);
+  // If the destination overlaps the part of the source that is yet to be read,
+  // e.g. MOVSB forward with DI = SI + 1, each iteration reads what an earlier
+  // iteration wrote. Copy element by element to replicate that.
+  bool overlaps =
+      backward ? (dest_linear_address < src_linear_address &&
+                  dest_linear_address + size > src_linear_address)
+               : (dest_linear_address > src_linear_address &&
+                  dest_linear_address < src_linear_address + size);
+  if (overlaps) {
+    uint8_t element_size = kNumBytes[ctx->metadata->width];
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t offset = GetStringElementIndex(ctx, count, i) * element_size;
+      uint8_t element[2];
+      for (uint8_t j = 0; j < element_size; ++j) {
+        element[j] = src[offset + j];
+      }
+      for (uint8_t j = 0; j < element_size; ++j) {
+        dest[offset + j] = element[j];
+      }
+    }
+  } else if (dest_linear_address <= src_linear_address) {
+    // Otherwise, every iteration reads the original source, so copy with
+    // memmove semantics.
+    for (uint32_t i = 0; i < size; ++i) {
+      dest[i] = src[i];
+    }
+  } else {
+    for (uint32_t i = size; i > 0; --i) {
+      dest[i - 1] = src[i - 1];
+    }
+  }
+
+  AdvanceStringAddress(ctx, kSI, count);
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk STOS, running all iterations.
+static uint16_t ExecuteStosBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX];
+  if (ctx->metadata->width == kByte) {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i] = value & 0xFF;
+    }
+  } else {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i * 2] = value & 0xFF;
+      dest[i * 2 + 1] = (value >> 8) & 0xFF;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk LODS, skipping all but the last iteration as only the last value loaded
+// is observable.
+static uint16_t ExecuteLodsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  // Only skip reads from plain memory, which have no side effects.
+  if (count < 2 ||
+      !GetDirectStringOperandForReading(ctx, &src_address, count)) {
+    return 0;
+  }
+  AdvanceStringAddress(ctx, kSI, count - 1);
+  ctx->cpu->registers[kCX] -= count - 1;
+  return count - 1;
+}
+
+// Bulk SCAS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteScasBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* dest =
+      count < 2 ? NULL
+                : GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX] & kMaxValue[ctx->metadata->width];
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint16_t element = ReadStringElement(
+        ctx, dest, GetStringElementIndex(ctx, count, num_skipped));
+    if ((element == value) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// Bulk CMPS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteCmpsBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  if (count < 2) {
+    return 0;
+  }
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  const uint8_t* dest =
+      GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!src || !dest) {
+    return 0;
+  }
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint32_t index = GetStringElementIndex(ctx, count, num_skipped);
+    if ((ReadStringElement(ctx, src, index) ==
+         ReadStringElement(ctx, dest, index)) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kSI, num_skipped);
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// ============================================================================
+// Repetition prefixes
+// ============================================================================
+
+// Returns the number of iterations of a repeated string instruction to run in
+// this instruction cycle, which is CX limited by max_string_iterations.
+static uint16_t GetStringIterationCount(const InstructionContext* ctx) {
+  uint16_t count = ctx->cpu->registers[kCX];
+  uint16_t max_count = ctx->cpu->config->max_string_iterations;
+  return max_count && count > max_count ? max_count : count;
+}
+
+// Arrange for a repeated string instruction that has iterations left to be
+// executed again in the next instruction cycle, by rewinding IP to the start
+// of the instruction including its prefixes. As on the 8088, interrupts can be
+// serviced in between, and return to the instruction to resume it.
+static void RepeatStringInstruction(const InstructionContext* ctx) {
+  ctx->cpu->registers[kIP] -= ctx->instruction->size;
+}
+
+// Execute a string instruction with optional REP prefix. If bulk_fn is set,
+// it is given the chance to run the iterations in bulk first.
 static ExecuteStatus ExecuteStringInstructionWithREPPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP) {
     return fn(ctx);
   }
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -3269,7 +5886,8 @@ static ExecuteStatus ExecuteMovsIteration(const InstructionContext* ctx) {
 
 // MOVS
 YAX86_PRIVATE ExecuteStatus ExecuteMovs(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteMovsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteMovsIteration, ExecuteMovsBulk);
 }
 
 // Single STOS iteration.
@@ -3283,7 +5901,8 @@ static ExecuteStatus ExecuteStosIteration(const InstructionContext* ctx) {
 
 // STOS
 YAX86_PRIVATE ExecuteStatus ExecuteStos(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteStosIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteStosIteration, ExecuteStosBulk);
 }
 
 // Single LODS iteration.
@@ -3297,28 +5916,38 @@ static ExecuteStatus ExecuteLodsIteration(const InstructionContext* ctx) {
 
 // LODS
 YAX86_PRIVATE ExecuteStatus ExecuteLods(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteLodsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteLodsIteration, ExecuteLodsBulk);
 }
 
 // Execute a string instruction with optional REPZ/REPE or REPNZ/REPNE prefix.
 static ExecuteStatus ExecuteStringInstructionWithREPZOrRepNZPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t, bool)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP && prefix != kPrefixREPNZ) {
     return fn(ctx);
   }
   bool terminate_zf_value = prefix == kPrefixREPNZ;
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count, terminate_zf_value);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
     if (CPUGetFlag(ctx->cpu, kZF) == terminate_zf_value) {
-      break;
+      return kExecuteSuccess;
     }
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -3334,7 +5963,7 @@ static ExecuteStatus ExecuteScasIteration(const InstructionContext* ctx) {
 // SCAS
 YAX86_PRIVATE ExecuteStatus ExecuteScas(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteScasIteration);
+      ctx, ExecuteScasIteration, ExecuteScasBulk);
 }
 
 // Single CMPS iteration.
@@ -3350,7 +5979,7 @@ static ExecuteStatus ExecuteCmpsIteration(const InstructionContext* ctx) {
 // CMPS
 YAX86_PRIVATE ExecuteStatus ExecuteCmps(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteCmpsIteration);
+      ctx, ExecuteCmpsIteration, ExecuteCmpsBulk);
 }
 
 
@@ -4121,6 +6750,230 @@ ExecuteGroup5Instruction(const InstructionContext* ctx) {
 // src/cpu/instructions_group_5.c end
 // ==============================================================================
 
+// ==============================================================================
+// src/cpu/instructions_specialized.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/instructions_specialized.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "instructions.h"
+#include "lazy_flags.h"
+#include "operands.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Specialized ALU and MOV instructions
+// ============================================================================
+
+// The generic handlers for "op r/m, reg" and "op reg, r/m" instructions pass
+// operands around as OperandValue, and read and write them through function
+// pointer tables indexed by width and addressing mode. The handlers below
+// implement the same instructions for a fixed width and addressing mode, and
+// are selected through OpcodeMetadata.specialized_handlers.
+
+// Read a byte register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterByte(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return reg_or_rm < 4 ? cpu->registers[reg_or_rm] & 0xFF
+                       : cpu->registers[reg_or_rm - 4] >> 8;
+}
+
+// Read a word register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterWord(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return cpu->registers[reg_or_rm];
+}
+
+// Write a byte register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterByte(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  if (reg_or_rm < 4) {
+    cpu->registers[reg_or_rm] =
+        (cpu->registers[reg_or_rm] & 0xFF00) | (value & 0xFF);
+  } else {
+    cpu->registers[reg_or_rm - 4] =
+        (cpu->registers[reg_or_rm - 4] & 0x00FF) | ((value & 0xFF) << 8);
+  }
+}
+
+// Write a word register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterWord(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  cpu->registers[reg_or_rm] = value & 0xFFFF;
+}
+
+// Compute the linear address of an instruction's memory operand.
+static inline uint32_t GetMemoryOperandRawAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
+  return ToRawAddress(ctx->cpu, &address);
+}
+
+// ADD: returns op1 + op2 and sets flags.
+static inline uint32_t ComputeAdd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 + op2;
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, false);
+  return result;
+}
+
+// ADC: returns op1 + op2 + CF and sets flags.
+static inline uint32_t ComputeAddWithCarry(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool carry = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 + op2 + (carry ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, carry);
+  return result;
+}
+
+// SUB and CMP: returns op1 - op2 and sets flags.
+static inline uint32_t ComputeSub(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 - op2;
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, false);
+  return result;
+}
+
+// SBB: returns op1 - op2 - CF and sets flags.
+static inline uint32_t ComputeSubWithBorrow(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool borrow = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 - op2 - (borrow ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, borrow);
+  return result;
+}
+
+// AND: returns op1 & op2 and sets flags.
+static inline uint32_t ComputeBooleanAnd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 & op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// OR: returns op1 | op2 and sets flags.
+static inline uint32_t ComputeBooleanOr(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 | op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// XOR: returns op1 ^ op2 and sets flags.
+static inline uint32_t ComputeBooleanXor(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 ^ op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// MOV: returns op2.
+static inline uint32_t ComputeMove(
+    YAX86_UNUSED CPUState* cpu, YAX86_UNUSED Width width,
+    YAX86_UNUSED uint32_t op1, uint32_t op2) {
+  return op2;
+}
+
+// Define the 4 specialized handlers of an instruction for one width:
+//   - Execute<name>RegisterToRegister<width>: op r/m, reg with mod == 3
+//   - Execute<name>RegisterToMemory<width>: op r/m, reg with mod != 3
+//   - Execute<name>RegisterToRegisterReversed<width>: op reg, r/m with mod == 3
+//   - Execute<name>MemoryToRegister<width>: op reg, r/m with mod != 3
+// compute is one of the Compute* functions above. The destination is only
+// read if reads_dest is true, and only written if writes_dest is true.
+#define YAX86_SPECIALIZED_HANDLERS(                                          \
+    name, width, compute, reads_dest, writes_dest)                           \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToRegister##width(      \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.rm;                        \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToMemory##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint32_t dest = GetMemoryOperandRawAddress(ctx);                   \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRawMemory##width(cpu, dest) : 0,   \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRawMemory##width(cpu, dest, result);                              \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus                                                \
+      Execute##name##RegisterToRegisterReversed##width(                      \
+          const InstructionContext* ctx) {                                   \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.rm));              \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##MemoryToRegister##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    const uint32_t src =                                                     \
+        ReadRawMemory##width(cpu, GetMemoryOperandRawAddress(ctx));          \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        src);                                                                \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }
+
+// ADD r/m, reg and ADD reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Add, Byte, ComputeAdd, true, true)
+YAX86_SPECIALIZED_HANDLERS(Add, Word, ComputeAdd, true, true)
+// OR r/m, reg and OR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Byte, ComputeBooleanOr, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Word, ComputeBooleanOr, true, true)
+// ADC r/m, reg and ADC reg, r/m
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Byte, ComputeAddWithCarry, true, true)
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Word, ComputeAddWithCarry, true, true)
+// SBB r/m, reg and SBB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Byte, ComputeSubWithBorrow, true, true)
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Word, ComputeSubWithBorrow, true, true)
+// AND r/m, reg and AND reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Byte, ComputeBooleanAnd, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Word, ComputeBooleanAnd, true, true)
+// SUB r/m, reg and SUB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Sub, Byte, ComputeSub, true, true)
+YAX86_SPECIALIZED_HANDLERS(Sub, Word, ComputeSub, true, true)
+// XOR r/m, reg and XOR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Byte, ComputeBooleanXor, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Word, ComputeBooleanXor, true, true)
+// CMP r/m, reg and CMP reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Cmp, Byte, ComputeSub, true, false)
+YAX86_SPECIALIZED_HANDLERS(Cmp, Word, ComputeSub, true, false)
+// MOV r/m, reg and MOV reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Move, Byte, ComputeMove, false, true)
+YAX86_SPECIALIZED_HANDLERS(Move, Word, ComputeMove, false, true)
+
+#undef YAX86_SPECIALIZED_HANDLERS
+
+
+// ==============================================================================
+// src/cpu/instructions_specialized.c end
+// ==============================================================================
+
 // ==============================================================================
 // src/cpu/opcode_table.c start
 // ==============================================================================
@@ -4138,31 +6991,39 @@ ExecuteGroup5Instruction(const InstructionContext* ctx) {
 // ============================================================================
 
 // Global opcode metadata lookup table.
-YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
+YAX86_PRIVATE const OpcodeMetadata opcode_table[256] = {
     // ADD r/m8, r8
     {.opcode = 0x00,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryByte,
+                              ExecuteAddRegisterToRegisterByte}},
     // ADD r/m16, r16
     {.opcode = 0x01,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryWord,
+                              ExecuteAddRegisterToRegisterWord}},
     // ADD r8, r/m8
     {.opcode = 0x02,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterByte,
+                              ExecuteAddRegisterToRegisterReversedByte}},
     // ADD r16, r/m16
     {.opcode = 0x03,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterWord,
+                              ExecuteAddRegisterToRegisterReversedWord}},
     // ADD AL, imm8
     {.opcode = 0x04,
      .has_modrm = false,
@@ -4192,25 +7053,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryByte,
+                              ExecuteBooleanOrRegisterToRegisterByte}},
     // OR r/m16, r16
     {.opcode = 0x09,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryWord,
+                              ExecuteBooleanOrRegisterToRegisterWord}},
     // OR r8, r/m8
     {.opcode = 0x0A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterByte,
+                              ExecuteBooleanOrRegisterToRegisterReversedByte}},
     // OR r16, r/m16
     {.opcode = 0x0B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterWord,
+                              ExecuteBooleanOrRegisterToRegisterReversedWord}},
     // OR AL, imm8
     {.opcode = 0x0C,
      .has_modrm = false,
@@ -4236,25 +7105,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryByte,
+                              ExecuteAddWithCarryRegisterToRegisterByte}},
     // ADC r/m16, r16
     {.opcode = 0x11,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryWord,
+                              ExecuteAddWithCarryRegisterToRegisterWord}},
     // ADC r8, r/m8
     {.opcode = 0x12,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterByte,
+          ExecuteAddWithCarryRegisterToRegisterReversedByte}},
     // ADC r16, r/m16
     {.opcode = 0x13,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterWord,
+          ExecuteAddWithCarryRegisterToRegisterReversedWord}},
     // ADC AL, imm8
     {.opcode = 0x14,
      .has_modrm = false,
@@ -4284,25 +7163,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryByte,
+                              ExecuteSubWithBorrowRegisterToRegisterByte}},
     // SBB r/m16, r16
     {.opcode = 0x19,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryWord,
+                              ExecuteSubWithBorrowRegisterToRegisterWord}},
     // SBB r8, r/m8
     {.opcode = 0x1A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterByte,
+          ExecuteSubWithBorrowRegisterToRegisterReversedByte}},
     // SBB r16, r/m16
     {.opcode = 0x1B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterWord,
+          ExecuteSubWithBorrowRegisterToRegisterReversedWord}},
     // SBB AL, imm8
     {.opcode = 0x1C,
      .has_modrm = false,
@@ -4332,25 +7221,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryByte,
+                              ExecuteBooleanAndRegisterToRegisterByte}},
     // AND r/m16, r16
     {.opcode = 0x21,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryWord,
+                              ExecuteBooleanAndRegisterToRegisterWord}},
     // AND r8, r/m8
     {.opcode = 0x22,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterByte,
+                              ExecuteBooleanAndRegisterToRegisterReversedByte}},
     // AND r16, r/m16
     {.opcode = 0x23,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterWord,
+                              ExecuteBooleanAndRegisterToRegisterReversedWord}},
     // AND AL, imm8
     {.opcode = 0x24,
      .has_modrm = false,
@@ -4375,25 +7272,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryByte,
+                              ExecuteSubRegisterToRegisterByte}},
     // SUB r/m16, r16
     {.opcode = 0x29,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryWord,
+                              ExecuteSubRegisterToRegisterWord}},
     // SUB r8, r/m8
     {.opcode = 0x2A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterByte,
+                              ExecuteSubRegisterToRegisterReversedByte}},
     // SUB r16, r/m16
     {.opcode = 0x2B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterWord,
+                              ExecuteSubRegisterToRegisterReversedWord}},
     // SUB AL, imm8
     {.opcode = 0x2C,
      .has_modrm = false,
@@ -4418,25 +7323,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryByte,
+                              ExecuteBooleanXorRegisterToRegisterByte}},
     // XOR r/m16, r16
     {.opcode = 0x31,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryWord,
+                              ExecuteBooleanXorRegisterToRegisterWord}},
     // XOR r8, r/m8
     {.opcode = 0x32,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterByte,
+                              ExecuteBooleanXorRegisterToRegisterReversedByte}},
     // XOR r16, r/m16
     {.opcode = 0x33,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterWord,
+                              ExecuteBooleanXorRegisterToRegisterReversedWord}},
     // XOR AL, imm8
     {.opcode = 0x34,
      .has_modrm = false,
@@ -4462,25 +7375,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryByte,
+                              ExecuteCmpRegisterToRegisterByte}},
     // CMP r/m16, r16
     {.opcode = 0x39,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryWord,
+                              ExecuteCmpRegisterToRegisterWord}},
     // CMP r8, r/m8
     {.opcode = 0x3A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterByte,
+                              ExecuteCmpRegisterToRegisterReversedByte}},
     // CMP r16, r/m16
     {.opcode = 0x3B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterWord,
+                              ExecuteCmpRegisterToRegisterReversedWord}},
     // CMP AL, imm8
     {.opcode = 0x3C,
      .has_modrm = false,
@@ -4861,25 +7782,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryByte,
+                              ExecuteMoveRegisterToRegisterByte}},
     // MOV r/m16, r16
     {.opcode = 0x89,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryWord,
+                              ExecuteMoveRegisterToRegisterWord}},
     // MOV r8, r/m8
     {.opcode = 0x8A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterByte,
+                              ExecuteMoveRegisterToRegisterReversedByte}},
     // MOV r16, r/m16
     {.opcode = 0x8B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterWord,
+                              ExecuteMoveRegisterToRegisterReversedWord}},
     // MOV r/m16, sreg
     {.opcode = 0x8C,
      .has_modrm = true,
@@ -5529,7 +8458,802 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
 
 
 // ==============================================================================
-// src/cpu/opcode_table.c end
+// src/cpu/opcode_table.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/jit.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/jit.h"
+#ifndef YAX86_CPU_JIT_H
+#define YAX86_CPU_JIT_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Returns whether a block has native code that is still valid.
+extern bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block);
+
+// Compile a block to native code, flushing the code buffer if it is full.
+// Returns false if the block could not be compiled.
+extern bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler);
+
+// Run a compiled block. Returns the number of instructions executed. Execution
+// stops early if the handler requests it, in which case jit->stopped is set.
+extern uint32_t RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block);
+
+#endif  // YAX86_CPU_HAS_JIT
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_JIT_H
+
+
+// ==============================================================================
+// src/cpu/jit.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/jit.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/jit.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "jit.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size) {
+  jit->code = code;
+  jit->code_size = code_size;
+  jit->code_used = 0;
+  jit->epoch = 0;
+  jit->current_block = NULL;
+  jit->current_block_start_cycles = 0;
+  jit->current_block_max_cycles = 0;
+  jit->current_block_variable_clock_cycles = 0;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  jit->num_compiled_blocks = 0;
+  jit->num_flushes = 0;
+  jit->num_native_executions = 0;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Native code is generated for the System V AMD64 calling convention. A
+// compiled block is a function taking the CPUState pointer in RDI and
+// returning the number of instructions executed in EAX. The CPUState pointer
+// is kept in RBX throughout the block.
+
+// Writes native code to the JIT's code buffer.
+typedef struct JITEmitter {
+  // Start of the code being emitted.
+  uint8_t* start;
+  // Next byte to write.
+  uint8_t* next;
+} JITEmitter;
+
+static inline void EmitByte(JITEmitter* emitter, uint8_t value) {
+  *emitter->next = value;
+  ++emitter->next;
+}
+
+static inline void EmitWord(JITEmitter* emitter, uint16_t value) {
+  EmitByte(emitter, value & 0xFF);
+  EmitByte(emitter, (value >> 8) & 0xFF);
+}
+
+static inline void EmitDword(JITEmitter* emitter, uint32_t value) {
+  EmitWord(emitter, value & 0xFFFF);
+  EmitWord(emitter, (value >> 16) & 0xFFFF);
+}
+
+static inline void EmitQword(JITEmitter* emitter, uint64_t value) {
+  EmitDword(emitter, value & 0xFFFFFFFF);
+  EmitDword(emitter, (value >> 32) & 0xFFFFFFFF);
+}
+
+// Emit a sequence of bytes.
+static void EmitBytes(
+    JITEmitter* emitter, const uint8_t* bytes, uint8_t num_bytes) {
+  for (uint8_t i = 0; i < num_bytes; ++i) {
+    EmitByte(emitter, bytes[i]);
+  }
+}
+
+// Returns the offset of a register within CPUState, for use as a displacement
+// from RBX. byte_offset selects the high byte of the register if set.
+static inline uint32_t GetRegisterDisplacement(
+    RegisterIndex register_index, uint8_t byte_offset) {
+  return (uint32_t)(offsetof(CPUState, registers) +
+                    register_index * sizeof(uint16_t) + byte_offset);
+}
+
+// Returns the displacement of an 8-bit register encoded in a REG or R/M field.
+static inline uint32_t GetByteRegisterDisplacement(uint8_t reg_or_rm) {
+  // AL, CL, DL, BL are the low bytes and AH, CH, DH, BH the high bytes of AX,
+  // CX, DX and BX, which is at offset 1 on the little-endian host.
+  return GetRegisterDisplacement(
+      (RegisterIndex)(reg_or_rm & 0x3), reg_or_rm >> 2);
+}
+
+// push rbx
+// mov rbx, rdi
+static void EmitPrologue(JITEmitter* emitter) {
+  static const uint8_t kPrologue[] = {0x53, 0x48, 0x89, 0xFB};
+  EmitBytes(emitter, kPrologue, sizeof(kPrologue));
+}
+
+// mov eax, num_instructions
+// pop rbx
+// ret
+static void EmitReturn(JITEmitter* emitter, uint32_t num_instructions) {
+  EmitByte(emitter, 0xB8);
+  EmitDword(emitter, num_instructions);
+  EmitByte(emitter, 0x5B);
+  EmitByte(emitter, 0xC3);
+}
+
+// add word [rbx + IP], delta
+static void EmitAddIP(JITEmitter* emitter, uint16_t delta) {
+  static const uint8_t kAddWord[] = {0x66, 0x81, 0x83};
+  EmitBytes(emitter, kAddWord, sizeof(kAddWord));
+  EmitDword(emitter, GetRegisterDisplacement(kIP, 0));
+  EmitWord(emitter, delta);
+}
+
+// mov word [rbx + dest], value
+static void EmitMoveImmediateWord(
+    JITEmitter* emitter, uint32_t dest, uint16_t value) {
+  static const uint8_t kMoveWord[] = {0x66, 0xC7, 0x83};
+  EmitBytes(emitter, kMoveWord, sizeof(kMoveWord));
+  EmitDword(emitter, dest);
+  EmitWord(emitter, value);
+}
+
+// mov byte [rbx + dest], value
+static void EmitMoveImmediateByte(
+    JITEmitter* emitter, uint32_t dest, uint8_t value) {
+  static const uint8_t kMoveByte[] = {0xC6, 0x83};
+  EmitBytes(emitter, kMoveByte, sizeof(kMoveByte));
+  EmitDword(emitter, dest);
+  EmitByte(emitter, value);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+static void EmitMoveWord(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadWord[] = {0x0F, 0xB7, 0x83};
+  static const uint8_t kStoreWord[] = {0x66, 0x89, 0x83};
+  EmitBytes(emitter, kLoadWord, sizeof(kLoadWord));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreWord, sizeof(kStoreWord));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, byte [rbx + src]
+// mov byte [rbx + dest], al
+static void EmitMoveByte(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadByte[] = {0x0F, 0xB6, 0x83};
+  static const uint8_t kStoreByte[] = {0x88, 0x83};
+  EmitBytes(emitter, kLoadByte, sizeof(kLoadByte));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreByte, sizeof(kStoreByte));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+// shl eax, 4
+// mov dword [rbx + base], eax
+static void EmitMoveSegmentRegister(
+    JITEmitter* emitter, RegisterIndex dest, uint32_t src) {
+  static const uint8_t kShiftLeft4[] = {0xC1, 0xE0, 0x04};
+  static const uint8_t kStoreDword[] = {0x89, 0x83};
+  EmitMoveWord(emitter, GetRegisterDisplacement(dest, 0), src);
+  EmitBytes(emitter, kShiftLeft4, sizeof(kShiftLeft4));
+  EmitBytes(emitter, kStoreDword, sizeof(kStoreDword));
+  EmitDword(
+      emitter, (uint32_t)(offsetof(CPUState, segment_bases) +
+                          (dest - kES) * sizeof(uint32_t)));
+}
+
+// Emit a call to the interpreter for an instruction, returning from the block
+// with the number of instructions executed if the interpreter requests it.
+//
+// mov rdi, rbx
+// mov rsi, entry
+// mov rax, handler
+// call rax
+// test al, al
+// jz continue
+// <return num_instructions>
+// continue:
+static void EmitInterpreterCall(
+    JITEmitter* emitter, const CPUBlockInstruction* entry,
+    JITInstructionHandler handler, uint32_t num_instructions) {
+  static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+  static const uint8_t kCallRAXAndTest[] = {0xFF, 0xD0, 0x84, 0xC0};
+  enum {
+    // Size of the code emitted by EmitReturn.
+    kReturnSize = 7,
+  };
+  EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xBE);
+  EmitQword(emitter, (uint64_t)(uintptr_t)entry);
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(emitter, (uint64_t)(uintptr_t)handler);
+  EmitBytes(emitter, kCallRAXAndTest, sizeof(kCallRAXAndTest));
+  EmitByte(emitter, 0x74);
+  EmitByte(emitter, kReturnSize);
+  EmitReturn(emitter, num_instructions);
+}
+
+// Kind of an ALU instruction that can be compiled to native code. The first
+// 8 match the REG field of Group 1 instructions and bits 3-5 of the opcode of
+// the other forms of those instructions.
+typedef enum JITALUOp {
+  kJITALUAdd = 0,
+  kJITALUOr,
+  // ADC and SBB depend on CF, and are not compiled to native code.
+  kJITALUAddWithCarry,
+  kJITALUSubWithBorrow,
+  kJITALUAnd,
+  kJITALUSub,
+  kJITALUXor,
+  kJITALUCmp,
+  kJITALUTest,
+  kJITALUInc,
+  kJITALUDec,
+} JITALUOp;
+
+// An ALU instruction on registers, or on a register and an immediate, that can
+// be compiled to native code.
+typedef struct JITALUInstruction {
+  // Kind of the instruction.
+  JITALUOp op;
+  // Data width of the instruction.
+  Width width;
+  // Displacement of the destination register from RBX.
+  uint32_t dest;
+  // Whether the source is an immediate instead of a register.
+  bool has_immediate_src;
+  // Displacement of the source register from RBX, or the immediate value.
+  uint32_t src;
+} JITALUInstruction;
+
+// Returns the displacement of a register encoded in a REG or R/M field.
+static inline uint32_t GetRegisterOperandDisplacement(
+    Width width, uint8_t reg_or_rm) {
+  return width == kByte
+             ? GetByteRegisterDisplacement(reg_or_rm)
+             : GetRegisterDisplacement((RegisterIndex)reg_or_rm, 0);
+}
+
+// Returns the immediate value of an instruction as the interpreter passes it
+// to the ALU, which is zero-extended from the instruction's width.
+static inline uint32_t GetImmediateOperand(
+    const Instruction* instruction, Width width) {
+  return width == kByte ? instruction->immediate[0]
+                        : (uint32_t)(instruction->immediate[0] |
+                                     (instruction->immediate[1] << 8));
+}
+
+// Decode an ALU instruction that can be compiled to native code. Returns false
+// if the instruction is not supported.
+static bool DecodeALUInstruction(
+    const Instruction* instruction, JITALUInstruction* alu) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  const bool is_register_mod_rm =
+      instruction->has_mod_rm && mod_rm->mod == kModRMModRegister;
+  // INC AX/CX/DX/BX/SP/BP/SI/DI and DEC AX/CX/DX/BX/SP/BP/SI/DI
+  if (opcode >= 0x40 && opcode <= 0x4F) {
+    alu->op = opcode < 0x48 ? kJITALUInc : kJITALUDec;
+    alu->width = kWord;
+    alu->dest = GetRegisterDisplacement((RegisterIndex)(opcode & 0x07), 0);
+    alu->has_immediate_src = true;
+    alu->src = 1;
+    return true;
+  }
+  // ADD, OR, AND, SUB, XOR and CMP in the forms op r/m, reg; op reg, r/m; and
+  // op AL/AX, imm.
+  if (opcode < 0x40 && (opcode & 0x07) <= 5) {
+    alu->op = (JITALUOp)(opcode >> 3);
+    alu->width = (opcode & 0x01) ? kWord : kByte;
+    switch (opcode & 0x07) {
+      case 0:
+      case 1:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        break;
+      case 2:
+      case 3:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        break;
+      default:
+        alu->dest = GetRegisterDisplacement(kAX, 0);
+        alu->has_immediate_src = true;
+        alu->src = GetImmediateOperand(instruction, alu->width);
+        break;
+    }
+    return alu->op != kJITALUAddWithCarry && alu->op != kJITALUSubWithBorrow;
+  }
+  switch (opcode) {
+    // Group 1 r/m8, imm8; r/m16, imm16; and r/m16, sign-extended imm8
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = (JITALUOp)mod_rm->reg;
+      alu->width = opcode == 0x80 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = true;
+      alu->src = opcode == 0x83
+                     ? (uint16_t)(int16_t)(int8_t)instruction->immediate[0]
+                     : GetImmediateOperand(instruction, alu->width);
+      return alu->op != kJITALUAddWithCarry &&
+             alu->op != kJITALUSubWithBorrow;
+    // TEST r/m8, r8 and TEST r/m16, r16
+    case 0x84:
+    case 0x85:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0x84 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = false;
+      alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+      return true;
+    // TEST AL, imm8 and TEST AX, imm16
+    case 0xA8:
+    case 0xA9:
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0xA8 ? kByte : kWord;
+      alu->dest = GetRegisterDisplacement(kAX, 0);
+      alu->has_immediate_src = true;
+      alu->src = GetImmediateOperand(instruction, alu->width);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the offset of a field of CPUState.lazy_flags within CPUState.
+#define YAX86_LAZY_FLAGS_DISPLACEMENT(field) \
+  ((uint32_t)(offsetof(CPUState, lazy_flags) + offsetof(CPULazyFlags, field)))
+
+// Emit native code for an ALU instruction. The result is written to the
+// destination register, and the operation is recorded in CPUState.lazy_flags
+// exactly as the interpreter records it. If set_host_flags is true, the code
+// ends by setting the host's flags as the instruction sets the 8086's
+// CF, PF, ZF, SF and OF, for a conditional jump that follows. INC and DEC
+// leave the host's CF undefined.
+static void EmitALUInstruction(
+    JITEmitter* emitter, const JITALUInstruction* alu, bool set_host_flags) {
+  // Lazy flags operation and host instruction to compute the result in EDX
+  // from EAX and ECX, indexed by JITALUOp.
+  static const uint8_t kLazyFlagsOps[] = {
+      kLazyFlagsAdd,     kLazyFlagsBoolean, kLazyFlagsAdd,
+      kLazyFlagsSub,     kLazyFlagsBoolean, kLazyFlagsSub,
+      kLazyFlagsBoolean, kLazyFlagsSub,     kLazyFlagsBoolean,
+      kLazyFlagsInc,     kLazyFlagsDec,
+  };
+  static const uint8_t kComputeResult[][2] = {
+      {0x01, 0xCA},  // add edx, ecx
+      {0x09, 0xCA},  // or edx, ecx
+      {0x01, 0xCA},  // ADC (unused)
+      {0x29, 0xCA},  // SBB (unused)
+      {0x21, 0xCA},  // and edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x31, 0xCA},  // xor edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x21, 0xCA},  // and edx, ecx
+      {0x01, 0xCA},  // add edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+  };
+  const uint8_t lazy_flags_op = kLazyFlagsOps[alu->op];
+  const bool is_boolean = lazy_flags_op == kLazyFlagsBoolean;
+  const uint16_t produced = kLazyFlagsProduced[lazy_flags_op];
+
+  // Evaluate pending flags from the previous operation that this one does not
+  // produce, as SetLazyFlags() does.
+  //
+  // test word [rbx + pending], kArithmeticFlags & ~produced
+  // jz skip
+  // mov rdi, rbx
+  // mov esi, produced
+  // mov rax, DiscardLazyFlags
+  // call rax
+  // skip:
+  if (produced != kArithmeticFlags) {
+    static const uint8_t kTestPendingWord[] = {0x66, 0xF7, 0x83};
+    static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+    static const uint8_t kCallRAX[] = {0xFF, 0xD0};
+    enum {
+      // Size of the code skipped if no flags need to be evaluated.
+      kDiscardCallSize = 20,
+    };
+    EmitBytes(emitter, kTestPendingWord, sizeof(kTestPendingWord));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending));
+    EmitWord(emitter, kArithmeticFlags & ~produced);
+    EmitByte(emitter, 0x74);
+    EmitByte(emitter, kDiscardCallSize);
+    EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+    EmitByte(emitter, 0xBE);
+    EmitDword(emitter, produced);
+    EmitByte(emitter, 0x48);
+    EmitByte(emitter, 0xB8);
+    EmitQword(emitter, (uint64_t)(uintptr_t)DiscardLazyFlags);
+    EmitBytes(emitter, kCallRAX, sizeof(kCallRAX));
+  }
+
+  // movzx eax, byte/word [rbx + dest]
+  EmitByte(emitter, 0x0F);
+  EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+  EmitByte(emitter, 0x83);
+  EmitDword(emitter, alu->dest);
+  if (alu->has_immediate_src) {
+    // mov ecx, src
+    EmitByte(emitter, 0xB9);
+    EmitDword(emitter, alu->src);
+  } else {
+    // movzx ecx, byte/word [rbx + src]
+    EmitByte(emitter, 0x0F);
+    EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, alu->src);
+  }
+  // mov edx, eax
+  // <op> edx, ecx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0xC2);
+  EmitBytes(emitter, kComputeResult[alu->op], sizeof(kComputeResult[0]));
+
+  // Record the operation in CPUState.lazy_flags. Boolean operations record 0
+  // for both operands.
+  EmitMoveImmediateWord(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending), produced);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op), lazy_flags_op);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(width), (uint8_t)alu->width);
+  EmitMoveImmediateByte(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(did_carry), 0);
+  if (is_boolean) {
+    // mov dword [rbx + op1], 0
+    // mov dword [rbx + op2], 0
+    static const uint8_t kMoveImmediateDword[] = {0xC7, 0x83};
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitDword(emitter, 0);
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+    EmitDword(emitter, 0);
+  } else {
+    // mov [rbx + op1], eax
+    // mov [rbx + op2], ecx
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x83);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+  }
+  // mov [rbx + result], edx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0x93);
+  EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(result));
+
+  // mov [rbx + dest], dl/dx
+  if (alu->op != kJITALUCmp && alu->op != kJITALUTest) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    EmitByte(emitter, alu->width == kByte ? 0x88 : 0x89);
+    EmitByte(emitter, 0x93);
+    EmitDword(emitter, alu->dest);
+  }
+
+  // add al/ax, cl/cx for additions, cmp al/ax, cl/cx for subtractions, or
+  // test dl/dx, dl/dx for boolean operations.
+  if (set_host_flags) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    if (is_boolean) {
+      EmitByte(emitter, alu->width == kByte ? 0x84 : 0x85);
+      EmitByte(emitter, 0xD2);
+    } else if (
+        lazy_flags_op == kLazyFlagsAdd || lazy_flags_op == kLazyFlagsInc) {
+      EmitByte(emitter, alu->width == kByte ? 0x00 : 0x01);
+      EmitByte(emitter, 0xC8);
+    } else {
+      EmitByte(emitter, alu->width == kByte ? 0x38 : 0x39);
+      EmitByte(emitter, 0xC8);
+    }
+  }
+}
+
+#undef YAX86_LAZY_FLAGS_DISPLACEMENT
+
+// Returns whether a conditional jump can be compiled to native code when it
+// follows an ALU instruction compiled to native code, using the host's flags.
+static bool CanEmitConditionalJump(
+    const Instruction* instruction, const JITALUInstruction* alu) {
+  enum {
+    // Opcodes of conditional jumps. JO is the first and JG the last.
+    kOpcodeJO = 0x70,
+    kOpcodeJB = 0x72,
+    kOpcodeJAE = 0x73,
+    kOpcodeJBE = 0x76,
+    kOpcodeJA = 0x77,
+    kOpcodeJG = 0x7F,
+  };
+  const uint8_t opcode = instruction->opcode;
+  if (instruction->prefix_size > 0 || opcode < kOpcodeJO ||
+      opcode > kOpcodeJG) {
+    return false;
+  }
+  // INC and DEC do not produce CF, so JB, JAE, JBE and JA need the 8086's CF.
+  const bool reads_cf = opcode == kOpcodeJB || opcode == kOpcodeJAE ||
+                        opcode == kOpcodeJBE || opcode == kOpcodeJA;
+  return !reads_cf || (alu->op != kJITALUInc && alu->op != kJITALUDec);
+}
+
+// Emit native code for a conditional jump that ends a block, given the host's
+// flags set by EmitALUInstruction(). ip_delta is the distance from IP in
+// CPUState to the instruction after the jump. If the jump is taken, its extra
+// clock cycles are added to the JIT's current_block_variable_clock_cycles.
+//
+// j<cc> taken
+// add word [rbx + IP], ip_delta
+// jmp done
+// taken:
+// add word [rbx + IP], ip_delta + rel8
+// mov rax, &jit->current_block_variable_clock_cycles
+// add dword [rax], taken_clock_cycles
+// done:
+static void EmitConditionalJump(
+    JITEmitter* emitter, CPUJIT* jit, const Instruction* instruction,
+    uint16_t ip_delta) {
+  static const uint8_t kAddDwordToRAX[] = {0x81, 0x00};
+  enum {
+    // Size of the code emitted by EmitAddIP.
+    kAddIPSize = 9,
+    // Size of the jmp to done.
+    kJumpSize = 2,
+    // Size of the code that counts the taken jump's clock cycles.
+    kAddClockCyclesSize = 16,
+  };
+  // Conditional jumps on the host have the same condition codes as on the
+  // 8086.
+  EmitByte(emitter, instruction->opcode);
+  EmitByte(emitter, kAddIPSize + kJumpSize);
+  EmitAddIP(emitter, ip_delta);
+  EmitByte(emitter, 0xEB);
+  EmitByte(emitter, kAddIPSize + kAddClockCyclesSize);
+  EmitAddIP(emitter, (uint16_t)(ip_delta + (int8_t)instruction->immediate[0]));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(
+      emitter, (uint64_t)(uintptr_t)&jit->current_block_variable_clock_cycles);
+  EmitBytes(emitter, kAddDwordToRAX, sizeof(kAddDwordToRAX));
+  EmitDword(emitter, GetBranchTakenVariableClockCycles(instruction));
+}
+
+// Emit native code for an instruction that only moves data between registers
+// or from an immediate to a register. Such instructions cannot fault, touch
+// memory or affect flags. Returns false if the instruction is not supported.
+static bool EmitNativeInstruction(
+    JITEmitter* emitter, const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+    // Value of the ModR/M REG field for CS.
+    kModRMRegCS = kCS - kES,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  // NOP
+  if (opcode == 0x90) {
+    return true;
+  }
+  // MOV AL/CL/DL/BL/AH/CH/DH/BH, imm8
+  if (opcode >= 0xB0 && opcode <= 0xB7) {
+    EmitMoveImmediateByte(
+        emitter, GetByteRegisterDisplacement(opcode - 0xB0),
+        instruction->immediate[0]);
+    return true;
+  }
+  // MOV AX/CX/DX/BX/SP/BP/SI/DI, imm16
+  if (opcode >= 0xB8 && opcode <= 0xBF) {
+    EmitMoveImmediateWord(
+        emitter, GetRegisterDisplacement((RegisterIndex)(opcode - 0xB8), 0),
+        (uint16_t)(instruction->immediate[0] |
+                   (instruction->immediate[1] << 8)));
+    return true;
+  }
+  if (!instruction->has_mod_rm || mod_rm->mod != kModRMModRegister) {
+    return false;
+  }
+  switch (opcode) {
+    // MOV r/m8, r8
+    case 0x88:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->rm),
+          GetByteRegisterDisplacement(mod_rm->reg));
+      return true;
+    // MOV r8, r/m8
+    case 0x8A:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->reg),
+          GetByteRegisterDisplacement(mod_rm->rm));
+      return true;
+    // MOV r/m16, r16
+    case 0x89:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0));
+      return true;
+    // MOV r16, r/m16
+    case 0x8B:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    // MOV r/m16, sreg
+    case 0x8C:
+      if (mod_rm->reg >= kNumSegmentRegisters) {
+        return false;
+      }
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)(kES + mod_rm->reg), 0));
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      if (mod_rm->reg >= kNumSegmentRegisters || mod_rm->reg == kModRMRegCS) {
+        return false;
+      }
+      EmitMoveSegmentRegister(
+          emitter, (RegisterIndex)(kES + mod_rm->reg),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    default:
+      return false;
+  }
+}
+
+YAX86_PRIVATE bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block) {
+  return block->native_code && block->jit_epoch == jit->epoch;
+}
+
+YAX86_PRIVATE bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler) {
+  if (jit->code_size < kCPUJITMaxBlockCodeSize) {
+    return false;
+  }
+  // Flush the code buffer if it is full. This invalidates the native code of
+  // all blocks compiled so far.
+  if (jit->code_size - jit->code_used < kCPUJITMaxBlockCodeSize) {
+    jit->code_used = 0;
+    ++jit->epoch;
+    ++jit->num_flushes;
+  }
+
+  JITEmitter emitter = {
+      .start = jit->code + jit->code_used,
+      .next = jit->code + jit->code_used,
+  };
+  EmitPrologue(&emitter);
+  // IP is only updated in CPUState before calling into the interpreter and at
+  // the end of the block.
+  uint16_t pending_ip_delta = 0;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const CPUBlockInstruction* entry = &block->instructions[i];
+    JITALUInstruction alu;
+    if (DecodeALUInstruction(&entry->instruction, &alu)) {
+      // A conditional jump that ends the block right after the ALU
+      // instruction is compiled together with it, using the host's flags.
+      const CPUBlockInstruction* jump =
+          i + 2 == block->num_instructions ? entry + 1 : NULL;
+      if (jump && !CanEmitConditionalJump(&jump->instruction, &alu)) {
+        jump = NULL;
+      }
+      EmitALUInstruction(&emitter, &alu, jump != NULL);
+      pending_ip_delta += entry->instruction.size;
+      if (jump) {
+        EmitConditionalJump(
+            &emitter, jit, &jump->instruction,
+            pending_ip_delta + jump->instruction.size);
+        pending_ip_delta = 0;
+        break;
+      }
+      continue;
+    }
+    if (EmitNativeInstruction(&emitter, &entry->instruction)) {
+      pending_ip_delta += entry->instruction.size;
+      continue;
+    }
+    if (pending_ip_delta) {
+      EmitAddIP(&emitter, pending_ip_delta);
+      pending_ip_delta = 0;
+    }
+    EmitInterpreterCall(&emitter, entry, handler, i + 1);
+  }
+  if (pending_ip_delta) {
+    EmitAddIP(&emitter, pending_ip_delta);
+  }
+  EmitReturn(&emitter, block->num_instructions);
+
+  block->native_code = emitter.start;
+  block->jit_epoch = jit->epoch;
+  jit->code_used += (uint32_t)(emitter.next - emitter.start);
+  ++jit->num_compiled_blocks;
+  return true;
+}
+
+// Signature of a compiled block.
+typedef uint32_t (*JITCompiledBlockFn)(CPUState* cpu);
+
+YAX86_PRIVATE uint32_t
+RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block) {
+  // ISO C does not allow casting a data pointer to a function pointer, so
+  // convert through a union instead.
+  union {
+    uint8_t* code;
+    JITCompiledBlockFn fn;
+  } native_code = {.code = block->native_code};
+  jit->current_block = block;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  ++jit->num_native_executions;
+  return native_code.fn(cpu);
+}
+
+#endif  // YAX86_CPU_HAS_JIT
+
+
+// ==============================================================================
+// src/cpu/jit.c end
 // ==============================================================================
 
 // ==============================================================================
@@ -5539,9 +9263,14 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
 #line 1 "./src/cpu/cpu.c"
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
+#include "block_cache.h"
+#include "fusion.h"
+#include "instruction_cache.h"
 #include "instructions.h"
+#include "jit.h"
 #include "operands.h"
 #include "public.h"
+#include "timing.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
 
@@ -5557,6 +9286,14 @@ void CPUInit(CPUState* cpu, CPUConfig* config) {
   cpu->config = config;
 }
 
+// Derive the segment base addresses from the segment registers, which the host
+// may have written directly.
+static inline void SyncSegmentBases(CPUState* cpu) {
+  for (int i = kES; i <= kDS; ++i) {
+    CPUSetSegmentRegister(cpu, (RegisterIndex)i, cpu->registers[i]);
+  }
+}
+
 // ============================================================================
 // Instruction decoding
 // ============================================================================
@@ -5616,12 +9353,12 @@ static uint8_t GetImmediateSize(const OpcodeMetadata* metadata, uint8_t reg) {
   }
 }
 
-CPUFetchNextInstructionStatus CPUFetchNextInstruction(
-    CPUState* cpu, Instruction* dest_instruction) {
+// Decode the instruction at CS:original_ip from memory.
+static CPUFetchNextInstructionStatus DecodeInstruction(
+    CPUState* cpu, uint16_t original_ip, Instruction* dest_instruction) {
   Instruction instruction = {0};
   uint8_t current_byte;
-  const uint16_t original_ip = cpu->registers[kIP];
-  uint16_t ip = cpu->registers[kIP];
+  uint16_t ip = original_ip;
 
   // Prefix
   current_byte = ReadNextInstructionByte(cpu, &ip);
@@ -5661,60 +9398,137 @@ CPUFetchNextInstructionStatus CPUFetchNextInstruction(
   }
 
   instruction.size = ip - original_ip;
+  ResolveMemoryOperand(&instruction);
 
   *dest_instruction = instruction;
   return kFetchSuccess;
 }
 
+// Fetch the next instruction from CS:IP along with its opcode metadata, using
+// the instruction cache if available.
+static CPUFetchNextInstructionStatus FetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction,
+    const OpcodeMetadata** dest_metadata) {
+  CPUInstructionCache* cache = cpu->config->instruction_cache;
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  if (cache) {
+    const CPUInstructionCacheEntry* entry =
+        LookupInstructionCache(cache, address);
+    if (entry) {
+      *dest_instruction = entry->instruction;
+      *dest_metadata = entry->metadata;
+      return kFetchSuccess;
+    }
+  }
+
+  CPUFetchNextInstructionStatus status =
+      DecodeInstruction(cpu, ip, dest_instruction);
+  if (status != kFetchSuccess) {
+    return status;
+  }
+  *dest_metadata = &opcode_table[dest_instruction->opcode];
+  if (cache) {
+    FillInstructionCache(cache, address, ip, dest_instruction, *dest_metadata);
+  }
+  return kFetchSuccess;
+}
+
+CPUFetchNextInstructionStatus CPUFetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction) {
+  const OpcodeMetadata* metadata;
+  SyncSegmentBases(cpu);
+  return FetchNextInstruction(cpu, dest_instruction, &metadata);
+}
+
 // ============================================================================
 // Execution
 // ============================================================================
 
-ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+// Returns the handler for a decoded instruction, preferring a handler
+// specialized for the addressing mode of its ModR/M byte if there is one.
+static inline OpcodeHandler GetOpcodeHandler(
+    const OpcodeMetadata* metadata, const Instruction* instruction) {
+  OpcodeHandler handler =
+      metadata->specialized_handlers
+          [instruction->mod_rm.mod == 3 ? kModRMClassRegister
+                                        : kModRMClassMemory];
+  return handler ? handler : metadata->handler;
+}
+
+// Run the handler for a decoded instruction, without any callbacks.
+static inline ExecuteStatus RunInstructionHandler(
+    CPUState* cpu, const Instruction* instruction,
+    const OpcodeMetadata* metadata) {
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = instruction,
+      .metadata = metadata,
+  };
+  return GetOpcodeHandler(metadata, instruction)(&context);
+}
+
+// Execute a single instruction. If metadata is provided, the instruction is
+// known to have been produced by the decoder and is not validated again.
+static ExecuteStatus ExecuteInstruction(
+    CPUState* cpu, Instruction* instruction, const OpcodeMetadata* metadata) {
   ExecuteStatus status;
 
   // Run the on_before_execute_instruction callback if provided.
-  if (cpu->config->on_before_execute_instruction &&
-      (status = cpu->config->on_before_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_before_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_before_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
+    // The callback may have modified the instruction.
+    metadata = NULL;
   }
 
-  const OpcodeMetadata* metadata = &opcode_table[instruction->opcode];
+  if (!metadata) {
+    metadata = &opcode_table[instruction->opcode];
+    // Check encoded instruction against expected instruction format.
+    if (metadata->handler &&
+        (instruction->has_mod_rm != metadata->has_modrm ||
+         instruction->immediate_size !=
+             (metadata->has_modrm
+                  ? GetImmediateSize(metadata, instruction->mod_rm.reg)
+                  : metadata->immediate_size))) {
+      return kExecuteInvalidInstruction;
+    }
+    ResolveMemoryOperand(instruction);
+  }
   if (!metadata->handler) {
     return kExecuteInvalidOpcode;
   }
 
-  // Check encoded instruction against expected instruction format.
-  if (instruction->has_mod_rm != metadata->has_modrm) {
-    return kExecuteInvalidInstruction;
-  }
-  if (instruction->immediate_size !=
-      (metadata->has_modrm ? GetImmediateSize(metadata, instruction->mod_rm.reg)
-                           : metadata->immediate_size)) {
-    return kExecuteInvalidInstruction;
-  }
-
   // Run the instruction handler.
-  InstructionContext context = {
-      .cpu = cpu,
-      .instruction = instruction,
-      .metadata = metadata,
-  };
-  if ((status = metadata->handler(&context)) != kExecuteSuccess) {
+  if ((status = RunInstructionHandler(cpu, instruction, metadata)) !=
+      kExecuteSuccess) {
     return status;
   }
 
   // Run the on_after_execute_instruction callback if provided.
-  if (cpu->config->on_after_execute_instruction &&
-      (status = cpu->config->on_after_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_after_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_after_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
   }
 
   return kExecuteSuccess;
 }
 
+ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = ExecuteInstruction(cpu, instruction, NULL);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
 // Process pending interrupt, if any.
 static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   if (!cpu->has_pending_interrupt) {
@@ -5725,7 +9539,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
 
   // Prepare for interrupt processing.
   cpu->is_halted = false;
-  Push(cpu, WordValue(cpu->flags));
+  Push(cpu, WordValue(CPUGetFlags(cpu)));
   CPUSetFlag(cpu, kIF, false);
   CPUSetFlag(cpu, kTF, false);
   Push(cpu, WordValue(cpu->registers[kCS]));
@@ -5738,6 +9552,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       cpu->config->handle_interrupt
           ? cpu->config->handle_interrupt(cpu, interrupt_number)
           : kExecuteUnhandledInterrupt;
+  SyncSegmentBases(cpu);
 
   switch (interrupt_handler_status) {
     case kExecuteSuccess: {
@@ -5751,7 +9566,8 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       // Table.
       uint16_t ivt_entry_offset = interrupt_number << 2;
       cpu->registers[kIP] = ReadRawMemoryWord(cpu, ivt_entry_offset);
-      cpu->registers[kCS] = ReadRawMemoryWord(cpu, ivt_entry_offset + 2);
+      CPUSetSegmentRegister(
+          cpu, kCS, ReadRawMemoryWord(cpu, ivt_entry_offset + 2));
       return kExecuteSuccess;
     }
     default:
@@ -5760,43 +9576,818 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   }
 }
 
-ExecuteStatus CPUTick(CPUState* cpu) {
+// Handle pending interrupts and single-step execution at the end of an
+// instruction cycle.
+static ExecuteStatus FinishTick(CPUState* cpu) {
+  ExecuteStatus status;
+
+  // Step 3: Handle pending interrupts.
+  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+    return status;
+  }
+
+  // Step 4: If trap flag is set, handle single-step execution.
+  if (CPUGetFlag(cpu, kTF)) {
+    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
+    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+      return status;
+    }
+  }
+
+  return kExecuteSuccess;
+}
+
+// Count instruction cycles spent halted, each of which takes one clock cycle.
+static inline void CountHaltedCycles(CPUState* cpu, uint32_t num_cycles) {
+  cpu->cycles += num_cycles;
+  cpu->idle_cycles += num_cycles;
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += num_cycles;
+  }
+}
+
+// Count the clock cycles taken by an instruction that was just executed, on
+// top of the instruction cycle already counted, given IP after the instruction
+// was fetched and CX before it was executed. Returns the clock cycles taken.
+static inline uint32_t CountInstructionClockCycles(
+    CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint32_t clock_cycles =
+      GetInstructionClockCycles(cpu, instruction, next_ip, cx);
+  cpu->cycles += clock_cycles - 1;
+  cpu->clock_cycles += clock_cycles;
+  return clock_cycles;
+}
+
+// Run a single instruction cycle, leaving arithmetic flags pending.
+static ExecuteStatus Tick(CPUState* cpu) {
   ExecuteStatus status;
 
   // Execute next CPU instruction if not halted.
   if (!cpu->is_halted) {
+    ++cpu->cycles;
     // Step 1: Fetch the next instruction, and increment IP.
     Instruction instruction;
+    const OpcodeMetadata* metadata;
     CPUFetchNextInstructionStatus fetch_status =
-        CPUFetchNextInstruction(cpu, &instruction);
+        FetchNextInstruction(cpu, &instruction, &metadata);
     if (fetch_status != kFetchSuccess) {
       return kExecuteInvalidInstruction;
     }
     cpu->registers[kIP] += instruction.size;
+    const uint16_t next_ip = cpu->registers[kIP];
+    const uint16_t cx = cpu->registers[kCX];
 
     // Step 2: Execute the instruction.
-    status = CPUExecuteInstruction(cpu, &instruction);
+    status = ExecuteInstruction(cpu, &instruction, metadata);
     if (status != kExecuteSuccess && status != kExecuteHalt) {
       return status;
     }
+    if (cpu->config->use_clock_cycles) {
+      CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+    }
+  } else {
+    CountHaltedCycles(cpu, 1);
   }
 
-  // Step 3: Handle pending interrupts.
-  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+  return FinishTick(cpu);
+}
+
+ExecuteStatus CPUTick(CPUState* cpu) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Tick(cpu);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Block execution
+// ============================================================================
+
+// Returns whether the string instruction has a REP or REPNZ prefix.
+static bool HasRepetitionPrefix(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns whether an instruction ends a block. This includes all control
+// transfers, REP string instructions, and instructions that may change CS,
+// halt the CPU or enable interrupts.
+static bool IsBlockTerminator(const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M REG field for MOV sreg, r/m16 targeting CS.
+    kModRMRegCS = kCS - kES,
+  };
+  switch (instruction->opcode) {
+    // Jcc rel8
+    case 0x70:
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    case 0x74:
+    case 0x75:
+    case 0x76:
+    case 0x77:
+    case 0x78:
+    case 0x79:
+    case 0x7A:
+    case 0x7B:
+    case 0x7C:
+    case 0x7D:
+    case 0x7E:
+    case 0x7F:
+    // CALL ptr16:16
+    case 0x9A:
+    // POPF
+    case 0x9D:
+    // RET imm16, RET, RETF imm16, RETF
+    case 0xC2:
+    case 0xC3:
+    case 0xCA:
+    case 0xCB:
+    // INT 3, INT imm8, INTO, IRET
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+    // LOOPNZ, LOOPZ, LOOP, JCXZ
+    case 0xE0:
+    case 0xE1:
+    case 0xE2:
+    case 0xE3:
+    // CALL rel16, JMP rel16, JMP ptr16:16, JMP rel8
+    case 0xE8:
+    case 0xE9:
+    case 0xEA:
+    case 0xEB:
+    // HLT
+    case 0xF4:
+    // STI
+    case 0xFB:
+    // POP CS
+    case 0x0F:
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      return instruction->mod_rm.reg == kModRMRegCS;
+    // Group 5 - CALL and JMP through r/m16 or m16:16
+    case 0xFF:
+      return instruction->mod_rm.reg >= 2 && instruction->mod_rm.reg <= 5;
+    // MOVS, CMPS, STOS, LODS, SCAS
+    case 0xA4:
+    case 0xA5:
+    case 0xA6:
+    case 0xA7:
+    case 0xAA:
+    case 0xAB:
+    case 0xAC:
+    case 0xAD:
+    case 0xAE:
+    case 0xAF:
+      return HasRepetitionPrefix(instruction);
+    default:
+      return false;
+  }
+}
+
+// Translate the block starting at CS:IP. Returns NULL if not even the first
+// instruction could be added to a block, in which case the caller should fall
+// back to CPUTick().
+static CPUBlock* TranslateBlock(
+    CPUState* cpu, CPUBlockCache* cache, uint32_t address) {
+  uint16_t ip = cpu->registers[kIP];
+  uint32_t page_offset = address % kCPUInstructionCachePageSize;
+  CPUBlock* block = AllocateBlock(cache, address);
+  while (block->num_instructions < kCPUMaxBlockInstructions) {
+    CPUBlockInstruction* entry =
+        &block->instructions[block->num_instructions];
+    if (DecodeInstruction(cpu, ip, &entry->instruction) != kFetchSuccess) {
+      break;
+    }
+    uint8_t size = entry->instruction.size;
+    // Stop before instructions that wrap around the end of the code segment or
+    // straddle two pages, as in the instruction cache.
+    if ((uint32_t)ip + size > 0x10000 ||
+        page_offset + block->size + size > kCPUInstructionCachePageSize) {
+      break;
+    }
+    entry->metadata = &opcode_table[entry->instruction.opcode];
+    entry->has_variable_clock_cycles =
+        HasVariableClockCycles(&entry->instruction);
+    entry->clock_cycles =
+        (uint16_t)GetInstructionBaseClockCycles(&entry->instruction);
+    entry->block_clock_cycles =
+        block->num_instructions
+            ? entry[-1].block_clock_cycles + entry[-1].clock_cycles
+            : 0;
+    ++block->num_instructions;
+    block->size += size;
+    ip += size;
+    if (!entry->metadata->handler || IsBlockTerminator(&entry->instruction)) {
+      break;
+    }
+  }
+  if (block->num_instructions == 0) {
+    return NULL;
+  }
+  FuseBlockInstructions(block);
+  CommitBlock(cache, block);
+  return block;
+}
+
+// Returns the block starting at CS:IP, translating it if needed. If previous
+// is not NULL, the block is looked up through the previous block's successor
+// links first.
+static CPUBlock* GetBlock(
+    CPUState* cpu, CPUBlockCache* cache, CPUBlock* previous) {
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  CPUBlock* block =
+      previous ? LookupSuccessorBlock(cache, previous, address, ip)
+               : LookupBlockCache(cache, address, ip);
+  if (block) {
+    if (previous) {
+      LinkSuccessorBlock(previous, block);
+    }
+    return block;
+  }
+  block = TranslateBlock(cpu, cache, address);
+  // Translating the block may have evicted the previous block from the cache.
+  if (block && previous && previous != block) {
+    LinkSuccessorBlock(previous, block);
+  }
+  return block;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Execute an instruction on behalf of native code. Returns true if native
+// execution should stop after the instruction, under the same conditions as
+// CPUTickBlock().
+static bool ExecuteJITInstruction(
+    CPUState* cpu, const CPUBlockInstruction* entry) {
+  CPUJIT* jit = cpu->config->jit;
+  const CPUBlock* block = jit->current_block;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  Instruction instruction = entry->instruction;
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  cpu->cycles = jit->current_block_start_cycles +
+                (use_clock_cycles
+                     ? entry->block_clock_cycles +
+                           jit->current_block_variable_clock_cycles
+                     : (uint32_t)(entry - block->instructions)) +
+                1;
+  jit->status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+  jit->stopped = jit->status != kExecuteSuccess || cpu->is_halted ||
+                 cpu->has_pending_interrupt || cpu->stop_requested ||
+                 CPUGetFlag(cpu, kTF) ||
+                 !IsBlockValid(cpu->config->block_cache, block);
+  if (use_clock_cycles && entry->has_variable_clock_cycles) {
+    jit->current_block_variable_clock_cycles +=
+        GetInstructionVariableClockCycles(cpu, &instruction, next_ip, cx);
+    // Stop if the budget could run out before the last instruction, now that
+    // this instruction took longer than its base clock cycles.
+    const CPUBlockInstruction* last =
+        &block->instructions[block->num_instructions - 1];
+    if (entry != last && last->block_clock_cycles +
+                                 jit->current_block_variable_clock_cycles >=
+                             jit->current_block_max_cycles) {
+      jit->stopped = true;
+    }
+  }
+  return jit->stopped;
+}
+
+// Returns whether a block can be run as native code. Native code does not run
+// hooks or check for interrupts after instructions it translates itself, so
+// it must run the whole block without needing either. The budget must also
+// last until the block's last instruction, assuming each instruction takes
+// its base clock cycles with CPUConfig.use_clock_cycles.
+static bool CanRunCompiledBlock(
+    const CPUState* cpu, const CPUBlock* block, uint32_t max_block_cycles) {
+  const CPUBlockInstruction* last =
+      &block->instructions[block->num_instructions - 1];
+  const uint32_t cycles_before_last = cpu->config->use_clock_cycles
+                                          ? last->block_clock_cycles
+                                          : block->num_instructions - 1u;
+  return !cpu->config->on_before_execute_instruction &&
+         !cpu->config->on_after_execute_instruction &&
+         !cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF) &&
+         cycles_before_last < max_block_cycles;
+}
+
+// Run a block as native code if it is hot, compiling it if needed. Returns
+// false if the block should be interpreted instead.
+static bool TryRunCompiledBlock(
+    CPUState* cpu, CPUBlock* block, uint32_t max_block_cycles) {
+  CPUJIT* jit = cpu->config->jit;
+  if (block->execution_count < kCPUJITHotBlockThreshold) {
+    ++block->execution_count;
+    return false;
+  }
+  if (!CanRunCompiledBlock(cpu, block, max_block_cycles)) {
+    return false;
+  }
+  if (!IsBlockCompiled(jit, block) &&
+      !CompileBlock(jit, block, ExecuteJITInstruction)) {
+    return false;
+  }
+  jit->current_block_start_cycles = cpu->cycles;
+  jit->current_block_max_cycles = max_block_cycles;
+  jit->current_block_variable_clock_cycles = 0;
+  uint32_t block_instructions = RunCompiledBlock(jit, cpu, block);
+  if (cpu->config->use_clock_cycles) {
+    const CPUBlockInstruction* last =
+        &block->instructions[block_instructions - 1];
+    cpu->cycles = jit->current_block_start_cycles + last->block_clock_cycles +
+                  last->clock_cycles + jit->current_block_variable_clock_cycles;
+  } else {
+    cpu->cycles = jit->current_block_start_cycles + block_instructions;
+  }
+  return true;
+}
+
+#endif  // YAX86_CPU_HAS_JIT
+
+// Count the clock cycles taken by an instruction that was just executed from a
+// block, on top of the instruction cycle already counted, given IP after the
+// instruction was fetched and CX before it was executed.
+static inline void CountBlockInstructionClockCycles(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint16_t next_ip,
+    uint16_t cx) {
+  cpu->cycles += entry->clock_cycles - 1u;
+  if (entry->has_variable_clock_cycles) {
+    cpu->cycles += GetInstructionVariableClockCycles(
+        cpu, &entry->instruction, next_ip, cx);
+  }
+}
+
+// Execute the fused sequence starting at a block entry, as consecutive
+// instruction cycles without instruction callbacks. The first instruction of a
+// sequence never writes to memory or changes TF, so a pending interrupt or a
+// stop request are the only reasons to stop between the two instructions, in
+// which case only the first one is executed. Returns the number of
+// instructions executed in *num_executed.
+static ExecuteStatus ExecuteFusedSequence(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint8_t* num_executed) {
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  const Instruction* first = &entry[0].instruction;
+  cpu->registers[kIP] += first->size;
+  cpu->cycles += use_clock_cycles ? entry[0].clock_cycles : 1;
+  *num_executed = 1;
+  if (entry->fusion == kCPUFusionZeroRegister) {
+    ExecuteFusedZeroRegister(cpu, first, entry->metadata->width);
+    return kExecuteSuccess;
+  }
+  ExecuteStatus status = RunInstructionHandler(cpu, first, entry->metadata);
+  if (status != kExecuteSuccess || cpu->has_pending_interrupt ||
+      cpu->stop_requested) {
     return status;
   }
 
-  // Step 4: If trap flag is set, handle single-step execution.
-  if (CPUGetFlag(cpu, kTF)) {
-    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
-    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
-      return status;
+  const Instruction* second = &entry[1].instruction;
+  cpu->registers[kIP] += second->size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ++cpu->cycles;
+  *num_executed = 2;
+  // Resolve the conditional jump directly from the operands of the CMP, TEST,
+  // INC or DEC, leaving its flags pending.
+  bool is_taken;
+  if (entry->fusion != kCPUFusionLoadStore &&
+      EvaluateFusedJumpCondition(
+          &cpu->lazy_flags, second->opcode, &is_taken)) {
+    if (is_taken) {
+      cpu->registers[kIP] =
+          AddSignedOffsetByte(cpu->registers[kIP], second->immediate[0]);
+    }
+  } else {
+    status = RunInstructionHandler(cpu, second, entry[1].metadata);
+  }
+  if (use_clock_cycles) {
+    CountBlockInstructionClockCycles(cpu, &entry[1], next_ip, cx);
+  }
+  return status;
+}
+
+// Returns whether a loop block branched back to its own start.
+static inline bool IsLoopBack(const CPUState* cpu, const CPUBlock* block) {
+  return block->is_loop &&
+         CPUGetSegmentBase(cpu, kCS) + cpu->registers[kIP] == block->address;
+}
+
+// Skip iterations of a loop block that branched back to its own start, if
+// their effect is known in advance. Delay loops and loops that wait for memory
+// or a port to change can then use up the instruction budget at once. The last
+// iteration took iteration_cycles, leaving max_cycles of the budget.
+static void SkipLoopIterations(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_cycles, uint32_t iteration_cycles) {
+  const uint32_t num_iterations = FastForwardLoop(
+      cpu, block, snapshot, max_cycles / iteration_cycles, iteration_cycles);
+  cpu->config->block_cache->num_skipped_loop_iterations += num_iterations;
+}
+
+// Run instructions in translated blocks starting with the given block, until
+// max_cycles instruction cycles have been counted since start_cycles.
+static ExecuteStatus RunBlocks(
+    CPUState* cpu, CPUBlock* block, uint32_t start_cycles,
+    uint32_t max_cycles) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  // Fused sequences are only executed as a single step if no callback needs
+  // to see the individual instructions.
+  const bool can_fuse = !cpu->config->on_before_execute_instruction &&
+                        !cpu->config->on_after_execute_instruction;
+  LoopSnapshot snapshot = {0};
+
+  for (;;) {
+    const uint32_t block_start_cycles = cpu->cycles;
+#ifdef YAX86_CPU_HAS_JIT
+    if (cpu->config->jit &&
+        TryRunCompiledBlock(
+            cpu, block, max_cycles - (cpu->cycles - start_cycles))) {
+      CPUJIT* jit = cpu->config->jit;
+      if (jit->status != kExecuteSuccess && jit->status != kExecuteHalt) {
+        return jit->status;
+      }
+      if (jit->stopped || cpu->cycles - start_cycles >= max_cycles) {
+        return FinishTick(cpu);
+      }
+      if (IsLoopBack(cpu, block)) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      } else {
+        snapshot.block = NULL;
+      }
+      if (!(block = GetBlock(cpu, cache, block))) {
+        return kExecuteSuccess;
+      }
+      continue;
+    }
+#endif  // YAX86_CPU_HAS_JIT
+    for (uint8_t i = 0; i < block->num_instructions;) {
+      const CPUBlockInstruction* entry = &block->instructions[i];
+      const uint32_t remaining_cycles =
+          max_cycles - (cpu->cycles - start_cycles);
+      ExecuteStatus status;
+      uint8_t num_executed;
+      const uint8_t fusion_length =
+          GetFusionLength((CPUFusionKind)entry->fusion);
+      // The last instruction of a fused sequence must start within the budget.
+      if (entry->fusion != kCPUFusionNone && can_fuse &&
+          !CPUGetFlag(cpu, kTF) &&
+          (fusion_length == 1 ||
+           remaining_cycles > (use_clock_cycles ? entry->clock_cycles : 1u))) {
+        status = ExecuteFusedSequence(cpu, entry, &num_executed);
+        if (num_executed == fusion_length) {
+          ++cache->fusion_counts[entry->fusion];
+        }
+      } else {
+        // Copy the instruction, as the on_before_execute_instruction callback
+        // may modify it.
+        Instruction instruction = entry->instruction;
+        cpu->registers[kIP] += instruction.size;
+        const uint16_t next_ip = cpu->registers[kIP];
+        const uint16_t cx = cpu->registers[kCX];
+        ++cpu->cycles;
+        status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+        if (use_clock_cycles) {
+          CountBlockInstructionClockCycles(cpu, entry, next_ip, cx);
+        }
+        num_executed = 1;
+      }
+      i += num_executed;
+      if (status != kExecuteSuccess && status != kExecuteHalt) {
+        return status;
+      }
+      // Stop at the end of the instruction cycle if it needs interrupt
+      // handling, if the host asked to stop, or if it wrote to the block's own
+      // code.
+      if (cpu->is_halted || cpu->has_pending_interrupt ||
+          cpu->stop_requested || CPUGetFlag(cpu, kTF) ||
+          cpu->cycles - start_cycles >= max_cycles ||
+          !IsBlockValid(cache, block)) {
+        return FinishTick(cpu);
+      }
+    }
+    // Run a loop block again directly if it branched back to its own start.
+    // Iterations are only skipped if no callback needs to see them.
+    if (IsLoopBack(cpu, block)) {
+      ++cache->fusion_counts[kCPUFusionLoop];
+      if (can_fuse) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      }
+      continue;
+    }
+    // Follow the link to the next block.
+    snapshot.block = NULL;
+    if (!(block = GetBlock(cpu, cache, block))) {
+      return kExecuteSuccess;
     }
   }
+}
+
+// Run instructions in translated blocks, leaving arithmetic flags pending.
+static ExecuteStatus TickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const uint32_t start_cycles = cpu->cycles;
+  *num_instructions = 0;
+  if (max_instructions == 0) {
+    return kExecuteSuccess;
+  }
+  CPUBlock* block =
+      (cache && !cpu->is_halted) ? GetBlock(cpu, cache, NULL) : NULL;
+  if (!block) {
+    ExecuteStatus status = Tick(cpu);
+    *num_instructions = cpu->cycles - start_cycles;
+    return status;
+  }
+  ExecuteStatus status = RunBlocks(cpu, block, start_cycles, max_instructions);
+  *num_instructions = cpu->cycles - start_cycles;
+  // Clock cycles are counted in instruction cycles while running blocks.
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += *num_instructions;
+  }
+  return status;
+}
+
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = TickBlock(cpu, max_instructions, num_instructions);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Batched execution
+// ============================================================================
 
+// Run a single instruction cycle like Tick(), but without checking for
+// instruction callbacks.
+static ExecuteStatus TickWithoutCallbacks(CPUState* cpu) {
+  ++cpu->cycles;
+  Instruction instruction;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, &instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
+  }
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ExecuteStatus status =
+      metadata->handler
+          ? RunInstructionHandler(cpu, &instruction, metadata)
+          : kExecuteInvalidOpcode;
+  if (status != kExecuteSuccess && status != kExecuteHalt) {
+    return status;
+  }
+  if (cpu->config->use_clock_cycles) {
+    CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+  }
+  return FinishTick(cpu);
+}
+
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Labels of the opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_LABEL_ROW(row)                                           \
+  &&opcode_##row##0, &&opcode_##row##1, &&opcode_##row##2, &&opcode_##row##3, \
+      &&opcode_##row##4, &&opcode_##row##5, &&opcode_##row##6,                \
+      &&opcode_##row##7, &&opcode_##row##8, &&opcode_##row##9,                \
+      &&opcode_##row##A, &&opcode_##row##B, &&opcode_##row##C,                \
+      &&opcode_##row##D, &&opcode_##row##E, &&opcode_##row##F
+
+// Opcode handler in RunThreaded(). As the opcode is a constant, the compiler
+// can call the handler directly, and inline it with its metadata. Only
+// opcodes with specialized handlers check the ModR/M byte.
+#define YAX86_OPCODE_HANDLER(opcode)                                          \
+  opcode_##opcode:                                                            \
+  context.metadata = &opcode_table[0x##opcode];                               \
+  status = opcode_table[0x##opcode].handler                                   \
+               ? GetOpcodeHandler(&opcode_table[0x##opcode], &instruction)(   \
+                     &context)                                                \
+               : kExecuteInvalidOpcode;                                       \
+  YAX86_DISPATCH_NEXT_OPCODE()
+
+// Opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_HANDLER_ROW(row)                                         \
+  YAX86_OPCODE_HANDLER(row##0)                                                \
+  YAX86_OPCODE_HANDLER(row##1)                                                \
+  YAX86_OPCODE_HANDLER(row##2)                                                \
+  YAX86_OPCODE_HANDLER(row##3)                                                \
+  YAX86_OPCODE_HANDLER(row##4)                                                \
+  YAX86_OPCODE_HANDLER(row##5)                                                \
+  YAX86_OPCODE_HANDLER(row##6)                                                \
+  YAX86_OPCODE_HANDLER(row##7)                                                \
+  YAX86_OPCODE_HANDLER(row##8)                                                \
+  YAX86_OPCODE_HANDLER(row##9)                                                \
+  YAX86_OPCODE_HANDLER(row##A)                                                \
+  YAX86_OPCODE_HANDLER(row##B)                                                \
+  YAX86_OPCODE_HANDLER(row##C)                                                \
+  YAX86_OPCODE_HANDLER(row##D)                                                \
+  YAX86_OPCODE_HANDLER(row##E)                                                \
+  YAX86_OPCODE_HANDLER(row##F)
+
+// Finish the current instruction cycle, then fetch the next instruction and
+// jump to the handler for its opcode. Each handler has its own copy of the
+// indirect jump, which lets the host predict opcode sequences.
+#define YAX86_DISPATCH_NEXT_OPCODE()                                          \
+  ++cycles;                                                                   \
+  if (status != kExecuteSuccess && status != kExecuteHalt) {                  \
+    goto done;                                                                \
+  }                                                                           \
+  if (use_clock_cycles) {                                                     \
+    cycles +=                                                                 \
+        CountInstructionClockCycles(cpu, &instruction, next_ip, cx) - 1;      \
+  }                                                                           \
+  if ((status = FinishTick(cpu)) != kExecuteSuccess ||                        \
+      cycles >= max_cycles || cpu->is_halted || cpu->stop_requested) {        \
+    goto done;                                                                \
+  }                                                                           \
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=               \
+      kExecuteSuccess) {                                                      \
+    ++cycles;                                                                 \
+    goto done;                                                                \
+  }                                                                           \
+  next_ip = cpu->registers[kIP];                                              \
+  cx = cpu->registers[kCX];                                                   \
+  goto *kOpcodeLabels[instruction.opcode];
+
+// Start an instruction cycle and fetch the next instruction for
+// RunThreaded().
+static inline ExecuteStatus FetchThreadedInstruction(
+    CPUState* cpu, Instruction* instruction) {
+  ++cpu->cycles;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
+  }
+  cpu->registers[kIP] += instruction->size;
   return kExecuteSuccess;
 }
 
+// Computed gotos are a GCC and Clang extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Run instruction cycles like TickWithoutCallbacks() until the budget is used
+// up, the CPU halts or execution needs to return to the host. Instead of
+// calling opcode handlers through the opcode table, this jumps directly from
+// one opcode's handler to the next with computed gotos.
+static ExecuteStatus RunThreaded(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  static const void* const kOpcodeLabels[256] = {
+      YAX86_OPCODE_LABEL_ROW(0),
+      YAX86_OPCODE_LABEL_ROW(1),
+      YAX86_OPCODE_LABEL_ROW(2),
+      YAX86_OPCODE_LABEL_ROW(3),
+      YAX86_OPCODE_LABEL_ROW(4),
+      YAX86_OPCODE_LABEL_ROW(5),
+      YAX86_OPCODE_LABEL_ROW(6),
+      YAX86_OPCODE_LABEL_ROW(7),
+      YAX86_OPCODE_LABEL_ROW(8),
+      YAX86_OPCODE_LABEL_ROW(9),
+      YAX86_OPCODE_LABEL_ROW(A),
+      YAX86_OPCODE_LABEL_ROW(B),
+      YAX86_OPCODE_LABEL_ROW(C),
+      YAX86_OPCODE_LABEL_ROW(D),
+      YAX86_OPCODE_LABEL_ROW(E),
+      YAX86_OPCODE_LABEL_ROW(F),
+  };
+  Instruction instruction;
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = &instruction,
+      .metadata = NULL,
+  };
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  ExecuteStatus status;
+  uint32_t cycles = 0;
+  // IP after the current instruction was fetched, and CX before it was
+  // executed, for timing it in clock cycles.
+  uint16_t next_ip;
+  uint16_t cx;
+  if (max_cycles == 0) {
+    *num_cycles = 0;
+    return kExecuteSuccess;
+  }
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=
+      kExecuteSuccess) {
+    *num_cycles = 1;
+    return status;
+  }
+  next_ip = cpu->registers[kIP];
+  cx = cpu->registers[kCX];
+  goto *kOpcodeLabels[instruction.opcode];
+
+  YAX86_OPCODE_HANDLER_ROW(0)
+  YAX86_OPCODE_HANDLER_ROW(1)
+  YAX86_OPCODE_HANDLER_ROW(2)
+  YAX86_OPCODE_HANDLER_ROW(3)
+  YAX86_OPCODE_HANDLER_ROW(4)
+  YAX86_OPCODE_HANDLER_ROW(5)
+  YAX86_OPCODE_HANDLER_ROW(6)
+  YAX86_OPCODE_HANDLER_ROW(7)
+  YAX86_OPCODE_HANDLER_ROW(8)
+  YAX86_OPCODE_HANDLER_ROW(9)
+  YAX86_OPCODE_HANDLER_ROW(A)
+  YAX86_OPCODE_HANDLER_ROW(B)
+  YAX86_OPCODE_HANDLER_ROW(C)
+  YAX86_OPCODE_HANDLER_ROW(D)
+  YAX86_OPCODE_HANDLER_ROW(E)
+  YAX86_OPCODE_HANDLER_ROW(F)
+
+done:
+  *num_cycles = cycles;
+  return status;
+}
+
+#pragma GCC diagnostic pop
+
+#undef YAX86_OPCODE_LABEL_ROW
+#undef YAX86_OPCODE_HANDLER
+#undef YAX86_OPCODE_HANDLER_ROW
+#undef YAX86_DISPATCH_NEXT_OPCODE
+
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Run instruction cycles until the budget is used up or execution needs to
+// return to the host, leaving arithmetic flags pending.
+static ExecuteStatus Run(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  CPUBlockCache* const cache = cpu->config->block_cache;
+  const bool has_callbacks = cpu->config->on_before_execute_instruction ||
+                             cpu->config->on_after_execute_instruction;
+  ExecuteStatus status = kExecuteSuccess;
+  uint32_t cycles = 0;
+  while (cycles < max_cycles && !cpu->stop_requested) {
+    if (cpu->is_halted) {
+      if (!cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF)) {
+        // Nothing can wake up the CPU until the host raises an interrupt.
+        CountHaltedCycles(cpu, max_cycles - cycles);
+        cycles = max_cycles;
+        break;
+      }
+      CountHaltedCycles(cpu, 1);
+      ++cycles;
+      if ((status = FinishTick(cpu)) != kExecuteSuccess) {
+        break;
+      }
+      continue;
+    }
+    if (cache) {
+      uint32_t block_cycles;
+      status = TickBlock(cpu, max_cycles - cycles, &block_cycles);
+      cycles += block_cycles;
+    } else if (has_callbacks) {
+      const uint32_t start_cycles = cpu->cycles;
+      status = Tick(cpu);
+      cycles += cpu->cycles - start_cycles;
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+    } else if (!cpu->config->use_portable_dispatch) {
+      uint32_t threaded_cycles;
+      status = RunThreaded(cpu, max_cycles - cycles, &threaded_cycles);
+      cycles += threaded_cycles;
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+    } else {
+      const uint32_t start_cycles = cpu->cycles;
+      status = TickWithoutCallbacks(cpu);
+      cycles += cpu->cycles - start_cycles;
+    }
+    if (status != kExecuteSuccess || cpu->is_halted) {
+      break;
+    }
+  }
+  *num_cycles = cycles;
+  return status;
+}
+
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Run(cpu, max_cycles, num_cycles);
+  cpu->stop_requested = false;
+  CPUMaterializeFlags(cpu);
+  return status;
+}
 
 
 // ==============================================================================
@@ -227,6 +227,11 @@ void KeyboardHandleKeyPress(KeyboardState* keyboard, uint8_t scancode);
 // send buffered scancodes.
 void KeyboardTickMs(KeyboardState* keyboard);
 
+// Returns whether the next call to KeyboardTickMs() would do anything, i.e. a
+// reset timer is running or a buffered scancode can be sent. If this returns
+// false, the keyboard does not need to be ticked until its state changes.
+bool KeyboardNeedsTick(const KeyboardState* keyboard);
+
 #endif  // YAX86_KEYBOARD_PUBLIC_H
 
 
@@ -363,6 +368,16 @@ void KeyboardTickMs(KeyboardState* keyboard) {
   KeyboardSendNextScancode(keyboard);
 }
 
+bool KeyboardNeedsTick(const KeyboardState* keyboard) {
+  // Waiting for the clock line to be held low long enough to trigger reset.
+  if (keyboard->clock_low == false) {
+    return keyboard->clock_low_ms != kKeyboardResetTriggered;
+  }
+  // Waiting to send the next scancode.
+  return keyboard->enable_clear == false && !keyboard->waiting_for_ack &&
+         KeyboardBufferLength(&keyboard->buffer) > 0;
+}
+
 
 
 // ==============================================================================
@@ -102,6 +102,10 @@ typedef struct PITChannelState {
   PITByte rw_byte;
   // Whether a latch command is active.
   bool latch_active;
+  // Value of PITState.ticks at which counter and output_state were last
+  // brought up to date. Channels are only updated when accessed, except for
+  // channel 0 which is updated by PITTick() and PITAdvance().
+  uint32_t sync_ticks;
 } PITChannelState;
 
 // State of the PIT.
@@ -111,6 +115,9 @@ typedef struct PITState {
 
   // The three timer channels.
   PITChannelState channels[kPITNumChannels];
+
+  // Number of ticks of the PIT's input clock so far.
+  uint32_t ticks;
 } PITState;
 
 // Initializes the PIT to its power-on state.
@@ -126,6 +133,22 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value);
 // invoked at a frequency of 1.193182 MHz for accurate timing.
 void PITTick(PITState* pit);
 
+// Simulates num_ticks ticks of the PIT's input clock, with the same result as
+// calling PITTick() num_ticks times. Counters are computed from the elapsed
+// time, so this only takes time proportional to the number of output changes.
+void PITAdvance(PITState* pit, uint32_t num_ticks);
+
+enum {
+  // Return value of PITGetTicksUntilIRQ0() when IRQ 0 will not be raised.
+  kPITNoIRQ0 = 0,
+};
+
+// Returns the number of ticks until channel 0 next raises IRQ 0, i.e. the
+// number of ticks to pass to PITAdvance() for the IRQ to be raised on the last
+// tick. Returns kPITNoIRQ0 if channel 0 will not raise IRQ 0 unless it is
+// reprogrammed.
+uint32_t PITGetTicksUntilIRQ0(PITState* pit);
+
 #endif  // YAX86_PIT_PUBLIC_H
 
 
@@ -153,6 +176,9 @@ enum {
   // Fallback reload value when 0 is written to the counter. The hardware
   // treats a reload value of 0 as 0x10000.
   kPITFallbackReloadValue = 0x10000,
+  // Channel index used when simulating a copy of a channel, so that output
+  // changes have no side effects.
+  kPITSimulatedChannel = -1,
 };
 
 // Specifies the behavior of a timer channel in a specific mode (0-5).
@@ -162,6 +188,14 @@ typedef struct PITModeMetadata {
   // Callback to handle a tick for this mode.
   void (*handle_tick)(
       PITState* pit, PITChannelState* channel, int channel_index);
+  // Amount the counter is decremented by on each tick.
+  uint8_t counter_step;
+  // Returns the number of ticks until the next tick on which handle_tick does
+  // more than decrement the counter by counter_step, or 0 if there is none.
+  uint32_t (*get_ticks_until_transition)(const PITChannelState* channel);
+  // Returns the number of ticks after which a channel that was just reloaded
+  // returns to the same state, or 0 if the mode is not periodic.
+  uint32_t (*get_period)(const PITChannelState* channel);
 } PITModeMetadata;
 
 // Metadata for unsupported modes (1, 4, 5).
@@ -189,24 +223,34 @@ static inline void PITChannelSetOutputState(
 // Tick handler for Mode 0: Interrupt on Terminal Count.
 static void PITMode0HandleTick(
     PITState* pit, PITChannelState* channel, int channel_index) {
-  // Since this is a one-shot timer, do nothing if the counter is already 0.
-  if (channel->counter == 0) {
-    return;
-  }
-
-  // Decrement the counter by 1.
+  // Decrement the counter by 1. Like the hardware, the counter keeps wrapping
+  // around after terminal count, so a count of 0 is treated as 0x10000.
   --channel->counter;
 
-  // If at terminal count, set output high and trigger terminal count.
+  // If at terminal count, set output high and trigger terminal count. The
+  // output then stays high until the channel is reprogrammed.
   if (channel->counter == 0) {
     PITChannelSetOutputState(pit, channel, channel_index, true);
   }
 }
 
+static uint32_t PITMode0GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  // Once the output is high, the channel only counts down.
+  if (channel->output_state) {
+    return 0;
+  }
+  // Terminal count is reached when the counter reaches 0.
+  return channel->counter ? channel->counter : kPITFallbackReloadValue;
+}
+
 // Metadata for Mode 0: Interrupt on Terminal Count.
 static const PITModeMetadata kPITMode0Metadata = {
     .initial_output_state = false,
     .handle_tick = PITMode0HandleTick,
+    .counter_step = 1,
+    .get_ticks_until_transition = PITMode0GetTicksUntilTransition,
+    .get_period = NULL,
 };
 
 // Tick handler for Mode 2: Rate Generator.
@@ -230,10 +274,26 @@ static void PITMode2HandleTick(
   }
 }
 
+static uint32_t PITMode2GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  // The next transition is when the counter is decremented to 1, or to 0 if
+  // it is already 1.
+  uint16_t ticks_until_one = channel->counter - 1;
+  return ticks_until_one ? ticks_until_one : 1;
+}
+
+static uint32_t PITMode2GetPeriod(const PITChannelState* channel) {
+  return channel->reload_value ? channel->reload_value
+                               : kPITFallbackReloadValue;
+}
+
 // Metadata for Mode 2: Rate Generator.
 static const PITModeMetadata kPITMode2Metadata = {
     .initial_output_state = true,
     .handle_tick = PITMode2HandleTick,
+    .counter_step = 1,
+    .get_ticks_until_transition = PITMode2GetTicksUntilTransition,
+    .get_period = PITMode2GetPeriod,
 };
 
 // Tick handler for Mode 3: Square Wave Generator.
@@ -256,10 +316,33 @@ static void PITMode3HandleTick(
   }
 }
 
+// Returns the number of ticks for a Mode 3 counter to count down from a value
+// to terminal count.
+static inline uint32_t PITMode3GetTicksUntilTerminalCount(uint16_t counter) {
+  if (counter == 0) {
+    return kPITFallbackReloadValue / 2;
+  }
+  // Even values reach 0, and odd values wrap around to 0xFFFF.
+  return ((uint32_t)counter + 1) / 2;
+}
+
+static uint32_t PITMode3GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  return PITMode3GetTicksUntilTerminalCount(channel->counter);
+}
+
+static uint32_t PITMode3GetPeriod(const PITChannelState* channel) {
+  // The output toggles twice per period.
+  return 2 * PITMode3GetTicksUntilTerminalCount(channel->reload_value);
+}
+
 // Metadata for Mode 3: Square Wave Generator.
 static const PITModeMetadata kPITMode3Metadata = {
     .initial_output_state = true,
     .handle_tick = PITMode3HandleTick,
+    .counter_step = 2,
+    .get_ticks_until_transition = PITMode3GetTicksUntilTransition,
+    .get_period = PITMode3GetPeriod,
 };
 
 // Array of mode metadata indexed by mode number.
@@ -272,6 +355,54 @@ static const PITModeMetadata* kPITModeMetadata[kPITNumModes] = {
     &kPITUnsupportedMode,  // Mode 5 (unsupported)
 };
 
+// Returns the metadata for a channel's mode, or NULL if the channel does not
+// count in its mode.
+static inline const PITModeMetadata* PITGetCountingModeMetadata(
+    const PITChannelState* channel) {
+  if (channel->mode >= kPITNumModes) {
+    // Invalid mode - ignore.
+    return NULL;
+  }
+  const PITModeMetadata* mode_metadata = kPITModeMetadata[channel->mode];
+  return mode_metadata->handle_tick ? mode_metadata : NULL;
+}
+
+// Advance a channel by num_ticks ticks, with the same result as calling its
+// tick handler num_ticks times. Only ticks with transitions are handled one by
+// one, so this takes time proportional to the number of output transitions.
+static void PITChannelAdvance(
+    PITState* pit, PITChannelState* channel, int channel_index,
+    uint32_t num_ticks) {
+  const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+  if (!mode_metadata) {
+    return;
+  }
+  while (num_ticks > 0) {
+    uint32_t ticks = mode_metadata->get_ticks_until_transition(channel);
+    if (ticks == 0 || ticks > num_ticks) {
+      channel->counter -= (uint16_t)(num_ticks * mode_metadata->counter_step);
+      return;
+    }
+    channel->counter -= (uint16_t)((ticks - 1) * mode_metadata->counter_step);
+    mode_metadata->handle_tick(pit, channel, channel_index);
+    num_ticks -= ticks;
+    // If the channel was just reloaded and output changes have no side
+    // effects, skip over whole periods.
+    if (channel_index != 0 && mode_metadata->get_period &&
+        channel->counter == channel->reload_value) {
+      num_ticks %= mode_metadata->get_period(channel);
+    }
+  }
+}
+
+// Bring a channel's counter and output state up to date with the PIT's clock.
+static inline void PITChannelSync(
+    PITState* pit, PITChannelState* channel, int channel_index) {
+  uint32_t num_ticks = pit->ticks - channel->sync_ticks;
+  channel->sync_ticks = pit->ticks;
+  PITChannelAdvance(pit, channel, channel_index, num_ticks);
+}
+
 void PITInit(PITState* pit, PITConfig* config) {
   static const PITState zero_pit_state = {0};
   *pit = zero_pit_state;
@@ -352,6 +483,7 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value) {
         return;
       }
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
 
       PITAccessMode access_mode = (PITAccessMode)((value >> 4) & 0x03);
       if (access_mode == kPITAccessLatch) {
@@ -379,6 +511,7 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value) {
       // Data port for a channel.
       int channel_index = port - kPITPortChannel0;
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
       PITChannelWritePort(pit, channel, channel_index, value);
       break;
     }
@@ -439,6 +572,7 @@ uint8_t PITReadPort(PITState* pit, uint16_t port) {
       // Data port for a channel.
       int channel_index = port - kPITPortChannel0;
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
       return PITChannelReadPort(pit, channel, channel_index);
     }
     default:
@@ -448,17 +582,52 @@ uint8_t PITReadPort(PITState* pit, uint16_t port) {
 }
 
 void PITTick(PITState* pit) {
+  // Bring all channels up to date, then run each channel's tick handler once.
   PITChannelState* channel = &pit->channels[0];
   for (int i = 0; i < kPITNumChannels; ++i, ++channel) {
-    if (channel->mode >= kPITNumModes) {
-      // Invalid mode - ignore.
-      continue;
-    }
-    const PITModeMetadata* mode_metadata = kPITModeMetadata[channel->mode];
-    if (mode_metadata->handle_tick) {
+    PITChannelSync(pit, channel, i);
+    channel->sync_ticks = pit->ticks + 1;
+    const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+    if (mode_metadata) {
       mode_metadata->handle_tick(pit, channel, i);
     }
   }
+  ++pit->ticks;
+}
+
+void PITAdvance(PITState* pit, uint32_t num_ticks) {
+  pit->ticks += num_ticks;
+  // Channel 0 raises IRQ 0, so bring it up to date right away. The other
+  // channels are brought up to date when accessed.
+  PITChannelSync(pit, &pit->channels[0], 0);
+}
+
+uint32_t PITGetTicksUntilIRQ0(PITState* pit) {
+  PITChannelState* channel = &pit->channels[0];
+  PITChannelSync(pit, channel, 0);
+  const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+  if (!mode_metadata) {
+    return kPITNoIRQ0;
+  }
+  // Simulate a copy of the channel until the output rises. In every supported
+  // mode, this happens within 2 transitions if it happens at all.
+  PITChannelState simulated_channel = *channel;
+  uint32_t ticks = 0;
+  for (int i = 0; i < 2; ++i) {
+    uint32_t transition_ticks =
+        mode_metadata->get_ticks_until_transition(&simulated_channel);
+    if (transition_ticks == 0) {
+      break;
+    }
+    bool old_output_state = simulated_channel.output_state;
+    PITChannelAdvance(
+        pit, &simulated_channel, kPITSimulatedChannel, transition_ticks);
+    ticks += transition_ticks;
+    if (!old_output_state && simulated_channel.output_state) {
+      return ticks;
+    }
+  }
+  return kPITNoIRQ0;
 }
 
 
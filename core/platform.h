@@ -149,10 +149,22 @@ enum {
   // Conventional memory - first 640KB of physical memory, mapped to 0x00000 to
   // 0x9FFFF (640KB).
   kMemoryMapEntryConventional = 0,
+  // Open bus entry that unmapped addresses resolve to. Entries of this type
+  // cannot be registered.
+  kMemoryMapEntryNone = 0xFF,
 
   // Maximum number of memory map entries.
   kMaxMemoryMapEntries = 16,
 
+  // Size of the 8088's physical address space in bytes.
+  kMemoryAddressSpaceSize = kCPUMemoryAddressSpaceSize,
+  // Granularity of the memory map dispatch table in bytes. This matches the
+  // CPU's direct memory access page size so the same page tables can be
+  // shared with the CPU.
+  kMemoryMapPageSize = kCPUMemoryPageSize,
+  // Number of pages in the memory map dispatch table.
+  kNumMemoryMapPages = kMemoryAddressSpaceSize / kMemoryMapPageSize,
+
   // Maximum size of physical memory in bytes.
   kMaxPhysicalMemorySize = 640 * 1024,
   // Minimum size of physical memory in bytes.
@@ -178,10 +190,31 @@ typedef struct MemoryMapEntry {
   // address.
   void (*write_byte)(
       struct MemoryMapEntry* entry, uint32_t relative_address, uint8_t value);
+  // Optional callback to read a word from the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, read_byte is used.
+  uint16_t (*read_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address);
+  // Optional callback to write a word to the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, write_byte is used.
+  void (*write_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address, uint16_t value);
+
+  // Optional host memory backing the memory region, indexed by relative
+  // address. If set, reads are served directly from host memory and read_byte
+  // is not used.
+  const uint8_t* read_data;
+  // Optional writable host memory backing the memory region, indexed by
+  // relative address. If set, writes go directly to host memory and write_byte
+  // is not used. For RAM, this is typically the same buffer as read_data; for
+  // ROM, this should be left NULL.
+  uint8_t* write_data;
 } MemoryMapEntry;
 
 // Register a memory map entry in the platform state. Returns true if the entry
 // was successfully registered, or false if:
+//   - The entry's type is kMemoryMapEntryNone.
 //   - There already exists a memory map entry with the same type.
 //   - The new entry's memory region overlaps with an existing entry.
 //   - The number of memory map entries would exceed kMaxMemoryMapEntries.
@@ -204,7 +237,8 @@ MemoryMapEntry* GetMemoryMapEntryByType(
 // behavior.
 uint8_t ReadMemoryByte(struct PlatformState* platform, uint32_t address);
 // Read a word from a logical memory address by invoking the corresponding
-// memory map entry's read_byte callback.
+// memory map entry's read_word callback, or its read_byte callback if the word
+// straddles two memory map entries.
 uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 // Write a byte to a logical memory address by invoking the corresponding
 // memory map entry's write_byte callback.
@@ -215,7 +249,8 @@ uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 void WriteMemoryByte(
     struct PlatformState* platform, uint32_t address, uint8_t value);
 // Write a word to a logical memory address by invoking the corresponding
-// memory map entry's write_byte callback.
+// memory map entry's write_word callback, or its write_byte callback if the
+// word straddles two memory map entries.
 void WriteMemoryWord(
     struct PlatformState* platform, uint32_t address, uint16_t value);
 
@@ -258,6 +293,13 @@ typedef struct PortMapEntry {
   uint8_t (*read_byte)(struct PortMapEntry* entry, uint16_t port);
   // Callback to write a byte an I/O port within the range.
   void (*write_byte)(struct PortMapEntry* entry, uint16_t port, uint8_t value);
+  // Optional callback to read a word from an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, read_byte is used.
+  uint16_t (*read_word)(struct PortMapEntry* entry, uint16_t port);
+  // Optional callback to write a word to an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, write_byte is used.
+  void (*write_word)(
+      struct PortMapEntry* entry, uint16_t port, uint16_t value);
 } PortMapEntry;
 
 // Register an I/O port map entry in the platform state. Returns true if the
@@ -279,14 +321,17 @@ PortMapEntry* GetPortMapEntryByType(
 // entry's read_byte callback.
 uint8_t ReadPortByte(struct PlatformState* platform, uint16_t port);
 // Read a word from an I/O port by invoking the corresponding I/O port map
-// entry's read_byte callback. This reads two consecutive bytes from the port.
+// entry's read_word callback. This reads two consecutive ports, falling back to
+// read_byte if read_word is not set or the ports belong to different entries.
 uint16_t ReadPortWord(struct PlatformState* platform, uint16_t port);
 // Write a byte to an I/O port by invoking the corresponding I/O port map
 // entry's write_byte callback.
 void WritePortByte(
     struct PlatformState* platform, uint16_t port, uint8_t value);
 // Write a word to an I/O port by invoking the corresponding I/O port map
-// entry's write_byte callback. This writes two consecutive bytes to the port.
+// entry's write_word callback. This writes two consecutive ports, falling back
+// to write_byte if write_word is not set or the ports belong to different
+// entries.
 void WritePortWord(
     struct PlatformState* platform, uint16_t port, uint16_t value);
 
@@ -294,6 +339,38 @@ void WritePortWord(
 // Platform state
 // ============================================================================
 
+enum {
+  // Default maximum number of iterations of a repeated string instruction to
+  // run per CPU tick.
+  kPlatformDefaultMaxStringIterations = 64,
+  // BIOS keyboard services interrupt.
+  kPlatformKeyboardServiceInterrupt = 0x16,
+  // Maximum number of 8088 clock cycles between two INT 16h keyboard status
+  // checks for them to count as the same polling loop.
+  kPlatformMaxKeyboardPollInterval = 80000,
+  // Estimated average number of 8088 clock cycles per instruction, used to
+  // measure the time between keyboard status checks when
+  // PlatformConfig.use_clock_cycles is not set.
+  kPlatformAverageInstructionClockCycles = 8,
+};
+
+// BIOS keyboard services used by the guest to check for a key press, in AH.
+enum {
+  // Check for a key press.
+  kPlatformKeyboardServiceCheckKey = 0x01,
+  // Check for a key press on an enhanced keyboard.
+  kPlatformKeyboardServiceCheckExtendedKey = 0x11,
+};
+
+enum {
+  // Opcode of the INT imm8 instruction.
+  kPlatformINTOpcode = 0xCD,
+  // Address of the keyboard buffer head pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferHeadAddress = 0x41A,
+  // Address of the keyboard buffer tail pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferTailAddress = 0x41C,
+};
+
 // Caller-provided runtime configuration.
 typedef struct PlatformConfig {
   // Custom data passed through to callbacks.
@@ -302,6 +379,61 @@ typedef struct PlatformConfig {
   // Physical memory size in bytes. Must be between 64K and 640K.
   uint32_t physical_memory_size;
 
+  // Optional host buffer of physical_memory_size bytes backing physical memory.
+  // If set, physical memory is accessed directly and the callbacks below are
+  // not used.
+  uint8_t* physical_memory;
+
+  // Optional cache of decoded instructions for the CPU. The platform
+  // initializes the cache and invalidates it on DMA writes.
+  CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated blocks for the CPU. The platform initializes
+  // the cache and invalidates it on DMA writes.
+  CPUBlockCache* block_cache;
+
+  // Optional JIT for the CPU, which must be initialized by the caller with
+  // CPUInitJIT(). Only used together with block_cache.
+  CPUJIT* jit;
+
+  // Optional track read-ahead cache for the FDC. The platform initializes the
+  // cache. See FDCConfig.track_cache.
+  FDCTrackCache* fdc_track_cache;
+
+  // Optional write-back cache for the FDC. The platform initializes the cache.
+  // See FDCConfig.write_cache.
+  FDCWriteCache* fdc_write_cache;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // CPU tick, or 0 for kPlatformDefaultMaxStringIterations. See
+  // CPUConfig.max_string_iterations.
+  uint16_t max_string_iterations;
+
+  // Whether each CPU instruction should take as many ticks as it takes clock
+  // cycles on the 8088, so that ticks track the 4.77MHz clock and device
+  // timings relative to the CPU are accurate. See CPUConfig.use_clock_cycles.
+  // Otherwise, each instruction takes one tick. This keeps the block cache,
+  // the JIT and threaded dispatch, at the cost of timing each instruction, and
+  // of more ticks per instruction for the devices to catch up with.
+  bool use_clock_cycles;
+
+  // Number of consecutive INT 16h keyboard status checks that find the
+  // keyboard buffer empty, each within kPlatformMaxKeyboardPollInterval clock
+  // cycles of the last, after which the guest is treated as waiting for input,
+  // or 0 to never do so. The CPU is then halted at the INT 16h instruction
+  // until the next interrupt, and checks again when it resumes. This lets the
+  // host sleep while DOS polls for input at its prompt, which the CPU cannot
+  // detect as idle by itself as the polling loop spans DOS and the BIOS. A
+  // program that polls the keyboard this often while doing other work is
+  // slowed down to the rate of interrupts.
+  uint8_t idle_keyboard_polls;
+
+  // Whether the FDC should transfer the rest of a sector to or from memory via
+  // DMA in one step, instead of one byte per FDC tick. The guest sees the same
+  // memory, DMA and FDC state at the end of the transfer, but the transfer
+  // completes much sooner. See FDCConfig.transfer_dma_block.
+  bool use_bulk_disk_transfers;
+
   // Callback to read a byte from physical memory.
   //
   // On the 8086, accessing an invalid memory address will yield garbage data
@@ -328,6 +460,22 @@ typedef struct PlatformConfig {
 STATIC_VECTOR_TYPE(MemoryMap, MemoryMapEntry, kMaxMemoryMapEntries)
 STATIC_VECTOR_TYPE(PortMap, PortMapEntry, kMaxPortMapEntries)
 
+// Devices ticked by the platform, in the order they are ticked.
+typedef enum PlatformTimerType {
+  kPlatformTimerPIT = 0,
+  kPlatformTimerFDC,
+  kPlatformTimerKeyboard,
+  kNumPlatformTimers,
+} PlatformTimerType;
+
+// A device's next tick. Devices are only scheduled while they have work to do.
+typedef struct PlatformTimer {
+  // Whether the device is scheduled to tick.
+  bool active;
+  // Value of PlatformState.ticks on which the device ticks next.
+  uint32_t deadline;
+} PlatformTimer;
+
 // State of the platform.
 typedef struct PlatformState {
   // Pointer to caller-provided runtime configuration.
@@ -374,11 +522,48 @@ typedef struct PlatformState {
 
   // Memory map.
   MemoryMap memory_map;
+  // Page-granular dispatch table for the memory map, rebuilt whenever a memory
+  // map entry is registered. Each page points to the entry covering the entire
+  // page, to open_bus_memory_map_entry if the page is not mapped at all, or to
+  // NULL if the page is split across more than one entry.
+  MemoryMapEntry* memory_map_pages[kNumMemoryMapPages];
+  // Host memory backing each page for reads, or NULL if reads from the page
+  // must go through the memory map. Shared with the CPU.
+  const uint8_t* memory_read_pages[kNumMemoryMapPages];
+  // Host memory backing each page for writes, or NULL if writes to the page
+  // must go through the memory map. Shared with the CPU.
+  uint8_t* memory_write_pages[kNumMemoryMapPages];
+  // Memory map entry shared by all unmapped pages. Reads return 0xFF and writes
+  // are ignored.
+  MemoryMapEntry open_bus_memory_map_entry;
   // I/O port map.
   PortMap io_port_map;
 
   // How many ticks have run.
   uint32_t ticks;
+  // Next tick of each device, indexed by PlatformTimerType.
+  PlatformTimer timers[kNumPlatformTimers];
+  // Value of CPUState.cycles when ticks was last updated. Used to find the
+  // current tick while the CPU is running a batch of instructions.
+  uint32_t cpu_cycles;
+  // Tick up to which the PIT has been brought up to date, exclusive.
+  uint32_t pit_sync_tick;
+  // Whether the host has asked PlatformRun() to return early.
+  bool stop_requested;
+  // Number of ticks run by the last call to PlatformRun() during which the
+  // CPU was idle, i.e. halted or spinning in a loop that waits for an
+  // interrupt.
+  uint32_t idle_ticks;
+  // Whether the CPU was idle for the whole of the last batch of ticks run by
+  // PlatformRun().
+  bool is_idle;
+  // Number of consecutive INT 16h keyboard status checks that found the
+  // keyboard buffer empty. See PlatformConfig.idle_keyboard_polls.
+  uint8_t num_keyboard_polls;
+  // Time of the last INT 16h keyboard status check in 8088 clock cycles,
+  // estimated from CPUState.cycles if PlatformConfig.use_clock_cycles is not
+  // set. Wraps around.
+  uint32_t last_keyboard_poll_clock_cycles;
 } PlatformState;
 
 // Initialize the platform state with the provided configuration. Returns true
@@ -390,10 +575,35 @@ bool PlatformInit(PlatformState* platform, PlatformConfig* config);
 // IRQ was successfully raised, or false if the IRQ number is invalid.
 bool PlatformRaiseIRQ(PlatformState* platform, uint8_t irq);
 
-// Run a single cycle of the platform, including ticking all sub-modules. This
-// should be called at the CPU clock rate (4.77MHz for the 8088).
+// Run a single CPU instruction cycle of the platform, including ticking all
+// sub-modules. This takes one tick, or with PlatformConfig.use_clock_cycles,
+// as many ticks as the instruction's clock cycles.
 void PlatformTick(PlatformState* platform);
 
+// Run up to max_ticks ticks of the platform, with the same results as calling
+// PlatformTick() until max_ticks ticks have run. The CPU runs in batches up to
+// the next device tick, so this is much faster than calling PlatformTick() in a
+// loop. Returns the number of ticks run, which is less than max_ticks if the
+// CPU encountered an error or PlatformRequestStop() was called. With
+// PlatformConfig.use_clock_cycles, this may exceed max_ticks by up to the
+// length of the last instruction.
+uint32_t PlatformRun(PlatformState* platform, uint32_t max_ticks);
+
+// Ask PlatformRun() to return at the end of the current instruction cycle. Can
+// be called from callbacks invoked while running.
+void PlatformRequestStop(PlatformState* platform);
+
+// Returns whether the guest was waiting for an interrupt at the end of the last
+// call to PlatformRun(), so that nothing guest-visible happens until the next
+// device event or host input. The host may then sleep for up to
+// PlatformGetTicksUntilNextEvent() ticks, or until host input arrives.
+bool PlatformIsIdle(const PlatformState* platform);
+
+// Returns the number of ticks up to and including the next device event that
+// may interrupt the guest, or max_ticks if that is sooner.
+uint32_t PlatformGetTicksUntilNextEvent(
+    PlatformState* platform, uint32_t max_ticks);
+
 #endif  // YAX86_PLATFORM_PUBLIC_H
 
 
@@ -456,14 +666,95 @@ void PlatformTick(PlatformState* platform);
 #include "public.h"
 #endif  // YAX86_IMPLEMENTATION
 
+// Read callback for unmapped memory. The 8088 reads an undriven data bus as
+// all ones.
+static uint8_t OpenBusReadByte(
+    YAX86_UNUSED MemoryMapEntry* entry, YAX86_UNUSED uint32_t address) {
+  return 0xFF;
+}
+
+// Look up the memory region corresponding to an address by scanning all memory
+// map entries. Returns NULL if the address is not mapped.
+static MemoryMapEntry* ScanMemoryMapForAddress(
+    PlatformState* platform, uint32_t address) {
+  for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
+    MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
+    if (address >= entry->start && address <= entry->end) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Rebuild the page-granular dispatch table from the current memory map
+// entries.
+static void RebuildMemoryMapPages(PlatformState* platform) {
+  static const MemoryMapEntry kOpenBusMemoryMapEntry = {
+      .context = NULL,
+      .entry_type = kMemoryMapEntryNone,
+      .start = 0,
+      .end = kMemoryAddressSpaceSize - 1,
+      .read_byte = OpenBusReadByte,
+      .write_byte = NULL,
+  };
+  platform->open_bus_memory_map_entry = kOpenBusMemoryMapEntry;
+  for (uint32_t page = 0; page < kNumMemoryMapPages; ++page) {
+    uint32_t page_start = page * kMemoryMapPageSize;
+    uint32_t page_end = page_start + kMemoryMapPageSize - 1;
+    MemoryMapEntry* page_entry = &platform->open_bus_memory_map_entry;
+    const uint8_t* read_page = NULL;
+    uint8_t* write_page = NULL;
+    for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
+      MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
+      if (entry->start > page_end || page_start > entry->end) {
+        continue;
+      }
+      if (entry->start <= page_start && entry->end >= page_end) {
+        page_entry = entry;
+        if (entry->read_data) {
+          read_page = entry->read_data + (page_start - entry->start);
+        }
+        if (entry->write_data) {
+          write_page = entry->write_data + (page_start - entry->start);
+        }
+      } else {
+        // The page is only partially covered by this entry, so lookups within
+        // the page must fall back to a scan.
+        page_entry = NULL;
+      }
+      break;
+    }
+    platform->memory_map_pages[page] = page_entry;
+    platform->memory_read_pages[page] = read_page;
+    platform->memory_write_pages[page] = write_page;
+  }
+}
+
+// Look up the memory region corresponding to an address via the dispatch
+// table. Returns the open bus entry if the address is not mapped.
+static inline MemoryMapEntry* LookupMemoryMapPage(
+    PlatformState* platform, uint32_t address) {
+  MemoryMapEntry* entry = NULL;
+  if (address < kMemoryAddressSpaceSize) {
+    entry = platform->memory_map_pages[address / kMemoryMapPageSize];
+    if (entry) {
+      return entry;
+    }
+  }
+  entry = ScanMemoryMapForAddress(platform, address);
+  return entry ? entry : &platform->open_bus_memory_map_entry;
+}
+
 // Register a memory map entry in the platform state. Returns true if the entry
 // was successfully registered, or false if:
+//   - The entry's type is kMemoryMapEntryNone.
 //   - There already exists a memory map entry with the same type.
 //   - The new entry's memory region overlaps with an existing entry.
 //   - The number of memory map entries would exceed kMaxMemoryMapEntries.
 bool RegisterMemoryMapEntry(
     PlatformState* platform, const MemoryMapEntry* entry) {
-  if (MemoryMapLength(&platform->memory_map) >= kMaxMemoryMapEntries) {
+  if (entry->entry_type == kMemoryMapEntryNone ||
+      MemoryMapLength(&platform->memory_map) >= kMaxMemoryMapEntries) {
     return false;
   }
   for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
@@ -476,22 +767,19 @@ bool RegisterMemoryMapEntry(
       return false;
     }
   }
-  return MemoryMapAppend(&platform->memory_map, entry);
+  if (!MemoryMapAppend(&platform->memory_map, entry)) {
+    return false;
+  }
+  RebuildMemoryMapPages(platform);
+  return true;
 }
 
 // Look up the memory region corresponding to an address. Returns NULL if the
 // address is not mapped to a known memory region.
 MemoryMapEntry* GetMemoryMapEntryForAddress(
     PlatformState* platform, uint32_t address) {
-  // TODO: Use a more efficient data structure for lookups, such as a sorted
-  // array with binary search.
-  for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
-    MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
-    if (address >= entry->start && address <= entry->end) {
-      return entry;
-    }
-  }
-  return NULL;
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  return entry->entry_type == kMemoryMapEntryNone ? NULL : entry;
 }
 
 // Look up a memory region by type. Returns NULL if no region found with the
@@ -509,8 +797,18 @@ MemoryMapEntry* GetMemoryMapEntryByType(
 
 // Read a byte from a logical memory address.
 uint8_t ReadMemoryByte(PlatformState* platform, uint32_t address) {
-  MemoryMapEntry* entry = GetMemoryMapEntryForAddress(platform, address);
-  if (!entry || !entry->read_byte) {
+  if (address < kMemoryAddressSpaceSize) {
+    const uint8_t* page =
+        platform->memory_read_pages[address / kMemoryMapPageSize];
+    if (page) {
+      return page[address % kMemoryMapPageSize];
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (entry->read_data) {
+    return entry->read_data[address - entry->start];
+  }
+  if (!entry->read_byte) {
     return 0xFF;
   }
   return entry->read_byte(entry, address - entry->start);
@@ -518,6 +816,26 @@ uint8_t ReadMemoryByte(PlatformState* platform, uint32_t address) {
 
 // Read a word from a logical memory address.
 uint16_t ReadMemoryWord(PlatformState* platform, uint32_t address) {
+  uint32_t page_offset = address % kMemoryMapPageSize;
+  if (address < kMemoryAddressSpaceSize &&
+      page_offset < kMemoryMapPageSize - 1) {
+    const uint8_t* page =
+        platform->memory_read_pages[address / kMemoryMapPageSize];
+    if (page) {
+      return (page[page_offset + 1] << 8) | page[page_offset];
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (address < entry->end) {
+    uint32_t relative_address = address - entry->start;
+    if (entry->read_data) {
+      return (entry->read_data[relative_address + 1] << 8) |
+             entry->read_data[relative_address];
+    }
+    if (entry->read_word) {
+      return entry->read_word(entry, relative_address);
+    }
+  }
   uint8_t low_byte = ReadMemoryByte(platform, address);
   uint8_t high_byte = ReadMemoryByte(platform, address + 1);
   return (high_byte << 8) | low_byte;
@@ -525,8 +843,19 @@ uint16_t ReadMemoryWord(PlatformState* platform, uint32_t address) {
 
 // Write a byte to a logical memory address.
 void WriteMemoryByte(PlatformState* platform, uint32_t address, uint8_t value) {
-  MemoryMapEntry* entry = GetMemoryMapEntryForAddress(platform, address);
-  if (!entry || !entry->write_byte) {
+  if (address < kMemoryAddressSpaceSize) {
+    uint8_t* page = platform->memory_write_pages[address / kMemoryMapPageSize];
+    if (page) {
+      page[address % kMemoryMapPageSize] = value;
+      return;
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (entry->write_data) {
+    entry->write_data[address - entry->start] = value;
+    return;
+  }
+  if (!entry->write_byte) {
     return;
   }
   entry->write_byte(entry, address - entry->start, value);
@@ -535,6 +864,29 @@ void WriteMemoryByte(PlatformState* platform, uint32_t address, uint8_t value) {
 // Write a word to a logical memory address.
 void WriteMemoryWord(
     PlatformState* platform, uint32_t address, uint16_t value) {
+  uint32_t page_offset = address % kMemoryMapPageSize;
+  if (address < kMemoryAddressSpaceSize &&
+      page_offset < kMemoryMapPageSize - 1) {
+    uint8_t* page = platform->memory_write_pages[address / kMemoryMapPageSize];
+    if (page) {
+      page[page_offset] = value & 0xFF;
+      page[page_offset + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (address < entry->end) {
+    uint32_t relative_address = address - entry->start;
+    if (entry->write_data) {
+      entry->write_data[relative_address] = value & 0xFF;
+      entry->write_data[relative_address + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+    if (entry->write_word) {
+      entry->write_word(entry, relative_address, value);
+      return;
+    }
+  }
   WriteMemoryByte(platform, address, value & 0xFF);
   WriteMemoryByte(platform, address + 1, (value >> 8) & 0xFF);
 }
@@ -595,8 +947,13 @@ uint8_t ReadPortByte(PlatformState* platform, uint16_t port) {
 }
 
 // Read a word from an I/O port by invoking the corresponding I/O port map
-// entry's read_byte callback. This reads two consecutive bytes from the port.
+// entry's read_word callback. This reads two consecutive ports, falling back to
+// read_byte if read_word is not set or the ports belong to different entries.
 uint16_t ReadPortWord(PlatformState* platform, uint16_t port) {
+  PortMapEntry* entry = GetPortMapEntryForPort(platform, port);
+  if (entry && entry->read_word && port < entry->end) {
+    return entry->read_word(entry, port);
+  }
   uint8_t low_byte = ReadPortByte(platform, port);
   uint8_t high_byte = ReadPortByte(platform, port + 1);
   return (high_byte << 8) | low_byte;
@@ -613,8 +970,15 @@ void WritePortByte(PlatformState* platform, uint16_t port, uint8_t value) {
 }
 
 // Write a word to an I/O port by invoking the corresponding I/O port map
-// entry's write_byte callback. This writes two consecutive bytes to the port.
+// entry's write_word callback. This writes two consecutive ports, falling back
+// to write_byte if write_word is not set or the ports belong to different
+// entries.
 void WritePortWord(PlatformState* platform, uint16_t port, uint16_t value) {
+  PortMapEntry* entry = GetPortMapEntryForPort(platform, port);
+  if (entry && entry->write_word && port < entry->end) {
+    entry->write_word(entry, port, value);
+    return;
+  }
   WritePortByte(platform, port, value & 0xFF);
   WritePortByte(platform, port + 1, (value >> 8) & 0xFF);
 }
@@ -632,6 +996,15 @@ static void CPUCallbackWriteMemoryByte(
   WriteMemoryByte((PlatformState*)cpu->config->context, address, value);
 }
 
+static uint16_t CPUCallbackReadMemoryWord(CPUState* cpu, uint32_t address) {
+  return ReadMemoryWord((PlatformState*)cpu->config->context, address);
+}
+
+static void CPUCallbackWriteMemoryWord(
+    CPUState* cpu, uint32_t address, uint16_t value) {
+  WriteMemoryWord((PlatformState*)cpu->config->context, address, value);
+}
+
 static uint8_t CPUCallbackReadPortByte(CPUState* cpu, uint16_t port) {
   return ReadPortByte((PlatformState*)cpu->config->context, port);
 }
@@ -641,6 +1014,104 @@ static void CPUCallbackWritePortByte(
   WritePortByte((PlatformState*)cpu->config->context, port, value);
 }
 
+static uint16_t CPUCallbackReadPortWord(CPUState* cpu, uint16_t port) {
+  return ReadPortWord((PlatformState*)cpu->config->context, port);
+}
+
+static void CPUCallbackWritePortWord(
+    CPUState* cpu, uint16_t port, uint16_t value) {
+  WritePortWord((PlatformState*)cpu->config->context, port, value);
+}
+
+// Reads from the PIT depend on the current time, and reads from the DMA
+// controller and the FDC data register change their state. Reads from other
+// ports only change when the CPU writes to a port or when devices are ticked
+// between calls to CPURun().
+static bool CPUCallbackIsPortStable(CPUState* cpu, uint16_t port) {
+  PortMapEntry* entry =
+      GetPortMapEntryForPort((PlatformState*)cpu->config->context, port);
+  if (!entry) {
+    return true;
+  }
+  switch (entry->entry_type) {
+    case kPortMapEntryPIC:
+    case kPortMapEntryPPI:
+    case kPortMapEntryMDA:
+      return true;
+    case kPortMapEntryFDC:
+      return port == kFDCPortMSR;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an interrupt that was just raised is an INT 16h instruction
+// checking for a key press with interrupts enabled, while the keyboard buffer
+// in the BIOS data area is empty. The CPU has pushed FLAGS, CS and IP.
+static bool IsEmptyKeyboardPoll(PlatformState* platform) {
+  CPUState* cpu = &platform->cpu;
+  const uint8_t function = cpu->registers[kAX] >> 8;
+  if (function != kPlatformKeyboardServiceCheckKey &&
+      function != kPlatformKeyboardServiceCheckExtendedKey) {
+    return false;
+  }
+  const uint32_t return_address =
+      ((uint32_t)cpu->registers[kCS] << 4) + cpu->registers[kIP];
+  if (ReadMemoryByte(platform, return_address - 2) != kPlatformINTOpcode ||
+      ReadMemoryByte(platform, return_address - 1) !=
+          kPlatformKeyboardServiceInterrupt) {
+    return false;
+  }
+  // FLAGS as pushed by the interrupt.
+  const uint32_t flags_address = ((uint32_t)cpu->registers[kSS] << 4) +
+                                 (uint16_t)(cpu->registers[kSP] + 4);
+  if (!(ReadMemoryWord(platform, flags_address) & kIF)) {
+    return false;
+  }
+  return ReadMemoryWord(platform, kPlatformBIOSKeyboardBufferHeadAddress) ==
+         ReadMemoryWord(platform, kPlatformBIOSKeyboardBufferTailAddress);
+}
+
+// Returns the number of 8088 clock cycles run so far, estimated from the
+// number of instructions if PlatformConfig.use_clock_cycles is not set. Wraps
+// around.
+static uint32_t GetKeyboardPollClockCycles(PlatformState* platform) {
+  if (platform->config->use_clock_cycles) {
+    return (uint32_t)platform->cpu.clock_cycles;
+  }
+  return platform->cpu.cycles * kPlatformAverageInstructionClockCycles;
+}
+
+// Halt the CPU at INT 16h instructions that keep finding the keyboard buffer
+// empty. See PlatformConfig.idle_keyboard_polls.
+static ExecuteStatus CPUCallbackHandleInterrupt(
+    CPUState* cpu, uint8_t interrupt_number) {
+  PlatformState* platform = (PlatformState*)cpu->config->context;
+  if (interrupt_number != kPlatformKeyboardServiceInterrupt) {
+    return kExecuteUnhandledInterrupt;
+  }
+  if (!IsEmptyKeyboardPoll(platform)) {
+    platform->num_keyboard_polls = 0;
+    return kExecuteUnhandledInterrupt;
+  }
+  const uint32_t clock_cycles = GetKeyboardPollClockCycles(platform);
+  if (clock_cycles - platform->last_keyboard_poll_clock_cycles >
+      kPlatformMaxKeyboardPollInterval) {
+    platform->num_keyboard_polls = 0;
+  }
+  platform->last_keyboard_poll_clock_cycles = clock_cycles;
+  if (platform->num_keyboard_polls < platform->config->idle_keyboard_polls) {
+    ++platform->num_keyboard_polls;
+    return kExecuteUnhandledInterrupt;
+  }
+  // Return to the INT 16h instruction, halted until the next interrupt.
+  const uint32_t stack_address =
+      ((uint32_t)cpu->registers[kSS] << 4) + cpu->registers[kSP];
+  WriteMemoryWord(platform, stack_address, cpu->registers[kIP] - 2);
+  cpu->is_halted = true;
+  return kExecuteSuccess;
+}
+
 static const CPUConfig kEmptyCPUConfig = {0};
 
 // ============================================================================
@@ -662,17 +1133,188 @@ static void WritePhysicalMemoryByte(
   }
 }
 
+// ============================================================================
+// Device timers
+// ============================================================================
+
+enum {
+  // PIT ticks at 1.19MHz, CPU at 4.77MHz. 4.77 / 1.19 ~= 4.
+  kPITTickPeriod = 4,
+  // The main clock on the FDC is 8MHz. 8MHz / 4.77MHz ~= 2.
+  kFDCTickPeriod = 2,
+  // The keyboard ticks every 1ms.
+  kKeyboardTickPeriod = 4770,
+};
+
+// Returns the first tick at or after the given tick on which a device with the
+// given period ticks.
+static inline uint32_t GetNextDeviceTick(uint32_t ticks, uint32_t period) {
+  return ticks + (period - ticks % period) % period;
+}
+
+// Returns the tick that is currently running. While the CPU is executing an
+// instruction, this is the tick of that instruction.
+static inline uint32_t GetCurrentTick(const PlatformState* platform) {
+  uint32_t cycles = platform->cpu.cycles - platform->cpu_cycles;
+  return platform->ticks + (cycles ? cycles - 1 : 0);
+}
+
+// Bring the PIT up to date with all of its ticks before the given tick.
+static void SyncPIT(PlatformState* platform, uint32_t end_tick) {
+  uint32_t num_ticks = end_tick - platform->pit_sync_tick;
+  if (num_ticks == 0 || num_ticks > (uint32_t)INT32_MAX) {
+    // Already up to date.
+    return;
+  }
+  uint32_t first_pit_tick =
+      GetNextDeviceTick(platform->pit_sync_tick, kPITTickPeriod) -
+      platform->pit_sync_tick;
+  platform->pit_sync_tick = end_tick;
+  if (first_pit_tick < num_ticks) {
+    PITAdvance(
+        &platform->pit,
+        (num_ticks - 1 - first_pit_tick) / kPITTickPeriod + 1);
+  }
+}
+
+// The PIT is scheduled for the next tick on which channel 0 raises IRQ 0.
+// Counters are otherwise computed from the elapsed time when accessed.
+static bool PITTimerSchedule(
+    PlatformState* platform, YAX86_UNUSED uint32_t from_tick,
+    uint32_t* deadline) {
+  uint32_t pit_ticks = PITGetTicksUntilIRQ0(&platform->pit);
+  if (pit_ticks == kPITNoIRQ0) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(platform->pit_sync_tick, kPITTickPeriod) +
+              (pit_ticks - 1) * kPITTickPeriod;
+  return true;
+}
+
+static void PITTimerTick(PlatformState* platform) {
+  SyncPIT(platform, platform->ticks + 1);
+}
+
+static bool FDCTimerSchedule(
+    PlatformState* platform, uint32_t from_tick, uint32_t* deadline) {
+  if (platform->fdc.phase != kFDCPhaseExecution) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(from_tick, kFDCTickPeriod);
+  return true;
+}
+
+static void FDCTimerTick(PlatformState* platform) { FDCTick(&platform->fdc); }
+
+static bool KeyboardTimerSchedule(
+    PlatformState* platform, uint32_t from_tick, uint32_t* deadline) {
+  if (!KeyboardNeedsTick(&platform->keyboard)) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(from_tick, kKeyboardTickPeriod);
+  return true;
+}
+
+static void KeyboardTimerTick(PlatformState* platform) {
+  KeyboardTickMs(&platform->keyboard);
+}
+
+// How a device is ticked by the platform.
+typedef struct PlatformTimerMetadata {
+  // Returns whether the device has any work to do, and if so, stores the next
+  // tick at or after from_tick on which it should be ticked in deadline.
+  bool (*schedule)(
+      PlatformState* platform, uint32_t from_tick, uint32_t* deadline);
+  // Tick the device.
+  void (*tick)(PlatformState* platform);
+} PlatformTimerMetadata;
+
+// Device timer metadata, indexed by PlatformTimerType.
+static const PlatformTimerMetadata kPlatformTimerMetadata[] = {
+    {.schedule = PITTimerSchedule, .tick = PITTimerTick},
+    {.schedule = FDCTimerSchedule, .tick = FDCTimerTick},
+    {.schedule = KeyboardTimerSchedule, .tick = KeyboardTimerTick},
+};
+
+// Schedule devices that have work to do but are not scheduled yet.
+static void ScheduleTimers(PlatformState* platform) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    PlatformTimer* timer = &platform->timers[i];
+    if (!timer->active) {
+      timer->active = kPlatformTimerMetadata[i].schedule(
+          platform, platform->ticks, &timer->deadline);
+    }
+  }
+}
+
+// Tick devices whose deadline is at or before the current tick, and reschedule
+// them if they still have work to do. Deadlines are only passed when an
+// instruction takes more than one tick, in which case the device catches up on
+// the ticks it missed.
+static void RunDueTimers(PlatformState* platform) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    PlatformTimer* timer = &platform->timers[i];
+    const PlatformTimerMetadata* metadata = &kPlatformTimerMetadata[i];
+    while (timer->active &&
+           (int32_t)(platform->ticks - timer->deadline) >= 0) {
+      metadata->tick(platform);
+      timer->active =
+          metadata->schedule(platform, timer->deadline + 1, &timer->deadline);
+    }
+  }
+}
+
+// Returns the number of ticks from the current tick up to and including the
+// earliest device deadline, or max_ticks if that is sooner.
+static uint32_t GetTicksUntilNextTimer(
+    const PlatformState* platform, uint32_t max_ticks) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    const PlatformTimer* timer = &platform->timers[i];
+    if (timer->active) {
+      uint32_t ticks = timer->deadline - platform->ticks + 1;
+      if (ticks < max_ticks) {
+        max_ticks = ticks;
+      }
+    }
+  }
+  return max_ticks;
+}
+
+// Called when the CPU changes a device's state. If the device now has work to
+// do but is not scheduled, stop the CPU so that it can be scheduled.
+static void RequestStopIfTimerNeeded(
+    PlatformState* platform, PlatformTimerType type) {
+  uint32_t deadline;
+  if (!platform->timers[type].active &&
+      kPlatformTimerMetadata[type].schedule(
+          platform, GetCurrentTick(platform), &deadline)) {
+    CPURequestStop(&platform->cpu);
+  }
+}
+
+// Called when the CPU reprograms a device. Unschedule the device and stop the
+// CPU so that it can be scheduled again.
+static void RequestReschedule(PlatformState* platform, PlatformTimerType type) {
+  platform->timers[type].active = false;
+  CPURequestStop(&platform->cpu);
+}
+
 // ============================================================================
 // Callbacks for 8259 PIC module
 // ============================================================================
 
 static uint8_t PICCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
-  return PICReadPort((PICState*)entry->context, port);
+  PlatformState* platform = (PlatformState*)entry->context;
+  return PICReadPort(&platform->pic, port);
 }
 
 static void PICCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  PICWritePort((PICState*)entry->context, port, value);
+  PlatformState* platform = (PlatformState*)entry->context;
+  PICWritePort(&platform->pic, port, value);
+  // Unmasking an IRQ or ending an interrupt may let a pending IRQ through, so
+  // return to PlatformRun() to check the PIC.
+  CPURequestStop(&platform->cpu);
 }
 
 static void PICCallbackPlatformRaiseIRQ0(void* context) {
@@ -685,12 +1327,17 @@ static void PICCallbackPlatformRaiseIRQ0(void* context) {
 // ============================================================================
 
 static uint8_t PITCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
-  return PITReadPort((PITState*)entry->context, port);
+  PlatformState* platform = (PlatformState*)entry->context;
+  SyncPIT(platform, GetCurrentTick(platform));
+  return PITReadPort(&platform->pit, port);
 }
 
 static void PITCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  PITWritePort((PITState*)entry->context, port, value);
+  PlatformState* platform = (PlatformState*)entry->context;
+  SyncPIT(platform, GetCurrentTick(platform));
+  PITWritePort(&platform->pit, port, value);
+  RequestReschedule(platform, kPlatformTimerPIT);
 }
 
 static void PITCallbackSetPCSpeakerFrequency(
@@ -717,6 +1364,7 @@ static void PPICallbackSetKeyboardControl(
   PlatformState* platform = (PlatformState*)context;
   KeyboardHandleControl(
       &platform->keyboard, keyboard_enable_clear, keyboard_clock_low);
+  RequestStopIfTimerNeeded(platform, kPlatformTimerKeyboard);
 }
 
 // ============================================================================
@@ -751,13 +1399,25 @@ static void FDCCallbackRequestDMA(void* context) {
   DMATransferByte(&platform->dma, kPlatformDMAChannelFloppy);
 }
 
+static uint16_t FDCCallbackTransferDMABlock(
+    void* context, uint8_t* data, uint16_t size, bool to_memory) {
+  PlatformState* platform = (PlatformState*)context;
+  return DMATransferBlock(
+      &platform->dma, kPlatformDMAChannelFloppy,
+      to_memory ? kDMAModeTransferTypeWrite : kDMAModeTransferTypeRead, data,
+      size);
+}
+
 static uint8_t FDCCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
   return FDCReadPort((FDCState*)entry->context, port);
 }
 
 static void FDCCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  FDCWritePort((FDCState*)entry->context, port, value);
+  FDCState* fdc = (FDCState*)entry->context;
+  FDCWritePort(fdc, port, value);
+  RequestStopIfTimerNeeded(
+      (PlatformState*)fdc->config->context, kPlatformTimerFDC);
 }
 
 // ============================================================================
@@ -772,6 +1432,7 @@ static uint8_t DMACallbackReadMemoryByte(void* context, uint32_t address) {
 static void DMACallbackWriteMemoryByte(
     void* context, uint32_t address, uint8_t value) {
   PlatformState* platform = (PlatformState*)context;
+  CPUInvalidateInstructionCache(&platform->cpu, address);
   WriteMemoryByte(platform, address, value);
 }
 
@@ -862,6 +1523,8 @@ static void PlatformInitBIOS(PlatformState* platform) {
       .end = kBIOSROMStartAddress + bios_size - 1,
       .read_byte = BIOSCallbackReadROMByte,
       .write_byte = NULL,  // BIOS ROM is read-only.
+      .read_data = BIOSGetROMData(),
+      .write_data = NULL,
   };
   RegisterMemoryMapEntry(platform, &bios_rom);
 }
@@ -873,6 +1536,30 @@ static void PlatformInitCPU(PlatformState* platform) {
   platform->cpu_config.write_memory_byte = CPUCallbackWriteMemoryByte;
   platform->cpu_config.read_port = CPUCallbackReadPortByte;
   platform->cpu_config.write_port = CPUCallbackWritePortByte;
+  platform->cpu_config.read_memory_word = CPUCallbackReadMemoryWord;
+  platform->cpu_config.write_memory_word = CPUCallbackWriteMemoryWord;
+  platform->cpu_config.read_port_word = CPUCallbackReadPortWord;
+  platform->cpu_config.write_port_word = CPUCallbackWritePortWord;
+  platform->cpu_config.is_port_stable = CPUCallbackIsPortStable;
+  if (platform->config->idle_keyboard_polls) {
+    platform->cpu_config.handle_interrupt = CPUCallbackHandleInterrupt;
+  }
+  platform->cpu_config.read_memory_pages = platform->memory_read_pages;
+  platform->cpu_config.write_memory_pages = platform->memory_write_pages;
+  platform->cpu_config.instruction_cache = platform->config->instruction_cache;
+  if (platform->cpu_config.instruction_cache) {
+    CPUInitInstructionCache(platform->cpu_config.instruction_cache);
+  }
+  platform->cpu_config.block_cache = platform->config->block_cache;
+  if (platform->cpu_config.block_cache) {
+    CPUInitBlockCache(platform->cpu_config.block_cache);
+  }
+  platform->cpu_config.jit = platform->config->jit;
+  platform->cpu_config.max_string_iterations =
+      platform->config->max_string_iterations
+          ? platform->config->max_string_iterations
+          : kPlatformDefaultMaxStringIterations;
+  platform->cpu_config.use_clock_cycles = platform->config->use_clock_cycles;
   CPUInit(&platform->cpu, &platform->cpu_config);
 
   // Initialize CPU registers.
@@ -893,8 +1580,11 @@ static void PlatformInitMemoryMap(PlatformState* platform) {
       .start = 0x0000,
       .end = platform->config->physical_memory_size - 1,
       .read_byte = ReadPhysicalMemoryByte,
-      .write_byte = WritePhysicalMemoryByte};
-  MemoryMapAppend(&platform->memory_map, &conventional_memory);
+      .write_byte = WritePhysicalMemoryByte,
+      .read_data = platform->config->physical_memory,
+      .write_data = platform->config->physical_memory,
+  };
+  RegisterMemoryMapEntry(platform, &conventional_memory);
 }
 
 static void PlatformInitPIC(PlatformState* platform) {
@@ -906,7 +1596,7 @@ static void PlatformInitPIC(PlatformState* platform) {
       .end = 0x21,
       .read_byte = PICCallbackReadPortByte,
       .write_byte = PICCallbackWritePortByte,
-      .context = &platform->pic,
+      .context = platform,
   };
   RegisterPortMapEntry(platform, &pic_entry);
 }
@@ -923,7 +1613,7 @@ static void PlatformInitPIT(PlatformState* platform) {
       .end = 0x43,
       .read_byte = PITCallbackReadPortByte,
       .write_byte = PITCallbackWritePortByte,
-      .context = &platform->pit,
+      .context = platform,
   };
   RegisterPortMapEntry(platform, &pit_entry);
 }
@@ -961,6 +1651,20 @@ static void PlatformInitFDC(PlatformState* platform) {
   platform->fdc_config.request_dma = FDCCallbackRequestDMA;
   platform->fdc_config.read_image_byte = NULL;
   platform->fdc_config.write_image_byte = NULL;
+  platform->fdc_config.get_image_sector = NULL;
+  platform->fdc_config.read_image_bytes = NULL;
+  platform->fdc_config.track_cache = platform->config->fdc_track_cache;
+  if (platform->fdc_config.track_cache) {
+    FDCInitTrackCache(platform->fdc_config.track_cache);
+  }
+  platform->fdc_config.write_image_bytes = NULL;
+  platform->fdc_config.write_cache = platform->config->fdc_write_cache;
+  if (platform->fdc_config.write_cache) {
+    FDCInitWriteCache(platform->fdc_config.write_cache);
+  }
+  platform->fdc_config.transfer_dma_block =
+      platform->config->use_bulk_disk_transfers ? FDCCallbackTransferDMABlock
+                                                : NULL;
   FDCInit(&platform->fdc, &platform->fdc_config);
   PortMapEntry fdc_entry = {
       .entry_type = (PortMapEntryType)kPortMapEntryFDC,
@@ -1050,6 +1754,18 @@ bool PlatformInit(PlatformState* platform, PlatformConfig* config) {
   PlatformInitMDA(platform);
 
   platform->ticks = 0;
+  platform->cpu_cycles = platform->cpu.cycles;
+  platform->pit_sync_tick = 0;
+  platform->stop_requested = false;
+  platform->idle_ticks = 0;
+  platform->is_idle = false;
+  platform->num_keyboard_polls = 0;
+  platform->last_keyboard_poll_clock_cycles =
+      GetKeyboardPollClockCycles(platform);
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    platform->timers[i].active = false;
+  }
+  ScheduleTimers(platform);
 
   return true;
 }
@@ -1059,41 +1775,93 @@ bool PlatformRaiseIRQ(PlatformState* platform, uint8_t irq) {
     return false;
   }
   PICRaiseIRQ(&platform->pic, irq);
+  // If the CPU is running in PlatformRun(), return so the IRQ can be delivered.
+  CPURequestStop(&platform->cpu);
   return true;
 }
 
-void PlatformTick(PlatformState* platform) {
-  // Tick the CPU.
-  CPUTick(&platform->cpu);
+// Finish num_ticks ticks after the CPU has run them, by checking the PIC and
+// ticking devices at the end of the last tick. Device deadlines before the last
+// tick are only allowed within the CPU's last instruction.
+static void FinishTicks(PlatformState* platform, uint32_t num_ticks) {
+  platform->ticks += num_ticks - 1;
 
   // Check for pending interrupts from the PIC after an
   // instruction has been executed. This is how we connect the PIC to the CPU's
   // interrupt handling flow.
-  if (CPUGetFlag(&platform->cpu, kIF)) {
+  if (PICHasPendingInterrupt(&platform->pic) &&
+      CPUGetFlag(&platform->cpu, kIF)) {
     uint8_t interrupt_vector = PICGetPendingInterrupt(&platform->pic);
     if (interrupt_vector != kPICNoPendingInterrupt) {
       CPUSetPendingInterrupt(&platform->cpu, interrupt_vector);
     }
   }
 
-  // PIT ticks at 1.19MHz, CPU at 4.77MHz. 4.77 / 1.19 ~= 4.
-  if (platform->ticks % 4 == 0) {
-    PITTick(&platform->pit);
-  }
+  // Schedule devices that the CPU gave work to during the last tick, then tick
+  // devices that are due.
+  ScheduleTimers(platform);
+  RunDueTimers(platform);
 
-  // The main clock on the FDC is 8MHz. 8MHz / 4.77MHz ~= 2.
-  if (platform->ticks % 2 == 0) {
-    FDCTick(&platform->fdc);
-  }
+  ++platform->ticks;
+  platform->cpu_cycles = platform->cpu.cycles;
+}
 
-  // The keyboard ticks every 1ms.
-  if (platform->ticks % 4770 == 0) {
-    KeyboardTickMs(&platform->keyboard);
+void PlatformTick(PlatformState* platform) {
+  // Tick the CPU.
+  CPUTick(&platform->cpu);
+  FinishTicks(platform, platform->cpu.cycles - platform->cpu_cycles);
+}
+
+uint32_t PlatformRun(PlatformState* platform, uint32_t max_ticks) {
+  platform->stop_requested = false;
+  platform->idle_ticks = 0;
+  uint32_t ticks_run = 0;
+  while (ticks_run < max_ticks && !platform->stop_requested) {
+    // Run the CPU up to the next device tick. While an IRQ is waiting in the
+    // PIC, e.g. for the CPU to enable interrupts, check it after every tick.
+    ScheduleTimers(platform);
+    uint32_t max_cycles =
+        GetTicksUntilNextTimer(platform, max_ticks - ticks_run);
+    if (PICHasPendingInterrupt(&platform->pic)) {
+      max_cycles = 1;
+    }
+    uint32_t num_cycles;
+    const uint32_t start_idle_cycles = platform->cpu.idle_cycles;
+    ExecuteStatus status = CPURun(&platform->cpu, max_cycles, &num_cycles);
+    if (status != kExecuteSuccess && num_cycles == 0) {
+      // Count the failed instruction cycle, as PlatformTick() does.
+      num_cycles = 1;
+    }
+    if (num_cycles == 0) {
+      continue;
+    }
+    const uint32_t idle_cycles = platform->cpu.idle_cycles - start_idle_cycles;
+    platform->idle_ticks += idle_cycles;
+    platform->is_idle = idle_cycles == num_cycles;
+    FinishTicks(platform, num_cycles);
+    ticks_run += num_cycles;
+    if (status != kExecuteSuccess) {
+      break;
+    }
   }
+  return ticks_run;
+}
 
-  ++platform->ticks;
+void PlatformRequestStop(PlatformState* platform) {
+  platform->stop_requested = true;
+  CPURequestStop(&platform->cpu);
 }
 
+bool PlatformIsIdle(const PlatformState* platform) {
+  return platform->is_idle && !platform->cpu.has_pending_interrupt &&
+         !PICHasPendingInterrupt(&platform->pic);
+}
+
+uint32_t PlatformGetTicksUntilNextEvent(
+    PlatformState* platform, uint32_t max_ticks) {
+  ScheduleTimers(platform);
+  return GetTicksUntilNextTimer(platform, max_ticks);
+}
 
 
 // ==============================================================================
@@ -14,3 +14,7 @@ uint8_t BIOSReadROMByte(uint32_t offset) {
   }
   return kBIOSROMData[offset];
 }
+
+const uint8_t* BIOSGetROMData(void) {
+  return kBIOSROMData;
+}
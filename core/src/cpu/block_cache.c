@@ -0,0 +1,131 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "block_cache.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Block cache
+// ============================================================================
+
+void CPUInitBlockCache(CPUBlockCache* cache) {
+  for (uint32_t i = 0; i < kCPUBlockCacheSize; ++i) {
+    CPUBlock* block = &cache->blocks[i];
+    block->num_instructions = 0;
+    block->next_successor = 0;
+    for (uint8_t j = 0; j < kCPUNumBlockSuccessors; ++j) {
+      block->successors[j] = NULL;
+    }
+#ifdef YAX86_CPU_HAS_JIT
+    block->execution_count = 0;
+    block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_blocks[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+  cache->num_chained = 0;
+  for (uint8_t i = 0; i < kCPUNumFusionKinds; ++i) {
+    cache->fusion_counts[i] = 0;
+  }
+  cache->num_skipped_loop_iterations = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetBlockCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+YAX86_PRIVATE bool IsBlockValid(
+    const CPUBlockCache* cache, const CPUBlock* block) {
+  return block->num_instructions > 0 &&
+         block->generation ==
+             cache->page_generations[GetBlockCachePage(block->address)];
+}
+
+// Returns whether a block is valid and can be entered at a CS:IP, i.e. it does
+// not run past the end of the code segment.
+static inline bool IsBlockValidAt(
+    const CPUBlockCache* cache, const CPUBlock* block, uint32_t address,
+    uint16_t ip) {
+  return block->address == address && (uint32_t)ip + block->size <= 0x10000 &&
+         IsBlockValid(cache, block);
+}
+
+YAX86_PRIVATE CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  if (IsBlockValidAt(cache, block, address, ip)) {
+    ++cache->num_hits;
+    return block;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  block->address = address;
+  block->size = 0;
+  block->num_instructions = 0;
+  block->next_successor = 0;
+  block->is_loop = false;
+  block->is_read_only = false;
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    block->successors[i] = NULL;
+  }
+#ifdef YAX86_CPU_HAS_JIT
+  block->execution_count = 0;
+  block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  return block;
+}
+
+YAX86_PRIVATE void CommitBlock(CPUBlockCache* cache, CPUBlock* block) {
+  uint32_t page = GetBlockCachePage(block->address);
+  block->generation = cache->page_generations[page];
+  cache->page_has_blocks[page] = true;
+}
+
+YAX86_PRIVATE CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    CPUBlock* successor = block->successors[i];
+    if (successor && IsBlockValidAt(cache, successor, address, ip)) {
+      ++cache->num_hits;
+      ++cache->num_chained;
+      return successor;
+    }
+  }
+  return LookupBlockCache(cache, address, ip);
+}
+
+YAX86_PRIVATE void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    if (block->successors[i] == successor) {
+      return;
+    }
+  }
+  block->successors[block->next_successor] = successor;
+  block->next_successor = (block->next_successor + 1) % kCPUNumBlockSuccessors;
+}
+
+YAX86_PRIVATE void InvalidateBlockCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  if (!cache) {
+    return;
+  }
+  uint32_t page = GetBlockCachePage(address);
+  if (cache->page_has_blocks[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_blocks[page] = false;
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef YAX86_CPU_BLOCK_CACHE_H
+#define YAX86_CPU_BLOCK_CACHE_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Look up a translated block in the cache by linear address. ip is the offset
+// of the block within the code segment. Returns NULL if the block is not cached
+// or the cached block is stale.
+extern CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip);
+
+// Returns the cache entry to translate a block at a linear address into. The
+// entry is cleared and any previous block in it is evicted.
+extern CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address);
+
+// Mark a block filled in by the caller as valid.
+extern void CommitBlock(CPUBlockCache* cache, CPUBlock* block);
+
+// Returns whether a block is still valid, i.e. its page has not been written to
+// since it was translated.
+extern bool IsBlockValid(const CPUBlockCache* cache, const CPUBlock* block);
+
+// Returns the block following a block at a linear address, using the block's
+// successor links if possible. Returns NULL if the successor has not been
+// translated yet.
+extern CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip);
+
+// Record a link from a block to a successor block.
+extern void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor);
+
+// Invalidate translated blocks in the page containing a memory address that is
+// about to be written.
+extern void InvalidateBlockCacheOnWrite(CPUState* cpu, uint32_t address);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_BLOCK_CACHE_H
@@ -1,8 +1,13 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
+#include "block_cache.h"
+#include "fusion.h"
+#include "instruction_cache.h"
 #include "instructions.h"
+#include "jit.h"
 #include "operands.h"
 #include "public.h"
+#include "timing.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
 
@@ -18,6 +23,14 @@ void CPUInit(CPUState* cpu, CPUConfig* config) {
   cpu->config = config;
 }
 
+// Derive the segment base addresses from the segment registers, which the host
+// may have written directly.
+static inline void SyncSegmentBases(CPUState* cpu) {
+  for (int i = kES; i <= kDS; ++i) {
+    CPUSetSegmentRegister(cpu, (RegisterIndex)i, cpu->registers[i]);
+  }
+}
+
 // ============================================================================
 // Instruction decoding
 // ============================================================================
@@ -77,12 +90,12 @@ static uint8_t GetImmediateSize(const OpcodeMetadata* metadata, uint8_t reg) {
   }
 }
 
-CPUFetchNextInstructionStatus CPUFetchNextInstruction(
-    CPUState* cpu, Instruction* dest_instruction) {
+// Decode the instruction at CS:original_ip from memory.
+static CPUFetchNextInstructionStatus DecodeInstruction(
+    CPUState* cpu, uint16_t original_ip, Instruction* dest_instruction) {
   Instruction instruction = {0};
   uint8_t current_byte;
-  const uint16_t original_ip = cpu->registers[kIP];
-  uint16_t ip = cpu->registers[kIP];
+  uint16_t ip = original_ip;
 
   // Prefix
   current_byte = ReadNextInstructionByte(cpu, &ip);
@@ -122,60 +135,137 @@ CPUFetchNextInstructionStatus CPUFetchNextInstruction(
   }
 
   instruction.size = ip - original_ip;
+  ResolveMemoryOperand(&instruction);
 
   *dest_instruction = instruction;
   return kFetchSuccess;
 }
 
+// Fetch the next instruction from CS:IP along with its opcode metadata, using
+// the instruction cache if available.
+static CPUFetchNextInstructionStatus FetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction,
+    const OpcodeMetadata** dest_metadata) {
+  CPUInstructionCache* cache = cpu->config->instruction_cache;
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  if (cache) {
+    const CPUInstructionCacheEntry* entry =
+        LookupInstructionCache(cache, address);
+    if (entry) {
+      *dest_instruction = entry->instruction;
+      *dest_metadata = entry->metadata;
+      return kFetchSuccess;
+    }
+  }
+
+  CPUFetchNextInstructionStatus status =
+      DecodeInstruction(cpu, ip, dest_instruction);
+  if (status != kFetchSuccess) {
+    return status;
+  }
+  *dest_metadata = &opcode_table[dest_instruction->opcode];
+  if (cache) {
+    FillInstructionCache(cache, address, ip, dest_instruction, *dest_metadata);
+  }
+  return kFetchSuccess;
+}
+
+CPUFetchNextInstructionStatus CPUFetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction) {
+  const OpcodeMetadata* metadata;
+  SyncSegmentBases(cpu);
+  return FetchNextInstruction(cpu, dest_instruction, &metadata);
+}
+
 // ============================================================================
 // Execution
 // ============================================================================
 
-ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+// Returns the handler for a decoded instruction, preferring a handler
+// specialized for the addressing mode of its ModR/M byte if there is one.
+static inline OpcodeHandler GetOpcodeHandler(
+    const OpcodeMetadata* metadata, const Instruction* instruction) {
+  OpcodeHandler handler =
+      metadata->specialized_handlers
+          [instruction->mod_rm.mod == 3 ? kModRMClassRegister
+                                        : kModRMClassMemory];
+  return handler ? handler : metadata->handler;
+}
+
+// Run the handler for a decoded instruction, without any callbacks.
+static inline ExecuteStatus RunInstructionHandler(
+    CPUState* cpu, const Instruction* instruction,
+    const OpcodeMetadata* metadata) {
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = instruction,
+      .metadata = metadata,
+  };
+  return GetOpcodeHandler(metadata, instruction)(&context);
+}
+
+// Execute a single instruction. If metadata is provided, the instruction is
+// known to have been produced by the decoder and is not validated again.
+static ExecuteStatus ExecuteInstruction(
+    CPUState* cpu, Instruction* instruction, const OpcodeMetadata* metadata) {
   ExecuteStatus status;
 
   // Run the on_before_execute_instruction callback if provided.
-  if (cpu->config->on_before_execute_instruction &&
-      (status = cpu->config->on_before_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_before_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_before_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
+    // The callback may have modified the instruction.
+    metadata = NULL;
   }
 
-  const OpcodeMetadata* metadata = &opcode_table[instruction->opcode];
+  if (!metadata) {
+    metadata = &opcode_table[instruction->opcode];
+    // Check encoded instruction against expected instruction format.
+    if (metadata->handler &&
+        (instruction->has_mod_rm != metadata->has_modrm ||
+         instruction->immediate_size !=
+             (metadata->has_modrm
+                  ? GetImmediateSize(metadata, instruction->mod_rm.reg)
+                  : metadata->immediate_size))) {
+      return kExecuteInvalidInstruction;
+    }
+    ResolveMemoryOperand(instruction);
+  }
   if (!metadata->handler) {
     return kExecuteInvalidOpcode;
   }
 
-  // Check encoded instruction against expected instruction format.
-  if (instruction->has_mod_rm != metadata->has_modrm) {
-    return kExecuteInvalidInstruction;
-  }
-  if (instruction->immediate_size !=
-      (metadata->has_modrm ? GetImmediateSize(metadata, instruction->mod_rm.reg)
-                           : metadata->immediate_size)) {
-    return kExecuteInvalidInstruction;
-  }
-
   // Run the instruction handler.
-  InstructionContext context = {
-      .cpu = cpu,
-      .instruction = instruction,
-      .metadata = metadata,
-  };
-  if ((status = metadata->handler(&context)) != kExecuteSuccess) {
+  if ((status = RunInstructionHandler(cpu, instruction, metadata)) !=
+      kExecuteSuccess) {
     return status;
   }
 
   // Run the on_after_execute_instruction callback if provided.
-  if (cpu->config->on_after_execute_instruction &&
-      (status = cpu->config->on_after_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_after_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_after_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
   }
 
   return kExecuteSuccess;
 }
 
+ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = ExecuteInstruction(cpu, instruction, NULL);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
 // Process pending interrupt, if any.
 static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   if (!cpu->has_pending_interrupt) {
@@ -186,7 +276,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
 
   // Prepare for interrupt processing.
   cpu->is_halted = false;
-  Push(cpu, WordValue(cpu->flags));
+  Push(cpu, WordValue(CPUGetFlags(cpu)));
   CPUSetFlag(cpu, kIF, false);
   CPUSetFlag(cpu, kTF, false);
   Push(cpu, WordValue(cpu->registers[kCS]));
@@ -199,6 +289,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       cpu->config->handle_interrupt
           ? cpu->config->handle_interrupt(cpu, interrupt_number)
           : kExecuteUnhandledInterrupt;
+  SyncSegmentBases(cpu);
 
   switch (interrupt_handler_status) {
     case kExecuteSuccess: {
@@ -212,7 +303,8 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       // Table.
       uint16_t ivt_entry_offset = interrupt_number << 2;
       cpu->registers[kIP] = ReadRawMemoryWord(cpu, ivt_entry_offset);
-      cpu->registers[kCS] = ReadRawMemoryWord(cpu, ivt_entry_offset + 2);
+      CPUSetSegmentRegister(
+          cpu, kCS, ReadRawMemoryWord(cpu, ivt_entry_offset + 2));
       return kExecuteSuccess;
     }
     default:
@@ -221,40 +313,815 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   }
 }
 
-ExecuteStatus CPUTick(CPUState* cpu) {
+// Handle pending interrupts and single-step execution at the end of an
+// instruction cycle.
+static ExecuteStatus FinishTick(CPUState* cpu) {
+  ExecuteStatus status;
+
+  // Step 3: Handle pending interrupts.
+  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+    return status;
+  }
+
+  // Step 4: If trap flag is set, handle single-step execution.
+  if (CPUGetFlag(cpu, kTF)) {
+    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
+    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+      return status;
+    }
+  }
+
+  return kExecuteSuccess;
+}
+
+// Count instruction cycles spent halted, each of which takes one clock cycle.
+static inline void CountHaltedCycles(CPUState* cpu, uint32_t num_cycles) {
+  cpu->cycles += num_cycles;
+  cpu->idle_cycles += num_cycles;
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += num_cycles;
+  }
+}
+
+// Count the clock cycles taken by an instruction that was just executed, on
+// top of the instruction cycle already counted, given IP after the instruction
+// was fetched and CX before it was executed. Returns the clock cycles taken.
+static inline uint32_t CountInstructionClockCycles(
+    CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint32_t clock_cycles =
+      GetInstructionClockCycles(cpu, instruction, next_ip, cx);
+  cpu->cycles += clock_cycles - 1;
+  cpu->clock_cycles += clock_cycles;
+  return clock_cycles;
+}
+
+// Run a single instruction cycle, leaving arithmetic flags pending.
+static ExecuteStatus Tick(CPUState* cpu) {
   ExecuteStatus status;
 
   // Execute next CPU instruction if not halted.
   if (!cpu->is_halted) {
+    ++cpu->cycles;
     // Step 1: Fetch the next instruction, and increment IP.
     Instruction instruction;
+    const OpcodeMetadata* metadata;
     CPUFetchNextInstructionStatus fetch_status =
-        CPUFetchNextInstruction(cpu, &instruction);
+        FetchNextInstruction(cpu, &instruction, &metadata);
     if (fetch_status != kFetchSuccess) {
       return kExecuteInvalidInstruction;
     }
     cpu->registers[kIP] += instruction.size;
+    const uint16_t next_ip = cpu->registers[kIP];
+    const uint16_t cx = cpu->registers[kCX];
 
     // Step 2: Execute the instruction.
-    status = CPUExecuteInstruction(cpu, &instruction);
+    status = ExecuteInstruction(cpu, &instruction, metadata);
     if (status != kExecuteSuccess && status != kExecuteHalt) {
       return status;
     }
+    if (cpu->config->use_clock_cycles) {
+      CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+    }
+  } else {
+    CountHaltedCycles(cpu, 1);
   }
 
-  // Step 3: Handle pending interrupts.
-  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+  return FinishTick(cpu);
+}
+
+ExecuteStatus CPUTick(CPUState* cpu) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Tick(cpu);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Block execution
+// ============================================================================
+
+// Returns whether the string instruction has a REP or REPNZ prefix.
+static bool HasRepetitionPrefix(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns whether an instruction ends a block. This includes all control
+// transfers, REP string instructions, and instructions that may change CS,
+// halt the CPU or enable interrupts.
+static bool IsBlockTerminator(const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M REG field for MOV sreg, r/m16 targeting CS.
+    kModRMRegCS = kCS - kES,
+  };
+  switch (instruction->opcode) {
+    // Jcc rel8
+    case 0x70:
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    case 0x74:
+    case 0x75:
+    case 0x76:
+    case 0x77:
+    case 0x78:
+    case 0x79:
+    case 0x7A:
+    case 0x7B:
+    case 0x7C:
+    case 0x7D:
+    case 0x7E:
+    case 0x7F:
+    // CALL ptr16:16
+    case 0x9A:
+    // POPF
+    case 0x9D:
+    // RET imm16, RET, RETF imm16, RETF
+    case 0xC2:
+    case 0xC3:
+    case 0xCA:
+    case 0xCB:
+    // INT 3, INT imm8, INTO, IRET
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+    // LOOPNZ, LOOPZ, LOOP, JCXZ
+    case 0xE0:
+    case 0xE1:
+    case 0xE2:
+    case 0xE3:
+    // CALL rel16, JMP rel16, JMP ptr16:16, JMP rel8
+    case 0xE8:
+    case 0xE9:
+    case 0xEA:
+    case 0xEB:
+    // HLT
+    case 0xF4:
+    // STI
+    case 0xFB:
+    // POP CS
+    case 0x0F:
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      return instruction->mod_rm.reg == kModRMRegCS;
+    // Group 5 - CALL and JMP through r/m16 or m16:16
+    case 0xFF:
+      return instruction->mod_rm.reg >= 2 && instruction->mod_rm.reg <= 5;
+    // MOVS, CMPS, STOS, LODS, SCAS
+    case 0xA4:
+    case 0xA5:
+    case 0xA6:
+    case 0xA7:
+    case 0xAA:
+    case 0xAB:
+    case 0xAC:
+    case 0xAD:
+    case 0xAE:
+    case 0xAF:
+      return HasRepetitionPrefix(instruction);
+    default:
+      return false;
+  }
+}
+
+// Translate the block starting at CS:IP. Returns NULL if not even the first
+// instruction could be added to a block, in which case the caller should fall
+// back to CPUTick().
+static CPUBlock* TranslateBlock(
+    CPUState* cpu, CPUBlockCache* cache, uint32_t address) {
+  uint16_t ip = cpu->registers[kIP];
+  uint32_t page_offset = address % kCPUInstructionCachePageSize;
+  CPUBlock* block = AllocateBlock(cache, address);
+  while (block->num_instructions < kCPUMaxBlockInstructions) {
+    CPUBlockInstruction* entry =
+        &block->instructions[block->num_instructions];
+    if (DecodeInstruction(cpu, ip, &entry->instruction) != kFetchSuccess) {
+      break;
+    }
+    uint8_t size = entry->instruction.size;
+    // Stop before instructions that wrap around the end of the code segment or
+    // straddle two pages, as in the instruction cache.
+    if ((uint32_t)ip + size > 0x10000 ||
+        page_offset + block->size + size > kCPUInstructionCachePageSize) {
+      break;
+    }
+    entry->metadata = &opcode_table[entry->instruction.opcode];
+    entry->has_variable_clock_cycles =
+        HasVariableClockCycles(&entry->instruction);
+    entry->clock_cycles =
+        (uint16_t)GetInstructionBaseClockCycles(&entry->instruction);
+    entry->block_clock_cycles =
+        block->num_instructions
+            ? entry[-1].block_clock_cycles + entry[-1].clock_cycles
+            : 0;
+    ++block->num_instructions;
+    block->size += size;
+    ip += size;
+    if (!entry->metadata->handler || IsBlockTerminator(&entry->instruction)) {
+      break;
+    }
+  }
+  if (block->num_instructions == 0) {
+    return NULL;
+  }
+  FuseBlockInstructions(block);
+  CommitBlock(cache, block);
+  return block;
+}
+
+// Returns the block starting at CS:IP, translating it if needed. If previous
+// is not NULL, the block is looked up through the previous block's successor
+// links first.
+static CPUBlock* GetBlock(
+    CPUState* cpu, CPUBlockCache* cache, CPUBlock* previous) {
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  CPUBlock* block =
+      previous ? LookupSuccessorBlock(cache, previous, address, ip)
+               : LookupBlockCache(cache, address, ip);
+  if (block) {
+    if (previous) {
+      LinkSuccessorBlock(previous, block);
+    }
+    return block;
+  }
+  block = TranslateBlock(cpu, cache, address);
+  // Translating the block may have evicted the previous block from the cache.
+  if (block && previous && previous != block) {
+    LinkSuccessorBlock(previous, block);
+  }
+  return block;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Execute an instruction on behalf of native code. Returns true if native
+// execution should stop after the instruction, under the same conditions as
+// CPUTickBlock().
+static bool ExecuteJITInstruction(
+    CPUState* cpu, const CPUBlockInstruction* entry) {
+  CPUJIT* jit = cpu->config->jit;
+  const CPUBlock* block = jit->current_block;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  Instruction instruction = entry->instruction;
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  cpu->cycles = jit->current_block_start_cycles +
+                (use_clock_cycles
+                     ? entry->block_clock_cycles +
+                           jit->current_block_variable_clock_cycles
+                     : (uint32_t)(entry - block->instructions)) +
+                1;
+  jit->status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+  jit->stopped = jit->status != kExecuteSuccess || cpu->is_halted ||
+                 cpu->has_pending_interrupt || cpu->stop_requested ||
+                 CPUGetFlag(cpu, kTF) ||
+                 !IsBlockValid(cpu->config->block_cache, block);
+  if (use_clock_cycles && entry->has_variable_clock_cycles) {
+    jit->current_block_variable_clock_cycles +=
+        GetInstructionVariableClockCycles(cpu, &instruction, next_ip, cx);
+    // Stop if the budget could run out before the last instruction, now that
+    // this instruction took longer than its base clock cycles.
+    const CPUBlockInstruction* last =
+        &block->instructions[block->num_instructions - 1];
+    if (entry != last && last->block_clock_cycles +
+                                 jit->current_block_variable_clock_cycles >=
+                             jit->current_block_max_cycles) {
+      jit->stopped = true;
+    }
+  }
+  return jit->stopped;
+}
+
+// Returns whether a block can be run as native code. Native code does not run
+// hooks or check for interrupts after instructions it translates itself, so
+// it must run the whole block without needing either. The budget must also
+// last until the block's last instruction, assuming each instruction takes
+// its base clock cycles with CPUConfig.use_clock_cycles.
+static bool CanRunCompiledBlock(
+    const CPUState* cpu, const CPUBlock* block, uint32_t max_block_cycles) {
+  const CPUBlockInstruction* last =
+      &block->instructions[block->num_instructions - 1];
+  const uint32_t cycles_before_last = cpu->config->use_clock_cycles
+                                          ? last->block_clock_cycles
+                                          : block->num_instructions - 1u;
+  return !cpu->config->on_before_execute_instruction &&
+         !cpu->config->on_after_execute_instruction &&
+         !cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF) &&
+         cycles_before_last < max_block_cycles;
+}
+
+// Run a block as native code if it is hot, compiling it if needed. Returns
+// false if the block should be interpreted instead.
+static bool TryRunCompiledBlock(
+    CPUState* cpu, CPUBlock* block, uint32_t max_block_cycles) {
+  CPUJIT* jit = cpu->config->jit;
+  if (block->execution_count < kCPUJITHotBlockThreshold) {
+    ++block->execution_count;
+    return false;
+  }
+  if (!CanRunCompiledBlock(cpu, block, max_block_cycles)) {
+    return false;
+  }
+  if (!IsBlockCompiled(jit, block) &&
+      !CompileBlock(jit, block, ExecuteJITInstruction)) {
+    return false;
+  }
+  jit->current_block_start_cycles = cpu->cycles;
+  jit->current_block_max_cycles = max_block_cycles;
+  jit->current_block_variable_clock_cycles = 0;
+  uint32_t block_instructions = RunCompiledBlock(jit, cpu, block);
+  if (cpu->config->use_clock_cycles) {
+    const CPUBlockInstruction* last =
+        &block->instructions[block_instructions - 1];
+    cpu->cycles = jit->current_block_start_cycles + last->block_clock_cycles +
+                  last->clock_cycles + jit->current_block_variable_clock_cycles;
+  } else {
+    cpu->cycles = jit->current_block_start_cycles + block_instructions;
+  }
+  return true;
+}
+
+#endif  // YAX86_CPU_HAS_JIT
+
+// Count the clock cycles taken by an instruction that was just executed from a
+// block, on top of the instruction cycle already counted, given IP after the
+// instruction was fetched and CX before it was executed.
+static inline void CountBlockInstructionClockCycles(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint16_t next_ip,
+    uint16_t cx) {
+  cpu->cycles += entry->clock_cycles - 1u;
+  if (entry->has_variable_clock_cycles) {
+    cpu->cycles += GetInstructionVariableClockCycles(
+        cpu, &entry->instruction, next_ip, cx);
+  }
+}
+
+// Execute the fused sequence starting at a block entry, as consecutive
+// instruction cycles without instruction callbacks. The first instruction of a
+// sequence never writes to memory or changes TF, so a pending interrupt or a
+// stop request are the only reasons to stop between the two instructions, in
+// which case only the first one is executed. Returns the number of
+// instructions executed in *num_executed.
+static ExecuteStatus ExecuteFusedSequence(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint8_t* num_executed) {
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  const Instruction* first = &entry[0].instruction;
+  cpu->registers[kIP] += first->size;
+  cpu->cycles += use_clock_cycles ? entry[0].clock_cycles : 1;
+  *num_executed = 1;
+  if (entry->fusion == kCPUFusionZeroRegister) {
+    ExecuteFusedZeroRegister(cpu, first, entry->metadata->width);
+    return kExecuteSuccess;
+  }
+  ExecuteStatus status = RunInstructionHandler(cpu, first, entry->metadata);
+  if (status != kExecuteSuccess || cpu->has_pending_interrupt ||
+      cpu->stop_requested) {
     return status;
   }
 
-  // Step 4: If trap flag is set, handle single-step execution.
-  if (CPUGetFlag(cpu, kTF)) {
-    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
-    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
-      return status;
+  const Instruction* second = &entry[1].instruction;
+  cpu->registers[kIP] += second->size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ++cpu->cycles;
+  *num_executed = 2;
+  // Resolve the conditional jump directly from the operands of the CMP, TEST,
+  // INC or DEC, leaving its flags pending.
+  bool is_taken;
+  if (entry->fusion != kCPUFusionLoadStore &&
+      EvaluateFusedJumpCondition(
+          &cpu->lazy_flags, second->opcode, &is_taken)) {
+    if (is_taken) {
+      cpu->registers[kIP] =
+          AddSignedOffsetByte(cpu->registers[kIP], second->immediate[0]);
     }
+  } else {
+    status = RunInstructionHandler(cpu, second, entry[1].metadata);
+  }
+  if (use_clock_cycles) {
+    CountBlockInstructionClockCycles(cpu, &entry[1], next_ip, cx);
+  }
+  return status;
+}
+
+// Returns whether a loop block branched back to its own start.
+static inline bool IsLoopBack(const CPUState* cpu, const CPUBlock* block) {
+  return block->is_loop &&
+         CPUGetSegmentBase(cpu, kCS) + cpu->registers[kIP] == block->address;
+}
+
+// Skip iterations of a loop block that branched back to its own start, if
+// their effect is known in advance. Delay loops and loops that wait for memory
+// or a port to change can then use up the instruction budget at once. The last
+// iteration took iteration_cycles, leaving max_cycles of the budget.
+static void SkipLoopIterations(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_cycles, uint32_t iteration_cycles) {
+  const uint32_t num_iterations = FastForwardLoop(
+      cpu, block, snapshot, max_cycles / iteration_cycles, iteration_cycles);
+  cpu->config->block_cache->num_skipped_loop_iterations += num_iterations;
+}
+
+// Run instructions in translated blocks starting with the given block, until
+// max_cycles instruction cycles have been counted since start_cycles.
+static ExecuteStatus RunBlocks(
+    CPUState* cpu, CPUBlock* block, uint32_t start_cycles,
+    uint32_t max_cycles) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  // Fused sequences are only executed as a single step if no callback needs
+  // to see the individual instructions.
+  const bool can_fuse = !cpu->config->on_before_execute_instruction &&
+                        !cpu->config->on_after_execute_instruction;
+  LoopSnapshot snapshot = {0};
+
+  for (;;) {
+    const uint32_t block_start_cycles = cpu->cycles;
+#ifdef YAX86_CPU_HAS_JIT
+    if (cpu->config->jit &&
+        TryRunCompiledBlock(
+            cpu, block, max_cycles - (cpu->cycles - start_cycles))) {
+      CPUJIT* jit = cpu->config->jit;
+      if (jit->status != kExecuteSuccess && jit->status != kExecuteHalt) {
+        return jit->status;
+      }
+      if (jit->stopped || cpu->cycles - start_cycles >= max_cycles) {
+        return FinishTick(cpu);
+      }
+      if (IsLoopBack(cpu, block)) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      } else {
+        snapshot.block = NULL;
+      }
+      if (!(block = GetBlock(cpu, cache, block))) {
+        return kExecuteSuccess;
+      }
+      continue;
+    }
+#endif  // YAX86_CPU_HAS_JIT
+    for (uint8_t i = 0; i < block->num_instructions;) {
+      const CPUBlockInstruction* entry = &block->instructions[i];
+      const uint32_t remaining_cycles =
+          max_cycles - (cpu->cycles - start_cycles);
+      ExecuteStatus status;
+      uint8_t num_executed;
+      const uint8_t fusion_length =
+          GetFusionLength((CPUFusionKind)entry->fusion);
+      // The last instruction of a fused sequence must start within the budget.
+      if (entry->fusion != kCPUFusionNone && can_fuse &&
+          !CPUGetFlag(cpu, kTF) &&
+          (fusion_length == 1 ||
+           remaining_cycles > (use_clock_cycles ? entry->clock_cycles : 1u))) {
+        status = ExecuteFusedSequence(cpu, entry, &num_executed);
+        if (num_executed == fusion_length) {
+          ++cache->fusion_counts[entry->fusion];
+        }
+      } else {
+        // Copy the instruction, as the on_before_execute_instruction callback
+        // may modify it.
+        Instruction instruction = entry->instruction;
+        cpu->registers[kIP] += instruction.size;
+        const uint16_t next_ip = cpu->registers[kIP];
+        const uint16_t cx = cpu->registers[kCX];
+        ++cpu->cycles;
+        status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+        if (use_clock_cycles) {
+          CountBlockInstructionClockCycles(cpu, entry, next_ip, cx);
+        }
+        num_executed = 1;
+      }
+      i += num_executed;
+      if (status != kExecuteSuccess && status != kExecuteHalt) {
+        return status;
+      }
+      // Stop at the end of the instruction cycle if it needs interrupt
+      // handling, if the host asked to stop, or if it wrote to the block's own
+      // code.
+      if (cpu->is_halted || cpu->has_pending_interrupt ||
+          cpu->stop_requested || CPUGetFlag(cpu, kTF) ||
+          cpu->cycles - start_cycles >= max_cycles ||
+          !IsBlockValid(cache, block)) {
+        return FinishTick(cpu);
+      }
+    }
+    // Run a loop block again directly if it branched back to its own start.
+    // Iterations are only skipped if no callback needs to see them.
+    if (IsLoopBack(cpu, block)) {
+      ++cache->fusion_counts[kCPUFusionLoop];
+      if (can_fuse) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      }
+      continue;
+    }
+    // Follow the link to the next block.
+    snapshot.block = NULL;
+    if (!(block = GetBlock(cpu, cache, block))) {
+      return kExecuteSuccess;
+    }
+  }
+}
+
+// Run instructions in translated blocks, leaving arithmetic flags pending.
+static ExecuteStatus TickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const uint32_t start_cycles = cpu->cycles;
+  *num_instructions = 0;
+  if (max_instructions == 0) {
+    return kExecuteSuccess;
   }
+  CPUBlock* block =
+      (cache && !cpu->is_halted) ? GetBlock(cpu, cache, NULL) : NULL;
+  if (!block) {
+    ExecuteStatus status = Tick(cpu);
+    *num_instructions = cpu->cycles - start_cycles;
+    return status;
+  }
+  ExecuteStatus status = RunBlocks(cpu, block, start_cycles, max_instructions);
+  *num_instructions = cpu->cycles - start_cycles;
+  // Clock cycles are counted in instruction cycles while running blocks.
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += *num_instructions;
+  }
+  return status;
+}
 
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = TickBlock(cpu, max_instructions, num_instructions);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Batched execution
+// ============================================================================
+
+// Run a single instruction cycle like Tick(), but without checking for
+// instruction callbacks.
+static ExecuteStatus TickWithoutCallbacks(CPUState* cpu) {
+  ++cpu->cycles;
+  Instruction instruction;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, &instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
+  }
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ExecuteStatus status =
+      metadata->handler
+          ? RunInstructionHandler(cpu, &instruction, metadata)
+          : kExecuteInvalidOpcode;
+  if (status != kExecuteSuccess && status != kExecuteHalt) {
+    return status;
+  }
+  if (cpu->config->use_clock_cycles) {
+    CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+  }
+  return FinishTick(cpu);
+}
+
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Labels of the opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_LABEL_ROW(row)                                           \
+  &&opcode_##row##0, &&opcode_##row##1, &&opcode_##row##2, &&opcode_##row##3, \
+      &&opcode_##row##4, &&opcode_##row##5, &&opcode_##row##6,                \
+      &&opcode_##row##7, &&opcode_##row##8, &&opcode_##row##9,                \
+      &&opcode_##row##A, &&opcode_##row##B, &&opcode_##row##C,                \
+      &&opcode_##row##D, &&opcode_##row##E, &&opcode_##row##F
+
+// Opcode handler in RunThreaded(). As the opcode is a constant, the compiler
+// can call the handler directly, and inline it with its metadata. Only
+// opcodes with specialized handlers check the ModR/M byte.
+#define YAX86_OPCODE_HANDLER(opcode)                                          \
+  opcode_##opcode:                                                            \
+  context.metadata = &opcode_table[0x##opcode];                               \
+  status = opcode_table[0x##opcode].handler                                   \
+               ? GetOpcodeHandler(&opcode_table[0x##opcode], &instruction)(   \
+                     &context)                                                \
+               : kExecuteInvalidOpcode;                                       \
+  YAX86_DISPATCH_NEXT_OPCODE()
+
+// Opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_HANDLER_ROW(row)                                         \
+  YAX86_OPCODE_HANDLER(row##0)                                                \
+  YAX86_OPCODE_HANDLER(row##1)                                                \
+  YAX86_OPCODE_HANDLER(row##2)                                                \
+  YAX86_OPCODE_HANDLER(row##3)                                                \
+  YAX86_OPCODE_HANDLER(row##4)                                                \
+  YAX86_OPCODE_HANDLER(row##5)                                                \
+  YAX86_OPCODE_HANDLER(row##6)                                                \
+  YAX86_OPCODE_HANDLER(row##7)                                                \
+  YAX86_OPCODE_HANDLER(row##8)                                                \
+  YAX86_OPCODE_HANDLER(row##9)                                                \
+  YAX86_OPCODE_HANDLER(row##A)                                                \
+  YAX86_OPCODE_HANDLER(row##B)                                                \
+  YAX86_OPCODE_HANDLER(row##C)                                                \
+  YAX86_OPCODE_HANDLER(row##D)                                                \
+  YAX86_OPCODE_HANDLER(row##E)                                                \
+  YAX86_OPCODE_HANDLER(row##F)
+
+// Finish the current instruction cycle, then fetch the next instruction and
+// jump to the handler for its opcode. Each handler has its own copy of the
+// indirect jump, which lets the host predict opcode sequences.
+#define YAX86_DISPATCH_NEXT_OPCODE()                                          \
+  ++cycles;                                                                   \
+  if (status != kExecuteSuccess && status != kExecuteHalt) {                  \
+    goto done;                                                                \
+  }                                                                           \
+  if (use_clock_cycles) {                                                     \
+    cycles +=                                                                 \
+        CountInstructionClockCycles(cpu, &instruction, next_ip, cx) - 1;      \
+  }                                                                           \
+  if ((status = FinishTick(cpu)) != kExecuteSuccess ||                        \
+      cycles >= max_cycles || cpu->is_halted || cpu->stop_requested) {        \
+    goto done;                                                                \
+  }                                                                           \
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=               \
+      kExecuteSuccess) {                                                      \
+    ++cycles;                                                                 \
+    goto done;                                                                \
+  }                                                                           \
+  next_ip = cpu->registers[kIP];                                              \
+  cx = cpu->registers[kCX];                                                   \
+  goto *kOpcodeLabels[instruction.opcode];
+
+// Start an instruction cycle and fetch the next instruction for
+// RunThreaded().
+static inline ExecuteStatus FetchThreadedInstruction(
+    CPUState* cpu, Instruction* instruction) {
+  ++cpu->cycles;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
+  }
+  cpu->registers[kIP] += instruction->size;
   return kExecuteSuccess;
 }
 
+// Computed gotos are a GCC and Clang extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Run instruction cycles like TickWithoutCallbacks() until the budget is used
+// up, the CPU halts or execution needs to return to the host. Instead of
+// calling opcode handlers through the opcode table, this jumps directly from
+// one opcode's handler to the next with computed gotos.
+static ExecuteStatus RunThreaded(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  static const void* const kOpcodeLabels[256] = {
+      YAX86_OPCODE_LABEL_ROW(0),
+      YAX86_OPCODE_LABEL_ROW(1),
+      YAX86_OPCODE_LABEL_ROW(2),
+      YAX86_OPCODE_LABEL_ROW(3),
+      YAX86_OPCODE_LABEL_ROW(4),
+      YAX86_OPCODE_LABEL_ROW(5),
+      YAX86_OPCODE_LABEL_ROW(6),
+      YAX86_OPCODE_LABEL_ROW(7),
+      YAX86_OPCODE_LABEL_ROW(8),
+      YAX86_OPCODE_LABEL_ROW(9),
+      YAX86_OPCODE_LABEL_ROW(A),
+      YAX86_OPCODE_LABEL_ROW(B),
+      YAX86_OPCODE_LABEL_ROW(C),
+      YAX86_OPCODE_LABEL_ROW(D),
+      YAX86_OPCODE_LABEL_ROW(E),
+      YAX86_OPCODE_LABEL_ROW(F),
+  };
+  Instruction instruction;
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = &instruction,
+      .metadata = NULL,
+  };
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  ExecuteStatus status;
+  uint32_t cycles = 0;
+  // IP after the current instruction was fetched, and CX before it was
+  // executed, for timing it in clock cycles.
+  uint16_t next_ip;
+  uint16_t cx;
+  if (max_cycles == 0) {
+    *num_cycles = 0;
+    return kExecuteSuccess;
+  }
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=
+      kExecuteSuccess) {
+    *num_cycles = 1;
+    return status;
+  }
+  next_ip = cpu->registers[kIP];
+  cx = cpu->registers[kCX];
+  goto *kOpcodeLabels[instruction.opcode];
+
+  YAX86_OPCODE_HANDLER_ROW(0)
+  YAX86_OPCODE_HANDLER_ROW(1)
+  YAX86_OPCODE_HANDLER_ROW(2)
+  YAX86_OPCODE_HANDLER_ROW(3)
+  YAX86_OPCODE_HANDLER_ROW(4)
+  YAX86_OPCODE_HANDLER_ROW(5)
+  YAX86_OPCODE_HANDLER_ROW(6)
+  YAX86_OPCODE_HANDLER_ROW(7)
+  YAX86_OPCODE_HANDLER_ROW(8)
+  YAX86_OPCODE_HANDLER_ROW(9)
+  YAX86_OPCODE_HANDLER_ROW(A)
+  YAX86_OPCODE_HANDLER_ROW(B)
+  YAX86_OPCODE_HANDLER_ROW(C)
+  YAX86_OPCODE_HANDLER_ROW(D)
+  YAX86_OPCODE_HANDLER_ROW(E)
+  YAX86_OPCODE_HANDLER_ROW(F)
+
+done:
+  *num_cycles = cycles;
+  return status;
+}
+
+#pragma GCC diagnostic pop
+
+#undef YAX86_OPCODE_LABEL_ROW
+#undef YAX86_OPCODE_HANDLER
+#undef YAX86_OPCODE_HANDLER_ROW
+#undef YAX86_DISPATCH_NEXT_OPCODE
+
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Run instruction cycles until the budget is used up or execution needs to
+// return to the host, leaving arithmetic flags pending.
+static ExecuteStatus Run(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  CPUBlockCache* const cache = cpu->config->block_cache;
+  const bool has_callbacks = cpu->config->on_before_execute_instruction ||
+                             cpu->config->on_after_execute_instruction;
+  ExecuteStatus status = kExecuteSuccess;
+  uint32_t cycles = 0;
+  while (cycles < max_cycles && !cpu->stop_requested) {
+    if (cpu->is_halted) {
+      if (!cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF)) {
+        // Nothing can wake up the CPU until the host raises an interrupt.
+        CountHaltedCycles(cpu, max_cycles - cycles);
+        cycles = max_cycles;
+        break;
+      }
+      CountHaltedCycles(cpu, 1);
+      ++cycles;
+      if ((status = FinishTick(cpu)) != kExecuteSuccess) {
+        break;
+      }
+      continue;
+    }
+    if (cache) {
+      uint32_t block_cycles;
+      status = TickBlock(cpu, max_cycles - cycles, &block_cycles);
+      cycles += block_cycles;
+    } else if (has_callbacks) {
+      const uint32_t start_cycles = cpu->cycles;
+      status = Tick(cpu);
+      cycles += cpu->cycles - start_cycles;
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+    } else if (!cpu->config->use_portable_dispatch) {
+      uint32_t threaded_cycles;
+      status = RunThreaded(cpu, max_cycles - cycles, &threaded_cycles);
+      cycles += threaded_cycles;
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+    } else {
+      const uint32_t start_cycles = cpu->cycles;
+      status = TickWithoutCallbacks(cpu);
+      cycles += cpu->cycles - start_cycles;
+    }
+    if (status != kExecuteSuccess || cpu->is_halted) {
+      break;
+    }
+  }
+  *num_cycles = cycles;
+  return status;
+}
+
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Run(cpu, max_cycles, num_cycles);
+  cpu->stop_requested = false;
+  CPUMaterializeFlags(cpu);
+  return status;
+}
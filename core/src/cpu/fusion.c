@@ -0,0 +1,371 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "fusion.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction fusion
+// ============================================================================
+
+// Number of instructions in each kind of fused sequence, indexed by
+// CPUFusionKind. Loops are not executed as a sequence of instructions.
+static const uint8_t kFusionLengths[kCPUNumFusionKinds] = {
+    1,  // kCPUFusionNone
+    2,  // kCPUFusionCompareJump
+    2,  // kCPUFusionIncDecJump
+    2,  // kCPUFusionLoadStore
+    1,  // kCPUFusionZeroRegister
+    0,  // kCPUFusionLoop
+};
+
+YAX86_PRIVATE uint8_t GetFusionLength(CPUFusionKind kind) {
+  return kFusionLengths[kind];
+}
+
+// Returns whether an instruction is a CMP or TEST instruction.
+static bool IsCompare(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // CMP r/m, reg; CMP reg, r/m; CMP AL/AX, imm
+    case 0x38:
+    case 0x39:
+    case 0x3A:
+    case 0x3B:
+    case 0x3C:
+    case 0x3D:
+    // TEST r/m, reg; TEST AL/AX, imm
+    case 0x84:
+    case 0x85:
+    case 0xA8:
+    case 0xA9:
+      return true;
+    // Group 1 - CMP r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      return instruction->mod_rm.reg == 7;
+    // Group 3 - TEST r/m, imm
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction is an INC or DEC of a 16-bit register.
+static bool IsIncDecRegister(const Instruction* instruction) {
+  return instruction->opcode >= 0x40 && instruction->opcode <= 0x4F;
+}
+
+// Returns whether an instruction is a conditional jump (Jcc rel8).
+static bool IsConditionalJump(const Instruction* instruction) {
+  return instruction->opcode >= 0x70 && instruction->opcode <= 0x7F;
+}
+
+// Returns whether an instruction is a short branch, i.e. a Jcc, LOOP, LOOPZ,
+// LOOPNZ, JCXZ or JMP with a rel8 operand.
+static bool IsShortBranch(const Instruction* instruction) {
+  return IsConditionalJump(instruction) ||
+         (instruction->opcode >= 0xE0 && instruction->opcode <= 0xE3) ||
+         instruction->opcode == 0xEB;
+}
+
+// Returns whether an instruction is an XOR or SUB of a register with itself.
+static bool IsZeroRegister(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // SUB r/m, reg; SUB reg, r/m
+    case 0x28:
+    case 0x29:
+    case 0x2A:
+    case 0x2B:
+    // XOR r/m, reg; XOR reg, r/m
+    case 0x30:
+    case 0x31:
+    case 0x32:
+    case 0x33:
+      return instruction->mod_rm.mod == 3 &&
+             instruction->mod_rm.reg == instruction->mod_rm.rm;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction only writes to registers other than segment
+// registers and SP, and to flags other than IF and TF.
+static bool IsReadOnlyInstruction(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const bool is_register = instruction->mod_rm.mod == 3;
+  // ALU instructions: op r/m, reg; op reg, r/m; op AL/AX, imm
+  if (opcode < 0x40 && (opcode & 0x07) < 6) {
+    // op r/m, reg writes to memory unless it is a CMP.
+    return (opcode & 0x06) != 0 || is_register || (opcode & 0x38) == 0x38;
+  }
+  // INC and DEC of a register
+  if (IsIncDecRegister(instruction) || IsShortBranch(instruction)) {
+    return true;
+  }
+  switch (opcode) {
+    // Group 1 - op r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      return is_register || instruction->mod_rm.reg == 7;
+    // XCHG r/m, reg; MOV r/m, reg; MOV r/m, imm
+    case 0x86:
+    case 0x87:
+    case 0x88:
+    case 0x89:
+    case 0xC6:
+    case 0xC7:
+    // Group 2 - shifts and rotates
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3:
+      return is_register;
+    // Group 3 - TEST r/m, imm; NOT; NEG
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0 ||
+             ((instruction->mod_rm.reg == 2 || instruction->mod_rm.reg == 3) &&
+              is_register);
+    // TEST r/m, reg; MOV reg, r/m; LEA
+    case 0x84:
+    case 0x85:
+    case 0x8A:
+    case 0x8B:
+    case 0x8D:
+    // XCHG AX, reg
+    case 0x90:
+    case 0x91:
+    case 0x92:
+    case 0x93:
+    case 0x94:
+    case 0x95:
+    case 0x96:
+    case 0x97:
+    // CBW; CWD; SAHF; LAHF
+    case 0x98:
+    case 0x99:
+    case 0x9E:
+    case 0x9F:
+    // MOV AL/AX, moffs; TEST AL/AX, imm
+    case 0xA0:
+    case 0xA1:
+    case 0xA8:
+    case 0xA9:
+    // XLAT
+    case 0xD7:
+    // IN AL/AX, imm8; IN AL/AX, DX
+    case 0xE4:
+    case 0xE5:
+    case 0xEC:
+    case 0xED:
+    // CMC; CLC; STC; CLD; STD
+    case 0xF5:
+    case 0xF8:
+    case 0xF9:
+    case 0xFC:
+    case 0xFD:
+      return true;
+    default:
+      // MOV reg, imm
+      return opcode >= 0xB0 && opcode <= 0xBF;
+  }
+}
+
+// Returns the kind of fused sequence starting with an instruction. next is the
+// following instruction in the block, or NULL if there is none.
+static CPUFusionKind GetFusionKind(
+    const Instruction* instruction, const Instruction* next) {
+  if (IsZeroRegister(instruction)) {
+    return kCPUFusionZeroRegister;
+  }
+  if (!next) {
+    return kCPUFusionNone;
+  }
+  if (IsConditionalJump(next)) {
+    if (IsCompare(instruction)) {
+      return kCPUFusionCompareJump;
+    }
+    if (IsIncDecRegister(instruction)) {
+      return kCPUFusionIncDecJump;
+    }
+  }
+  // The LODS may have a segment override prefix, but the STOS may not be
+  // repeated.
+  if (((instruction->opcode == 0xAC && next->opcode == 0xAA) ||
+       (instruction->opcode == 0xAD && next->opcode == 0xAB)) &&
+      next->prefix_size == 0) {
+    return kCPUFusionLoadStore;
+  }
+  return kCPUFusionNone;
+}
+
+YAX86_PRIVATE void FuseBlockInstructions(CPUBlock* block) {
+  block->is_read_only = true;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const Instruction* next = i + 1 < block->num_instructions
+                                  ? &block->instructions[i + 1].instruction
+                                  : NULL;
+    block->instructions[i].fusion =
+        GetFusionKind(&block->instructions[i].instruction, next);
+    if (!IsReadOnlyInstruction(&block->instructions[i].instruction)) {
+      block->is_read_only = false;
+    }
+  }
+  // The block branches back to its own start if the branch offset is minus
+  // the size of the block.
+  const Instruction* last =
+      &block->instructions[block->num_instructions - 1].instruction;
+  block->is_loop = IsShortBranch(last) &&
+                   (int32_t)(int8_t)last->immediate[0] == -(int32_t)block->size;
+}
+
+// Sign-extend a value of a given width.
+static inline int32_t SignExtend(uint32_t value, Width width) {
+  return (int32_t)((value & kMaxValue[width]) ^ kSignBit[width]) -
+         (int32_t)kSignBit[width];
+}
+
+YAX86_PRIVATE bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken) {
+  const Width width = (Width)lazy_flags->width;
+  const uint32_t result = lazy_flags->result & kMaxValue[width];
+  // CMP without borrow, or TEST.
+  const bool is_compare = lazy_flags->op == kLazyFlagsSub &&
+                          !lazy_flags->did_carry &&
+                          lazy_flags->pending == kArithmeticFlags;
+  const bool is_test = lazy_flags->op == kLazyFlagsBoolean &&
+                       lazy_flags->pending == (kArithmeticFlags & ~kAF);
+  const int32_t op1 = SignExtend(lazy_flags->op1, width);
+  const int32_t op2 = SignExtend(lazy_flags->op2, width);
+  bool condition;
+  switch (opcode & 0xFE) {
+    // JC / JNC
+    case 0x72:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition =
+          is_compare && lazy_flags->op1 < (lazy_flags->op2 & kMaxValue[width]);
+      break;
+    // JZ / JNZ
+    case 0x74:
+      if (!(lazy_flags->pending & kZF)) {
+        return false;
+      }
+      condition = result == 0;
+      break;
+    // JBE / JA
+    case 0x76:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? lazy_flags->op1 <=
+                                   (lazy_flags->op2 & kMaxValue[width])
+                             : result == 0;
+      break;
+    // JS / JNS
+    case 0x78:
+      if (!(lazy_flags->pending & kSF)) {
+        return false;
+      }
+      condition = (result & kSignBit[width]) != 0;
+      break;
+    // JL / JGE
+    case 0x7C:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 < op2 : (result & kSignBit[width]) != 0;
+      break;
+    // JLE / JG
+    case 0x7E:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 <= op2
+                             : result == 0 || (result & kSignBit[width]) != 0;
+      break;
+    // JO, JP and their negations
+    default:
+      return false;
+  }
+  // Even opcode => jump if the condition is true
+  // Odd opcode => jump if the condition is false
+  *is_taken = condition == ((opcode & 0x1) == 0);
+  return true;
+}
+
+YAX86_PRIVATE void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width) {
+  const uint8_t reg = instruction->mod_rm.reg;
+  if (width == kWord) {
+    cpu->registers[reg] = 0;
+  } else if (reg < 4) {
+    cpu->registers[reg] &= 0xFF00;
+  } else {
+    cpu->registers[reg - 4] &= 0x00FF;
+  }
+  // The flags of x - x and x ^ x don't depend on x.
+  SetLazyFlags(
+      cpu, instruction->opcode < 0x30 ? kLazyFlagsSub : kLazyFlagsBoolean,
+      width, 0, 0, 0, false);
+}
+
+// Returns whether the CPU state matches a loop snapshot.
+static bool MatchesLoopSnapshot(
+    const CPUState* cpu, const LoopSnapshot* snapshot) {
+  for (int i = 0; i < kNumRegisters; ++i) {
+    if (cpu->registers[i] != snapshot->registers[i]) {
+      return false;
+    }
+  }
+  const CPULazyFlags* a = &cpu->lazy_flags;
+  const CPULazyFlags* b = &snapshot->lazy_flags;
+  return cpu->flags == snapshot->flags && a->pending == b->pending &&
+         a->op == b->op && a->width == b->width &&
+         a->did_carry == b->did_carry && a->op1 == b->op1 &&
+         a->op2 == b->op2 && a->result == b->result &&
+         cpu->num_unstable_port_reads == snapshot->num_unstable_port_reads;
+}
+
+YAX86_PRIVATE uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles) {
+  // A LOOP instruction branching to itself only counts down CX. Skip all but
+  // the last iteration, which leaves the loop.
+  if (block->num_instructions == 1 &&
+      block->instructions[0].instruction.opcode == 0xE2) {
+    uint32_t num_iterations = (uint32_t)cpu->registers[kCX] - 1;
+    if (num_iterations > max_iterations) {
+      num_iterations = max_iterations;
+    }
+    cpu->registers[kCX] -= num_iterations;
+    cpu->cycles += num_iterations * iteration_cycles;
+    return num_iterations;
+  }
+  if (!block->is_read_only) {
+    return 0;
+  }
+  // If the last iteration left the CPU state unchanged, without reading from
+  // ports that may have changed, every further iteration does the same.
+  if (snapshot->block == block && MatchesLoopSnapshot(cpu, snapshot)) {
+    cpu->cycles += max_iterations * iteration_cycles;
+    cpu->idle_cycles += max_iterations * iteration_cycles;
+    return max_iterations;
+  }
+  snapshot->block = block;
+  for (int i = 0; i < kNumRegisters; ++i) {
+    snapshot->registers[i] = cpu->registers[i];
+  }
+  snapshot->flags = cpu->flags;
+  snapshot->lazy_flags = cpu->lazy_flags;
+  snapshot->num_unstable_port_reads = cpu->num_unstable_port_reads;
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef YAX86_CPU_FUSION_H
+#define YAX86_CPU_FUSION_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Recognize fused sequences in a translated block, and set the fusion kind of
+// each instruction and whether the block is a loop.
+extern void FuseBlockInstructions(CPUBlock* block);
+
+// Returns the number of instructions in a fused sequence.
+extern uint8_t GetFusionLength(CPUFusionKind kind);
+
+// Evaluate the condition of a conditional jump directly from the operands of
+// the pending flag-producing operation. Returns false if the condition can't
+// be derived this way, in which case the jump must be executed normally.
+extern bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken);
+
+// Execute an XOR or SUB of a register with itself.
+extern void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width);
+
+// Fast-forward through up to max_iterations further iterations of a loop
+// block that just branched back to its own start, if their effect is known in
+// advance: a LOOP instruction branching to itself, or a read-only block whose
+// last iteration left the CPU state unchanged since the previous call with the
+// same snapshot. Otherwise, saves the CPU state in the snapshot. Each skipped
+// iteration advances CPUState.cycles by iteration_cycles, the number of cycles
+// taken by the iteration that just ran. Returns the number of iterations
+// skipped.
+extern uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_FUSION_H
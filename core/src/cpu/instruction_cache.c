@@ -0,0 +1,94 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+void CPUInitInstructionCache(CPUInstructionCache* cache) {
+  for (uint32_t i = 0; i < kCPUInstructionCacheSize; ++i) {
+    cache->entries[i].metadata = NULL;
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_instructions[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetInstructionCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+// Returns the cache entry for a linear address.
+static inline CPUInstructionCacheEntry* GetInstructionCacheEntry(
+    CPUInstructionCache* cache, uint32_t address) {
+  return &cache->entries[address % kCPUInstructionCacheSize];
+}
+
+static void InvalidateInstructionCachePage(
+    CPUInstructionCache* cache, uint32_t address) {
+  uint32_t page = GetInstructionCachePage(address);
+  if (cache->page_has_instructions[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_instructions[page] = false;
+  }
+}
+
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+  InvalidateBlockCacheOnWrite(cpu, address);
+}
+
+YAX86_PRIVATE void InvalidateInstructionCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+}
+
+YAX86_PRIVATE const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address) {
+  const CPUInstructionCacheEntry* entry =
+      GetInstructionCacheEntry(cache, address);
+  if (entry->metadata && entry->address == address &&
+      entry->generation ==
+          cache->page_generations[GetInstructionCachePage(address)]) {
+    ++cache->num_hits;
+    return entry;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata) {
+  // Don't cache instructions that wrap around the end of the code segment, as
+  // their bytes are not contiguous in memory, or that straddle two pages, as
+  // only the first page's generation is tracked.
+  if ((uint32_t)ip + instruction->size > 0x10000 ||
+      (address % kCPUInstructionCachePageSize) + instruction->size >
+          kCPUInstructionCachePageSize) {
+    return;
+  }
+  uint32_t page = GetInstructionCachePage(address);
+  CPUInstructionCacheEntry* entry = GetInstructionCacheEntry(cache, address);
+  entry->address = address;
+  entry->generation = cache->page_generations[page];
+  entry->metadata = metadata;
+  entry->instruction = *instruction;
+  cache->page_has_instructions[page] = true;
+}
@@ -0,0 +1,25 @@
+#ifndef YAX86_CPU_INSTRUCTION_CACHE_H
+#define YAX86_CPU_INSTRUCTION_CACHE_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Look up a decoded instruction in the cache by linear address. Returns NULL
+// if the instruction is not cached or the cached entry is stale.
+extern const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address);
+
+// Add a decoded instruction to the cache. ip is the offset of the instruction
+// within the code segment.
+extern void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata);
+
+// Invalidate cached instructions in the page containing a memory address
+// that is about to be written.
+extern void InvalidateInstructionCacheOnWrite(CPUState* cpu, uint32_t address);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_INSTRUCTION_CACHE_H
@@ -29,7 +29,7 @@ extern ExecuteStatus ExecuteNoOp(const InstructionContext* ctx);
 // ============================================================================
 
 // Global opcode metadata lookup table.
-extern OpcodeMetadata opcode_table[256];
+extern const OpcodeMetadata opcode_table[256];
 
 // ============================================================================
 // Move instructions - instructions_mov.h
@@ -453,6 +453,42 @@ extern ExecuteStatus ExecuteGroup4Instruction(const InstructionContext* ctx);
 // Group 5 instruction handler.
 extern ExecuteStatus ExecuteGroup5Instruction(const InstructionContext* ctx);
 
+// ============================================================================
+// Specialized ALU and MOV instructions - instructions_specialized.c
+// ============================================================================
+
+// Declare the specialized handlers of an instruction for one width.
+#define YAX86_DECLARE_SPECIALIZED_HANDLERS(name, width)                    \
+  extern ExecuteStatus Execute##name##RegisterToRegister##width(           \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToMemory##width(             \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToRegisterReversed##width(   \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##MemoryToRegister##width(             \
+      const InstructionContext* ctx);
+
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Word)
+
+#undef YAX86_DECLARE_SPECIALIZED_HANDLERS
+
 #endif  // YAX86_IMPLEMENTATION
 
 #endif  // YAX86_CPU_INSTRUCTIONS_H
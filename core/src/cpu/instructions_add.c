@@ -1,6 +1,7 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -13,34 +14,26 @@
 // Other than common flags, the INC instruction sets the following flags:
 // - Overflow Flag (OF) - Set when result has wrong sign
 // - Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterInc(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  // Overflow Flag (OF) Set when result has wrong sign (both operands have same
-  // sign but result has different sign)
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool op2_sign = (op2 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  CPUSetFlag(ctx->cpu, kOF, (op1_sign == op2_sign) && (result_sign != op1_sign));
-
-  // Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
-  CPUSetFlag(
-      ctx->cpu, kAF, ((op1 & 0xF) + (op2 & 0xF) + (did_carry ? 1 : 0)) > 0xF);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsInc, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Set CPU flags after an ADD or ADC instruction.
 // Other than the flags set by the INC instruction, the ADD instruction sets the
 // following flags:
 // - Carry Flag (CF) - Set when result overflows the maximum width
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterAdd(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetFlagsAfterInc(ctx, op1, op2, result, did_carry);
-  // Carry Flag (CF)
-  CPUSetFlag(ctx->cpu, kCF, result > kMaxValue[ctx->metadata->width]);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsAdd, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Common signature of SetFlagsAfterAdd and SetFlagsAfterInc.
@@ -1,6 +1,7 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -9,13 +10,13 @@
 // Boolean AND, OR and XOR instructions
 // ============================================================================
 
+// Set CPU flags after a boolean instruction. Other than common flags, the
+// Carry Flag (CF) and Overflow Flag (OF) are cleared. The flags are evaluated
+// lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterBooleanInstruction(
     const InstructionContext* ctx, uint32_t result) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-  // Carry Flag (CF) should be cleared
-  CPUSetFlag(ctx->cpu, kCF, false);
-  // Overflow Flag (OF) should be cleared
-  CPUSetFlag(ctx->cpu, kOF, false);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsBoolean, ctx->metadata->width, 0, 0, result, false);
 }
 
 // Common logic for AND instructions.
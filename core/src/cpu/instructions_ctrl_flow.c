@@ -1,6 +1,7 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -50,7 +51,7 @@ ExecuteShortOrNearJump(const InstructionContext* ctx) {
 YAX86_PRIVATE ExecuteStatus ExecuteFarJump(
     const InstructionContext* ctx, const OperandValue* segment,
     const OperandValue* offset) {
-  ctx->cpu->registers[kCS] = FromOperandValue(segment);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(segment));
   ctx->cpu->registers[kIP] = FromOperandValue(offset);
   return kExecuteSuccess;
 }
@@ -97,7 +98,7 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteUnsignedConditionalJump(const InstructionContext* ctx) {
   uint16_t flag_mask = kUnsignedConditionalJumpFlagBitmasks
       [(ctx->instruction->opcode - 0x70) / 2];
-  bool flag_value = (ctx->cpu->flags & flag_mask) != 0;
+  bool flag_value = GetFlagsInMask(ctx->cpu, flag_mask) != 0;
   // Even opcode => jump if the flag is set
   // Odd opcode => jump if the flag is not set
   bool success_value = ((ctx->instruction->opcode & 0x1) == 0);
@@ -210,7 +211,7 @@ static ExecuteStatus ExecuteFarReturnCommon(
   OperandValue new_ip = Pop(ctx->cpu);
   OperandValue new_cs = Pop(ctx->cpu);
   ctx->cpu->registers[kIP] = FromOperandValue(&new_ip);
-  ctx->cpu->registers[kCS] = FromOperandValue(&new_cs);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(&new_cs));
   ctx->cpu->registers[kSP] += arg_size;
   return kExecuteSuccess;
 }
@@ -236,9 +237,9 @@ YAX86_PRIVATE ExecuteStatus ExecuteReturnFromInterrupt(CPUState* cpu) {
   OperandValue ip_value = Pop(cpu);
   cpu->registers[kIP] = FromOperandValue(&ip_value);
   OperandValue cs_value = Pop(cpu);
-  cpu->registers[kCS] = FromOperandValue(&cs_value);
+  CPUSetSegmentRegister(cpu, kCS, FromOperandValue(&cs_value));
   OperandValue flags_value = Pop(cpu);
-  cpu->flags = FromOperandValue(&flags_value);
+  CPUSetFlags(cpu, FromOperandValue(&flags_value));
   return kExecuteSuccess;
 }
 
@@ -1,6 +1,7 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -13,6 +14,7 @@ YAX86_PRIVATE void SetCommonFlagsAfterInstruction(
     const InstructionContext* ctx, uint32_t result) {
   Width width = ctx->metadata->width;
   result &= kMaxValue[width];
+  DiscardLazyFlags(ctx->cpu, kZF | kSF | kPF);
   // Zero flag (ZF)
   CPUSetFlag(ctx->cpu, kZF, result == 0);
   // Sign flag (SF)
@@ -17,8 +17,11 @@ static OperandValue ReadByteFromPort(CPUState* cpu, uint16_t port) {
 
 // Read a word from an I/O port as a uint16_t.
 static OperandValue ReadWordFromPort(CPUState* cpu, uint16_t port) {
+  if (cpu->config->read_port_word) {
+    return WordValue(cpu->config->read_port_word(cpu, port));
+  }
   uint8_t low = ReadByteFromPort(cpu, port).value.byte_value;
-  uint8_t high = ReadByteFromPort(cpu, port).value.byte_value;
+  uint8_t high = ReadByteFromPort(cpu, port + 1).value.byte_value;
   return WordValue((high << 8) | low);
 }
 
@@ -28,8 +31,19 @@ static OperandValue (*const kReadFromPortFns[])(CPUState*, uint16_t) = {
     ReadWordFromPort,  // kWord
 };
 
+// Count reads from I/O ports that are not known to be stable, so that loops
+// polling them are not fast-forwarded.
+static void CountPortRead(CPUState* cpu, uint16_t port, Width width) {
+  bool (*is_port_stable)(CPUState*, uint16_t) = cpu->config->is_port_stable;
+  if (!is_port_stable || !is_port_stable(cpu, port) ||
+      (width == kWord && !is_port_stable(cpu, port + 1))) {
+    ++cpu->num_unstable_port_reads;
+  }
+}
+
 // Common logic for IN instructions.
 static ExecuteStatus ExecuteIn(const InstructionContext* ctx, uint16_t port) {
+  CountPortRead(ctx->cpu, port, ctx->metadata->width);
   OperandValue value = kReadFromPortFns[ctx->metadata->width](ctx->cpu, port);
   Operand dest = ReadRegisterOperandForRegisterIndex(ctx, kAX);
   WriteOperand(ctx, &dest, FromOperandValue(&value));
@@ -60,8 +74,12 @@ static void WriteByteToPort(CPUState* cpu, uint16_t port, OperandValue value) {
 // Write a word to an I/O port.
 static void WriteWordToPort(CPUState* cpu, uint16_t port, OperandValue value) {
   uint32_t raw_value = FromOperandValue(&value);
+  if (cpu->config->write_port_word) {
+    cpu->config->write_port_word(cpu, port, raw_value);
+    return;
+  }
   WriteByteToPort(cpu, port, ByteValue(raw_value & 0xFF));
-  WriteByteToPort(cpu, port, ByteValue((raw_value >> 8) & 0xFF));
+  WriteByteToPort(cpu, port + 1, ByteValue((raw_value >> 8) & 0xFF));
 }
 
 // Table of functions to write to an I/O port, indexed by data width.
@@ -13,10 +13,10 @@
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadEffectiveAddress(const InstructionContext* ctx) {
   Operand dest = ReadRegisterOperand(ctx);
+  // The result is the offset within the segment, without the segment base.
   MemoryAddress memory_address =
       GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
-  uint32_t raw_address = ToRawAddress(ctx->cpu, &memory_address);
-  WriteOperandAddress(ctx, &dest.address, raw_address);
+  WriteOperandAddress(ctx, &dest.address, memory_address.offset);
   return kExecuteSuccess;
 }
 
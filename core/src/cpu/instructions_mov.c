@@ -157,12 +157,15 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteTranslateByte(const InstructionContext* ctx) {
   // Read the AL register
   Operand al = ReadRegisterOperandForRegisterIndex(ctx, kAX);
+  // The table is in DS unless overridden by a segment override prefix, which
+  // the decoder resolves.
   OperandAddress src_address = {
       .type = kOperandAddressTypeMemory,
       .value =
           {.memory_address =
                {
-                   .segment_register_index = kDS,
+                   .segment_register_index =
+                       (RegisterIndex)ctx->instruction->segment_register_index,
                    .offset =
                        (uint16_t)(ctx->cpu->registers[kBX] + FromOperand(&al)),
                }},
@@ -0,0 +1,213 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "instructions.h"
+#include "lazy_flags.h"
+#include "operands.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Specialized ALU and MOV instructions
+// ============================================================================
+
+// The generic handlers for "op r/m, reg" and "op reg, r/m" instructions pass
+// operands around as OperandValue, and read and write them through function
+// pointer tables indexed by width and addressing mode. The handlers below
+// implement the same instructions for a fixed width and addressing mode, and
+// are selected through OpcodeMetadata.specialized_handlers.
+
+// Read a byte register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterByte(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return reg_or_rm < 4 ? cpu->registers[reg_or_rm] & 0xFF
+                       : cpu->registers[reg_or_rm - 4] >> 8;
+}
+
+// Read a word register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterWord(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return cpu->registers[reg_or_rm];
+}
+
+// Write a byte register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterByte(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  if (reg_or_rm < 4) {
+    cpu->registers[reg_or_rm] =
+        (cpu->registers[reg_or_rm] & 0xFF00) | (value & 0xFF);
+  } else {
+    cpu->registers[reg_or_rm - 4] =
+        (cpu->registers[reg_or_rm - 4] & 0x00FF) | ((value & 0xFF) << 8);
+  }
+}
+
+// Write a word register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterWord(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  cpu->registers[reg_or_rm] = value & 0xFFFF;
+}
+
+// Compute the linear address of an instruction's memory operand.
+static inline uint32_t GetMemoryOperandRawAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
+  return ToRawAddress(ctx->cpu, &address);
+}
+
+// ADD: returns op1 + op2 and sets flags.
+static inline uint32_t ComputeAdd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 + op2;
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, false);
+  return result;
+}
+
+// ADC: returns op1 + op2 + CF and sets flags.
+static inline uint32_t ComputeAddWithCarry(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool carry = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 + op2 + (carry ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, carry);
+  return result;
+}
+
+// SUB and CMP: returns op1 - op2 and sets flags.
+static inline uint32_t ComputeSub(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 - op2;
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, false);
+  return result;
+}
+
+// SBB: returns op1 - op2 - CF and sets flags.
+static inline uint32_t ComputeSubWithBorrow(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool borrow = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 - op2 - (borrow ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, borrow);
+  return result;
+}
+
+// AND: returns op1 & op2 and sets flags.
+static inline uint32_t ComputeBooleanAnd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 & op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// OR: returns op1 | op2 and sets flags.
+static inline uint32_t ComputeBooleanOr(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 | op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// XOR: returns op1 ^ op2 and sets flags.
+static inline uint32_t ComputeBooleanXor(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 ^ op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// MOV: returns op2.
+static inline uint32_t ComputeMove(
+    YAX86_UNUSED CPUState* cpu, YAX86_UNUSED Width width,
+    YAX86_UNUSED uint32_t op1, uint32_t op2) {
+  return op2;
+}
+
+// Define the 4 specialized handlers of an instruction for one width:
+//   - Execute<name>RegisterToRegister<width>: op r/m, reg with mod == 3
+//   - Execute<name>RegisterToMemory<width>: op r/m, reg with mod != 3
+//   - Execute<name>RegisterToRegisterReversed<width>: op reg, r/m with mod == 3
+//   - Execute<name>MemoryToRegister<width>: op reg, r/m with mod != 3
+// compute is one of the Compute* functions above. The destination is only
+// read if reads_dest is true, and only written if writes_dest is true.
+#define YAX86_SPECIALIZED_HANDLERS(                                          \
+    name, width, compute, reads_dest, writes_dest)                           \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToRegister##width(      \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.rm;                        \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToMemory##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint32_t dest = GetMemoryOperandRawAddress(ctx);                   \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRawMemory##width(cpu, dest) : 0,   \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRawMemory##width(cpu, dest, result);                              \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus                                                \
+      Execute##name##RegisterToRegisterReversed##width(                      \
+          const InstructionContext* ctx) {                                   \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.rm));              \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##MemoryToRegister##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    const uint32_t src =                                                     \
+        ReadRawMemory##width(cpu, GetMemoryOperandRawAddress(ctx));          \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        src);                                                                \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }
+
+// ADD r/m, reg and ADD reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Add, Byte, ComputeAdd, true, true)
+YAX86_SPECIALIZED_HANDLERS(Add, Word, ComputeAdd, true, true)
+// OR r/m, reg and OR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Byte, ComputeBooleanOr, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Word, ComputeBooleanOr, true, true)
+// ADC r/m, reg and ADC reg, r/m
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Byte, ComputeAddWithCarry, true, true)
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Word, ComputeAddWithCarry, true, true)
+// SBB r/m, reg and SBB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Byte, ComputeSubWithBorrow, true, true)
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Word, ComputeSubWithBorrow, true, true)
+// AND r/m, reg and AND reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Byte, ComputeBooleanAnd, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Word, ComputeBooleanAnd, true, true)
+// SUB r/m, reg and SUB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Sub, Byte, ComputeSub, true, true)
+YAX86_SPECIALIZED_HANDLERS(Sub, Word, ComputeSub, true, true)
+// XOR r/m, reg and XOR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Byte, ComputeBooleanXor, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Word, ComputeBooleanXor, true, true)
+// CMP r/m, reg and CMP reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Cmp, Byte, ComputeSub, true, false)
+YAX86_SPECIALIZED_HANDLERS(Cmp, Word, ComputeSub, true, false)
+// MOV r/m, reg and MOV reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Move, Byte, ComputeMove, false, true)
+YAX86_SPECIALIZED_HANDLERS(Move, Word, ComputeMove, false, true)
+
+#undef YAX86_SPECIALIZED_HANDLERS
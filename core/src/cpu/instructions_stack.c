@@ -55,14 +55,14 @@ ExecutePopSegmentRegister(const InstructionContext* ctx) {
 
 // PUSHF
 YAX86_PRIVATE ExecuteStatus ExecutePushFlags(const InstructionContext* ctx) {
-  Push(ctx->cpu, WordValue(ctx->cpu->flags));
+  Push(ctx->cpu, WordValue(CPUGetFlags(ctx->cpu)));
   return kExecuteSuccess;
 }
 
 // POPF
 YAX86_PRIVATE ExecuteStatus ExecutePopFlags(const InstructionContext* ctx) {
   OperandValue value = Pop(ctx->cpu);
-  ctx->cpu->flags = FromOperandValue(&value);
+  CPUSetFlags(ctx->cpu, FromOperandValue(&value));
   return kExecuteSuccess;
 }
 
@@ -98,7 +98,8 @@ static const OperandAddress* GetAHRegisterAddress(void) {
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadAHFromFlags(const InstructionContext* ctx) {
   WriteRegisterOperandByte(
-      ctx->cpu, GetAHRegisterAddress(), ByteValue(ctx->cpu->flags & 0x00FF));
+      ctx->cpu, GetAHRegisterAddress(),
+      ByteValue(CPUGetFlags(ctx->cpu) & 0x00FF));
   return kExecuteSuccess;
 }
 
@@ -108,6 +109,7 @@ ExecuteStoreAHToFlags(const InstructionContext* ctx) {
   OperandValue value =
       ReadRegisterOperandByte(ctx->cpu, GetAHRegisterAddress());
   // Clear the lower byte of flags and set it to the value in AH
-  ctx->cpu->flags = (ctx->cpu->flags & 0xFF00) | value.value.byte_value;
+  CPUSetFlags(
+      ctx->cpu, (CPUGetFlags(ctx->cpu) & 0xFF00) | value.value.byte_value);
   return kExecuteSuccess;
 }
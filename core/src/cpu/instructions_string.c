@@ -25,21 +25,34 @@ static uint8_t GetRepetitionPrefix(const InstructionContext* ctx) {
   return prefix;
 }
 
+// Get the source memory address for string instructions. Typically DS:SI but
+// can be overridden by a segment override prefix, which the decoder resolves.
+static MemoryAddress GetStringSourceAddress(const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)ctx->instruction->segment_register_index,
+      .offset = ctx->cpu->registers[kSI],
+  };
+  return address;
+}
+
+// Get the destination memory address for string instructions. Always ES:DI.
+static MemoryAddress GetStringDestinationAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index = kES,
+      .offset = ctx->cpu->registers[kDI],
+  };
+  return address;
+}
+
 // Get the source operand for string instructions. Typically DS:SI but can be
 // overridden by a segment override prefix.
 static Operand GetStringSourceOperand(const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kDS,
-                      .offset = ctx->cpu->registers[kSI],
-                  },
-          },
+      .value = {.memory_address = GetStringSourceAddress(ctx)},
   };
-  ApplySegmentOverride(ctx->instruction, &address.value.memory_address);
   Operand operand = {
       .address = address,
       .value = ReadOperandValue(ctx, &address),
@@ -52,14 +65,7 @@ static OperandAddress GetStringDestinationOperandAddress(
     const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kES,
-                      .offset = ctx->cpu->registers[kDI],
-                  },
-          },
+      .value = {.memory_address = GetStringDestinationAddress(ctx)},
   };
   return address;
 }
@@ -92,21 +98,304 @@ static void UpdateStringDestinationAddress(const InstructionContext* ctx) {
   }
 }
 
-// Execute a string instruction with optional REP prefix.
+// ============================================================================
+// Bulk string operations
+// ============================================================================
+
+// When the memory operands of a repeated string instruction are directly
+// accessible host memory, the iterations can be run in bulk without going
+// through the operand helpers. Each bulk function below runs up to count
+// iterations, where count is at most CX, updates SI, DI and CX accordingly,
+// and returns the number of iterations run. The remaining iterations, if any,
+// are run one at a time.
+
+// Get the linear address of count elements of a string operand starting at
+// offset and proceeding in the direction given by DF, i.e. the lowest linear
+// address touched. Returns false if the elements wrap around the end of the
+// segment.
+static bool GetStringOperandRange(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count, uint32_t* linear_address) {
+  uint32_t element_size = kNumBytes[ctx->metadata->width];
+  uint32_t size = count * element_size;
+  uint32_t low_offset = address->offset;
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    if (low_offset + element_size < size) {
+      return false;
+    }
+    low_offset = low_offset + element_size - size;
+  }
+  if (low_offset + size > 0x10000) {
+    return false;
+  }
+  MemoryAddress low_address = {
+      .segment_register_index = address->segment_register_index,
+      .offset = (uint16_t)low_offset,
+  };
+  *linear_address = ToRawAddress(ctx->cpu, &low_address);
+  return true;
+}
+
+// Get a host pointer to count elements of a string operand for reading, or
+// NULL if they are not all directly accessible.
+static const uint8_t* GetDirectStringOperandForReading(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  return GetDirectReadMemory(
+      ctx->cpu, linear_address, count * kNumBytes[ctx->metadata->width]);
+}
+
+// Get a host pointer to count elements of a string operand for writing, or
+// NULL if they are not all directly accessible. Invalidates cached code in the
+// range.
+static uint8_t* GetDirectStringOperandForWriting(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  uint8_t* memory = GetDirectWriteMemory(ctx->cpu, linear_address, size);
+  if (memory) {
+    InvalidateCachesOnWrite(ctx->cpu, linear_address, size);
+  }
+  return memory;
+}
+
+// Advance an address register (SI or DI) by count elements in the direction
+// given by DF.
+static void AdvanceStringAddress(
+    const InstructionContext* ctx, RegisterIndex register_index,
+    uint16_t count) {
+  uint16_t delta = (uint16_t)(count * kNumBytes[ctx->metadata->width]);
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    ctx->cpu->registers[register_index] -= delta;
+  } else {
+    ctx->cpu->registers[register_index] += delta;
+  }
+}
+
+// Read the element at an index from a host pointer to a string operand, where
+// the pointer points to the lowest addressed element.
+static inline uint16_t ReadStringElement(
+    const InstructionContext* ctx, const uint8_t* memory, uint32_t index) {
+  if (ctx->metadata->width == kByte) {
+    return memory[index];
+  }
+  return (uint16_t)(memory[index * 2] | (memory[index * 2 + 1] << 8));
+}
+
+// Returns the index of the iteration in host memory order, where the pointers
+// to string operands point to the lowest addressed element.
+static inline uint32_t GetStringElementIndex(
+    const InstructionContext* ctx, uint16_t count, uint32_t iteration) {
+  return CPUGetFlag(ctx->cpu, kDF) ? count - 1 - iteration : iteration;
+}
+
+// Bulk MOVS, running all iterations.
+static uint16_t ExecuteMovsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint32_t src_linear_address, dest_linear_address;
+  if (!GetStringOperandRange(ctx, &src_address, count, &src_linear_address) ||
+      !GetStringOperandRange(
+          ctx, &dest_address, count, &dest_linear_address)) {
+    return 0;
+  }
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  if (!src) {
+    return 0;
+  }
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  bool backward = CPUGetFlag(ctx->cpu, kDF);
+  // If the destination overlaps the part of the source that is yet to be read,
+  // e.g. MOVSB forward with DI = SI + 1, each iteration reads what an earlier
+  // iteration wrote. Copy element by element to replicate that.
+  bool overlaps =
+      backward ? (dest_linear_address < src_linear_address &&
+                  dest_linear_address + size > src_linear_address)
+               : (dest_linear_address > src_linear_address &&
+                  dest_linear_address < src_linear_address + size);
+  if (overlaps) {
+    uint8_t element_size = kNumBytes[ctx->metadata->width];
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t offset = GetStringElementIndex(ctx, count, i) * element_size;
+      uint8_t element[2];
+      for (uint8_t j = 0; j < element_size; ++j) {
+        element[j] = src[offset + j];
+      }
+      for (uint8_t j = 0; j < element_size; ++j) {
+        dest[offset + j] = element[j];
+      }
+    }
+  } else if (dest_linear_address <= src_linear_address) {
+    // Otherwise, every iteration reads the original source, so copy with
+    // memmove semantics.
+    for (uint32_t i = 0; i < size; ++i) {
+      dest[i] = src[i];
+    }
+  } else {
+    for (uint32_t i = size; i > 0; --i) {
+      dest[i - 1] = src[i - 1];
+    }
+  }
+
+  AdvanceStringAddress(ctx, kSI, count);
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk STOS, running all iterations.
+static uint16_t ExecuteStosBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX];
+  if (ctx->metadata->width == kByte) {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i] = value & 0xFF;
+    }
+  } else {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i * 2] = value & 0xFF;
+      dest[i * 2 + 1] = (value >> 8) & 0xFF;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk LODS, skipping all but the last iteration as only the last value loaded
+// is observable.
+static uint16_t ExecuteLodsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  // Only skip reads from plain memory, which have no side effects.
+  if (count < 2 ||
+      !GetDirectStringOperandForReading(ctx, &src_address, count)) {
+    return 0;
+  }
+  AdvanceStringAddress(ctx, kSI, count - 1);
+  ctx->cpu->registers[kCX] -= count - 1;
+  return count - 1;
+}
+
+// Bulk SCAS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteScasBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* dest =
+      count < 2 ? NULL
+                : GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX] & kMaxValue[ctx->metadata->width];
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint16_t element = ReadStringElement(
+        ctx, dest, GetStringElementIndex(ctx, count, num_skipped));
+    if ((element == value) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// Bulk CMPS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteCmpsBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  if (count < 2) {
+    return 0;
+  }
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  const uint8_t* dest =
+      GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!src || !dest) {
+    return 0;
+  }
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint32_t index = GetStringElementIndex(ctx, count, num_skipped);
+    if ((ReadStringElement(ctx, src, index) ==
+         ReadStringElement(ctx, dest, index)) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kSI, num_skipped);
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// ============================================================================
+// Repetition prefixes
+// ============================================================================
+
+// Returns the number of iterations of a repeated string instruction to run in
+// this instruction cycle, which is CX limited by max_string_iterations.
+static uint16_t GetStringIterationCount(const InstructionContext* ctx) {
+  uint16_t count = ctx->cpu->registers[kCX];
+  uint16_t max_count = ctx->cpu->config->max_string_iterations;
+  return max_count && count > max_count ? max_count : count;
+}
+
+// Arrange for a repeated string instruction that has iterations left to be
+// executed again in the next instruction cycle, by rewinding IP to the start
+// of the instruction including its prefixes. As on the 8088, interrupts can be
+// serviced in between, and return to the instruction to resume it.
+static void RepeatStringInstruction(const InstructionContext* ctx) {
+  ctx->cpu->registers[kIP] -= ctx->instruction->size;
+}
+
+// Execute a string instruction with optional REP prefix. If bulk_fn is set,
+// it is given the chance to run the iterations in bulk first.
 static ExecuteStatus ExecuteStringInstructionWithREPPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP) {
     return fn(ctx);
   }
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -122,7 +411,8 @@ static ExecuteStatus ExecuteMovsIteration(const InstructionContext* ctx) {
 
 // MOVS
 YAX86_PRIVATE ExecuteStatus ExecuteMovs(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteMovsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteMovsIteration, ExecuteMovsBulk);
 }
 
 // Single STOS iteration.
@@ -136,7 +426,8 @@ static ExecuteStatus ExecuteStosIteration(const InstructionContext* ctx) {
 
 // STOS
 YAX86_PRIVATE ExecuteStatus ExecuteStos(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteStosIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteStosIteration, ExecuteStosBulk);
 }
 
 // Single LODS iteration.
@@ -150,28 +441,38 @@ static ExecuteStatus ExecuteLodsIteration(const InstructionContext* ctx) {
 
 // LODS
 YAX86_PRIVATE ExecuteStatus ExecuteLods(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteLodsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteLodsIteration, ExecuteLodsBulk);
 }
 
 // Execute a string instruction with optional REPZ/REPE or REPNZ/REPNE prefix.
 static ExecuteStatus ExecuteStringInstructionWithREPZOrRepNZPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t, bool)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP && prefix != kPrefixREPNZ) {
     return fn(ctx);
   }
   bool terminate_zf_value = prefix == kPrefixREPNZ;
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count, terminate_zf_value);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
     if (CPUGetFlag(ctx->cpu, kZF) == terminate_zf_value) {
-      break;
+      return kExecuteSuccess;
     }
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -187,7 +488,7 @@ static ExecuteStatus ExecuteScasIteration(const InstructionContext* ctx) {
 // SCAS
 YAX86_PRIVATE ExecuteStatus ExecuteScas(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteScasIteration);
+      ctx, ExecuteScasIteration, ExecuteScasBulk);
 }
 
 // Single CMPS iteration.
@@ -203,5 +504,5 @@ static ExecuteStatus ExecuteCmpsIteration(const InstructionContext* ctx) {
 // CMPS
 YAX86_PRIVATE ExecuteStatus ExecuteCmps(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteCmpsIteration);
+      ctx, ExecuteCmpsIteration, ExecuteCmpsBulk);
 }
@@ -1,6 +1,7 @@
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -9,50 +10,29 @@
 // SUB, SBB, and DEC instructions
 // ============================================================================
 
-// Set CPU flags after a DEC or SUB/SBB operation (base function).
-// This function sets ZF, SF, PF, OF, AF. It does NOT affect CF.
+// Set CPU flags after a DEC operation.
+// This sets ZF, SF, PF, OF, AF. It does NOT affect CF.
 // - OF is for the full operation op1 - (op2 + did_borrow).
 // - AF is for the full operation op1 - (op2 + did_borrow).
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterDec(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  uint32_t max_val = kMaxValue[ctx->metadata->width];
-
-  // Overflow Flag (OF)
-  // OF is set if op1_sign != val_being_subtracted_sign AND result_sign ==
-  // val_being_subtracted_sign where val_being_subtracted = (op2 + did_borrow)
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  uint32_t val_being_subtracted = (op2 & max_val) + (did_borrow ? 1 : 0);
-  // Mask val_being_subtracted to current width before checking its sign,
-  // in case (op2 & max_val) + 1 caused a temporary overflow beyond max_val if
-  // op2 was max_val.
-  bool val_being_subtracted_sign =
-      ((val_being_subtracted & max_val) & sign_bit) != 0;
-  CPUSetFlag(
-      ctx->cpu, kOF,
-      (op1_sign != val_being_subtracted_sign) &&
-          (result_sign == val_being_subtracted_sign));
-
-  // Auxiliary Carry Flag (AF) - borrow from bit 3 to bit 4
-  CPUSetFlag(ctx->cpu, kAF, (op1 & 0xF) < ((op2 & 0xF) + (did_borrow ? 1 : 0)));
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsDec, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Set CPU flags after a SUB, SBB, CMP or NEG instruction.
-// This calls SetFlagsAfterDec and then sets the Carry Flag (CF).
+// This sets the same flags as SetFlagsAfterDec, as well as the Carry Flag (CF),
+// which is set if op1 < (op2 + did_borrow) (unsigned comparison).
+// The flags are evaluated lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterSub(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetFlagsAfterDec(ctx, op1, op2, result, did_borrow);
-
-  // Carry Flag (CF) - Set when a borrow is generated
-  // CF is set if op1 < (op2 + did_borrow) (unsigned comparison)
-  uint32_t val_being_subtracted =
-      (op2 & kMaxValue[ctx->metadata->width]) + (did_borrow ? 1 : 0);
-  CPUSetFlag(ctx->cpu, kCF, op1 < val_being_subtracted);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsSub, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Common signature of SetFlagsAfterSub and SetFlagsAfterDec.
@@ -0,0 +1,747 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "jit.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size) {
+  jit->code = code;
+  jit->code_size = code_size;
+  jit->code_used = 0;
+  jit->epoch = 0;
+  jit->current_block = NULL;
+  jit->current_block_start_cycles = 0;
+  jit->current_block_max_cycles = 0;
+  jit->current_block_variable_clock_cycles = 0;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  jit->num_compiled_blocks = 0;
+  jit->num_flushes = 0;
+  jit->num_native_executions = 0;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Native code is generated for the System V AMD64 calling convention. A
+// compiled block is a function taking the CPUState pointer in RDI and
+// returning the number of instructions executed in EAX. The CPUState pointer
+// is kept in RBX throughout the block.
+
+// Writes native code to the JIT's code buffer.
+typedef struct JITEmitter {
+  // Start of the code being emitted.
+  uint8_t* start;
+  // Next byte to write.
+  uint8_t* next;
+} JITEmitter;
+
+static inline void EmitByte(JITEmitter* emitter, uint8_t value) {
+  *emitter->next = value;
+  ++emitter->next;
+}
+
+static inline void EmitWord(JITEmitter* emitter, uint16_t value) {
+  EmitByte(emitter, value & 0xFF);
+  EmitByte(emitter, (value >> 8) & 0xFF);
+}
+
+static inline void EmitDword(JITEmitter* emitter, uint32_t value) {
+  EmitWord(emitter, value & 0xFFFF);
+  EmitWord(emitter, (value >> 16) & 0xFFFF);
+}
+
+static inline void EmitQword(JITEmitter* emitter, uint64_t value) {
+  EmitDword(emitter, value & 0xFFFFFFFF);
+  EmitDword(emitter, (value >> 32) & 0xFFFFFFFF);
+}
+
+// Emit a sequence of bytes.
+static void EmitBytes(
+    JITEmitter* emitter, const uint8_t* bytes, uint8_t num_bytes) {
+  for (uint8_t i = 0; i < num_bytes; ++i) {
+    EmitByte(emitter, bytes[i]);
+  }
+}
+
+// Returns the offset of a register within CPUState, for use as a displacement
+// from RBX. byte_offset selects the high byte of the register if set.
+static inline uint32_t GetRegisterDisplacement(
+    RegisterIndex register_index, uint8_t byte_offset) {
+  return (uint32_t)(offsetof(CPUState, registers) +
+                    register_index * sizeof(uint16_t) + byte_offset);
+}
+
+// Returns the displacement of an 8-bit register encoded in a REG or R/M field.
+static inline uint32_t GetByteRegisterDisplacement(uint8_t reg_or_rm) {
+  // AL, CL, DL, BL are the low bytes and AH, CH, DH, BH the high bytes of AX,
+  // CX, DX and BX, which is at offset 1 on the little-endian host.
+  return GetRegisterDisplacement(
+      (RegisterIndex)(reg_or_rm & 0x3), reg_or_rm >> 2);
+}
+
+// push rbx
+// mov rbx, rdi
+static void EmitPrologue(JITEmitter* emitter) {
+  static const uint8_t kPrologue[] = {0x53, 0x48, 0x89, 0xFB};
+  EmitBytes(emitter, kPrologue, sizeof(kPrologue));
+}
+
+// mov eax, num_instructions
+// pop rbx
+// ret
+static void EmitReturn(JITEmitter* emitter, uint32_t num_instructions) {
+  EmitByte(emitter, 0xB8);
+  EmitDword(emitter, num_instructions);
+  EmitByte(emitter, 0x5B);
+  EmitByte(emitter, 0xC3);
+}
+
+// add word [rbx + IP], delta
+static void EmitAddIP(JITEmitter* emitter, uint16_t delta) {
+  static const uint8_t kAddWord[] = {0x66, 0x81, 0x83};
+  EmitBytes(emitter, kAddWord, sizeof(kAddWord));
+  EmitDword(emitter, GetRegisterDisplacement(kIP, 0));
+  EmitWord(emitter, delta);
+}
+
+// mov word [rbx + dest], value
+static void EmitMoveImmediateWord(
+    JITEmitter* emitter, uint32_t dest, uint16_t value) {
+  static const uint8_t kMoveWord[] = {0x66, 0xC7, 0x83};
+  EmitBytes(emitter, kMoveWord, sizeof(kMoveWord));
+  EmitDword(emitter, dest);
+  EmitWord(emitter, value);
+}
+
+// mov byte [rbx + dest], value
+static void EmitMoveImmediateByte(
+    JITEmitter* emitter, uint32_t dest, uint8_t value) {
+  static const uint8_t kMoveByte[] = {0xC6, 0x83};
+  EmitBytes(emitter, kMoveByte, sizeof(kMoveByte));
+  EmitDword(emitter, dest);
+  EmitByte(emitter, value);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+static void EmitMoveWord(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadWord[] = {0x0F, 0xB7, 0x83};
+  static const uint8_t kStoreWord[] = {0x66, 0x89, 0x83};
+  EmitBytes(emitter, kLoadWord, sizeof(kLoadWord));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreWord, sizeof(kStoreWord));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, byte [rbx + src]
+// mov byte [rbx + dest], al
+static void EmitMoveByte(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadByte[] = {0x0F, 0xB6, 0x83};
+  static const uint8_t kStoreByte[] = {0x88, 0x83};
+  EmitBytes(emitter, kLoadByte, sizeof(kLoadByte));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreByte, sizeof(kStoreByte));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+// shl eax, 4
+// mov dword [rbx + base], eax
+static void EmitMoveSegmentRegister(
+    JITEmitter* emitter, RegisterIndex dest, uint32_t src) {
+  static const uint8_t kShiftLeft4[] = {0xC1, 0xE0, 0x04};
+  static const uint8_t kStoreDword[] = {0x89, 0x83};
+  EmitMoveWord(emitter, GetRegisterDisplacement(dest, 0), src);
+  EmitBytes(emitter, kShiftLeft4, sizeof(kShiftLeft4));
+  EmitBytes(emitter, kStoreDword, sizeof(kStoreDword));
+  EmitDword(
+      emitter, (uint32_t)(offsetof(CPUState, segment_bases) +
+                          (dest - kES) * sizeof(uint32_t)));
+}
+
+// Emit a call to the interpreter for an instruction, returning from the block
+// with the number of instructions executed if the interpreter requests it.
+//
+// mov rdi, rbx
+// mov rsi, entry
+// mov rax, handler
+// call rax
+// test al, al
+// jz continue
+// <return num_instructions>
+// continue:
+static void EmitInterpreterCall(
+    JITEmitter* emitter, const CPUBlockInstruction* entry,
+    JITInstructionHandler handler, uint32_t num_instructions) {
+  static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+  static const uint8_t kCallRAXAndTest[] = {0xFF, 0xD0, 0x84, 0xC0};
+  enum {
+    // Size of the code emitted by EmitReturn.
+    kReturnSize = 7,
+  };
+  EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xBE);
+  EmitQword(emitter, (uint64_t)(uintptr_t)entry);
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(emitter, (uint64_t)(uintptr_t)handler);
+  EmitBytes(emitter, kCallRAXAndTest, sizeof(kCallRAXAndTest));
+  EmitByte(emitter, 0x74);
+  EmitByte(emitter, kReturnSize);
+  EmitReturn(emitter, num_instructions);
+}
+
+// Kind of an ALU instruction that can be compiled to native code. The first
+// 8 match the REG field of Group 1 instructions and bits 3-5 of the opcode of
+// the other forms of those instructions.
+typedef enum JITALUOp {
+  kJITALUAdd = 0,
+  kJITALUOr,
+  // ADC and SBB depend on CF, and are not compiled to native code.
+  kJITALUAddWithCarry,
+  kJITALUSubWithBorrow,
+  kJITALUAnd,
+  kJITALUSub,
+  kJITALUXor,
+  kJITALUCmp,
+  kJITALUTest,
+  kJITALUInc,
+  kJITALUDec,
+} JITALUOp;
+
+// An ALU instruction on registers, or on a register and an immediate, that can
+// be compiled to native code.
+typedef struct JITALUInstruction {
+  // Kind of the instruction.
+  JITALUOp op;
+  // Data width of the instruction.
+  Width width;
+  // Displacement of the destination register from RBX.
+  uint32_t dest;
+  // Whether the source is an immediate instead of a register.
+  bool has_immediate_src;
+  // Displacement of the source register from RBX, or the immediate value.
+  uint32_t src;
+} JITALUInstruction;
+
+// Returns the displacement of a register encoded in a REG or R/M field.
+static inline uint32_t GetRegisterOperandDisplacement(
+    Width width, uint8_t reg_or_rm) {
+  return width == kByte
+             ? GetByteRegisterDisplacement(reg_or_rm)
+             : GetRegisterDisplacement((RegisterIndex)reg_or_rm, 0);
+}
+
+// Returns the immediate value of an instruction as the interpreter passes it
+// to the ALU, which is zero-extended from the instruction's width.
+static inline uint32_t GetImmediateOperand(
+    const Instruction* instruction, Width width) {
+  return width == kByte ? instruction->immediate[0]
+                        : (uint32_t)(instruction->immediate[0] |
+                                     (instruction->immediate[1] << 8));
+}
+
+// Decode an ALU instruction that can be compiled to native code. Returns false
+// if the instruction is not supported.
+static bool DecodeALUInstruction(
+    const Instruction* instruction, JITALUInstruction* alu) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  const bool is_register_mod_rm =
+      instruction->has_mod_rm && mod_rm->mod == kModRMModRegister;
+  // INC AX/CX/DX/BX/SP/BP/SI/DI and DEC AX/CX/DX/BX/SP/BP/SI/DI
+  if (opcode >= 0x40 && opcode <= 0x4F) {
+    alu->op = opcode < 0x48 ? kJITALUInc : kJITALUDec;
+    alu->width = kWord;
+    alu->dest = GetRegisterDisplacement((RegisterIndex)(opcode & 0x07), 0);
+    alu->has_immediate_src = true;
+    alu->src = 1;
+    return true;
+  }
+  // ADD, OR, AND, SUB, XOR and CMP in the forms op r/m, reg; op reg, r/m; and
+  // op AL/AX, imm.
+  if (opcode < 0x40 && (opcode & 0x07) <= 5) {
+    alu->op = (JITALUOp)(opcode >> 3);
+    alu->width = (opcode & 0x01) ? kWord : kByte;
+    switch (opcode & 0x07) {
+      case 0:
+      case 1:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        break;
+      case 2:
+      case 3:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        break;
+      default:
+        alu->dest = GetRegisterDisplacement(kAX, 0);
+        alu->has_immediate_src = true;
+        alu->src = GetImmediateOperand(instruction, alu->width);
+        break;
+    }
+    return alu->op != kJITALUAddWithCarry && alu->op != kJITALUSubWithBorrow;
+  }
+  switch (opcode) {
+    // Group 1 r/m8, imm8; r/m16, imm16; and r/m16, sign-extended imm8
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = (JITALUOp)mod_rm->reg;
+      alu->width = opcode == 0x80 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = true;
+      alu->src = opcode == 0x83
+                     ? (uint16_t)(int16_t)(int8_t)instruction->immediate[0]
+                     : GetImmediateOperand(instruction, alu->width);
+      return alu->op != kJITALUAddWithCarry &&
+             alu->op != kJITALUSubWithBorrow;
+    // TEST r/m8, r8 and TEST r/m16, r16
+    case 0x84:
+    case 0x85:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0x84 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = false;
+      alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+      return true;
+    // TEST AL, imm8 and TEST AX, imm16
+    case 0xA8:
+    case 0xA9:
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0xA8 ? kByte : kWord;
+      alu->dest = GetRegisterDisplacement(kAX, 0);
+      alu->has_immediate_src = true;
+      alu->src = GetImmediateOperand(instruction, alu->width);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the offset of a field of CPUState.lazy_flags within CPUState.
+#define YAX86_LAZY_FLAGS_DISPLACEMENT(field) \
+  ((uint32_t)(offsetof(CPUState, lazy_flags) + offsetof(CPULazyFlags, field)))
+
+// Emit native code for an ALU instruction. The result is written to the
+// destination register, and the operation is recorded in CPUState.lazy_flags
+// exactly as the interpreter records it. If set_host_flags is true, the code
+// ends by setting the host's flags as the instruction sets the 8086's
+// CF, PF, ZF, SF and OF, for a conditional jump that follows. INC and DEC
+// leave the host's CF undefined.
+static void EmitALUInstruction(
+    JITEmitter* emitter, const JITALUInstruction* alu, bool set_host_flags) {
+  // Lazy flags operation and host instruction to compute the result in EDX
+  // from EAX and ECX, indexed by JITALUOp.
+  static const uint8_t kLazyFlagsOps[] = {
+      kLazyFlagsAdd,     kLazyFlagsBoolean, kLazyFlagsAdd,
+      kLazyFlagsSub,     kLazyFlagsBoolean, kLazyFlagsSub,
+      kLazyFlagsBoolean, kLazyFlagsSub,     kLazyFlagsBoolean,
+      kLazyFlagsInc,     kLazyFlagsDec,
+  };
+  static const uint8_t kComputeResult[][2] = {
+      {0x01, 0xCA},  // add edx, ecx
+      {0x09, 0xCA},  // or edx, ecx
+      {0x01, 0xCA},  // ADC (unused)
+      {0x29, 0xCA},  // SBB (unused)
+      {0x21, 0xCA},  // and edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x31, 0xCA},  // xor edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x21, 0xCA},  // and edx, ecx
+      {0x01, 0xCA},  // add edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+  };
+  const uint8_t lazy_flags_op = kLazyFlagsOps[alu->op];
+  const bool is_boolean = lazy_flags_op == kLazyFlagsBoolean;
+  const uint16_t produced = kLazyFlagsProduced[lazy_flags_op];
+
+  // Evaluate pending flags from the previous operation that this one does not
+  // produce, as SetLazyFlags() does.
+  //
+  // test word [rbx + pending], kArithmeticFlags & ~produced
+  // jz skip
+  // mov rdi, rbx
+  // mov esi, produced
+  // mov rax, DiscardLazyFlags
+  // call rax
+  // skip:
+  if (produced != kArithmeticFlags) {
+    static const uint8_t kTestPendingWord[] = {0x66, 0xF7, 0x83};
+    static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+    static const uint8_t kCallRAX[] = {0xFF, 0xD0};
+    enum {
+      // Size of the code skipped if no flags need to be evaluated.
+      kDiscardCallSize = 20,
+    };
+    EmitBytes(emitter, kTestPendingWord, sizeof(kTestPendingWord));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending));
+    EmitWord(emitter, kArithmeticFlags & ~produced);
+    EmitByte(emitter, 0x74);
+    EmitByte(emitter, kDiscardCallSize);
+    EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+    EmitByte(emitter, 0xBE);
+    EmitDword(emitter, produced);
+    EmitByte(emitter, 0x48);
+    EmitByte(emitter, 0xB8);
+    EmitQword(emitter, (uint64_t)(uintptr_t)DiscardLazyFlags);
+    EmitBytes(emitter, kCallRAX, sizeof(kCallRAX));
+  }
+
+  // movzx eax, byte/word [rbx + dest]
+  EmitByte(emitter, 0x0F);
+  EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+  EmitByte(emitter, 0x83);
+  EmitDword(emitter, alu->dest);
+  if (alu->has_immediate_src) {
+    // mov ecx, src
+    EmitByte(emitter, 0xB9);
+    EmitDword(emitter, alu->src);
+  } else {
+    // movzx ecx, byte/word [rbx + src]
+    EmitByte(emitter, 0x0F);
+    EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, alu->src);
+  }
+  // mov edx, eax
+  // <op> edx, ecx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0xC2);
+  EmitBytes(emitter, kComputeResult[alu->op], sizeof(kComputeResult[0]));
+
+  // Record the operation in CPUState.lazy_flags. Boolean operations record 0
+  // for both operands.
+  EmitMoveImmediateWord(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending), produced);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op), lazy_flags_op);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(width), (uint8_t)alu->width);
+  EmitMoveImmediateByte(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(did_carry), 0);
+  if (is_boolean) {
+    // mov dword [rbx + op1], 0
+    // mov dword [rbx + op2], 0
+    static const uint8_t kMoveImmediateDword[] = {0xC7, 0x83};
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitDword(emitter, 0);
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+    EmitDword(emitter, 0);
+  } else {
+    // mov [rbx + op1], eax
+    // mov [rbx + op2], ecx
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x83);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+  }
+  // mov [rbx + result], edx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0x93);
+  EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(result));
+
+  // mov [rbx + dest], dl/dx
+  if (alu->op != kJITALUCmp && alu->op != kJITALUTest) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    EmitByte(emitter, alu->width == kByte ? 0x88 : 0x89);
+    EmitByte(emitter, 0x93);
+    EmitDword(emitter, alu->dest);
+  }
+
+  // add al/ax, cl/cx for additions, cmp al/ax, cl/cx for subtractions, or
+  // test dl/dx, dl/dx for boolean operations.
+  if (set_host_flags) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    if (is_boolean) {
+      EmitByte(emitter, alu->width == kByte ? 0x84 : 0x85);
+      EmitByte(emitter, 0xD2);
+    } else if (
+        lazy_flags_op == kLazyFlagsAdd || lazy_flags_op == kLazyFlagsInc) {
+      EmitByte(emitter, alu->width == kByte ? 0x00 : 0x01);
+      EmitByte(emitter, 0xC8);
+    } else {
+      EmitByte(emitter, alu->width == kByte ? 0x38 : 0x39);
+      EmitByte(emitter, 0xC8);
+    }
+  }
+}
+
+#undef YAX86_LAZY_FLAGS_DISPLACEMENT
+
+// Returns whether a conditional jump can be compiled to native code when it
+// follows an ALU instruction compiled to native code, using the host's flags.
+static bool CanEmitConditionalJump(
+    const Instruction* instruction, const JITALUInstruction* alu) {
+  enum {
+    // Opcodes of conditional jumps. JO is the first and JG the last.
+    kOpcodeJO = 0x70,
+    kOpcodeJB = 0x72,
+    kOpcodeJAE = 0x73,
+    kOpcodeJBE = 0x76,
+    kOpcodeJA = 0x77,
+    kOpcodeJG = 0x7F,
+  };
+  const uint8_t opcode = instruction->opcode;
+  if (instruction->prefix_size > 0 || opcode < kOpcodeJO ||
+      opcode > kOpcodeJG) {
+    return false;
+  }
+  // INC and DEC do not produce CF, so JB, JAE, JBE and JA need the 8086's CF.
+  const bool reads_cf = opcode == kOpcodeJB || opcode == kOpcodeJAE ||
+                        opcode == kOpcodeJBE || opcode == kOpcodeJA;
+  return !reads_cf || (alu->op != kJITALUInc && alu->op != kJITALUDec);
+}
+
+// Emit native code for a conditional jump that ends a block, given the host's
+// flags set by EmitALUInstruction(). ip_delta is the distance from IP in
+// CPUState to the instruction after the jump. If the jump is taken, its extra
+// clock cycles are added to the JIT's current_block_variable_clock_cycles.
+//
+// j<cc> taken
+// add word [rbx + IP], ip_delta
+// jmp done
+// taken:
+// add word [rbx + IP], ip_delta + rel8
+// mov rax, &jit->current_block_variable_clock_cycles
+// add dword [rax], taken_clock_cycles
+// done:
+static void EmitConditionalJump(
+    JITEmitter* emitter, CPUJIT* jit, const Instruction* instruction,
+    uint16_t ip_delta) {
+  static const uint8_t kAddDwordToRAX[] = {0x81, 0x00};
+  enum {
+    // Size of the code emitted by EmitAddIP.
+    kAddIPSize = 9,
+    // Size of the jmp to done.
+    kJumpSize = 2,
+    // Size of the code that counts the taken jump's clock cycles.
+    kAddClockCyclesSize = 16,
+  };
+  // Conditional jumps on the host have the same condition codes as on the
+  // 8086.
+  EmitByte(emitter, instruction->opcode);
+  EmitByte(emitter, kAddIPSize + kJumpSize);
+  EmitAddIP(emitter, ip_delta);
+  EmitByte(emitter, 0xEB);
+  EmitByte(emitter, kAddIPSize + kAddClockCyclesSize);
+  EmitAddIP(emitter, (uint16_t)(ip_delta + (int8_t)instruction->immediate[0]));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(
+      emitter, (uint64_t)(uintptr_t)&jit->current_block_variable_clock_cycles);
+  EmitBytes(emitter, kAddDwordToRAX, sizeof(kAddDwordToRAX));
+  EmitDword(emitter, GetBranchTakenVariableClockCycles(instruction));
+}
+
+// Emit native code for an instruction that only moves data between registers
+// or from an immediate to a register. Such instructions cannot fault, touch
+// memory or affect flags. Returns false if the instruction is not supported.
+static bool EmitNativeInstruction(
+    JITEmitter* emitter, const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+    // Value of the ModR/M REG field for CS.
+    kModRMRegCS = kCS - kES,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  // NOP
+  if (opcode == 0x90) {
+    return true;
+  }
+  // MOV AL/CL/DL/BL/AH/CH/DH/BH, imm8
+  if (opcode >= 0xB0 && opcode <= 0xB7) {
+    EmitMoveImmediateByte(
+        emitter, GetByteRegisterDisplacement(opcode - 0xB0),
+        instruction->immediate[0]);
+    return true;
+  }
+  // MOV AX/CX/DX/BX/SP/BP/SI/DI, imm16
+  if (opcode >= 0xB8 && opcode <= 0xBF) {
+    EmitMoveImmediateWord(
+        emitter, GetRegisterDisplacement((RegisterIndex)(opcode - 0xB8), 0),
+        (uint16_t)(instruction->immediate[0] |
+                   (instruction->immediate[1] << 8)));
+    return true;
+  }
+  if (!instruction->has_mod_rm || mod_rm->mod != kModRMModRegister) {
+    return false;
+  }
+  switch (opcode) {
+    // MOV r/m8, r8
+    case 0x88:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->rm),
+          GetByteRegisterDisplacement(mod_rm->reg));
+      return true;
+    // MOV r8, r/m8
+    case 0x8A:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->reg),
+          GetByteRegisterDisplacement(mod_rm->rm));
+      return true;
+    // MOV r/m16, r16
+    case 0x89:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0));
+      return true;
+    // MOV r16, r/m16
+    case 0x8B:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    // MOV r/m16, sreg
+    case 0x8C:
+      if (mod_rm->reg >= kNumSegmentRegisters) {
+        return false;
+      }
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)(kES + mod_rm->reg), 0));
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      if (mod_rm->reg >= kNumSegmentRegisters || mod_rm->reg == kModRMRegCS) {
+        return false;
+      }
+      EmitMoveSegmentRegister(
+          emitter, (RegisterIndex)(kES + mod_rm->reg),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    default:
+      return false;
+  }
+}
+
+YAX86_PRIVATE bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block) {
+  return block->native_code && block->jit_epoch == jit->epoch;
+}
+
+YAX86_PRIVATE bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler) {
+  if (jit->code_size < kCPUJITMaxBlockCodeSize) {
+    return false;
+  }
+  // Flush the code buffer if it is full. This invalidates the native code of
+  // all blocks compiled so far.
+  if (jit->code_size - jit->code_used < kCPUJITMaxBlockCodeSize) {
+    jit->code_used = 0;
+    ++jit->epoch;
+    ++jit->num_flushes;
+  }
+
+  JITEmitter emitter = {
+      .start = jit->code + jit->code_used,
+      .next = jit->code + jit->code_used,
+  };
+  EmitPrologue(&emitter);
+  // IP is only updated in CPUState before calling into the interpreter and at
+  // the end of the block.
+  uint16_t pending_ip_delta = 0;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const CPUBlockInstruction* entry = &block->instructions[i];
+    JITALUInstruction alu;
+    if (DecodeALUInstruction(&entry->instruction, &alu)) {
+      // A conditional jump that ends the block right after the ALU
+      // instruction is compiled together with it, using the host's flags.
+      const CPUBlockInstruction* jump =
+          i + 2 == block->num_instructions ? entry + 1 : NULL;
+      if (jump && !CanEmitConditionalJump(&jump->instruction, &alu)) {
+        jump = NULL;
+      }
+      EmitALUInstruction(&emitter, &alu, jump != NULL);
+      pending_ip_delta += entry->instruction.size;
+      if (jump) {
+        EmitConditionalJump(
+            &emitter, jit, &jump->instruction,
+            pending_ip_delta + jump->instruction.size);
+        pending_ip_delta = 0;
+        break;
+      }
+      continue;
+    }
+    if (EmitNativeInstruction(&emitter, &entry->instruction)) {
+      pending_ip_delta += entry->instruction.size;
+      continue;
+    }
+    if (pending_ip_delta) {
+      EmitAddIP(&emitter, pending_ip_delta);
+      pending_ip_delta = 0;
+    }
+    EmitInterpreterCall(&emitter, entry, handler, i + 1);
+  }
+  if (pending_ip_delta) {
+    EmitAddIP(&emitter, pending_ip_delta);
+  }
+  EmitReturn(&emitter, block->num_instructions);
+
+  block->native_code = emitter.start;
+  block->jit_epoch = jit->epoch;
+  jit->code_used += (uint32_t)(emitter.next - emitter.start);
+  ++jit->num_compiled_blocks;
+  return true;
+}
+
+// Signature of a compiled block.
+typedef uint32_t (*JITCompiledBlockFn)(CPUState* cpu);
+
+YAX86_PRIVATE uint32_t
+RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block) {
+  // ISO C does not allow casting a data pointer to a function pointer, so
+  // convert through a union instead.
+  union {
+    uint8_t* code;
+    JITCompiledBlockFn fn;
+  } native_code = {.code = block->native_code};
+  jit->current_block = block;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  ++jit->num_native_executions;
+  return native_code.fn(cpu);
+}
+
+#endif  // YAX86_CPU_HAS_JIT
@@ -0,0 +1,26 @@
+#ifndef YAX86_CPU_JIT_H
+#define YAX86_CPU_JIT_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Returns whether a block has native code that is still valid.
+extern bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block);
+
+// Compile a block to native code, flushing the code buffer if it is full.
+// Returns false if the block could not be compiled.
+extern bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler);
+
+// Run a compiled block. Returns the number of instructions executed. Execution
+// stops early if the handler requests it, in which case jit->stopped is set.
+extern uint32_t RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block);
+
+#endif  // YAX86_CPU_HAS_JIT
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_JIT_H
@@ -0,0 +1,171 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Lazy flags
+// ============================================================================
+
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+YAX86_PRIVATE const uint16_t kLazyFlagsProduced[] = {
+    // kLazyFlagsAdd
+    kArithmeticFlags,
+    // kLazyFlagsInc
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsSub
+    kArithmeticFlags,
+    // kLazyFlagsDec
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsBoolean
+    kArithmeticFlags & ~kAF,
+};
+
+// Returns whether the number of set bits in the least significant byte of a
+// value is even.
+static inline bool IsParityEven(uint32_t value) {
+  uint8_t parity = value & 0xFF;
+  parity ^= parity >> 4;
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  return (parity & 1) == 0;
+}
+
+// Returns whether an operation is an addition, as opposed to a subtraction.
+static inline bool IsLazyFlagsOpAdd(uint8_t op) {
+  return op == kLazyFlagsAdd || op == kLazyFlagsInc;
+}
+
+// Carry Flag (CF) - Set when an addition overflows the maximum width, or a
+// subtraction generates a borrow.
+static bool EvaluateCarryFlag(const CPULazyFlags* lazy_flags) {
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  switch (lazy_flags->op) {
+    case kLazyFlagsAdd:
+      return lazy_flags->result > max_value;
+    case kLazyFlagsSub:
+      return lazy_flags->op1 < (lazy_flags->op2 & max_value) +
+                                   (lazy_flags->did_carry ? 1 : 0);
+    default:
+      return false;
+  }
+}
+
+// Overflow Flag (OF) - Set when the result has the wrong sign.
+static bool EvaluateOverflowFlag(const CPULazyFlags* lazy_flags) {
+  if (lazy_flags->op == kLazyFlagsBoolean) {
+    return false;
+  }
+  const uint32_t sign_bit = kSignBit[lazy_flags->width];
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  bool op1_sign = (lazy_flags->op1 & sign_bit) != 0;
+  bool result_sign = (lazy_flags->result & sign_bit) != 0;
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    // Both operands have the same sign but the result has a different sign.
+    bool op2_sign = (lazy_flags->op2 & sign_bit) != 0;
+    return (op1_sign == op2_sign) && (result_sign != op1_sign);
+  }
+  // The operands have different signs and the result has the sign of the
+  // value being subtracted, which is op2 + did_carry truncated to the width.
+  uint32_t val_being_subtracted =
+      (lazy_flags->op2 & max_value) + (lazy_flags->did_carry ? 1 : 0);
+  bool val_being_subtracted_sign =
+      ((val_being_subtracted & max_value) & sign_bit) != 0;
+  return (op1_sign != val_being_subtracted_sign) &&
+         (result_sign == val_being_subtracted_sign);
+}
+
+// Auxiliary Carry Flag (AF) - carry or borrow between bit 3 and bit 4.
+static bool EvaluateAuxiliaryCarryFlag(const CPULazyFlags* lazy_flags) {
+  uint32_t op1_low = lazy_flags->op1 & 0xF;
+  uint32_t op2_low = (lazy_flags->op2 & 0xF) + (lazy_flags->did_carry ? 1 : 0);
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    return op1_low + op2_low > 0xF;
+  }
+  return op1_low < op2_low;
+}
+
+// Evaluate a single flag produced by an operation.
+static bool EvaluateLazyFlag(const CPULazyFlags* lazy_flags, Flag flag) {
+  const uint32_t result = lazy_flags->result & kMaxValue[lazy_flags->width];
+  switch (flag) {
+    case kZF:
+      return result == 0;
+    case kSF:
+      return (result & kSignBit[lazy_flags->width]) != 0;
+    case kPF:
+      return IsParityEven(result);
+    case kCF:
+      return EvaluateCarryFlag(lazy_flags);
+    case kOF:
+      return EvaluateOverflowFlag(lazy_flags);
+    case kAF:
+      return EvaluateAuxiliaryCarryFlag(lazy_flags);
+    default:
+      return false;
+  }
+}
+
+// Evaluate the pending flags in mask and write them to cpu->flags.
+static void EvaluateLazyFlags(CPUState* cpu, uint16_t mask) {
+  static const Flag kFlags[] = {kCF, kPF, kAF, kZF, kSF, kOF};
+  mask &= cpu->lazy_flags.pending;
+  for (uint8_t i = 0; i < sizeof(kFlags) / sizeof(kFlags[0]); ++i) {
+    if (!(mask & kFlags[i])) {
+      continue;
+    }
+    if (EvaluateLazyFlag(&cpu->lazy_flags, kFlags[i])) {
+      cpu->flags |= kFlags[i];
+    } else {
+      cpu->flags &= ~kFlags[i];
+    }
+  }
+}
+
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag) {
+  return EvaluateLazyFlag(&cpu->lazy_flags, flag);
+}
+
+void CPUMaterializeFlags(CPUState* cpu) {
+  EvaluateLazyFlags(cpu, cpu->lazy_flags.pending);
+  cpu->lazy_flags.pending = 0;
+}
+
+YAX86_PRIVATE void DiscardLazyFlags(CPUState* cpu, uint16_t mask) {
+  if (cpu->lazy_flags.pending & ~mask) {
+    EvaluateLazyFlags(cpu, ~mask);
+  }
+  cpu->lazy_flags.pending = 0;
+}
+
+YAX86_PRIVATE void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry) {
+  const uint16_t produced = kLazyFlagsProduced[op];
+  DiscardLazyFlags(cpu, produced);
+  CPULazyFlags* lazy_flags = &cpu->lazy_flags;
+  lazy_flags->pending = produced;
+  lazy_flags->op = op;
+  lazy_flags->width = width;
+  lazy_flags->did_carry = did_carry;
+  lazy_flags->op1 = op1;
+  lazy_flags->op2 = op2;
+  lazy_flags->result = result;
+}
+
+YAX86_PRIVATE uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask) {
+  uint16_t flags = cpu->flags & mask & ~cpu->lazy_flags.pending;
+  uint16_t pending = cpu->lazy_flags.pending & mask;
+  for (uint16_t flag = 1; pending; flag <<= 1) {
+    if (pending & flag) {
+      pending &= ~flag;
+      if (EvaluateLazyFlag(&cpu->lazy_flags, (Flag)flag)) {
+        flags |= flag;
+      }
+    }
+  }
+  return flags;
+}
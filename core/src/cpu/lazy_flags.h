@@ -0,0 +1,28 @@
+#ifndef YAX86_CPU_LAZY_FLAGS_H
+#define YAX86_CPU_LAZY_FLAGS_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+extern const uint16_t kLazyFlagsProduced[];
+
+// Record a flag-producing operation, whose flags will be evaluated when they
+// are read. Pending flags from the previous operation that are not produced by
+// this operation are evaluated first.
+extern void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry);
+
+// Prepare to set the flags in mask directly. Pending flags outside of mask are
+// evaluated, and pending flags in mask are discarded.
+extern void DiscardLazyFlags(CPUState* cpu, uint16_t mask);
+
+// Returns the value of the flags in mask, evaluating pending flags as needed.
+extern uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_LAZY_FLAGS_H
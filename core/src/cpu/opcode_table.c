@@ -10,31 +10,39 @@
 // ============================================================================
 
 // Global opcode metadata lookup table.
-YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
+YAX86_PRIVATE const OpcodeMetadata opcode_table[256] = {
     // ADD r/m8, r8
     {.opcode = 0x00,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryByte,
+                              ExecuteAddRegisterToRegisterByte}},
     // ADD r/m16, r16
     {.opcode = 0x01,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryWord,
+                              ExecuteAddRegisterToRegisterWord}},
     // ADD r8, r/m8
     {.opcode = 0x02,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterByte,
+                              ExecuteAddRegisterToRegisterReversedByte}},
     // ADD r16, r/m16
     {.opcode = 0x03,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterWord,
+                              ExecuteAddRegisterToRegisterReversedWord}},
     // ADD AL, imm8
     {.opcode = 0x04,
      .has_modrm = false,
@@ -64,25 +72,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryByte,
+                              ExecuteBooleanOrRegisterToRegisterByte}},
     // OR r/m16, r16
     {.opcode = 0x09,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryWord,
+                              ExecuteBooleanOrRegisterToRegisterWord}},
     // OR r8, r/m8
     {.opcode = 0x0A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterByte,
+                              ExecuteBooleanOrRegisterToRegisterReversedByte}},
     // OR r16, r/m16
     {.opcode = 0x0B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterWord,
+                              ExecuteBooleanOrRegisterToRegisterReversedWord}},
     // OR AL, imm8
     {.opcode = 0x0C,
      .has_modrm = false,
@@ -108,25 +124,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryByte,
+                              ExecuteAddWithCarryRegisterToRegisterByte}},
     // ADC r/m16, r16
     {.opcode = 0x11,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryWord,
+                              ExecuteAddWithCarryRegisterToRegisterWord}},
     // ADC r8, r/m8
     {.opcode = 0x12,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterByte,
+          ExecuteAddWithCarryRegisterToRegisterReversedByte}},
     // ADC r16, r/m16
     {.opcode = 0x13,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterWord,
+          ExecuteAddWithCarryRegisterToRegisterReversedWord}},
     // ADC AL, imm8
     {.opcode = 0x14,
      .has_modrm = false,
@@ -156,25 +182,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryByte,
+                              ExecuteSubWithBorrowRegisterToRegisterByte}},
     // SBB r/m16, r16
     {.opcode = 0x19,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryWord,
+                              ExecuteSubWithBorrowRegisterToRegisterWord}},
     // SBB r8, r/m8
     {.opcode = 0x1A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterByte,
+          ExecuteSubWithBorrowRegisterToRegisterReversedByte}},
     // SBB r16, r/m16
     {.opcode = 0x1B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterWord,
+          ExecuteSubWithBorrowRegisterToRegisterReversedWord}},
     // SBB AL, imm8
     {.opcode = 0x1C,
      .has_modrm = false,
@@ -204,25 +240,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryByte,
+                              ExecuteBooleanAndRegisterToRegisterByte}},
     // AND r/m16, r16
     {.opcode = 0x21,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryWord,
+                              ExecuteBooleanAndRegisterToRegisterWord}},
     // AND r8, r/m8
     {.opcode = 0x22,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterByte,
+                              ExecuteBooleanAndRegisterToRegisterReversedByte}},
     // AND r16, r/m16
     {.opcode = 0x23,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterWord,
+                              ExecuteBooleanAndRegisterToRegisterReversedWord}},
     // AND AL, imm8
     {.opcode = 0x24,
      .has_modrm = false,
@@ -247,25 +291,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryByte,
+                              ExecuteSubRegisterToRegisterByte}},
     // SUB r/m16, r16
     {.opcode = 0x29,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryWord,
+                              ExecuteSubRegisterToRegisterWord}},
     // SUB r8, r/m8
     {.opcode = 0x2A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterByte,
+                              ExecuteSubRegisterToRegisterReversedByte}},
     // SUB r16, r/m16
     {.opcode = 0x2B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterWord,
+                              ExecuteSubRegisterToRegisterReversedWord}},
     // SUB AL, imm8
     {.opcode = 0x2C,
      .has_modrm = false,
@@ -290,25 +342,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryByte,
+                              ExecuteBooleanXorRegisterToRegisterByte}},
     // XOR r/m16, r16
     {.opcode = 0x31,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryWord,
+                              ExecuteBooleanXorRegisterToRegisterWord}},
     // XOR r8, r/m8
     {.opcode = 0x32,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterByte,
+                              ExecuteBooleanXorRegisterToRegisterReversedByte}},
     // XOR r16, r/m16
     {.opcode = 0x33,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterWord,
+                              ExecuteBooleanXorRegisterToRegisterReversedWord}},
     // XOR AL, imm8
     {.opcode = 0x34,
      .has_modrm = false,
@@ -334,25 +394,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryByte,
+                              ExecuteCmpRegisterToRegisterByte}},
     // CMP r/m16, r16
     {.opcode = 0x39,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryWord,
+                              ExecuteCmpRegisterToRegisterWord}},
     // CMP r8, r/m8
     {.opcode = 0x3A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterByte,
+                              ExecuteCmpRegisterToRegisterReversedByte}},
     // CMP r16, r/m16
     {.opcode = 0x3B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterWord,
+                              ExecuteCmpRegisterToRegisterReversedWord}},
     // CMP AL, imm8
     {.opcode = 0x3C,
      .has_modrm = false,
@@ -733,25 +801,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryByte,
+                              ExecuteMoveRegisterToRegisterByte}},
     // MOV r/m16, r16
     {.opcode = 0x89,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryWord,
+                              ExecuteMoveRegisterToRegisterWord}},
     // MOV r8, r/m8
     {.opcode = 0x8A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterByte,
+                              ExecuteMoveRegisterToRegisterReversedByte}},
     // MOV r16, r/m16
     {.opcode = 0x8B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterWord,
+                              ExecuteMoveRegisterToRegisterReversedWord}},
     // MOV r/m16, sreg
     {.opcode = 0x8C,
      .has_modrm = true,
@@ -2,6 +2,8 @@
 #include "operands.h"
 
 #include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
 #endif  // YAX86_IMPLEMENTATION
 
 // Helper functions to construct OperandValue.
@@ -73,12 +75,20 @@ YAX86_PRIVATE int32_t FromSignedOperand(const Operand* operand) {
 // Computes the raw effective address corresponding to a MemoryAddress.
 YAX86_PRIVATE uint32_t
 ToRawAddress(const CPUState* cpu, const MemoryAddress* address) {
-  uint16_t segment = cpu->registers[address->segment_register_index];
-  return (((uint32_t)segment) << 4) + (uint32_t)(address->offset);
+  return CPUGetSegmentBase(cpu, address->segment_register_index) +
+         (uint32_t)(address->offset);
 }
 
 // Read a byte from memory as a uint8_t.
 YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return page[raw_address % kCPUMemoryPageSize];
+    }
+  }
   return cpu->config->read_memory_byte
              ? cpu->config->read_memory_byte(cpu, raw_address)
              : 0xFF;
@@ -86,6 +96,20 @@ YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
 
 // Read a word from memory as a uint16_t.
 YAX86_PRIVATE uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address) {
+  uint32_t page_offset = raw_address % kCPUMemoryPageSize;
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return (((uint16_t)page[page_offset + 1]) << 8) |
+             (uint16_t)page[page_offset];
+    }
+  }
+  if (cpu->config->read_memory_word) {
+    return cpu->config->read_memory_word(cpu, raw_address);
+  }
   uint8_t low_byte_value = ReadRawMemoryByte(cpu, raw_address);
   uint8_t high_byte_value = ReadRawMemoryByte(cpu, raw_address + 1);
   return (((uint16_t)high_byte_value) << 8) | (uint16_t)low_byte_value;
@@ -137,6 +161,17 @@ OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
 // Write a byte as uint8_t to memory.
 YAX86_PRIVATE void WriteRawMemoryByte(
     CPUState* cpu, uint32_t address, uint8_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[address % kCPUMemoryPageSize] = value;
+      return;
+    }
+  }
   if (!cpu->config->write_memory_byte) {
     return;
   }
@@ -146,10 +181,83 @@ YAX86_PRIVATE void WriteRawMemoryByte(
 // Write a word as uint16_t to memory.
 YAX86_PRIVATE void WriteRawMemoryWord(
     CPUState* cpu, uint32_t address, uint16_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateInstructionCacheOnWrite(cpu, address + 1);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address + 1);
+  uint32_t page_offset = address % kCPUMemoryPageSize;
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[page_offset] = value & 0xFF;
+      page[page_offset + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+  }
+  if (cpu->config->write_memory_word) {
+    cpu->config->write_memory_word(cpu, address, value);
+    return;
+  }
   WriteRawMemoryByte(cpu, address, value & 0xFF);
   WriteRawMemoryByte(cpu, address + 1, (value >> 8) & 0xFF);
 }
 
+// Returns a host pointer to size bytes of memory starting at a linear address
+// in a page table, if all pages in the range are mapped and contiguous in host
+// memory. Otherwise, returns NULL.
+static const uint8_t* GetDirectMemory(
+    const uint8_t* const* pages, uint32_t address, uint32_t size) {
+  if (!pages || size == 0 || address >= kCPUMemoryAddressSpaceSize ||
+      size > kCPUMemoryAddressSpaceSize - address) {
+    return NULL;
+  }
+  uint32_t first_page = address / kCPUMemoryPageSize;
+  uint32_t last_page = (address + size - 1) / kCPUMemoryPageSize;
+  const uint8_t* first_page_memory = pages[first_page];
+  if (!first_page_memory) {
+    return NULL;
+  }
+  for (uint32_t page = first_page + 1; page <= last_page; ++page) {
+    if (pages[page] !=
+        first_page_memory + (page - first_page) * kCPUMemoryPageSize) {
+      return NULL;
+    }
+  }
+  return first_page_memory + address % kCPUMemoryPageSize;
+}
+
+YAX86_PRIVATE const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return GetDirectMemory(cpu->config->read_memory_pages, address, size);
+}
+
+YAX86_PRIVATE uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return (uint8_t*)GetDirectMemory(
+      (const uint8_t* const*)cpu->config->write_memory_pages, address, size);
+}
+
+YAX86_PRIVATE void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+  // Invalidating one address in each cache page is sufficient.
+  uint32_t last_address = address + size - 1;
+  for (uint32_t page_address = address;
+       page_address / kCPUInstructionCachePageSize <
+       last_address / kCPUInstructionCachePageSize;
+       page_address += kCPUInstructionCachePageSize) {
+    InvalidateInstructionCacheOnWrite(cpu, page_address);
+    InvalidateBlockCacheOnWrite(cpu, page_address);
+  }
+  InvalidateInstructionCacheOnWrite(cpu, last_address);
+  InvalidateBlockCacheOnWrite(cpu, last_address);
+}
+
 // Write a byte to memory.
 YAX86_PRIVATE void WriteMemoryOperandByte(
     CPUState* cpu, const OperandAddress* address, OperandValue value) {
@@ -182,7 +290,12 @@ YAX86_PRIVATE void WriteRegisterOperandByte(
 YAX86_PRIVATE void WriteRegisterOperandWord(
     CPUState* cpu, const OperandAddress* address, OperandValue value) {
   const RegisterAddress* register_address = &address->value.register_address;
-  cpu->registers[register_address->register_index] = value.value.word_value;
+  const RegisterIndex register_index = register_address->register_index;
+  if (register_index >= kES && register_index <= kDS) {
+    CPUSetSegmentRegister(cpu, register_index, value.value.word_value);
+  } else {
+    cpu->registers[register_index] = value.value.word_value;
+  }
 }
 
 // Table of Write* functions, indexed by OperandAddressType and Width.
@@ -274,82 +387,109 @@ YAX86_PRIVATE void ApplySegmentOverride(
   }
 }
 
-// Compute the memory address for an instruction.
-YAX86_PRIVATE MemoryAddress
-GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
-  MemoryAddress address;
-  uint8_t mod = instruction->mod_rm.mod;
-  uint8_t rm = instruction->mod_rm.rm;
-  switch (rm) {
-    case 0:  // [BX + SI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 1:  // [BX + DI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 2:  // [BP + SI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kSI];
-      address.segment_register_index = kSS;
-      break;
-    case 3:  // [BP + DI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kDI];
-      address.segment_register_index = kSS;
-      break;
-    case 4:  // [SI]
-      address.offset = cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 5:  // [DI]
-      address.offset = cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 6:
-      if (mod == 0) {
-        // Direct memory address with 16-bit displacement
-        address.offset = 0;
-        address.segment_register_index = kDS;
-      } else {
-        // [BP]
-        address.offset = cpu->registers[kBP];
-        address.segment_register_index = kSS;
-      }
-      break;
-    case 7:  // [BX]
-      address.offset = cpu->registers[kBX];
-      address.segment_register_index = kDS;
-      break;
-    default:
-      // Not possible as RM field is 3 bits (0-7).
-      address.offset = 0xFFFF;
-      address.segment_register_index = kDS;  // Invalid RM field
-      break;
-  }
+// Registers and default segment of each ModR/M memory addressing mode,
+// indexed by mod * 8 + rm.
+static const EffectiveAddressMode
+    kEffectiveAddressModes[kNumEffectiveAddressModes] = {
+        // mod = 0, rm = 0: [BX + SI]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 0, rm = 1: [BX + DI]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 0, rm = 2: [BP + SI]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 0, rm = 3: [BP + DI]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 0, rm = 4: [SI]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 5: [DI]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 6: [disp16]
+        {kAX, 0, kAX, 0, kDS},
+        // mod = 0, rm = 7: [BX]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 0: [BX + SI + disp8]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 1, rm = 1: [BX + DI + disp8]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 1, rm = 2: [BP + SI + disp8]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 1, rm = 3: [BP + DI + disp8]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 1, rm = 4: [SI + disp8]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 5: [DI + disp8]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 6: [BP + disp8]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 1, rm = 7: [BX + disp8]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 0: [BX + SI + disp16]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 2, rm = 1: [BX + DI + disp16]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 2, rm = 2: [BP + SI + disp16]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 2, rm = 3: [BP + DI + disp16]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 2, rm = 4: [SI + disp16]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 5: [DI + disp16]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 6: [BP + disp16]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 2, rm = 7: [BX + disp16]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+};
 
-  // Apply segment override prefixes if present
+YAX86_PRIVATE void ResolveMemoryOperand(Instruction* instruction) {
+  MemoryAddress address = {
+      .segment_register_index = kDS,
+      .offset = 0,
+  };
+  if (instruction->has_mod_rm) {
+    // Register operands (mod = 3) have no memory operand, but resolve them like
+    // mod = 1 without a displacement for instructions that expect one.
+    uint8_t mod = instruction->mod_rm.mod == 3 ? 1 : instruction->mod_rm.mod;
+    instruction->effective_address_mode = mod * 8 + instruction->mod_rm.rm;
+    address.segment_register_index =
+        kEffectiveAddressModes[instruction->effective_address_mode]
+            .default_segment_register_index;
+  } else {
+    instruction->effective_address_mode = 0;
+  }
   ApplySegmentOverride(instruction, &address);
+  instruction->segment_register_index = address.segment_register_index;
 
-  // Add displacement if present
   switch (instruction->displacement_size) {
-    case 1: {
-      uint8_t raw_displacement = instruction->displacement[0];
-      address.offset = AddSignedOffsetByte(address.offset, raw_displacement);
+    case 1:
+      instruction->displacement_value =
+          AddSignedOffsetByte(0, instruction->displacement[0]);
       break;
-    }
-    case 2: {
-      // Concatenate the two displacement bytes as an unsigned 16-bit integer
-      uint16_t raw_displacement =
+    case 2:
+      instruction->displacement_value =
           ((uint16_t)instruction->displacement[0]) |
           (((uint16_t)instruction->displacement[1]) << 8);
-      address.offset = AddSignedOffsetWord(address.offset, raw_displacement);
       break;
-    }
     default:
-      // No displacement
+      instruction->displacement_value = 0;
       break;
   }
+}
 
+// Compute the memory address for an instruction.
+YAX86_PRIVATE MemoryAddress
+GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
+  const EffectiveAddressMode* mode =
+      &kEffectiveAddressModes[instruction->effective_address_mode];
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)instruction->segment_register_index,
+      .offset = (uint16_t)((cpu->registers[mode->base_register_index] &
+                            mode->base_mask) +
+                           (cpu->registers[mode->index_register_index] &
+                            mode->index_mask) +
+                           instruction->displacement_value),
+  };
   return address;
 }
 
@@ -59,6 +59,24 @@ extern void WriteRawMemoryByte(CPUState* cpu, uint32_t address, uint8_t value);
 // Write a word as uint16_t to memory.
 extern void WriteRawMemoryWord(CPUState* cpu, uint32_t address, uint16_t value);
 
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for reading, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL.
+extern const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for writing, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL. The caller must invalidate cached code
+// with InvalidateCachesOnWrite() before writing.
+extern uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Invalidate cached instructions and blocks overlapping size bytes of memory
+// starting at a linear address.
+extern void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
 // Write a byte to memory.
 extern void WriteMemoryOperandByte(
     CPUState* cpu, const OperandAddress* address, OperandValue value);
@@ -93,6 +111,11 @@ extern RegisterAddress GetRegisterAddressWord(CPUState* cpu, uint8_t reg_or_rm);
 extern void ApplySegmentOverride(
     const Instruction* instruction, MemoryAddress* address);
 
+// Resolve the effective address mode, displacement and segment register of
+// an instruction's memory operand from its prefixes, ModR/M byte and
+// displacement bytes.
+extern void ResolveMemoryOperand(Instruction* instruction);
+
 // Compute the memory address for an instruction.
 extern MemoryAddress GetMemoryOperandAddress(
     CPUState* cpu, const Instruction* instruction);
@@ -3,8 +3,23 @@
 #define YAX86_CPU_PUBLIC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// The JIT backend is only available on x86-64 Linux hosts. Define
+// YAX86_DISABLE_JIT to build the pure interpreter on such hosts as well.
+#if defined(__x86_64__) && defined(__linux__) && !defined(YAX86_DISABLE_JIT)
+#define YAX86_CPU_HAS_JIT 1
+#endif  // defined(__x86_64__) && defined(__linux__) && ...
+
+// CPURun() dispatches opcodes with computed gotos on compilers that support
+// them. Define YAX86_DISABLE_THREADED_DISPATCH to always use the portable
+// dispatch through the opcode table.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(YAX86_DISABLE_THREADED_DISPATCH)
+#define YAX86_CPU_HAS_THREADED_DISPATCH 1
+#endif  // (defined(__GNUC__) || defined(__clang__)) && ...
+
 // ============================================================================
 // CPU state
 // ============================================================================
@@ -50,6 +65,8 @@ typedef enum RegisterIndex {
 enum {
   // Number of registers.
   kNumRegisters = kIP + 1,
+  // Number of segment registers, from kES to kDS.
+  kNumSegmentRegisters = kDS - kES + 1,
 };
 
 // CPU flag masks.
@@ -77,8 +94,44 @@ typedef enum Flag {
 enum {
   // CPU flags value on reset.
   kInitialFlags = (1 << 1),  // Reserved_1 is always 1.
+  // Flags produced by arithmetic and logic instructions, which may be
+  // evaluated lazily.
+  kArithmeticFlags = kCF | kPF | kAF | kZF | kSF | kOF,
 };
 
+// Kind of the last flag-producing operation, used to lazily evaluate flags.
+typedef enum CPULazyFlagsOp {
+  // ADD and ADC. Produces all arithmetic flags.
+  kLazyFlagsAdd = 0,
+  // INC. Produces all arithmetic flags except CF.
+  kLazyFlagsInc,
+  // SUB, SBB, CMP and NEG. Produces all arithmetic flags.
+  kLazyFlagsSub,
+  // DEC. Produces all arithmetic flags except CF.
+  kLazyFlagsDec,
+  // AND, OR, XOR and TEST. Produces all arithmetic flags except AF.
+  kLazyFlagsBoolean,
+} CPULazyFlagsOp;
+
+// The last flag-producing operation, from which flags are evaluated on demand.
+typedef struct CPULazyFlags {
+  // Flags that have not been written to CPUState.flags yet and must be
+  // evaluated from this operation, or 0 if there is no pending operation.
+  uint16_t pending;
+  // Kind of the operation, as a CPULazyFlagsOp.
+  uint8_t op;
+  // Data width of the operation, as a Width.
+  uint8_t width;
+  // Whether the operation included a carry or borrow.
+  bool did_carry;
+  // First operand.
+  uint32_t op1;
+  // Second operand.
+  uint32_t op2;
+  // Result, before truncating to the operation's data width.
+  uint32_t result;
+} CPULazyFlags;
+
 // Standard interrupts.
 typedef enum InterruptNumber {
   kInterruptDivideError = 0,
@@ -105,6 +158,18 @@ typedef enum ExecuteStatus {
 
 struct CPUState;
 struct Instruction;
+struct CPUInstructionCache;
+struct CPUBlockCache;
+struct CPUJIT;
+
+enum {
+  // Size of the 8088's physical address space in bytes.
+  kCPUMemoryAddressSpaceSize = 1024 * 1024,
+  // Granularity of direct host memory access in bytes.
+  kCPUMemoryPageSize = 4 * 1024,
+  // Number of pages in the physical address space.
+  kCPUNumMemoryPages = kCPUMemoryAddressSpaceSize / kCPUMemoryPageSize,
+};
 
 // Caller-provided runtime configuration.
 typedef struct CPUConfig {
@@ -132,6 +197,29 @@ typedef struct CPUConfig {
   void (*write_memory_byte)(
       struct CPUState* cpu, uint32_t address, uint8_t value);
 
+  // Optional callback to read a word from memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word reads are split into two
+  // calls to read_memory_byte.
+  uint16_t (*read_memory_word)(struct CPUState* cpu, uint32_t address);
+
+  // Optional callback to write a word to memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word writes are split into
+  // two calls to write_memory_byte.
+  void (*write_memory_word)(
+      struct CPUState* cpu, uint32_t address, uint16_t value);
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for reading. Reads from a page with a
+  // non-NULL pointer are served directly from host memory; reads from other
+  // pages go through read_memory_byte.
+  const uint8_t* const* read_memory_pages;
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for writing. Writes to a page with a
+  // non-NULL pointer go directly to host memory; writes to other pages go
+  // through write_memory_byte.
+  uint8_t* const* write_memory_pages;
+
   // Callback to handle an interrupt.
   //   - Return kExecuteSuccess if the interrupt was handled and execution
   //     should continue.
@@ -174,6 +262,61 @@ typedef struct CPUConfig {
   // For simplicity, we use a single 8-bit interface for memory access, similar
   // to the real-life 8088.
   void (*write_port)(struct CPUState* cpu, uint16_t port, uint8_t value);
+
+  // Optional callback to read a word from an I/O port, with the low byte from
+  // port and the high byte from port + 1. If not set, word reads are split into
+  // two calls to read_port.
+  uint16_t (*read_port_word)(struct CPUState* cpu, uint16_t port);
+
+  // Optional callback to write a word to an I/O port, with the low byte to port
+  // and the high byte to port + 1. If not set, word writes are split into two
+  // calls to write_port.
+  void (*write_port_word)(struct CPUState* cpu, uint16_t port, uint16_t value);
+
+  // Optional callback that returns whether reads from an I/O port have no side
+  // effects, and return the same value until the CPU writes to memory or to a
+  // port. Reads from ports whose value depends on the passage of time within a
+  // call to CPUTickBlock() or CPURun(), such as timer counters, are not
+  // stable. Translated loops that make no progress while only reading stable
+  // ports and memory are fast-forwarded to the end of the instruction budget.
+  // If not set, loops that read from ports are never fast-forwarded. Memory
+  // reads are assumed to never have side effects.
+  bool (*is_port_stable)(struct CPUState* cpu, uint16_t port);
+
+  // Optional cache of decoded instructions. If set, the cache must be
+  // initialized with CPUInitInstructionCache() before use.
+  struct CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated basic blocks, used by CPUTickBlock(). If set,
+  // the cache must be initialized with CPUInitBlockCache() before use.
+  struct CPUBlockCache* block_cache;
+
+  // Optional JIT compiler state. If set, hot blocks in block_cache are
+  // translated to native code when running CPUTickBlock(). The JIT must be
+  // initialized with CPUInitJIT() before CPUInit(), and is only used on hosts
+  // where YAX86_CPU_HAS_JIT is defined.
+  struct CPUJIT* jit;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // instruction cycle, or 0 for no limit. An instruction with iterations left
+  // is executed again in the next instruction cycle, with progress saved in
+  // CX, SI and DI, so that interrupts and devices are serviced in between.
+  // Smaller values reduce interrupt latency, larger values increase
+  // throughput.
+  uint16_t max_string_iterations;
+
+  // Whether CPURun() should dispatch opcodes through the opcode table even on
+  // hosts where YAX86_CPU_HAS_THREADED_DISPATCH is defined. This is mainly
+  // useful for comparing the two.
+  bool use_portable_dispatch;
+
+  // Whether each instruction cycle should advance CPUState.cycles by the
+  // number of clock cycles the instruction takes on the 8088, instead of by 1,
+  // so that the execution functions' budgets are in clock cycles. The last
+  // instruction run by CPUTickBlock() or CPURun() may then exceed the budget.
+  // Translated blocks store the clock cycles of their instructions, so the
+  // block cache and the JIT still apply.
+  bool use_clock_cycles;
 } CPUConfig;
 
 // State of the emulated CPU.
@@ -183,8 +326,13 @@ typedef struct CPUState {
 
   // Register values
   uint16_t registers[kNumRegisters];
-  // Flag values
+  // Flag values. Arithmetic flags are evaluated lazily while instructions are
+  // executing, but this is always exact between calls to CPUTick() and other
+  // execution functions, and when invoking the instruction and interrupt
+  // callbacks. Use CPUGetFlag() / CPUGetFlags() from other callbacks.
   uint16_t flags;
+  // The last flag-producing operation whose flags have not been evaluated yet.
+  CPULazyFlags lazy_flags;
 
   // Whether there is an active interrupt.
   bool has_pending_interrupt;
@@ -195,17 +343,70 @@ typedef struct CPUState {
   // or execute any instructions until an external event (e.g., an interrupt)
   // clears this state.
   bool is_halted;
+
+  // Whether the host or a callback has asked CPURun() to return after the
+  // current instruction. Cleared when CPURun() returns.
+  bool stop_requested;
+
+  // Number of instruction cycles started so far by CPUTick() and the other
+  // execution functions, including cycles spent halted. While an instruction
+  // is executing, this includes the instruction's own cycle. Wraps around.
+  uint32_t cycles;
+
+  // Linear base addresses of the segment registers, indexed by register index
+  // minus kES. These are derived from registers again at the start of
+  // CPUTick() and the other execution functions and after the instruction and
+  // interrupt callbacks return, so the host may write segment registers
+  // directly at those points. Use CPUSetSegmentRegister() from other
+  // callbacks.
+  uint32_t segment_bases[kNumSegmentRegisters];
+
+  // Number of reads from I/O ports that are not known to be stable according
+  // to the is_port_stable callback. Wraps around.
+  uint32_t num_unstable_port_reads;
+
+  // Number of cycles, out of cycles, that were spent idle: halted, or in loop
+  // iterations that were fast-forwarded because they make no progress until
+  // an interrupt arrives. Wraps around.
+  uint32_t idle_cycles;
+
+  // Number of 8088 clock cycles run so far, including one per cycle spent
+  // halted. Only counted if CPUConfig.use_clock_cycles is set.
+  uint64_t clock_cycles;
 } CPUState;
 
 // Initialize CPU state.
 void CPUInit(CPUState* cpu, CPUConfig* config);
 
+// Evaluate a pending lazily evaluated flag.
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag);
+// Evaluate all pending lazily evaluated flags and write them to cpu->flags.
+void CPUMaterializeFlags(CPUState* cpu);
+
 // Get the value of a CPU flag.
 static inline bool CPUGetFlag(const CPUState* cpu, Flag flag) {
+  if (cpu->lazy_flags.pending & flag) {
+    return CPUGetLazyFlag(cpu, flag);
+  }
   return (cpu->flags & flag) != 0;
 }
+// Get the value of the flags register.
+static inline uint16_t CPUGetFlags(CPUState* cpu) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
+  return cpu->flags;
+}
+// Set the value of the flags register.
+static inline void CPUSetFlags(CPUState* cpu, uint16_t flags) {
+  cpu->lazy_flags.pending = 0;
+  cpu->flags = flags;
+}
 // Set a CPU flag.
 static inline void CPUSetFlag(CPUState* cpu, Flag flag, bool value) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
   if (value) {
     cpu->flags |= flag;
   } else {
@@ -226,6 +427,23 @@ static inline void CPUClearPendingInterrupt(CPUState* cpu) {
   cpu->pending_interrupt_number = 0;
 }
 
+// Get the linear base address of a segment register.
+static inline uint32_t CPUGetSegmentBase(
+    const CPUState* cpu, RegisterIndex segment_register_index) {
+  return cpu->segment_bases[segment_register_index - kES];
+}
+// Set the value of a segment register, updating its linear base address.
+static inline void CPUSetSegmentRegister(
+    CPUState* cpu, RegisterIndex segment_register_index, uint16_t value) {
+  cpu->registers[segment_register_index] = value;
+  cpu->segment_bases[segment_register_index - kES] = ((uint32_t)value) << 4;
+}
+
+// Ask CPURun() to return at the end of the current instruction cycle. This can
+// be called from callbacks, e.g. when a device raises an interrupt that the
+// host must deliver before the next instruction.
+static inline void CPURequestStop(CPUState* cpu) { cpu->stop_requested = true; }
+
 // ============================================================================
 // Instructions
 // ============================================================================
@@ -295,8 +513,254 @@ typedef struct Instruction {
 
   // Total length of the original encoded instruction in bytes.
   uint8_t size;
+
+  // Memory operand addressing, resolved from the fields above by the decoder.
+
+  // Sign-extended displacement of the ModR/M memory operand.
+  uint16_t displacement_value;
+  // Base and index registers of the ModR/M memory operand, as mod * 8 + rm.
+  uint8_t effective_address_mode;
+  // Segment register of the ModR/M memory operand, or of the source operand
+  // of string instructions and XLAT, after applying segment override prefixes.
+  uint8_t segment_register_index;
 } Instruction;
 
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+enum {
+  // Number of entries in the decoded instruction cache.
+  kCPUInstructionCacheSize = 1024,
+  // Granularity of instruction cache invalidation in bytes.
+  kCPUInstructionCachePageSize = 1024,
+  // Number of invalidation pages in the physical address space.
+  kCPUInstructionCacheNumPages =
+      kCPUMemoryAddressSpaceSize / kCPUInstructionCachePageSize,
+};
+
+// An entry in the decoded instruction cache.
+typedef struct CPUInstructionCacheEntry {
+  // Linear address of the instruction.
+  uint32_t address;
+  // Generation of the page containing the instruction at the time it was
+  // decoded. The entry is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Opcode metadata for the instruction, or NULL if the entry is empty.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+} CPUInstructionCacheEntry;
+
+// A direct-mapped cache of decoded instructions, keyed by the linear address of
+// CS:IP.
+//
+// Any write to memory through the CPU invalidates cached instructions in the
+// same page by bumping the page's generation, so self-modifying code behaves
+// correctly. Memory modified outside the CPU, such as by DMA or by the host,
+// must be reported via CPUInvalidateInstructionCache().
+typedef struct CPUInstructionCache {
+  // Cache entries, indexed by linear address modulo kCPUInstructionCacheSize.
+  CPUInstructionCacheEntry entries[kCPUInstructionCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached instructions. Used to skip bumping
+  // the generation counter on writes to pages that contain no code.
+  bool page_has_instructions[kCPUInstructionCacheNumPages];
+
+  // Number of instruction fetches served from the cache.
+  uint64_t num_hits;
+  // Number of instruction fetches that had to be decoded from memory.
+  uint64_t num_misses;
+} CPUInstructionCache;
+
+// Initialize or reset an instruction cache.
+void CPUInitInstructionCache(CPUInstructionCache* cache);
+
+// Invalidate any cached instructions or translated blocks covering a memory
+// address. This must be called when memory is modified without going through
+// the CPU, such as by DMA.
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address);
+
+// ============================================================================
+// Block cache
+// ============================================================================
+
+enum {
+  // Number of blocks in the block cache.
+  kCPUBlockCacheSize = 256,
+  // Maximum number of instructions in a block.
+  kCPUMaxBlockInstructions = 16,
+  // Number of successor links kept per block. Most blocks end in a conditional
+  // jump or loop, which has a taken and a not-taken successor.
+  kCPUNumBlockSuccessors = 2,
+};
+
+// Common instruction sequences that are recognized when translating a block,
+// and executed as a single step when there are no instruction callbacks.
+typedef enum CPUFusionKind {
+  // Not the start of a fused sequence.
+  kCPUFusionNone = 0,
+  // CMP or TEST followed by a conditional jump.
+  kCPUFusionCompareJump,
+  // INC or DEC of a register followed by a conditional jump.
+  kCPUFusionIncDecJump,
+  // LODSB followed by STOSB, or LODSW followed by STOSW.
+  kCPUFusionLoadStore,
+  // XOR or SUB of a register with itself.
+  kCPUFusionZeroRegister,
+  // A block ending in a short branch back to its own start, such as a LOOP
+  // over a short body.
+  kCPUFusionLoop,
+  kCPUNumFusionKinds,
+} CPUFusionKind;
+
+struct CPUBlock;
+
+// A decoded instruction in a translated block, along with its pre-resolved
+// opcode metadata and handler.
+typedef struct CPUBlockInstruction {
+  // Opcode metadata for the instruction.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+  // Kind of fused sequence starting at this instruction, as a CPUFusionKind.
+  uint8_t fusion;
+  // Whether the instruction may take more clock cycles than clock_cycles,
+  // depending on the CPU state.
+  bool has_variable_clock_cycles;
+  // Number of 8088 clock cycles the instruction takes regardless of the CPU
+  // state.
+  uint16_t clock_cycles;
+  // Sum of clock_cycles of the instructions before this one in the block.
+  uint16_t block_clock_cycles;
+} CPUBlockInstruction;
+
+// A translated basic block - a straight-line run of instructions ending at the
+// first control transfer, or at the end of an invalidation page.
+typedef struct CPUBlock {
+  // Linear address of the first instruction.
+  uint32_t address;
+  // Generation of the page containing the block at the time it was translated.
+  // The block is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Total size of the block's instructions in bytes.
+  uint16_t size;
+  // Number of instructions in the block, or 0 if the entry is empty.
+  uint8_t num_instructions;
+  // Index of the successor link to replace next.
+  uint8_t next_successor;
+  // Whether the block ends in a short branch back to its own start.
+  bool is_loop;
+  // Whether the block's instructions only write to registers and flags, so
+  // that running it from the same CPU state always has the same effect as
+  // long as the memory and ports it reads don't change.
+  bool is_read_only;
+  // Links to blocks that previously followed this block. A link is only
+  // followed after checking that the linked block is still valid and starts
+  // at the next CS:IP.
+  struct CPUBlock* successors[kCPUNumBlockSuccessors];
+#ifdef YAX86_CPU_HAS_JIT
+  // Number of times the block has been entered, used to detect hot blocks.
+  uint16_t execution_count;
+  // JIT epoch in which native_code was generated. The native code is stale if
+  // the JIT's code buffer has since been flushed.
+  uint32_t jit_epoch;
+  // Native code for the block, or NULL if the block has not been compiled.
+  uint8_t* native_code;
+#endif  // YAX86_CPU_HAS_JIT
+  // The block's instructions.
+  CPUBlockInstruction instructions[kCPUMaxBlockInstructions];
+} CPUBlock;
+
+// A direct-mapped cache of translated basic blocks, keyed by the linear address
+// of the first instruction.
+//
+// Blocks are invalidated in the same way as the instruction cache: any write
+// to memory through the CPU bumps the generation of the page written to, and
+// memory modified outside the CPU must be reported via
+// CPUInvalidateInstructionCache().
+typedef struct CPUBlockCache {
+  // Cached blocks, indexed by linear address modulo kCPUBlockCacheSize.
+  CPUBlock blocks[kCPUBlockCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached blocks. Used to skip bumping the
+  // generation counter on writes to pages that contain no code.
+  bool page_has_blocks[kCPUInstructionCacheNumPages];
+
+  // Number of blocks found in the cache or through a successor link.
+  uint64_t num_hits;
+  // Number of blocks that had to be translated.
+  uint64_t num_misses;
+  // Number of block transitions that followed a successor link.
+  uint64_t num_chained;
+  // Number of times each kind of fused sequence was executed as a single
+  // step, indexed by CPUFusionKind.
+  uint64_t fusion_counts[kCPUNumFusionKinds];
+  // Number of loop iterations skipped by fast-forwarding delay loops and
+  // loops that make no progress.
+  uint64_t num_skipped_loop_iterations;
+} CPUBlockCache;
+
+// Initialize or reset a block cache.
+void CPUInitBlockCache(CPUBlockCache* cache);
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+enum {
+  // Number of times a block must be entered before it is compiled.
+  kCPUJITHotBlockThreshold = 16,
+  // Maximum size of the native code for a single block in bytes.
+  kCPUJITMaxBlockCodeSize = 2048,
+};
+
+// State of the JIT compiler, which translates hot blocks into native x86-64
+// code. Register moves, register ALU instructions and a conditional jump that
+// follows one are translated directly, recording flags in
+// CPUState.lazy_flags like the interpreter. Other instructions are compiled
+// into calls to the interpreter's opcode handlers, so translated blocks access
+// memory through the same callbacks and direct page tables.
+typedef struct CPUJIT {
+  // Caller-provided executable buffer for native code, such as memory mapped
+  // with PROT_READ | PROT_WRITE | PROT_EXEC.
+  uint8_t* code;
+  // Size of the code buffer in bytes.
+  uint32_t code_size;
+  // Number of bytes of the code buffer in use.
+  uint32_t code_used;
+  // Incremented whenever the code buffer is flushed.
+  uint32_t epoch;
+
+  // Block being executed natively.
+  CPUBlock* current_block;
+  // Value of CPUState.cycles before the current block started.
+  uint32_t current_block_start_cycles;
+  // Budget of CPUState.cycles for the current block. Only used if
+  // CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_max_cycles;
+  // Clock cycles taken by the current block's instructions so far on top of
+  // their base clock cycles. Only used if CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_variable_clock_cycles;
+  // Status of the last instruction executed natively.
+  ExecuteStatus status;
+  // Whether native execution of the current block stopped early.
+  bool stopped;
+
+  // Number of blocks compiled.
+  uint64_t num_compiled_blocks;
+  // Number of times the code buffer was flushed because it was full.
+  uint64_t num_flushes;
+  // Number of block executions that ran native code.
+  uint64_t num_native_executions;
+} CPUJIT;
+
+// Initialize or reset a JIT with a caller-provided executable code buffer.
+// The code buffer must be at least kCPUJITMaxBlockCodeSize bytes.
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size);
+
 // ============================================================================
 // Execution
 // ============================================================================
@@ -319,4 +783,31 @@ ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction);
 // instruction at CS:IP, and handling interrupts.
 ExecuteStatus CPUTick(CPUState* cpu);
 
+// Run up to max_instructions instruction cycles from translated blocks,
+// following links between blocks without decoding again. Each instruction is
+// executed with the same semantics as CPUTick(), but execution stops early
+// after an instruction that leaves the CPU halted, raises an interrupt or sets
+// the trap flag, so external interrupts only need to be checked between calls.
+// The number of instruction cycles run is stored in num_instructions. If
+// CPUConfig.use_clock_cycles is set, max_instructions and num_instructions are
+// in clock cycles instead, as in CPURun().
+//
+// If no block cache is configured, or the code at CS:IP cannot be translated,
+// this runs a single CPUTick().
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions);
+
+// Run up to max_cycles instruction cycles with the same semantics as calling
+// CPUTick() max_cycles times, using translated blocks if a block cache is
+// configured. The number of instruction cycles run is stored in num_cycles.
+// If CPUConfig.use_clock_cycles is set, max_cycles and num_cycles are in clock
+// cycles instead, and num_cycles may exceed max_cycles by up to the length of
+// the last instruction.
+//
+// Execution returns early when an instruction halts the CPU, on error, or when
+// CPURequestStop() is called. If the CPU is already halted with no pending
+// interrupt, it stays halted for all remaining cycles. The instruction
+// callbacks in CPUConfig are only checked once per call.
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles);
+
 #endif  // YAX86_CPU_PUBLIC_H
@@ -0,0 +1,518 @@
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction timing
+// ============================================================================
+
+enum {
+  // Opcodes of the first and last conditional jumps, JO and JG.
+  kOpcodeJO = 0x70,
+  kOpcodeJG = 0x7F,
+  // Opcodes of the first and last string instructions, MOVSB and SCASW.
+  kOpcodeMOVSB = 0xA4,
+  kOpcodeSCASW = 0xAF,
+  // Opcode of INTO.
+  kOpcodeINTO = 0xCE,
+  // Opcodes of shifts and rotates by CL.
+  kOpcodeShiftByteByCL = 0xD2,
+  kOpcodeShiftWordByCL = 0xD3,
+  // Value of the ModR/M MOD field for register operands.
+  kModRMModRegister = 3,
+  // Value of the ModR/M REG field for CMP in Group 1 instructions.
+  kModRMRegCMP = 7,
+
+  // Clock cycles taken by a short conditional jump when it transfers control.
+  kConditionalJumpTakenCycles = 16,
+  // Clock cycles taken by each segment override or LOCK prefix.
+  kPrefixCycles = 2,
+  // Clock cycles taken by a repeated string instruction on top of the time
+  // per iteration.
+  kRepeatedStringBaseCycles = 9,
+  // Clock cycles taken per bit by shifts and rotates by CL.
+  kShiftByCLCyclesPerBit = 4,
+  // Clock cycles taken by CMP r/m8, imm8 and CMP r/m16, imm16 with a memory
+  // operand, which do not write back to memory.
+  kCompareImmediateByteMemoryCycles = 10,
+  kCompareImmediateWordMemoryCycles = 14,
+};
+
+// Clock cycles taken by each instruction on the 8088, indexed by opcode. These
+// are the 8086 timings from the Intel datasheet, plus 4 clock cycles for each
+// word transferred over the 8088's 8-bit bus. Conditional branches are listed
+// with the time taken when not branching.
+static const InstructionTiming kInstructionTimings[256] = {
+    {3, 16},   // 0x00 ADD r/m8, r8
+    {3, 24},   // 0x01 ADD r/m16, r16
+    {3, 9},    // 0x02 ADD r8, r/m8
+    {3, 13},   // 0x03 ADD r16, r/m16
+    {4, 4},    // 0x04 ADD AL, imm8
+    {4, 4},    // 0x05 ADD AX, imm16
+    {14, 14},  // 0x06 PUSH ES
+    {12, 12},  // 0x07 POP ES
+    {3, 16},   // 0x08 OR r/m8, r8
+    {3, 24},   // 0x09 OR r/m16, r16
+    {3, 9},    // 0x0A OR r8, r/m8
+    {3, 13},   // 0x0B OR r16, r/m16
+    {4, 4},    // 0x0C OR AL, imm8
+    {4, 4},    // 0x0D OR AX, imm16
+    {14, 14},  // 0x0E PUSH CS
+    {2, 2},    // 0x0F unsupported
+    {3, 16},   // 0x10 ADC r/m8, r8
+    {3, 24},   // 0x11 ADC r/m16, r16
+    {3, 9},    // 0x12 ADC r8, r/m8
+    {3, 13},   // 0x13 ADC r16, r/m16
+    {4, 4},    // 0x14 ADC AL, imm8
+    {4, 4},    // 0x15 ADC AX, imm16
+    {14, 14},  // 0x16 PUSH SS
+    {12, 12},  // 0x17 POP SS
+    {3, 16},   // 0x18 SBB r/m8, r8
+    {3, 24},   // 0x19 SBB r/m16, r16
+    {3, 9},    // 0x1A SBB r8, r/m8
+    {3, 13},   // 0x1B SBB r16, r/m16
+    {4, 4},    // 0x1C SBB AL, imm8
+    {4, 4},    // 0x1D SBB AX, imm16
+    {14, 14},  // 0x1E PUSH DS
+    {12, 12},  // 0x1F POP DS
+    {3, 16},   // 0x20 AND r/m8, r8
+    {3, 24},   // 0x21 AND r/m16, r16
+    {3, 9},    // 0x22 AND r8, r/m8
+    {3, 13},   // 0x23 AND r16, r/m16
+    {4, 4},    // 0x24 AND AL, imm8
+    {4, 4},    // 0x25 AND AX, imm16
+    {2, 2},    // 0x26 ES prefix
+    {4, 4},    // 0x27 DAA
+    {3, 16},   // 0x28 SUB r/m8, r8
+    {3, 24},   // 0x29 SUB r/m16, r16
+    {3, 9},    // 0x2A SUB r8, r/m8
+    {3, 13},   // 0x2B SUB r16, r/m16
+    {4, 4},    // 0x2C SUB AL, imm8
+    {4, 4},    // 0x2D SUB AX, imm16
+    {2, 2},    // 0x2E CS prefix
+    {4, 4},    // 0x2F DAS
+    {3, 16},   // 0x30 XOR r/m8, r8
+    {3, 24},   // 0x31 XOR r/m16, r16
+    {3, 9},    // 0x32 XOR r8, r/m8
+    {3, 13},   // 0x33 XOR r16, r/m16
+    {4, 4},    // 0x34 XOR AL, imm8
+    {4, 4},    // 0x35 XOR AX, imm16
+    {2, 2},    // 0x36 SS prefix
+    {4, 4},    // 0x37 AAA
+    {3, 9},    // 0x38 CMP r/m8, r8
+    {3, 13},   // 0x39 CMP r/m16, r16
+    {3, 9},    // 0x3A CMP r8, r/m8
+    {3, 13},   // 0x3B CMP r16, r/m16
+    {4, 4},    // 0x3C CMP AL, imm8
+    {4, 4},    // 0x3D CMP AX, imm16
+    {2, 2},    // 0x3E DS prefix
+    {4, 4},    // 0x3F AAS
+    {2, 2},    // 0x40 INC AX
+    {2, 2},    // 0x41 INC CX
+    {2, 2},    // 0x42 INC DX
+    {2, 2},    // 0x43 INC BX
+    {2, 2},    // 0x44 INC SP
+    {2, 2},    // 0x45 INC BP
+    {2, 2},    // 0x46 INC SI
+    {2, 2},    // 0x47 INC DI
+    {2, 2},    // 0x48 DEC AX
+    {2, 2},    // 0x49 DEC CX
+    {2, 2},    // 0x4A DEC DX
+    {2, 2},    // 0x4B DEC BX
+    {2, 2},    // 0x4C DEC SP
+    {2, 2},    // 0x4D DEC BP
+    {2, 2},    // 0x4E DEC SI
+    {2, 2},    // 0x4F DEC DI
+    {15, 15},  // 0x50 PUSH AX
+    {15, 15},  // 0x51 PUSH CX
+    {15, 15},  // 0x52 PUSH DX
+    {15, 15},  // 0x53 PUSH BX
+    {15, 15},  // 0x54 PUSH SP
+    {15, 15},  // 0x55 PUSH BP
+    {15, 15},  // 0x56 PUSH SI
+    {15, 15},  // 0x57 PUSH DI
+    {12, 12},  // 0x58 POP AX
+    {12, 12},  // 0x59 POP CX
+    {12, 12},  // 0x5A POP DX
+    {12, 12},  // 0x5B POP BX
+    {12, 12},  // 0x5C POP SP
+    {12, 12},  // 0x5D POP BP
+    {12, 12},  // 0x5E POP SI
+    {12, 12},  // 0x5F POP DI
+    {2, 2},    // 0x60 unsupported
+    {2, 2},    // 0x61 unsupported
+    {2, 2},    // 0x62 unsupported
+    {2, 2},    // 0x63 unsupported
+    {2, 2},    // 0x64 unsupported
+    {2, 2},    // 0x65 unsupported
+    {2, 2},    // 0x66 unsupported
+    {2, 2},    // 0x67 unsupported
+    {2, 2},    // 0x68 unsupported
+    {2, 2},    // 0x69 unsupported
+    {2, 2},    // 0x6A unsupported
+    {2, 2},    // 0x6B unsupported
+    {2, 2},    // 0x6C unsupported
+    {2, 2},    // 0x6D unsupported
+    {2, 2},    // 0x6E unsupported
+    {2, 2},    // 0x6F unsupported
+    {4, 4},    // 0x70 JO rel8
+    {4, 4},    // 0x71 JNO rel8
+    {4, 4},    // 0x72 JB/JNAE/JC rel8
+    {4, 4},    // 0x73 JNB/JAE/JNC rel8
+    {4, 4},    // 0x74 JE/JZ rel8
+    {4, 4},    // 0x75 JNE/JNZ rel8
+    {4, 4},    // 0x76 JBE/JNA rel8
+    {4, 4},    // 0x77 JNBE/JA rel8
+    {4, 4},    // 0x78 JS rel8
+    {4, 4},    // 0x79 JNS rel8
+    {4, 4},    // 0x7A JP/JPE rel8
+    {4, 4},    // 0x7B JNP/JPO rel8
+    {4, 4},    // 0x7C JL/JNGE rel8
+    {4, 4},    // 0x7D JNL/JGE rel8
+    {4, 4},    // 0x7E JLE/JNG rel8
+    {4, 4},    // 0x7F JNLE/JG rel8
+    {4, 17},   // 0x80 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x81 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm16 (Group 1)
+    {4, 17},   // 0x82 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x83 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm8 (Group 1)
+    {3, 9},    // 0x84 TEST r/m8, r8
+    {3, 13},   // 0x85 TEST r/m16, r16
+    {4, 17},   // 0x86 XCHG r/m8, r8
+    {4, 25},   // 0x87 XCHG r/m16, r16
+    {2, 9},    // 0x88 MOV r/m8, r8
+    {2, 13},   // 0x89 MOV r/m16, r16
+    {2, 8},    // 0x8A MOV r8, r/m8
+    {2, 12},   // 0x8B MOV r16, r/m16
+    {2, 13},   // 0x8C MOV r/m16, sreg
+    {2, 2},    // 0x8D LEA r16, m
+    {2, 12},   // 0x8E MOV sreg, r/m16
+    {12, 25},  // 0x8F POP r/m16
+    {3, 3},    // 0x90 XCHG AX, AX (NOP)
+    {3, 3},    // 0x91 XCHG AX, CX
+    {3, 3},    // 0x92 XCHG AX, DX
+    {3, 3},    // 0x93 XCHG AX, BX
+    {3, 3},    // 0x94 XCHG AX, SP
+    {3, 3},    // 0x95 XCHG AX, BP
+    {3, 3},    // 0x96 XCHG AX, SI
+    {3, 3},    // 0x97 XCHG AX, DI
+    {2, 2},    // 0x98 CBW
+    {5, 5},    // 0x99 CWD
+    {36, 36},  // 0x9A CALL ptr16:16
+    {4, 4},    // 0x9B WAIT
+    {14, 14},  // 0x9C PUSHF
+    {12, 12},  // 0x9D POPF
+    {4, 4},    // 0x9E SAHF
+    {4, 4},    // 0x9F LAHF
+    {10, 10},  // 0xA0 MOV AL, moffs16
+    {14, 14},  // 0xA1 MOV AX, moffs16
+    {10, 10},  // 0xA2 MOV moffs16, AL
+    {14, 14},  // 0xA3 MOV moffs16, AX
+    {18, 18},  // 0xA4 MOVSB
+    {26, 26},  // 0xA5 MOVSW
+    {22, 22},  // 0xA6 CMPSB
+    {30, 30},  // 0xA7 CMPSW
+    {4, 4},    // 0xA8 TEST AL, imm8
+    {4, 4},    // 0xA9 TEST AX, imm16
+    {11, 11},  // 0xAA STOSB
+    {15, 15},  // 0xAB STOSW
+    {12, 12},  // 0xAC LODSB
+    {16, 16},  // 0xAD LODSW
+    {15, 15},  // 0xAE SCASB
+    {19, 19},  // 0xAF SCASW
+    {4, 4},    // 0xB0 MOV AL, imm8
+    {4, 4},    // 0xB1 MOV CL, imm8
+    {4, 4},    // 0xB2 MOV DL, imm8
+    {4, 4},    // 0xB3 MOV BL, imm8
+    {4, 4},    // 0xB4 MOV AH, imm8
+    {4, 4},    // 0xB5 MOV CH, imm8
+    {4, 4},    // 0xB6 MOV DH, imm8
+    {4, 4},    // 0xB7 MOV BH, imm8
+    {4, 4},    // 0xB8 MOV AX, imm16
+    {4, 4},    // 0xB9 MOV CX, imm16
+    {4, 4},    // 0xBA MOV DX, imm16
+    {4, 4},    // 0xBB MOV BX, imm16
+    {4, 4},    // 0xBC MOV SP, imm16
+    {4, 4},    // 0xBD MOV BP, imm16
+    {4, 4},    // 0xBE MOV SI, imm16
+    {4, 4},    // 0xBF MOV DI, imm16
+    {2, 2},    // 0xC0 unsupported
+    {2, 2},    // 0xC1 unsupported
+    {24, 24},  // 0xC2 RET imm16
+    {20, 20},  // 0xC3 RET
+    {24, 24},  // 0xC4 LES r16, m32
+    {24, 24},  // 0xC5 LDS r16, m32
+    {4, 10},   // 0xC6 MOV r/m8, imm8
+    {4, 14},   // 0xC7 MOV r/m16, imm16
+    {2, 2},    // 0xC8 unsupported
+    {2, 2},    // 0xC9 unsupported
+    {33, 33},  // 0xCA RETF imm16
+    {34, 34},  // 0xCB RETF
+    {72, 72},  // 0xCC INT 3
+    {71, 71},  // 0xCD INT imm8
+    {4, 4},    // 0xCE INTO
+    {44, 44},  // 0xCF IRET
+    {2, 15},   // 0xD0 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, 1 (Group 2)
+    {2, 23},   // 0xD1 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, 1 (Group 2)
+    {8, 20},   // 0xD2 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, CL (Group 2)
+    {8, 28},   // 0xD3 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, CL (Group 2)
+    {83, 83},  // 0xD4 AAM
+    {60, 60},  // 0xD5 AAD
+    {2, 2},    // 0xD6 unsupported
+    {11, 11},  // 0xD7 XLAT/XLATB
+    {2, 8},    // 0xD8 ESC instruction 0xD8 for 8087 numeric coprocessor
+    {2, 8},    // 0xD9 ESC instruction 0xD9 for 8087 numeric coprocessor
+    {2, 8},    // 0xDA ESC instruction 0xDA for 8087 numeric coprocessor
+    {2, 8},    // 0xDB ESC instruction 0xDB for 8087 numeric coprocessor
+    {2, 8},    // 0xDC ESC instruction 0xDC for 8087 numeric coprocessor
+    {2, 8},    // 0xDD ESC instruction 0xDD for 8087 numeric coprocessor
+    {2, 8},    // 0xDE ESC instruction 0xDE for 8087 numeric coprocessor
+    {2, 8},    // 0xDF ESC instruction 0xDF for 8087 numeric coprocessor
+    {5, 5},    // 0xE0 LOOPNE/LOOPNZ rel8
+    {6, 6},    // 0xE1 LOOPE/LOOPZ rel8
+    {5, 5},    // 0xE2 LOOP rel8
+    {6, 6},    // 0xE3 JCXZ rel8
+    {10, 10},  // 0xE4 IN AL, imm8
+    {14, 14},  // 0xE5 IN AX, imm8
+    {10, 10},  // 0xE6 OUT imm8, AL
+    {14, 14},  // 0xE7 OUT imm8, AX
+    {23, 23},  // 0xE8 CALL rel16
+    {15, 15},  // 0xE9 JMP rel16
+    {15, 15},  // 0xEA JMP ptr16:16
+    {15, 15},  // 0xEB JMP rel8
+    {8, 8},    // 0xEC IN AL, DX
+    {12, 12},  // 0xED IN AX, DX
+    {8, 8},    // 0xEE OUT DX, AL
+    {12, 12},  // 0xEF OUT DX, AX
+    {2, 2},    // 0xF0 LOCK prefix
+    {2, 2},    // 0xF1 unsupported
+    {2, 2},    // 0xF2 REPNE prefix
+    {2, 2},    // 0xF3 REP/REPE prefix
+    {2, 2},    // 0xF4 HLT
+    {2, 2},    // 0xF5 CMC
+    {5, 11},   // 0xF6 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m8 (Group 3)
+    {5, 15},   // 0xF7 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m16 (Group 3)
+    {2, 2},    // 0xF8 CLC
+    {2, 2},    // 0xF9 STC
+    {2, 2},    // 0xFA CLI
+    {2, 2},    // 0xFB STI
+    {2, 2},    // 0xFC CLD
+    {2, 2},    // 0xFD STD
+    {3, 15},   // 0xFE INC/DEC r/m8 (Group 4)
+    {3, 23},   // 0xFF INC/DEC/CALL/JMP/PUSH r/m16 (Group 5)
+};
+
+// Clock cycles taken by group 3 instructions on byte operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3ByteTimings[8] = {
+    {5, 11},     // TEST r/m8, imm8
+    {5, 11},     // TEST r/m8, imm8
+    {3, 16},     // NOT r/m8
+    {3, 16},     // NEG r/m8
+    {77, 83},    // MUL r/m8
+    {98, 104},   // IMUL r/m8
+    {90, 96},    // DIV r/m8
+    {112, 118},  // IDIV r/m8
+};
+
+// Clock cycles taken by group 3 instructions on word operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3WordTimings[8] = {
+    {5, 15},     // TEST r/m16, imm16
+    {5, 15},     // TEST r/m16, imm16
+    {3, 24},     // NOT r/m16
+    {3, 24},     // NEG r/m16
+    {133, 143},  // MUL r/m16
+    {154, 164},  // IMUL r/m16
+    {162, 172},  // DIV r/m16
+    {184, 194},  // IDIV r/m16
+};
+
+// Clock cycles taken by group 5 instructions, indexed by the REG field of the
+// ModR/M byte.
+static const InstructionTiming kGroup5Timings[8] = {
+    {3, 23},   // INC r/m16
+    {3, 23},   // DEC r/m16
+    {20, 29},  // CALL r/m16
+    {53, 53},  // CALL m16:16
+    {11, 18},  // JMP r/m16
+    {24, 24},  // JMP m16:16
+    {15, 24},  // PUSH r/m16
+    {2, 2},    // unsupported
+};
+
+// Clock cycles taken to compute the effective address of a memory operand,
+// indexed by whether the operand has a displacement and by the R/M field of
+// the ModR/M byte.
+static const uint8_t kEffectiveAddressCycles[2][8] = {
+    // [BX+SI], [BX+DI], [BP+SI], [BP+DI], [SI], [DI], [disp16], [BX]
+    {7, 8, 8, 7, 5, 5, 6, 5},
+    // The same plus an 8-bit or 16-bit displacement, with [BP+disp] for 6.
+    {11, 12, 12, 11, 9, 9, 9, 9},
+};
+
+// Clock cycles taken per iteration of repeated string instructions, indexed by
+// opcode - kOpcodeMOVSB. A repeated string instruction takes
+// kRepeatedStringBaseCycles plus this per iteration.
+static const uint8_t kRepeatedStringCycles[kOpcodeSCASW - kOpcodeMOVSB + 1] = {
+    17, 25,  // MOVSB, MOVSW
+    22, 30,  // CMPSB, CMPSW
+    0,  0,   // TEST AL, imm8 and TEST AX, imm16
+    10, 14,  // STOSB, STOSW
+    13, 17,  // LODSB, LODSW
+    15, 19,  // SCASB, SCASW
+};
+
+// Returns the clock cycles taken by a short branch or INTO when it transfers
+// control, or 0 if the instruction is not one of them.
+static uint8_t GetBranchTakenCycles(uint8_t opcode) {
+  if (opcode >= kOpcodeJO && opcode <= kOpcodeJG) {
+    return kConditionalJumpTakenCycles;
+  }
+  switch (opcode) {
+    case kOpcodeINTO:
+      return 73;
+    case 0xE0:  // LOOPNZ
+      return 19;
+    case 0xE1:  // LOOPZ
+      return 18;
+    case 0xE2:  // LOOP
+      return 17;
+    case 0xE3:  // JCXZ
+      return 18;
+    default:
+      return 0;
+  }
+}
+
+// Returns whether an instruction has a REP or REPNZ prefix.
+static bool IsRepeated(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the clock cycles taken per iteration of a repeated string
+// instruction, or 0 if the instruction is not one.
+static uint8_t GetRepeatedStringCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  if (opcode < kOpcodeMOVSB || opcode > kOpcodeSCASW ||
+      !IsRepeated(instruction)) {
+    return 0;
+  }
+  return kRepeatedStringCycles[opcode - kOpcodeMOVSB];
+}
+
+YAX86_PRIVATE uint32_t GetInstructionBaseClockCycles(
+    const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  InstructionTiming timing = kInstructionTimings[opcode];
+  uint32_t cycles = 0;
+
+  // Segment override and LOCK prefixes take clock cycles of their own.
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] != kPrefixREP &&
+        instruction->prefix[i] != kPrefixREPNZ) {
+      cycles += kPrefixCycles;
+    }
+  }
+
+  // Repeated string instructions may run in several instruction cycles, so
+  // all of their time is counted as variable clock cycles.
+  if (GetRepeatedStringCycles(instruction)) {
+    return cycles;
+  }
+
+  // Instructions in groups take different times depending on the operation.
+  switch (opcode) {
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      // CMP r/m, imm does not write back to memory.
+      if (mod_rm->reg == kModRMRegCMP) {
+        timing.memory_cycles = (opcode & 1) ? kCompareImmediateWordMemoryCycles
+                                            : kCompareImmediateByteMemoryCycles;
+      }
+      break;
+    case 0xF6:
+      timing = kGroup3ByteTimings[mod_rm->reg];
+      break;
+    case 0xF7:
+      timing = kGroup3WordTimings[mod_rm->reg];
+      break;
+    case 0xFF:
+      timing = kGroup5Timings[mod_rm->reg];
+      break;
+    default:
+      break;
+  }
+
+  if (instruction->has_mod_rm && mod_rm->mod != kModRMModRegister) {
+    return cycles + timing.memory_cycles +
+           kEffectiveAddressCycles[mod_rm->mod != 0][mod_rm->rm];
+  }
+  return cycles + timing.register_cycles;
+}
+
+YAX86_PRIVATE bool HasVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  return GetBranchTakenCycles(opcode) || opcode == kOpcodeShiftByteByCL ||
+         opcode == kOpcodeShiftWordByCL || GetRepeatedStringCycles(instruction);
+}
+
+YAX86_PRIVATE uint32_t
+GetBranchTakenVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const uint8_t branch_taken_cycles = GetBranchTakenCycles(opcode);
+  if (!branch_taken_cycles) {
+    return 0;
+  }
+  return branch_taken_cycles - kInstructionTimings[opcode].register_cycles;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint8_t opcode = instruction->opcode;
+
+  // Repeated string instructions take time per iteration run, each of which
+  // decremented CX. A long one runs in several instruction cycles, rewinding
+  // IP to itself until the last, so its base time is only counted once it
+  // completes.
+  const uint8_t repeated_string_cycles = GetRepeatedStringCycles(instruction);
+  if (repeated_string_cycles) {
+    const uint32_t iteration_cycles = (uint16_t)(cx - cpu->registers[kCX]) *
+                                      (uint32_t)repeated_string_cycles;
+    return cpu->registers[kIP] == next_ip
+               ? kRepeatedStringBaseCycles + iteration_cycles
+               : iteration_cycles;
+  }
+
+  // Shifts and rotates by CL take time per bit.
+  if (opcode == kOpcodeShiftByteByCL || opcode == kOpcodeShiftWordByCL) {
+    return kShiftByCLCyclesPerBit * (uint32_t)(cx & 0xFF);
+  }
+
+  // Short branches that were taken, and INTO when it raised an interrupt, take
+  // longer than the table entries.
+  if (opcode == kOpcodeINTO ? cpu->has_pending_interrupt
+                     : cpu->registers[kIP] != next_ip) {
+    return GetBranchTakenVariableClockCycles(instruction);
+  }
+  return 0;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  return GetInstructionBaseClockCycles(instruction) +
+         GetInstructionVariableClockCycles(cpu, instruction, next_ip, cx);
+}
@@ -0,0 +1,40 @@
+#ifndef YAX86_CPU_TIMING_H
+#define YAX86_CPU_TIMING_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed, given IP after the instruction was fetched and CX before it
+// was executed.
+extern uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles an instruction takes regardless of
+// the CPU state, i.e. when it does not branch and shifts by 0 bits. The time
+// of repeated string instructions other than their prefixes is all variable,
+// as they may run over several instruction cycles.
+extern uint32_t GetInstructionBaseClockCycles(const Instruction* instruction);
+
+// Returns whether an instruction may take more clock cycles than its base
+// clock cycles depending on the CPU state.
+extern bool HasVariableClockCycles(const Instruction* instruction);
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed on top of its base clock cycles, with the same arguments as
+// GetInstructionClockCycles().
+extern uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles a short branch takes on top of its
+// base clock cycles when it transfers control, or 0 if the instruction is not
+// a short branch.
+extern uint32_t GetBranchTakenVariableClockCycles(
+    const Instruction* instruction);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_TIMING_H
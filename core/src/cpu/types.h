@@ -84,6 +84,24 @@ enum {
   kNumOperandAddressTypes = kOperandAddressTypeMemory + 1,
 };
 
+// Registers that make up the effective address of a ModR/M memory operand,
+// before adding the displacement.
+typedef struct EffectiveAddressMode {
+  // Base register, masked by base_mask. A mask of 0 means no base register.
+  RegisterIndex base_register_index;
+  uint16_t base_mask;
+  // Index register, masked by index_mask. A mask of 0 means no index register.
+  RegisterIndex index_register_index;
+  uint16_t index_mask;
+  // Segment register used when there is no segment override prefix.
+  RegisterIndex default_segment_register_index;
+} EffectiveAddressMode;
+
+enum {
+  // Number of ModR/M memory addressing modes, indexed by mod * 8 + rm.
+  kNumEffectiveAddressModes = 3 * 8,
+};
+
 // Operand address.
 typedef struct OperandAddress {
   // Type of operand (register or memory).
@@ -128,6 +146,19 @@ typedef struct {
 // Handler function for an opcode.
 typedef ExecuteStatus (*OpcodeHandler)(const InstructionContext* context);
 
+// Addressing mode of an instruction's ModR/M byte.
+typedef enum ModRMClass {
+  // The R/M field refers to a memory operand (mod != 3).
+  kModRMClassMemory = 0,
+  // The R/M field refers to a register operand (mod == 3).
+  kModRMClassRegister,
+} ModRMClass;
+
+enum {
+  // Number of ModR/M addressing mode classes.
+  kNumModRMClasses = kModRMClassRegister + 1,
+};
+
 // An entry in the opcode lookup table.
 typedef struct OpcodeMetadata {
   // Opcode.
@@ -143,6 +174,46 @@ typedef struct OpcodeMetadata {
 
   // Handler function.
   OpcodeHandler handler;
+  // Optional handlers specialized for the instruction's width and the
+  // addressing mode of its ModR/M byte, indexed by ModRMClass. When NULL,
+  // handler is used instead.
+  OpcodeHandler specialized_handlers[kNumModRMClasses];
 } OpcodeMetadata;
 
+// CPU state at the point where a loop block branched back to its own start,
+// used to detect loops that make no progress.
+typedef struct LoopSnapshot {
+  // The loop block, or NULL if no snapshot has been taken.
+  const CPUBlock* block;
+  // Register values.
+  uint16_t registers[kNumRegisters];
+  // Flag values, with the pending flag-producing operation.
+  uint16_t flags;
+  CPULazyFlags lazy_flags;
+  // Value of CPUState.num_unstable_port_reads.
+  uint32_t num_unstable_port_reads;
+} LoopSnapshot;
+
+// Number of 8088 clock cycles taken by an instruction.
+typedef struct InstructionTiming {
+  // Clock cycles with a register operand, or without a ModR/M byte. For
+  // conditional branches, this is the time taken when not branching.
+  uint8_t register_cycles;
+  // Clock cycles with a memory operand, excluding the effective address
+  // calculation.
+  uint8_t memory_cycles;
+} InstructionTiming;
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// JIT types.
+
+// Interpreter callback invoked by native code to execute an instruction that
+// the JIT cannot translate directly. Returns true if native execution of the
+// block should stop after the instruction.
+typedef bool (*JITInstructionHandler)(
+    CPUState* cpu, const CPUBlockInstruction* entry);
+
+#endif  // YAX86_CPU_HAS_JIT
+
 #endif  // YAX86_CPU_TYPES_H
@@ -163,21 +163,56 @@ void DMAWritePort(DMAState* dma, uint16_t port, uint8_t value) {
   }
 }
 
-void DMATransferByte(DMAState* dma, uint8_t channel_index) {
-  if (channel_index >= kDMANumChannels) {
-    return;
-  }
+// Helper to check whether a channel can transfer data: the controller is
+// enabled (bit 2 of command register clear) and the channel is not masked.
+static inline bool DMAIsChannelReady(
+    const DMAState* dma, uint8_t channel_index) {
+  return channel_index < kDMANumChannels &&
+         (dma->command_register & 0x04) == 0 &&
+         (dma->mask_register & (1 << channel_index)) == 0;
+}
+
+// Helper to update the address and count registers after transferring a byte.
+// Returns true if the channel reached its Terminal Count (TC).
+static bool DMAAdvanceChannel(DMAState* dma, uint8_t channel_index) {
   DMAChannelState* channel = &dma->channels[channel_index];
 
-  // Check if controller is disabled (bit 2 of command register).
-  if ((dma->command_register & 0x04) != 0) {
-    return;
+  // Update address register
+  if ((channel->mode & kDMAModeAddressDecrement) == 0) {
+    ++channel->current_address;
+  } else {
+    --channel->current_address;
+  }
+
+  // Update count register and check for Terminal Count (TC)
+  --channel->current_count;
+  if (channel->current_count != 0xFFFF) {
+    return false;
+  }
+
+  // Set TC bit in status register
+  dma->status_register |= (1 << channel_index);
+
+  // Notify the system that TC has been reached.
+  if (dma->config->on_terminal_count) {
+    dma->config->on_terminal_count(dma->config->context, channel_index);
+  }
+
+  // Handle auto-initialization or mask the channel
+  if ((channel->mode & kDMAModeAutoInitialize) != 0) {
+    channel->current_address = channel->base_address;
+    channel->current_count = channel->base_count;
+  } else {
+    dma->mask_register |= (1 << channel_index);
   }
+  return true;
+}
 
-  // If channel is masked, do nothing.
-  if ((dma->mask_register & (1 << channel_index)) != 0) {
+void DMATransferByte(DMAState* dma, uint8_t channel_index) {
+  if (!DMAIsChannelReady(dma, channel_index)) {
     return;
   }
+  DMAChannelState* channel = &dma->channels[channel_index];
 
   // Construct full 20-bit memory address
   const uint32_t address =
@@ -208,33 +243,45 @@ void DMATransferByte(DMAState* dma, uint8_t channel_index) {
       break;
   }
 
+  DMAAdvanceChannel(dma, channel_index);
+}
 
-
-  // Update address register
-  if ((channel->mode & kDMAModeAddressDecrement) == 0) {
-    ++channel->current_address;
-  } else {
-    --channel->current_address;
+uint16_t DMATransferBlock(
+    DMAState* dma, uint8_t channel_index, uint8_t transfer_type,
+    uint8_t* data, uint16_t size) {
+  if (!DMAIsChannelReady(dma, channel_index)) {
+    return 0;
+  }
+  const DMAChannelState* channel = &dma->channels[channel_index];
+  if ((channel->mode & (0x03 << 2)) != transfer_type) {
+    return 0;
   }
 
-  // Update count register and check for Terminal Count (TC)
-  --channel->current_count;
-  if (channel->current_count == 0xFFFF) {
-    // Set TC bit in status register
-    dma->status_register |= (1 << channel_index);
-
-    // Notify the system that TC has been reached.
-    if (dma->config->on_terminal_count) {
-      dma->config->on_terminal_count(dma->config->context, channel_index);
+  uint16_t i = 0;
+  while (i < size) {
+    // Construct full 20-bit memory address
+    const uint32_t address =
+        ((uint32_t)channel->page_register << 16) | channel->current_address;
+    switch (transfer_type) {
+      case kDMAModeTransferTypeWrite:  // Write to memory (buffer -> memory)
+        if (dma->config->write_memory_byte) {
+          dma->config->write_memory_byte(
+              dma->config->context, address, data[i]);
+        }
+        break;
+      case kDMAModeTransferTypeRead:  // Read from memory (memory -> buffer)
+        data[i] = dma->config->read_memory_byte
+                      ? dma->config->read_memory_byte(
+                            dma->config->context, address)
+                      : 0xFF;
+        break;
+      default:
+        break;
     }
-
-    // Handle auto-initialization or mask the channel
-    if ((channel->mode & kDMAModeAutoInitialize) != 0) {
-      channel->current_address = channel->base_address;
-      channel->current_count = channel->base_count;
-    } else {
-      dma->mask_register |= (1 << channel_index);
+    ++i;
+    if (DMAAdvanceChannel(dma, channel_index)) {
+      break;
     }
   }
+  return i;
 }
-
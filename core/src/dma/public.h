@@ -204,5 +204,18 @@ void DMAWritePort(DMAState* dma, uint16_t port, uint8_t value);
 // peripheral.
 void DMATransferByte(DMAState* dma, uint8_t channel_index);
 
+// Executes up to size single-byte transfers for the specified channel in one
+// step, exchanging data with a buffer instead of the device callbacks. If the
+// channel is programmed to write to memory, bytes are taken from data; if it
+// is programmed to read from memory, bytes are stored into data. The channel
+// registers, status register, mask register and terminal count callback end
+// up as if DMATransferByte() had been called once per byte. Stops after the
+// byte that reaches terminal count. Returns the number of bytes transferred,
+// or 0 if the controller is disabled, the channel is masked, or the channel's
+// transfer type is not transfer_type.
+uint16_t DMATransferBlock(
+    DMAState* dma, uint8_t channel_index, uint8_t transfer_type,
+    uint8_t* data, uint16_t size);
+
 #endif  // YAX86_DMA_PUBLIC_H
 
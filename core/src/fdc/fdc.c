@@ -158,6 +158,446 @@ static void FDCFinishReadWrite(
   FDCFinishCommandExecution(fdc);
 }
 
+// Helper to finish a read/write command after the last byte was transferred.
+static void FDCFinishTransfer(FDCState* fdc) {
+  uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
+  uint8_t head_address = (fdc->transfer.head & 0x01);
+  FDCFinishReadWrite(
+      fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+}
+
+// Returns the size of each sector in the current read/write command.
+static uint16_t FDCGetSectorSize(FDCState* fdc) {
+  if (fdc->transfer.sector_size_code == 0) {
+    // DTL
+    return *FDCCommandBufferGet(&fdc->command_buffer, 8);
+  }
+  return 128 << fdc->transfer.sector_size_code;
+}
+
+// Helper to move on to the next sector after the last byte of a sector was
+// transferred. Returns false and sets tc_received if the transfer ends here.
+static bool FDCAdvanceSector(FDCState* fdc, uint8_t drive_index) {
+  if (fdc->transfer.sector >= fdc->transfer.eot) {
+    // End of Track reached.
+    if (!fdc->transfer.multi_track || (fdc->transfer.head & 1) != 0) {
+      // Standard termination (MT=0 or already on Head 1).
+      // Increment sector so result phase reports the *next* logical sector.
+      fdc->transfer.sector++;
+      fdc->transfer.tc_received = true;
+      return false;
+    }
+    // Multi-Track rollover: Side 0 -> Side 1.
+    fdc->transfer.head ^= 1;   // Flip to Head 1
+    fdc->transfer.sector = 1;  // Reset to Sector 1
+  } else {
+    // Move to next sector.
+    fdc->transfer.sector++;
+  }
+  fdc->transfer.sector_byte_index = 0;
+
+  // Recompute offset for new head/sector.
+  FDCDriveState* drive = &fdc->drives[drive_index];
+  fdc->transfer.current_offset = FDCComputeOffset(
+      *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
+      fdc->transfer.sector, 0);
+  if (fdc->transfer.current_offset == kFDCInvalidOffset) {
+    // Should not happen if EOT is correct, but if we ran off the end of the
+    // image despite EOT, terminate.
+    fdc->transfer.tc_received = true;
+    return false;
+  }
+  return true;
+}
+
+// Helper to check whether the rest of a sector can be transferred in one step
+// with the transfer_dma_block callback.
+static inline bool FDCCanTransferBlock(FDCState* fdc, uint16_t sector_size) {
+  return fdc->config && fdc->config->transfer_dma_block &&
+         sector_size <= kFDCBlockTransferBufferSize;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// with the get_image_sector callback. Returns NULL if not available.
+static inline uint8_t* FDCGetImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size,
+    bool writable) {
+  if (!fdc->config || !fdc->config->get_image_sector) {
+    return NULL;
+  }
+  return fdc->config->get_image_sector(
+      fdc->config->context, drive_index, offset, size, writable);
+}
+
+// Helper to check whether size bytes of a disk image starting at offset can be
+// written, either in place through get_image_sector or with a callback to
+// write to the image.
+static bool FDCCanWriteImage(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  if (fdc->config &&
+      (fdc->config->write_image_bytes || fdc->config->write_image_byte)) {
+    return true;
+  }
+  return FDCGetImageSector(fdc, drive_index, offset, size, true) != NULL;
+}
+
+// Helper to write bytes directly to a disk image, bypassing the write cache.
+// Returns false if the bytes could not be written.
+static bool FDCWriteImageDirect(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  uint8_t* sector = FDCGetImageSector(fdc, drive_index, offset, size, true);
+  if (sector) {
+    for (uint16_t i = 0; i < size; ++i) {
+      sector[i] = data[i];
+    }
+  } else if (fdc->config && fdc->config->write_image_bytes) {
+    fdc->config->write_image_bytes(
+        fdc->config->context, drive_index, offset, data, size);
+  } else if (fdc->config && fdc->config->write_image_byte) {
+    for (uint16_t i = 0; i < size; ++i) {
+      fdc->config->write_image_byte(
+          fdc->config->context, drive_index, offset + i, data[i]);
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Helper to get the sector size of a drive's disk if its sectors can be held
+// in the write cache, or 0 if there is no write cache or they cannot.
+static uint16_t FDCGetWriteCacheSectorSize(FDCState* fdc, uint8_t drive_index) {
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  if (!fdc->config || !fdc->config->write_cache || !format ||
+      format->sector_size == 0 ||
+      format->sector_size > kFDCWriteCacheSectorSize) {
+    return 0;
+  }
+  return format->sector_size;
+}
+
+// Helper to find the pending write of a sector starting at offset. Returns
+// NULL if the sector has no pending write.
+static FDCCachedSector* FDCFindCachedSector(
+    FDCWriteCache* cache, uint8_t drive_index, uint32_t offset) {
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    FDCCachedSector* sector = &cache->sectors[i];
+    if (sector->dirty && sector->drive == drive_index &&
+        sector->offset == offset) {
+      return sector;
+    }
+  }
+  return NULL;
+}
+
+// Helper to copy pending writes overlapping size bytes of a disk image starting
+// at offset into data. Returns whether any pending writes overlap.
+static bool FDCApplyPendingWrites(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint8_t* data,
+    uint16_t size) {
+  FDCWriteCache* cache = fdc->config ? fdc->config->write_cache : NULL;
+  if (!cache) {
+    return false;
+  }
+  bool has_pending_writes = false;
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    const FDCCachedSector* sector = &cache->sectors[i];
+    if (!sector->dirty || sector->drive != drive_index ||
+        sector->offset >= offset + size ||
+        sector->offset + sector->size <= offset) {
+      continue;
+    }
+    has_pending_writes = true;
+    if (!data) {
+      continue;
+    }
+    for (uint16_t j = 0; j < sector->size; ++j) {
+      const uint32_t byte_offset = sector->offset + j;
+      if (byte_offset >= offset && byte_offset < offset + size) {
+        data[byte_offset - offset] = sector->data[j];
+      }
+    }
+  }
+  return has_pending_writes;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// from a pending write. Returns NULL if the bytes are not all within a single
+// sector with a pending write.
+static uint8_t* FDCGetPendingWrite(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  const uint16_t sector_size = FDCGetWriteCacheSectorSize(fdc, drive_index);
+  if (sector_size == 0) {
+    return NULL;
+  }
+  const uint32_t sector_offset = offset - offset % sector_size;
+  if (offset + size > sector_offset + sector_size) {
+    return NULL;
+  }
+  FDCCachedSector* sector =
+      FDCFindCachedSector(fdc->config->write_cache, drive_index, sector_offset);
+  return sector ? sector->data + (offset - sector_offset) : NULL;
+}
+
+// Helper to read a track of a disk image into a track cache entry, including
+// pending writes. Returns false if the track could not be read.
+static bool FDCFillCachedTrack(
+    FDCState* fdc, uint8_t drive_index, FDCCachedTrack* track) {
+  if (fdc->config->read_image_bytes) {
+    if (!fdc->config->read_image_bytes(
+            fdc->config->context, drive_index, track->offset, track->data,
+            track->size)) {
+      return false;
+    }
+  } else if (fdc->config->read_image_byte) {
+    for (uint16_t i = 0; i < track->size; ++i) {
+      track->data[i] = fdc->config->read_image_byte(
+          fdc->config->context, drive_index, track->offset + i);
+    }
+  } else {
+    return false;
+  }
+  FDCApplyPendingWrites(
+      fdc, drive_index, track->offset, track->data, track->size);
+  return true;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// from the track cache, reading the track into the cache if needed. Returns
+// NULL if there is no track cache, or if the bytes are not within a single
+// track that fits in the cache.
+static uint8_t* FDCGetCachedImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  FDCTrackCache* cache = fdc->config ? fdc->config->track_cache : NULL;
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  if (!cache || !format) {
+    return NULL;
+  }
+  const uint32_t track_size =
+      (uint32_t)format->num_sectors_per_track * format->sector_size;
+  if (track_size == 0 || track_size > kFDCTrackCacheSize) {
+    return NULL;
+  }
+  const uint32_t track_offset = offset - offset % track_size;
+  if (offset + size > track_offset + track_size) {
+    return NULL;
+  }
+
+  FDCCachedTrack* track = &cache->tracks[drive_index];
+  if (track->valid && track->offset == track_offset &&
+      track->size == track_size) {
+    ++cache->num_hits;
+  } else {
+    track->offset = track_offset;
+    track->size = (uint16_t)track_size;
+    track->valid = FDCFillCachedTrack(fdc, drive_index, track);
+    if (!track->valid) {
+      return NULL;
+    }
+    ++cache->num_fills;
+  }
+  return track->data + (offset - track_offset);
+}
+
+// Helper to apply a write to a disk image to the track cache.
+static void FDCUpdateCachedTrack(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  FDCTrackCache* cache = fdc->config ? fdc->config->track_cache : NULL;
+  if (!cache) {
+    return;
+  }
+  FDCCachedTrack* track = &cache->tracks[drive_index];
+  if (!track->valid) {
+    return;
+  }
+  for (uint16_t i = 0; i < size; ++i) {
+    if (offset + i >= track->offset &&
+        offset + i < track->offset + track->size) {
+      track->data[offset + i - track->offset] = data[i];
+    }
+  }
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset for
+// reading, from pending writes, get_image_sector or the track cache. Returns
+// NULL if not available, in which case the bytes must be read one at a time
+// with FDCReadImageByte().
+static uint8_t* FDCGetReadableImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  uint8_t* sector = FDCGetPendingWrite(fdc, drive_index, offset, size);
+  if (sector) {
+    return sector;
+  }
+  if (FDCApplyPendingWrites(fdc, drive_index, offset, NULL, size)) {
+    // Some but not all of the bytes have pending writes.
+    return NULL;
+  }
+  sector = FDCGetImageSector(fdc, drive_index, offset, size, false);
+  if (sector) {
+    return sector;
+  }
+  return FDCGetCachedImageSector(fdc, drive_index, offset, size);
+}
+
+// Helper to read a byte from a disk image.
+static uint8_t FDCReadImageByte(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset) {
+  const uint8_t* sector =
+      FDCGetReadableImageSector(fdc, drive_index, offset, 1);
+  if (sector) {
+    return *sector;
+  }
+  if (fdc->config && fdc->config->read_image_byte) {
+    return fdc->config->read_image_byte(
+        fdc->config->context, drive_index, offset);
+  }
+  return 0;
+}
+
+// Helper to write the pending writes of a drive to its disk image. Pending
+// writes to adjacent sectors of the same track are written in one step.
+// Returns false if any of them could not be written, in which case they stay
+// in the cache.
+static bool FDCFlushPendingWrites(FDCState* fdc, uint8_t drive_index) {
+  FDCWriteCache* cache = fdc->config ? fdc->config->write_cache : NULL;
+  if (!cache) {
+    return true;
+  }
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  bool has_flushed = false;
+  bool success = true;
+  // Pending writes below this offset have been flushed or failed to flush.
+  uint32_t min_offset = 0;
+  for (;;) {
+    // Find the pending write with the lowest offset.
+    FDCCachedSector* first = NULL;
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      FDCCachedSector* sector = &cache->sectors[i];
+      if (sector->dirty && sector->drive == drive_index &&
+          sector->offset >= min_offset &&
+          (!first || sector->offset < first->offset)) {
+        first = sector;
+      }
+    }
+    if (!first) {
+      break;
+    }
+
+    // Gather the pending writes to the following sectors of the same track.
+    const uint32_t track_size =
+        format ? (uint32_t)format->num_sectors_per_track * format->sector_size
+               : first->size;
+    const uint32_t track_end =
+        first->offset - first->offset % track_size + track_size;
+    const uint32_t offset = first->offset;
+    uint16_t size = 0;
+    FDCCachedSector* sector = first;
+    while (sector && offset + size + sector->size <= track_end &&
+           size + sector->size <= kFDCTrackCacheSize) {
+      for (uint16_t i = 0; i < sector->size; ++i) {
+        cache->flush_buffer[size + i] = sector->data[i];
+      }
+      size += sector->size;
+      sector = FDCFindCachedSector(cache, drive_index, offset + size);
+    }
+    min_offset = offset + size;
+
+    if (!FDCWriteImageDirect(
+            fdc, drive_index, offset, cache->flush_buffer, size)) {
+      success = false;
+      continue;
+    }
+    for (uint32_t i = offset; i < offset + size;) {
+      FDCCachedSector* flushed = FDCFindCachedSector(cache, drive_index, i);
+      flushed->dirty = false;
+      i += flushed->size;
+    }
+    ++cache->num_image_writes;
+    cache->num_coalesced_bytes += size - first->size;
+    has_flushed = true;
+  }
+  if (has_flushed) {
+    ++cache->num_flushes;
+  }
+  return success;
+}
+
+// Helper to get a free write cache entry, flushing pending writes if the
+// cache is full. Returns NULL if none of the pending writes could be written.
+static FDCCachedSector* FDCAllocateCachedSector(FDCState* fdc) {
+  FDCWriteCache* cache = fdc->config->write_cache;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      if (!cache->sectors[i].dirty) {
+        return &cache->sectors[i];
+      }
+    }
+    if (pass == 0) {
+      FDCFlush(fdc);
+    }
+  }
+  return NULL;
+}
+
+// Helper to write bytes to a disk image, via the write cache if set. Returns
+// false if the bytes, or pending writes flushed to make room for them, could
+// not be written.
+static bool FDCWriteImage(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  const uint16_t sector_size = FDCGetWriteCacheSectorSize(fdc, drive_index);
+  if (sector_size == 0) {
+    FDCUpdateCachedTrack(fdc, drive_index, offset, data, size);
+    return FDCWriteImageDirect(fdc, drive_index, offset, data, size);
+  }
+  // Writes held in the cache could never be flushed.
+  if (!FDCCanWriteImage(fdc, drive_index, offset, size)) {
+    return false;
+  }
+
+  FDCWriteCache* cache = fdc->config->write_cache;
+  for (uint16_t i = 0; i < size;) {
+    const uint32_t sector_offset = (offset + i) - (offset + i) % sector_size;
+    uint16_t num_bytes = (uint16_t)(sector_offset + sector_size - offset - i);
+    if (num_bytes > size - i) {
+      num_bytes = size - i;
+    }
+    FDCCachedSector* sector =
+        FDCFindCachedSector(cache, drive_index, sector_offset);
+    if (!sector) {
+      sector = FDCAllocateCachedSector(fdc);
+      if (!sector) {
+        return false;
+      }
+      if (num_bytes < sector_size) {
+        // Read the rest of the sector from the image.
+        const uint8_t* image_sector = FDCGetReadableImageSector(
+            fdc, drive_index, sector_offset, sector_size);
+        for (uint16_t j = 0; j < sector_size; ++j) {
+          sector->data[j] =
+              image_sector ? image_sector[j]
+                           : FDCReadImageByte(
+                                 fdc, drive_index, sector_offset + j);
+        }
+      }
+      sector->dirty = true;
+      sector->drive = drive_index;
+      sector->offset = sector_offset;
+      sector->size = sector_size;
+    }
+    for (uint16_t j = 0; j < num_bytes; ++j) {
+      sector->data[offset + i - sector_offset + j] = data[i + j];
+    }
+    i += num_bytes;
+  }
+  // Reading the rest of a partially written sector may have filled the track
+  // cache, so the track cache is updated last.
+  FDCUpdateCachedTrack(fdc, drive_index, offset, data, size);
+  return true;
+}
+
 // Handler for Write Data command.
 static void FDCHandleWriteData(FDCState* fdc) {
   if (fdc->current_command_ticks == 0) {
@@ -212,13 +652,10 @@ static void FDCHandleWriteData(FDCState* fdc) {
 
   // Execution Loop.
 
-  // Check for Terminal Count (TC).
-  if (fdc->transfer.tc_received) {
+  // Check for Terminal Count (TC) while waiting for the next byte.
+  if (fdc->transfer.tc_received && fdc->transfer.dma_request_active) {
     // Transfer complete.
-    uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-    uint8_t head_address = (fdc->transfer.head & 0x01);
-    FDCFinishReadWrite(
-        fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+    FDCFinishTransfer(fdc);
     return;
   }
 
@@ -227,75 +664,113 @@ static void FDCHandleWriteData(FDCState* fdc) {
     return;
   }
 
-  // Data has arrived in data_register. Write it to image.
   uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-  if (fdc->config && fdc->config->write_image_byte) {
-    fdc->config->write_image_byte(
-        fdc->config->context, drive_index, fdc->transfer.current_offset,
-        fdc->transfer.data_register);
-  }
+  const uint16_t sector_size = FDCGetSectorSize(fdc);
+  for (;;) {
+    // Data has arrived in data_register. In block transfer mode, fetch the
+    // rest of the sector along with it, directly into the image if possible.
+    uint16_t size = 1;
+    if (FDCCanTransferBlock(fdc, sector_size) && !fdc->transfer.tc_received) {
+      size = sector_size - fdc->transfer.sector_byte_index;
+    }
+    uint8_t* sector =
+        (size > 1 && !fdc->config->write_cache)
+            ? FDCGetImageSector(
+                  fdc, drive_index, fdc->transfer.current_offset, size, true)
+            : NULL;
+    uint8_t* data = sector ? sector : fdc->transfer.block_buffer;
+    uint16_t num_bytes = 1;
+    data[0] = fdc->transfer.data_register;
+    if (size > 1) {
+      num_bytes += fdc->config->transfer_dma_block(
+          fdc->config->context, data + 1, size - 1, false);
+      fdc->transfer.data_register = data[num_bytes - 1];
+    }
 
-  // Advance pointers.
-  fdc->transfer.current_offset++;
-  fdc->transfer.sector_byte_index++;
+    // Write data to image.
+    if (sector) {
+      FDCUpdateCachedTrack(
+          fdc, drive_index, fdc->transfer.current_offset, data, num_bytes);
+    } else if (!FDCWriteImage(
+                   fdc, drive_index, fdc->transfer.current_offset, data,
+                   num_bytes)) {
+      // Write fault.
+      FDCFinishReadWrite(
+          fdc,
+          kFDCST0AbnormalTermination | kFDCST0EquipmentCheck |
+              (fdc->transfer.head & 0x01) << 2 | drive_index,
+          0, 0);
+      return;
+    }
 
-  // Calculate sector size.
-  uint16_t sector_size;
-  uint8_t dtl = *FDCCommandBufferGet(&fdc->command_buffer, 8);
-  if (fdc->transfer.sector_size_code == 0) {
-    sector_size = dtl;
-  } else {
-    sector_size = 128 << fdc->transfer.sector_size_code;
+    // Advance pointers.
+    fdc->transfer.current_offset += num_bytes;
+    fdc->transfer.sector_byte_index += num_bytes;
+
+    // Check for sector boundary, and for the last byte before TC.
+    if ((fdc->transfer.sector_byte_index >= sector_size &&
+         !FDCAdvanceSector(fdc, drive_index)) ||
+        fdc->transfer.tc_received) {
+      FDCFinishTransfer(fdc);
+      return;
+    }
+
+    // Request next byte via DMA.
+    fdc->transfer.dma_request_active = true;
+    if (fdc->config && fdc->config->request_dma) {
+      fdc->config->request_dma(fdc->config->context);
+    }
+
+    // Without block transfers, only one byte is written per tick.
+    if (!FDCCanTransferBlock(fdc, sector_size) ||
+        fdc->transfer.dma_request_active) {
+      return;
+    }
   }
+}
 
-  // Check for sector boundary.
-  if (fdc->transfer.sector_byte_index >= sector_size) {
-    // Sector done.
-    if (fdc->transfer.sector >= fdc->transfer.eot) {
-      // End of Track reached.
-      if (fdc->transfer.multi_track && (fdc->transfer.head & 1) == 0) {
-        // Multi-Track rollover.
-        fdc->transfer.head ^= 1;
-        fdc->transfer.sector = 1;
-        fdc->transfer.sector_byte_index = 0;
-
-        // Recompute offset.
-        FDCDriveState* drive = &fdc->drives[drive_index];
-        fdc->transfer.current_offset = FDCComputeOffset(
-            *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-            fdc->transfer.sector, 0);
-
-        if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-          fdc->transfer.tc_received = true;
-          return;  // Stop here, don't request next byte.
-        }
-      } else {
-        // Terminate.
-        fdc->transfer.sector++;
-        fdc->transfer.tc_received = true;
-        return;  // Stop here.
-      }
-    } else {
-      // Next sector.
-      fdc->transfer.sector++;
-      fdc->transfer.sector_byte_index = 0;
-      FDCDriveState* drive = &fdc->drives[drive_index];
-      fdc->transfer.current_offset = FDCComputeOffset(
-          *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-          fdc->transfer.sector, 0);
-
-      if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-        fdc->transfer.tc_received = true;
-        return;
+// Helper to transfer the rest of the current sector and the following sectors
+// of a Read Data command in one step with the transfer_dma_block callback,
+// until TC or the end of the transfer. Returns false if DMA was not ready for a
+// block transfer, in which case nothing was transferred.
+static bool FDCReadDataBlocks(
+    FDCState* fdc, uint8_t drive_index, uint16_t sector_size) {
+  if (!FDCCanTransferBlock(fdc, sector_size)) {
+    return false;
+  }
+  bool has_transferred = false;
+  while (!fdc->transfer.tc_received) {
+    // Read the rest of the sector from the image, directly if possible.
+    const uint16_t size = sector_size - fdc->transfer.sector_byte_index;
+    uint8_t* data = FDCGetReadableImageSector(
+        fdc, drive_index, fdc->transfer.current_offset, size);
+    if (!data) {
+      data = fdc->transfer.block_buffer;
+      for (uint16_t i = 0; i < size; ++i) {
+        data[i] = FDCReadImageByte(
+            fdc, drive_index, fdc->transfer.current_offset + i);
       }
     }
-  }
 
-  // Request next byte via DMA.
-  fdc->transfer.dma_request_active = true;
-  if (fdc->config && fdc->config->request_dma) {
-    fdc->config->request_dma(fdc->config->context);
+    // Transfer it to memory. This stops early on TC.
+    const uint16_t num_bytes = fdc->config->transfer_dma_block(
+        fdc->config->context, data, size, true);
+    if (num_bytes == 0) {
+      break;
+    }
+    has_transferred = true;
+    fdc->transfer.data_register = data[num_bytes - 1];
+
+    // Advance pointers.
+    fdc->transfer.current_offset += num_bytes;
+    fdc->transfer.sector_byte_index += num_bytes;
+
+    // Check for sector boundary.
+    if (fdc->transfer.sector_byte_index >= sector_size) {
+      FDCAdvanceSector(fdc, drive_index);
+    }
   }
+  return has_transferred;
 }
 
 // Handler for Read Data command.
@@ -355,10 +830,7 @@ static void FDCHandleReadData(FDCState* fdc) {
   // Check for Terminal Count (TC).
   if (fdc->transfer.tc_received) {
     // Transfer complete.
-    uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-    uint8_t head_address = (fdc->transfer.head & 0x01);
-    FDCFinishReadWrite(
-        fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+    FDCFinishTransfer(fdc);
     return;
   }
 
@@ -367,15 +839,16 @@ static void FDCHandleReadData(FDCState* fdc) {
     return;
   }
 
-  // Read next byte.
   uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-  if (fdc->config && fdc->config->read_image_byte) {
-    fdc->transfer.data_register = fdc->config->read_image_byte(
-        fdc->config->context, drive_index, fdc->transfer.current_offset);
-  } else {
-    fdc->transfer.data_register = 0;
+  const uint16_t sector_size = FDCGetSectorSize(fdc);
+  if (FDCReadDataBlocks(fdc, drive_index, sector_size)) {
+    return;
   }
 
+  // Read next byte.
+  fdc->transfer.data_register =
+      FDCReadImageByte(fdc, drive_index, fdc->transfer.current_offset);
+
   // Advance pointers.
   fdc->transfer.current_offset++;
   fdc->transfer.sector_byte_index++;
@@ -386,57 +859,9 @@ static void FDCHandleReadData(FDCState* fdc) {
     fdc->config->request_dma(fdc->config->context);
   }
 
-  // Calculate sector size again for boundary check.
-  uint16_t sector_size;
-  uint8_t dtl = *FDCCommandBufferGet(&fdc->command_buffer, 8);
-  if (fdc->transfer.sector_size_code == 0) {
-    sector_size = dtl;
-  } else {
-    sector_size = 128 << fdc->transfer.sector_size_code;
-  }
-
   // Check for sector boundary.
   if (fdc->transfer.sector_byte_index >= sector_size) {
-    // Sector done.
-    if (fdc->transfer.sector >= fdc->transfer.eot) {
-      // End of Track reached.
-      if (fdc->transfer.multi_track && (fdc->transfer.head & 1) == 0) {
-        // Multi-Track rollover: Side 0 -> Side 1.
-        fdc->transfer.head ^= 1;   // Flip to Head 1
-        fdc->transfer.sector = 1;  // Reset to Sector 1
-        fdc->transfer.sector_byte_index = 0;
-
-        // Recompute offset for new head/sector.
-        FDCDriveState* drive = &fdc->drives[drive_index];
-        fdc->transfer.current_offset = FDCComputeOffset(
-            *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-            fdc->transfer.sector, 0);
-
-        if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-          fdc->transfer.tc_received = true;
-        }
-      } else {
-        // Standard termination (MT=0 or already on Head 1).
-        // Increment sector so result phase reports the *next* logical sector.
-        fdc->transfer.sector++;
-        fdc->transfer.tc_received = true;
-      }
-    } else {
-      // Move to next sector.
-      fdc->transfer.sector++;
-      fdc->transfer.sector_byte_index = 0;
-      // Recompute offset for new sector.
-      FDCDriveState* drive = &fdc->drives[drive_index];
-      fdc->transfer.current_offset = FDCComputeOffset(
-          *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-          fdc->transfer.sector, 0);
-
-      if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-        // Should not happen if EOT is correct, but if we ran off the end
-        // of the image despite EOT, terminate.
-        fdc->transfer.tc_received = true;
-      }
-    }
+    FDCAdvanceSector(fdc, drive_index);
   }
 }
 
@@ -541,6 +966,38 @@ void FDCInit(FDCState* fdc, FDCConfig* config) {
   fdc->config = config;
 }
 
+void FDCInitTrackCache(FDCTrackCache* cache) {
+  for (int i = 0; i < kFDCNumDrives; ++i) {
+    cache->tracks[i].valid = false;
+  }
+  cache->num_hits = 0;
+  cache->num_fills = 0;
+}
+
+void FDCInitWriteCache(FDCWriteCache* cache) {
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    cache->sectors[i].dirty = false;
+  }
+  cache->num_flushes = 0;
+  cache->num_image_writes = 0;
+  cache->num_coalesced_bytes = 0;
+}
+
+// Drop a drive's cached track and pending writes after its disk was changed.
+static void FDCInvalidateCaches(FDCState* fdc, uint8_t drive) {
+  if (fdc->config && fdc->config->track_cache) {
+    fdc->config->track_cache->tracks[drive].valid = false;
+  }
+  if (fdc->config && fdc->config->write_cache) {
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      FDCCachedSector* sector = &fdc->config->write_cache->sectors[i];
+      if (sector->drive == drive) {
+        sector->dirty = false;
+      }
+    }
+  }
+}
+
 // Looks up command metadata by opcode. Returns NULL if not found. This is a
 // linear search, but the command table is small enough that this is fine.
 static const FDCCommandMetadata* FDCFindCommandMetadata(uint8_t opcode) {
@@ -732,24 +1189,41 @@ void FDCWritePort(FDCState* fdc, uint16_t port, uint8_t value) {
 
 void FDCHandleTC(FDCState* fdc) { fdc->transfer.tc_received = true; }
 
-void FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format) {
+bool FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format) {
   if (drive >= kFDCNumDrives) {
-    return;
+    return true;
   }
   FDCDriveState* drive_state = &fdc->drives[drive];
+  const bool success =
+      !drive_state->present || FDCFlushPendingWrites(fdc, drive);
   drive_state->present = true;
   drive_state->format = format;
   drive_state->head = 0;
   drive_state->track = 0;
+  FDCInvalidateCaches(fdc, drive);
+  return success;
 }
 
-void FDCEjectDisk(FDCState* fdc, uint8_t drive) {
+bool FDCEjectDisk(FDCState* fdc, uint8_t drive) {
   if (drive >= kFDCNumDrives) {
-    return;
+    return true;
   }
+  const bool success = FDCFlushPendingWrites(fdc, drive);
   FDCDriveState* drive_state = &fdc->drives[drive];
   drive_state->present = false;
   drive_state->format = NULL;
+  FDCInvalidateCaches(fdc, drive);
+  return success;
+}
+
+bool FDCFlush(FDCState* fdc) {
+  bool success = true;
+  for (uint8_t drive = 0; drive < kFDCNumDrives; ++drive) {
+    if (!FDCFlushPendingWrites(fdc, drive)) {
+      success = false;
+    }
+  }
+  return success;
 }
 
 void FDCTick(FDCState* fdc) {
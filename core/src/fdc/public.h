@@ -34,6 +34,8 @@ static const FDCDiskFormat kFDCFormat360KB = {
 };
 
 struct FDCState;
+struct FDCTrackCache;
+struct FDCWriteCache;
 
 enum {
   // Number of floppy drives supported by the FDC.
@@ -42,6 +44,16 @@ enum {
   kFDCCommandBufferSize = 9,
   // Maximum size of a command result.
   kFDCResultBufferSize = 7,
+  // Maximum sector size transferred with the transfer_dma_block callback.
+  kFDCBlockTransferBufferSize = 512,
+  // Maximum size of a track held in an FDCTrackCache, enough for a track of
+  // kFDCFormat360KB.
+  kFDCTrackCacheSize = 9 * 512,
+  // Number of sectors held in an FDCWriteCache, enough for both tracks of a
+  // cylinder of kFDCFormat360KB.
+  kFDCWriteCacheNumSectors = 18,
+  // Maximum size of a sector held in an FDCWriteCache.
+  kFDCWriteCacheSectorSize = 512,
 };
 
 // Command phases of the FDC.
@@ -202,7 +214,10 @@ typedef struct FDCConfig {
       // byte offset within the image
       uint32_t offset);
 
-  // Callback to write a byte to a floppy image.
+  // Callback to write a byte to a floppy image. If neither this nor
+  // write_image_bytes is set and get_image_sector does not return the bytes as
+  // writable, Write Data commands fail with Equipment Check set in ST0 (a
+  // write fault).
   void (*write_image_byte)(
       void* context,
       // 0 to kFDCNumDrives-1
@@ -211,8 +226,143 @@ typedef struct FDCConfig {
       uint32_t offset,
       // byte value to write
       uint8_t value);
+
+  // Optional callback to get a pointer to size bytes of a floppy image
+  // starting at offset, so that sectors can be read or written directly
+  // instead of one byte at a time through read_image_byte and
+  // write_image_byte. writable is true if the FDC will write to the bytes.
+  // The pointer is only used until the FDC call that requested it returns.
+  // Returns NULL if the bytes are not available, for example if they are out
+  // of range or the image is read-only, in which case the FDC falls back to
+  // read_image_byte and write_image_byte.
+  uint8_t* (*get_image_sector)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // number of bytes starting at offset
+      uint16_t size,
+      // whether the bytes will be written
+      bool writable);
+
+  // Optional callback to read size bytes of a floppy image starting at offset
+  // into data in one call. Used to fill track_cache. Returns false on error.
+  bool (*read_image_bytes)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // buffer to read into
+      uint8_t* data,
+      // number of bytes to read
+      uint16_t size);
+
+  // Optional callback to write size bytes from data to a floppy image
+  // starting at offset in one call. Used to flush write_cache.
+  void (*write_image_bytes)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // bytes to write
+      const uint8_t* data,
+      // number of bytes to write
+      uint16_t size);
+
+  // Optional cache of the last track read from each drive. If set, the cache
+  // must be initialized with FDCInitTrackCache() before use. Reads that
+  // get_image_sector does not serve fetch the whole track with
+  // read_image_bytes, or read_image_byte if not set, and later reads from the
+  // same track are served from the cache.
+  struct FDCTrackCache* track_cache;
+
+  // Optional write-back cache of sectors written to images. If set, the cache
+  // must be initialized with FDCInitWriteCache() before use. Writes are held
+  // in the cache until FDCFlush() is called, the disk is ejected, or the cache
+  // is full, and are then written with get_image_sector, write_image_bytes or
+  // write_image_byte, in one call per run of adjacent sectors on a track.
+  struct FDCWriteCache* write_cache;
+
+  // Optional callback to transfer a block of bytes to or from memory via DMA
+  // in one step, instead of one byte per request_dma call. If to_memory is
+  // true, transfers data to memory; otherwise, fills data from memory.
+  // Returns the number of bytes transferred, which is less than size if the
+  // DMA controller reached the terminal count (and called FDCHandleTC), or 0
+  // if the DMA channel is not ready, in which case the FDC falls back to
+  // transferring one byte at a time.
+  uint16_t (*transfer_dma_block)(
+      void* context, uint8_t* data, uint16_t size, bool to_memory);
 } FDCConfig;
 
+// A track held in an FDCTrackCache.
+typedef struct FDCCachedTrack {
+  // Whether data holds a track.
+  bool valid;
+  // Byte offset of the track within the image.
+  uint32_t offset;
+  // Size of the track in bytes.
+  uint16_t size;
+  // Contents of the track.
+  uint8_t data[kFDCTrackCacheSize];
+} FDCCachedTrack;
+
+// A read-ahead cache holding the last track read from each drive, so that
+// reading the sectors of a track takes one read from the image instead of one
+// per byte. Writes through the FDC are applied to both the image and the
+// cache. Images modified outside the FDC must be reported by re-initializing
+// the cache with FDCInitTrackCache().
+typedef struct FDCTrackCache {
+  // Cached track of each drive.
+  FDCCachedTrack tracks[kFDCNumDrives];
+
+  // Number of reads served from the cache.
+  uint32_t num_hits;
+  // Number of tracks read from images into the cache.
+  uint32_t num_fills;
+} FDCTrackCache;
+
+// Initialize or reset a track cache.
+void FDCInitTrackCache(FDCTrackCache* cache);
+
+// A sector held in an FDCWriteCache.
+typedef struct FDCCachedSector {
+  // Whether data holds a write that has not been written to the image yet.
+  bool dirty;
+  // Drive whose image the sector belongs to.
+  uint8_t drive;
+  // Byte offset of the sector within the image.
+  uint32_t offset;
+  // Size of the sector in bytes.
+  uint16_t size;
+  // Contents of the sector.
+  uint8_t data[kFDCWriteCacheSectorSize];
+} FDCCachedSector;
+
+// A write-back cache of sectors written to images, so that writes reach the
+// image in a few large writes instead of one write per byte. Reads through the
+// FDC see pending writes. Pending writes are written to the image when the disk
+// is ejected or another disk is inserted into its drive.
+typedef struct FDCWriteCache {
+  // Cached sectors.
+  FDCCachedSector sectors[kFDCWriteCacheNumSectors];
+  // Buffer for a run of adjacent sectors being written to an image.
+  uint8_t flush_buffer[kFDCTrackCacheSize];
+
+  // Number of times pending writes of a drive were flushed.
+  uint32_t num_flushes;
+  // Number of writes to images.
+  uint32_t num_image_writes;
+  // Number of bytes written to images together with a preceding sector,
+  // instead of in a write of their own.
+  uint32_t num_coalesced_bytes;
+} FDCWriteCache;
+
+// Initialize or reset a write cache, dropping any pending writes.
+void FDCInitWriteCache(FDCWriteCache* cache);
+
 STATIC_VECTOR_TYPE(FDCCommandBuffer, uint8_t, kFDCCommandBufferSize)
 STATIC_VECTOR_TYPE(FDCResultBuffer, uint8_t, kFDCResultBufferSize)
 
@@ -265,6 +415,8 @@ typedef struct FDCState {
     uint8_t data_register;  // Buffer for the byte currently being transferred.
     bool dma_request_active;  // DREQ is asserted, waiting for DMA access.
     bool tc_received;         // TC (Terminal Count) signal received from DMA.
+    // Buffer for the sector being transferred with transfer_dma_block.
+    uint8_t block_buffer[kFDCBlockTransferBufferSize];
   } transfer;
 } FDCState;
 
@@ -281,11 +433,23 @@ void FDCWritePort(FDCState* fdc, uint16_t port, uint8_t value);
 // This represents the TC signal.
 void FDCHandleTC(FDCState* fdc);
 
-// Inserts a disk with the given format into the specified drive.
-void FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format);
-
-// Ejects the disk from the specified drive.
-void FDCEjectDisk(FDCState* fdc, uint8_t drive);
+// Inserts a disk with the given format into the specified drive. If the drive
+// already holds a disk, pending writes in FDCConfig.write_cache are written to
+// its image first, so the image callbacks must still refer to the previous
+// image when this is called. Returns false if any of them could not be
+// written; they are dropped along with the previous disk.
+bool FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format);
+
+// Ejects the disk from the specified drive, writing any pending writes in
+// FDCConfig.write_cache to its image first. Returns false if any of them could
+// not be written; they are dropped along with the disk.
+bool FDCEjectDisk(FDCState* fdc, uint8_t drive);
+
+// Writes all pending writes in FDCConfig.write_cache to the disk images.
+// Returns false if any of them could not be written because no callback to
+// write to the image was set and get_image_sector returned NULL. Such writes
+// stay in the cache, and are written by a later call that succeeds.
+bool FDCFlush(FDCState* fdc);
 
 // Simulates a tick of the FDC, handling any timed operations.
 void FDCTick(FDCState* fdc);
@@ -118,3 +118,13 @@ void KeyboardTickMs(KeyboardState* keyboard) {
   KeyboardSendNextScancode(keyboard);
 }
 
+bool KeyboardNeedsTick(const KeyboardState* keyboard) {
+  // Waiting for the clock line to be held low long enough to trigger reset.
+  if (keyboard->clock_low == false) {
+    return keyboard->clock_low_ms != kKeyboardResetTriggered;
+  }
+  // Waiting to send the next scancode.
+  return keyboard->enable_clear == false && !keyboard->waiting_for_ack &&
+         KeyboardBufferLength(&keyboard->buffer) > 0;
+}
+
@@ -110,5 +110,10 @@ void KeyboardHandleKeyPress(KeyboardState* keyboard, uint8_t scancode);
 // send buffered scancodes.
 void KeyboardTickMs(KeyboardState* keyboard);
 
+// Returns whether the next call to KeyboardTickMs() would do anything, i.e. a
+// reset timer is running or a buffered scancode can be sent. If this returns
+// false, the keyboard does not need to be ticked until its state changes.
+bool KeyboardNeedsTick(const KeyboardState* keyboard);
+
 #endif  // YAX86_KEYBOARD_PUBLIC_H
 
@@ -42,6 +42,27 @@ static const uint16_t kPICBasePorts[kPICNumModes] = {
     0xA0,  // kPICSlave
 };
 
+// Map a register value to the index of its lowest set bit, i.e. the highest
+// priority IRQ in the register. Maps 0 to 8.
+static const uint8_t kPICLowestSetBit[256] = {
+    8, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+
 // ============================================================================
 // Helper functions
 // ============================================================================
@@ -88,6 +109,35 @@ static inline uint8_t PICGetCascadeIRQ(PICState* pic) {
   return pic->icw3 & 0x07;
 }
 
+// Returns the highest priority IRQ that is requested, unmasked and has higher
+// priority than all interrupts in service, or 8 if there is none.
+static inline uint8_t PICGetDeliverableIRQ(PICState* pic) {
+  uint8_t irr = pic->irr & ~pic->imr;
+  // Only IRQs with a lower number than the highest priority in-service IRQ
+  // can interrupt it.
+  uint8_t priority_mask = (uint8_t)((1 << kPICLowestSetBit[pic->isr]) - 1);
+  return kPICLowestSetBit[irr & priority_mask];
+}
+
+// Recompute the cached pending interrupt vector after a change to IRR, IMR,
+// ISR or the ICWs. A slave PIC also updates its master, whose pending
+// interrupt vector depends on the slave's.
+static void PICUpdatePendingInterrupt(PICState* pic) {
+  uint8_t irq = PICGetDeliverableIRQ(pic);
+  if (irq >= 8) {
+    pic->pending_interrupt = kPICNoPendingInterrupt;
+  } else if (PICIsMaster(pic) && irq == kMasterCascadeIRQ &&
+             pic->cascade_pic) {
+    pic->pending_interrupt = pic->cascade_pic->pending_interrupt;
+  } else {
+    pic->pending_interrupt = (pic->icw2 & kICW2_BASE) + irq;
+  }
+
+  if (PICIsSlave(pic) && pic->cascade_pic) {
+    PICUpdatePendingInterrupt(pic->cascade_pic);
+  }
+}
+
 // ============================================================================
 // PIC initialization
 // ============================================================================
@@ -100,6 +150,7 @@ void PICInit(PICState* pic, PICConfig* config) {
 
   // All interrupts masked by default.
   pic->imr = 0xFF;
+  pic->pending_interrupt = kPICNoPendingInterrupt;
 }
 
 // ============================================================================
@@ -111,6 +162,7 @@ void PICRaiseIRQ(PICState* pic, uint8_t irq) {
     return;
   }
   pic->irr |= (1 << irq);
+  PICUpdatePendingInterrupt(pic);
 
   // If this is a slave PIC, also raise the cascade IRQ on the master.
   if (PICIsSlave(pic) && pic->cascade_pic) {
@@ -123,6 +175,7 @@ void PICLowerIRQ(PICState* pic, uint8_t irq) {
     return;
   }
   pic->irr &= ~(1 << irq);
+  PICUpdatePendingInterrupt(pic);
 
   // If this is a slave PIC and no interrupts are pending, lower the cascade
   // IRQ on the master.
@@ -199,12 +252,7 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
               pic->isr &= ~(1 << irq);
             } else {
               // Non-Specific EOI: clear highest priority ISR bit.
-              for (uint8_t i = 0, isr_mask = 1; i < 8; ++i, isr_mask <<= 1) {
-                if (pic->isr & isr_mask) {
-                  pic->isr &= ~isr_mask;
-                  break;
-                }
-              }
+              pic->isr &= pic->isr - 1;
             }
           } else {
             // Other OCW2 commands (Rotate) are not implemented as they are not
@@ -253,8 +301,10 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
 
     default:
       // Invalid port - ignore.
-      break;
+      return;
   }
+
+  PICUpdatePendingInterrupt(pic);
 }
 
 // ============================================================================
@@ -262,32 +312,13 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
 // ============================================================================
 
 uint8_t PICGetPendingInterrupt(PICState* pic) {
-  // Find highest priority requested and unmasked interrupt.
-  uint8_t irr = pic->irr & ~pic->imr;
-  if (irr == 0) {
+  // Find highest priority requested and unmasked interrupt that has higher
+  // priority than any interrupt already being serviced.
+  uint8_t pending_irq = PICGetDeliverableIRQ(pic);
+  if (pending_irq >= 8) {
     return kPICNoPendingInterrupt;
   }
-  uint8_t pending_irq = 0, pending_irq_mask = 1;
-  for (; pending_irq < 8; ++pending_irq, pending_irq_mask <<= 1) {
-    if (irr & pending_irq_mask) {
-      break;
-    }
-  }
-
-  // If there is already an interrupt being serviced, the new pending interrupt
-  // must have higher priority (lower IRQ number) to be serviced now.
-  if (pic->isr > 0) {
-    uint8_t in_service_irq = 0, in_service_irq_mask = 1;
-    for (; in_service_irq < 8; ++in_service_irq, in_service_irq_mask <<= 1) {
-      if (pic->isr & in_service_irq_mask) {
-        break;
-      }
-    }
-    if (pending_irq >= in_service_irq) {
-      // New interrupt does not have higher priority than in-service interrupt.
-      return kPICNoPendingInterrupt;
-    }
-  }
+  uint8_t pending_irq_mask = (uint8_t)(1 << pending_irq);
 
   // If this is the master PIC and the interrupt is from the slave, return the
   // slave PIC's interrupt vector.
@@ -296,6 +327,7 @@ uint8_t PICGetPendingInterrupt(PICState* pic) {
     uint8_t slave_vector = PICGetPendingInterrupt(pic->cascade_pic);
     if (slave_vector != kPICNoPendingInterrupt) {
       pic->isr |= pending_irq_mask;
+      PICUpdatePendingInterrupt(pic);
     }
     return slave_vector;
   }
@@ -303,7 +335,7 @@ uint8_t PICGetPendingInterrupt(PICState* pic) {
   // This is a normal interrupt on this PIC (or it's a slave reporting up).
   pic->isr |= pending_irq_mask;
   pic->irr &= ~pending_irq_mask;
+  PICUpdatePendingInterrupt(pic);
 
   return (pic->icw2 & kICW2_BASE) + pending_irq;
 }
-
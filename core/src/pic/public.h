@@ -104,6 +104,11 @@ typedef struct PICState {
   // The register to read on the next read from the data port.
   PICReadRegister read_register;
 
+  // Vector number of the interrupt that PICGetPendingInterrupt() would
+  // deliver, or kPICNoPendingInterrupt. Kept up to date whenever IRR, IMR or
+  // ISR change, so that the CPU does not need to poll the PIC.
+  uint8_t pending_interrupt;
+
   // Pointer to master PIC if this is a slave, or to slave PIC if this is a
   // master. NULL if this is a single PIC.
   struct PICState* cascade_pic;
@@ -151,4 +156,10 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value);
 // PIC as well. If no interrupts are pending, returns kPICNoPendingInterrupt.
 uint8_t PICGetPendingInterrupt(PICState* pic);
 
+// Returns whether PICGetPendingInterrupt() would deliver an interrupt. This is
+// cheap enough to check after every instruction.
+static inline bool PICHasPendingInterrupt(const PICState* pic) {
+  return pic->pending_interrupt != kPICNoPendingInterrupt;
+}
+
 #endif  // YAX86_PIC_PUBLIC_H
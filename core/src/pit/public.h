@@ -86,6 +86,10 @@ typedef struct PITChannelState {
   PITByte rw_byte;
   // Whether a latch command is active.
   bool latch_active;
+  // Value of PITState.ticks at which counter and output_state were last
+  // brought up to date. Channels are only updated when accessed, except for
+  // channel 0 which is updated by PITTick() and PITAdvance().
+  uint32_t sync_ticks;
 } PITChannelState;
 
 // State of the PIT.
@@ -95,6 +99,9 @@ typedef struct PITState {
 
   // The three timer channels.
   PITChannelState channels[kPITNumChannels];
+
+  // Number of ticks of the PIT's input clock so far.
+  uint32_t ticks;
 } PITState;
 
 // Initializes the PIT to its power-on state.
@@ -110,5 +117,21 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value);
 // invoked at a frequency of 1.193182 MHz for accurate timing.
 void PITTick(PITState* pit);
 
+// Simulates num_ticks ticks of the PIT's input clock, with the same result as
+// calling PITTick() num_ticks times. Counters are computed from the elapsed
+// time, so this only takes time proportional to the number of output changes.
+void PITAdvance(PITState* pit, uint32_t num_ticks);
+
+enum {
+  // Return value of PITGetTicksUntilIRQ0() when IRQ 0 will not be raised.
+  kPITNoIRQ0 = 0,
+};
+
+// Returns the number of ticks until channel 0 next raises IRQ 0, i.e. the
+// number of ticks to pass to PITAdvance() for the IRQ to be raised on the last
+// tick. Returns kPITNoIRQ0 if channel 0 will not raise IRQ 0 unless it is
+// reprogrammed.
+uint32_t PITGetTicksUntilIRQ0(PITState* pit);
+
 #endif  // YAX86_PIT_PUBLIC_H
 
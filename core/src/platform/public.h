@@ -32,10 +32,22 @@ enum {
   // Conventional memory - first 640KB of physical memory, mapped to 0x00000 to
   // 0x9FFFF (640KB).
   kMemoryMapEntryConventional = 0,
+  // Open bus entry that unmapped addresses resolve to. Entries of this type
+  // cannot be registered.
+  kMemoryMapEntryNone = 0xFF,
 
   // Maximum number of memory map entries.
   kMaxMemoryMapEntries = 16,
 
+  // Size of the 8088's physical address space in bytes.
+  kMemoryAddressSpaceSize = kCPUMemoryAddressSpaceSize,
+  // Granularity of the memory map dispatch table in bytes. This matches the
+  // CPU's direct memory access page size so the same page tables can be
+  // shared with the CPU.
+  kMemoryMapPageSize = kCPUMemoryPageSize,
+  // Number of pages in the memory map dispatch table.
+  kNumMemoryMapPages = kMemoryAddressSpaceSize / kMemoryMapPageSize,
+
   // Maximum size of physical memory in bytes.
   kMaxPhysicalMemorySize = 640 * 1024,
   // Minimum size of physical memory in bytes.
@@ -61,10 +73,31 @@ typedef struct MemoryMapEntry {
   // address.
   void (*write_byte)(
       struct MemoryMapEntry* entry, uint32_t relative_address, uint8_t value);
+  // Optional callback to read a word from the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, read_byte is used.
+  uint16_t (*read_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address);
+  // Optional callback to write a word to the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, write_byte is used.
+  void (*write_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address, uint16_t value);
+
+  // Optional host memory backing the memory region, indexed by relative
+  // address. If set, reads are served directly from host memory and read_byte
+  // is not used.
+  const uint8_t* read_data;
+  // Optional writable host memory backing the memory region, indexed by
+  // relative address. If set, writes go directly to host memory and write_byte
+  // is not used. For RAM, this is typically the same buffer as read_data; for
+  // ROM, this should be left NULL.
+  uint8_t* write_data;
 } MemoryMapEntry;
 
 // Register a memory map entry in the platform state. Returns true if the entry
 // was successfully registered, or false if:
+//   - The entry's type is kMemoryMapEntryNone.
 //   - There already exists a memory map entry with the same type.
 //   - The new entry's memory region overlaps with an existing entry.
 //   - The number of memory map entries would exceed kMaxMemoryMapEntries.
@@ -87,7 +120,8 @@ MemoryMapEntry* GetMemoryMapEntryByType(
 // behavior.
 uint8_t ReadMemoryByte(struct PlatformState* platform, uint32_t address);
 // Read a word from a logical memory address by invoking the corresponding
-// memory map entry's read_byte callback.
+// memory map entry's read_word callback, or its read_byte callback if the word
+// straddles two memory map entries.
 uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 // Write a byte to a logical memory address by invoking the corresponding
 // memory map entry's write_byte callback.
@@ -98,7 +132,8 @@ uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 void WriteMemoryByte(
     struct PlatformState* platform, uint32_t address, uint8_t value);
 // Write a word to a logical memory address by invoking the corresponding
-// memory map entry's write_byte callback.
+// memory map entry's write_word callback, or its write_byte callback if the
+// word straddles two memory map entries.
 void WriteMemoryWord(
     struct PlatformState* platform, uint32_t address, uint16_t value);
 
@@ -141,6 +176,13 @@ typedef struct PortMapEntry {
   uint8_t (*read_byte)(struct PortMapEntry* entry, uint16_t port);
   // Callback to write a byte an I/O port within the range.
   void (*write_byte)(struct PortMapEntry* entry, uint16_t port, uint8_t value);
+  // Optional callback to read a word from an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, read_byte is used.
+  uint16_t (*read_word)(struct PortMapEntry* entry, uint16_t port);
+  // Optional callback to write a word to an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, write_byte is used.
+  void (*write_word)(
+      struct PortMapEntry* entry, uint16_t port, uint16_t value);
 } PortMapEntry;
 
 // Register an I/O port map entry in the platform state. Returns true if the
@@ -162,14 +204,17 @@ PortMapEntry* GetPortMapEntryByType(
 // entry's read_byte callback.
 uint8_t ReadPortByte(struct PlatformState* platform, uint16_t port);
 // Read a word from an I/O port by invoking the corresponding I/O port map
-// entry's read_byte callback. This reads two consecutive bytes from the port.
+// entry's read_word callback. This reads two consecutive ports, falling back to
+// read_byte if read_word is not set or the ports belong to different entries.
 uint16_t ReadPortWord(struct PlatformState* platform, uint16_t port);
 // Write a byte to an I/O port by invoking the corresponding I/O port map
 // entry's write_byte callback.
 void WritePortByte(
     struct PlatformState* platform, uint16_t port, uint8_t value);
 // Write a word to an I/O port by invoking the corresponding I/O port map
-// entry's write_byte callback. This writes two consecutive bytes to the port.
+// entry's write_word callback. This writes two consecutive ports, falling back
+// to write_byte if write_word is not set or the ports belong to different
+// entries.
 void WritePortWord(
     struct PlatformState* platform, uint16_t port, uint16_t value);
 
@@ -177,6 +222,38 @@ void WritePortWord(
 // Platform state
 // ============================================================================
 
+enum {
+  // Default maximum number of iterations of a repeated string instruction to
+  // run per CPU tick.
+  kPlatformDefaultMaxStringIterations = 64,
+  // BIOS keyboard services interrupt.
+  kPlatformKeyboardServiceInterrupt = 0x16,
+  // Maximum number of 8088 clock cycles between two INT 16h keyboard status
+  // checks for them to count as the same polling loop.
+  kPlatformMaxKeyboardPollInterval = 80000,
+  // Estimated average number of 8088 clock cycles per instruction, used to
+  // measure the time between keyboard status checks when
+  // PlatformConfig.use_clock_cycles is not set.
+  kPlatformAverageInstructionClockCycles = 8,
+};
+
+// BIOS keyboard services used by the guest to check for a key press, in AH.
+enum {
+  // Check for a key press.
+  kPlatformKeyboardServiceCheckKey = 0x01,
+  // Check for a key press on an enhanced keyboard.
+  kPlatformKeyboardServiceCheckExtendedKey = 0x11,
+};
+
+enum {
+  // Opcode of the INT imm8 instruction.
+  kPlatformINTOpcode = 0xCD,
+  // Address of the keyboard buffer head pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferHeadAddress = 0x41A,
+  // Address of the keyboard buffer tail pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferTailAddress = 0x41C,
+};
+
 // Caller-provided runtime configuration.
 typedef struct PlatformConfig {
   // Custom data passed through to callbacks.
@@ -185,6 +262,61 @@ typedef struct PlatformConfig {
   // Physical memory size in bytes. Must be between 64K and 640K.
   uint32_t physical_memory_size;
 
+  // Optional host buffer of physical_memory_size bytes backing physical memory.
+  // If set, physical memory is accessed directly and the callbacks below are
+  // not used.
+  uint8_t* physical_memory;
+
+  // Optional cache of decoded instructions for the CPU. The platform
+  // initializes the cache and invalidates it on DMA writes.
+  CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated blocks for the CPU. The platform initializes
+  // the cache and invalidates it on DMA writes.
+  CPUBlockCache* block_cache;
+
+  // Optional JIT for the CPU, which must be initialized by the caller with
+  // CPUInitJIT(). Only used together with block_cache.
+  CPUJIT* jit;
+
+  // Optional track read-ahead cache for the FDC. The platform initializes the
+  // cache. See FDCConfig.track_cache.
+  FDCTrackCache* fdc_track_cache;
+
+  // Optional write-back cache for the FDC. The platform initializes the cache.
+  // See FDCConfig.write_cache.
+  FDCWriteCache* fdc_write_cache;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // CPU tick, or 0 for kPlatformDefaultMaxStringIterations. See
+  // CPUConfig.max_string_iterations.
+  uint16_t max_string_iterations;
+
+  // Whether each CPU instruction should take as many ticks as it takes clock
+  // cycles on the 8088, so that ticks track the 4.77MHz clock and device
+  // timings relative to the CPU are accurate. See CPUConfig.use_clock_cycles.
+  // Otherwise, each instruction takes one tick. This keeps the block cache,
+  // the JIT and threaded dispatch, at the cost of timing each instruction, and
+  // of more ticks per instruction for the devices to catch up with.
+  bool use_clock_cycles;
+
+  // Number of consecutive INT 16h keyboard status checks that find the
+  // keyboard buffer empty, each within kPlatformMaxKeyboardPollInterval clock
+  // cycles of the last, after which the guest is treated as waiting for input,
+  // or 0 to never do so. The CPU is then halted at the INT 16h instruction
+  // until the next interrupt, and checks again when it resumes. This lets the
+  // host sleep while DOS polls for input at its prompt, which the CPU cannot
+  // detect as idle by itself as the polling loop spans DOS and the BIOS. A
+  // program that polls the keyboard this often while doing other work is
+  // slowed down to the rate of interrupts.
+  uint8_t idle_keyboard_polls;
+
+  // Whether the FDC should transfer the rest of a sector to or from memory via
+  // DMA in one step, instead of one byte per FDC tick. The guest sees the same
+  // memory, DMA and FDC state at the end of the transfer, but the transfer
+  // completes much sooner. See FDCConfig.transfer_dma_block.
+  bool use_bulk_disk_transfers;
+
   // Callback to read a byte from physical memory.
   //
   // On the 8086, accessing an invalid memory address will yield garbage data
@@ -211,6 +343,22 @@ typedef struct PlatformConfig {
 STATIC_VECTOR_TYPE(MemoryMap, MemoryMapEntry, kMaxMemoryMapEntries)
 STATIC_VECTOR_TYPE(PortMap, PortMapEntry, kMaxPortMapEntries)
 
+// Devices ticked by the platform, in the order they are ticked.
+typedef enum PlatformTimerType {
+  kPlatformTimerPIT = 0,
+  kPlatformTimerFDC,
+  kPlatformTimerKeyboard,
+  kNumPlatformTimers,
+} PlatformTimerType;
+
+// A device's next tick. Devices are only scheduled while they have work to do.
+typedef struct PlatformTimer {
+  // Whether the device is scheduled to tick.
+  bool active;
+  // Value of PlatformState.ticks on which the device ticks next.
+  uint32_t deadline;
+} PlatformTimer;
+
 // State of the platform.
 typedef struct PlatformState {
   // Pointer to caller-provided runtime configuration.
@@ -257,11 +405,48 @@ typedef struct PlatformState {
 
   // Memory map.
   MemoryMap memory_map;
+  // Page-granular dispatch table for the memory map, rebuilt whenever a memory
+  // map entry is registered. Each page points to the entry covering the entire
+  // page, to open_bus_memory_map_entry if the page is not mapped at all, or to
+  // NULL if the page is split across more than one entry.
+  MemoryMapEntry* memory_map_pages[kNumMemoryMapPages];
+  // Host memory backing each page for reads, or NULL if reads from the page
+  // must go through the memory map. Shared with the CPU.
+  const uint8_t* memory_read_pages[kNumMemoryMapPages];
+  // Host memory backing each page for writes, or NULL if writes to the page
+  // must go through the memory map. Shared with the CPU.
+  uint8_t* memory_write_pages[kNumMemoryMapPages];
+  // Memory map entry shared by all unmapped pages. Reads return 0xFF and writes
+  // are ignored.
+  MemoryMapEntry open_bus_memory_map_entry;
   // I/O port map.
   PortMap io_port_map;
 
   // How many ticks have run.
   uint32_t ticks;
+  // Next tick of each device, indexed by PlatformTimerType.
+  PlatformTimer timers[kNumPlatformTimers];
+  // Value of CPUState.cycles when ticks was last updated. Used to find the
+  // current tick while the CPU is running a batch of instructions.
+  uint32_t cpu_cycles;
+  // Tick up to which the PIT has been brought up to date, exclusive.
+  uint32_t pit_sync_tick;
+  // Whether the host has asked PlatformRun() to return early.
+  bool stop_requested;
+  // Number of ticks run by the last call to PlatformRun() during which the
+  // CPU was idle, i.e. halted or spinning in a loop that waits for an
+  // interrupt.
+  uint32_t idle_ticks;
+  // Whether the CPU was idle for the whole of the last batch of ticks run by
+  // PlatformRun().
+  bool is_idle;
+  // Number of consecutive INT 16h keyboard status checks that found the
+  // keyboard buffer empty. See PlatformConfig.idle_keyboard_polls.
+  uint8_t num_keyboard_polls;
+  // Time of the last INT 16h keyboard status check in 8088 clock cycles,
+  // estimated from CPUState.cycles if PlatformConfig.use_clock_cycles is not
+  // set. Wraps around.
+  uint32_t last_keyboard_poll_clock_cycles;
 } PlatformState;
 
 // Initialize the platform state with the provided configuration. Returns true
@@ -273,8 +458,33 @@ bool PlatformInit(PlatformState* platform, PlatformConfig* config);
 // IRQ was successfully raised, or false if the IRQ number is invalid.
 bool PlatformRaiseIRQ(PlatformState* platform, uint8_t irq);
 
-// Run a single cycle of the platform, including ticking all sub-modules. This
-// should be called at the CPU clock rate (4.77MHz for the 8088).
+// Run a single CPU instruction cycle of the platform, including ticking all
+// sub-modules. This takes one tick, or with PlatformConfig.use_clock_cycles,
+// as many ticks as the instruction's clock cycles.
 void PlatformTick(PlatformState* platform);
 
+// Run up to max_ticks ticks of the platform, with the same results as calling
+// PlatformTick() until max_ticks ticks have run. The CPU runs in batches up to
+// the next device tick, so this is much faster than calling PlatformTick() in a
+// loop. Returns the number of ticks run, which is less than max_ticks if the
+// CPU encountered an error or PlatformRequestStop() was called. With
+// PlatformConfig.use_clock_cycles, this may exceed max_ticks by up to the
+// length of the last instruction.
+uint32_t PlatformRun(PlatformState* platform, uint32_t max_ticks);
+
+// Ask PlatformRun() to return at the end of the current instruction cycle. Can
+// be called from callbacks invoked while running.
+void PlatformRequestStop(PlatformState* platform);
+
+// Returns whether the guest was waiting for an interrupt at the end of the last
+// call to PlatformRun(), so that nothing guest-visible happens until the next
+// device event or host input. The host may then sleep for up to
+// PlatformGetTicksUntilNextEvent() ticks, or until host input arrives.
+bool PlatformIsIdle(const PlatformState* platform);
+
+// Returns the number of ticks up to and including the next device event that
+// may interrupt the guest, or max_ticks if that is sooner.
+uint32_t PlatformGetTicksUntilNextEvent(
+    PlatformState* platform, uint32_t max_ticks);
+
 #endif  // YAX86_PLATFORM_PUBLIC_H
@@ -0,0 +1,322 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+using namespace std;
+
+class BlockCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { CPUInitBlockCache(&cache_); }
+
+  static CPUBlockCache cache_;
+};
+
+CPUBlockCache BlockCacheTest::cache_;
+
+TEST_F(BlockCacheTest, ChainsLoop) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-loop-test",
+      "mov cx, 10\n"
+      "loop_start: add ax, 1\n"
+      "loop loop_start\n"
+      "hlt\n");
+  helper->cpu_.config->block_cache = &cache_;
+  helper->cpu_.registers[kAX] = 0;
+
+  // mov + 10 x (add + loop) + hlt
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 22);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 10);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+  // The first block is translated, then the loop body and hlt.
+  EXPECT_EQ(cache_.num_misses, 3);
+  // The loop body branches back to its own start, so it is run again directly
+  // instead of through its successor link.
+  EXPECT_EQ(cache_.num_chained, 0);
+  EXPECT_EQ(cache_.fusion_counts[kCPUFusionLoop], 8);
+}
+
+TEST_F(BlockCacheTest, StopsAtMaxInstructions) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-max-instructions-test",
+      "loop_start: add ax, 1\n"
+      "jmp loop_start\n");
+  helper->cpu_.config->block_cache = &cache_;
+  helper->cpu_.registers[kAX] = 0;
+
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 5, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 5);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 3);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 3);
+}
+
+TEST_F(BlockCacheTest, StopsAtPendingInterrupt) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-interrupt-test",
+      "mov ax, 1\n"
+      "int 0x80\n"
+      "mov ax, 2\n");
+  helper->cpu_.config->block_cache = &cache_;
+  helper->cpu_.config->handle_interrupt = [](CPUState*, uint8_t) {
+    return kExecuteUnhandledInterrupt;
+  };
+  helper->cpu_.registers[kSP] = 0x0800;
+  // Point the interrupt vector at the last instruction.
+  helper->memory_[0x80 * 4] = (kCOMFileLoadOffset + 5) & 0xFF;
+  helper->memory_[0x80 * 4 + 1] = (kCOMFileLoadOffset + 5) >> 8;
+
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 1);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 5);
+}
+
+TEST_F(BlockCacheTest, SelfModifyingCode) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-self-modifying-test",
+      "mov word [target + 1], 2\n"
+      "target: mov ax, 1\n"
+      "hlt\n");
+  helper->cpu_.config->block_cache = &cache_;
+
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 1);
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 2);
+}
+
+// Build a program that runs each conditional jump after each kind of fused
+// CMP, TEST, INC or DEC, recording the jumps taken in BP, followed by fused
+// LODS / STOS pairs and register zeroing idioms.
+string BuildFusionTestProgram() {
+  const char* const kConditionalJumps[] = {
+      "jo", "jno", "jc", "jnc", "jz", "jnz", "jbe", "ja",
+      "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg",
+  };
+  const char* const kCompares[] = {
+      "cmp ax, bx",  "cmp al, bl", "cmp ax, 1234h", "cmp bx, 5",
+      "test ax, bx", "test bl, al", "dec dx",        "inc dx",
+  };
+  string program;
+  int label = 0;
+  for (const char* compare : kCompares) {
+    for (const char* jump : kConditionalJumps) {
+      program += string(compare) + "\n" + jump + " l" + to_string(label) +
+                 "\n" + "add bp, " + to_string(label + 1) + "\n" + "l" +
+                 to_string(label) + ":\n";
+      ++label;
+    }
+  }
+  program +=
+      "mov si, 0C00h\n"
+      "mov di, 0D00h\n"
+      "mov cx, 5\n"
+      "copy_loop: lodsb\n"
+      "stosb\n"
+      "lodsw\n"
+      "stosw\n"
+      "loop copy_loop\n"
+      "xor cx, cx\n"
+      "sub bl, bl\n"
+      "xor ah, ah\n"
+      "hlt\n";
+  return program;
+}
+
+TEST_F(BlockCacheTest, FusedSequencesMatchTick) {
+  const string program = BuildFusionTestProgram();
+  auto expected = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-fusion-test", program);
+  auto actual = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-fusion-test", program);
+  CPUConfig* const actual_config = actual->cpu_.config;
+  actual_config->block_cache = &cache_;
+
+  mt19937 rng(42);
+  const uint16_t kValues[] = {
+      0, 1, 5, 0x7F, 0x80, 0xFF, 0x1234, 0x7FFF, 0x8000, 0xFFFF};
+  for (int i = 0; i < 200; ++i) {
+    CPUState initial_state = expected->cpu_;
+    for (uint8_t reg : {kAX, kBX, kDX}) {
+      initial_state.registers[reg] =
+          i < 100 ? kValues[rng() % 10] : (uint16_t)rng();
+    }
+    initial_state.registers[kBP] = 0;
+    initial_state.registers[kIP] = kCOMFileLoadOffset;
+    initial_state.is_halted = false;
+    CPUSetFlags(&initial_state, rng() & kArithmeticFlags);
+    for (uint32_t j = 0x0C00; j < 0x0D00; ++j) {
+      expected->memory_[j] = actual->memory_[j] = (uint8_t)rng();
+    }
+    expected->cpu_ = initial_state;
+    actual->cpu_ = initial_state;
+    actual->cpu_.config = actual_config;
+
+    while (!expected->cpu_.is_halted) {
+      ASSERT_EQ(CPUTick(&expected->cpu_), kExecuteSuccess);
+    }
+    while (!actual->cpu_.is_halted) {
+      uint32_t num_instructions;
+      ASSERT_EQ(
+          CPUTickBlock(&actual->cpu_, 100, &num_instructions),
+          kExecuteSuccess);
+    }
+    for (int reg = 0; reg < kNumRegisters; ++reg) {
+      ASSERT_EQ(expected->cpu_.registers[reg], actual->cpu_.registers[reg])
+          << "iteration " << i << ", register " << reg;
+    }
+    ASSERT_EQ(expected->cpu_.flags, actual->cpu_.flags) << "iteration " << i;
+    ASSERT_EQ(expected->cpu_.cycles, actual->cpu_.cycles) << "iteration " << i;
+    ASSERT_EQ(
+        memcmp(
+            expected->memory_.get() + 0x0D00, actual->memory_.get() + 0x0D00,
+            0x100),
+        0)
+        << "iteration " << i;
+  }
+  EXPECT_GT(cache_.fusion_counts[kCPUFusionCompareJump], 0);
+  EXPECT_GT(cache_.fusion_counts[kCPUFusionIncDecJump], 0);
+  EXPECT_GT(cache_.fusion_counts[kCPUFusionLoadStore], 0);
+  EXPECT_GT(cache_.fusion_counts[kCPUFusionZeroRegister], 0);
+  EXPECT_GT(cache_.fusion_counts[kCPUFusionLoop], 0);
+}
+
+TEST_F(BlockCacheTest, StopsBetweenFusedInstructions) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-fusion-interrupt-test",
+      "cmp ax, [0800h]\n"
+      "jz target\n"
+      "mov bx, 1\n"
+      "target: hlt\n");
+  helper->cpu_.config->block_cache = &cache_;
+  // Raise an interrupt when the CMP reads its memory operand.
+  static uint8_t* memory;
+  memory = helper->memory_.get();
+  helper->cpu_.config->read_memory_byte = [](CPUState* cpu, uint32_t address) {
+    if (address == 0x0800) {
+      CPUSetPendingInterrupt(cpu, 0x80);
+    }
+    return memory[address];
+  };
+  helper->cpu_.config->handle_interrupt = [](CPUState*, uint8_t) {
+    return kExecuteUnhandledInterrupt;
+  };
+  helper->cpu_.registers[kSP] = 0x0C00;
+  // Point the interrupt vector at the HLT.
+  helper->memory_[0x80 * 4] = (kCOMFileLoadOffset + 9) & 0xFF;
+  helper->memory_[0x80 * 4 + 1] = (kCOMFileLoadOffset + 9) >> 8;
+
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  // The interrupt is handled after the CMP, and returns to the JZ.
+  EXPECT_EQ(num_instructions, 1);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 9);
+  EXPECT_EQ(helper->memory_[0x0BFA], (kCOMFileLoadOffset + 4) & 0xFF);
+  EXPECT_EQ(helper->memory_[0x0BFB], (kCOMFileLoadOffset + 4) >> 8);
+  EXPECT_EQ(cache_.fusion_counts[kCPUFusionCompareJump], 0);
+}
+
+TEST_F(BlockCacheTest, SkipsDelayLoop) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-delay-loop-test",
+      "mov cx, 1000\n"
+      "delay: loop delay\n"
+      "hlt\n");
+  helper->cpu_.config->block_cache = &cache_;
+
+  // mov + 99 x loop. The first loop ends the first block, and the loop block
+  // runs once before the remaining iterations are skipped.
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 100);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 901);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 3);
+  EXPECT_EQ(cache_.num_skipped_loop_iterations, 97);
+
+  // 901 x loop + hlt, of which the last loop leaves the loop.
+  EXPECT_EQ(
+      CPUTickBlock(&helper->cpu_, 10000, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 902);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+  EXPECT_EQ(helper->cpu_.cycles, 1002);
+  EXPECT_EQ(cache_.num_skipped_loop_iterations, 97 + 899);
+}
+
+// Number of reads from I/O ports in the polling loop tests.
+int num_port_reads = 0;
+
+// Run a loop polling a port and memory with CPUTick() and CPUTickBlock(),
+// and expect the same results.
+void ExpectPollingLoopMatchesTick(
+    CPUBlockCache* cache, bool (*is_port_stable)(CPUState*, uint16_t)) {
+  const string program =
+      "poll: in al, 0x60\n"
+      "or al, [0800h]\n"
+      "jz poll\n"
+      "hlt\n";
+  auto expected = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-polling-loop-test", program);
+  auto actual = CPUTestHelper::CreateWithProgram(
+      "execute-block-cache-polling-loop-test", program);
+  for (auto* helper : {expected.get(), actual.get()}) {
+    helper->cpu_.config->read_port = [](CPUState*, uint16_t) -> uint8_t {
+      ++num_port_reads;
+      return 0;
+    };
+    helper->cpu_.config->is_port_stable = is_port_stable;
+  }
+  actual->cpu_.config->block_cache = cache;
+
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(CPUTick(&expected->cpu_), kExecuteSuccess);
+  }
+  num_port_reads = 0;
+  uint32_t num_instructions = 0;
+  EXPECT_EQ(
+      CPUTickBlock(&actual->cpu_, 1000, &num_instructions), kExecuteSuccess);
+  EXPECT_EQ(num_instructions, 1000);
+  for (int reg = 0; reg < kNumRegisters; ++reg) {
+    EXPECT_EQ(expected->cpu_.registers[reg], actual->cpu_.registers[reg])
+        << "register " << reg;
+  }
+  EXPECT_EQ(expected->cpu_.flags, actual->cpu_.flags);
+  EXPECT_EQ(expected->cpu_.cycles, actual->cpu_.cycles);
+  // Skipped iterations are counted as idle.
+  EXPECT_EQ(actual->cpu_.idle_cycles, cache->num_skipped_loop_iterations * 3);
+}
+
+TEST_F(BlockCacheTest, SkipsPollingLoop) {
+  ExpectPollingLoopMatchesTick(
+      &cache_, [](CPUState*, uint16_t port) { return port == 0x60; });
+  // The loop is skipped after running twice, then the budget ends after the
+  // IN of the next iteration.
+  EXPECT_EQ(num_port_reads, 3);
+  EXPECT_GT(cache_.num_skipped_loop_iterations, 0);
+}
+
+TEST_F(BlockCacheTest, DoesNotSkipPollingLoopOnUnstablePort) {
+  ExpectPollingLoopMatchesTick(
+      &cache_, [](CPUState*, uint16_t port) { return port != 0x60; });
+  // 1000 instructions = 333 x (in + or + jz) + in
+  EXPECT_EQ(num_port_reads, 334);
+  EXPECT_EQ(cache_.num_skipped_loop_iterations, 0);
+}
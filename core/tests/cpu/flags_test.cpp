@@ -90,3 +90,81 @@ TEST_F(FlagsTest, SetDirectionFlag) {
   // Expect DF to be set, others remain kInitialFlags
   EXPECT_EQ(helper->cpu_.flags, kInitialFlags | kDF);
 }
+
+class LazyFlagsTest : public ::testing::Test {
+ protected:
+  void SetUp() override { CPUInitBlockCache(&cache_); }
+
+  // Run a program with lazily evaluated flags until it halts.
+  void RunUntilHalted(CPUTestHelper* helper) {
+    helper->cpu_.config->block_cache = &cache_;
+    uint32_t num_instructions = 0;
+    EXPECT_EQ(
+        CPUTickBlock(&helper->cpu_, 100, &num_instructions), kExecuteSuccess);
+    EXPECT_TRUE(helper->cpu_.is_halted);
+  }
+
+  static CPUBlockCache cache_;
+};
+
+CPUBlockCache LazyFlagsTest::cache_;
+
+TEST_F(LazyFlagsTest, IncPreservesCarryFromAdd) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-lazy-flags-inc-after-add-test",
+      "mov al, 0xFF\n"
+      "add al, 1\n"  // CF, ZF, AF, PF set
+      "inc bx\n"     // CF preserved, ZF, AF, PF cleared
+      "hlt\n");
+  helper->cpu_.registers[kBX] = 0;
+  RunUntilHalted(helper.get());
+  EXPECT_EQ(helper->cpu_.lazy_flags.pending, 0);
+  EXPECT_EQ(helper->cpu_.flags & kArithmeticFlags, kCF);
+}
+
+TEST_F(LazyFlagsTest, BooleanPreservesAuxiliaryCarryFromSub) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-lazy-flags-and-after-sub-test",
+      "mov al, 0x10\n"
+      "sub al, 1\n"   // AF, CF clear, result 0x0F
+      "and al, 0\n"   // ZF, PF set, CF, OF cleared, AF preserved
+      "hlt\n");
+  RunUntilHalted(helper.get());
+  EXPECT_EQ(helper->cpu_.flags & kArithmeticFlags, kAF | kZF | kPF);
+}
+
+TEST_F(LazyFlagsTest, ConditionalJumpOnPendingFlags) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-lazy-flags-jcc-test",
+      "mov ax, 5\n"
+      "cmp ax, 6\n"
+      "jbe below\n"
+      "mov bx, 1\n"
+      "hlt\n"
+      "below: mov bx, 2\n"
+      "jl less\n"
+      "hlt\n"
+      "less: mov cx, 3\n"
+      "hlt\n");
+  helper->cpu_.registers[kBX] = 0;
+  helper->cpu_.registers[kCX] = 0;
+  RunUntilHalted(helper.get());
+  EXPECT_EQ(helper->cpu_.registers[kBX], 2);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 3);
+  EXPECT_EQ(
+      helper->cpu_.flags & kArithmeticFlags, kCF | kSF | kAF | kPF);
+}
+
+TEST_F(LazyFlagsTest, PushFlagsEvaluatesPendingFlags) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-lazy-flags-pushf-test",
+      "mov al, 0x7F\n"
+      "add al, 1\n"  // OF, SF, AF set
+      "pushf\n"
+      "pop bx\n"
+      "hlt\n");
+  helper->cpu_.registers[kSP] = 0x0800;
+  RunUntilHalted(helper.get());
+  EXPECT_EQ(helper->cpu_.registers[kBX] & kArithmeticFlags, kOF | kSF | kAF);
+  EXPECT_EQ(helper->cpu_.registers[kBX], helper->cpu_.flags);
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <map>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+using namespace std;
+
+class InOutTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ports_.clear();
+    num_word_calls_ = 0;
+  }
+
+  static uint8_t ReadPort(CPUState* cpu, uint16_t port) {
+    return ports_[port];
+  }
+
+  static void WritePort(CPUState* cpu, uint16_t port, uint8_t value) {
+    ports_[port] = value;
+  }
+
+  static uint16_t ReadPortWord(CPUState* cpu, uint16_t port) {
+    ++num_word_calls_;
+    return (ports_[port + 1] << 8) | ports_[port];
+  }
+
+  static void WritePortWord(CPUState* cpu, uint16_t port, uint16_t value) {
+    ++num_word_calls_;
+    ports_[port] = value & 0xFF;
+    ports_[port + 1] = value >> 8;
+  }
+
+  static map<uint16_t, uint8_t> ports_;
+  static int num_word_calls_;
+};
+
+map<uint16_t, uint8_t> InOutTest::ports_;
+int InOutTest::num_word_calls_ = 0;
+
+TEST_F(InOutTest, ByteAccess) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-in-out-byte-test",
+      "in al, 40h\n"
+      "out dx, al\n");
+  helper->cpu_.config->read_port = ReadPort;
+  helper->cpu_.config->write_port = WritePort;
+  ports_[0x40] = 0x12;
+  helper->cpu_.registers[kDX] = 0x3F5;
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kAX] & 0xFF, 0x12);
+  EXPECT_EQ(ports_[0x3F5], 0x12);
+}
+
+TEST_F(InOutTest, WordAccessWithByteCallbacks) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-in-out-word-byte-callbacks-test",
+      "in ax, 40h\n"
+      "out dx, ax\n");
+  helper->cpu_.config->read_port = ReadPort;
+  helper->cpu_.config->write_port = WritePort;
+  ports_[0x40] = 0x34;
+  ports_[0x41] = 0x12;
+  helper->cpu_.registers[kDX] = 0x300;
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 0x1234);
+  EXPECT_EQ(ports_[0x300], 0x34);
+  EXPECT_EQ(ports_[0x301], 0x12);
+}
+
+TEST_F(InOutTest, WordAccessWithWordCallbacks) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-in-out-word-word-callbacks-test",
+      "in ax, dx\n"
+      "out 60h, ax\n");
+  helper->cpu_.config->read_port_word = ReadPortWord;
+  helper->cpu_.config->write_port_word = WritePortWord;
+  ports_[0x200] = 0xCD;
+  ports_[0x201] = 0xAB;
+  helper->cpu_.registers[kDX] = 0x200;
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 0xABCD);
+  EXPECT_EQ(ports_[0x60], 0xCD);
+  EXPECT_EQ(ports_[0x61], 0xAB);
+  EXPECT_EQ(num_word_calls_, 2);
+}
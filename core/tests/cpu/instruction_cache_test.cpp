@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+using namespace std;
+
+class InstructionCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { CPUInitInstructionCache(&cache_); }
+
+  static CPUInstructionCache cache_;
+};
+
+CPUInstructionCache InstructionCacheTest::cache_;
+
+TEST_F(InstructionCacheTest, CachesLoop) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-instruction-cache-loop-test",
+      "mov cx, 10\n"
+      "loop_start: add ax, 1\n"
+      "loop loop_start\n");
+  helper->cpu_.config->instruction_cache = &cache_;
+  helper->cpu_.registers[kAX] = 0;
+
+  // mov + 10 x (add + loop)
+  helper->ExecuteInstructions(21);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 10);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+  EXPECT_EQ(cache_.num_misses, 3);
+  EXPECT_EQ(cache_.num_hits, 18);
+}
+
+TEST_F(InstructionCacheTest, SelfModifyingCode) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-instruction-cache-self-modifying-test",
+      "target: mov ax, 1\n"
+      "mov word [target + 1], 2\n"
+      "jmp target\n");
+  helper->cpu_.config->instruction_cache = &cache_;
+
+  helper->ExecuteInstructions(3);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 1);
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 2);
+}
+
+TEST_F(InstructionCacheTest, WritesToOtherPagesDoNotInvalidate) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-instruction-cache-other-page-test",
+      "target: mov ax, 1\n"
+      "mov word [0C00h], 2\n"
+      "jmp target\n");
+  helper->cpu_.config->instruction_cache = &cache_;
+
+  helper->ExecuteInstructions(6);
+  EXPECT_EQ(cache_.num_misses, 3);
+  EXPECT_EQ(cache_.num_hits, 3);
+}
+
+TEST_F(InstructionCacheTest, ExternalWriteRequiresInvalidation) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-instruction-cache-external-write-test",
+      "target: mov ax, 1\n"
+      "jmp target\n");
+  helper->cpu_.config->instruction_cache = &cache_;
+
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 1);
+  // Simulate a DMA write to the immediate operand.
+  helper->memory_[kCOMFileLoadOffset + 1] = 3;
+  CPUInvalidateInstructionCache(&helper->cpu_, kCOMFileLoadOffset + 1);
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 3);
+}
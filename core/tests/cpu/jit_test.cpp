@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+
+#include <sys/mman.h>
+
+#include <cstring>
+
+using namespace std;
+
+class JITTest : public ::testing::Test {
+ protected:
+  static constexpr uint32_t kCodeSize = 64 * 1024;
+
+  void SetUp() override {
+    code_ = static_cast<uint8_t*>(mmap(
+        nullptr, kCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(code_, MAP_FAILED);
+  }
+
+  void TearDown() override { munmap(code_, kCodeSize); }
+
+  // Run a program until HLT with CPUTickBlock(), with or without the JIT.
+  unique_ptr<CPUTestHelper> Run(
+      const string& name, const string& asm_code, bool enable_jit,
+      uint32_t code_size = kCodeSize, bool use_clock_cycles = false) {
+    auto helper = CPUTestHelper::CreateWithProgram(name, asm_code);
+    CPUInitBlockCache(&block_cache_);
+    helper->cpu_.config->block_cache = &block_cache_;
+    helper->cpu_.config->use_clock_cycles = use_clock_cycles;
+    if (enable_jit) {
+      CPUInitJIT(&jit_, code_, code_size);
+      helper->cpu_.config->jit = &jit_;
+    }
+    helper->cpu_.registers[kSP] = 0x0F00;
+    for (int i = 0; i < 100000 && !helper->cpu_.is_halted; ++i) {
+      uint32_t num_instructions;
+      EXPECT_EQ(
+          CPUTickBlock(&helper->cpu_, 50, &num_instructions), kExecuteSuccess);
+    }
+    EXPECT_TRUE(helper->cpu_.is_halted);
+    return helper;
+  }
+
+  // Run a program with and without the JIT in lockstep, and check that the
+  // resulting CPU state and memory are identical.
+  void RunInLockstep(
+      const string& name, const string& asm_code,
+      uint32_t code_size = kCodeSize, bool use_clock_cycles = false) {
+    auto interpreter = Run(name, asm_code, false, kCodeSize, use_clock_cycles);
+    auto jit = Run(name, asm_code, true, code_size, use_clock_cycles);
+    for (int i = 0; i < kNumRegisters; ++i) {
+      EXPECT_EQ(interpreter->cpu_.registers[i], jit->cpu_.registers[i])
+          << "register " << i;
+    }
+    EXPECT_EQ(interpreter->cpu_.flags, jit->cpu_.flags);
+    EXPECT_EQ(CPUGetFlags(&interpreter->cpu_), CPUGetFlags(&jit->cpu_));
+    EXPECT_EQ(interpreter->cpu_.cycles, jit->cpu_.cycles);
+    EXPECT_EQ(
+        memcmp(
+            interpreter->memory_.get(), jit->memory_.get(),
+            interpreter->memory_size_),
+        0);
+  }
+
+  static CPUBlockCache block_cache_;
+  CPUJIT jit_;
+  uint8_t* code_;
+};
+
+CPUBlockCache JITTest::block_cache_;
+
+static const char kRegisterMovesProgram[] =
+    "mov cx, 100\n"
+    "loop_start: mov bx, cx\n"
+    "mov dl, bl\n"
+    "mov dh, 7\n"
+    "mov ah, dl\n"
+    "add ax, bx\n"
+    "mov [0800h], ax\n"
+    "mov es, cx\n"
+    "mov si, es\n"
+    "nop\n"
+    "loop loop_start\n"
+    "hlt\n";
+
+TEST_F(JITTest, RegisterMoves) {
+  RunInLockstep("execute-jit-register-moves-test", kRegisterMovesProgram);
+  EXPECT_GT(jit_.num_compiled_blocks, 0);
+  EXPECT_GT(jit_.num_native_executions, 0);
+}
+
+TEST_F(JITTest, FlushesFullCodeBuffer) {
+  RunInLockstep(
+      "execute-jit-flush-test", kRegisterMovesProgram,
+      kCPUJITMaxBlockCodeSize);
+  EXPECT_GT(jit_.num_flushes, 0);
+}
+
+// Each conditional jump follows a different ALU instruction, covering every
+// condition code.
+static const char kALUAndConditionalJumpsProgram[] =
+    "mov cx, 300\n"
+    "loop_start: mov ax, cx\n"
+    "mov bx, cx\n"
+    "shl bx, 1\n"
+    "add al, bl\n"
+    "jo l0\n"
+    "inc di\n"
+    "l0: sub ax, bx\n"
+    "jno l1\n"
+    "inc si\n"
+    "l1: cmp al, bh\n"
+    "jb l2\n"
+    "inc dx\n"
+    "l2: cmp ax, bx\n"
+    "jae l3\n"
+    "dec dx\n"
+    "l3: xor ax, bx\n"
+    "je l4\n"
+    "add di, 3\n"
+    "l4: and al, 0fh\n"
+    "jne l5\n"
+    "add si, 5\n"
+    "l5: cmp bl, al\n"
+    "jbe l6\n"
+    "inc bp\n"
+    "l6: sub bx, 1000\n"
+    "ja l7\n"
+    "dec bp\n"
+    "l7: test al, 8\n"
+    "js l8\n"
+    "or dx, 1\n"
+    "l8: add bx, cx\n"
+    "jns l9\n"
+    "or dx, 2\n"
+    "l9: or ax, bx\n"
+    "jp l10\n"
+    "xor di, dx\n"
+    "l10: cmp ax, 1234h\n"
+    "jnp l11\n"
+    "xor si, dx\n"
+    "l11: cmp al, 40h\n"
+    "jl l12\n"
+    "add bp, ax\n"
+    "l12: cmp bx, -200\n"
+    "jge l13\n"
+    "sub bp, ax\n"
+    "l13: dec ax\n"
+    "jle l14\n"
+    "add dx, ax\n"
+    "l14: inc bx\n"
+    "jg l15\n"
+    "sub dx, bx\n"
+    "l15: test dh, bl\n"
+    "jz l16\n"
+    "add [0800h], ax\n"
+    "l16: cmp ax, bx\n"
+    "inc si\n"
+    "jb l17\n"
+    "dec di\n"
+    "l17: stc\n"
+    "dec bx\n"
+    "adc [0802h], bx\n"
+    "loop loop_start\n"
+    "hlt\n";
+
+TEST_F(JITTest, ALUAndConditionalJumps) {
+  RunInLockstep("execute-jit-alu-test", kALUAndConditionalJumpsProgram);
+  EXPECT_GT(jit_.num_native_executions, 0);
+}
+
+TEST_F(JITTest, ALUAndConditionalJumpsWithClockCycles) {
+  RunInLockstep(
+      "execute-jit-alu-clock-cycles-test", kALUAndConditionalJumpsProgram,
+      kCodeSize, /* use_clock_cycles */ true);
+  EXPECT_GT(jit_.num_native_executions, 0);
+}
+
+TEST_F(JITTest, CallsAndStack) {
+  RunInLockstep(
+      "execute-jit-calls-test",
+      "mov cx, 50\n"
+      "loop_start: push cx\n"
+      "call foo\n"
+      "pop cx\n"
+      "loop loop_start\n"
+      "hlt\n"
+      "foo: mov ax, cx\n"
+      "shl ax, 1\n"
+      "adc dx, ax\n"
+      "ret\n");
+  EXPECT_GT(jit_.num_native_executions, 0);
+}
+
+TEST_F(JITTest, SelfModifyingCode) {
+  RunInLockstep(
+      "execute-jit-self-modifying-test",
+      "mov cx, 50\n"
+      "loop_start: mov word [target + 1], cx\n"
+      "target: mov ax, 1\n"
+      "add dx, ax\n"
+      "loop loop_start\n"
+      "hlt\n");
+  // The block rewrites itself on every iteration, so it never becomes hot.
+  EXPECT_EQ(jit_.num_compiled_blocks, 0);
+}
+
+#endif  // YAX86_CPU_HAS_JIT
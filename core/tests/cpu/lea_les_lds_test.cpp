@@ -112,6 +112,21 @@ TEST_F(LeaLesLdsTest, LEA) {
        {kAF, true}});
 }
 
+TEST_F(LeaLesLdsTest, LEAIgnoresSegmentBase) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-lea-segment-test",
+      "lea si, [di+2]\n"
+      "lea ax, [bp+4]\n");
+  // The result is an offset, regardless of the segment it refers to.
+  helper->cpu_.registers[kDS] = 0x0040;
+  helper->cpu_.registers[kSS] = 0x0030;
+  helper->cpu_.registers[kDI] = 0x001E;
+  helper->cpu_.registers[kBP] = 0x0100;
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kSI], 0x0020);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 0x0104);
+}
+
 TEST_F(LeaLesLdsTest, LES) {
   auto helper =
       CPUTestHelper::CreateWithProgram("execute-les-test", "les di, [bx]\n");
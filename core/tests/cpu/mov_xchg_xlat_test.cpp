@@ -783,4 +783,20 @@ TEST_F(MovXchgXlatTest, XLAT) {
        {kPF, false},
        {kOF, false},
        {kAF, false}});
-}
\ No newline at end of file
+}
+
+TEST_F(MovXchgXlatTest, XLATWithSegmentOverride) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-xlat-segment-override-test",
+      "db 26h\n"  // ES segment override prefix
+      "xlat\n");
+  helper->cpu_.registers[kDS] = 0;
+  helper->cpu_.registers[kES] = 0x0010;
+  helper->cpu_.registers[kBX] = 0x0700;
+  helper->cpu_.registers[kAX] = 0x0005;
+  // The table is read from ES:BX, not DS:BX.
+  helper->memory_[0x0705] = 0x11;
+  helper->memory_[0x0805] = 0x22;
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 0x0022);
+}
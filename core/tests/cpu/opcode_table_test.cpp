@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <memory>
+
 #define YAX86_IMPLEMENTATION
 #include "cpu.h"
 
@@ -48,3 +51,108 @@ TEST_F(OpcodeTableTest, InstructionPrefixMetadataIntegrity) {
         << "Handler should be null for prefix opcode 0x" << hex << prefix;
   }
 }
+
+// Memory for SpecializedHandlersMatchHandlers.
+constexpr uint32_t kSpecializedTestMemorySize = 0x10000;
+
+struct SpecializedTestMemory {
+  uint8_t bytes[kSpecializedTestMemorySize];
+};
+
+uint8_t ReadSpecializedTestMemory(CPUState* cpu, uint32_t address) {
+  return static_cast<SpecializedTestMemory*>(cpu->config->context)
+      ->bytes[address % kSpecializedTestMemorySize];
+}
+
+void WriteSpecializedTestMemory(
+    CPUState* cpu, uint32_t address, uint8_t value) {
+  static_cast<SpecializedTestMemory*>(cpu->config->context)
+      ->bytes[address % kSpecializedTestMemorySize] = value;
+}
+
+TEST_F(OpcodeTableTest, SpecializedHandlersMatchHandlers) {
+  auto expected_memory = make_unique<SpecializedTestMemory>();
+  auto actual_memory = make_unique<SpecializedTestMemory>();
+  CPUConfig expected_config = {0};
+  expected_config.context = expected_memory.get();
+  expected_config.read_memory_byte = ReadSpecializedTestMemory;
+  expected_config.write_memory_byte = WriteSpecializedTestMemory;
+  CPUConfig actual_config = expected_config;
+  actual_config.context = actual_memory.get();
+  for (uint32_t i = 0; i < kSpecializedTestMemorySize; ++i) {
+    expected_memory->bytes[i] = i * 37 + (i >> 8) * 101 + 11;
+  }
+
+  uint32_t seed = 12345;
+  auto next_random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xFFFF;
+  };
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    const OpcodeMetadata* metadata = &opcode_table[opcode];
+    if (!metadata->specialized_handlers[kModRMClassMemory] &&
+        !metadata->specialized_handlers[kModRMClassRegister]) {
+      continue;
+    }
+    for (int mod_rm = 0; mod_rm < 256; ++mod_rm) {
+      Instruction instruction = {0};
+      instruction.opcode = opcode;
+      instruction.has_mod_rm = true;
+      instruction.mod_rm.mod = mod_rm >> 6;
+      instruction.mod_rm.reg = (mod_rm >> 3) & 7;
+      instruction.mod_rm.rm = mod_rm & 7;
+      if (instruction.mod_rm.mod == 1) {
+        instruction.displacement_size = 1;
+      } else if (
+          instruction.mod_rm.mod == 2 ||
+          (instruction.mod_rm.mod == 0 && instruction.mod_rm.rm == 6)) {
+        instruction.displacement_size = 2;
+      }
+      instruction.displacement[0] = next_random();
+      instruction.displacement[1] = next_random();
+      ResolveMemoryOperand(&instruction);
+
+      CPUState expected, actual;
+      CPUInit(&expected, &expected_config);
+      for (int i = 0; i < kNumRegisters; ++i) {
+        expected.registers[i] = next_random();
+      }
+      for (int i = kES; i <= kDS; ++i) {
+        CPUSetSegmentRegister(
+            &expected, (RegisterIndex)i, expected.registers[i]);
+      }
+      CPUSetFlag(&expected, kCF, next_random() & 1);
+      actual = expected;
+      actual.config = &actual_config;
+      *actual_memory = *expected_memory;
+
+      InstructionContext expected_context = {
+          &expected, &instruction, metadata};
+      InstructionContext actual_context = {&actual, &instruction, metadata};
+      ModRMClass mod_rm_class = instruction.mod_rm.mod == 3
+                                    ? kModRMClassRegister
+                                    : kModRMClassMemory;
+      ASSERT_EQ(metadata->handler(&expected_context), kExecuteSuccess);
+      ASSERT_EQ(
+          metadata->specialized_handlers[mod_rm_class](&actual_context),
+          kExecuteSuccess);
+      CPUMaterializeFlags(&expected);
+      CPUMaterializeFlags(&actual);
+      for (int i = 0; i < kNumRegisters; ++i) {
+        EXPECT_EQ(expected.registers[i], actual.registers[i])
+            << "Register " << i << " mismatch for opcode 0x" << hex << opcode
+            << " ModR/M 0x" << mod_rm;
+      }
+      EXPECT_EQ(expected.flags, actual.flags)
+          << "Flags mismatch for opcode 0x" << hex << opcode << " ModR/M 0x"
+          << mod_rm;
+      EXPECT_EQ(
+          memcmp(
+              expected_memory->bytes, actual_memory->bytes,
+              kSpecializedTestMemorySize),
+          0)
+          << "Memory mismatch for opcode 0x" << hex << opcode << " ModR/M 0x"
+          << mod_rm;
+    }
+  }
+}
@@ -91,3 +91,38 @@ TEST_F(PushPopTest, PopMemory) {
   EXPECT_EQ(helper->memory_[0x401], 0xAB);  // High byte
   EXPECT_EQ(helper->cpu_.registers[kSP], initial_sp + 2);
 }
+
+TEST_F(PushPopTest, PushPopUseWordCallbacks) {
+  static int num_word_reads;
+  static int num_word_writes;
+  num_word_reads = 0;
+  num_word_writes = 0;
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-push-pop-word-callbacks-test",
+      "push ax\n"
+      "pop bx\n");
+  static uint8_t* memory;
+  memory = helper->memory_.get();
+  helper->cpu_.config->read_memory_word = [](CPUState* cpu,
+                                             uint32_t address) -> uint16_t {
+    ++num_word_reads;
+    return (memory[address + 1] << 8) | memory[address];
+  };
+  helper->cpu_.config->write_memory_word = [](CPUState* cpu, uint32_t address,
+                                              uint16_t value) {
+    ++num_word_writes;
+    memory[address] = value & 0xFF;
+    memory[address + 1] = value >> 8;
+  };
+  helper->cpu_.registers[kSS] = 0;
+  helper->cpu_.registers[kSP] = helper->memory_size_ - 2;
+  helper->cpu_.registers[kAX] = 0xBEEF;
+  helper->cpu_.registers[kBX] = 0;
+
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kBX], 0xBEEF);
+  EXPECT_EQ(helper->memory_[helper->memory_size_ - 4], 0xEF);
+  EXPECT_EQ(helper->memory_[helper->memory_size_ - 3], 0xBE);
+  EXPECT_EQ(num_word_writes, 1);
+  EXPECT_EQ(num_word_reads, 1);
+}
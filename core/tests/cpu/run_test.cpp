@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+using namespace std;
+
+// Runs each test with both the threaded and the portable dispatch loop.
+class RunTest : public ::testing::TestWithParam<bool> {
+ protected:
+  // Each dispatch mode assembles the program under its own name, as ctest may
+  // run them in parallel.
+  unique_ptr<CPUTestHelper> CreateWithProgram(
+      const string& name, const string& asm_code) {
+    auto helper = CPUTestHelper::CreateWithProgram(
+        name + (GetParam() ? "-portable" : "-threaded"), asm_code);
+    helper->cpu_.config->use_portable_dispatch = GetParam();
+    return helper;
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(
+    Dispatch, RunTest, ::testing::Values(false, true),
+    [](const ::testing::TestParamInfo<bool>& info) {
+      return info.param ? "Portable" : "Threaded";
+    });
+
+TEST_P(RunTest, ReturnsWhenHalted) {
+  auto helper = CreateWithProgram(
+      "execute-run-halt-test",
+      "mov cx, 10\n"
+      "loop_start: add ax, 1\n"
+      "loop loop_start\n"
+      "hlt\n"
+      "mov ax, 0\n");
+  helper->cpu_.registers[kAX] = 0;
+
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  // mov + 10 x (add + loop) + hlt
+  EXPECT_EQ(num_cycles, 22);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 10);
+
+  // The halted CPU idles for the whole budget.
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 100);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 10);
+}
+
+TEST_P(RunTest, StopsAtMaxCycles) {
+  auto helper = CreateWithProgram(
+      "execute-run-max-cycles-test",
+      "loop_start: add ax, 1\n"
+      "jmp loop_start\n");
+  helper->cpu_.registers[kAX] = 0;
+
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 5, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 5);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 3);
+}
+
+TEST_P(RunTest, StopsWhenRequested) {
+  auto helper = CreateWithProgram(
+      "execute-run-stop-test",
+      "loop_start: add ax, 1\n"
+      "out 0x80, al\n"
+      "jmp loop_start\n");
+  helper->cpu_.registers[kAX] = 0;
+  helper->cpu_.config->write_port = [](CPUState* cpu, uint16_t, uint8_t) {
+    CPURequestStop(cpu);
+  };
+
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 2);
+  EXPECT_FALSE(helper->cpu_.stop_requested);
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 3);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 2);
+}
+
+TEST_P(RunTest, ReturnsOnInvalidOpcode) {
+  auto helper = CreateWithProgram(
+      "execute-run-invalid-opcode-test",
+      "add ax, 1\n"
+      "db 0x0F\n");
+  // POP CS is treated as an invalid opcode.
+  uint32_t num_cycles = 0;
+  ExecuteStatus status = CPURun(&helper->cpu_, 100, &num_cycles);
+  EXPECT_NE(status, kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 2);
+  EXPECT_EQ(helper->cpu_.registers[kAX], 1);
+}
+
+TEST_P(RunTest, RunsMixedInstructions) {
+  auto helper = CreateWithProgram(
+      "execute-run-mixed-test",
+      "mov cx, 100\n"
+      "mov bx, 0x800\n"
+      "mov sp, 0xF00\n"
+      "loop_start: mov al, cl\n"
+      "xor al, 0x5A\n"
+      "mov [bx], al\n"
+      "inc bx\n"
+      "add dx, ax\n"
+      "shl dx, 1\n"
+      "push dx\n"
+      "pop si\n"
+      "loop loop_start\n"
+      "hlt\n");
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 10000, &num_cycles), kExecuteSuccess);
+  // 3 x mov + 100 x 9 + hlt
+  EXPECT_EQ(num_cycles, 904);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+  EXPECT_EQ(helper->cpu_.registers[kBX], 0x800 + 100);
+  EXPECT_EQ(helper->cpu_.registers[kSI], helper->cpu_.registers[kDX]);
+  EXPECT_EQ(helper->memory_[0x800], 100 ^ 0x5A);
+  EXPECT_EQ(helper->memory_[0x800 + 99], 1 ^ 0x5A);
+}
+
+TEST_P(RunTest, UsesUpdatedSegmentRegisters) {
+  auto helper = CreateWithProgram(
+      "execute-run-segment-test",
+      "mov ds, ax\n"
+      "mov bl, [0010h]\n"   // Default to DS
+      "mov bh, [bp+10h]\n"  // Default to SS for BP-based addressing
+      "db 0x26\n"           // ES segment override prefix
+      "mov cl, [bp+10h]\n"
+      "pop ds\n"
+      "mov ch, [0010h]\n"
+      "hlt\n");
+  helper->cpu_.registers[kAX] = 0x20;
+  helper->cpu_.registers[kBP] = 0x08;
+  helper->cpu_.registers[kSS] = 0x30;
+  helper->cpu_.registers[kES] = 0x40;
+  helper->cpu_.registers[kSP] = 0x80;
+  // Word 0x0050 at SS:SP.
+  helper->memory_[0x0380] = 0x50;
+  helper->memory_[0x0381] = 0x00;
+  helper->memory_[0x0210] = 0x11;
+  helper->memory_[0x0318] = 0x22;
+  helper->memory_[0x0418] = 0x33;
+  helper->memory_[0x0510] = 0x44;
+
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+  EXPECT_EQ(helper->cpu_.registers[kDS], 0x50);
+  EXPECT_EQ(helper->cpu_.registers[kBX], 0x2211);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0x4433);
+}
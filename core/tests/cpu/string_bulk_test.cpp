@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kMemorySize = 0x20000;
+
+// A repeated string instruction test case.
+struct StringBulkTestCase {
+  string name;
+  string asm_code;
+  uint16_t si;
+  uint16_t di;
+  uint16_t cx;
+  uint16_t ax;
+  // Additional memory setup.
+  function<void(uint8_t*)> setup_memory;
+};
+
+void PrintTo(const StringBulkTestCase& test_case, ostream* os) {
+  *os << test_case.name;
+}
+
+// Run a test case with memory accessed through callbacks or directly through
+// page tables, running at most max_string_iterations iterations per
+// instruction cycle.
+unique_ptr<CPUTestHelper> RunStringBulkTestCase(
+    const StringBulkTestCase& test_case, bool use_direct_memory,
+    uint8_t** pages, uint16_t max_string_iterations = 0) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      test_case.name, test_case.asm_code, kMemorySize);
+  for (size_t i = 0x1000; i < kMemorySize; ++i) {
+    helper->memory_[i] = (uint8_t)(i * 37 + (i >> 8) * 101 + 11);
+  }
+  if (test_case.setup_memory) {
+    test_case.setup_memory(helper->memory_.get());
+  }
+  if (use_direct_memory) {
+    for (uint32_t i = 0; i < kCPUNumMemoryPages; ++i) {
+      pages[i] = i < kMemorySize / kCPUMemoryPageSize
+                     ? helper->memory_.get() + i * kCPUMemoryPageSize
+                     : nullptr;
+    }
+    helper->cpu_.config->read_memory_pages = pages;
+    helper->cpu_.config->write_memory_pages = pages;
+  }
+  helper->cpu_.registers[kDS] = 0x100;
+  helper->cpu_.registers[kES] = 0x200;
+  helper->cpu_.registers[kSI] = test_case.si;
+  helper->cpu_.registers[kDI] = test_case.di;
+  helper->cpu_.registers[kCX] = test_case.cx;
+  helper->cpu_.registers[kAX] = test_case.ax;
+  helper->cpu_.config->max_string_iterations = max_string_iterations;
+  // Set or clear DF, then run the string instruction until it completes.
+  helper->ExecuteInstructions(1);
+  uint16_t string_instruction_ip = helper->cpu_.registers[kIP];
+  do {
+    helper->ExecuteInstructions(1);
+  } while (helper->cpu_.registers[kIP] == string_instruction_ip);
+  return helper;
+}
+
+class StringBulkTest : public ::testing::TestWithParam<StringBulkTestCase> {
+ protected:
+  uint8_t* pages_[kCPUNumMemoryPages];
+};
+
+// Expect two test case runs to have the same results.
+void ExpectSameResults(
+    const CPUTestHelper& expected, const CPUTestHelper& actual) {
+  for (int i = 0; i < kNumRegisters; ++i) {
+    EXPECT_EQ(expected.cpu_.registers[i], actual.cpu_.registers[i])
+        << "register " << i;
+  }
+  EXPECT_EQ(expected.cpu_.flags, actual.cpu_.flags);
+  EXPECT_EQ(
+      memcmp(expected.memory_.get(), actual.memory_.get(), kMemorySize), 0);
+}
+
+TEST_P(StringBulkTest, MatchesCallbacks) {
+  auto expected = RunStringBulkTestCase(GetParam(), false, pages_);
+  auto actual = RunStringBulkTestCase(GetParam(), true, pages_);
+  ExpectSameResults(*expected, *actual);
+}
+
+TEST_P(StringBulkTest, MatchesCallbacksInChunks) {
+  auto expected = RunStringBulkTestCase(GetParam(), false, pages_);
+  auto actual = RunStringBulkTestCase(GetParam(), true, pages_, 7);
+  ExpectSameResults(*expected, *actual);
+}
+
+// Make the 8 bytes starting at DS:offset_1 and ES:offset_2 equal, with
+// DS = 0x100 and ES = 0x200.
+function<void(uint8_t*)> MatchBytes(uint16_t offset_1, uint16_t offset_2) {
+  return [=](uint8_t* memory) {
+    memcpy(memory + 0x1000 + offset_1, memory + 0x2000 + offset_2, 8);
+  };
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    StringBulkTests, StringBulkTest,
+    ::testing::Values(
+        StringBulkTestCase{
+            "rep-movsb-forward", "cld\nrep movsb\n", 0x0100, 0x0800, 0x300,
+            0},
+        StringBulkTestCase{
+            "rep-movsb-backward", "std\nrep movsb\n", 0x0400, 0x0800, 0x300,
+            0},
+        // DI = SI + 1 in linear address space, replicating the first byte.
+        StringBulkTestCase{
+            "rep-movsb-forward-overlap", "cld\nrep movsb\n", 0x1001, 0x0002,
+            0x100, 0},
+        StringBulkTestCase{
+            "rep-movsb-forward-overlap-behind", "cld\nrep movsb\n", 0x1003,
+            0x0002, 0x100, 0},
+        StringBulkTestCase{
+            "rep-movsb-backward-overlap", "std\nrep movsb\n", 0x1003, 0x0002,
+            0x100, 0},
+        StringBulkTestCase{
+            "rep-movsw-forward-overlap", "cld\nrep movsw\n", 0x1001, 0x0002,
+            0x100, 0},
+        StringBulkTestCase{
+            "rep-movsw-backward-overlap", "std\nrep movsw\n", 0x1005, 0x0002,
+            0x100, 0},
+        StringBulkTestCase{
+            "rep-movsw-backward-overlap-ahead", "std\nrep movsw\n", 0x1000,
+            0x0003, 0x100, 0},
+        StringBulkTestCase{
+            "rep-movsw-segment-override", "cld\ndb 0x26\nrep movsw\n",
+            0x0100, 0x0800, 0x200, 0},
+        // The source wraps around the end of the segment.
+        StringBulkTestCase{
+            "rep-movsw-wrap", "cld\nrep movsw\n", 0xFFF0, 0x0800, 0x20, 0},
+        StringBulkTestCase{
+            "rep-stosb", "cld\nrep stosb\n", 0, 0x0100, 0x1234, 0xAB42},
+        StringBulkTestCase{
+            "rep-stosw-backward", "std\nrep stosw\n", 0, 0x3000, 0x800,
+            0xAB42},
+        StringBulkTestCase{
+            "rep-lodsb", "cld\nrep lodsb\n", 0x0100, 0, 0x300, 0},
+        StringBulkTestCase{
+            "rep-lodsw-backward", "std\nrep lodsw\n", 0x0800, 0, 0x300, 0},
+        StringBulkTestCase{
+            "repe-cmpsb", "cld\nrepe cmpsb\n", 0x0100, 0x0200, 0x100, 0,
+            MatchBytes(0x0100, 0x0200)},
+        StringBulkTestCase{
+            "repe-cmpsw-all-equal", "cld\nrepe cmpsw\n", 0x0100, 0x0200, 4,
+            0, MatchBytes(0x0100, 0x0200)},
+        StringBulkTestCase{
+            "repne-cmpsb-backward", "std\nrepne cmpsb\n", 0x0107, 0x0207,
+            0x100, 0, MatchBytes(0x0100, 0x0200)},
+        StringBulkTestCase{
+            "repne-cmpsw", "cld\nrepne cmpsw\n", 0x0100, 0x0208, 0x80, 0},
+        StringBulkTestCase{
+            "repne-scasb", "cld\nrepne scasb\n", 0, 0x0100, 0x400, 0x0042},
+        StringBulkTestCase{
+            "repne-scasb-not-found", "cld\nrepne scasb\n", 0, 0x0100, 0x10,
+            0x0042},
+        StringBulkTestCase{
+            "repe-scasw-backward", "std\nrepe scasw\n", 0, 0x0300, 0x10,
+            0x1234,
+            [](uint8_t* memory) {
+              for (int i = 0; i < 8; ++i) {
+                memory[0x2300 - i * 2] = 0x34;
+                memory[0x2301 - i * 2] = 0x12;
+              }
+            }}),
+    [](const ::testing::TestParamInfo<StringBulkTestCase>& info) {
+      string name = info.param.name;
+      for (char& c : name) {
+        if (c == '-') {
+          c = '_';
+        }
+      }
+      return name;
+    });
+
+TEST(StringBulkInvalidationTest, InvalidatesInstructionCache) {
+  // Overwrite the second instruction with NOPs using REP STOSB, then execute
+  // it.
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "rep-stosb-invalidation",
+      "rep stosb\n"
+      "inc bx\n",
+      kMemorySize);
+  auto cache = make_unique<CPUInstructionCache>();
+  CPUInitInstructionCache(cache.get());
+  uint8_t* pages[kCPUNumMemoryPages] = {0};
+  for (uint32_t i = 0; i < kMemorySize / kCPUMemoryPageSize; ++i) {
+    pages[i] = helper->memory_.get() + i * kCPUMemoryPageSize;
+  }
+  helper->cpu_.config->instruction_cache = cache.get();
+  helper->cpu_.config->read_memory_pages = pages;
+  helper->cpu_.config->write_memory_pages = pages;
+
+  // Cache the INC BX instruction by executing it once.
+  helper->cpu_.registers[kIP] = 0x102;
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kBX], 1);
+
+  helper->cpu_.registers[kIP] = 0x100;
+  helper->cpu_.registers[kES] = 0;
+  helper->cpu_.registers[kDI] = 0x102;
+  helper->cpu_.registers[kCX] = 1;
+  // NOP
+  helper->cpu_.registers[kAX] = 0x90;
+  helper->ExecuteInstructions(2);
+  EXPECT_EQ(helper->cpu_.registers[kBX], 1);
+  EXPECT_EQ(helper->cpu_.registers[kIP], 0x103);
+}
+
+}  // namespace
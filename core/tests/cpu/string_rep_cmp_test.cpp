@@ -875,4 +875,29 @@ TEST_F(StringRepCmpTest, CMPSSegmentOverride) {
   // Check that SI and DI were incremented by 1
   EXPECT_EQ(helper->cpu_.registers[kSI], 0x01);
   EXPECT_EQ(helper->cpu_.registers[kDI], 0x01);
-}
\ No newline at end of file
+}
+TEST_F(StringRepCmpTest, REPNEScasbInChunks) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "repne-scasb-chunks-test", "repne scasb\n");
+  helper->cpu_.config->max_string_iterations = 3;
+  helper->cpu_.registers[kES] = 0x030;
+  helper->cpu_.registers[kDI] = 0x00;
+  helper->cpu_.registers[kCX] = 10;
+  helper->cpu_.registers[kAX] = 0x55;
+  CPUSetFlag(&helper->cpu_, kDF, false);
+  helper->memory_[0x304] = 0x55;
+
+  // The first execution scans 3 bytes without a match and is repeated.
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 7);
+  EXPECT_EQ(helper->cpu_.registers[kDI], 0x03);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset);
+  EXPECT_FALSE(CPUGetFlag(&helper->cpu_, kZF));
+
+  // The second execution finds the match and terminates.
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 5);
+  EXPECT_EQ(helper->cpu_.registers[kDI], 0x05);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 2);
+  EXPECT_TRUE(CPUGetFlag(&helper->cpu_, kZF));
+}
@@ -1039,3 +1039,65 @@ TEST_F(StringRepTest, LODSWMultipleOperations) {
   EXPECT_EQ(helper->cpu_.registers[kAX], 0x4433);
   EXPECT_EQ(helper->cpu_.registers[kSI], 0x0304);
 }
+
+TEST_F(StringRepTest, REPMOVSBInChunks) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-rep-movsb-chunks-test", "rep movsb\n");
+  helper->cpu_.config->max_string_iterations = 4;
+  helper->cpu_.registers[kDS] = 0;
+  helper->cpu_.registers[kES] = 0;
+  helper->cpu_.registers[kSI] = 0x0400;
+  helper->cpu_.registers[kDI] = 0x0500;
+  helper->cpu_.registers[kCX] = 10;
+  CPUSetFlag(&helper->cpu_, kDF, false);
+  for (int i = 0; i < 10; ++i) {
+    helper->memory_[0x0400 + i] = 0x10 + i;
+  }
+
+  // The first two executions copy 4 bytes each, and rewind IP to re-execute
+  // the instruction.
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 6);
+  EXPECT_EQ(helper->cpu_.registers[kSI], 0x0404);
+  EXPECT_EQ(helper->cpu_.registers[kDI], 0x0504);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset);
+  EXPECT_EQ(helper->memory_[0x0503], 0x13);
+  EXPECT_EQ(helper->memory_[0x0504], 0x00);
+
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 2);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset);
+
+  // The last execution copies the remaining 2 bytes and moves on.
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+  EXPECT_EQ(helper->cpu_.registers[kSI], 0x040A);
+  EXPECT_EQ(helper->cpu_.registers[kDI], 0x050A);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 2);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(helper->memory_[0x0500 + i], 0x10 + i);
+  }
+}
+
+TEST_F(StringRepTest, REPSTOSWInChunksWithSegmentOverride) {
+  // The segment override prefix is ignored by STOS, but must be preserved
+  // when the instruction is re-executed.
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "execute-rep-stosw-chunks-test", "cs rep stosw\n");
+  helper->cpu_.config->max_string_iterations = 2;
+  helper->cpu_.registers[kES] = 0;
+  helper->cpu_.registers[kDI] = 0x0500;
+  helper->cpu_.registers[kCX] = 3;
+  helper->cpu_.registers[kAX] = 0x1234;
+
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 1);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset);
+
+  helper->ExecuteInstructions(1);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+  EXPECT_EQ(helper->cpu_.registers[kDI], 0x0506);
+  EXPECT_EQ(helper->cpu_.registers[kIP], kCOMFileLoadOffset + 3);
+  EXPECT_EQ(helper->memory_[0x0504], 0x34);
+  EXPECT_EQ(helper->memory_[0x0505], 0x12);
+}
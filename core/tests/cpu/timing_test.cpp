@@ -0,0 +1,272 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "./test_helpers.h"
+#include "cpu.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+#include <sys/mman.h>
+#endif  // YAX86_CPU_HAS_JIT
+
+using namespace std;
+
+namespace {
+
+// An instruction timing test case.
+struct TimingTestCase {
+  string name;
+  // Instructions to set up the CPU state, followed by the instruction to time.
+  string asm_code;
+  // Number of setup instructions.
+  int num_setup_instructions;
+  // Expected clock cycles of the timed instruction.
+  uint32_t clock_cycles;
+};
+
+void PrintTo(const TimingTestCase& test_case, ostream* os) {
+  *os << test_case.name;
+}
+
+class TimingTest : public ::testing::TestWithParam<TimingTestCase> {};
+
+TEST_P(TimingTest, CountsClockCycles) {
+  const TimingTestCase& test_case = GetParam();
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "timing-" + test_case.name, test_case.asm_code);
+  helper->cpu_.config->use_clock_cycles = true;
+  helper->cpu_.registers[kBX] = 0x400;
+  helper->cpu_.registers[kSI] = 0x500;
+  helper->cpu_.registers[kDI] = 0x600;
+  helper->cpu_.registers[kSP] = 0xF00;
+  for (int i = 0; i < test_case.num_setup_instructions; ++i) {
+    ASSERT_EQ(CPUTick(&helper->cpu_), kExecuteSuccess);
+  }
+  const uint32_t start_cycles = helper->cpu_.cycles;
+  const uint64_t start_clock_cycles = helper->cpu_.clock_cycles;
+  ASSERT_EQ(CPUTick(&helper->cpu_), kExecuteSuccess);
+  EXPECT_EQ(helper->cpu_.cycles - start_cycles, test_case.clock_cycles);
+  EXPECT_EQ(
+      helper->cpu_.clock_cycles - start_clock_cycles, test_case.clock_cycles);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    TimingTests, TimingTest,
+    ::testing::Values(
+        TimingTestCase{"add-reg-reg", "add ax, bx\n", 0, 3},
+        // 24 + 5 for [BX]
+        TimingTestCase{"add-mem-reg", "add [bx], ax\n", 0, 29},
+        // 13 + 11 for [BX+SI+disp]
+        TimingTestCase{"add-reg-mem-disp", "add ax, [bx+si+4]\n", 0, 24},
+        // 12 + 6 for [disp16]
+        TimingTestCase{"mov-reg-direct", "mov bx, [0x200]\n", 0, 18},
+        // 2 for the prefix + 12 + 5 for [SI]
+        TimingTestCase{"mov-segment-override", "mov bx, [es:si]\n", 0, 19},
+        // CMP does not write back to memory: 10 + 5 for [BX]
+        TimingTestCase{"cmp-mem-imm", "cmp byte [bx], 1\n", 0, 15},
+        TimingTestCase{"mul-reg8", "mul bl\n", 0, 77},
+        // 143 + 5 for [BX]
+        TimingTestCase{"mul-mem16", "mul word [bx]\n", 0, 148},
+        TimingTestCase{"jz-taken", "xor ax, ax\njz $+4\n", 1, 16},
+        TimingTestCase{"jz-not-taken", "or al, 1\njz $+4\n", 1, 4},
+        TimingTestCase{"loop-taken", "mov cx, 2\nloop $\n", 1, 17},
+        TimingTestCase{"loop-not-taken", "mov cx, 1\nloop $\n", 1, 5},
+        // 8 + 4 per bit
+        TimingTestCase{"shl-reg-cl", "mov cl, 3\nshl ax, cl\n", 1, 20},
+        // 28 + 4 per bit + 5 for [BX]
+        TimingTestCase{
+            "shl-mem-cl", "mov cl, 3\nshl word [bx], cl\n", 1, 45},
+        // 9 + 17 per iteration
+        TimingTestCase{"rep-movsb", "mov cx, 5\nrep movsb\n", 1, 94},
+        // 9 + 19 per iteration, stopping at the first mismatch
+        TimingTestCase{
+            "repe-scasw", "mov ax, 1\nmov cx, 5\nrepe scasw\n", 2, 28},
+        TimingTestCase{"call-near", "call $+3\n", 0, 23}),
+    [](const ::testing::TestParamInfo<TimingTestCase>& info) {
+      string name = info.param.name;
+      for (char& c : name) {
+        if (c == '-') {
+          c = '_';
+        }
+      }
+      return name;
+    });
+
+TEST(TimingRunTest, BudgetsInClockCycles) {
+  auto helper = CPUTestHelper::CreateWithProgram(
+      "timing-run-test",
+      "mov cx, 10\n"
+      "loop_start: loop loop_start\n"
+      "hlt\n");
+  auto block_cache = make_unique<CPUBlockCache>();
+  CPUInitBlockCache(block_cache.get());
+  helper->cpu_.config->block_cache = block_cache.get();
+  helper->cpu_.config->use_clock_cycles = true;
+
+  // The last instruction may run past the budget: mov (4) + loop (17).
+  uint32_t num_cycles = 0;
+  EXPECT_EQ(CPURun(&helper->cpu_, 20, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 21);
+  EXPECT_EQ(helper->cpu_.registers[kCX], 9);
+
+  // 8 x loop taken (17) + loop not taken (5) + hlt (2)
+  EXPECT_EQ(CPURun(&helper->cpu_, 1000, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 8 * 17 + 5 + 2);
+  EXPECT_TRUE(helper->cpu_.is_halted);
+
+  // The halted CPU idles for the whole budget, one clock cycle per cycle.
+  EXPECT_EQ(CPURun(&helper->cpu_, 100, &num_cycles), kExecuteSuccess);
+  EXPECT_EQ(num_cycles, 100);
+  EXPECT_EQ(helper->cpu_.clock_cycles, 21 + 8 * 17 + 5 + 2 + 100);
+  EXPECT_EQ(helper->cpu_.cycles, helper->cpu_.clock_cycles);
+  // The loop ran from its translated block, skipping iterations at once.
+  EXPECT_EQ(block_cache->fusion_counts[kCPUFusionLoop], 1);
+  EXPECT_EQ(block_cache->num_skipped_loop_iterations, 7);
+}
+
+TEST(TimingRunTest, CountsChunkedRepeatedStringInstructionsOnce) {
+  // Clock cycles of a program, running REP string instructions in chunks of
+  // at most max_string_iterations iterations each.
+  auto count_clock_cycles = [](uint16_t max_string_iterations) {
+    auto helper = CPUTestHelper::CreateWithProgram(
+        "timing-chunked-rep-test",
+        "mov cx, 100\n"
+        "rep movsw\n"
+        "hlt\n");
+    helper->cpu_.config->use_clock_cycles = true;
+    helper->cpu_.config->max_string_iterations = max_string_iterations;
+    helper->cpu_.registers[kSI] = 0x500;
+    helper->cpu_.registers[kDI] = 0x700;
+    int num_ticks = 0;
+    while (!helper->cpu_.is_halted) {
+      EXPECT_EQ(CPUTick(&helper->cpu_), kExecuteSuccess);
+      ++num_ticks;
+    }
+    EXPECT_EQ(helper->cpu_.registers[kCX], 0);
+    EXPECT_EQ(helper->cpu_.cycles, helper->cpu_.clock_cycles);
+    return make_pair(num_ticks, helper->cpu_.clock_cycles);
+  };
+  // mov (4) + 9 + 25 per iteration + hlt (2)
+  const uint64_t expected_clock_cycles = 4 + 9 + 100 * 25 + 2;
+  const auto unchunked = count_clock_cycles(0);
+  EXPECT_EQ(unchunked.first, 3);
+  EXPECT_EQ(unchunked.second, expected_clock_cycles);
+  const auto chunked = count_clock_cycles(16);
+  EXPECT_EQ(chunked.first, 9);
+  EXPECT_EQ(chunked.second, expected_clock_cycles);
+}
+
+// How CPURun() executes instructions in TimingLockstepTest.
+enum class TimingRunMode { kDispatch, kBlockCache, kJIT };
+
+class TimingLockstepTest : public ::testing::TestWithParam<TimingRunMode> {};
+
+// Run a program with CPURun() in clock cycles, and expect the same state and
+// timing as CPUTick() after each batch.
+TEST_P(TimingLockstepTest, MatchesCPUTick) {
+  const string asm_code =
+      "mov cx, 40\n"
+      "outer: push cx\n"
+      "mov cl, 3\n"
+      "shl ax, cl\n"
+      "mul bx\n"
+      "pop cx\n"
+      "mov si, 0x500\n"
+      "mov di, 0x600\n"
+      "push cx\n"
+      "mov cx, 5\n"
+      "rep movsb\n"
+      "pop cx\n"
+      "cmp cx, 20\n"
+      "jb skip\n"
+      "add dx, [bx+si+4]\n"
+      "skip: inc bx\n"
+      "loop outer\n"
+      "mov cx, 300\n"
+      "delay: loop delay\n"
+      "hlt\n";
+  // Each mode assembles the program under its own name, as ctest may run them
+  // in parallel.
+  const string name =
+      "timing-lockstep-" + to_string(static_cast<int>(GetParam()));
+  auto expected = CPUTestHelper::CreateWithProgram(name, asm_code);
+  auto actual = CPUTestHelper::CreateWithProgram(name, asm_code);
+  auto block_cache = make_unique<CPUBlockCache>();
+  CPUInitBlockCache(block_cache.get());
+  if (GetParam() != TimingRunMode::kDispatch) {
+    actual->cpu_.config->block_cache = block_cache.get();
+  }
+#ifdef YAX86_CPU_HAS_JIT
+  constexpr size_t kCodeSize = 64 * 1024;
+  CPUJIT jit;
+  uint8_t* code = static_cast<uint8_t*>(mmap(
+      nullptr, kCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  ASSERT_NE(code, MAP_FAILED);
+  if (GetParam() == TimingRunMode::kJIT) {
+    CPUInitJIT(&jit, code, kCodeSize);
+    actual->cpu_.config->jit = &jit;
+  }
+#else
+  if (GetParam() == TimingRunMode::kJIT) {
+    GTEST_SKIP() << "JIT not available";
+  }
+#endif  // YAX86_CPU_HAS_JIT
+  for (CPUTestHelper* helper : {expected.get(), actual.get()}) {
+    helper->cpu_.config->use_clock_cycles = true;
+    helper->cpu_.registers[kSP] = 0xF00;
+  }
+
+  while (!actual->cpu_.is_halted) {
+    uint32_t num_cycles;
+    ASSERT_EQ(CPURun(&actual->cpu_, 37, &num_cycles), kExecuteSuccess);
+    while ((int32_t)(actual->cpu_.cycles - expected->cpu_.cycles) > 0) {
+      ASSERT_EQ(CPUTick(&expected->cpu_), kExecuteSuccess);
+    }
+    ASSERT_EQ(actual->cpu_.cycles, expected->cpu_.cycles);
+    ASSERT_EQ(actual->cpu_.clock_cycles, expected->cpu_.clock_cycles);
+    for (int i = 0; i < kNumRegisters; ++i) {
+      ASSERT_EQ(actual->cpu_.registers[i], expected->cpu_.registers[i])
+          << "register " << i << " at cycle " << actual->cpu_.cycles;
+    }
+    ASSERT_EQ(actual->cpu_.flags, expected->cpu_.flags);
+  }
+  EXPECT_TRUE(expected->cpu_.is_halted);
+  EXPECT_EQ(
+      memcmp(
+          expected->memory_.get(), actual->memory_.get(),
+          expected->memory_size_),
+      0);
+  if (GetParam() != TimingRunMode::kDispatch) {
+    EXPECT_GT(block_cache->fusion_counts[kCPUFusionLoop], 0);
+    EXPECT_GT(block_cache->num_skipped_loop_iterations, 0);
+  }
+#ifdef YAX86_CPU_HAS_JIT
+  if (GetParam() == TimingRunMode::kJIT) {
+    EXPECT_GT(jit.num_native_executions, 0);
+  }
+  munmap(code, kCodeSize);
+#endif  // YAX86_CPU_HAS_JIT
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    TimingLockstepTests, TimingLockstepTest,
+    ::testing::Values(
+        TimingRunMode::kDispatch, TimingRunMode::kBlockCache,
+        TimingRunMode::kJIT),
+    [](const ::testing::TestParamInfo<TimingRunMode>& info) {
+      switch (info.param) {
+        case TimingRunMode::kDispatch:
+          return string("Dispatch");
+        case TimingRunMode::kBlockCache:
+          return string("BlockCache");
+        case TimingRunMode::kJIT:
+          return string("JIT");
+      }
+      return string();
+    });
+
+}  // namespace
@@ -101,4 +101,90 @@ TEST_F(DMATransferTest, MaskedChannelBlocksTransfer) {
   EXPECT_EQ(g_mock_memory[expected_address], 0x00);
 }
 
+TEST_F(DMATransferTest, BlockWriteTransfer) {
+  // Arrange: Configure Ch 2 for a memory write of 4 bytes.
+  SetUpChannel2ForTransfer(kDMAModeTransferTypeWrite, 4);
+  uint8_t data[] = {0x01, 0x02, 0x03, 0x04};
+
+  // Act: Transfer the first 3 bytes, then the rest.
+  EXPECT_EQ(DMATransferBlock(&dma_, 2, kDMAModeTransferTypeWrite, data, 3), 3);
+  EXPECT_EQ(dma_.status_register, 0);
+  EXPECT_EQ(dma_.channels[2].current_address, 0x1237);
+  EXPECT_EQ(dma_.channels[2].current_count, 0);
+  EXPECT_EQ(
+      DMATransferBlock(&dma_, 2, kDMAModeTransferTypeWrite, data + 3, 1), 1);
+
+  // Assert: The data was written to memory, and the channel reached TC.
+  const uint32_t expected_address = 0x011234;
+  EXPECT_EQ(memcmp(g_mock_memory + expected_address, data, sizeof(data)), 0);
+  EXPECT_EQ(dma_.status_register, (1 << 2));
+  EXPECT_EQ(dma_.mask_register & (1 << 2), (1 << 2));
+}
+
+TEST_F(DMATransferTest, BlockReadTransferStopsAtTerminalCount) {
+  // Arrange: Configure Ch 2 for a memory read of 2 bytes with address
+  // decrement.
+  SetUpChannel2ForTransfer(
+      kDMAModeTransferTypeRead | kDMAModeAddressDecrement, 2);
+  g_mock_memory[0x011234] = 0xAB;
+  g_mock_memory[0x011233] = 0xCD;
+  static int num_terminal_counts;
+  num_terminal_counts = 0;
+  config_.on_terminal_count = [](void* context, uint8_t channel) {
+    ++num_terminal_counts;
+  };
+
+  // Act: Attempt to transfer more bytes than the channel's count.
+  uint8_t data[4] = {0};
+  EXPECT_EQ(
+      DMATransferBlock(&dma_, 2, kDMAModeTransferTypeRead, data, sizeof(data)),
+      2);
+
+  // Assert: Only the bytes up to TC were read from memory.
+  EXPECT_EQ(data[0], 0xAB);
+  EXPECT_EQ(data[1], 0xCD);
+  EXPECT_EQ(data[2], 0x00);
+  EXPECT_EQ(num_terminal_counts, 1);
+  EXPECT_EQ(dma_.channels[2].current_address, 0x1232);
+  EXPECT_EQ(dma_.status_register, (1 << 2));
+  EXPECT_EQ(dma_.mask_register & (1 << 2), (1 << 2));
+}
+
+TEST_F(DMATransferTest, BlockTransferStopsAtTerminalCountWithAutoInitialize) {
+  // Arrange: Configure for a 2-byte transfer with auto-initialize.
+  SetUpChannel2ForTransfer(
+      kDMAModeTransferTypeWrite | kDMAModeAutoInitialize, 2);
+  uint8_t data[] = {0x01, 0x02, 0x03, 0x04};
+
+  // Act: Transfer more bytes than the channel's count.
+  EXPECT_EQ(
+      DMATransferBlock(&dma_, 2, kDMAModeTransferTypeWrite, data, sizeof(data)),
+      2);
+
+  // Assert: The channel was reinitialized, and remains unmasked.
+  EXPECT_EQ(g_mock_memory[0x011236], 0x00);
+  EXPECT_EQ(dma_.status_register, (1 << 2));
+  EXPECT_EQ(dma_.mask_register & (1 << 2), 0);
+  EXPECT_EQ(dma_.channels[2].current_address, dma_.channels[2].base_address);
+  EXPECT_EQ(dma_.channels[2].current_count, dma_.channels[2].base_count);
+}
+
+TEST_F(DMATransferTest, BlockTransferRequiresReadyChannel) {
+  // Arrange: Configure Ch 2 for a memory write.
+  SetUpChannel2ForTransfer(kDMAModeTransferTypeWrite, 4);
+  uint8_t data[] = {0x01, 0x02, 0x03, 0x04};
+
+  // Act & Assert: A transfer of the wrong type does nothing.
+  EXPECT_EQ(
+      DMATransferBlock(&dma_, 2, kDMAModeTransferTypeRead, data, sizeof(data)),
+      0);
+  // Act & Assert: A transfer on a masked channel does nothing.
+  DMAWritePort(&dma_, kDMAPortSingleMask, kDMAModeSelectChannel2 | (1 << 2));
+  EXPECT_EQ(
+      DMATransferBlock(&dma_, 2, kDMAModeTransferTypeWrite, data, sizeof(data)),
+      0);
+  EXPECT_EQ(g_mock_memory[0x011234], 0x00);
+  EXPECT_EQ(dma_.channels[2].current_count, 3);
+}
+
 }  // namespace
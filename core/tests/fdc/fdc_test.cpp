@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "fdc.h"
 
@@ -66,7 +71,7 @@ class FDCTest : public ::testing::Test {
     return FDCReadPort(&fdc_, kFDCPortData);
   }
 
-  FDCConfig config_;
+  FDCConfig config_ = {0};
   FDCState fdc_;
   bool irq6_raised_ = false;
   bool dma_requested_ = false;
@@ -593,4 +598,610 @@ TEST_F(FDCTest, SpecifyCommand) {
   EXPECT_FALSE(irq6_raised_);
 }
 
+// Runs Read Data and Write Data commands against a simulated DMA channel,
+// either one byte per request_dma call or in blocks with transfer_dma_block.
+struct FDCWithSimulatedDMA {
+  static constexpr uint32_t kImageSize = 64 * 1024;
+
+  FDCWithSimulatedDMA() {
+    image_.resize(kImageSize);
+    for (uint32_t i = 0; i < kImageSize; ++i) {
+      image_[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    memory_.resize(kImageSize);
+    for (uint32_t i = 0; i < kImageSize; ++i) {
+      memory_[i] = (uint8_t)(i * 13 + 5);
+    }
+
+    config_.context = this;
+    config_.raise_irq6 = [](void* context) {
+      static_cast<FDCWithSimulatedDMA*>(context)->irq6_raised_ = true;
+    };
+    config_.read_image_byte = [](void* context, uint8_t drive,
+                                 uint32_t offset) -> uint8_t {
+      FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+      ++test->num_image_byte_accesses_;
+      return test->image_[offset];
+    };
+    config_.write_image_byte = [](void* context, uint8_t drive,
+                                  uint32_t offset, uint8_t value) {
+      FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+      ++test->num_image_byte_accesses_;
+      test->image_[offset] = value;
+    };
+    config_.request_dma = [](void* context) {
+      FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+      if (test->dma_count_ == 0) {
+        // Channel masked after TC.
+        return;
+      }
+      uint8_t& value = test->memory_[test->dma_address_++];
+      if (test->to_memory_) {
+        value = FDCReadPort(&test->fdc_, kFDCPortData);
+      } else {
+        FDCWritePort(&test->fdc_, kFDCPortData, value);
+      }
+      if (--test->dma_count_ == 0) {
+        FDCHandleTC(&test->fdc_);
+      }
+    };
+    FDCInit(&fdc_, &config_);
+    FDCWritePort(&fdc_, kFDCPortDOR, kFDCDORReset | kFDCDORInterruptEnable);
+    FDCInsertDisk(&fdc_, 0, &kFDCFormat360KB);
+  }
+
+  void EnableBlockTransfers() {
+    config_.transfer_dma_block = [](void* context, uint8_t* data,
+                                    uint16_t size, bool to_memory) {
+      FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+      EXPECT_EQ(to_memory, test->to_memory_);
+      uint16_t num_bytes = std::min<uint32_t>(size, test->dma_count_);
+      uint8_t* memory = test->memory_.data() + test->dma_address_;
+      if (to_memory) {
+        memcpy(memory, data, num_bytes);
+      } else {
+        memcpy(data, memory, num_bytes);
+      }
+      test->dma_address_ += num_bytes;
+      test->dma_count_ -= num_bytes;
+      if (num_bytes > 0 && test->dma_count_ == 0) {
+        FDCHandleTC(&test->fdc_);
+      }
+      ++test->num_block_transfers_;
+      return num_bytes;
+    };
+  }
+
+  // Lets the FDC access image sectors directly. If read_only is true, sectors
+  // are only available for reading.
+  void EnableImageSectors(bool read_only) {
+    read_only_ = read_only;
+    config_.get_image_sector = [](void* context, uint8_t drive,
+                                  uint32_t offset, uint16_t size,
+                                  bool writable) -> uint8_t* {
+      FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+      if ((writable && test->read_only_) || offset + size > kImageSize) {
+        return nullptr;
+      }
+      ++test->num_image_sector_accesses_;
+      return test->image_.data() + offset;
+    };
+  }
+
+  // Caches tracks read from the image. If use_read_image_bytes is true, tracks
+  // are read with one read_image_bytes call.
+  void EnableTrackCache(bool use_read_image_bytes) {
+    track_cache_ = std::make_unique<FDCTrackCache>();
+    FDCInitTrackCache(track_cache_.get());
+    config_.track_cache = track_cache_.get();
+    if (use_read_image_bytes) {
+      config_.read_image_bytes = [](void* context, uint8_t drive,
+                                    uint32_t offset, uint8_t* data,
+                                    uint16_t size) {
+        FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+        if (offset + size > kImageSize) {
+          return false;
+        }
+        ++test->num_image_bytes_reads_;
+        memcpy(data, test->image_.data() + offset, size);
+        return true;
+      };
+    }
+  }
+
+  // Holds written sectors in a write cache. If use_write_image_bytes is true,
+  // runs of sectors are written with one write_image_bytes call.
+  void EnableWriteCache(bool use_write_image_bytes) {
+    write_cache_ = std::make_unique<FDCWriteCache>();
+    FDCInitWriteCache(write_cache_.get());
+    config_.write_cache = write_cache_.get();
+    if (use_write_image_bytes) {
+      config_.write_image_bytes = [](void* context, uint8_t drive,
+                                     uint32_t offset, const uint8_t* data,
+                                     uint16_t size) {
+        FDCWithSimulatedDMA* test = static_cast<FDCWithSimulatedDMA*>(context);
+        ++test->num_image_bytes_writes_;
+        memcpy(test->image_.data() + offset, data, size);
+      };
+    }
+  }
+
+  // Runs a Read Data (0x06) or Write Data (0x05) command with the MT bit
+  // starting at C=cylinder H=0 R=start_sector, transferring num_bytes via DMA.
+  // Returns the number of ticks until the command finishes.
+  int RunCommand(
+      uint8_t command, uint8_t start_sector, uint32_t num_bytes,
+      uint8_t cylinder = 0) {
+    to_memory_ = (command == 0x06);
+    result_.clear();
+    dma_count_ = num_bytes;
+    FDCWritePort(&fdc_, kFDCPortData, 0x80 | command);
+    const uint8_t params[] = {0x00, cylinder, 0x00, start_sector, 0x02, 0x09,
+                              0x2A, 0xFF};
+    for (uint8_t param : params) {
+      FDCWritePort(&fdc_, kFDCPortData, param);
+    }
+    int ticks = 0;
+    irq6_raised_ = false;
+    while (!irq6_raised_ && ticks < 10000) {
+      FDCTick(&fdc_);
+      ++ticks;
+    }
+    EXPECT_EQ(fdc_.phase, kFDCPhaseResult);
+    for (int i = 0; i < kFDCResultBufferSize; ++i) {
+      result_.push_back(FDCReadPort(&fdc_, kFDCPortData));
+    }
+    EXPECT_EQ(fdc_.phase, kFDCPhaseIdle);
+    return ticks;
+  }
+
+  FDCConfig config_ = {0};
+  FDCState fdc_;
+  bool irq6_raised_ = false;
+  std::vector<uint8_t> image_;
+  std::vector<uint8_t> memory_;
+  bool to_memory_ = false;
+  uint32_t dma_address_ = 0;
+  uint32_t dma_count_ = 0;
+  int num_block_transfers_ = 0;
+  bool read_only_ = false;
+  int num_image_byte_accesses_ = 0;
+  int num_image_sector_accesses_ = 0;
+  std::unique_ptr<FDCTrackCache> track_cache_;
+  int num_image_bytes_reads_ = 0;
+  std::unique_ptr<FDCWriteCache> write_cache_;
+  int num_image_bytes_writes_ = 0;
+  std::vector<uint8_t> result_;
+};
+
+// Run a command one byte at a time and in blocks, and expect the same results.
+void ExpectBlockTransferMatchesBytes(
+    uint8_t command, uint8_t start_sector, uint32_t num_bytes) {
+  FDCWithSimulatedDMA expected;
+  FDCWithSimulatedDMA actual;
+  actual.EnableBlockTransfers();
+  const int expected_ticks =
+      expected.RunCommand(command, start_sector, num_bytes);
+  const int actual_ticks = actual.RunCommand(command, start_sector, num_bytes);
+  EXPECT_GT(expected_ticks, 512);
+  EXPECT_LT(actual_ticks, 10);
+  EXPECT_GT(actual.num_block_transfers_, 0);
+  EXPECT_EQ(actual.image_, expected.image_);
+  EXPECT_EQ(actual.memory_, expected.memory_);
+  EXPECT_EQ(actual.dma_address_, expected.dma_address_);
+  EXPECT_EQ(actual.dma_count_, expected.dma_count_);
+  EXPECT_EQ(actual.result_, expected.result_);
+}
+
+TEST(FDCBlockTransfer, ReadDataMatchesBytes) {
+  ExpectBlockTransferMatchesBytes(0x06, 1, 512);
+}
+
+TEST(FDCBlockTransfer, ReadDataWithTCInSectorMatchesBytes) {
+  ExpectBlockTransferMatchesBytes(0x06, 1, 1000);
+}
+
+TEST(FDCBlockTransfer, ReadDataAcrossHeadsMatchesBytes) {
+  // Sectors 8 and 9 of head 0, then up to the end of track on head 1, where
+  // the command ends before TC.
+  ExpectBlockTransferMatchesBytes(0x06, 8, 20 * 512);
+}
+
+TEST(FDCBlockTransfer, WriteDataMatchesBytes) {
+  ExpectBlockTransferMatchesBytes(0x05, 1, 512);
+}
+
+TEST(FDCBlockTransfer, WriteDataWithTCInSectorMatchesBytes) {
+  ExpectBlockTransferMatchesBytes(0x05, 3, 1000);
+}
+
+TEST(FDCBlockTransfer, WriteDataAcrossHeadsMatchesBytes) {
+  ExpectBlockTransferMatchesBytes(0x05, 8, 20 * 512);
+}
+
+// Run a command with image byte callbacks and with direct access to image
+// sectors, and expect the same results.
+void ExpectImageSectorsMatchBytes(
+    uint8_t command, uint8_t start_sector, uint32_t num_bytes,
+    bool use_block_transfers) {
+  FDCWithSimulatedDMA expected;
+  FDCWithSimulatedDMA actual;
+  if (use_block_transfers) {
+    expected.EnableBlockTransfers();
+    actual.EnableBlockTransfers();
+  }
+  actual.EnableImageSectors(false);
+  expected.RunCommand(command, start_sector, num_bytes);
+  actual.RunCommand(command, start_sector, num_bytes);
+  EXPECT_GT(expected.num_image_byte_accesses_, 0);
+  EXPECT_EQ(actual.num_image_byte_accesses_, 0);
+  EXPECT_GT(actual.num_image_sector_accesses_, 0);
+  EXPECT_EQ(actual.image_, expected.image_);
+  EXPECT_EQ(actual.memory_, expected.memory_);
+  EXPECT_EQ(actual.result_, expected.result_);
+}
+
+TEST(FDCImageSector, ReadDataMatchesBytes) {
+  ExpectImageSectorsMatchBytes(0x06, 8, 1000, false);
+}
+
+TEST(FDCImageSector, ReadDataInBlocksMatchesBytes) {
+  ExpectImageSectorsMatchBytes(0x06, 8, 1000, true);
+}
+
+TEST(FDCImageSector, WriteDataMatchesBytes) {
+  ExpectImageSectorsMatchBytes(0x05, 8, 1000, false);
+}
+
+TEST(FDCImageSector, WriteDataInBlocksMatchesBytes) {
+  ExpectImageSectorsMatchBytes(0x05, 8, 1000, true);
+}
+
+TEST(FDCImageSector, WriteDataToReadOnlyImageUsesBytes) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableImageSectors(true);
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(fdc.num_image_sector_accesses_, 0);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 512);
+  EXPECT_TRUE(
+      std::equal(fdc.image_.begin(), fdc.image_.begin() + 512,
+                 fdc.memory_.begin()));
+}
+
+// Run a command with and without a track cache, and expect the same results.
+void ExpectTrackCacheMatchesBytes(
+    uint8_t command, uint8_t start_sector, uint32_t num_bytes,
+    bool use_block_transfers) {
+  FDCWithSimulatedDMA expected;
+  FDCWithSimulatedDMA actual;
+  if (use_block_transfers) {
+    expected.EnableBlockTransfers();
+    actual.EnableBlockTransfers();
+  }
+  actual.EnableTrackCache(true);
+  expected.RunCommand(command, start_sector, num_bytes);
+  actual.RunCommand(command, start_sector, num_bytes);
+  EXPECT_EQ(actual.image_, expected.image_);
+  EXPECT_EQ(actual.memory_, expected.memory_);
+  EXPECT_EQ(actual.result_, expected.result_);
+}
+
+TEST(FDCTrackCache, ReadDataMatchesBytes) {
+  // Sectors 8 and 9 of head 0, then sector 1 of head 1.
+  ExpectTrackCacheMatchesBytes(0x06, 8, 1100, false);
+}
+
+TEST(FDCTrackCache, ReadDataInBlocksMatchesBytes) {
+  ExpectTrackCacheMatchesBytes(0x06, 8, 1100, true);
+}
+
+TEST(FDCTrackCache, WriteDataMatchesBytes) {
+  ExpectTrackCacheMatchesBytes(0x05, 8, 1100, true);
+}
+
+TEST(FDCTrackCache, ReadsEachTrackOnce) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableTrackCache(true);
+  // Sectors 1 and 2 of head 0.
+  fdc.RunCommand(0x06, 1, 1024);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 1);
+  // Sector 3 of head 0 is served from the cache.
+  fdc.RunCommand(0x06, 3, 512);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 1);
+  EXPECT_GT(fdc.track_cache_->num_hits, 0);
+  // Sectors 8 and 9 of head 0 are served from the cache, then sector 1 of
+  // head 1 replaces the cached track.
+  fdc.RunCommand(0x06, 8, 1100);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 2);
+  // Sector 1 of head 0 is read again.
+  fdc.RunCommand(0x06, 1, 512);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 3);
+  EXPECT_EQ(fdc.track_cache_->num_fills, 3);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 0);
+  EXPECT_TRUE(std::equal(
+      fdc.image_.begin(), fdc.image_.begin() + 512,
+      fdc.memory_.begin() + 1024 + 512 + 1100));
+}
+
+TEST(FDCTrackCache, FillsWithImageBytes) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableTrackCache(false);
+  fdc.RunCommand(0x06, 1, 1024);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 9 * 512);
+  EXPECT_EQ(fdc.track_cache_->num_fills, 1);
+  EXPECT_TRUE(std::equal(
+      fdc.image_.begin(), fdc.image_.begin() + 1024, fdc.memory_.begin()));
+}
+
+TEST(FDCTrackCache, ReadsSeeWrites) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableTrackCache(true);
+  // Cache track 0 of head 0.
+  fdc.RunCommand(0x06, 1, 512);
+  // Overwrite sector 2 with the data just read.
+  fdc.dma_address_ = 0;
+  fdc.RunCommand(0x05, 2, 512);
+  // Read back sector 2 from the cache.
+  fdc.dma_address_ = 0x1000;
+  fdc.RunCommand(0x06, 2, 512);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 1);
+  EXPECT_TRUE(std::equal(
+      fdc.image_.begin(), fdc.image_.begin() + 512,
+      fdc.memory_.begin() + 0x1000));
+}
+
+TEST(FDCTrackCache, InsertDiskInvalidatesCache) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableTrackCache(true);
+  fdc.RunCommand(0x06, 1, 512);
+  // Change the disk.
+  for (uint32_t i = 0; i < 512; ++i) {
+    fdc.image_[i] = (uint8_t)~fdc.image_[i];
+  }
+  FDCInsertDisk(&fdc.fdc_, 0, &kFDCFormat360KB);
+  fdc.dma_address_ = 0;
+  fdc.RunCommand(0x06, 1, 512);
+  EXPECT_EQ(fdc.num_image_bytes_reads_, 2);
+  EXPECT_TRUE(std::equal(
+      fdc.image_.begin(), fdc.image_.begin() + 512, fdc.memory_.begin()));
+}
+
+// Write sectors 2 and part of 3, then read sectors 1 to 4, with and without a
+// write cache, and expect the same results.
+void ExpectWriteCacheMatchesBytes(
+    bool use_block_transfers, bool use_track_cache) {
+  FDCWithSimulatedDMA expected;
+  FDCWithSimulatedDMA actual;
+  if (use_block_transfers) {
+    expected.EnableBlockTransfers();
+    actual.EnableBlockTransfers();
+  }
+  if (use_track_cache) {
+    actual.EnableTrackCache(true);
+  }
+  actual.EnableWriteCache(true);
+  for (FDCWithSimulatedDMA* fdc : {&expected, &actual}) {
+    fdc->RunCommand(0x05, 2, 700);
+    fdc->dma_address_ = 0x1000;
+    fdc->RunCommand(0x06, 1, 4 * 512);
+  }
+  EXPECT_EQ(actual.memory_, expected.memory_);
+  EXPECT_EQ(actual.result_, expected.result_);
+  EXPECT_NE(actual.image_, expected.image_);
+  FDCFlush(&actual.fdc_);
+  EXPECT_EQ(actual.image_, expected.image_);
+  // Read the sectors again after the flush.
+  for (FDCWithSimulatedDMA* fdc : {&expected, &actual}) {
+    fdc->dma_address_ = 0x2000;
+    fdc->RunCommand(0x06, 1, 4 * 512);
+  }
+  EXPECT_EQ(actual.memory_, expected.memory_);
+  if (use_track_cache) {
+    EXPECT_EQ(actual.num_image_byte_accesses_, 0);
+  }
+}
+
+TEST(FDCWriteCache, ReadsSeePendingWrites) {
+  ExpectWriteCacheMatchesBytes(false, false);
+}
+
+TEST(FDCWriteCache, ReadsSeePendingWritesInBlocks) {
+  ExpectWriteCacheMatchesBytes(true, false);
+}
+
+TEST(FDCWriteCache, ReadsSeePendingWritesWithTrackCache) {
+  ExpectWriteCacheMatchesBytes(true, true);
+}
+
+TEST(FDCWriteCache, CoalescesWritesPerTrack) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(true);
+  const std::vector<uint8_t> original_image = fdc.image_;
+  // Sectors 8 and 9 of head 0, and sector 1 of head 1.
+  fdc.RunCommand(0x05, 8, 3 * 512);
+  // Sector 3 of head 0.
+  fdc.RunCommand(0x05, 3, 512);
+  EXPECT_EQ(fdc.image_, original_image);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 0);
+
+  FDCFlush(&fdc.fdc_);
+  // Sector 3, sectors 8 and 9, and sector 1 of head 1.
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 3);
+  EXPECT_EQ(fdc.write_cache_->num_image_writes, 3);
+  EXPECT_EQ(fdc.write_cache_->num_coalesced_bytes, 512);
+  EXPECT_EQ(fdc.write_cache_->num_flushes, 1);
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin(), fdc.memory_.begin() + 3 * 512,
+      fdc.image_.begin() + 7 * 512));
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin() + 3 * 512, fdc.memory_.begin() + 4 * 512,
+      fdc.image_.begin() + 2 * 512));
+
+  // Nothing is left to flush.
+  FDCFlush(&fdc.fdc_);
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 3);
+  EXPECT_EQ(fdc.write_cache_->num_flushes, 1);
+}
+
+TEST(FDCWriteCache, FlushesWhenFull) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(true);
+  // All sectors of both heads fill the cache.
+  fdc.RunCommand(0x05, 1, 18 * 512);
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 0);
+  // One more sector on the next cylinder flushes a track per head.
+  fdc.dma_address_ = 0x8000;
+  fdc.RunCommand(0x05, 1, 512, 1);
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 2);
+  EXPECT_EQ(fdc.write_cache_->num_coalesced_bytes, 2 * 8 * 512);
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin(), fdc.memory_.begin() + 18 * 512,
+      fdc.image_.begin()));
+  // The new write is still pending.
+  const uint32_t cylinder_1_offset = 18 * 512;
+  EXPECT_FALSE(std::equal(
+      fdc.memory_.begin() + 0x8000, fdc.memory_.begin() + 0x8000 + 512,
+      fdc.image_.begin() + cylinder_1_offset));
+  FDCFlush(&fdc.fdc_);
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin() + 0x8000, fdc.memory_.begin() + 0x8000 + 512,
+      fdc.image_.begin() + cylinder_1_offset));
+}
+
+TEST(FDCWriteCache, EjectFlushesPendingWrites) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(false);
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 0);
+  FDCEjectDisk(&fdc.fdc_, 0);
+  EXPECT_EQ(fdc.num_image_byte_accesses_, 512);
+  EXPECT_EQ(fdc.write_cache_->num_flushes, 1);
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin(), fdc.memory_.begin() + 512, fdc.image_.begin()));
+}
+
+TEST(FDCWriteCache, InsertDiskFlushesPendingWrites) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(true);
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 0);
+  // Insert another disk without ejecting the first one.
+  FDCInsertDisk(&fdc.fdc_, 0, &kFDCFormat360KB);
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 1);
+  EXPECT_EQ(fdc.write_cache_->num_flushes, 1);
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin(), fdc.memory_.begin() + 512, fdc.image_.begin()));
+  // Reads from the new disk do not see the writes to the previous one.
+  for (uint32_t i = 0; i < 512; ++i) {
+    fdc.image_[i] = (uint8_t)~fdc.image_[i];
+  }
+  fdc.dma_address_ = 0x1000;
+  fdc.RunCommand(0x06, 1, 512);
+  EXPECT_TRUE(std::equal(
+      fdc.image_.begin(), fdc.image_.begin() + 512,
+      fdc.memory_.begin() + 0x1000));
+  EXPECT_TRUE(FDCFlush(&fdc.fdc_));
+  EXPECT_EQ(fdc.num_image_bytes_writes_, 1);
+}
+
+TEST(FDCWriteCache, FailedFlushKeepsPendingWrites) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(true);
+  const std::vector<uint8_t> original_image = fdc.image_;
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(fdc.result_[0], kFDCST0NormalTermination);
+  // The image becomes unwritable before the write is flushed.
+  auto write_image_byte = fdc.config_.write_image_byte;
+  auto write_image_bytes = fdc.config_.write_image_bytes;
+  fdc.config_.write_image_byte = nullptr;
+  fdc.config_.write_image_bytes = nullptr;
+  EXPECT_FALSE(FDCFlush(&fdc.fdc_));
+  EXPECT_EQ(fdc.image_, original_image);
+  // The write is flushed once the image is writable again.
+  fdc.config_.write_image_byte = write_image_byte;
+  fdc.config_.write_image_bytes = write_image_bytes;
+  EXPECT_TRUE(FDCFlush(&fdc.fdc_));
+  EXPECT_TRUE(std::equal(
+      fdc.memory_.begin(), fdc.memory_.begin() + 512, fdc.image_.begin()));
+}
+
+TEST(FDCWriteCache, EjectReportsUnwritableImage) {
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableWriteCache(true);
+  const std::vector<uint8_t> original_image = fdc.image_;
+  fdc.RunCommand(0x05, 1, 512);
+  fdc.config_.write_image_byte = nullptr;
+  fdc.config_.write_image_bytes = nullptr;
+  EXPECT_FALSE(FDCEjectDisk(&fdc.fdc_, 0));
+  EXPECT_EQ(fdc.image_, original_image);
+}
+
+// Write a sector with no callback to write to the image, and expect a write
+// fault.
+void ExpectWriteDataWithoutImageWriterFails(
+    bool use_block_transfers, bool use_write_cache) {
+  FDCWithSimulatedDMA fdc;
+  if (use_block_transfers) {
+    fdc.EnableBlockTransfers();
+  }
+  if (use_write_cache) {
+    fdc.EnableWriteCache(false);
+  }
+  fdc.config_.write_image_byte = nullptr;
+  const std::vector<uint8_t> original_image = fdc.image_;
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(
+      fdc.result_[0], kFDCST0AbnormalTermination | kFDCST0EquipmentCheck);
+  EXPECT_EQ(fdc.image_, original_image);
+  EXPECT_TRUE(FDCFlush(&fdc.fdc_));
+}
+
+TEST(FDCWriteFault, WriteDataWithoutImageWriterFails) {
+  ExpectWriteDataWithoutImageWriterFails(false, false);
+}
+
+TEST(FDCWriteFault, WriteDataInBlocksWithoutImageWriterFails) {
+  ExpectWriteDataWithoutImageWriterFails(true, false);
+}
+
+TEST(FDCWriteFault, WriteDataToWriteCacheWithoutImageWriterFails) {
+  ExpectWriteDataWithoutImageWriterFails(true, true);
+}
+
+TEST(FDCWriteFault, WriteDataToReadOnlyImageSectorsFails) {
+  // Image sectors that are only readable do not make the image writable.
+  FDCWithSimulatedDMA fdc;
+  fdc.EnableBlockTransfers();
+  fdc.EnableImageSectors(true);
+  fdc.EnableWriteCache(false);
+  fdc.config_.write_image_byte = nullptr;
+  const std::vector<uint8_t> original_image = fdc.image_;
+  fdc.RunCommand(0x05, 1, 512);
+  EXPECT_EQ(
+      fdc.result_[0], kFDCST0AbnormalTermination | kFDCST0EquipmentCheck);
+  EXPECT_EQ(fdc.image_, original_image);
+  EXPECT_TRUE(FDCFlush(&fdc.fdc_));
+}
+
+TEST(FDCBlockTransfer, WriteDataWritesLastByteBeforeTC) {
+  // The byte delivered along with TC is written to the image.
+  FDCWithSimulatedDMA fdc;
+  const std::vector<uint8_t> expected_image = {
+      fdc.memory_[0], fdc.memory_[1], fdc.memory_[2], fdc.image_[3]};
+  fdc.RunCommand(0x05, 1, 3);
+  EXPECT_EQ(
+      std::vector<uint8_t>(fdc.image_.begin(), fdc.image_.begin() + 4),
+      expected_image);
+}
+
 } // namespace
@@ -158,4 +158,30 @@ TEST_F(KeyboardTest, ShortClockLowDoesNotReset) {
   ASSERT_EQ(g_irq1_count, 1);
 }
 
+TEST_F(KeyboardTest, NeedsTick) {
+  // Idle keyboard has nothing to do.
+  EXPECT_FALSE(KeyboardNeedsTick(&keyboard_));
+
+  // Buffered key press can be sent.
+  KeyboardHandleKeyPress(&keyboard_, 0x1E);
+  EXPECT_TRUE(KeyboardNeedsTick(&keyboard_));
+  KeyboardTickMs(&keyboard_);
+  // Waiting for ack.
+  EXPECT_FALSE(KeyboardNeedsTick(&keyboard_));
+  KeyboardHandleKeyPress(&keyboard_, 0x1F);
+  EXPECT_FALSE(KeyboardNeedsTick(&keyboard_));
+  KeyboardHandleControl(&keyboard_, true, true);
+  KeyboardHandleControl(&keyboard_, false, true);
+  EXPECT_TRUE(KeyboardNeedsTick(&keyboard_));
+  KeyboardTickMs(&keyboard_);
+
+  // Reset timer runs until reset is triggered.
+  KeyboardHandleControl(&keyboard_, false, false);
+  for (int i = 0; i < kKeyboardResetThresholdMs; ++i) {
+    EXPECT_TRUE(KeyboardNeedsTick(&keyboard_));
+    KeyboardTickMs(&keyboard_);
+  }
+  EXPECT_FALSE(KeyboardNeedsTick(&keyboard_));
+}
+
 }  // namespace
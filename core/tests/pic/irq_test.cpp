@@ -9,6 +9,7 @@ enum {
   kICW1_INIT = (1 << 4),   // 1 = initialization mode
   kICW1_SNGL = (1 << 1),   // 1 = single PIC, 0 = cascaded
   kOCW2_EOI = (1 << 5),    // End of Interrupt
+  kOCW2_SL = (1 << 6),     // Specific Level
   kICW2_BASE_XT = 0x08,    // Base for IBM PC/XT
   kICW2_BASE_AT_M = 0x08,  // Base for IBM PC/AT Master
   kICW2_BASE_AT_S = 0x70,  // Base for IBM PC/AT Slave
@@ -192,4 +193,52 @@ TEST_F(IRQTest, Cascaded_LowerIRQ) {
   EXPECT_EQ(master_.irr, 0);  // Master cascade line is down.
 }
 
+TEST_F(IRQTest, SinglePIC_HasPendingInterrupt) {
+  SetUpSinglePIC();
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+
+  // Raising an IRQ makes an interrupt pending.
+  PICRaiseIRQ(&master_, 4);
+  EXPECT_TRUE(PICHasPendingInterrupt(&master_));
+
+  // Masking the IRQ via OCW1 hides it, and unmasking it reveals it again.
+  PICWritePort(&master_, 0x21, 1 << 4);
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+  PICWritePort(&master_, 0x21, 0x00);
+  EXPECT_TRUE(PICHasPendingInterrupt(&master_));
+
+  // Acknowledging the interrupt clears it.
+  EXPECT_EQ(PICGetPendingInterrupt(&master_), kICW2_BASE_XT + 4);
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+
+  // A lower priority IRQ is held back until the in-service IRQ ends.
+  PICRaiseIRQ(&master_, 6);
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+  PICWritePort(&master_, 0x20, kOCW2_EOI | kOCW2_SL | 4);
+  EXPECT_TRUE(PICHasPendingInterrupt(&master_));
+
+  // Lowering the IRQ line withdraws the request.
+  PICLowerIRQ(&master_, 6);
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+}
+
+TEST_F(IRQTest, Cascaded_HasPendingInterrupt) {
+  SetUpCascadedPICs();
+
+  // A masked slave IRQ raises the cascade line, but is not deliverable.
+  PICWritePort(&slave_, 0xA1, 1 << 3);
+  PICRaiseIRQ(&slave_, 3);
+  EXPECT_EQ(master_.irr, 1 << 2);
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+
+  // Unmasking it on the slave makes it pending on the master.
+  PICWritePort(&slave_, 0xA1, 0x00);
+  EXPECT_TRUE(PICHasPendingInterrupt(&slave_));
+  EXPECT_TRUE(PICHasPendingInterrupt(&master_));
+
+  EXPECT_EQ(PICGetPendingInterrupt(&master_), kICW2_BASE_AT_S + 3);
+  EXPECT_FALSE(PICHasPendingInterrupt(&slave_));
+  EXPECT_FALSE(PICHasPendingInterrupt(&master_));
+}
+
 }  // namespace
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include "pit.h"
+
+namespace {
+
+static int irq_0_call_count;
+static void MockRaiseIRQ0(void* context) { ++irq_0_call_count; }
+
+class AdvanceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    config_.raise_irq_0 = MockRaiseIRQ0;
+    irq_0_call_count = 0;
+  }
+
+  // Program a channel with a mode and an LSB/MSB reload value.
+  static void Program(
+      PITState* pit, int channel_index, uint8_t mode, uint16_t reload_value) {
+    PITWritePort(
+        pit, kPITPortControl,
+        (channel_index << 6) | (kPITAccessLSBThenMSB << 4) | (mode << 1));
+    PITWritePort(pit, kPITPortChannel0 + channel_index, reload_value & 0xFF);
+    PITWritePort(pit, kPITPortChannel0 + channel_index, reload_value >> 8);
+  }
+
+  // Read a channel's current counter through a latch command.
+  static uint16_t ReadCounter(PITState* pit, int channel_index) {
+    PITWritePort(pit, kPITPortControl, channel_index << 6);
+    uint8_t lsb = PITReadPort(pit, kPITPortChannel0 + channel_index);
+    uint8_t msb = PITReadPort(pit, kPITPortChannel0 + channel_index);
+    return (msb << 8) | lsb;
+  }
+
+  // Expect PITAdvance() to match running the per-tick handlers with PITTick()
+  // for a channel in a mode.
+  void ExpectAdvanceMatchesTick(
+      int channel_index, uint8_t mode, uint16_t reload_value) {
+    PITState expected, actual;
+    PITInit(&expected, &config_);
+    PITInit(&actual, &config_);
+    Program(&expected, channel_index, mode, reload_value);
+    Program(&actual, channel_index, mode, reload_value);
+    irq_0_call_count = 0;
+    uint32_t num_ticks = 1;
+    for (int i = 0; i < 12; ++i) {
+      for (uint32_t j = 0; j < num_ticks; ++j) {
+        PITTick(&expected);
+      }
+      int expected_irq_0_call_count = irq_0_call_count;
+      irq_0_call_count = 0;
+      PITAdvance(&actual, num_ticks);
+      EXPECT_EQ(
+          irq_0_call_count, channel_index == 0 ? expected_irq_0_call_count : 0);
+      irq_0_call_count = 0;
+      EXPECT_EQ(
+          ReadCounter(&actual, channel_index),
+          ReadCounter(&expected, channel_index))
+          << "mode " << (int)mode << " reload " << reload_value << " after "
+          << num_ticks << " ticks";
+      EXPECT_EQ(
+          actual.channels[channel_index].output_state,
+          expected.channels[channel_index].output_state);
+      num_ticks = num_ticks * 3 + 1;
+    }
+  }
+
+  PITConfig config_ = {0};
+};
+
+TEST_F(AdvanceTest, MatchesTick) {
+  static const uint16_t kReloadValues[] = {0, 1, 2, 3, 18, 1193, 0x8001};
+  for (int channel_index = 0; channel_index < kPITNumChannels;
+       ++channel_index) {
+    for (uint8_t mode : {0, 2, 3}) {
+      for (uint16_t reload_value : kReloadValues) {
+        ExpectAdvanceMatchesTick(channel_index, mode, reload_value);
+      }
+    }
+  }
+}
+
+TEST_F(AdvanceTest, TicksUntilIRQ0) {
+  PITState pit;
+  PITInit(&pit, &config_);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), kPITNoIRQ0);
+
+  // Mode 3 raises IRQ 0 once per period.
+  Program(&pit, 0, 3, 10000);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), 10000);
+  PITAdvance(&pit, 9999);
+  EXPECT_EQ(irq_0_call_count, 0);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), 1);
+  PITAdvance(&pit, 1);
+  EXPECT_EQ(irq_0_call_count, 1);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), 10000);
+
+  // Mode 2 raises IRQ 0 when the counter reaches 0.
+  Program(&pit, 0, 2, 100);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), 100);
+
+  // Mode 0 raises IRQ 0 once on terminal count.
+  Program(&pit, 0, 0, 50);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), 50);
+  irq_0_call_count = 0;
+  PITAdvance(&pit, 50);
+  EXPECT_EQ(irq_0_call_count, 1);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&pit), kPITNoIRQ0);
+}
+
+TEST_F(AdvanceTest, Mode0CountOfZero) {
+  // A count of 0 is treated as 0x10000, whether ticked one at a time or
+  // advanced in one step.
+  PITState ticked, advanced;
+  PITInit(&ticked, &config_);
+  PITInit(&advanced, &config_);
+  Program(&ticked, 0, 0, 0);
+  Program(&advanced, 0, 0, 0);
+  EXPECT_EQ(PITGetTicksUntilIRQ0(&advanced), 0x10000);
+
+  for (uint32_t i = 0; i < 0xFFFF; ++i) {
+    PITTick(&ticked);
+  }
+  EXPECT_EQ(irq_0_call_count, 0);
+  EXPECT_EQ(ReadCounter(&ticked, 0), 1);
+  PITTick(&ticked);
+  EXPECT_EQ(irq_0_call_count, 1);
+  EXPECT_TRUE(ticked.channels[0].output_state);
+  EXPECT_EQ(ReadCounter(&ticked, 0), 0);
+
+  irq_0_call_count = 0;
+  PITAdvance(&advanced, 0x10000);
+  EXPECT_EQ(irq_0_call_count, 1);
+  EXPECT_TRUE(advanced.channels[0].output_state);
+  EXPECT_EQ(ReadCounter(&advanced, 0), 0);
+}
+
+TEST_F(AdvanceTest, Mode0AfterTerminalCount) {
+  PITState ticked, advanced;
+  PITInit(&ticked, &config_);
+  PITInit(&advanced, &config_);
+  Program(&ticked, 0, 0, 50);
+  Program(&advanced, 0, 0, 50);
+  for (uint32_t i = 0; i < 60; ++i) {
+    PITTick(&ticked);
+  }
+  PITAdvance(&advanced, 60);
+  EXPECT_EQ(irq_0_call_count, 2);
+
+  // After terminal count, the counter keeps wrapping around while the output
+  // stays high, and IRQ 0 is not raised again.
+  irq_0_call_count = 0;
+  for (PITState* pit : {&ticked, &advanced}) {
+    EXPECT_EQ(ReadCounter(pit, 0), 0x10000 - 10);
+    EXPECT_TRUE(pit->channels[0].output_state);
+    EXPECT_EQ(PITGetTicksUntilIRQ0(pit), kPITNoIRQ0);
+  }
+  for (uint32_t i = 0; i < 0x10000 + 20; ++i) {
+    PITTick(&ticked);
+  }
+  PITAdvance(&advanced, 0x10000 + 20);
+  EXPECT_EQ(irq_0_call_count, 0);
+  for (PITState* pit : {&ticked, &advanced}) {
+    EXPECT_EQ(ReadCounter(pit, 0), 0x10000 - 30);
+    EXPECT_TRUE(pit->channels[0].output_state);
+  }
+
+  // Reprogramming the channel sets the output low again.
+  for (PITState* pit : {&ticked, &advanced}) {
+    Program(pit, 0, 0, 20);
+    EXPECT_EQ(PITGetTicksUntilIRQ0(pit), 20);
+  }
+}
+
+}  // namespace
@@ -0,0 +1,266 @@
+#include <cstring>
+
+#include "bios.h"
+#include "gtest/gtest.h"
+#include "platform.h"
+
+namespace {
+
+class MemoryMapTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    memset(ram_, 0, sizeof(ram_));
+    memset(device_, 0, sizeof(device_));
+    config_.context = this;
+    // Deliberately not a multiple of the page size.
+    config_.physical_memory_size = 100 * 1000;
+    config_.read_physical_memory_byte = [](PlatformState* p,
+                                           uint32_t addr) -> uint8_t {
+      MemoryMapTest* test = static_cast<MemoryMapTest*>(p->config->context);
+      return test->ram_[addr];
+    };
+    config_.write_physical_memory_byte = [](PlatformState* p, uint32_t addr,
+                                            uint8_t val) {
+      MemoryMapTest* test = static_cast<MemoryMapTest*>(p->config->context);
+      test->ram_[addr] = val;
+    };
+    ASSERT_TRUE(PlatformInit(&platform_, &config_));
+  }
+
+  MemoryMapEntry MakeDeviceEntry(uint32_t start, uint32_t end) {
+    MemoryMapEntry entry = {
+        .context = this,
+        .entry_type = 0x80,
+        .start = start,
+        .end = end,
+        .read_byte = [](MemoryMapEntry* entry, uint32_t address) -> uint8_t {
+          return static_cast<MemoryMapTest*>(entry->context)->device_[address];
+        },
+        .write_byte =
+            [](MemoryMapEntry* entry, uint32_t address, uint8_t value) {
+              static_cast<MemoryMapTest*>(entry->context)->device_[address] =
+                  value;
+            },
+    };
+    return entry;
+  }
+
+  MemoryMapEntry MakeWordDeviceEntry(uint32_t start, uint32_t end) {
+    MemoryMapEntry entry = MakeDeviceEntry(start, end);
+    entry.read_word = [](MemoryMapEntry* entry,
+                         uint32_t address) -> uint16_t {
+      MemoryMapTest* test = static_cast<MemoryMapTest*>(entry->context);
+      ++test->num_word_calls_;
+      return (test->device_[address + 1] << 8) | test->device_[address];
+    };
+    entry.write_word = [](MemoryMapEntry* entry, uint32_t address,
+                          uint16_t value) {
+      MemoryMapTest* test = static_cast<MemoryMapTest*>(entry->context);
+      ++test->num_word_calls_;
+      test->device_[address] = value & 0xFF;
+      test->device_[address + 1] = value >> 8;
+    };
+    return entry;
+  }
+
+  PortMapEntry MakeWordPortEntry(uint16_t start, uint16_t end) {
+    PortMapEntry entry = {
+        .context = this,
+        .entry_type = start,
+        .start = start,
+        .end = end,
+        .read_byte = [](PortMapEntry* entry, uint16_t port) -> uint8_t {
+          return static_cast<MemoryMapTest*>(entry->context)->device_[port];
+        },
+        .write_byte =
+            [](PortMapEntry* entry, uint16_t port, uint8_t value) {
+              static_cast<MemoryMapTest*>(entry->context)->device_[port] =
+                  value;
+            },
+        .read_word = [](PortMapEntry* entry, uint16_t port) -> uint16_t {
+          MemoryMapTest* test = static_cast<MemoryMapTest*>(entry->context);
+          ++test->num_word_calls_;
+          return (test->device_[port + 1] << 8) | test->device_[port];
+        },
+        .write_word =
+            [](PortMapEntry* entry, uint16_t port, uint16_t value) {
+              MemoryMapTest* test = static_cast<MemoryMapTest*>(entry->context);
+              ++test->num_word_calls_;
+              test->device_[port] = value & 0xFF;
+              test->device_[port + 1] = value >> 8;
+            },
+    };
+    return entry;
+  }
+
+  PlatformConfig config_ = {0};
+  PlatformState platform_;
+  uint8_t ram_[100 * 1000];
+  uint8_t device_[0x2000];
+  int num_word_calls_ = 0;
+};
+
+TEST_F(MemoryMapTest, ConventionalMemory) {
+  WriteMemoryByte(&platform_, 0x00000, 0x12);
+  WriteMemoryWord(&platform_, 0x01234, 0xBEEF);
+  EXPECT_EQ(ram_[0x00000], 0x12);
+  EXPECT_EQ(ram_[0x01234], 0xEF);
+  EXPECT_EQ(ram_[0x01235], 0xBE);
+  EXPECT_EQ(ReadMemoryWord(&platform_, 0x01234), 0xBEEF);
+
+  // Last byte of conventional memory, on a partially mapped page.
+  WriteMemoryByte(&platform_, 100 * 1000 - 1, 0x34);
+  EXPECT_EQ(ram_[100 * 1000 - 1], 0x34);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 100 * 1000 - 1), 0x34);
+  EXPECT_EQ(
+      GetMemoryMapEntryForAddress(&platform_, 100 * 1000 - 1),
+      GetMemoryMapEntryByType(&platform_, kMemoryMapEntryConventional));
+}
+
+TEST_F(MemoryMapTest, UnmappedMemoryIsOpenBus) {
+  // Just past the end of conventional memory, on the same page.
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 100 * 1000), nullptr);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 100 * 1000), 0xFF);
+  // Fully unmapped page.
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0x50000), nullptr);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0x50000), 0xFF);
+  EXPECT_EQ(ReadMemoryWord(&platform_, 0x50000), 0xFFFF);
+  // Writes to unmapped memory are ignored.
+  WriteMemoryByte(&platform_, 0x50000, 0x00);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0x50000), 0xFF);
+  // Beyond the 1MB address space.
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0x100000), nullptr);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0x100000), 0xFF);
+}
+
+TEST_F(MemoryMapTest, BIOSROMIsReadOnly) {
+  MemoryMapEntry* bios =
+      GetMemoryMapEntryByType(&platform_, kMemoryMapEntryBIOSROM);
+  ASSERT_NE(bios, nullptr);
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xFFFF0), bios);
+  uint8_t value = ReadMemoryByte(&platform_, 0xFFFF0);
+  EXPECT_EQ(value, BIOSReadROMByte(0xFFFF0 - kBIOSROMStartAddress));
+  WriteMemoryByte(&platform_, 0xFFFF0, value ^ 0xFF);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xFFFF0), value);
+}
+
+TEST_F(MemoryMapTest, RegisterEntryUpdatesDispatchTable) {
+  // An entry that is not aligned to page boundaries.
+  MemoryMapEntry entry = MakeDeviceEntry(0xC0800, 0xC27FF);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xC0800), 0xFF);
+  ASSERT_TRUE(RegisterMemoryMapEntry(&platform_, &entry));
+  MemoryMapEntry* registered = GetMemoryMapEntryByType(&platform_, 0x80);
+  ASSERT_NE(registered, nullptr);
+
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC07FF), nullptr);
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC0800), registered);
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC1800), registered);
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC27FF), registered);
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC2800), nullptr);
+
+  WriteMemoryByte(&platform_, 0xC0800, 0x56);
+  WriteMemoryByte(&platform_, 0xC27FF, 0x78);
+  EXPECT_EQ(device_[0x0000], 0x56);
+  EXPECT_EQ(device_[0x1FFF], 0x78);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xC0800), 0x56);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xC27FF), 0x78);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xC2800), 0xFF);
+}
+
+TEST_F(MemoryMapTest, RejectsOpenBusEntryType) {
+  MemoryMapEntry entry = MakeDeviceEntry(0xC0000, 0xC1FFF);
+  entry.entry_type = kMemoryMapEntryNone;
+  EXPECT_FALSE(RegisterMemoryMapEntry(&platform_, &entry));
+  EXPECT_EQ(GetMemoryMapEntryForAddress(&platform_, 0xC0000), nullptr);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xC0000), 0xFF);
+}
+
+TEST_F(MemoryMapTest, WordAccessUsesWordCallbacks) {
+  MemoryMapEntry entry = MakeWordDeviceEntry(0xC0000, 0xC1FFF);
+  ASSERT_TRUE(RegisterMemoryMapEntry(&platform_, &entry));
+
+  WriteMemoryWord(&platform_, 0xC0010, 0x1234);
+  EXPECT_EQ(num_word_calls_, 1);
+  EXPECT_EQ(device_[0x10], 0x34);
+  EXPECT_EQ(device_[0x11], 0x12);
+  EXPECT_EQ(ReadMemoryWord(&platform_, 0xC0010), 0x1234);
+  EXPECT_EQ(num_word_calls_, 2);
+
+  // A word straddling the end of the entry is split into bytes.
+  device_[0x1FFF] = 0x56;
+  EXPECT_EQ(ReadMemoryWord(&platform_, 0xC1FFF), 0xFF56);
+  WriteMemoryWord(&platform_, 0xC1FFF, 0xABCD);
+  EXPECT_EQ(device_[0x1FFF], 0xCD);
+  EXPECT_EQ(num_word_calls_, 2);
+}
+
+TEST_F(MemoryMapTest, PortWordAccessUsesWordCallbacks) {
+  PortMapEntry entry = MakeWordPortEntry(0x300, 0x301);
+  ASSERT_TRUE(RegisterPortMapEntry(&platform_, &entry));
+
+  WritePortWord(&platform_, 0x300, 0x1234);
+  EXPECT_EQ(ReadPortWord(&platform_, 0x300), 0x1234);
+  EXPECT_EQ(num_word_calls_, 2);
+  // A word straddling the end of the entry is split into bytes.
+  EXPECT_EQ(ReadPortWord(&platform_, 0x301), 0xFF12);
+  EXPECT_EQ(num_word_calls_, 2);
+}
+
+TEST_F(MemoryMapTest, RegisterOverlappingEntryFails) {
+  MemoryMapEntry entry = MakeDeviceEntry(0x10000, 0x10FFF);
+  EXPECT_FALSE(RegisterMemoryMapEntry(&platform_, &entry));
+  EXPECT_EQ(
+      GetMemoryMapEntryForAddress(&platform_, 0x10000),
+      GetMemoryMapEntryByType(&platform_, kMemoryMapEntryConventional));
+}
+
+class DirectMemoryMapTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    memset(ram_, 0, sizeof(ram_));
+    config_.physical_memory_size = sizeof(ram_);
+    config_.physical_memory = ram_;
+    ASSERT_TRUE(PlatformInit(&platform_, &config_));
+  }
+
+  PlatformConfig config_ = {0};
+  PlatformState platform_;
+  uint8_t ram_[64 * 1024];
+};
+
+TEST_F(DirectMemoryMapTest, ConventionalMemory) {
+  EXPECT_NE(platform_.memory_read_pages[0], nullptr);
+  EXPECT_NE(platform_.memory_write_pages[0], nullptr);
+  WriteMemoryWord(&platform_, 0x1234, 0xBEEF);
+  EXPECT_EQ(ram_[0x1234], 0xEF);
+  EXPECT_EQ(ram_[0x1235], 0xBE);
+  ram_[0xFFFF] = 0x42;
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xFFFF), 0x42);
+  // Just past the end of physical memory.
+  EXPECT_EQ(platform_.memory_read_pages[0x10], nullptr);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0x10000), 0xFF);
+}
+
+TEST_F(DirectMemoryMapTest, BIOSROMIsReadOnly) {
+  uint32_t page = 0xFFFF0 / kMemoryMapPageSize;
+  EXPECT_NE(platform_.memory_read_pages[page], nullptr);
+  EXPECT_EQ(platform_.memory_write_pages[page], nullptr);
+  uint8_t value = ReadMemoryByte(&platform_, 0xFFFF0);
+  EXPECT_EQ(value, BIOSReadROMByte(0xFFFF0 - kBIOSROMStartAddress));
+  WriteMemoryByte(&platform_, 0xFFFF0, value ^ 0xFF);
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0xFFFF0), value);
+}
+
+TEST_F(DirectMemoryMapTest, CPUAccessesMemoryDirectly) {
+  // mov word [0x2000], 0x1234
+  static const uint8_t kCode[] = {0xC7, 0x06, 0x00, 0x20, 0x34, 0x12};
+  memcpy(&ram_[0x0100], kCode, sizeof(kCode));
+  platform_.cpu.registers[kCS] = 0x0000;
+  platform_.cpu.registers[kIP] = 0x0100;
+  EXPECT_EQ(CPUTick(&platform_.cpu), kExecuteSuccess);
+  EXPECT_EQ(platform_.cpu.registers[kIP], 0x0106);
+  EXPECT_EQ(ram_[0x2000], 0x34);
+  EXPECT_EQ(ram_[0x2001], 0x12);
+}
+
+}  // namespace
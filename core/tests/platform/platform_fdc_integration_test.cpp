@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "gtest/gtest.h"
 #include "platform.h"
 
@@ -38,12 +40,17 @@ class PlatformFDCIntegrationTest : public ::testing::Test {
     return ReadPortByte(&platform_, port);
   }
 
+  // Reads sectors starting from C=0 H=0 R=1 into memory at 0x1000 via DMA,
+  // with a DMA count of num_bytes - 1. Returns the number of FDC ticks until
+  // IRQ 6 is raised at the end of the command, or -1 on timeout.
+  int ReadSectorsViaDMA(uint16_t num_bytes);
+
   PlatformConfig config_ = {0};
   PlatformState platform_;
   uint8_t ram_[64 * 1024];
 };
 
-TEST_F(PlatformFDCIntegrationTest, ReadSectorViaDMA) {
+int PlatformFDCIntegrationTest::ReadSectorsViaDMA(uint16_t num_bytes) {
   // 1. Reset FDC to known state.
   // Unmask IRQ 6 in PIC (Port 0x21). Default is masked.
   WritePort(0x21, 0xBF); // Clear bit 6.
@@ -85,16 +92,16 @@ TEST_F(PlatformFDCIntegrationTest, ReadSectorViaDMA) {
   // Page Register (0x81) for Ch2. 0x00.
   WritePort(0x81, 0x00);
   
-  // Count 511 (0x1FF).
+  // Count num_bytes - 1.
   // Ch2 Count (0x05). LSB then MSB.
-  WritePort(0x05, 0xFF);
-  WritePort(0x05, 0x01);
+  WritePort(0x05, (num_bytes - 1) & 0xFF);
+  WritePort(0x05, (num_bytes - 1) >> 8);
   
   // Unmask Channel 2 (0x0A). 0 = Clear mask (Enable).
   WritePort(0x0A, 0x02); // Clear mask bit 2.
 
   // Initialize target memory with a canary pattern.
-  for (int i = 0; i < 512; ++i) {
+  for (int i = 0; i < num_bytes; ++i) {
     // We can't use WriteMemoryByte directly as it's not exposed in test class helper.
     // Use helper.
     // But 'WriteMemoryByte' is global in public.h? Yes.
@@ -120,21 +127,22 @@ TEST_F(PlatformFDCIntegrationTest, ReadSectorViaDMA) {
   // Drive FDC ticks until IRQ 6 is raised again.
   // Limit iterations to avoid infinite loop.
   int ticks = 0;
-  bool done = false;
-  while (ticks < 2000) { // 512 bytes + overhead
+  while (ticks < num_bytes + 2000) { // num_bytes + overhead
     FDCTick(&platform_.fdc);
     ticks++;
     // Check if IRQ 6 is raised (Transfer Complete).
     // Note: FDC raises IRQ 6 at end of command.
     // PIC status check:
     if (platform_.pic.irr & (1 << 6)) {
-      done = true;
-      break;
+      return ticks;
     }
   }
-  
-  EXPECT_TRUE(done) << "Transfer timed out.";
-  
+  return -1;
+}
+
+TEST_F(PlatformFDCIntegrationTest, ReadSectorViaDMA) {
+  EXPECT_GE(ReadSectorsViaDMA(512), 512) << "Transfer timed out.";
+
   // 5. Verify Memory Content.
   // Address 0x1000 should contain data.
   // MockImageRead(0, 0) = 0x00 -> RAM[0x1000]
@@ -146,4 +154,45 @@ TEST_F(PlatformFDCIntegrationTest, ReadSectorViaDMA) {
   }
 }
 
+TEST_F(PlatformFDCIntegrationTest, ReadSectorsViaBulkDMA) {
+  // Read 2 sectors byte by byte for reference.
+  const int byte_ticks = ReadSectorsViaDMA(1024);
+  ASSERT_GE(byte_ticks, 1024) << "Transfer timed out.";
+  const DMAState expected_dma = platform_.dma;
+  FDCResultBuffer expected_result = platform_.fdc.result_buffer;
+
+  // Read the same sectors again with bulk transfers.
+  config_.use_bulk_disk_transfers = true;
+  ASSERT_TRUE(PlatformInit(&platform_, &config_));
+  platform_.fdc_config.read_image_byte = MockImageRead;
+  memset(ram_, 0, sizeof(ram_));
+  const int bulk_ticks = ReadSectorsViaDMA(1024);
+  ASSERT_GT(bulk_ticks, 0) << "Transfer timed out.";
+  EXPECT_LT(bulk_ticks, 100);
+
+  // The guest sees the same memory, DMA and FDC state.
+  for (int i = 0; i < 1024; ++i) {
+    ASSERT_EQ(ReadMemoryByte(&platform_, 0x1000 + i), (uint8_t)(i & 0xFF))
+        << "Mismatch at offset " << i;
+  }
+  EXPECT_EQ(ReadMemoryByte(&platform_, 0x1000 + 1024), 0x00);
+  EXPECT_EQ(
+      platform_.dma.channels[2].current_address,
+      expected_dma.channels[2].current_address);
+  EXPECT_EQ(
+      platform_.dma.channels[2].current_count,
+      expected_dma.channels[2].current_count);
+  EXPECT_EQ(platform_.dma.status_register, expected_dma.status_register);
+  EXPECT_EQ(platform_.dma.mask_register, expected_dma.mask_register);
+  ASSERT_EQ(
+      FDCResultBufferLength(&platform_.fdc.result_buffer),
+      FDCResultBufferLength(&expected_result));
+  for (size_t i = 0; i < FDCResultBufferLength(&expected_result); ++i) {
+    EXPECT_EQ(
+        *FDCResultBufferGet(&platform_.fdc.result_buffer, i),
+        *FDCResultBufferGet(&expected_result, i))
+        << "Result byte " << i;
+  }
+}
+
 } // namespace
@@ -0,0 +1,244 @@
+#include <cstring>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "platform.h"
+
+namespace {
+
+constexpr uint32_t kMemorySize = 640 * 1024;
+
+// A platform booting the BIOS with directly accessed memory.
+struct TestPlatform {
+  TestPlatform() {
+    config.physical_memory_size = kMemorySize;
+    config.physical_memory = memory;
+    config.block_cache = &block_cache;
+    EXPECT_TRUE(PlatformInit(&platform, &config));
+  }
+
+  PlatformConfig config = {0};
+  PlatformState platform;
+  CPUBlockCache block_cache;
+  uint8_t memory[kMemorySize] = {0};
+};
+
+// Expect two platforms to be in the same state.
+void ExpectSameState(const PlatformState& a, const PlatformState& b) {
+  EXPECT_EQ(a.ticks, b.ticks);
+  for (int i = 0; i < kNumRegisters; ++i) {
+    EXPECT_EQ(a.cpu.registers[i], b.cpu.registers[i]) << "register " << i;
+  }
+  EXPECT_EQ(a.cpu.flags, b.cpu.flags);
+  EXPECT_EQ(a.cpu.is_halted, b.cpu.is_halted);
+  EXPECT_EQ(a.pic.irr, b.pic.irr);
+  EXPECT_EQ(a.pic.isr, b.pic.isr);
+  EXPECT_EQ(a.pic.imr, b.pic.imr);
+  for (int i = 0; i < kPITNumChannels; ++i) {
+    EXPECT_EQ(a.pit.channels[i].counter, b.pit.channels[i].counter)
+        << "PIT channel " << i;
+  }
+}
+
+// Run the BIOS with PlatformTick() and PlatformRun() in lockstep, and expect
+// the same results.
+void ExpectPlatformRunMatchesPlatformTick(bool use_block_cache) {
+  auto expected = std::make_unique<TestPlatform>();
+  auto actual = std::make_unique<TestPlatform>();
+  expected->platform.cpu_config.block_cache = nullptr;
+  if (!use_block_cache) {
+    actual->platform.cpu_config.block_cache = nullptr;
+  }
+
+  constexpr uint32_t kBatchSize = 10007;
+  for (int batch = 0; batch < 100; ++batch) {
+    for (uint32_t i = 0; i < kBatchSize; ++i) {
+      PlatformTick(&expected->platform);
+    }
+    ASSERT_EQ(PlatformRun(&actual->platform, kBatchSize), kBatchSize);
+    ExpectSameState(expected->platform, actual->platform);
+    if (::testing::Test::HasFailure()) {
+      FAIL() << "Diverged in batch " << batch;
+    }
+  }
+  EXPECT_EQ(
+      memcmp(expected->memory, actual->memory, sizeof(expected->memory)), 0);
+  if (use_block_cache) {
+    // Fused sequences are executed while booting the BIOS.
+    EXPECT_GT(actual->block_cache.fusion_counts[kCPUFusionCompareJump], 0);
+    EXPECT_GT(actual->block_cache.fusion_counts[kCPUFusionLoop], 0);
+    // So are delay loops, which are skipped.
+    EXPECT_GT(actual->block_cache.num_skipped_loop_iterations, 0);
+  }
+}
+
+TEST(PlatformRunTest, MatchesPlatformTick) {
+  ExpectPlatformRunMatchesPlatformTick(false);
+}
+
+TEST(PlatformRunTest, MatchesPlatformTickWithBlockCache) {
+  ExpectPlatformRunMatchesPlatformTick(true);
+}
+
+TEST(PlatformRunTest, MatchesPlatformTickInClockCycles) {
+  auto expected = std::make_unique<TestPlatform>();
+  auto actual = std::make_unique<TestPlatform>();
+  for (TestPlatform* test_platform : {expected.get(), actual.get()}) {
+    test_platform->config.use_clock_cycles = true;
+    ASSERT_TRUE(PlatformInit(&test_platform->platform, &test_platform->config));
+  }
+
+  // Each instruction takes as many ticks as clock cycles, so PlatformRun() may
+  // run past the budget to the end of the last instruction, which may be a
+  // chunk of a repeated string instruction.
+  constexpr uint32_t kBatchSize = 100003;
+  for (int batch = 0; batch < 100; ++batch) {
+    const uint32_t ticks = PlatformRun(&actual->platform, kBatchSize);
+    ASSERT_GE(ticks, kBatchSize);
+    ASSERT_LT(ticks, kBatchSize + 4096);
+    while ((int32_t)(actual->platform.ticks - expected->platform.ticks) > 0) {
+      PlatformTick(&expected->platform);
+    }
+    ExpectSameState(expected->platform, actual->platform);
+    EXPECT_EQ(actual->platform.cpu.clock_cycles, actual->platform.ticks);
+    if (::testing::Test::HasFailure()) {
+      FAIL() << "Diverged in batch " << batch;
+    }
+  }
+  EXPECT_EQ(
+      memcmp(expected->memory, actual->memory, sizeof(expected->memory)), 0);
+  // The BIOS ends up waiting for a key press, with timer interrupts at the
+  // PIT's rate in clock cycles.
+  EXPECT_TRUE(PlatformIsIdle(&actual->platform));
+  EXPECT_LE(
+      PlatformGetTicksUntilNextEvent(&actual->platform, UINT32_MAX),
+      0x10000 * 4);
+}
+
+TEST(PlatformRunTest, StopsWhenRequested) {
+  auto test_platform = std::make_unique<TestPlatform>();
+  PlatformState* platform = &test_platform->platform;
+  PlatformRequestStop(platform);
+  // A stop requested before running is cleared.
+  EXPECT_EQ(PlatformRun(platform, 1000), 1000);
+  EXPECT_EQ(platform->ticks, 1000);
+
+  platform->cpu_config.on_after_execute_instruction =
+      [](CPUState* cpu, const Instruction*) {
+        PlatformRequestStop((PlatformState*)cpu->config->context);
+        return kExecuteSuccess;
+      };
+  EXPECT_EQ(PlatformRun(platform, 1000), 1);
+  EXPECT_EQ(platform->ticks, 1001);
+}
+
+TEST(PlatformRunTest, SchedulesDevicesOnlyWhenNeeded) {
+  auto test_platform = std::make_unique<TestPlatform>();
+  PlatformState* platform = &test_platform->platform;
+  // The PIT is not scheduled until the BIOS programs channel 0.
+  EXPECT_FALSE(platform->timers[kPlatformTimerPIT].active);
+  EXPECT_FALSE(platform->timers[kPlatformTimerFDC].active);
+  EXPECT_FALSE(platform->timers[kPlatformTimerKeyboard].active);
+
+  // A key press is sent on the next keyboard tick.
+  KeyboardHandleKeyPress(&platform->keyboard, 0x1E);
+  EXPECT_EQ(PlatformRun(platform, 1), 1);
+  EXPECT_TRUE(platform->keyboard.waiting_for_ack);
+  EXPECT_FALSE(platform->timers[kPlatformTimerKeyboard].active);
+
+  // The FDC is ticked while it executes a RECALIBRATE command.
+  WritePortByte(platform, 0x3F2, 0x1C);
+  WritePortByte(platform, 0x3F5, 0x07);
+  WritePortByte(platform, 0x3F5, 0x00);
+  EXPECT_EQ(platform->fdc.phase, kFDCPhaseExecution);
+  EXPECT_EQ(PlatformRun(platform, 1000), 1000);
+  EXPECT_NE(platform->fdc.phase, kFDCPhaseExecution);
+  EXPECT_FALSE(platform->timers[kPlatformTimerFDC].active);
+}
+
+TEST(PlatformRunTest, DetectsIdleGuest) {
+  auto test_platform = std::make_unique<TestPlatform>();
+  PlatformState* platform = &test_platform->platform;
+  // Without a boot disk, the BIOS ends up waiting for a key press.
+  constexpr uint32_t kBatchSize = 100000;
+  for (int batch = 0; batch < 100 && !PlatformIsIdle(platform); ++batch) {
+    EXPECT_EQ(PlatformRun(platform, kBatchSize), kBatchSize);
+  }
+  ASSERT_TRUE(PlatformIsIdle(platform));
+
+  // The guest stays idle up to the next timer interrupt.
+  uint32_t ticks = PlatformGetTicksUntilNextEvent(platform, UINT32_MAX);
+  EXPECT_GT(ticks, 1);
+  EXPECT_LE(ticks, 0x10000 * 4);
+  EXPECT_EQ(PlatformRun(platform, ticks - 1), ticks - 1);
+  EXPECT_EQ(platform->idle_ticks, ticks - 1);
+  EXPECT_TRUE(PlatformIsIdle(platform));
+  // The timer interrupt handler runs, then the guest is idle again.
+  EXPECT_EQ(PlatformRun(platform, kBatchSize), kBatchSize);
+  EXPECT_LT(platform->idle_ticks, kBatchSize);
+  EXPECT_TRUE(PlatformIsIdle(platform));
+
+  // A key press is the next event.
+  KeyboardHandleKeyPress(&platform->keyboard, 0x1E);
+  EXPECT_LE(PlatformGetTicksUntilNextEvent(platform, UINT32_MAX), 4770);
+}
+
+// Run a program polling INT 16h for a key press, then storing it at 0x7E00,
+// after the BIOS has booted.
+void RunKeyboardPollingProgram(TestPlatform* test_platform) {
+  PlatformState* platform = &test_platform->platform;
+  constexpr uint32_t kBatchSize = 100000;
+  for (int batch = 0; batch < 100 && !PlatformIsIdle(platform); ++batch) {
+    EXPECT_GE(PlatformRun(platform, kBatchSize), kBatchSize);
+  }
+  ASSERT_TRUE(PlatformIsIdle(platform));
+  static const uint8_t kProgram[] = {
+      0xFB,              // sti
+      0x31, 0xDB,        // xor bx, bx
+      0x8E, 0xDB,        // mov ds, bx
+      0xB4, 0x01,        // poll: mov ah, 1
+      0xCD, 0x16,        // int 16h
+      0x74, 0xFA,        // jz poll
+      0xB4, 0x00,        // mov ah, 0
+      0xCD, 0x16,        // int 16h
+      0xA2, 0x00, 0x7E,  // mov [7E00h], al
+      0xEB, 0xFE,        // jmp $
+  };
+  memcpy(test_platform->memory + 0x7C00, kProgram, sizeof(kProgram));
+  platform->cpu.registers[kCS] = 0;
+  platform->cpu.registers[kIP] = 0x7C00;
+  for (int batch = 0; batch < 10; ++batch) {
+    EXPECT_GE(PlatformRun(platform, kBatchSize), kBatchSize);
+  }
+}
+
+TEST(PlatformRunTest, DetectsGuestPollingKeyboard) {
+  auto test_platform = std::make_unique<TestPlatform>();
+  PlatformState* platform = &test_platform->platform;
+  test_platform->config.use_clock_cycles = true;
+  test_platform->config.idle_keyboard_polls = 16;
+  ASSERT_TRUE(PlatformInit(platform, &test_platform->config));
+  RunKeyboardPollingProgram(test_platform.get());
+  // The guest is halted at the INT 16h instruction between interrupts.
+  EXPECT_TRUE(PlatformIsIdle(platform));
+  EXPECT_TRUE(platform->cpu.is_halted);
+  EXPECT_EQ(platform->cpu.registers[kIP], 0x7C07);
+
+  // A key press wakes the guest up, which then reads it.
+  KeyboardHandleKeyPress(&platform->keyboard, 0x1E);
+  EXPECT_GE(PlatformRun(platform, 100000), 100000);
+  EXPECT_EQ(test_platform->memory[0x7E00], 'a');
+  EXPECT_EQ(platform->cpu.registers[kIP], 0x7C12);
+}
+
+TEST(PlatformRunTest, IgnoresGuestPollingKeyboardByDefault) {
+  auto test_platform = std::make_unique<TestPlatform>();
+  RunKeyboardPollingProgram(test_platform.get());
+  EXPECT_FALSE(PlatformIsIdle(&test_platform->platform));
+
+  KeyboardHandleKeyPress(&test_platform->platform.keyboard, 0x1E);
+  EXPECT_EQ(PlatformRun(&test_platform->platform, 100000), 100000);
+  EXPECT_EQ(test_platform->memory[0x7E00], 'a');
+}
+
+}  // namespace
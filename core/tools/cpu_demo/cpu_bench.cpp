@@ -0,0 +1,241 @@
+// Benchmark for the CPURun() dispatch loop.
+//
+// Runs a demo program repeatedly with the threaded and the portable dispatch
+// loop, with the block cache and with the JIT, replaying the same standard
+// input each time and discarding the output, and reports the number of
+// instructions executed per second.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define YAX86_IMPLEMENTATION
+#include "cpu.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+#include <sys/mman.h>
+#endif  // YAX86_CPU_HAS_JIT
+
+using namespace std;
+
+// VM memory.
+constexpr uint32_t kMemorySize = 0x10000;
+uint8_t memory[kMemorySize] = {0};
+uint8_t* memory_pages[kCPUNumMemoryPages] = {0};
+
+// Input replayed to the program on each run.
+istringstream input;
+
+// Block cache for the block cache and JIT benchmarks.
+CPUBlockCache block_cache;
+
+#ifdef YAX86_CPU_HAS_JIT
+// JIT for the JIT benchmark.
+CPUJIT jit;
+// Size of the JIT's code buffer.
+constexpr uint32_t kJITCodeSize = 1024 * 1024;
+#endif  // YAX86_CPU_HAS_JIT
+
+vector<uint8_t> Assemble(const string& asm_file_name) {
+  // Assemble the code to a COM file
+  string com_file_name = asm_file_name + ".com";
+  string command = "nasm -f bin " + asm_file_name + " -o " + com_file_name;
+  if (system(command.c_str()) != 0) {
+    throw runtime_error("Failed to run command: " + command);
+  }
+
+  // Read the COM file into memory
+  ifstream com_file(com_file_name, ios::binary);
+  if (!com_file) {
+    throw runtime_error("Failed to read COM file: " + com_file_name);
+  }
+  vector<uint8_t> machine_code(
+      (istreambuf_iterator<char>(com_file)), istreambuf_iterator<char>());
+  com_file.close();
+
+  return machine_code;
+}
+
+// Minimal DOS interrupt handler that reads from the replayed input and
+// discards all output.
+ExecuteStatus HandleInterrupt(CPUState* cpu, uint8_t interrupt_number) {
+  if (interrupt_number != 0x21) {
+    return kExecuteUnhandledInterrupt;
+  }
+
+  uint8_t ah = (cpu->registers[kAX] >> 8) & 0xFF;
+  uint16_t dx = cpu->registers[kDX];
+  switch (ah) {
+    case 0x01: {  // Read character
+      char ch = '\n';
+      input.get(ch);
+      cpu->registers[kAX] = (ah << 8) | static_cast<uint8_t>(ch);
+      return kExecuteSuccess;
+    }
+    case 0x02:  // Print character
+    case 0x09:  // Print string
+      return kExecuteSuccess;
+    case 0x0A: {  // Read string
+      uint8_t max_length = memory[dx];
+      string line;
+      getline(input, line);
+      if (line.size() > max_length - 1) {
+        line.resize(max_length - 1);
+      }
+      memory[dx + 1] = line.size();
+      line += '\n';
+      memcpy(memory + dx + 2, line.c_str(), line.size());
+      return kExecuteSuccess;
+    }
+    case 0x2C:  // Get system time
+      // Use a fixed time so that every run executes the same instructions.
+      cpu->registers[kCX] = 0x0C00;
+      cpu->registers[kDX] = 0;
+      return kExecuteSuccess;
+    case 0x4C:  // Terminate program
+      return kExecuteHalt;
+    default:
+      cerr << "Unhandled DOS interrupt: " << hex
+           << static_cast<int>(interrupt_number) << " AH = " << hex
+           << static_cast<int>(ah) << endl;
+      return kExecuteHalt;
+  }
+}
+
+// Run the program once to completion, and return the number of instructions
+// executed.
+uint64_t RunProgram(
+    CPUConfig* config, const vector<uint8_t>& machine_code,
+    const string& input_data) {
+  memset(memory, 0, sizeof(memory));
+  memcpy(memory + 0x100, machine_code.data(), machine_code.size());
+  input.clear();
+  input.str(input_data);
+
+  CPUState cpu;
+  CPUInit(&cpu, config);
+  cpu.registers[kCS] = 0;
+  cpu.registers[kIP] = 0x100;
+  cpu.registers[kSP] = kMemorySize - 2;
+
+  uint64_t num_instructions = 0;
+  ExecuteStatus status;
+  do {
+    uint32_t num_cycles;
+    status = CPURun(&cpu, 1 << 20, &num_cycles);
+    num_instructions += num_cycles;
+  } while (status == kExecuteSuccess && !cpu.is_halted);
+  if (status != kExecuteSuccess && status != kExecuteHalt) {
+    throw runtime_error(
+        "Program execution failed with status: " + to_string(status));
+  }
+  return num_instructions;
+}
+
+// Run the program the given number of times, and print the results.
+void RunBenchmark(
+    const char* name, bool use_portable_dispatch, CPUBlockCache* block_cache,
+    CPUJIT* jit, const vector<uint8_t>& machine_code, const string& input_data,
+    int num_runs) {
+  CPUConfig config = {0};
+  config.read_memory_byte = [](CPUState* cpu, uint32_t address) -> uint8_t {
+    return address < kMemorySize ? memory[address] : 0xFF;
+  };
+  config.write_memory_byte = [](CPUState* cpu, uint32_t address,
+                                uint8_t value) {
+    if (address < kMemorySize) {
+      memory[address] = value;
+    }
+  };
+  config.read_memory_pages = memory_pages;
+  config.write_memory_pages = memory_pages;
+  config.handle_interrupt = HandleInterrupt;
+  config.use_portable_dispatch = use_portable_dispatch;
+  config.block_cache = block_cache;
+  if (block_cache) {
+    CPUInitBlockCache(block_cache);
+  }
+  config.jit = jit;
+  if (jit) {
+    CPUInitJIT(jit, jit->code, jit->code_size);
+  }
+
+  uint64_t num_instructions = 0;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < num_runs; ++i) {
+    num_instructions += RunProgram(&config, machine_code, input_data);
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << name << ": " << num_instructions << " instructions in "
+       << elapsed.count() << " s, "
+       << static_cast<uint64_t>(num_instructions / elapsed.count())
+       << " instructions/s" << endl;
+  if (block_cache) {
+    static const char* const kFusionNames[kCPUNumFusionKinds] = {
+        "none", "compare-jump", "inc-dec-jump", "load-store", "zero-register",
+        "loop",
+    };
+    for (int i = kCPUFusionNone + 1; i < kCPUNumFusionKinds; ++i) {
+      cout << "  fused " << kFusionNames[i] << ": "
+           << block_cache->fusion_counts[i] << endl;
+    }
+    cout << "  skipped loop iterations: "
+         << block_cache->num_skipped_loop_iterations << endl;
+  }
+  if (jit) {
+    cout << "  compiled blocks: " << jit->num_compiled_blocks << endl;
+    cout << "  native executions: " << jit->num_native_executions << endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <assembly_program> [num_runs] < input"
+         << endl;
+    return EXIT_FAILURE;
+  }
+  int num_runs = argc > 2 ? stoi(argv[2]) : 10000;
+
+  for (uint32_t i = 0; i < kMemorySize / kCPUMemoryPageSize; ++i) {
+    memory_pages[i] = memory + i * kCPUMemoryPageSize;
+  }
+  string input_data(
+      (istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+
+  try {
+    auto machine_code = Assemble(argv[1]);
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+    RunBenchmark(
+        "threaded", false, nullptr, nullptr, machine_code, input_data,
+        num_runs);
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+    RunBenchmark(
+        "portable", true, nullptr, nullptr, machine_code, input_data,
+        num_runs);
+    RunBenchmark(
+        "block cache", true, &block_cache, nullptr, machine_code, input_data,
+        num_runs);
+#ifdef YAX86_CPU_HAS_JIT
+    void* code = mmap(
+        nullptr, kJITCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+      throw runtime_error("Failed to map JIT code buffer");
+    }
+    CPUInitJIT(&jit, static_cast<uint8_t*>(code), kJITCodeSize);
+    RunBenchmark(
+        "JIT", true, &block_cache, &jit, machine_code, input_data, num_runs);
+    munmap(code, kJITCodeSize);
+#endif  // YAX86_CPU_HAS_JIT
+  } catch (const exception& e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -35,6 +35,9 @@ uint32_t BIOSGetROMSize(void);
 // Read a byte from the BIOS ROM.
 uint8_t BIOSReadROMByte(uint32_t offset);
 
+// Get a pointer to the BIOS ROM data, which is BIOSGetROMSize() bytes long.
+const uint8_t* BIOSGetROMData(void);
+
 #endif  // YAX86_BIOS_PUBLIC_H
 
 
@@ -625,6 +628,10 @@ uint8_t BIOSReadROMByte(uint32_t offset) {
   return kBIOSROMData[offset];
 }
 
+const uint8_t* BIOSGetROMData(void) {
+  return kBIOSROMData;
+}
+
 
 // ==============================================================================
 // src/bios/bios.c end
@@ -660,8 +667,23 @@ extern "C" {
 #define YAX86_CPU_PUBLIC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// The JIT backend is only available on x86-64 Linux hosts. Define
+// YAX86_DISABLE_JIT to build the pure interpreter on such hosts as well.
+#if defined(__x86_64__) && defined(__linux__) && !defined(YAX86_DISABLE_JIT)
+#define YAX86_CPU_HAS_JIT 1
+#endif  // defined(__x86_64__) && defined(__linux__) && ...
+
+// CPURun() dispatches opcodes with computed gotos on compilers that support
+// them. Define YAX86_DISABLE_THREADED_DISPATCH to always use the portable
+// dispatch through the opcode table.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(YAX86_DISABLE_THREADED_DISPATCH)
+#define YAX86_CPU_HAS_THREADED_DISPATCH 1
+#endif  // (defined(__GNUC__) || defined(__clang__)) && ...
+
 // ============================================================================
 // CPU state
 // ============================================================================
@@ -707,6 +729,8 @@ typedef enum RegisterIndex {
 enum {
   // Number of registers.
   kNumRegisters = kIP + 1,
+  // Number of segment registers, from kES to kDS.
+  kNumSegmentRegisters = kDS - kES + 1,
 };
 
 // CPU flag masks.
@@ -734,8 +758,44 @@ typedef enum Flag {
 enum {
   // CPU flags value on reset.
   kInitialFlags = (1 << 1),  // Reserved_1 is always 1.
+  // Flags produced by arithmetic and logic instructions, which may be
+  // evaluated lazily.
+  kArithmeticFlags = kCF | kPF | kAF | kZF | kSF | kOF,
 };
 
+// Kind of the last flag-producing operation, used to lazily evaluate flags.
+typedef enum CPULazyFlagsOp {
+  // ADD and ADC. Produces all arithmetic flags.
+  kLazyFlagsAdd = 0,
+  // INC. Produces all arithmetic flags except CF.
+  kLazyFlagsInc,
+  // SUB, SBB, CMP and NEG. Produces all arithmetic flags.
+  kLazyFlagsSub,
+  // DEC. Produces all arithmetic flags except CF.
+  kLazyFlagsDec,
+  // AND, OR, XOR and TEST. Produces all arithmetic flags except AF.
+  kLazyFlagsBoolean,
+} CPULazyFlagsOp;
+
+// The last flag-producing operation, from which flags are evaluated on demand.
+typedef struct CPULazyFlags {
+  // Flags that have not been written to CPUState.flags yet and must be
+  // evaluated from this operation, or 0 if there is no pending operation.
+  uint16_t pending;
+  // Kind of the operation, as a CPULazyFlagsOp.
+  uint8_t op;
+  // Data width of the operation, as a Width.
+  uint8_t width;
+  // Whether the operation included a carry or borrow.
+  bool did_carry;
+  // First operand.
+  uint32_t op1;
+  // Second operand.
+  uint32_t op2;
+  // Result, before truncating to the operation's data width.
+  uint32_t result;
+} CPULazyFlags;
+
 // Standard interrupts.
 typedef enum InterruptNumber {
   kInterruptDivideError = 0,
@@ -762,6 +822,18 @@ typedef enum ExecuteStatus {
 
 struct CPUState;
 struct Instruction;
+struct CPUInstructionCache;
+struct CPUBlockCache;
+struct CPUJIT;
+
+enum {
+  // Size of the 8088's physical address space in bytes.
+  kCPUMemoryAddressSpaceSize = 1024 * 1024,
+  // Granularity of direct host memory access in bytes.
+  kCPUMemoryPageSize = 4 * 1024,
+  // Number of pages in the physical address space.
+  kCPUNumMemoryPages = kCPUMemoryAddressSpaceSize / kCPUMemoryPageSize,
+};
 
 // Caller-provided runtime configuration.
 typedef struct CPUConfig {
@@ -789,6 +861,29 @@ typedef struct CPUConfig {
   void (*write_memory_byte)(
       struct CPUState* cpu, uint32_t address, uint8_t value);
 
+  // Optional callback to read a word from memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word reads are split into two
+  // calls to read_memory_byte.
+  uint16_t (*read_memory_word)(struct CPUState* cpu, uint32_t address);
+
+  // Optional callback to write a word to memory, with the low byte at address
+  // and the high byte at address + 1. If not set, word writes are split into
+  // two calls to write_memory_byte.
+  void (*write_memory_word)(
+      struct CPUState* cpu, uint32_t address, uint16_t value);
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for reading. Reads from a page with a
+  // non-NULL pointer are served directly from host memory; reads from other
+  // pages go through read_memory_byte.
+  const uint8_t* const* read_memory_pages;
+
+  // Optional table of kCPUNumMemoryPages pointers to host memory backing each
+  // page of the physical address space, for writing. Writes to a page with a
+  // non-NULL pointer go directly to host memory; writes to other pages go
+  // through write_memory_byte.
+  uint8_t* const* write_memory_pages;
+
   // Callback to handle an interrupt.
   //   - Return kExecuteSuccess if the interrupt was handled and execution
   //     should continue.
@@ -831,6 +926,61 @@ typedef struct CPUConfig {
   // For simplicity, we use a single 8-bit interface for memory access, similar
   // to the real-life 8088.
   void (*write_port)(struct CPUState* cpu, uint16_t port, uint8_t value);
+
+  // Optional callback to read a word from an I/O port, with the low byte from
+  // port and the high byte from port + 1. If not set, word reads are split into
+  // two calls to read_port.
+  uint16_t (*read_port_word)(struct CPUState* cpu, uint16_t port);
+
+  // Optional callback to write a word to an I/O port, with the low byte to port
+  // and the high byte to port + 1. If not set, word writes are split into two
+  // calls to write_port.
+  void (*write_port_word)(struct CPUState* cpu, uint16_t port, uint16_t value);
+
+  // Optional callback that returns whether reads from an I/O port have no side
+  // effects, and return the same value until the CPU writes to memory or to a
+  // port. Reads from ports whose value depends on the passage of time within a
+  // call to CPUTickBlock() or CPURun(), such as timer counters, are not
+  // stable. Translated loops that make no progress while only reading stable
+  // ports and memory are fast-forwarded to the end of the instruction budget.
+  // If not set, loops that read from ports are never fast-forwarded. Memory
+  // reads are assumed to never have side effects.
+  bool (*is_port_stable)(struct CPUState* cpu, uint16_t port);
+
+  // Optional cache of decoded instructions. If set, the cache must be
+  // initialized with CPUInitInstructionCache() before use.
+  struct CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated basic blocks, used by CPUTickBlock(). If set,
+  // the cache must be initialized with CPUInitBlockCache() before use.
+  struct CPUBlockCache* block_cache;
+
+  // Optional JIT compiler state. If set, hot blocks in block_cache are
+  // translated to native code when running CPUTickBlock(). The JIT must be
+  // initialized with CPUInitJIT() before CPUInit(), and is only used on hosts
+  // where YAX86_CPU_HAS_JIT is defined.
+  struct CPUJIT* jit;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // instruction cycle, or 0 for no limit. An instruction with iterations left
+  // is executed again in the next instruction cycle, with progress saved in
+  // CX, SI and DI, so that interrupts and devices are serviced in between.
+  // Smaller values reduce interrupt latency, larger values increase
+  // throughput.
+  uint16_t max_string_iterations;
+
+  // Whether CPURun() should dispatch opcodes through the opcode table even on
+  // hosts where YAX86_CPU_HAS_THREADED_DISPATCH is defined. This is mainly
+  // useful for comparing the two.
+  bool use_portable_dispatch;
+
+  // Whether each instruction cycle should advance CPUState.cycles by the
+  // number of clock cycles the instruction takes on the 8088, instead of by 1,
+  // so that the execution functions' budgets are in clock cycles. The last
+  // instruction run by CPUTickBlock() or CPURun() may then exceed the budget.
+  // Translated blocks store the clock cycles of their instructions, so the
+  // block cache and the JIT still apply.
+  bool use_clock_cycles;
 } CPUConfig;
 
 // State of the emulated CPU.
@@ -840,8 +990,13 @@ typedef struct CPUState {
 
   // Register values
   uint16_t registers[kNumRegisters];
-  // Flag values
+  // Flag values. Arithmetic flags are evaluated lazily while instructions are
+  // executing, but this is always exact between calls to CPUTick() and other
+  // execution functions, and when invoking the instruction and interrupt
+  // callbacks. Use CPUGetFlag() / CPUGetFlags() from other callbacks.
   uint16_t flags;
+  // The last flag-producing operation whose flags have not been evaluated yet.
+  CPULazyFlags lazy_flags;
 
   // Whether there is an active interrupt.
   bool has_pending_interrupt;
@@ -852,17 +1007,70 @@ typedef struct CPUState {
   // or execute any instructions until an external event (e.g., an interrupt)
   // clears this state.
   bool is_halted;
+
+  // Whether the host or a callback has asked CPURun() to return after the
+  // current instruction. Cleared when CPURun() returns.
+  bool stop_requested;
+
+  // Number of instruction cycles started so far by CPUTick() and the other
+  // execution functions, including cycles spent halted. While an instruction
+  // is executing, this includes the instruction's own cycle. Wraps around.
+  uint32_t cycles;
+
+  // Linear base addresses of the segment registers, indexed by register index
+  // minus kES. These are derived from registers again at the start of
+  // CPUTick() and the other execution functions and after the instruction and
+  // interrupt callbacks return, so the host may write segment registers
+  // directly at those points. Use CPUSetSegmentRegister() from other
+  // callbacks.
+  uint32_t segment_bases[kNumSegmentRegisters];
+
+  // Number of reads from I/O ports that are not known to be stable according
+  // to the is_port_stable callback. Wraps around.
+  uint32_t num_unstable_port_reads;
+
+  // Number of cycles, out of cycles, that were spent idle: halted, or in loop
+  // iterations that were fast-forwarded because they make no progress until
+  // an interrupt arrives. Wraps around.
+  uint32_t idle_cycles;
+
+  // Number of 8088 clock cycles run so far, including one per cycle spent
+  // halted. Only counted if CPUConfig.use_clock_cycles is set.
+  uint64_t clock_cycles;
 } CPUState;
 
 // Initialize CPU state.
 void CPUInit(CPUState* cpu, CPUConfig* config);
 
+// Evaluate a pending lazily evaluated flag.
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag);
+// Evaluate all pending lazily evaluated flags and write them to cpu->flags.
+void CPUMaterializeFlags(CPUState* cpu);
+
 // Get the value of a CPU flag.
 static inline bool CPUGetFlag(const CPUState* cpu, Flag flag) {
+  if (cpu->lazy_flags.pending & flag) {
+    return CPUGetLazyFlag(cpu, flag);
+  }
   return (cpu->flags & flag) != 0;
 }
+// Get the value of the flags register.
+static inline uint16_t CPUGetFlags(CPUState* cpu) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
+  return cpu->flags;
+}
+// Set the value of the flags register.
+static inline void CPUSetFlags(CPUState* cpu, uint16_t flags) {
+  cpu->lazy_flags.pending = 0;
+  cpu->flags = flags;
+}
 // Set a CPU flag.
 static inline void CPUSetFlag(CPUState* cpu, Flag flag, bool value) {
+  if (cpu->lazy_flags.pending) {
+    CPUMaterializeFlags(cpu);
+  }
   if (value) {
     cpu->flags |= flag;
   } else {
@@ -883,6 +1091,23 @@ static inline void CPUClearPendingInterrupt(CPUState* cpu) {
   cpu->pending_interrupt_number = 0;
 }
 
+// Get the linear base address of a segment register.
+static inline uint32_t CPUGetSegmentBase(
+    const CPUState* cpu, RegisterIndex segment_register_index) {
+  return cpu->segment_bases[segment_register_index - kES];
+}
+// Set the value of a segment register, updating its linear base address.
+static inline void CPUSetSegmentRegister(
+    CPUState* cpu, RegisterIndex segment_register_index, uint16_t value) {
+  cpu->registers[segment_register_index] = value;
+  cpu->segment_bases[segment_register_index - kES] = ((uint32_t)value) << 4;
+}
+
+// Ask CPURun() to return at the end of the current instruction cycle. This can
+// be called from callbacks, e.g. when a device raises an interrupt that the
+// host must deliver before the next instruction.
+static inline void CPURequestStop(CPUState* cpu) { cpu->stop_requested = true; }
+
 // ============================================================================
 // Instructions
 // ============================================================================
@@ -952,8 +1177,254 @@ typedef struct Instruction {
 
   // Total length of the original encoded instruction in bytes.
   uint8_t size;
+
+  // Memory operand addressing, resolved from the fields above by the decoder.
+
+  // Sign-extended displacement of the ModR/M memory operand.
+  uint16_t displacement_value;
+  // Base and index registers of the ModR/M memory operand, as mod * 8 + rm.
+  uint8_t effective_address_mode;
+  // Segment register of the ModR/M memory operand, or of the source operand
+  // of string instructions and XLAT, after applying segment override prefixes.
+  uint8_t segment_register_index;
 } Instruction;
 
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+enum {
+  // Number of entries in the decoded instruction cache.
+  kCPUInstructionCacheSize = 1024,
+  // Granularity of instruction cache invalidation in bytes.
+  kCPUInstructionCachePageSize = 1024,
+  // Number of invalidation pages in the physical address space.
+  kCPUInstructionCacheNumPages =
+      kCPUMemoryAddressSpaceSize / kCPUInstructionCachePageSize,
+};
+
+// An entry in the decoded instruction cache.
+typedef struct CPUInstructionCacheEntry {
+  // Linear address of the instruction.
+  uint32_t address;
+  // Generation of the page containing the instruction at the time it was
+  // decoded. The entry is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Opcode metadata for the instruction, or NULL if the entry is empty.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+} CPUInstructionCacheEntry;
+
+// A direct-mapped cache of decoded instructions, keyed by the linear address of
+// CS:IP.
+//
+// Any write to memory through the CPU invalidates cached instructions in the
+// same page by bumping the page's generation, so self-modifying code behaves
+// correctly. Memory modified outside the CPU, such as by DMA or by the host,
+// must be reported via CPUInvalidateInstructionCache().
+typedef struct CPUInstructionCache {
+  // Cache entries, indexed by linear address modulo kCPUInstructionCacheSize.
+  CPUInstructionCacheEntry entries[kCPUInstructionCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached instructions. Used to skip bumping
+  // the generation counter on writes to pages that contain no code.
+  bool page_has_instructions[kCPUInstructionCacheNumPages];
+
+  // Number of instruction fetches served from the cache.
+  uint64_t num_hits;
+  // Number of instruction fetches that had to be decoded from memory.
+  uint64_t num_misses;
+} CPUInstructionCache;
+
+// Initialize or reset an instruction cache.
+void CPUInitInstructionCache(CPUInstructionCache* cache);
+
+// Invalidate any cached instructions or translated blocks covering a memory
+// address. This must be called when memory is modified without going through
+// the CPU, such as by DMA.
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address);
+
+// ============================================================================
+// Block cache
+// ============================================================================
+
+enum {
+  // Number of blocks in the block cache.
+  kCPUBlockCacheSize = 256,
+  // Maximum number of instructions in a block.
+  kCPUMaxBlockInstructions = 16,
+  // Number of successor links kept per block. Most blocks end in a conditional
+  // jump or loop, which has a taken and a not-taken successor.
+  kCPUNumBlockSuccessors = 2,
+};
+
+// Common instruction sequences that are recognized when translating a block,
+// and executed as a single step when there are no instruction callbacks.
+typedef enum CPUFusionKind {
+  // Not the start of a fused sequence.
+  kCPUFusionNone = 0,
+  // CMP or TEST followed by a conditional jump.
+  kCPUFusionCompareJump,
+  // INC or DEC of a register followed by a conditional jump.
+  kCPUFusionIncDecJump,
+  // LODSB followed by STOSB, or LODSW followed by STOSW.
+  kCPUFusionLoadStore,
+  // XOR or SUB of a register with itself.
+  kCPUFusionZeroRegister,
+  // A block ending in a short branch back to its own start, such as a LOOP
+  // over a short body.
+  kCPUFusionLoop,
+  kCPUNumFusionKinds,
+} CPUFusionKind;
+
+struct CPUBlock;
+
+// A decoded instruction in a translated block, along with its pre-resolved
+// opcode metadata and handler.
+typedef struct CPUBlockInstruction {
+  // Opcode metadata for the instruction.
+  const struct OpcodeMetadata* metadata;
+  // The decoded instruction.
+  Instruction instruction;
+  // Kind of fused sequence starting at this instruction, as a CPUFusionKind.
+  uint8_t fusion;
+  // Whether the instruction may take more clock cycles than clock_cycles,
+  // depending on the CPU state.
+  bool has_variable_clock_cycles;
+  // Number of 8088 clock cycles the instruction takes regardless of the CPU
+  // state.
+  uint16_t clock_cycles;
+  // Sum of clock_cycles of the instructions before this one in the block.
+  uint16_t block_clock_cycles;
+} CPUBlockInstruction;
+
+// A translated basic block - a straight-line run of instructions ending at the
+// first control transfer, or at the end of an invalidation page.
+typedef struct CPUBlock {
+  // Linear address of the first instruction.
+  uint32_t address;
+  // Generation of the page containing the block at the time it was translated.
+  // The block is stale if the page's generation has since changed.
+  uint32_t generation;
+  // Total size of the block's instructions in bytes.
+  uint16_t size;
+  // Number of instructions in the block, or 0 if the entry is empty.
+  uint8_t num_instructions;
+  // Index of the successor link to replace next.
+  uint8_t next_successor;
+  // Whether the block ends in a short branch back to its own start.
+  bool is_loop;
+  // Whether the block's instructions only write to registers and flags, so
+  // that running it from the same CPU state always has the same effect as
+  // long as the memory and ports it reads don't change.
+  bool is_read_only;
+  // Links to blocks that previously followed this block. A link is only
+  // followed after checking that the linked block is still valid and starts
+  // at the next CS:IP.
+  struct CPUBlock* successors[kCPUNumBlockSuccessors];
+#ifdef YAX86_CPU_HAS_JIT
+  // Number of times the block has been entered, used to detect hot blocks.
+  uint16_t execution_count;
+  // JIT epoch in which native_code was generated. The native code is stale if
+  // the JIT's code buffer has since been flushed.
+  uint32_t jit_epoch;
+  // Native code for the block, or NULL if the block has not been compiled.
+  uint8_t* native_code;
+#endif  // YAX86_CPU_HAS_JIT
+  // The block's instructions.
+  CPUBlockInstruction instructions[kCPUMaxBlockInstructions];
+} CPUBlock;
+
+// A direct-mapped cache of translated basic blocks, keyed by the linear address
+// of the first instruction.
+//
+// Blocks are invalidated in the same way as the instruction cache: any write
+// to memory through the CPU bumps the generation of the page written to, and
+// memory modified outside the CPU must be reported via
+// CPUInvalidateInstructionCache().
+typedef struct CPUBlockCache {
+  // Cached blocks, indexed by linear address modulo kCPUBlockCacheSize.
+  CPUBlock blocks[kCPUBlockCacheSize];
+  // Generation counter of each page.
+  uint32_t page_generations[kCPUInstructionCacheNumPages];
+  // Whether each page may contain cached blocks. Used to skip bumping the
+  // generation counter on writes to pages that contain no code.
+  bool page_has_blocks[kCPUInstructionCacheNumPages];
+
+  // Number of blocks found in the cache or through a successor link.
+  uint64_t num_hits;
+  // Number of blocks that had to be translated.
+  uint64_t num_misses;
+  // Number of block transitions that followed a successor link.
+  uint64_t num_chained;
+  // Number of times each kind of fused sequence was executed as a single
+  // step, indexed by CPUFusionKind.
+  uint64_t fusion_counts[kCPUNumFusionKinds];
+  // Number of loop iterations skipped by fast-forwarding delay loops and
+  // loops that make no progress.
+  uint64_t num_skipped_loop_iterations;
+} CPUBlockCache;
+
+// Initialize or reset a block cache.
+void CPUInitBlockCache(CPUBlockCache* cache);
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+enum {
+  // Number of times a block must be entered before it is compiled.
+  kCPUJITHotBlockThreshold = 16,
+  // Maximum size of the native code for a single block in bytes.
+  kCPUJITMaxBlockCodeSize = 2048,
+};
+
+// State of the JIT compiler, which translates hot blocks into native x86-64
+// code. Register moves, register ALU instructions and a conditional jump that
+// follows one are translated directly, recording flags in
+// CPUState.lazy_flags like the interpreter. Other instructions are compiled
+// into calls to the interpreter's opcode handlers, so translated blocks access
+// memory through the same callbacks and direct page tables.
+typedef struct CPUJIT {
+  // Caller-provided executable buffer for native code, such as memory mapped
+  // with PROT_READ | PROT_WRITE | PROT_EXEC.
+  uint8_t* code;
+  // Size of the code buffer in bytes.
+  uint32_t code_size;
+  // Number of bytes of the code buffer in use.
+  uint32_t code_used;
+  // Incremented whenever the code buffer is flushed.
+  uint32_t epoch;
+
+  // Block being executed natively.
+  CPUBlock* current_block;
+  // Value of CPUState.cycles before the current block started.
+  uint32_t current_block_start_cycles;
+  // Budget of CPUState.cycles for the current block. Only used if
+  // CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_max_cycles;
+  // Clock cycles taken by the current block's instructions so far on top of
+  // their base clock cycles. Only used if CPUConfig.use_clock_cycles is set.
+  uint32_t current_block_variable_clock_cycles;
+  // Status of the last instruction executed natively.
+  ExecuteStatus status;
+  // Whether native execution of the current block stopped early.
+  bool stopped;
+
+  // Number of blocks compiled.
+  uint64_t num_compiled_blocks;
+  // Number of times the code buffer was flushed because it was full.
+  uint64_t num_flushes;
+  // Number of block executions that ran native code.
+  uint64_t num_native_executions;
+} CPUJIT;
+
+// Initialize or reset a JIT with a caller-provided executable code buffer.
+// The code buffer must be at least kCPUJITMaxBlockCodeSize bytes.
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size);
+
 // ============================================================================
 // Execution
 // ============================================================================
@@ -976,6 +1447,33 @@ ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction);
 // instruction at CS:IP, and handling interrupts.
 ExecuteStatus CPUTick(CPUState* cpu);
 
+// Run up to max_instructions instruction cycles from translated blocks,
+// following links between blocks without decoding again. Each instruction is
+// executed with the same semantics as CPUTick(), but execution stops early
+// after an instruction that leaves the CPU halted, raises an interrupt or sets
+// the trap flag, so external interrupts only need to be checked between calls.
+// The number of instruction cycles run is stored in num_instructions. If
+// CPUConfig.use_clock_cycles is set, max_instructions and num_instructions are
+// in clock cycles instead, as in CPURun().
+//
+// If no block cache is configured, or the code at CS:IP cannot be translated,
+// this runs a single CPUTick().
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions);
+
+// Run up to max_cycles instruction cycles with the same semantics as calling
+// CPUTick() max_cycles times, using translated blocks if a block cache is
+// configured. The number of instruction cycles run is stored in num_cycles.
+// If CPUConfig.use_clock_cycles is set, max_cycles and num_cycles are in clock
+// cycles instead, and num_cycles may exceed max_cycles by up to the length of
+// the last instruction.
+//
+// Execution returns early when an instruction halts the CPU, on error, or when
+// CPURequestStop() is called. If the CPU is already halted with no pending
+// interrupt, it stays halted for all remaining cycles. The instruction
+// callbacks in CPUConfig are only checked once per call.
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles);
+
 #endif  // YAX86_CPU_PUBLIC_H
 
 
@@ -1115,6 +1613,24 @@ enum {
   kNumOperandAddressTypes = kOperandAddressTypeMemory + 1,
 };
 
+// Registers that make up the effective address of a ModR/M memory operand,
+// before adding the displacement.
+typedef struct EffectiveAddressMode {
+  // Base register, masked by base_mask. A mask of 0 means no base register.
+  RegisterIndex base_register_index;
+  uint16_t base_mask;
+  // Index register, masked by index_mask. A mask of 0 means no index register.
+  RegisterIndex index_register_index;
+  uint16_t index_mask;
+  // Segment register used when there is no segment override prefix.
+  RegisterIndex default_segment_register_index;
+} EffectiveAddressMode;
+
+enum {
+  // Number of ModR/M memory addressing modes, indexed by mod * 8 + rm.
+  kNumEffectiveAddressModes = 3 * 8,
+};
+
 // Operand address.
 typedef struct OperandAddress {
   // Type of operand (register or memory).
@@ -1159,6 +1675,19 @@ typedef struct {
 // Handler function for an opcode.
 typedef ExecuteStatus (*OpcodeHandler)(const InstructionContext* context);
 
+// Addressing mode of an instruction's ModR/M byte.
+typedef enum ModRMClass {
+  // The R/M field refers to a memory operand (mod != 3).
+  kModRMClassMemory = 0,
+  // The R/M field refers to a register operand (mod == 3).
+  kModRMClassRegister,
+} ModRMClass;
+
+enum {
+  // Number of ModR/M addressing mode classes.
+  kNumModRMClasses = kModRMClassRegister + 1,
+};
+
 // An entry in the opcode lookup table.
 typedef struct OpcodeMetadata {
   // Opcode.
@@ -1174,8 +1703,48 @@ typedef struct OpcodeMetadata {
 
   // Handler function.
   OpcodeHandler handler;
+  // Optional handlers specialized for the instruction's width and the
+  // addressing mode of its ModR/M byte, indexed by ModRMClass. When NULL,
+  // handler is used instead.
+  OpcodeHandler specialized_handlers[kNumModRMClasses];
 } OpcodeMetadata;
 
+// CPU state at the point where a loop block branched back to its own start,
+// used to detect loops that make no progress.
+typedef struct LoopSnapshot {
+  // The loop block, or NULL if no snapshot has been taken.
+  const CPUBlock* block;
+  // Register values.
+  uint16_t registers[kNumRegisters];
+  // Flag values, with the pending flag-producing operation.
+  uint16_t flags;
+  CPULazyFlags lazy_flags;
+  // Value of CPUState.num_unstable_port_reads.
+  uint32_t num_unstable_port_reads;
+} LoopSnapshot;
+
+// Number of 8088 clock cycles taken by an instruction.
+typedef struct InstructionTiming {
+  // Clock cycles with a register operand, or without a ModR/M byte. For
+  // conditional branches, this is the time taken when not branching.
+  uint8_t register_cycles;
+  // Clock cycles with a memory operand, excluding the effective address
+  // calculation.
+  uint8_t memory_cycles;
+} InstructionTiming;
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// JIT types.
+
+// Interpreter callback invoked by native code to execute an instruction that
+// the JIT cannot translate directly. Returns true if native execution of the
+// block should stop after the instruction.
+typedef bool (*JITInstructionHandler)(
+    CPUState* cpu, const CPUBlockInstruction* entry);
+
+#endif  // YAX86_CPU_HAS_JIT
+
 #endif  // YAX86_CPU_TYPES_H
 
 
@@ -1184,186 +1753,1778 @@ typedef struct OpcodeMetadata {
 // ==============================================================================
 
 // ==============================================================================
-// src/cpu/operands.h start
+// src/cpu/lazy_flags.h start
 // ==============================================================================
 
-#line 1 "./src/cpu/operands.h"
-#ifndef YAX86_CPU_OPERANDS_H
-#define YAX86_CPU_OPERANDS_H
+#line 1 "./src/cpu/lazy_flags.h"
+#ifndef YAX86_CPU_LAZY_FLAGS_H
+#define YAX86_CPU_LAZY_FLAGS_H
 
 #ifndef YAX86_IMPLEMENTATION
 #include "public.h"
 #include "types.h"
 
-// Helper function to construct an OperandValue for a byte.
-extern OperandValue ByteValue(uint8_t byte_value);
-
-// Helper function to construct OperandValue for a word.
-extern OperandValue WordValue(uint16_t word_value);
-
-// Helper function to construct OperandValue given a Width and a value.
-extern OperandValue ToOperandValue(Width width, uint32_t raw_value);
-
-// Helper function to zero-extend OperandValue to a 32-bit value. This makes it
-// simpler to do direct arithmetic without worrying about overflow.
-extern uint32_t FromOperandValue(const OperandValue* value);
-
-// Helper function to sign-extend OperandValue to a 32-bit value. This makes it
-// simpler to do direct arithmetic without worrying about overflow.
-extern int32_t FromSignedOperandValue(const OperandValue* value);
-
-// Helper function to extract a zero-extended value from an operand.
-extern uint32_t FromOperand(const Operand* operand);
-
-// Helper function to extract a sign-extended value from an operand.
-extern int32_t FromSignedOperand(const Operand* operand);
-
-// Computes the raw effective address corresponding to a MemoryAddress.
-extern uint32_t ToRawAddress(const CPUState* cpu, const MemoryAddress* address);
-
-// Read a byte from memory as a uint8_t.
-extern uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address);
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+extern const uint16_t kLazyFlagsProduced[];
 
-// Read a word from memory as a uint16_t.
-extern uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address);
+// Record a flag-producing operation, whose flags will be evaluated when they
+// are read. Pending flags from the previous operation that are not produced by
+// this operation are evaluated first.
+extern void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry);
 
-// Read a byte from memory as an OperandValue.
-extern OperandValue ReadMemoryOperandByte(
-    CPUState* cpu, const OperandAddress* address);
+// Prepare to set the flags in mask directly. Pending flags outside of mask are
+// evaluated, and pending flags in mask are discarded.
+extern void DiscardLazyFlags(CPUState* cpu, uint16_t mask);
 
-// Read a word from memory as an OperandValue.
-extern OperandValue ReadMemoryOperandWord(
-    CPUState* cpu, const OperandAddress* address);
+// Returns the value of the flags in mask, evaluating pending flags as needed.
+extern uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask);
 
-// Read a byte from a register as an OperandValue.
-extern OperandValue ReadRegisterOperandByte(
-    CPUState* cpu, const OperandAddress* address);
+#endif  // YAX86_IMPLEMENTATION
 
-// Read a word from a register as an OperandValue.
-extern OperandValue ReadRegisterOperandWord(
-    CPUState* cpu, const OperandAddress* address);
+#endif  // YAX86_CPU_LAZY_FLAGS_H
 
-// Write a byte as uint8_t to memory.
-extern void WriteRawMemoryByte(CPUState* cpu, uint32_t address, uint8_t value);
 
-// Write a word as uint16_t to memory.
-extern void WriteRawMemoryWord(CPUState* cpu, uint32_t address, uint16_t value);
+// ==============================================================================
+// src/cpu/lazy_flags.h end
+// ==============================================================================
 
-// Write a byte to memory.
-extern void WriteMemoryOperandByte(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ==============================================================================
+// src/cpu/lazy_flags.c start
+// ==============================================================================
 
-// Write a word to memory.
-extern void WriteMemoryOperandWord(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+#line 1 "./src/cpu/lazy_flags.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
 
-// Write a byte to a register.
-extern void WriteRegisterOperandByte(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ============================================================================
+// Lazy flags
+// ============================================================================
 
-// Write a word to a register.
-extern void WriteRegisterOperandWord(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// Table of flags produced by each lazily evaluated operation, indexed by
+// CPULazyFlagsOp.
+YAX86_PRIVATE const uint16_t kLazyFlagsProduced[] = {
+    // kLazyFlagsAdd
+    kArithmeticFlags,
+    // kLazyFlagsInc
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsSub
+    kArithmeticFlags,
+    // kLazyFlagsDec
+    kArithmeticFlags & ~kCF,
+    // kLazyFlagsBoolean
+    kArithmeticFlags & ~kAF,
+};
 
-// Add an 8-bit signed relative offset to a 16-bit unsigned base address.
-extern uint16_t AddSignedOffsetByte(uint16_t base, uint8_t raw_offset);
+// Returns whether the number of set bits in the least significant byte of a
+// value is even.
+static inline bool IsParityEven(uint32_t value) {
+  uint8_t parity = value & 0xFF;
+  parity ^= parity >> 4;
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  return (parity & 1) == 0;
+}
 
-// Add a 16-bit signed relative offset to a 16-bit unsigned base address.
-extern uint16_t AddSignedOffsetWord(uint16_t base, uint16_t raw_offset);
+// Returns whether an operation is an addition, as opposed to a subtraction.
+static inline bool IsLazyFlagsOpAdd(uint8_t op) {
+  return op == kLazyFlagsAdd || op == kLazyFlagsInc;
+}
 
-// Get the register operand for a byte instruction based on the ModR/M byte's
-// reg or R/M field.
-extern RegisterAddress GetRegisterAddressByte(CPUState* cpu, uint8_t reg_or_rm);
+// Carry Flag (CF) - Set when an addition overflows the maximum width, or a
+// subtraction generates a borrow.
+static bool EvaluateCarryFlag(const CPULazyFlags* lazy_flags) {
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  switch (lazy_flags->op) {
+    case kLazyFlagsAdd:
+      return lazy_flags->result > max_value;
+    case kLazyFlagsSub:
+      return lazy_flags->op1 < (lazy_flags->op2 & max_value) +
+                                   (lazy_flags->did_carry ? 1 : 0);
+    default:
+      return false;
+  }
+}
 
-// Get the register operand for a word instruction based on the ModR/M byte's
-// reg or R/M field.
-extern RegisterAddress GetRegisterAddressWord(CPUState* cpu, uint8_t reg_or_rm);
+// Overflow Flag (OF) - Set when the result has the wrong sign.
+static bool EvaluateOverflowFlag(const CPULazyFlags* lazy_flags) {
+  if (lazy_flags->op == kLazyFlagsBoolean) {
+    return false;
+  }
+  const uint32_t sign_bit = kSignBit[lazy_flags->width];
+  const uint32_t max_value = kMaxValue[lazy_flags->width];
+  bool op1_sign = (lazy_flags->op1 & sign_bit) != 0;
+  bool result_sign = (lazy_flags->result & sign_bit) != 0;
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    // Both operands have the same sign but the result has a different sign.
+    bool op2_sign = (lazy_flags->op2 & sign_bit) != 0;
+    return (op1_sign == op2_sign) && (result_sign != op1_sign);
+  }
+  // The operands have different signs and the result has the sign of the
+  // value being subtracted, which is op2 + did_carry truncated to the width.
+  uint32_t val_being_subtracted =
+      (lazy_flags->op2 & max_value) + (lazy_flags->did_carry ? 1 : 0);
+  bool val_being_subtracted_sign =
+      ((val_being_subtracted & max_value) & sign_bit) != 0;
+  return (op1_sign != val_being_subtracted_sign) &&
+         (result_sign == val_being_subtracted_sign);
+}
 
-// Apply segment override prefixes to a MemoryAddress.
-extern void ApplySegmentOverride(
-    const Instruction* instruction, MemoryAddress* address);
+// Auxiliary Carry Flag (AF) - carry or borrow between bit 3 and bit 4.
+static bool EvaluateAuxiliaryCarryFlag(const CPULazyFlags* lazy_flags) {
+  uint32_t op1_low = lazy_flags->op1 & 0xF;
+  uint32_t op2_low = (lazy_flags->op2 & 0xF) + (lazy_flags->did_carry ? 1 : 0);
+  if (IsLazyFlagsOpAdd(lazy_flags->op)) {
+    return op1_low + op2_low > 0xF;
+  }
+  return op1_low < op2_low;
+}
+
+// Evaluate a single flag produced by an operation.
+static bool EvaluateLazyFlag(const CPULazyFlags* lazy_flags, Flag flag) {
+  const uint32_t result = lazy_flags->result & kMaxValue[lazy_flags->width];
+  switch (flag) {
+    case kZF:
+      return result == 0;
+    case kSF:
+      return (result & kSignBit[lazy_flags->width]) != 0;
+    case kPF:
+      return IsParityEven(result);
+    case kCF:
+      return EvaluateCarryFlag(lazy_flags);
+    case kOF:
+      return EvaluateOverflowFlag(lazy_flags);
+    case kAF:
+      return EvaluateAuxiliaryCarryFlag(lazy_flags);
+    default:
+      return false;
+  }
+}
 
-// Compute the memory address for an instruction.
-extern MemoryAddress GetMemoryOperandAddress(
-    CPUState* cpu, const Instruction* instruction);
+// Evaluate the pending flags in mask and write them to cpu->flags.
+static void EvaluateLazyFlags(CPUState* cpu, uint16_t mask) {
+  static const Flag kFlags[] = {kCF, kPF, kAF, kZF, kSF, kOF};
+  mask &= cpu->lazy_flags.pending;
+  for (uint8_t i = 0; i < sizeof(kFlags) / sizeof(kFlags[0]); ++i) {
+    if (!(mask & kFlags[i])) {
+      continue;
+    }
+    if (EvaluateLazyFlag(&cpu->lazy_flags, kFlags[i])) {
+      cpu->flags |= kFlags[i];
+    } else {
+      cpu->flags &= ~kFlags[i];
+    }
+  }
+}
 
-// Get a register or memory operand address based on the ModR/M byte and
-// displacement.
-extern OperandAddress GetRegisterOrMemoryOperandAddress(
-    CPUState* cpu, const Instruction* instruction, Width width);
+bool CPUGetLazyFlag(const CPUState* cpu, Flag flag) {
+  return EvaluateLazyFlag(&cpu->lazy_flags, flag);
+}
 
-// Read an 8-bit immediate value.
-extern OperandValue ReadImmediateOperandByte(const Instruction* instruction);
+void CPUMaterializeFlags(CPUState* cpu) {
+  EvaluateLazyFlags(cpu, cpu->lazy_flags.pending);
+  cpu->lazy_flags.pending = 0;
+}
 
-// Read a 16-bit immediate value.
-extern OperandValue ReadImmediateOperandWord(const Instruction* instruction);
+YAX86_PRIVATE void DiscardLazyFlags(CPUState* cpu, uint16_t mask) {
+  if (cpu->lazy_flags.pending & ~mask) {
+    EvaluateLazyFlags(cpu, ~mask);
+  }
+  cpu->lazy_flags.pending = 0;
+}
+
+YAX86_PRIVATE void SetLazyFlags(
+    CPUState* cpu, CPULazyFlagsOp op, Width width, uint32_t op1, uint32_t op2,
+    uint32_t result, bool did_carry) {
+  const uint16_t produced = kLazyFlagsProduced[op];
+  DiscardLazyFlags(cpu, produced);
+  CPULazyFlags* lazy_flags = &cpu->lazy_flags;
+  lazy_flags->pending = produced;
+  lazy_flags->op = op;
+  lazy_flags->width = width;
+  lazy_flags->did_carry = did_carry;
+  lazy_flags->op1 = op1;
+  lazy_flags->op2 = op2;
+  lazy_flags->result = result;
+}
+
+YAX86_PRIVATE uint16_t GetFlagsInMask(const CPUState* cpu, uint16_t mask) {
+  uint16_t flags = cpu->flags & mask & ~cpu->lazy_flags.pending;
+  uint16_t pending = cpu->lazy_flags.pending & mask;
+  for (uint16_t flag = 1; pending; flag <<= 1) {
+    if (pending & flag) {
+      pending &= ~flag;
+      if (EvaluateLazyFlag(&cpu->lazy_flags, (Flag)flag)) {
+        flags |= flag;
+      }
+    }
+  }
+  return flags;
+}
 
-// Table of GetRegisterAddress functions, indexed by Width.
-extern RegisterAddress (*const kGetRegisterAddressFn[kNumWidths])(
-    CPUState* cpu, uint8_t reg_or_rm);
 
-// Table of Read* functions, indexed by OperandAddressType and Width.
-extern OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
-    CPUState* cpu, const OperandAddress* address);
+// ==============================================================================
+// src/cpu/lazy_flags.c end
+// ==============================================================================
 
-// Table of Write* functions, indexed by OperandAddressType and Width.
-extern void (*const kWriteOperandFn[kNumOperandAddressTypes][kNumWidths])(
-    CPUState* cpu, const OperandAddress* address, OperandValue value);
+// ==============================================================================
+// src/cpu/block_cache.h start
+// ==============================================================================
 
-// Table of ReadImmediate* functions, indexed by Width.
-extern OperandValue (*const kReadImmediateValueFn[kNumWidths])(
-    const Instruction* instruction);
+#line 1 "./src/cpu/block_cache.h"
+#ifndef YAX86_CPU_BLOCK_CACHE_H
+#define YAX86_CPU_BLOCK_CACHE_H
 
-// Read a value from an operand address.
-extern OperandValue ReadOperandValue(
-    const InstructionContext* ctx, const OperandAddress* address);
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
 
-// Get a register or memory operand for an instruction based on the ModR/M
-// byte and displacement.
-extern Operand ReadRegisterOrMemoryOperand(const InstructionContext* ctx);
+// Look up a translated block in the cache by linear address. ip is the offset
+// of the block within the code segment. Returns NULL if the block is not cached
+// or the cached block is stale.
+extern CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip);
 
-// Get a register operand for an instruction.
-extern Operand ReadRegisterOperandForRegisterIndex(
-    const InstructionContext* ctx, RegisterIndex register_index);
+// Returns the cache entry to translate a block at a linear address into. The
+// entry is cleared and any previous block in it is evicted.
+extern CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address);
 
-// Get a register operand for an instruction from the REG field of the Mod/RM
-// byte.
-extern Operand ReadRegisterOperand(const InstructionContext* ctx);
+// Mark a block filled in by the caller as valid.
+extern void CommitBlock(CPUBlockCache* cache, CPUBlock* block);
 
-// Get a segment register operand for an instruction from the REG field of the
-// Mod/RM byte.
-extern Operand ReadSegmentRegisterOperand(const InstructionContext* ctx);
+// Returns whether a block is still valid, i.e. its page has not been written to
+// since it was translated.
+extern bool IsBlockValid(const CPUBlockCache* cache, const CPUBlock* block);
 
-// Write a value to a register or memory operand address.
-extern void WriteOperandAddress(
-    const InstructionContext* ctx, const OperandAddress* address,
-    uint32_t raw_value);
+// Returns the block following a block at a linear address, using the block's
+// successor links if possible. Returns NULL if the successor has not been
+// translated yet.
+extern CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip);
 
-// Write a value to a register or memory operand.
-extern void WriteOperand(
-    const InstructionContext* ctx, const Operand* operand, uint32_t raw_value);
+// Record a link from a block to a successor block.
+extern void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor);
 
-// Read an immediate value from the instruction.
-extern OperandValue ReadImmediate(const InstructionContext* ctx);
+// Invalidate translated blocks in the page containing a memory address that is
+// about to be written.
+extern void InvalidateBlockCacheOnWrite(CPUState* cpu, uint32_t address);
 
 #endif  // YAX86_IMPLEMENTATION
 
-#endif  // YAX86_CPU_OPERANDS_H
+#endif  // YAX86_CPU_BLOCK_CACHE_H
 
 
 // ==============================================================================
-// src/cpu/operands.h end
+// src/cpu/block_cache.h end
 // ==============================================================================
 
 // ==============================================================================
-// src/cpu/operands.c start
+// src/cpu/block_cache.c start
 // ==============================================================================
 
-#line 1 "./src/cpu/operands.c"
+#line 1 "./src/cpu/block_cache.c"
 #ifndef YAX86_IMPLEMENTATION
-#include "operands.h"
-
 #include "../util/common.h"
+#include "block_cache.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Block cache
+// ============================================================================
+
+void CPUInitBlockCache(CPUBlockCache* cache) {
+  for (uint32_t i = 0; i < kCPUBlockCacheSize; ++i) {
+    CPUBlock* block = &cache->blocks[i];
+    block->num_instructions = 0;
+    block->next_successor = 0;
+    for (uint8_t j = 0; j < kCPUNumBlockSuccessors; ++j) {
+      block->successors[j] = NULL;
+    }
+#ifdef YAX86_CPU_HAS_JIT
+    block->execution_count = 0;
+    block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_blocks[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+  cache->num_chained = 0;
+  for (uint8_t i = 0; i < kCPUNumFusionKinds; ++i) {
+    cache->fusion_counts[i] = 0;
+  }
+  cache->num_skipped_loop_iterations = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetBlockCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+YAX86_PRIVATE bool IsBlockValid(
+    const CPUBlockCache* cache, const CPUBlock* block) {
+  return block->num_instructions > 0 &&
+         block->generation ==
+             cache->page_generations[GetBlockCachePage(block->address)];
+}
+
+// Returns whether a block is valid and can be entered at a CS:IP, i.e. it does
+// not run past the end of the code segment.
+static inline bool IsBlockValidAt(
+    const CPUBlockCache* cache, const CPUBlock* block, uint32_t address,
+    uint16_t ip) {
+  return block->address == address && (uint32_t)ip + block->size <= 0x10000 &&
+         IsBlockValid(cache, block);
+}
+
+YAX86_PRIVATE CPUBlock* LookupBlockCache(
+    CPUBlockCache* cache, uint32_t address, uint16_t ip) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  if (IsBlockValidAt(cache, block, address, ip)) {
+    ++cache->num_hits;
+    return block;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE CPUBlock* AllocateBlock(CPUBlockCache* cache, uint32_t address) {
+  CPUBlock* block = &cache->blocks[address % kCPUBlockCacheSize];
+  block->address = address;
+  block->size = 0;
+  block->num_instructions = 0;
+  block->next_successor = 0;
+  block->is_loop = false;
+  block->is_read_only = false;
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    block->successors[i] = NULL;
+  }
+#ifdef YAX86_CPU_HAS_JIT
+  block->execution_count = 0;
+  block->native_code = NULL;
+#endif  // YAX86_CPU_HAS_JIT
+  return block;
+}
+
+YAX86_PRIVATE void CommitBlock(CPUBlockCache* cache, CPUBlock* block) {
+  uint32_t page = GetBlockCachePage(block->address);
+  block->generation = cache->page_generations[page];
+  cache->page_has_blocks[page] = true;
+}
+
+YAX86_PRIVATE CPUBlock* LookupSuccessorBlock(
+    CPUBlockCache* cache, CPUBlock* block, uint32_t address, uint16_t ip) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    CPUBlock* successor = block->successors[i];
+    if (successor && IsBlockValidAt(cache, successor, address, ip)) {
+      ++cache->num_hits;
+      ++cache->num_chained;
+      return successor;
+    }
+  }
+  return LookupBlockCache(cache, address, ip);
+}
+
+YAX86_PRIVATE void LinkSuccessorBlock(CPUBlock* block, CPUBlock* successor) {
+  for (uint8_t i = 0; i < kCPUNumBlockSuccessors; ++i) {
+    if (block->successors[i] == successor) {
+      return;
+    }
+  }
+  block->successors[block->next_successor] = successor;
+  block->next_successor = (block->next_successor + 1) % kCPUNumBlockSuccessors;
+}
+
+YAX86_PRIVATE void InvalidateBlockCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  if (!cache) {
+    return;
+  }
+  uint32_t page = GetBlockCachePage(address);
+  if (cache->page_has_blocks[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_blocks[page] = false;
+  }
+}
+
+
+// ==============================================================================
+// src/cpu/block_cache.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/instruction_cache.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/instruction_cache.h"
+#ifndef YAX86_CPU_INSTRUCTION_CACHE_H
+#define YAX86_CPU_INSTRUCTION_CACHE_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Look up a decoded instruction in the cache by linear address. Returns NULL
+// if the instruction is not cached or the cached entry is stale.
+extern const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address);
+
+// Add a decoded instruction to the cache. ip is the offset of the instruction
+// within the code segment.
+extern void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata);
+
+// Invalidate cached instructions in the page containing a memory address
+// that is about to be written.
+extern void InvalidateInstructionCacheOnWrite(CPUState* cpu, uint32_t address);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_INSTRUCTION_CACHE_H
+
+
+// ==============================================================================
+// src/cpu/instruction_cache.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/instruction_cache.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/instruction_cache.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction cache
+// ============================================================================
+
+void CPUInitInstructionCache(CPUInstructionCache* cache) {
+  for (uint32_t i = 0; i < kCPUInstructionCacheSize; ++i) {
+    cache->entries[i].metadata = NULL;
+  }
+  for (uint32_t i = 0; i < kCPUInstructionCacheNumPages; ++i) {
+    cache->page_generations[i] = 0;
+    cache->page_has_instructions[i] = false;
+  }
+  cache->num_hits = 0;
+  cache->num_misses = 0;
+}
+
+// Returns the invalidation page containing a linear address. Addresses beyond
+// the 1MB address space alias onto the low pages, which only results in extra
+// invalidations.
+static inline uint32_t GetInstructionCachePage(uint32_t address) {
+  return (address / kCPUInstructionCachePageSize) %
+         kCPUInstructionCacheNumPages;
+}
+
+// Returns the cache entry for a linear address.
+static inline CPUInstructionCacheEntry* GetInstructionCacheEntry(
+    CPUInstructionCache* cache, uint32_t address) {
+  return &cache->entries[address % kCPUInstructionCacheSize];
+}
+
+static void InvalidateInstructionCachePage(
+    CPUInstructionCache* cache, uint32_t address) {
+  uint32_t page = GetInstructionCachePage(address);
+  if (cache->page_has_instructions[page]) {
+    ++cache->page_generations[page];
+    cache->page_has_instructions[page] = false;
+  }
+}
+
+void CPUInvalidateInstructionCache(CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+  InvalidateBlockCacheOnWrite(cpu, address);
+}
+
+YAX86_PRIVATE void InvalidateInstructionCacheOnWrite(
+    CPUState* cpu, uint32_t address) {
+  if (cpu->config->instruction_cache) {
+    InvalidateInstructionCachePage(cpu->config->instruction_cache, address);
+  }
+}
+
+YAX86_PRIVATE const CPUInstructionCacheEntry* LookupInstructionCache(
+    CPUInstructionCache* cache, uint32_t address) {
+  const CPUInstructionCacheEntry* entry =
+      GetInstructionCacheEntry(cache, address);
+  if (entry->metadata && entry->address == address &&
+      entry->generation ==
+          cache->page_generations[GetInstructionCachePage(address)]) {
+    ++cache->num_hits;
+    return entry;
+  }
+  ++cache->num_misses;
+  return NULL;
+}
+
+YAX86_PRIVATE void FillInstructionCache(
+    CPUInstructionCache* cache, uint32_t address, uint16_t ip,
+    const Instruction* instruction, const OpcodeMetadata* metadata) {
+  // Don't cache instructions that wrap around the end of the code segment, as
+  // their bytes are not contiguous in memory, or that straddle two pages, as
+  // only the first page's generation is tracked.
+  if ((uint32_t)ip + instruction->size > 0x10000 ||
+      (address % kCPUInstructionCachePageSize) + instruction->size >
+          kCPUInstructionCachePageSize) {
+    return;
+  }
+  uint32_t page = GetInstructionCachePage(address);
+  CPUInstructionCacheEntry* entry = GetInstructionCacheEntry(cache, address);
+  entry->address = address;
+  entry->generation = cache->page_generations[page];
+  entry->metadata = metadata;
+  entry->instruction = *instruction;
+  cache->page_has_instructions[page] = true;
+}
+
+
+// ==============================================================================
+// src/cpu/instruction_cache.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/fusion.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/fusion.h"
+#ifndef YAX86_CPU_FUSION_H
+#define YAX86_CPU_FUSION_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Recognize fused sequences in a translated block, and set the fusion kind of
+// each instruction and whether the block is a loop.
+extern void FuseBlockInstructions(CPUBlock* block);
+
+// Returns the number of instructions in a fused sequence.
+extern uint8_t GetFusionLength(CPUFusionKind kind);
+
+// Evaluate the condition of a conditional jump directly from the operands of
+// the pending flag-producing operation. Returns false if the condition can't
+// be derived this way, in which case the jump must be executed normally.
+extern bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken);
+
+// Execute an XOR or SUB of a register with itself.
+extern void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width);
+
+// Fast-forward through up to max_iterations further iterations of a loop
+// block that just branched back to its own start, if their effect is known in
+// advance: a LOOP instruction branching to itself, or a read-only block whose
+// last iteration left the CPU state unchanged since the previous call with the
+// same snapshot. Otherwise, saves the CPU state in the snapshot. Each skipped
+// iteration advances CPUState.cycles by iteration_cycles, the number of cycles
+// taken by the iteration that just ran. Returns the number of iterations
+// skipped.
+extern uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_FUSION_H
+
+
+// ==============================================================================
+// src/cpu/fusion.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/fusion.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/fusion.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "fusion.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction fusion
+// ============================================================================
+
+// Number of instructions in each kind of fused sequence, indexed by
+// CPUFusionKind. Loops are not executed as a sequence of instructions.
+static const uint8_t kFusionLengths[kCPUNumFusionKinds] = {
+    1,  // kCPUFusionNone
+    2,  // kCPUFusionCompareJump
+    2,  // kCPUFusionIncDecJump
+    2,  // kCPUFusionLoadStore
+    1,  // kCPUFusionZeroRegister
+    0,  // kCPUFusionLoop
+};
+
+YAX86_PRIVATE uint8_t GetFusionLength(CPUFusionKind kind) {
+  return kFusionLengths[kind];
+}
+
+// Returns whether an instruction is a CMP or TEST instruction.
+static bool IsCompare(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // CMP r/m, reg; CMP reg, r/m; CMP AL/AX, imm
+    case 0x38:
+    case 0x39:
+    case 0x3A:
+    case 0x3B:
+    case 0x3C:
+    case 0x3D:
+    // TEST r/m, reg; TEST AL/AX, imm
+    case 0x84:
+    case 0x85:
+    case 0xA8:
+    case 0xA9:
+      return true;
+    // Group 1 - CMP r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      return instruction->mod_rm.reg == 7;
+    // Group 3 - TEST r/m, imm
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction is an INC or DEC of a 16-bit register.
+static bool IsIncDecRegister(const Instruction* instruction) {
+  return instruction->opcode >= 0x40 && instruction->opcode <= 0x4F;
+}
+
+// Returns whether an instruction is a conditional jump (Jcc rel8).
+static bool IsConditionalJump(const Instruction* instruction) {
+  return instruction->opcode >= 0x70 && instruction->opcode <= 0x7F;
+}
+
+// Returns whether an instruction is a short branch, i.e. a Jcc, LOOP, LOOPZ,
+// LOOPNZ, JCXZ or JMP with a rel8 operand.
+static bool IsShortBranch(const Instruction* instruction) {
+  return IsConditionalJump(instruction) ||
+         (instruction->opcode >= 0xE0 && instruction->opcode <= 0xE3) ||
+         instruction->opcode == 0xEB;
+}
+
+// Returns whether an instruction is an XOR or SUB of a register with itself.
+static bool IsZeroRegister(const Instruction* instruction) {
+  switch (instruction->opcode) {
+    // SUB r/m, reg; SUB reg, r/m
+    case 0x28:
+    case 0x29:
+    case 0x2A:
+    case 0x2B:
+    // XOR r/m, reg; XOR reg, r/m
+    case 0x30:
+    case 0x31:
+    case 0x32:
+    case 0x33:
+      return instruction->mod_rm.mod == 3 &&
+             instruction->mod_rm.reg == instruction->mod_rm.rm;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an instruction only writes to registers other than segment
+// registers and SP, and to flags other than IF and TF.
+static bool IsReadOnlyInstruction(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const bool is_register = instruction->mod_rm.mod == 3;
+  // ALU instructions: op r/m, reg; op reg, r/m; op AL/AX, imm
+  if (opcode < 0x40 && (opcode & 0x07) < 6) {
+    // op r/m, reg writes to memory unless it is a CMP.
+    return (opcode & 0x06) != 0 || is_register || (opcode & 0x38) == 0x38;
+  }
+  // INC and DEC of a register
+  if (IsIncDecRegister(instruction) || IsShortBranch(instruction)) {
+    return true;
+  }
+  switch (opcode) {
+    // Group 1 - op r/m, imm
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      return is_register || instruction->mod_rm.reg == 7;
+    // XCHG r/m, reg; MOV r/m, reg; MOV r/m, imm
+    case 0x86:
+    case 0x87:
+    case 0x88:
+    case 0x89:
+    case 0xC6:
+    case 0xC7:
+    // Group 2 - shifts and rotates
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3:
+      return is_register;
+    // Group 3 - TEST r/m, imm; NOT; NEG
+    case 0xF6:
+    case 0xF7:
+      return instruction->mod_rm.reg == 0 ||
+             ((instruction->mod_rm.reg == 2 || instruction->mod_rm.reg == 3) &&
+              is_register);
+    // TEST r/m, reg; MOV reg, r/m; LEA
+    case 0x84:
+    case 0x85:
+    case 0x8A:
+    case 0x8B:
+    case 0x8D:
+    // XCHG AX, reg
+    case 0x90:
+    case 0x91:
+    case 0x92:
+    case 0x93:
+    case 0x94:
+    case 0x95:
+    case 0x96:
+    case 0x97:
+    // CBW; CWD; SAHF; LAHF
+    case 0x98:
+    case 0x99:
+    case 0x9E:
+    case 0x9F:
+    // MOV AL/AX, moffs; TEST AL/AX, imm
+    case 0xA0:
+    case 0xA1:
+    case 0xA8:
+    case 0xA9:
+    // XLAT
+    case 0xD7:
+    // IN AL/AX, imm8; IN AL/AX, DX
+    case 0xE4:
+    case 0xE5:
+    case 0xEC:
+    case 0xED:
+    // CMC; CLC; STC; CLD; STD
+    case 0xF5:
+    case 0xF8:
+    case 0xF9:
+    case 0xFC:
+    case 0xFD:
+      return true;
+    default:
+      // MOV reg, imm
+      return opcode >= 0xB0 && opcode <= 0xBF;
+  }
+}
+
+// Returns the kind of fused sequence starting with an instruction. next is the
+// following instruction in the block, or NULL if there is none.
+static CPUFusionKind GetFusionKind(
+    const Instruction* instruction, const Instruction* next) {
+  if (IsZeroRegister(instruction)) {
+    return kCPUFusionZeroRegister;
+  }
+  if (!next) {
+    return kCPUFusionNone;
+  }
+  if (IsConditionalJump(next)) {
+    if (IsCompare(instruction)) {
+      return kCPUFusionCompareJump;
+    }
+    if (IsIncDecRegister(instruction)) {
+      return kCPUFusionIncDecJump;
+    }
+  }
+  // The LODS may have a segment override prefix, but the STOS may not be
+  // repeated.
+  if (((instruction->opcode == 0xAC && next->opcode == 0xAA) ||
+       (instruction->opcode == 0xAD && next->opcode == 0xAB)) &&
+      next->prefix_size == 0) {
+    return kCPUFusionLoadStore;
+  }
+  return kCPUFusionNone;
+}
+
+YAX86_PRIVATE void FuseBlockInstructions(CPUBlock* block) {
+  block->is_read_only = true;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const Instruction* next = i + 1 < block->num_instructions
+                                  ? &block->instructions[i + 1].instruction
+                                  : NULL;
+    block->instructions[i].fusion =
+        GetFusionKind(&block->instructions[i].instruction, next);
+    if (!IsReadOnlyInstruction(&block->instructions[i].instruction)) {
+      block->is_read_only = false;
+    }
+  }
+  // The block branches back to its own start if the branch offset is minus
+  // the size of the block.
+  const Instruction* last =
+      &block->instructions[block->num_instructions - 1].instruction;
+  block->is_loop = IsShortBranch(last) &&
+                   (int32_t)(int8_t)last->immediate[0] == -(int32_t)block->size;
+}
+
+// Sign-extend a value of a given width.
+static inline int32_t SignExtend(uint32_t value, Width width) {
+  return (int32_t)((value & kMaxValue[width]) ^ kSignBit[width]) -
+         (int32_t)kSignBit[width];
+}
+
+YAX86_PRIVATE bool EvaluateFusedJumpCondition(
+    const CPULazyFlags* lazy_flags, uint8_t opcode, bool* is_taken) {
+  const Width width = (Width)lazy_flags->width;
+  const uint32_t result = lazy_flags->result & kMaxValue[width];
+  // CMP without borrow, or TEST.
+  const bool is_compare = lazy_flags->op == kLazyFlagsSub &&
+                          !lazy_flags->did_carry &&
+                          lazy_flags->pending == kArithmeticFlags;
+  const bool is_test = lazy_flags->op == kLazyFlagsBoolean &&
+                       lazy_flags->pending == (kArithmeticFlags & ~kAF);
+  const int32_t op1 = SignExtend(lazy_flags->op1, width);
+  const int32_t op2 = SignExtend(lazy_flags->op2, width);
+  bool condition;
+  switch (opcode & 0xFE) {
+    // JC / JNC
+    case 0x72:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition =
+          is_compare && lazy_flags->op1 < (lazy_flags->op2 & kMaxValue[width]);
+      break;
+    // JZ / JNZ
+    case 0x74:
+      if (!(lazy_flags->pending & kZF)) {
+        return false;
+      }
+      condition = result == 0;
+      break;
+    // JBE / JA
+    case 0x76:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? lazy_flags->op1 <=
+                                   (lazy_flags->op2 & kMaxValue[width])
+                             : result == 0;
+      break;
+    // JS / JNS
+    case 0x78:
+      if (!(lazy_flags->pending & kSF)) {
+        return false;
+      }
+      condition = (result & kSignBit[width]) != 0;
+      break;
+    // JL / JGE
+    case 0x7C:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 < op2 : (result & kSignBit[width]) != 0;
+      break;
+    // JLE / JG
+    case 0x7E:
+      if (!is_compare && !is_test) {
+        return false;
+      }
+      condition = is_compare ? op1 <= op2
+                             : result == 0 || (result & kSignBit[width]) != 0;
+      break;
+    // JO, JP and their negations
+    default:
+      return false;
+  }
+  // Even opcode => jump if the condition is true
+  // Odd opcode => jump if the condition is false
+  *is_taken = condition == ((opcode & 0x1) == 0);
+  return true;
+}
+
+YAX86_PRIVATE void ExecuteFusedZeroRegister(
+    CPUState* cpu, const Instruction* instruction, Width width) {
+  const uint8_t reg = instruction->mod_rm.reg;
+  if (width == kWord) {
+    cpu->registers[reg] = 0;
+  } else if (reg < 4) {
+    cpu->registers[reg] &= 0xFF00;
+  } else {
+    cpu->registers[reg - 4] &= 0x00FF;
+  }
+  // The flags of x - x and x ^ x don't depend on x.
+  SetLazyFlags(
+      cpu, instruction->opcode < 0x30 ? kLazyFlagsSub : kLazyFlagsBoolean,
+      width, 0, 0, 0, false);
+}
+
+// Returns whether the CPU state matches a loop snapshot.
+static bool MatchesLoopSnapshot(
+    const CPUState* cpu, const LoopSnapshot* snapshot) {
+  for (int i = 0; i < kNumRegisters; ++i) {
+    if (cpu->registers[i] != snapshot->registers[i]) {
+      return false;
+    }
+  }
+  const CPULazyFlags* a = &cpu->lazy_flags;
+  const CPULazyFlags* b = &snapshot->lazy_flags;
+  return cpu->flags == snapshot->flags && a->pending == b->pending &&
+         a->op == b->op && a->width == b->width &&
+         a->did_carry == b->did_carry && a->op1 == b->op1 &&
+         a->op2 == b->op2 && a->result == b->result &&
+         cpu->num_unstable_port_reads == snapshot->num_unstable_port_reads;
+}
+
+YAX86_PRIVATE uint32_t FastForwardLoop(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_iterations, uint32_t iteration_cycles) {
+  // A LOOP instruction branching to itself only counts down CX. Skip all but
+  // the last iteration, which leaves the loop.
+  if (block->num_instructions == 1 &&
+      block->instructions[0].instruction.opcode == 0xE2) {
+    uint32_t num_iterations = (uint32_t)cpu->registers[kCX] - 1;
+    if (num_iterations > max_iterations) {
+      num_iterations = max_iterations;
+    }
+    cpu->registers[kCX] -= num_iterations;
+    cpu->cycles += num_iterations * iteration_cycles;
+    return num_iterations;
+  }
+  if (!block->is_read_only) {
+    return 0;
+  }
+  // If the last iteration left the CPU state unchanged, without reading from
+  // ports that may have changed, every further iteration does the same.
+  if (snapshot->block == block && MatchesLoopSnapshot(cpu, snapshot)) {
+    cpu->cycles += max_iterations * iteration_cycles;
+    cpu->idle_cycles += max_iterations * iteration_cycles;
+    return max_iterations;
+  }
+  snapshot->block = block;
+  for (int i = 0; i < kNumRegisters; ++i) {
+    snapshot->registers[i] = cpu->registers[i];
+  }
+  snapshot->flags = cpu->flags;
+  snapshot->lazy_flags = cpu->lazy_flags;
+  snapshot->num_unstable_port_reads = cpu->num_unstable_port_reads;
+  return 0;
+}
+
+
+// ==============================================================================
+// src/cpu/fusion.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/timing.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/timing.h"
+#ifndef YAX86_CPU_TIMING_H
+#define YAX86_CPU_TIMING_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed, given IP after the instruction was fetched and CX before it
+// was executed.
+extern uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles an instruction takes regardless of
+// the CPU state, i.e. when it does not branch and shifts by 0 bits. The time
+// of repeated string instructions other than their prefixes is all variable,
+// as they may run over several instruction cycles.
+extern uint32_t GetInstructionBaseClockCycles(const Instruction* instruction);
+
+// Returns whether an instruction may take more clock cycles than its base
+// clock cycles depending on the CPU state.
+extern bool HasVariableClockCycles(const Instruction* instruction);
+
+// Returns the number of 8088 clock cycles taken by an instruction that was
+// just executed on top of its base clock cycles, with the same arguments as
+// GetInstructionClockCycles().
+extern uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx);
+
+// Returns the number of 8088 clock cycles a short branch takes on top of its
+// base clock cycles when it transfers control, or 0 if the instruction is not
+// a short branch.
+extern uint32_t GetBranchTakenVariableClockCycles(
+    const Instruction* instruction);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_TIMING_H
+
+
+// ==============================================================================
+// src/cpu/timing.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/timing.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/timing.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Instruction timing
+// ============================================================================
+
+enum {
+  // Opcodes of the first and last conditional jumps, JO and JG.
+  kOpcodeJO = 0x70,
+  kOpcodeJG = 0x7F,
+  // Opcodes of the first and last string instructions, MOVSB and SCASW.
+  kOpcodeMOVSB = 0xA4,
+  kOpcodeSCASW = 0xAF,
+  // Opcode of INTO.
+  kOpcodeINTO = 0xCE,
+  // Opcodes of shifts and rotates by CL.
+  kOpcodeShiftByteByCL = 0xD2,
+  kOpcodeShiftWordByCL = 0xD3,
+  // Value of the ModR/M MOD field for register operands.
+  kModRMModRegister = 3,
+  // Value of the ModR/M REG field for CMP in Group 1 instructions.
+  kModRMRegCMP = 7,
+
+  // Clock cycles taken by a short conditional jump when it transfers control.
+  kConditionalJumpTakenCycles = 16,
+  // Clock cycles taken by each segment override or LOCK prefix.
+  kPrefixCycles = 2,
+  // Clock cycles taken by a repeated string instruction on top of the time
+  // per iteration.
+  kRepeatedStringBaseCycles = 9,
+  // Clock cycles taken per bit by shifts and rotates by CL.
+  kShiftByCLCyclesPerBit = 4,
+  // Clock cycles taken by CMP r/m8, imm8 and CMP r/m16, imm16 with a memory
+  // operand, which do not write back to memory.
+  kCompareImmediateByteMemoryCycles = 10,
+  kCompareImmediateWordMemoryCycles = 14,
+};
+
+// Clock cycles taken by each instruction on the 8088, indexed by opcode. These
+// are the 8086 timings from the Intel datasheet, plus 4 clock cycles for each
+// word transferred over the 8088's 8-bit bus. Conditional branches are listed
+// with the time taken when not branching.
+static const InstructionTiming kInstructionTimings[256] = {
+    {3, 16},   // 0x00 ADD r/m8, r8
+    {3, 24},   // 0x01 ADD r/m16, r16
+    {3, 9},    // 0x02 ADD r8, r/m8
+    {3, 13},   // 0x03 ADD r16, r/m16
+    {4, 4},    // 0x04 ADD AL, imm8
+    {4, 4},    // 0x05 ADD AX, imm16
+    {14, 14},  // 0x06 PUSH ES
+    {12, 12},  // 0x07 POP ES
+    {3, 16},   // 0x08 OR r/m8, r8
+    {3, 24},   // 0x09 OR r/m16, r16
+    {3, 9},    // 0x0A OR r8, r/m8
+    {3, 13},   // 0x0B OR r16, r/m16
+    {4, 4},    // 0x0C OR AL, imm8
+    {4, 4},    // 0x0D OR AX, imm16
+    {14, 14},  // 0x0E PUSH CS
+    {2, 2},    // 0x0F unsupported
+    {3, 16},   // 0x10 ADC r/m8, r8
+    {3, 24},   // 0x11 ADC r/m16, r16
+    {3, 9},    // 0x12 ADC r8, r/m8
+    {3, 13},   // 0x13 ADC r16, r/m16
+    {4, 4},    // 0x14 ADC AL, imm8
+    {4, 4},    // 0x15 ADC AX, imm16
+    {14, 14},  // 0x16 PUSH SS
+    {12, 12},  // 0x17 POP SS
+    {3, 16},   // 0x18 SBB r/m8, r8
+    {3, 24},   // 0x19 SBB r/m16, r16
+    {3, 9},    // 0x1A SBB r8, r/m8
+    {3, 13},   // 0x1B SBB r16, r/m16
+    {4, 4},    // 0x1C SBB AL, imm8
+    {4, 4},    // 0x1D SBB AX, imm16
+    {14, 14},  // 0x1E PUSH DS
+    {12, 12},  // 0x1F POP DS
+    {3, 16},   // 0x20 AND r/m8, r8
+    {3, 24},   // 0x21 AND r/m16, r16
+    {3, 9},    // 0x22 AND r8, r/m8
+    {3, 13},   // 0x23 AND r16, r/m16
+    {4, 4},    // 0x24 AND AL, imm8
+    {4, 4},    // 0x25 AND AX, imm16
+    {2, 2},    // 0x26 ES prefix
+    {4, 4},    // 0x27 DAA
+    {3, 16},   // 0x28 SUB r/m8, r8
+    {3, 24},   // 0x29 SUB r/m16, r16
+    {3, 9},    // 0x2A SUB r8, r/m8
+    {3, 13},   // 0x2B SUB r16, r/m16
+    {4, 4},    // 0x2C SUB AL, imm8
+    {4, 4},    // 0x2D SUB AX, imm16
+    {2, 2},    // 0x2E CS prefix
+    {4, 4},    // 0x2F DAS
+    {3, 16},   // 0x30 XOR r/m8, r8
+    {3, 24},   // 0x31 XOR r/m16, r16
+    {3, 9},    // 0x32 XOR r8, r/m8
+    {3, 13},   // 0x33 XOR r16, r/m16
+    {4, 4},    // 0x34 XOR AL, imm8
+    {4, 4},    // 0x35 XOR AX, imm16
+    {2, 2},    // 0x36 SS prefix
+    {4, 4},    // 0x37 AAA
+    {3, 9},    // 0x38 CMP r/m8, r8
+    {3, 13},   // 0x39 CMP r/m16, r16
+    {3, 9},    // 0x3A CMP r8, r/m8
+    {3, 13},   // 0x3B CMP r16, r/m16
+    {4, 4},    // 0x3C CMP AL, imm8
+    {4, 4},    // 0x3D CMP AX, imm16
+    {2, 2},    // 0x3E DS prefix
+    {4, 4},    // 0x3F AAS
+    {2, 2},    // 0x40 INC AX
+    {2, 2},    // 0x41 INC CX
+    {2, 2},    // 0x42 INC DX
+    {2, 2},    // 0x43 INC BX
+    {2, 2},    // 0x44 INC SP
+    {2, 2},    // 0x45 INC BP
+    {2, 2},    // 0x46 INC SI
+    {2, 2},    // 0x47 INC DI
+    {2, 2},    // 0x48 DEC AX
+    {2, 2},    // 0x49 DEC CX
+    {2, 2},    // 0x4A DEC DX
+    {2, 2},    // 0x4B DEC BX
+    {2, 2},    // 0x4C DEC SP
+    {2, 2},    // 0x4D DEC BP
+    {2, 2},    // 0x4E DEC SI
+    {2, 2},    // 0x4F DEC DI
+    {15, 15},  // 0x50 PUSH AX
+    {15, 15},  // 0x51 PUSH CX
+    {15, 15},  // 0x52 PUSH DX
+    {15, 15},  // 0x53 PUSH BX
+    {15, 15},  // 0x54 PUSH SP
+    {15, 15},  // 0x55 PUSH BP
+    {15, 15},  // 0x56 PUSH SI
+    {15, 15},  // 0x57 PUSH DI
+    {12, 12},  // 0x58 POP AX
+    {12, 12},  // 0x59 POP CX
+    {12, 12},  // 0x5A POP DX
+    {12, 12},  // 0x5B POP BX
+    {12, 12},  // 0x5C POP SP
+    {12, 12},  // 0x5D POP BP
+    {12, 12},  // 0x5E POP SI
+    {12, 12},  // 0x5F POP DI
+    {2, 2},    // 0x60 unsupported
+    {2, 2},    // 0x61 unsupported
+    {2, 2},    // 0x62 unsupported
+    {2, 2},    // 0x63 unsupported
+    {2, 2},    // 0x64 unsupported
+    {2, 2},    // 0x65 unsupported
+    {2, 2},    // 0x66 unsupported
+    {2, 2},    // 0x67 unsupported
+    {2, 2},    // 0x68 unsupported
+    {2, 2},    // 0x69 unsupported
+    {2, 2},    // 0x6A unsupported
+    {2, 2},    // 0x6B unsupported
+    {2, 2},    // 0x6C unsupported
+    {2, 2},    // 0x6D unsupported
+    {2, 2},    // 0x6E unsupported
+    {2, 2},    // 0x6F unsupported
+    {4, 4},    // 0x70 JO rel8
+    {4, 4},    // 0x71 JNO rel8
+    {4, 4},    // 0x72 JB/JNAE/JC rel8
+    {4, 4},    // 0x73 JNB/JAE/JNC rel8
+    {4, 4},    // 0x74 JE/JZ rel8
+    {4, 4},    // 0x75 JNE/JNZ rel8
+    {4, 4},    // 0x76 JBE/JNA rel8
+    {4, 4},    // 0x77 JNBE/JA rel8
+    {4, 4},    // 0x78 JS rel8
+    {4, 4},    // 0x79 JNS rel8
+    {4, 4},    // 0x7A JP/JPE rel8
+    {4, 4},    // 0x7B JNP/JPO rel8
+    {4, 4},    // 0x7C JL/JNGE rel8
+    {4, 4},    // 0x7D JNL/JGE rel8
+    {4, 4},    // 0x7E JLE/JNG rel8
+    {4, 4},    // 0x7F JNLE/JG rel8
+    {4, 17},   // 0x80 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x81 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm16 (Group 1)
+    {4, 17},   // 0x82 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m8, imm8 (Group 1)
+    {4, 25},   // 0x83 ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m16, imm8 (Group 1)
+    {3, 9},    // 0x84 TEST r/m8, r8
+    {3, 13},   // 0x85 TEST r/m16, r16
+    {4, 17},   // 0x86 XCHG r/m8, r8
+    {4, 25},   // 0x87 XCHG r/m16, r16
+    {2, 9},    // 0x88 MOV r/m8, r8
+    {2, 13},   // 0x89 MOV r/m16, r16
+    {2, 8},    // 0x8A MOV r8, r/m8
+    {2, 12},   // 0x8B MOV r16, r/m16
+    {2, 13},   // 0x8C MOV r/m16, sreg
+    {2, 2},    // 0x8D LEA r16, m
+    {2, 12},   // 0x8E MOV sreg, r/m16
+    {12, 25},  // 0x8F POP r/m16
+    {3, 3},    // 0x90 XCHG AX, AX (NOP)
+    {3, 3},    // 0x91 XCHG AX, CX
+    {3, 3},    // 0x92 XCHG AX, DX
+    {3, 3},    // 0x93 XCHG AX, BX
+    {3, 3},    // 0x94 XCHG AX, SP
+    {3, 3},    // 0x95 XCHG AX, BP
+    {3, 3},    // 0x96 XCHG AX, SI
+    {3, 3},    // 0x97 XCHG AX, DI
+    {2, 2},    // 0x98 CBW
+    {5, 5},    // 0x99 CWD
+    {36, 36},  // 0x9A CALL ptr16:16
+    {4, 4},    // 0x9B WAIT
+    {14, 14},  // 0x9C PUSHF
+    {12, 12},  // 0x9D POPF
+    {4, 4},    // 0x9E SAHF
+    {4, 4},    // 0x9F LAHF
+    {10, 10},  // 0xA0 MOV AL, moffs16
+    {14, 14},  // 0xA1 MOV AX, moffs16
+    {10, 10},  // 0xA2 MOV moffs16, AL
+    {14, 14},  // 0xA3 MOV moffs16, AX
+    {18, 18},  // 0xA4 MOVSB
+    {26, 26},  // 0xA5 MOVSW
+    {22, 22},  // 0xA6 CMPSB
+    {30, 30},  // 0xA7 CMPSW
+    {4, 4},    // 0xA8 TEST AL, imm8
+    {4, 4},    // 0xA9 TEST AX, imm16
+    {11, 11},  // 0xAA STOSB
+    {15, 15},  // 0xAB STOSW
+    {12, 12},  // 0xAC LODSB
+    {16, 16},  // 0xAD LODSW
+    {15, 15},  // 0xAE SCASB
+    {19, 19},  // 0xAF SCASW
+    {4, 4},    // 0xB0 MOV AL, imm8
+    {4, 4},    // 0xB1 MOV CL, imm8
+    {4, 4},    // 0xB2 MOV DL, imm8
+    {4, 4},    // 0xB3 MOV BL, imm8
+    {4, 4},    // 0xB4 MOV AH, imm8
+    {4, 4},    // 0xB5 MOV CH, imm8
+    {4, 4},    // 0xB6 MOV DH, imm8
+    {4, 4},    // 0xB7 MOV BH, imm8
+    {4, 4},    // 0xB8 MOV AX, imm16
+    {4, 4},    // 0xB9 MOV CX, imm16
+    {4, 4},    // 0xBA MOV DX, imm16
+    {4, 4},    // 0xBB MOV BX, imm16
+    {4, 4},    // 0xBC MOV SP, imm16
+    {4, 4},    // 0xBD MOV BP, imm16
+    {4, 4},    // 0xBE MOV SI, imm16
+    {4, 4},    // 0xBF MOV DI, imm16
+    {2, 2},    // 0xC0 unsupported
+    {2, 2},    // 0xC1 unsupported
+    {24, 24},  // 0xC2 RET imm16
+    {20, 20},  // 0xC3 RET
+    {24, 24},  // 0xC4 LES r16, m32
+    {24, 24},  // 0xC5 LDS r16, m32
+    {4, 10},   // 0xC6 MOV r/m8, imm8
+    {4, 14},   // 0xC7 MOV r/m16, imm16
+    {2, 2},    // 0xC8 unsupported
+    {2, 2},    // 0xC9 unsupported
+    {33, 33},  // 0xCA RETF imm16
+    {34, 34},  // 0xCB RETF
+    {72, 72},  // 0xCC INT 3
+    {71, 71},  // 0xCD INT imm8
+    {4, 4},    // 0xCE INTO
+    {44, 44},  // 0xCF IRET
+    {2, 15},   // 0xD0 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, 1 (Group 2)
+    {2, 23},   // 0xD1 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, 1 (Group 2)
+    {8, 20},   // 0xD2 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m8, CL (Group 2)
+    {8, 28},   // 0xD3 ROL/ROR/RCL/RCR/SHL/SHR/SAR r/m16, CL (Group 2)
+    {83, 83},  // 0xD4 AAM
+    {60, 60},  // 0xD5 AAD
+    {2, 2},    // 0xD6 unsupported
+    {11, 11},  // 0xD7 XLAT/XLATB
+    {2, 8},    // 0xD8 ESC instruction 0xD8 for 8087 numeric coprocessor
+    {2, 8},    // 0xD9 ESC instruction 0xD9 for 8087 numeric coprocessor
+    {2, 8},    // 0xDA ESC instruction 0xDA for 8087 numeric coprocessor
+    {2, 8},    // 0xDB ESC instruction 0xDB for 8087 numeric coprocessor
+    {2, 8},    // 0xDC ESC instruction 0xDC for 8087 numeric coprocessor
+    {2, 8},    // 0xDD ESC instruction 0xDD for 8087 numeric coprocessor
+    {2, 8},    // 0xDE ESC instruction 0xDE for 8087 numeric coprocessor
+    {2, 8},    // 0xDF ESC instruction 0xDF for 8087 numeric coprocessor
+    {5, 5},    // 0xE0 LOOPNE/LOOPNZ rel8
+    {6, 6},    // 0xE1 LOOPE/LOOPZ rel8
+    {5, 5},    // 0xE2 LOOP rel8
+    {6, 6},    // 0xE3 JCXZ rel8
+    {10, 10},  // 0xE4 IN AL, imm8
+    {14, 14},  // 0xE5 IN AX, imm8
+    {10, 10},  // 0xE6 OUT imm8, AL
+    {14, 14},  // 0xE7 OUT imm8, AX
+    {23, 23},  // 0xE8 CALL rel16
+    {15, 15},  // 0xE9 JMP rel16
+    {15, 15},  // 0xEA JMP ptr16:16
+    {15, 15},  // 0xEB JMP rel8
+    {8, 8},    // 0xEC IN AL, DX
+    {12, 12},  // 0xED IN AX, DX
+    {8, 8},    // 0xEE OUT DX, AL
+    {12, 12},  // 0xEF OUT DX, AX
+    {2, 2},    // 0xF0 LOCK prefix
+    {2, 2},    // 0xF1 unsupported
+    {2, 2},    // 0xF2 REPNE prefix
+    {2, 2},    // 0xF3 REP/REPE prefix
+    {2, 2},    // 0xF4 HLT
+    {2, 2},    // 0xF5 CMC
+    {5, 11},   // 0xF6 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m8 (Group 3)
+    {5, 15},   // 0xF7 TEST/NOT/NEG/MUL/IMUL/DIV/IDIV r/m16 (Group 3)
+    {2, 2},    // 0xF8 CLC
+    {2, 2},    // 0xF9 STC
+    {2, 2},    // 0xFA CLI
+    {2, 2},    // 0xFB STI
+    {2, 2},    // 0xFC CLD
+    {2, 2},    // 0xFD STD
+    {3, 15},   // 0xFE INC/DEC r/m8 (Group 4)
+    {3, 23},   // 0xFF INC/DEC/CALL/JMP/PUSH r/m16 (Group 5)
+};
+
+// Clock cycles taken by group 3 instructions on byte operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3ByteTimings[8] = {
+    {5, 11},     // TEST r/m8, imm8
+    {5, 11},     // TEST r/m8, imm8
+    {3, 16},     // NOT r/m8
+    {3, 16},     // NEG r/m8
+    {77, 83},    // MUL r/m8
+    {98, 104},   // IMUL r/m8
+    {90, 96},    // DIV r/m8
+    {112, 118},  // IDIV r/m8
+};
+
+// Clock cycles taken by group 3 instructions on word operands, indexed by the
+// REG field of the ModR/M byte.
+static const InstructionTiming kGroup3WordTimings[8] = {
+    {5, 15},     // TEST r/m16, imm16
+    {5, 15},     // TEST r/m16, imm16
+    {3, 24},     // NOT r/m16
+    {3, 24},     // NEG r/m16
+    {133, 143},  // MUL r/m16
+    {154, 164},  // IMUL r/m16
+    {162, 172},  // DIV r/m16
+    {184, 194},  // IDIV r/m16
+};
+
+// Clock cycles taken by group 5 instructions, indexed by the REG field of the
+// ModR/M byte.
+static const InstructionTiming kGroup5Timings[8] = {
+    {3, 23},   // INC r/m16
+    {3, 23},   // DEC r/m16
+    {20, 29},  // CALL r/m16
+    {53, 53},  // CALL m16:16
+    {11, 18},  // JMP r/m16
+    {24, 24},  // JMP m16:16
+    {15, 24},  // PUSH r/m16
+    {2, 2},    // unsupported
+};
+
+// Clock cycles taken to compute the effective address of a memory operand,
+// indexed by whether the operand has a displacement and by the R/M field of
+// the ModR/M byte.
+static const uint8_t kEffectiveAddressCycles[2][8] = {
+    // [BX+SI], [BX+DI], [BP+SI], [BP+DI], [SI], [DI], [disp16], [BX]
+    {7, 8, 8, 7, 5, 5, 6, 5},
+    // The same plus an 8-bit or 16-bit displacement, with [BP+disp] for 6.
+    {11, 12, 12, 11, 9, 9, 9, 9},
+};
+
+// Clock cycles taken per iteration of repeated string instructions, indexed by
+// opcode - kOpcodeMOVSB. A repeated string instruction takes
+// kRepeatedStringBaseCycles plus this per iteration.
+static const uint8_t kRepeatedStringCycles[kOpcodeSCASW - kOpcodeMOVSB + 1] = {
+    17, 25,  // MOVSB, MOVSW
+    22, 30,  // CMPSB, CMPSW
+    0,  0,   // TEST AL, imm8 and TEST AX, imm16
+    10, 14,  // STOSB, STOSW
+    13, 17,  // LODSB, LODSW
+    15, 19,  // SCASB, SCASW
+};
+
+// Returns the clock cycles taken by a short branch or INTO when it transfers
+// control, or 0 if the instruction is not one of them.
+static uint8_t GetBranchTakenCycles(uint8_t opcode) {
+  if (opcode >= kOpcodeJO && opcode <= kOpcodeJG) {
+    return kConditionalJumpTakenCycles;
+  }
+  switch (opcode) {
+    case kOpcodeINTO:
+      return 73;
+    case 0xE0:  // LOOPNZ
+      return 19;
+    case 0xE1:  // LOOPZ
+      return 18;
+    case 0xE2:  // LOOP
+      return 17;
+    case 0xE3:  // JCXZ
+      return 18;
+    default:
+      return 0;
+  }
+}
+
+// Returns whether an instruction has a REP or REPNZ prefix.
+static bool IsRepeated(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the clock cycles taken per iteration of a repeated string
+// instruction, or 0 if the instruction is not one.
+static uint8_t GetRepeatedStringCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  if (opcode < kOpcodeMOVSB || opcode > kOpcodeSCASW ||
+      !IsRepeated(instruction)) {
+    return 0;
+  }
+  return kRepeatedStringCycles[opcode - kOpcodeMOVSB];
+}
+
+YAX86_PRIVATE uint32_t GetInstructionBaseClockCycles(
+    const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  InstructionTiming timing = kInstructionTimings[opcode];
+  uint32_t cycles = 0;
+
+  // Segment override and LOCK prefixes take clock cycles of their own.
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] != kPrefixREP &&
+        instruction->prefix[i] != kPrefixREPNZ) {
+      cycles += kPrefixCycles;
+    }
+  }
+
+  // Repeated string instructions may run in several instruction cycles, so
+  // all of their time is counted as variable clock cycles.
+  if (GetRepeatedStringCycles(instruction)) {
+    return cycles;
+  }
+
+  // Instructions in groups take different times depending on the operation.
+  switch (opcode) {
+    case 0x80:
+    case 0x81:
+    case 0x82:
+    case 0x83:
+      // CMP r/m, imm does not write back to memory.
+      if (mod_rm->reg == kModRMRegCMP) {
+        timing.memory_cycles = (opcode & 1) ? kCompareImmediateWordMemoryCycles
+                                            : kCompareImmediateByteMemoryCycles;
+      }
+      break;
+    case 0xF6:
+      timing = kGroup3ByteTimings[mod_rm->reg];
+      break;
+    case 0xF7:
+      timing = kGroup3WordTimings[mod_rm->reg];
+      break;
+    case 0xFF:
+      timing = kGroup5Timings[mod_rm->reg];
+      break;
+    default:
+      break;
+  }
+
+  if (instruction->has_mod_rm && mod_rm->mod != kModRMModRegister) {
+    return cycles + timing.memory_cycles +
+           kEffectiveAddressCycles[mod_rm->mod != 0][mod_rm->rm];
+  }
+  return cycles + timing.register_cycles;
+}
+
+YAX86_PRIVATE bool HasVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  return GetBranchTakenCycles(opcode) || opcode == kOpcodeShiftByteByCL ||
+         opcode == kOpcodeShiftWordByCL || GetRepeatedStringCycles(instruction);
+}
+
+YAX86_PRIVATE uint32_t
+GetBranchTakenVariableClockCycles(const Instruction* instruction) {
+  const uint8_t opcode = instruction->opcode;
+  const uint8_t branch_taken_cycles = GetBranchTakenCycles(opcode);
+  if (!branch_taken_cycles) {
+    return 0;
+  }
+  return branch_taken_cycles - kInstructionTimings[opcode].register_cycles;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionVariableClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint8_t opcode = instruction->opcode;
+
+  // Repeated string instructions take time per iteration run, each of which
+  // decremented CX. A long one runs in several instruction cycles, rewinding
+  // IP to itself until the last, so its base time is only counted once it
+  // completes.
+  const uint8_t repeated_string_cycles = GetRepeatedStringCycles(instruction);
+  if (repeated_string_cycles) {
+    const uint32_t iteration_cycles = (uint16_t)(cx - cpu->registers[kCX]) *
+                                      (uint32_t)repeated_string_cycles;
+    return cpu->registers[kIP] == next_ip
+               ? kRepeatedStringBaseCycles + iteration_cycles
+               : iteration_cycles;
+  }
+
+  // Shifts and rotates by CL take time per bit.
+  if (opcode == kOpcodeShiftByteByCL || opcode == kOpcodeShiftWordByCL) {
+    return kShiftByCLCyclesPerBit * (uint32_t)(cx & 0xFF);
+  }
+
+  // Short branches that were taken, and INTO when it raised an interrupt, take
+  // longer than the table entries.
+  if (opcode == kOpcodeINTO ? cpu->has_pending_interrupt
+                     : cpu->registers[kIP] != next_ip) {
+    return GetBranchTakenVariableClockCycles(instruction);
+  }
+  return 0;
+}
+
+YAX86_PRIVATE uint32_t GetInstructionClockCycles(
+    const CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  return GetInstructionBaseClockCycles(instruction) +
+         GetInstructionVariableClockCycles(cpu, instruction, next_ip, cx);
+}
+
+
+// ==============================================================================
+// src/cpu/timing.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/operands.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/operands.h"
+#ifndef YAX86_CPU_OPERANDS_H
+#define YAX86_CPU_OPERANDS_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+// Helper function to construct an OperandValue for a byte.
+extern OperandValue ByteValue(uint8_t byte_value);
+
+// Helper function to construct OperandValue for a word.
+extern OperandValue WordValue(uint16_t word_value);
+
+// Helper function to construct OperandValue given a Width and a value.
+extern OperandValue ToOperandValue(Width width, uint32_t raw_value);
+
+// Helper function to zero-extend OperandValue to a 32-bit value. This makes it
+// simpler to do direct arithmetic without worrying about overflow.
+extern uint32_t FromOperandValue(const OperandValue* value);
+
+// Helper function to sign-extend OperandValue to a 32-bit value. This makes it
+// simpler to do direct arithmetic without worrying about overflow.
+extern int32_t FromSignedOperandValue(const OperandValue* value);
+
+// Helper function to extract a zero-extended value from an operand.
+extern uint32_t FromOperand(const Operand* operand);
+
+// Helper function to extract a sign-extended value from an operand.
+extern int32_t FromSignedOperand(const Operand* operand);
+
+// Computes the raw effective address corresponding to a MemoryAddress.
+extern uint32_t ToRawAddress(const CPUState* cpu, const MemoryAddress* address);
+
+// Read a byte from memory as a uint8_t.
+extern uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address);
+
+// Read a word from memory as a uint16_t.
+extern uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address);
+
+// Read a byte from memory as an OperandValue.
+extern OperandValue ReadMemoryOperandByte(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a word from memory as an OperandValue.
+extern OperandValue ReadMemoryOperandWord(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a byte from a register as an OperandValue.
+extern OperandValue ReadRegisterOperandByte(
+    CPUState* cpu, const OperandAddress* address);
+
+// Read a word from a register as an OperandValue.
+extern OperandValue ReadRegisterOperandWord(
+    CPUState* cpu, const OperandAddress* address);
+
+// Write a byte as uint8_t to memory.
+extern void WriteRawMemoryByte(CPUState* cpu, uint32_t address, uint8_t value);
+
+// Write a word as uint16_t to memory.
+extern void WriteRawMemoryWord(CPUState* cpu, uint32_t address, uint16_t value);
+
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for reading, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL.
+extern const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Returns a host pointer to size bytes of memory starting at a linear
+// address for writing, if they are all directly accessible and contiguous in
+// host memory. Otherwise, returns NULL. The caller must invalidate cached code
+// with InvalidateCachesOnWrite() before writing.
+extern uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Invalidate cached instructions and blocks overlapping size bytes of memory
+// starting at a linear address.
+extern void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size);
+
+// Write a byte to memory.
+extern void WriteMemoryOperandByte(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a word to memory.
+extern void WriteMemoryOperandWord(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a byte to a register.
+extern void WriteRegisterOperandByte(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Write a word to a register.
+extern void WriteRegisterOperandWord(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Add an 8-bit signed relative offset to a 16-bit unsigned base address.
+extern uint16_t AddSignedOffsetByte(uint16_t base, uint8_t raw_offset);
+
+// Add a 16-bit signed relative offset to a 16-bit unsigned base address.
+extern uint16_t AddSignedOffsetWord(uint16_t base, uint16_t raw_offset);
+
+// Get the register operand for a byte instruction based on the ModR/M byte's
+// reg or R/M field.
+extern RegisterAddress GetRegisterAddressByte(CPUState* cpu, uint8_t reg_or_rm);
+
+// Get the register operand for a word instruction based on the ModR/M byte's
+// reg or R/M field.
+extern RegisterAddress GetRegisterAddressWord(CPUState* cpu, uint8_t reg_or_rm);
+
+// Apply segment override prefixes to a MemoryAddress.
+extern void ApplySegmentOverride(
+    const Instruction* instruction, MemoryAddress* address);
+
+// Resolve the effective address mode, displacement and segment register of
+// an instruction's memory operand from its prefixes, ModR/M byte and
+// displacement bytes.
+extern void ResolveMemoryOperand(Instruction* instruction);
+
+// Compute the memory address for an instruction.
+extern MemoryAddress GetMemoryOperandAddress(
+    CPUState* cpu, const Instruction* instruction);
+
+// Get a register or memory operand address based on the ModR/M byte and
+// displacement.
+extern OperandAddress GetRegisterOrMemoryOperandAddress(
+    CPUState* cpu, const Instruction* instruction, Width width);
+
+// Read an 8-bit immediate value.
+extern OperandValue ReadImmediateOperandByte(const Instruction* instruction);
+
+// Read a 16-bit immediate value.
+extern OperandValue ReadImmediateOperandWord(const Instruction* instruction);
+
+// Table of GetRegisterAddress functions, indexed by Width.
+extern RegisterAddress (*const kGetRegisterAddressFn[kNumWidths])(
+    CPUState* cpu, uint8_t reg_or_rm);
+
+// Table of Read* functions, indexed by OperandAddressType and Width.
+extern OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
+    CPUState* cpu, const OperandAddress* address);
+
+// Table of Write* functions, indexed by OperandAddressType and Width.
+extern void (*const kWriteOperandFn[kNumOperandAddressTypes][kNumWidths])(
+    CPUState* cpu, const OperandAddress* address, OperandValue value);
+
+// Table of ReadImmediate* functions, indexed by Width.
+extern OperandValue (*const kReadImmediateValueFn[kNumWidths])(
+    const Instruction* instruction);
+
+// Read a value from an operand address.
+extern OperandValue ReadOperandValue(
+    const InstructionContext* ctx, const OperandAddress* address);
+
+// Get a register or memory operand for an instruction based on the ModR/M
+// byte and displacement.
+extern Operand ReadRegisterOrMemoryOperand(const InstructionContext* ctx);
+
+// Get a register operand for an instruction.
+extern Operand ReadRegisterOperandForRegisterIndex(
+    const InstructionContext* ctx, RegisterIndex register_index);
+
+// Get a register operand for an instruction from the REG field of the Mod/RM
+// byte.
+extern Operand ReadRegisterOperand(const InstructionContext* ctx);
+
+// Get a segment register operand for an instruction from the REG field of the
+// Mod/RM byte.
+extern Operand ReadSegmentRegisterOperand(const InstructionContext* ctx);
+
+// Write a value to a register or memory operand address.
+extern void WriteOperandAddress(
+    const InstructionContext* ctx, const OperandAddress* address,
+    uint32_t raw_value);
+
+// Write a value to a register or memory operand.
+extern void WriteOperand(
+    const InstructionContext* ctx, const Operand* operand, uint32_t raw_value);
+
+// Read an immediate value from the instruction.
+extern OperandValue ReadImmediate(const InstructionContext* ctx);
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_OPERANDS_H
+
+
+// ==============================================================================
+// src/cpu/operands.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/operands.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/operands.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "operands.h"
+
+#include "../util/common.h"
+#include "block_cache.h"
+#include "instruction_cache.h"
 #endif  // YAX86_IMPLEMENTATION
 
 // Helper functions to construct OperandValue.
@@ -1435,12 +3596,20 @@ YAX86_PRIVATE int32_t FromSignedOperand(const Operand* operand) {
 // Computes the raw effective address corresponding to a MemoryAddress.
 YAX86_PRIVATE uint32_t
 ToRawAddress(const CPUState* cpu, const MemoryAddress* address) {
-  uint16_t segment = cpu->registers[address->segment_register_index];
-  return (((uint32_t)segment) << 4) + (uint32_t)(address->offset);
+  return CPUGetSegmentBase(cpu, address->segment_register_index) +
+         (uint32_t)(address->offset);
 }
 
 // Read a byte from memory as a uint8_t.
 YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return page[raw_address % kCPUMemoryPageSize];
+    }
+  }
   return cpu->config->read_memory_byte
              ? cpu->config->read_memory_byte(cpu, raw_address)
              : 0xFF;
@@ -1448,6 +3617,20 @@ YAX86_PRIVATE uint8_t ReadRawMemoryByte(CPUState* cpu, uint32_t raw_address) {
 
 // Read a word from memory as a uint16_t.
 YAX86_PRIVATE uint16_t ReadRawMemoryWord(CPUState* cpu, uint32_t raw_address) {
+  uint32_t page_offset = raw_address % kCPUMemoryPageSize;
+  if (cpu->config->read_memory_pages &&
+      raw_address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    const uint8_t* page =
+        cpu->config->read_memory_pages[raw_address / kCPUMemoryPageSize];
+    if (page) {
+      return (((uint16_t)page[page_offset + 1]) << 8) |
+             (uint16_t)page[page_offset];
+    }
+  }
+  if (cpu->config->read_memory_word) {
+    return cpu->config->read_memory_word(cpu, raw_address);
+  }
   uint8_t low_byte_value = ReadRawMemoryByte(cpu, raw_address);
   uint8_t high_byte_value = ReadRawMemoryByte(cpu, raw_address + 1);
   return (((uint16_t)high_byte_value) << 8) | (uint16_t)low_byte_value;
@@ -1499,6 +3682,17 @@ OperandValue (*const kReadOperandValueFn[kNumOperandAddressTypes][kNumWidths])(
 // Write a byte as uint8_t to memory.
 YAX86_PRIVATE void WriteRawMemoryByte(
     CPUState* cpu, uint32_t address, uint8_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[address % kCPUMemoryPageSize] = value;
+      return;
+    }
+  }
   if (!cpu->config->write_memory_byte) {
     return;
   }
@@ -1508,10 +3702,83 @@ YAX86_PRIVATE void WriteRawMemoryByte(
 // Write a word as uint16_t to memory.
 YAX86_PRIVATE void WriteRawMemoryWord(
     CPUState* cpu, uint32_t address, uint16_t value) {
+  InvalidateInstructionCacheOnWrite(cpu, address);
+  InvalidateInstructionCacheOnWrite(cpu, address + 1);
+  InvalidateBlockCacheOnWrite(cpu, address);
+  InvalidateBlockCacheOnWrite(cpu, address + 1);
+  uint32_t page_offset = address % kCPUMemoryPageSize;
+  if (cpu->config->write_memory_pages &&
+      address < kCPUMemoryAddressSpaceSize &&
+      page_offset < kCPUMemoryPageSize - 1) {
+    uint8_t* page =
+        cpu->config->write_memory_pages[address / kCPUMemoryPageSize];
+    if (page) {
+      page[page_offset] = value & 0xFF;
+      page[page_offset + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+  }
+  if (cpu->config->write_memory_word) {
+    cpu->config->write_memory_word(cpu, address, value);
+    return;
+  }
   WriteRawMemoryByte(cpu, address, value & 0xFF);
   WriteRawMemoryByte(cpu, address + 1, (value >> 8) & 0xFF);
 }
 
+// Returns a host pointer to size bytes of memory starting at a linear address
+// in a page table, if all pages in the range are mapped and contiguous in host
+// memory. Otherwise, returns NULL.
+static const uint8_t* GetDirectMemory(
+    const uint8_t* const* pages, uint32_t address, uint32_t size) {
+  if (!pages || size == 0 || address >= kCPUMemoryAddressSpaceSize ||
+      size > kCPUMemoryAddressSpaceSize - address) {
+    return NULL;
+  }
+  uint32_t first_page = address / kCPUMemoryPageSize;
+  uint32_t last_page = (address + size - 1) / kCPUMemoryPageSize;
+  const uint8_t* first_page_memory = pages[first_page];
+  if (!first_page_memory) {
+    return NULL;
+  }
+  for (uint32_t page = first_page + 1; page <= last_page; ++page) {
+    if (pages[page] !=
+        first_page_memory + (page - first_page) * kCPUMemoryPageSize) {
+      return NULL;
+    }
+  }
+  return first_page_memory + address % kCPUMemoryPageSize;
+}
+
+YAX86_PRIVATE const uint8_t* GetDirectReadMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return GetDirectMemory(cpu->config->read_memory_pages, address, size);
+}
+
+YAX86_PRIVATE uint8_t* GetDirectWriteMemory(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  return (uint8_t*)GetDirectMemory(
+      (const uint8_t* const*)cpu->config->write_memory_pages, address, size);
+}
+
+YAX86_PRIVATE void InvalidateCachesOnWrite(
+    CPUState* cpu, uint32_t address, uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+  // Invalidating one address in each cache page is sufficient.
+  uint32_t last_address = address + size - 1;
+  for (uint32_t page_address = address;
+       page_address / kCPUInstructionCachePageSize <
+       last_address / kCPUInstructionCachePageSize;
+       page_address += kCPUInstructionCachePageSize) {
+    InvalidateInstructionCacheOnWrite(cpu, page_address);
+    InvalidateBlockCacheOnWrite(cpu, page_address);
+  }
+  InvalidateInstructionCacheOnWrite(cpu, last_address);
+  InvalidateBlockCacheOnWrite(cpu, last_address);
+}
+
 // Write a byte to memory.
 YAX86_PRIVATE void WriteMemoryOperandByte(
     CPUState* cpu, const OperandAddress* address, OperandValue value) {
@@ -1544,7 +3811,12 @@ YAX86_PRIVATE void WriteRegisterOperandByte(
 YAX86_PRIVATE void WriteRegisterOperandWord(
     CPUState* cpu, const OperandAddress* address, OperandValue value) {
   const RegisterAddress* register_address = &address->value.register_address;
-  cpu->registers[register_address->register_index] = value.value.word_value;
+  const RegisterIndex register_index = register_address->register_index;
+  if (register_index >= kES && register_index <= kDS) {
+    CPUSetSegmentRegister(cpu, register_index, value.value.word_value);
+  } else {
+    cpu->registers[register_index] = value.value.word_value;
+  }
 }
 
 // Table of Write* functions, indexed by OperandAddressType and Width.
@@ -1636,82 +3908,109 @@ YAX86_PRIVATE void ApplySegmentOverride(
   }
 }
 
-// Compute the memory address for an instruction.
-YAX86_PRIVATE MemoryAddress
-GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
-  MemoryAddress address;
-  uint8_t mod = instruction->mod_rm.mod;
-  uint8_t rm = instruction->mod_rm.rm;
-  switch (rm) {
-    case 0:  // [BX + SI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 1:  // [BX + DI]
-      address.offset = cpu->registers[kBX] + cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 2:  // [BP + SI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kSI];
-      address.segment_register_index = kSS;
-      break;
-    case 3:  // [BP + DI]
-      address.offset = cpu->registers[kBP] + cpu->registers[kDI];
-      address.segment_register_index = kSS;
-      break;
-    case 4:  // [SI]
-      address.offset = cpu->registers[kSI];
-      address.segment_register_index = kDS;
-      break;
-    case 5:  // [DI]
-      address.offset = cpu->registers[kDI];
-      address.segment_register_index = kDS;
-      break;
-    case 6:
-      if (mod == 0) {
-        // Direct memory address with 16-bit displacement
-        address.offset = 0;
-        address.segment_register_index = kDS;
-      } else {
-        // [BP]
-        address.offset = cpu->registers[kBP];
-        address.segment_register_index = kSS;
-      }
-      break;
-    case 7:  // [BX]
-      address.offset = cpu->registers[kBX];
-      address.segment_register_index = kDS;
-      break;
-    default:
-      // Not possible as RM field is 3 bits (0-7).
-      address.offset = 0xFFFF;
-      address.segment_register_index = kDS;  // Invalid RM field
-      break;
-  }
+// Registers and default segment of each ModR/M memory addressing mode,
+// indexed by mod * 8 + rm.
+static const EffectiveAddressMode
+    kEffectiveAddressModes[kNumEffectiveAddressModes] = {
+        // mod = 0, rm = 0: [BX + SI]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 0, rm = 1: [BX + DI]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 0, rm = 2: [BP + SI]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 0, rm = 3: [BP + DI]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 0, rm = 4: [SI]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 5: [DI]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 0, rm = 6: [disp16]
+        {kAX, 0, kAX, 0, kDS},
+        // mod = 0, rm = 7: [BX]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 0: [BX + SI + disp8]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 1, rm = 1: [BX + DI + disp8]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 1, rm = 2: [BP + SI + disp8]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 1, rm = 3: [BP + DI + disp8]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 1, rm = 4: [SI + disp8]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 5: [DI + disp8]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 1, rm = 6: [BP + disp8]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 1, rm = 7: [BX + disp8]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 0: [BX + SI + disp16]
+        {kBX, 0xFFFF, kSI, 0xFFFF, kDS},
+        // mod = 2, rm = 1: [BX + DI + disp16]
+        {kBX, 0xFFFF, kDI, 0xFFFF, kDS},
+        // mod = 2, rm = 2: [BP + SI + disp16]
+        {kBP, 0xFFFF, kSI, 0xFFFF, kSS},
+        // mod = 2, rm = 3: [BP + DI + disp16]
+        {kBP, 0xFFFF, kDI, 0xFFFF, kSS},
+        // mod = 2, rm = 4: [SI + disp16]
+        {kSI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 5: [DI + disp16]
+        {kDI, 0xFFFF, kAX, 0, kDS},
+        // mod = 2, rm = 6: [BP + disp16]
+        {kBP, 0xFFFF, kAX, 0, kSS},
+        // mod = 2, rm = 7: [BX + disp16]
+        {kBX, 0xFFFF, kAX, 0, kDS},
+};
 
-  // Apply segment override prefixes if present
+YAX86_PRIVATE void ResolveMemoryOperand(Instruction* instruction) {
+  MemoryAddress address = {
+      .segment_register_index = kDS,
+      .offset = 0,
+  };
+  if (instruction->has_mod_rm) {
+    // Register operands (mod = 3) have no memory operand, but resolve them like
+    // mod = 1 without a displacement for instructions that expect one.
+    uint8_t mod = instruction->mod_rm.mod == 3 ? 1 : instruction->mod_rm.mod;
+    instruction->effective_address_mode = mod * 8 + instruction->mod_rm.rm;
+    address.segment_register_index =
+        kEffectiveAddressModes[instruction->effective_address_mode]
+            .default_segment_register_index;
+  } else {
+    instruction->effective_address_mode = 0;
+  }
   ApplySegmentOverride(instruction, &address);
+  instruction->segment_register_index = address.segment_register_index;
 
-  // Add displacement if present
   switch (instruction->displacement_size) {
-    case 1: {
-      uint8_t raw_displacement = instruction->displacement[0];
-      address.offset = AddSignedOffsetByte(address.offset, raw_displacement);
+    case 1:
+      instruction->displacement_value =
+          AddSignedOffsetByte(0, instruction->displacement[0]);
       break;
-    }
-    case 2: {
-      // Concatenate the two displacement bytes as an unsigned 16-bit integer
-      uint16_t raw_displacement =
+    case 2:
+      instruction->displacement_value =
           ((uint16_t)instruction->displacement[0]) |
           (((uint16_t)instruction->displacement[1]) << 8);
-      address.offset = AddSignedOffsetWord(address.offset, raw_displacement);
       break;
-    }
     default:
-      // No displacement
+      instruction->displacement_value = 0;
       break;
   }
+}
 
+// Compute the memory address for an instruction.
+YAX86_PRIVATE MemoryAddress
+GetMemoryOperandAddress(CPUState* cpu, const Instruction* instruction) {
+  const EffectiveAddressMode* mode =
+      &kEffectiveAddressModes[instruction->effective_address_mode];
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)instruction->segment_register_index,
+      .offset = (uint16_t)((cpu->registers[mode->base_register_index] &
+                            mode->base_mask) +
+                           (cpu->registers[mode->index_register_index] &
+                            mode->index_mask) +
+                           instruction->displacement_value),
+  };
   return address;
 }
 
@@ -1866,7 +4165,7 @@ extern ExecuteStatus ExecuteNoOp(const InstructionContext* ctx);
 // ============================================================================
 
 // Global opcode metadata lookup table.
-extern OpcodeMetadata opcode_table[256];
+extern const OpcodeMetadata opcode_table[256];
 
 // ============================================================================
 // Move instructions - instructions_mov.h
@@ -2290,6 +4589,42 @@ extern ExecuteStatus ExecuteGroup4Instruction(const InstructionContext* ctx);
 // Group 5 instruction handler.
 extern ExecuteStatus ExecuteGroup5Instruction(const InstructionContext* ctx);
 
+// ============================================================================
+// Specialized ALU and MOV instructions - instructions_specialized.c
+// ============================================================================
+
+// Declare the specialized handlers of an instruction for one width.
+#define YAX86_DECLARE_SPECIALIZED_HANDLERS(name, width)                    \
+  extern ExecuteStatus Execute##name##RegisterToRegister##width(           \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToMemory##width(             \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##RegisterToRegisterReversed##width(   \
+      const InstructionContext* ctx);                                      \
+  extern ExecuteStatus Execute##name##MemoryToRegister##width(             \
+      const InstructionContext* ctx);
+
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Add, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanOr, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(AddWithCarry, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(SubWithBorrow, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanAnd, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Sub, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(BooleanXor, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Cmp, Word)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Byte)
+YAX86_DECLARE_SPECIALIZED_HANDLERS(Move, Word)
+
+#undef YAX86_DECLARE_SPECIALIZED_HANDLERS
+
 #endif  // YAX86_IMPLEMENTATION
 
 #endif  // YAX86_CPU_INSTRUCTIONS_H
@@ -2307,6 +4642,7 @@ extern ExecuteStatus ExecuteGroup5Instruction(const InstructionContext* ctx);
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2319,6 +4655,7 @@ YAX86_PRIVATE void SetCommonFlagsAfterInstruction(
     const InstructionContext* ctx, uint32_t result) {
   Width width = ctx->metadata->width;
   result &= kMaxValue[width];
+  DiscardLazyFlags(ctx->cpu, kZF | kSF | kPF);
   // Zero flag (ZF)
   CPUSetFlag(ctx->cpu, kZF, result == 0);
   // Sign flag (SF)
@@ -2532,12 +4869,15 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteTranslateByte(const InstructionContext* ctx) {
   // Read the AL register
   Operand al = ReadRegisterOperandForRegisterIndex(ctx, kAX);
+  // The table is in DS unless overridden by a segment override prefix, which
+  // the decoder resolves.
   OperandAddress src_address = {
       .type = kOperandAddressTypeMemory,
       .value =
           {.memory_address =
                {
-                   .segment_register_index = kDS,
+                   .segment_register_index =
+                       (RegisterIndex)ctx->instruction->segment_register_index,
                    .offset =
                        (uint16_t)(ctx->cpu->registers[kBX] + FromOperand(&al)),
                }},
@@ -2572,10 +4912,10 @@ ExecuteTranslateByte(const InstructionContext* ctx) {
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadEffectiveAddress(const InstructionContext* ctx) {
   Operand dest = ReadRegisterOperand(ctx);
+  // The result is the offset within the segment, without the segment base.
   MemoryAddress memory_address =
       GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
-  uint32_t raw_address = ToRawAddress(ctx->cpu, &memory_address);
-  WriteOperandAddress(ctx, &dest.address, raw_address);
+  WriteOperandAddress(ctx, &dest.address, memory_address.offset);
   return kExecuteSuccess;
 }
 
@@ -2630,6 +4970,7 @@ ExecuteLoadDSWithPointer(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2642,34 +4983,26 @@ ExecuteLoadDSWithPointer(const InstructionContext* ctx) {
 // Other than common flags, the INC instruction sets the following flags:
 // - Overflow Flag (OF) - Set when result has wrong sign
 // - Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterInc(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  // Overflow Flag (OF) Set when result has wrong sign (both operands have same
-  // sign but result has different sign)
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool op2_sign = (op2 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  CPUSetFlag(ctx->cpu, kOF, (op1_sign == op2_sign) && (result_sign != op1_sign));
-
-  // Auxiliary Carry Flag (AF) - carry from bit 3 to bit 4
-  CPUSetFlag(
-      ctx->cpu, kAF, ((op1 & 0xF) + (op2 & 0xF) + (did_carry ? 1 : 0)) > 0xF);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsInc, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Set CPU flags after an ADD or ADC instruction.
 // Other than the flags set by the INC instruction, the ADD instruction sets the
 // following flags:
 // - Carry Flag (CF) - Set when result overflows the maximum width
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterAdd(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_carry) {
-  SetFlagsAfterInc(ctx, op1, op2, result, did_carry);
-  // Carry Flag (CF)
-  CPUSetFlag(ctx->cpu, kCF, result > kMaxValue[ctx->metadata->width]);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsAdd, ctx->metadata->width, op1, op2, result,
+      did_carry);
 }
 
 // Common signature of SetFlagsAfterAdd and SetFlagsAfterInc.
@@ -2789,6 +5122,7 @@ YAX86_PRIVATE ExecuteStatus ExecuteIncRegister(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -2797,50 +5131,29 @@ YAX86_PRIVATE ExecuteStatus ExecuteIncRegister(const InstructionContext* ctx) {
 // SUB, SBB, and DEC instructions
 // ============================================================================
 
-// Set CPU flags after a DEC or SUB/SBB operation (base function).
-// This function sets ZF, SF, PF, OF, AF. It does NOT affect CF.
+// Set CPU flags after a DEC operation.
+// This sets ZF, SF, PF, OF, AF. It does NOT affect CF.
 // - OF is for the full operation op1 - (op2 + did_borrow).
 // - AF is for the full operation op1 - (op2 + did_borrow).
+// The flags are evaluated lazily when they are read.
 static void SetFlagsAfterDec(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-
-  uint32_t sign_bit = kSignBit[ctx->metadata->width];
-  uint32_t max_val = kMaxValue[ctx->metadata->width];
-
-  // Overflow Flag (OF)
-  // OF is set if op1_sign != val_being_subtracted_sign AND result_sign ==
-  // val_being_subtracted_sign where val_being_subtracted = (op2 + did_borrow)
-  bool op1_sign = (op1 & sign_bit) != 0;
-  bool result_sign = (result & sign_bit) != 0;
-  uint32_t val_being_subtracted = (op2 & max_val) + (did_borrow ? 1 : 0);
-  // Mask val_being_subtracted to current width before checking its sign,
-  // in case (op2 & max_val) + 1 caused a temporary overflow beyond max_val if
-  // op2 was max_val.
-  bool val_being_subtracted_sign =
-      ((val_being_subtracted & max_val) & sign_bit) != 0;
-  CPUSetFlag(
-      ctx->cpu, kOF,
-      (op1_sign != val_being_subtracted_sign) &&
-          (result_sign == val_being_subtracted_sign));
-
-  // Auxiliary Carry Flag (AF) - borrow from bit 3 to bit 4
-  CPUSetFlag(ctx->cpu, kAF, (op1 & 0xF) < ((op2 & 0xF) + (did_borrow ? 1 : 0)));
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsDec, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Set CPU flags after a SUB, SBB, CMP or NEG instruction.
-// This calls SetFlagsAfterDec and then sets the Carry Flag (CF).
+// This sets the same flags as SetFlagsAfterDec, as well as the Carry Flag (CF),
+// which is set if op1 < (op2 + did_borrow) (unsigned comparison).
+// The flags are evaluated lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterSub(
     const InstructionContext* ctx, uint32_t op1, uint32_t op2, uint32_t result,
     bool did_borrow) {
-  SetFlagsAfterDec(ctx, op1, op2, result, did_borrow);
-
-  // Carry Flag (CF) - Set when a borrow is generated
-  // CF is set if op1 < (op2 + did_borrow) (unsigned comparison)
-  uint32_t val_being_subtracted =
-      (op2 & kMaxValue[ctx->metadata->width]) + (did_borrow ? 1 : 0);
-  CPUSetFlag(ctx->cpu, kCF, op1 < val_being_subtracted);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsSub, ctx->metadata->width, op1, op2, result,
+      did_borrow);
 }
 
 // Common signature of SetFlagsAfterSub and SetFlagsAfterDec.
@@ -3056,6 +5369,7 @@ ExecuteCmpImmediateToALOrAX(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -3064,13 +5378,13 @@ ExecuteCmpImmediateToALOrAX(const InstructionContext* ctx) {
 // Boolean AND, OR and XOR instructions
 // ============================================================================
 
+// Set CPU flags after a boolean instruction. Other than common flags, the
+// Carry Flag (CF) and Overflow Flag (OF) are cleared. The flags are evaluated
+// lazily when they are read.
 YAX86_PRIVATE void SetFlagsAfterBooleanInstruction(
     const InstructionContext* ctx, uint32_t result) {
-  SetCommonFlagsAfterInstruction(ctx, result);
-  // Carry Flag (CF) should be cleared
-  CPUSetFlag(ctx->cpu, kCF, false);
-  // Overflow Flag (OF) should be cleared
-  CPUSetFlag(ctx->cpu, kOF, false);
+  SetLazyFlags(
+      ctx->cpu, kLazyFlagsBoolean, ctx->metadata->width, 0, 0, result, false);
 }
 
 // Common logic for AND instructions.
@@ -3227,6 +5541,7 @@ ExecuteTestImmediateToALOrAX(const InstructionContext* ctx) {
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
 #include "instructions.h"
+#include "lazy_flags.h"
 #include "operands.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
@@ -3276,7 +5591,7 @@ ExecuteShortOrNearJump(const InstructionContext* ctx) {
 YAX86_PRIVATE ExecuteStatus ExecuteFarJump(
     const InstructionContext* ctx, const OperandValue* segment,
     const OperandValue* offset) {
-  ctx->cpu->registers[kCS] = FromOperandValue(segment);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(segment));
   ctx->cpu->registers[kIP] = FromOperandValue(offset);
   return kExecuteSuccess;
 }
@@ -3323,7 +5638,7 @@ YAX86_PRIVATE ExecuteStatus
 ExecuteUnsignedConditionalJump(const InstructionContext* ctx) {
   uint16_t flag_mask = kUnsignedConditionalJumpFlagBitmasks
       [(ctx->instruction->opcode - 0x70) / 2];
-  bool flag_value = (ctx->cpu->flags & flag_mask) != 0;
+  bool flag_value = GetFlagsInMask(ctx->cpu, flag_mask) != 0;
   // Even opcode => jump if the flag is set
   // Odd opcode => jump if the flag is not set
   bool success_value = ((ctx->instruction->opcode & 0x1) == 0);
@@ -3436,7 +5751,7 @@ static ExecuteStatus ExecuteFarReturnCommon(
   OperandValue new_ip = Pop(ctx->cpu);
   OperandValue new_cs = Pop(ctx->cpu);
   ctx->cpu->registers[kIP] = FromOperandValue(&new_ip);
-  ctx->cpu->registers[kCS] = FromOperandValue(&new_cs);
+  CPUSetSegmentRegister(ctx->cpu, kCS, FromOperandValue(&new_cs));
   ctx->cpu->registers[kSP] += arg_size;
   return kExecuteSuccess;
 }
@@ -3462,9 +5777,9 @@ YAX86_PRIVATE ExecuteStatus ExecuteReturnFromInterrupt(CPUState* cpu) {
   OperandValue ip_value = Pop(cpu);
   cpu->registers[kIP] = FromOperandValue(&ip_value);
   OperandValue cs_value = Pop(cpu);
-  cpu->registers[kCS] = FromOperandValue(&cs_value);
+  CPUSetSegmentRegister(cpu, kCS, FromOperandValue(&cs_value));
   OperandValue flags_value = Pop(cpu);
-  cpu->flags = FromOperandValue(&flags_value);
+  CPUSetFlags(cpu, FromOperandValue(&flags_value));
   return kExecuteSuccess;
 }
 
@@ -3568,14 +5883,14 @@ ExecutePopSegmentRegister(const InstructionContext* ctx) {
 
 // PUSHF
 YAX86_PRIVATE ExecuteStatus ExecutePushFlags(const InstructionContext* ctx) {
-  Push(ctx->cpu, WordValue(ctx->cpu->flags));
+  Push(ctx->cpu, WordValue(CPUGetFlags(ctx->cpu)));
   return kExecuteSuccess;
 }
 
 // POPF
 YAX86_PRIVATE ExecuteStatus ExecutePopFlags(const InstructionContext* ctx) {
   OperandValue value = Pop(ctx->cpu);
-  ctx->cpu->flags = FromOperandValue(&value);
+  CPUSetFlags(ctx->cpu, FromOperandValue(&value));
   return kExecuteSuccess;
 }
 
@@ -3611,7 +5926,8 @@ static const OperandAddress* GetAHRegisterAddress(void) {
 YAX86_PRIVATE ExecuteStatus
 ExecuteLoadAHFromFlags(const InstructionContext* ctx) {
   WriteRegisterOperandByte(
-      ctx->cpu, GetAHRegisterAddress(), ByteValue(ctx->cpu->flags & 0x00FF));
+      ctx->cpu, GetAHRegisterAddress(),
+      ByteValue(CPUGetFlags(ctx->cpu) & 0x00FF));
   return kExecuteSuccess;
 }
 
@@ -3621,7 +5937,8 @@ ExecuteStoreAHToFlags(const InstructionContext* ctx) {
   OperandValue value =
       ReadRegisterOperandByte(ctx->cpu, GetAHRegisterAddress());
   // Clear the lower byte of flags and set it to the value in AH
-  ctx->cpu->flags = (ctx->cpu->flags & 0xFF00) | value.value.byte_value;
+  CPUSetFlags(
+      ctx->cpu, (CPUGetFlags(ctx->cpu) & 0xFF00) | value.value.byte_value);
   return kExecuteSuccess;
 }
 
@@ -3703,8 +6020,11 @@ static OperandValue ReadByteFromPort(CPUState* cpu, uint16_t port) {
 
 // Read a word from an I/O port as a uint16_t.
 static OperandValue ReadWordFromPort(CPUState* cpu, uint16_t port) {
+  if (cpu->config->read_port_word) {
+    return WordValue(cpu->config->read_port_word(cpu, port));
+  }
   uint8_t low = ReadByteFromPort(cpu, port).value.byte_value;
-  uint8_t high = ReadByteFromPort(cpu, port).value.byte_value;
+  uint8_t high = ReadByteFromPort(cpu, port + 1).value.byte_value;
   return WordValue((high << 8) | low);
 }
 
@@ -3714,8 +6034,19 @@ static OperandValue (*const kReadFromPortFns[])(CPUState*, uint16_t) = {
     ReadWordFromPort,  // kWord
 };
 
+// Count reads from I/O ports that are not known to be stable, so that loops
+// polling them are not fast-forwarded.
+static void CountPortRead(CPUState* cpu, uint16_t port, Width width) {
+  bool (*is_port_stable)(CPUState*, uint16_t) = cpu->config->is_port_stable;
+  if (!is_port_stable || !is_port_stable(cpu, port) ||
+      (width == kWord && !is_port_stable(cpu, port + 1))) {
+    ++cpu->num_unstable_port_reads;
+  }
+}
+
 // Common logic for IN instructions.
 static ExecuteStatus ExecuteIn(const InstructionContext* ctx, uint16_t port) {
+  CountPortRead(ctx->cpu, port, ctx->metadata->width);
   OperandValue value = kReadFromPortFns[ctx->metadata->width](ctx->cpu, port);
   Operand dest = ReadRegisterOperandForRegisterIndex(ctx, kAX);
   WriteOperand(ctx, &dest, FromOperandValue(&value));
@@ -3746,8 +6077,12 @@ static void WriteByteToPort(CPUState* cpu, uint16_t port, OperandValue value) {
 // Write a word to an I/O port.
 static void WriteWordToPort(CPUState* cpu, uint16_t port, OperandValue value) {
   uint32_t raw_value = FromOperandValue(&value);
+  if (cpu->config->write_port_word) {
+    cpu->config->write_port_word(cpu, port, raw_value);
+    return;
+  }
   WriteByteToPort(cpu, port, ByteValue(raw_value & 0xFF));
-  WriteByteToPort(cpu, port, ByteValue((raw_value >> 8) & 0xFF));
+  WriteByteToPort(cpu, port + 1, ByteValue((raw_value >> 8) & 0xFF));
 }
 
 // Table of functions to write to an I/O port, indexed by data width.
@@ -3813,21 +6148,34 @@ static uint8_t GetRepetitionPrefix(const InstructionContext* ctx) {
   return prefix;
 }
 
+// Get the source memory address for string instructions. Typically DS:SI but
+// can be overridden by a segment override prefix, which the decoder resolves.
+static MemoryAddress GetStringSourceAddress(const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index =
+          (RegisterIndex)ctx->instruction->segment_register_index,
+      .offset = ctx->cpu->registers[kSI],
+  };
+  return address;
+}
+
+// Get the destination memory address for string instructions. Always ES:DI.
+static MemoryAddress GetStringDestinationAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = {
+      .segment_register_index = kES,
+      .offset = ctx->cpu->registers[kDI],
+  };
+  return address;
+}
+
 // Get the source operand for string instructions. Typically DS:SI but can be
 // overridden by a segment override prefix.
 static Operand GetStringSourceOperand(const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kDS,
-                      .offset = ctx->cpu->registers[kSI],
-                  },
-          },
+      .value = {.memory_address = GetStringSourceAddress(ctx)},
   };
-  ApplySegmentOverride(ctx->instruction, &address.value.memory_address);
   Operand operand = {
       .address = address,
       .value = ReadOperandValue(ctx, &address),
@@ -3840,14 +6188,7 @@ static OperandAddress GetStringDestinationOperandAddress(
     const InstructionContext* ctx) {
   OperandAddress address = {
       .type = kOperandAddressTypeMemory,
-      .value =
-          {
-              .memory_address =
-                  {
-                      .segment_register_index = kES,
-                      .offset = ctx->cpu->registers[kDI],
-                  },
-          },
+      .value = {.memory_address = GetStringDestinationAddress(ctx)},
   };
   return address;
 }
@@ -3880,21 +6221,304 @@ static void UpdateStringDestinationAddress(const InstructionContext* ctx) {
   }
 }
 
-// Execute a string instruction with optional REP prefix.
+// ============================================================================
+// Bulk string operations
+// ============================================================================
+
+// When the memory operands of a repeated string instruction are directly
+// accessible host memory, the iterations can be run in bulk without going
+// through the operand helpers. Each bulk function below runs up to count
+// iterations, where count is at most CX, updates SI, DI and CX accordingly,
+// and returns the number of iterations run. The remaining iterations, if any,
+// are run one at a time.
+
+// Get the linear address of count elements of a string operand starting at
+// offset and proceeding in the direction given by DF, i.e. the lowest linear
+// address touched. Returns false if the elements wrap around the end of the
+// segment.
+static bool GetStringOperandRange(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count, uint32_t* linear_address) {
+  uint32_t element_size = kNumBytes[ctx->metadata->width];
+  uint32_t size = count * element_size;
+  uint32_t low_offset = address->offset;
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    if (low_offset + element_size < size) {
+      return false;
+    }
+    low_offset = low_offset + element_size - size;
+  }
+  if (low_offset + size > 0x10000) {
+    return false;
+  }
+  MemoryAddress low_address = {
+      .segment_register_index = address->segment_register_index,
+      .offset = (uint16_t)low_offset,
+  };
+  *linear_address = ToRawAddress(ctx->cpu, &low_address);
+  return true;
+}
+
+// Get a host pointer to count elements of a string operand for reading, or
+// NULL if they are not all directly accessible.
+static const uint8_t* GetDirectStringOperandForReading(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  return GetDirectReadMemory(
+      ctx->cpu, linear_address, count * kNumBytes[ctx->metadata->width]);
+}
+
+// Get a host pointer to count elements of a string operand for writing, or
+// NULL if they are not all directly accessible. Invalidates cached code in the
+// range.
+static uint8_t* GetDirectStringOperandForWriting(
+    const InstructionContext* ctx, const MemoryAddress* address,
+    uint16_t count) {
+  uint32_t linear_address;
+  if (!GetStringOperandRange(ctx, address, count, &linear_address)) {
+    return NULL;
+  }
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  uint8_t* memory = GetDirectWriteMemory(ctx->cpu, linear_address, size);
+  if (memory) {
+    InvalidateCachesOnWrite(ctx->cpu, linear_address, size);
+  }
+  return memory;
+}
+
+// Advance an address register (SI or DI) by count elements in the direction
+// given by DF.
+static void AdvanceStringAddress(
+    const InstructionContext* ctx, RegisterIndex register_index,
+    uint16_t count) {
+  uint16_t delta = (uint16_t)(count * kNumBytes[ctx->metadata->width]);
+  if (CPUGetFlag(ctx->cpu, kDF)) {
+    ctx->cpu->registers[register_index] -= delta;
+  } else {
+    ctx->cpu->registers[register_index] += delta;
+  }
+}
+
+// Read the element at an index from a host pointer to a string operand, where
+// the pointer points to the lowest addressed element.
+static inline uint16_t ReadStringElement(
+    const InstructionContext* ctx, const uint8_t* memory, uint32_t index) {
+  if (ctx->metadata->width == kByte) {
+    return memory[index];
+  }
+  return (uint16_t)(memory[index * 2] | (memory[index * 2 + 1] << 8));
+}
+
+// Returns the index of the iteration in host memory order, where the pointers
+// to string operands point to the lowest addressed element.
+static inline uint32_t GetStringElementIndex(
+    const InstructionContext* ctx, uint16_t count, uint32_t iteration) {
+  return CPUGetFlag(ctx->cpu, kDF) ? count - 1 - iteration : iteration;
+}
+
+// Bulk MOVS, running all iterations.
+static uint16_t ExecuteMovsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint32_t src_linear_address, dest_linear_address;
+  if (!GetStringOperandRange(ctx, &src_address, count, &src_linear_address) ||
+      !GetStringOperandRange(
+          ctx, &dest_address, count, &dest_linear_address)) {
+    return 0;
+  }
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  if (!src) {
+    return 0;
+  }
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+
+  uint32_t size = count * kNumBytes[ctx->metadata->width];
+  bool backward = CPUGetFlag(ctx->cpu, kDF);
+  // If the destination overlaps the part of the source that is yet to be read,
+  // e.g. MOVSB forward with DI = SI + 1, each iteration reads what an earlier
+  // iteration wrote. Copy element by element to replicate that.
+  bool overlaps =
+      backward ? (dest_linear_address < src_linear_address &&
+                  dest_linear_address + size > src_linear_address)
+               : (dest_linear_address > src_linear_address &&
+                  dest_linear_address < src_linear_address + size);
+  if (overlaps) {
+    uint8_t element_size = kNumBytes[ctx->metadata->width];
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t offset = GetStringElementIndex(ctx, count, i) * element_size;
+      uint8_t element[2];
+      for (uint8_t j = 0; j < element_size; ++j) {
+        element[j] = src[offset + j];
+      }
+      for (uint8_t j = 0; j < element_size; ++j) {
+        dest[offset + j] = element[j];
+      }
+    }
+  } else if (dest_linear_address <= src_linear_address) {
+    // Otherwise, every iteration reads the original source, so copy with
+    // memmove semantics.
+    for (uint32_t i = 0; i < size; ++i) {
+      dest[i] = src[i];
+    }
+  } else {
+    for (uint32_t i = size; i > 0; --i) {
+      dest[i - 1] = src[i - 1];
+    }
+  }
+
+  AdvanceStringAddress(ctx, kSI, count);
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk STOS, running all iterations.
+static uint16_t ExecuteStosBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  uint8_t* dest = GetDirectStringOperandForWriting(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX];
+  if (ctx->metadata->width == kByte) {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i] = value & 0xFF;
+    }
+  } else {
+    for (uint32_t i = 0; i < count; ++i) {
+      dest[i * 2] = value & 0xFF;
+      dest[i * 2 + 1] = (value >> 8) & 0xFF;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, count);
+  ctx->cpu->registers[kCX] -= count;
+  return count;
+}
+
+// Bulk LODS, skipping all but the last iteration as only the last value loaded
+// is observable.
+static uint16_t ExecuteLodsBulk(const InstructionContext* ctx, uint16_t count) {
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  // Only skip reads from plain memory, which have no side effects.
+  if (count < 2 ||
+      !GetDirectStringOperandForReading(ctx, &src_address, count)) {
+    return 0;
+  }
+  AdvanceStringAddress(ctx, kSI, count - 1);
+  ctx->cpu->registers[kCX] -= count - 1;
+  return count - 1;
+}
+
+// Bulk SCAS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteScasBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* dest =
+      count < 2 ? NULL
+                : GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!dest) {
+    return 0;
+  }
+  uint16_t value = ctx->cpu->registers[kAX] & kMaxValue[ctx->metadata->width];
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint16_t element = ReadStringElement(
+        ctx, dest, GetStringElementIndex(ctx, count, num_skipped));
+    if ((element == value) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// Bulk CMPS with a REPZ or REPNZ prefix, skipping the iterations before the
+// terminating or last iteration, as only the flags from the last comparison
+// are observable.
+static uint16_t ExecuteCmpsBulk(
+    const InstructionContext* ctx, uint16_t count, bool terminate_zf_value) {
+  if (count < 2) {
+    return 0;
+  }
+  MemoryAddress src_address = GetStringSourceAddress(ctx);
+  MemoryAddress dest_address = GetStringDestinationAddress(ctx);
+  const uint8_t* src =
+      GetDirectStringOperandForReading(ctx, &src_address, count);
+  const uint8_t* dest =
+      GetDirectStringOperandForReading(ctx, &dest_address, count);
+  if (!src || !dest) {
+    return 0;
+  }
+  uint16_t num_skipped = 0;
+  for (; num_skipped < count - 1; ++num_skipped) {
+    uint32_t index = GetStringElementIndex(ctx, count, num_skipped);
+    if ((ReadStringElement(ctx, src, index) ==
+         ReadStringElement(ctx, dest, index)) == terminate_zf_value) {
+      break;
+    }
+  }
+  AdvanceStringAddress(ctx, kSI, num_skipped);
+  AdvanceStringAddress(ctx, kDI, num_skipped);
+  ctx->cpu->registers[kCX] -= num_skipped;
+  return num_skipped;
+}
+
+// ============================================================================
+// Repetition prefixes
+// ============================================================================
+
+// Returns the number of iterations of a repeated string instruction to run in
+// this instruction cycle, which is CX limited by max_string_iterations.
+static uint16_t GetStringIterationCount(const InstructionContext* ctx) {
+  uint16_t count = ctx->cpu->registers[kCX];
+  uint16_t max_count = ctx->cpu->config->max_string_iterations;
+  return max_count && count > max_count ? max_count : count;
+}
+
+// Arrange for a repeated string instruction that has iterations left to be
+// executed again in the next instruction cycle, by rewinding IP to the start
+// of the instruction including its prefixes. As on the 8088, interrupts can be
+// serviced in between, and return to the instruction to resume it.
+static void RepeatStringInstruction(const InstructionContext* ctx) {
+  ctx->cpu->registers[kIP] -= ctx->instruction->size;
+}
+
+// Execute a string instruction with optional REP prefix. If bulk_fn is set,
+// it is given the chance to run the iterations in bulk first.
 static ExecuteStatus ExecuteStringInstructionWithREPPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP) {
     return fn(ctx);
   }
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -3910,7 +6534,8 @@ static ExecuteStatus ExecuteMovsIteration(const InstructionContext* ctx) {
 
 // MOVS
 YAX86_PRIVATE ExecuteStatus ExecuteMovs(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteMovsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteMovsIteration, ExecuteMovsBulk);
 }
 
 // Single STOS iteration.
@@ -3924,7 +6549,8 @@ static ExecuteStatus ExecuteStosIteration(const InstructionContext* ctx) {
 
 // STOS
 YAX86_PRIVATE ExecuteStatus ExecuteStos(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteStosIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteStosIteration, ExecuteStosBulk);
 }
 
 // Single LODS iteration.
@@ -3938,28 +6564,38 @@ static ExecuteStatus ExecuteLodsIteration(const InstructionContext* ctx) {
 
 // LODS
 YAX86_PRIVATE ExecuteStatus ExecuteLods(const InstructionContext* ctx) {
-  return ExecuteStringInstructionWithREPPrefix(ctx, ExecuteLodsIteration);
+  return ExecuteStringInstructionWithREPPrefix(
+      ctx, ExecuteLodsIteration, ExecuteLodsBulk);
 }
 
 // Execute a string instruction with optional REPZ/REPE or REPNZ/REPNE prefix.
 static ExecuteStatus ExecuteStringInstructionWithREPZOrRepNZPrefix(
     const InstructionContext* ctx,
-    ExecuteStatus (*fn)(const InstructionContext*)) {
+    ExecuteStatus (*fn)(const InstructionContext*),
+    uint16_t (*bulk_fn)(const InstructionContext*, uint16_t, bool)) {
   uint8_t prefix = GetRepetitionPrefix(ctx);
   if (prefix != kPrefixREP && prefix != kPrefixREPNZ) {
     return fn(ctx);
   }
   bool terminate_zf_value = prefix == kPrefixREPNZ;
-  while (ctx->cpu->registers[kCX]) {
+  uint16_t count = GetStringIterationCount(ctx);
+  uint16_t num_iterations = 0;
+  if (bulk_fn && count) {
+    num_iterations = bulk_fn(ctx, count, terminate_zf_value);
+  }
+  for (; num_iterations < count; ++num_iterations) {
     ExecuteStatus status = fn(ctx);
     if (status != kExecuteSuccess) {
       return status;
     }
     --ctx->cpu->registers[kCX];
     if (CPUGetFlag(ctx->cpu, kZF) == terminate_zf_value) {
-      break;
+      return kExecuteSuccess;
     }
   }
+  if (ctx->cpu->registers[kCX]) {
+    RepeatStringInstruction(ctx);
+  }
   return kExecuteSuccess;
 }
 
@@ -3975,7 +6611,7 @@ static ExecuteStatus ExecuteScasIteration(const InstructionContext* ctx) {
 // SCAS
 YAX86_PRIVATE ExecuteStatus ExecuteScas(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteScasIteration);
+      ctx, ExecuteScasIteration, ExecuteScasBulk);
 }
 
 // Single CMPS iteration.
@@ -3991,7 +6627,7 @@ static ExecuteStatus ExecuteCmpsIteration(const InstructionContext* ctx) {
 // CMPS
 YAX86_PRIVATE ExecuteStatus ExecuteCmps(const InstructionContext* ctx) {
   return ExecuteStringInstructionWithREPZOrRepNZPrefix(
-      ctx, ExecuteCmpsIteration);
+      ctx, ExecuteCmpsIteration, ExecuteCmpsBulk);
 }
 
 
@@ -4762,6 +7398,230 @@ ExecuteGroup5Instruction(const InstructionContext* ctx) {
 // src/cpu/instructions_group_5.c end
 // ==============================================================================
 
+// ==============================================================================
+// src/cpu/instructions_specialized.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/instructions_specialized.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "instructions.h"
+#include "lazy_flags.h"
+#include "operands.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// Specialized ALU and MOV instructions
+// ============================================================================
+
+// The generic handlers for "op r/m, reg" and "op reg, r/m" instructions pass
+// operands around as OperandValue, and read and write them through function
+// pointer tables indexed by width and addressing mode. The handlers below
+// implement the same instructions for a fixed width and addressing mode, and
+// are selected through OpcodeMetadata.specialized_handlers.
+
+// Read a byte register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterByte(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return reg_or_rm < 4 ? cpu->registers[reg_or_rm] & 0xFF
+                       : cpu->registers[reg_or_rm - 4] >> 8;
+}
+
+// Read a word register given the ModR/M byte's reg or R/M field.
+static inline uint32_t ReadRegisterWord(
+    const CPUState* cpu, uint8_t reg_or_rm) {
+  return cpu->registers[reg_or_rm];
+}
+
+// Write a byte register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterByte(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  if (reg_or_rm < 4) {
+    cpu->registers[reg_or_rm] =
+        (cpu->registers[reg_or_rm] & 0xFF00) | (value & 0xFF);
+  } else {
+    cpu->registers[reg_or_rm - 4] =
+        (cpu->registers[reg_or_rm - 4] & 0x00FF) | ((value & 0xFF) << 8);
+  }
+}
+
+// Write a word register given the ModR/M byte's reg or R/M field.
+static inline void WriteRegisterWord(
+    CPUState* cpu, uint8_t reg_or_rm, uint32_t value) {
+  cpu->registers[reg_or_rm] = value & 0xFFFF;
+}
+
+// Compute the linear address of an instruction's memory operand.
+static inline uint32_t GetMemoryOperandRawAddress(
+    const InstructionContext* ctx) {
+  MemoryAddress address = GetMemoryOperandAddress(ctx->cpu, ctx->instruction);
+  return ToRawAddress(ctx->cpu, &address);
+}
+
+// ADD: returns op1 + op2 and sets flags.
+static inline uint32_t ComputeAdd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 + op2;
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, false);
+  return result;
+}
+
+// ADC: returns op1 + op2 + CF and sets flags.
+static inline uint32_t ComputeAddWithCarry(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool carry = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 + op2 + (carry ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsAdd, width, op1, op2, result, carry);
+  return result;
+}
+
+// SUB and CMP: returns op1 - op2 and sets flags.
+static inline uint32_t ComputeSub(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 - op2;
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, false);
+  return result;
+}
+
+// SBB: returns op1 - op2 - CF and sets flags.
+static inline uint32_t ComputeSubWithBorrow(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  bool borrow = CPUGetFlag(cpu, kCF);
+  uint32_t result = op1 - op2 - (borrow ? 1 : 0);
+  SetLazyFlags(cpu, kLazyFlagsSub, width, op1, op2, result, borrow);
+  return result;
+}
+
+// AND: returns op1 & op2 and sets flags.
+static inline uint32_t ComputeBooleanAnd(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 & op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// OR: returns op1 | op2 and sets flags.
+static inline uint32_t ComputeBooleanOr(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 | op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// XOR: returns op1 ^ op2 and sets flags.
+static inline uint32_t ComputeBooleanXor(
+    CPUState* cpu, Width width, uint32_t op1, uint32_t op2) {
+  uint32_t result = op1 ^ op2;
+  SetLazyFlags(cpu, kLazyFlagsBoolean, width, 0, 0, result, false);
+  return result;
+}
+
+// MOV: returns op2.
+static inline uint32_t ComputeMove(
+    YAX86_UNUSED CPUState* cpu, YAX86_UNUSED Width width,
+    YAX86_UNUSED uint32_t op1, uint32_t op2) {
+  return op2;
+}
+
+// Define the 4 specialized handlers of an instruction for one width:
+//   - Execute<name>RegisterToRegister<width>: op r/m, reg with mod == 3
+//   - Execute<name>RegisterToMemory<width>: op r/m, reg with mod != 3
+//   - Execute<name>RegisterToRegisterReversed<width>: op reg, r/m with mod == 3
+//   - Execute<name>MemoryToRegister<width>: op reg, r/m with mod != 3
+// compute is one of the Compute* functions above. The destination is only
+// read if reads_dest is true, and only written if writes_dest is true.
+#define YAX86_SPECIALIZED_HANDLERS(                                          \
+    name, width, compute, reads_dest, writes_dest)                           \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToRegister##width(      \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.rm;                        \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##RegisterToMemory##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint32_t dest = GetMemoryOperandRawAddress(ctx);                   \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRawMemory##width(cpu, dest) : 0,   \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.reg));             \
+    if (writes_dest) {                                                       \
+      WriteRawMemory##width(cpu, dest, result);                              \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus                                                \
+      Execute##name##RegisterToRegisterReversed##width(                      \
+          const InstructionContext* ctx) {                                   \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        ReadRegister##width(cpu, ctx->instruction->mod_rm.rm));              \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }                                                                          \
+  YAX86_PRIVATE ExecuteStatus Execute##name##MemoryToRegister##width(        \
+      const InstructionContext* ctx) {                                       \
+    CPUState* cpu = ctx->cpu;                                                \
+    const uint8_t dest = ctx->instruction->mod_rm.reg;                       \
+    const uint32_t src =                                                     \
+        ReadRawMemory##width(cpu, GetMemoryOperandRawAddress(ctx));          \
+    uint32_t result = compute(                                               \
+        cpu, k##width, (reads_dest) ? ReadRegister##width(cpu, dest) : 0,    \
+        src);                                                                \
+    if (writes_dest) {                                                       \
+      WriteRegister##width(cpu, dest, result);                               \
+    }                                                                        \
+    return kExecuteSuccess;                                                  \
+  }
+
+// ADD r/m, reg and ADD reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Add, Byte, ComputeAdd, true, true)
+YAX86_SPECIALIZED_HANDLERS(Add, Word, ComputeAdd, true, true)
+// OR r/m, reg and OR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Byte, ComputeBooleanOr, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanOr, Word, ComputeBooleanOr, true, true)
+// ADC r/m, reg and ADC reg, r/m
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Byte, ComputeAddWithCarry, true, true)
+YAX86_SPECIALIZED_HANDLERS(AddWithCarry, Word, ComputeAddWithCarry, true, true)
+// SBB r/m, reg and SBB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Byte, ComputeSubWithBorrow, true, true)
+YAX86_SPECIALIZED_HANDLERS(
+    SubWithBorrow, Word, ComputeSubWithBorrow, true, true)
+// AND r/m, reg and AND reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Byte, ComputeBooleanAnd, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanAnd, Word, ComputeBooleanAnd, true, true)
+// SUB r/m, reg and SUB reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Sub, Byte, ComputeSub, true, true)
+YAX86_SPECIALIZED_HANDLERS(Sub, Word, ComputeSub, true, true)
+// XOR r/m, reg and XOR reg, r/m
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Byte, ComputeBooleanXor, true, true)
+YAX86_SPECIALIZED_HANDLERS(BooleanXor, Word, ComputeBooleanXor, true, true)
+// CMP r/m, reg and CMP reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Cmp, Byte, ComputeSub, true, false)
+YAX86_SPECIALIZED_HANDLERS(Cmp, Word, ComputeSub, true, false)
+// MOV r/m, reg and MOV reg, r/m
+YAX86_SPECIALIZED_HANDLERS(Move, Byte, ComputeMove, false, true)
+YAX86_SPECIALIZED_HANDLERS(Move, Word, ComputeMove, false, true)
+
+#undef YAX86_SPECIALIZED_HANDLERS
+
+
+// ==============================================================================
+// src/cpu/instructions_specialized.c end
+// ==============================================================================
+
 // ==============================================================================
 // src/cpu/opcode_table.c start
 // ==============================================================================
@@ -4779,31 +7639,39 @@ ExecuteGroup5Instruction(const InstructionContext* ctx) {
 // ============================================================================
 
 // Global opcode metadata lookup table.
-YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
+YAX86_PRIVATE const OpcodeMetadata opcode_table[256] = {
     // ADD r/m8, r8
     {.opcode = 0x00,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryByte,
+                              ExecuteAddRegisterToRegisterByte}},
     // ADD r/m16, r16
     {.opcode = 0x01,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemory},
+     .handler = ExecuteAddRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteAddRegisterToMemoryWord,
+                              ExecuteAddRegisterToRegisterWord}},
     // ADD r8, r/m8
     {.opcode = 0x02,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterByte,
+                              ExecuteAddRegisterToRegisterReversedByte}},
     // ADD r16, r/m16
     {.opcode = 0x03,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegister},
+     .handler = ExecuteAddRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteAddMemoryToRegisterWord,
+                              ExecuteAddRegisterToRegisterReversedWord}},
     // ADD AL, imm8
     {.opcode = 0x04,
      .has_modrm = false,
@@ -4833,25 +7701,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryByte,
+                              ExecuteBooleanOrRegisterToRegisterByte}},
     // OR r/m16, r16
     {.opcode = 0x09,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanOrRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanOrRegisterToMemoryWord,
+                              ExecuteBooleanOrRegisterToRegisterWord}},
     // OR r8, r/m8
     {.opcode = 0x0A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterByte,
+                              ExecuteBooleanOrRegisterToRegisterReversedByte}},
     // OR r16, r/m16
     {.opcode = 0x0B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanOrRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanOrMemoryToRegisterWord,
+                              ExecuteBooleanOrRegisterToRegisterReversedWord}},
     // OR AL, imm8
     {.opcode = 0x0C,
      .has_modrm = false,
@@ -4877,25 +7753,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryByte,
+                              ExecuteAddWithCarryRegisterToRegisterByte}},
     // ADC r/m16, r16
     {.opcode = 0x11,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry},
+     .handler = ExecuteAddRegisterToRegisterOrMemoryWithCarry,
+     .specialized_handlers = {ExecuteAddWithCarryRegisterToMemoryWord,
+                              ExecuteAddWithCarryRegisterToRegisterWord}},
     // ADC r8, r/m8
     {.opcode = 0x12,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterByte,
+          ExecuteAddWithCarryRegisterToRegisterReversedByte}},
     // ADC r16, r/m16
     {.opcode = 0x13,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry},
+     .handler = ExecuteAddRegisterOrMemoryToRegisterWithCarry,
+     .specialized_handlers =
+         {ExecuteAddWithCarryMemoryToRegisterWord,
+          ExecuteAddWithCarryRegisterToRegisterReversedWord}},
     // ADC AL, imm8
     {.opcode = 0x14,
      .has_modrm = false,
@@ -4925,25 +7811,35 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryByte,
+                              ExecuteSubWithBorrowRegisterToRegisterByte}},
     // SBB r/m16, r16
     {.opcode = 0x19,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow},
+     .handler = ExecuteSubRegisterFromRegisterOrMemoryWithBorrow,
+     .specialized_handlers = {ExecuteSubWithBorrowRegisterToMemoryWord,
+                              ExecuteSubWithBorrowRegisterToRegisterWord}},
     // SBB r8, r/m8
     {.opcode = 0x1A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterByte,
+          ExecuteSubWithBorrowRegisterToRegisterReversedByte}},
     // SBB r16, r/m16
     {.opcode = 0x1B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow},
+     .handler = ExecuteSubRegisterOrMemoryFromRegisterWithBorrow,
+     .specialized_handlers =
+         {ExecuteSubWithBorrowMemoryToRegisterWord,
+          ExecuteSubWithBorrowRegisterToRegisterReversedWord}},
     // SBB AL, imm8
     {.opcode = 0x1C,
      .has_modrm = false,
@@ -4973,25 +7869,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryByte,
+                              ExecuteBooleanAndRegisterToRegisterByte}},
     // AND r/m16, r16
     {.opcode = 0x21,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanAndRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanAndRegisterToMemoryWord,
+                              ExecuteBooleanAndRegisterToRegisterWord}},
     // AND r8, r/m8
     {.opcode = 0x22,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterByte,
+                              ExecuteBooleanAndRegisterToRegisterReversedByte}},
     // AND r16, r/m16
     {.opcode = 0x23,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanAndRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanAndMemoryToRegisterWord,
+                              ExecuteBooleanAndRegisterToRegisterReversedWord}},
     // AND AL, imm8
     {.opcode = 0x24,
      .has_modrm = false,
@@ -5016,25 +7920,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryByte,
+                              ExecuteSubRegisterToRegisterByte}},
     // SUB r/m16, r16
     {.opcode = 0x29,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterFromRegisterOrMemory},
+     .handler = ExecuteSubRegisterFromRegisterOrMemory,
+     .specialized_handlers = {ExecuteSubRegisterToMemoryWord,
+                              ExecuteSubRegisterToRegisterWord}},
     // SUB r8, r/m8
     {.opcode = 0x2A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterByte,
+                              ExecuteSubRegisterToRegisterReversedByte}},
     // SUB r16, r/m16
     {.opcode = 0x2B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteSubRegisterOrMemoryFromRegister},
+     .handler = ExecuteSubRegisterOrMemoryFromRegister,
+     .specialized_handlers = {ExecuteSubMemoryToRegisterWord,
+                              ExecuteSubRegisterToRegisterReversedWord}},
     // SUB AL, imm8
     {.opcode = 0x2C,
      .has_modrm = false,
@@ -5059,25 +7971,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryByte,
+                              ExecuteBooleanXorRegisterToRegisterByte}},
     // XOR r/m16, r16
     {.opcode = 0x31,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory},
+     .handler = ExecuteBooleanXorRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteBooleanXorRegisterToMemoryWord,
+                              ExecuteBooleanXorRegisterToRegisterWord}},
     // XOR r8, r/m8
     {.opcode = 0x32,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterByte,
+                              ExecuteBooleanXorRegisterToRegisterReversedByte}},
     // XOR r16, r/m16
     {.opcode = 0x33,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister},
+     .handler = ExecuteBooleanXorRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteBooleanXorMemoryToRegisterWord,
+                              ExecuteBooleanXorRegisterToRegisterReversedWord}},
     // XOR AL, imm8
     {.opcode = 0x34,
      .has_modrm = false,
@@ -5103,25 +8023,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryByte,
+                              ExecuteCmpRegisterToRegisterByte}},
     // CMP r/m16, r16
     {.opcode = 0x39,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterToRegisterOrMemory},
+     .handler = ExecuteCmpRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteCmpRegisterToMemoryWord,
+                              ExecuteCmpRegisterToRegisterWord}},
     // CMP r8, r/m8
     {.opcode = 0x3A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterByte,
+                              ExecuteCmpRegisterToRegisterReversedByte}},
     // CMP r16, r/m16
     {.opcode = 0x3B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteCmpRegisterOrMemoryToRegister},
+     .handler = ExecuteCmpRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteCmpMemoryToRegisterWord,
+                              ExecuteCmpRegisterToRegisterReversedWord}},
     // CMP AL, imm8
     {.opcode = 0x3C,
      .has_modrm = false,
@@ -5502,25 +8430,33 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryByte,
+                              ExecuteMoveRegisterToRegisterByte}},
     // MOV r/m16, r16
     {.opcode = 0x89,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterToRegisterOrMemory},
+     .handler = ExecuteMoveRegisterToRegisterOrMemory,
+     .specialized_handlers = {ExecuteMoveRegisterToMemoryWord,
+                              ExecuteMoveRegisterToRegisterWord}},
     // MOV r8, r/m8
     {.opcode = 0x8A,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kByte,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterByte,
+                              ExecuteMoveRegisterToRegisterReversedByte}},
     // MOV r16, r/m16
     {.opcode = 0x8B,
      .has_modrm = true,
      .immediate_size = 0,
      .width = kWord,
-     .handler = ExecuteMoveRegisterOrMemoryToRegister},
+     .handler = ExecuteMoveRegisterOrMemoryToRegister,
+     .specialized_handlers = {ExecuteMoveMemoryToRegisterWord,
+                              ExecuteMoveRegisterToRegisterReversedWord}},
     // MOV r/m16, sreg
     {.opcode = 0x8C,
      .has_modrm = true,
@@ -6170,7 +9106,802 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
 
 
 // ==============================================================================
-// src/cpu/opcode_table.c end
+// src/cpu/opcode_table.c end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/jit.h start
+// ==============================================================================
+
+#line 1 "./src/cpu/jit.h"
+#ifndef YAX86_CPU_JIT_H
+#define YAX86_CPU_JIT_H
+
+#ifndef YAX86_IMPLEMENTATION
+#include "public.h"
+#include "types.h"
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Returns whether a block has native code that is still valid.
+extern bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block);
+
+// Compile a block to native code, flushing the code buffer if it is full.
+// Returns false if the block could not be compiled.
+extern bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler);
+
+// Run a compiled block. Returns the number of instructions executed. Execution
+// stops early if the handler requests it, in which case jit->stopped is set.
+extern uint32_t RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block);
+
+#endif  // YAX86_CPU_HAS_JIT
+
+#endif  // YAX86_IMPLEMENTATION
+
+#endif  // YAX86_CPU_JIT_H
+
+
+// ==============================================================================
+// src/cpu/jit.h end
+// ==============================================================================
+
+// ==============================================================================
+// src/cpu/jit.c start
+// ==============================================================================
+
+#line 1 "./src/cpu/jit.c"
+#ifndef YAX86_IMPLEMENTATION
+#include "../util/common.h"
+#include "jit.h"
+#include "lazy_flags.h"
+#include "public.h"
+#include "timing.h"
+#include "types.h"
+#endif  // YAX86_IMPLEMENTATION
+
+// ============================================================================
+// JIT
+// ============================================================================
+
+void CPUInitJIT(CPUJIT* jit, uint8_t* code, uint32_t code_size) {
+  jit->code = code;
+  jit->code_size = code_size;
+  jit->code_used = 0;
+  jit->epoch = 0;
+  jit->current_block = NULL;
+  jit->current_block_start_cycles = 0;
+  jit->current_block_max_cycles = 0;
+  jit->current_block_variable_clock_cycles = 0;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  jit->num_compiled_blocks = 0;
+  jit->num_flushes = 0;
+  jit->num_native_executions = 0;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Native code is generated for the System V AMD64 calling convention. A
+// compiled block is a function taking the CPUState pointer in RDI and
+// returning the number of instructions executed in EAX. The CPUState pointer
+// is kept in RBX throughout the block.
+
+// Writes native code to the JIT's code buffer.
+typedef struct JITEmitter {
+  // Start of the code being emitted.
+  uint8_t* start;
+  // Next byte to write.
+  uint8_t* next;
+} JITEmitter;
+
+static inline void EmitByte(JITEmitter* emitter, uint8_t value) {
+  *emitter->next = value;
+  ++emitter->next;
+}
+
+static inline void EmitWord(JITEmitter* emitter, uint16_t value) {
+  EmitByte(emitter, value & 0xFF);
+  EmitByte(emitter, (value >> 8) & 0xFF);
+}
+
+static inline void EmitDword(JITEmitter* emitter, uint32_t value) {
+  EmitWord(emitter, value & 0xFFFF);
+  EmitWord(emitter, (value >> 16) & 0xFFFF);
+}
+
+static inline void EmitQword(JITEmitter* emitter, uint64_t value) {
+  EmitDword(emitter, value & 0xFFFFFFFF);
+  EmitDword(emitter, (value >> 32) & 0xFFFFFFFF);
+}
+
+// Emit a sequence of bytes.
+static void EmitBytes(
+    JITEmitter* emitter, const uint8_t* bytes, uint8_t num_bytes) {
+  for (uint8_t i = 0; i < num_bytes; ++i) {
+    EmitByte(emitter, bytes[i]);
+  }
+}
+
+// Returns the offset of a register within CPUState, for use as a displacement
+// from RBX. byte_offset selects the high byte of the register if set.
+static inline uint32_t GetRegisterDisplacement(
+    RegisterIndex register_index, uint8_t byte_offset) {
+  return (uint32_t)(offsetof(CPUState, registers) +
+                    register_index * sizeof(uint16_t) + byte_offset);
+}
+
+// Returns the displacement of an 8-bit register encoded in a REG or R/M field.
+static inline uint32_t GetByteRegisterDisplacement(uint8_t reg_or_rm) {
+  // AL, CL, DL, BL are the low bytes and AH, CH, DH, BH the high bytes of AX,
+  // CX, DX and BX, which is at offset 1 on the little-endian host.
+  return GetRegisterDisplacement(
+      (RegisterIndex)(reg_or_rm & 0x3), reg_or_rm >> 2);
+}
+
+// push rbx
+// mov rbx, rdi
+static void EmitPrologue(JITEmitter* emitter) {
+  static const uint8_t kPrologue[] = {0x53, 0x48, 0x89, 0xFB};
+  EmitBytes(emitter, kPrologue, sizeof(kPrologue));
+}
+
+// mov eax, num_instructions
+// pop rbx
+// ret
+static void EmitReturn(JITEmitter* emitter, uint32_t num_instructions) {
+  EmitByte(emitter, 0xB8);
+  EmitDword(emitter, num_instructions);
+  EmitByte(emitter, 0x5B);
+  EmitByte(emitter, 0xC3);
+}
+
+// add word [rbx + IP], delta
+static void EmitAddIP(JITEmitter* emitter, uint16_t delta) {
+  static const uint8_t kAddWord[] = {0x66, 0x81, 0x83};
+  EmitBytes(emitter, kAddWord, sizeof(kAddWord));
+  EmitDword(emitter, GetRegisterDisplacement(kIP, 0));
+  EmitWord(emitter, delta);
+}
+
+// mov word [rbx + dest], value
+static void EmitMoveImmediateWord(
+    JITEmitter* emitter, uint32_t dest, uint16_t value) {
+  static const uint8_t kMoveWord[] = {0x66, 0xC7, 0x83};
+  EmitBytes(emitter, kMoveWord, sizeof(kMoveWord));
+  EmitDword(emitter, dest);
+  EmitWord(emitter, value);
+}
+
+// mov byte [rbx + dest], value
+static void EmitMoveImmediateByte(
+    JITEmitter* emitter, uint32_t dest, uint8_t value) {
+  static const uint8_t kMoveByte[] = {0xC6, 0x83};
+  EmitBytes(emitter, kMoveByte, sizeof(kMoveByte));
+  EmitDword(emitter, dest);
+  EmitByte(emitter, value);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+static void EmitMoveWord(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadWord[] = {0x0F, 0xB7, 0x83};
+  static const uint8_t kStoreWord[] = {0x66, 0x89, 0x83};
+  EmitBytes(emitter, kLoadWord, sizeof(kLoadWord));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreWord, sizeof(kStoreWord));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, byte [rbx + src]
+// mov byte [rbx + dest], al
+static void EmitMoveByte(JITEmitter* emitter, uint32_t dest, uint32_t src) {
+  static const uint8_t kLoadByte[] = {0x0F, 0xB6, 0x83};
+  static const uint8_t kStoreByte[] = {0x88, 0x83};
+  EmitBytes(emitter, kLoadByte, sizeof(kLoadByte));
+  EmitDword(emitter, src);
+  EmitBytes(emitter, kStoreByte, sizeof(kStoreByte));
+  EmitDword(emitter, dest);
+}
+
+// movzx eax, word [rbx + src]
+// mov word [rbx + dest], ax
+// shl eax, 4
+// mov dword [rbx + base], eax
+static void EmitMoveSegmentRegister(
+    JITEmitter* emitter, RegisterIndex dest, uint32_t src) {
+  static const uint8_t kShiftLeft4[] = {0xC1, 0xE0, 0x04};
+  static const uint8_t kStoreDword[] = {0x89, 0x83};
+  EmitMoveWord(emitter, GetRegisterDisplacement(dest, 0), src);
+  EmitBytes(emitter, kShiftLeft4, sizeof(kShiftLeft4));
+  EmitBytes(emitter, kStoreDword, sizeof(kStoreDword));
+  EmitDword(
+      emitter, (uint32_t)(offsetof(CPUState, segment_bases) +
+                          (dest - kES) * sizeof(uint32_t)));
+}
+
+// Emit a call to the interpreter for an instruction, returning from the block
+// with the number of instructions executed if the interpreter requests it.
+//
+// mov rdi, rbx
+// mov rsi, entry
+// mov rax, handler
+// call rax
+// test al, al
+// jz continue
+// <return num_instructions>
+// continue:
+static void EmitInterpreterCall(
+    JITEmitter* emitter, const CPUBlockInstruction* entry,
+    JITInstructionHandler handler, uint32_t num_instructions) {
+  static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+  static const uint8_t kCallRAXAndTest[] = {0xFF, 0xD0, 0x84, 0xC0};
+  enum {
+    // Size of the code emitted by EmitReturn.
+    kReturnSize = 7,
+  };
+  EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xBE);
+  EmitQword(emitter, (uint64_t)(uintptr_t)entry);
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(emitter, (uint64_t)(uintptr_t)handler);
+  EmitBytes(emitter, kCallRAXAndTest, sizeof(kCallRAXAndTest));
+  EmitByte(emitter, 0x74);
+  EmitByte(emitter, kReturnSize);
+  EmitReturn(emitter, num_instructions);
+}
+
+// Kind of an ALU instruction that can be compiled to native code. The first
+// 8 match the REG field of Group 1 instructions and bits 3-5 of the opcode of
+// the other forms of those instructions.
+typedef enum JITALUOp {
+  kJITALUAdd = 0,
+  kJITALUOr,
+  // ADC and SBB depend on CF, and are not compiled to native code.
+  kJITALUAddWithCarry,
+  kJITALUSubWithBorrow,
+  kJITALUAnd,
+  kJITALUSub,
+  kJITALUXor,
+  kJITALUCmp,
+  kJITALUTest,
+  kJITALUInc,
+  kJITALUDec,
+} JITALUOp;
+
+// An ALU instruction on registers, or on a register and an immediate, that can
+// be compiled to native code.
+typedef struct JITALUInstruction {
+  // Kind of the instruction.
+  JITALUOp op;
+  // Data width of the instruction.
+  Width width;
+  // Displacement of the destination register from RBX.
+  uint32_t dest;
+  // Whether the source is an immediate instead of a register.
+  bool has_immediate_src;
+  // Displacement of the source register from RBX, or the immediate value.
+  uint32_t src;
+} JITALUInstruction;
+
+// Returns the displacement of a register encoded in a REG or R/M field.
+static inline uint32_t GetRegisterOperandDisplacement(
+    Width width, uint8_t reg_or_rm) {
+  return width == kByte
+             ? GetByteRegisterDisplacement(reg_or_rm)
+             : GetRegisterDisplacement((RegisterIndex)reg_or_rm, 0);
+}
+
+// Returns the immediate value of an instruction as the interpreter passes it
+// to the ALU, which is zero-extended from the instruction's width.
+static inline uint32_t GetImmediateOperand(
+    const Instruction* instruction, Width width) {
+  return width == kByte ? instruction->immediate[0]
+                        : (uint32_t)(instruction->immediate[0] |
+                                     (instruction->immediate[1] << 8));
+}
+
+// Decode an ALU instruction that can be compiled to native code. Returns false
+// if the instruction is not supported.
+static bool DecodeALUInstruction(
+    const Instruction* instruction, JITALUInstruction* alu) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  const bool is_register_mod_rm =
+      instruction->has_mod_rm && mod_rm->mod == kModRMModRegister;
+  // INC AX/CX/DX/BX/SP/BP/SI/DI and DEC AX/CX/DX/BX/SP/BP/SI/DI
+  if (opcode >= 0x40 && opcode <= 0x4F) {
+    alu->op = opcode < 0x48 ? kJITALUInc : kJITALUDec;
+    alu->width = kWord;
+    alu->dest = GetRegisterDisplacement((RegisterIndex)(opcode & 0x07), 0);
+    alu->has_immediate_src = true;
+    alu->src = 1;
+    return true;
+  }
+  // ADD, OR, AND, SUB, XOR and CMP in the forms op r/m, reg; op reg, r/m; and
+  // op AL/AX, imm.
+  if (opcode < 0x40 && (opcode & 0x07) <= 5) {
+    alu->op = (JITALUOp)(opcode >> 3);
+    alu->width = (opcode & 0x01) ? kWord : kByte;
+    switch (opcode & 0x07) {
+      case 0:
+      case 1:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        break;
+      case 2:
+      case 3:
+        if (!is_register_mod_rm) {
+          return false;
+        }
+        alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+        alu->has_immediate_src = false;
+        alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+        break;
+      default:
+        alu->dest = GetRegisterDisplacement(kAX, 0);
+        alu->has_immediate_src = true;
+        alu->src = GetImmediateOperand(instruction, alu->width);
+        break;
+    }
+    return alu->op != kJITALUAddWithCarry && alu->op != kJITALUSubWithBorrow;
+  }
+  switch (opcode) {
+    // Group 1 r/m8, imm8; r/m16, imm16; and r/m16, sign-extended imm8
+    case 0x80:
+    case 0x81:
+    case 0x83:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = (JITALUOp)mod_rm->reg;
+      alu->width = opcode == 0x80 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = true;
+      alu->src = opcode == 0x83
+                     ? (uint16_t)(int16_t)(int8_t)instruction->immediate[0]
+                     : GetImmediateOperand(instruction, alu->width);
+      return alu->op != kJITALUAddWithCarry &&
+             alu->op != kJITALUSubWithBorrow;
+    // TEST r/m8, r8 and TEST r/m16, r16
+    case 0x84:
+    case 0x85:
+      if (!is_register_mod_rm) {
+        return false;
+      }
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0x84 ? kByte : kWord;
+      alu->dest = GetRegisterOperandDisplacement(alu->width, mod_rm->rm);
+      alu->has_immediate_src = false;
+      alu->src = GetRegisterOperandDisplacement(alu->width, mod_rm->reg);
+      return true;
+    // TEST AL, imm8 and TEST AX, imm16
+    case 0xA8:
+    case 0xA9:
+      alu->op = kJITALUTest;
+      alu->width = opcode == 0xA8 ? kByte : kWord;
+      alu->dest = GetRegisterDisplacement(kAX, 0);
+      alu->has_immediate_src = true;
+      alu->src = GetImmediateOperand(instruction, alu->width);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the offset of a field of CPUState.lazy_flags within CPUState.
+#define YAX86_LAZY_FLAGS_DISPLACEMENT(field) \
+  ((uint32_t)(offsetof(CPUState, lazy_flags) + offsetof(CPULazyFlags, field)))
+
+// Emit native code for an ALU instruction. The result is written to the
+// destination register, and the operation is recorded in CPUState.lazy_flags
+// exactly as the interpreter records it. If set_host_flags is true, the code
+// ends by setting the host's flags as the instruction sets the 8086's
+// CF, PF, ZF, SF and OF, for a conditional jump that follows. INC and DEC
+// leave the host's CF undefined.
+static void EmitALUInstruction(
+    JITEmitter* emitter, const JITALUInstruction* alu, bool set_host_flags) {
+  // Lazy flags operation and host instruction to compute the result in EDX
+  // from EAX and ECX, indexed by JITALUOp.
+  static const uint8_t kLazyFlagsOps[] = {
+      kLazyFlagsAdd,     kLazyFlagsBoolean, kLazyFlagsAdd,
+      kLazyFlagsSub,     kLazyFlagsBoolean, kLazyFlagsSub,
+      kLazyFlagsBoolean, kLazyFlagsSub,     kLazyFlagsBoolean,
+      kLazyFlagsInc,     kLazyFlagsDec,
+  };
+  static const uint8_t kComputeResult[][2] = {
+      {0x01, 0xCA},  // add edx, ecx
+      {0x09, 0xCA},  // or edx, ecx
+      {0x01, 0xCA},  // ADC (unused)
+      {0x29, 0xCA},  // SBB (unused)
+      {0x21, 0xCA},  // and edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x31, 0xCA},  // xor edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+      {0x21, 0xCA},  // and edx, ecx
+      {0x01, 0xCA},  // add edx, ecx
+      {0x29, 0xCA},  // sub edx, ecx
+  };
+  const uint8_t lazy_flags_op = kLazyFlagsOps[alu->op];
+  const bool is_boolean = lazy_flags_op == kLazyFlagsBoolean;
+  const uint16_t produced = kLazyFlagsProduced[lazy_flags_op];
+
+  // Evaluate pending flags from the previous operation that this one does not
+  // produce, as SetLazyFlags() does.
+  //
+  // test word [rbx + pending], kArithmeticFlags & ~produced
+  // jz skip
+  // mov rdi, rbx
+  // mov esi, produced
+  // mov rax, DiscardLazyFlags
+  // call rax
+  // skip:
+  if (produced != kArithmeticFlags) {
+    static const uint8_t kTestPendingWord[] = {0x66, 0xF7, 0x83};
+    static const uint8_t kMoveCPUToRDI[] = {0x48, 0x89, 0xDF};
+    static const uint8_t kCallRAX[] = {0xFF, 0xD0};
+    enum {
+      // Size of the code skipped if no flags need to be evaluated.
+      kDiscardCallSize = 20,
+    };
+    EmitBytes(emitter, kTestPendingWord, sizeof(kTestPendingWord));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending));
+    EmitWord(emitter, kArithmeticFlags & ~produced);
+    EmitByte(emitter, 0x74);
+    EmitByte(emitter, kDiscardCallSize);
+    EmitBytes(emitter, kMoveCPUToRDI, sizeof(kMoveCPUToRDI));
+    EmitByte(emitter, 0xBE);
+    EmitDword(emitter, produced);
+    EmitByte(emitter, 0x48);
+    EmitByte(emitter, 0xB8);
+    EmitQword(emitter, (uint64_t)(uintptr_t)DiscardLazyFlags);
+    EmitBytes(emitter, kCallRAX, sizeof(kCallRAX));
+  }
+
+  // movzx eax, byte/word [rbx + dest]
+  EmitByte(emitter, 0x0F);
+  EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+  EmitByte(emitter, 0x83);
+  EmitDword(emitter, alu->dest);
+  if (alu->has_immediate_src) {
+    // mov ecx, src
+    EmitByte(emitter, 0xB9);
+    EmitDword(emitter, alu->src);
+  } else {
+    // movzx ecx, byte/word [rbx + src]
+    EmitByte(emitter, 0x0F);
+    EmitByte(emitter, alu->width == kByte ? 0xB6 : 0xB7);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, alu->src);
+  }
+  // mov edx, eax
+  // <op> edx, ecx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0xC2);
+  EmitBytes(emitter, kComputeResult[alu->op], sizeof(kComputeResult[0]));
+
+  // Record the operation in CPUState.lazy_flags. Boolean operations record 0
+  // for both operands.
+  EmitMoveImmediateWord(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(pending), produced);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op), lazy_flags_op);
+  EmitMoveImmediateByte(
+      emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(width), (uint8_t)alu->width);
+  EmitMoveImmediateByte(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(did_carry), 0);
+  if (is_boolean) {
+    // mov dword [rbx + op1], 0
+    // mov dword [rbx + op2], 0
+    static const uint8_t kMoveImmediateDword[] = {0xC7, 0x83};
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitDword(emitter, 0);
+    EmitBytes(emitter, kMoveImmediateDword, sizeof(kMoveImmediateDword));
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+    EmitDword(emitter, 0);
+  } else {
+    // mov [rbx + op1], eax
+    // mov [rbx + op2], ecx
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x83);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op1));
+    EmitByte(emitter, 0x89);
+    EmitByte(emitter, 0x8B);
+    EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(op2));
+  }
+  // mov [rbx + result], edx
+  EmitByte(emitter, 0x89);
+  EmitByte(emitter, 0x93);
+  EmitDword(emitter, YAX86_LAZY_FLAGS_DISPLACEMENT(result));
+
+  // mov [rbx + dest], dl/dx
+  if (alu->op != kJITALUCmp && alu->op != kJITALUTest) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    EmitByte(emitter, alu->width == kByte ? 0x88 : 0x89);
+    EmitByte(emitter, 0x93);
+    EmitDword(emitter, alu->dest);
+  }
+
+  // add al/ax, cl/cx for additions, cmp al/ax, cl/cx for subtractions, or
+  // test dl/dx, dl/dx for boolean operations.
+  if (set_host_flags) {
+    if (alu->width == kWord) {
+      EmitByte(emitter, 0x66);
+    }
+    if (is_boolean) {
+      EmitByte(emitter, alu->width == kByte ? 0x84 : 0x85);
+      EmitByte(emitter, 0xD2);
+    } else if (
+        lazy_flags_op == kLazyFlagsAdd || lazy_flags_op == kLazyFlagsInc) {
+      EmitByte(emitter, alu->width == kByte ? 0x00 : 0x01);
+      EmitByte(emitter, 0xC8);
+    } else {
+      EmitByte(emitter, alu->width == kByte ? 0x38 : 0x39);
+      EmitByte(emitter, 0xC8);
+    }
+  }
+}
+
+#undef YAX86_LAZY_FLAGS_DISPLACEMENT
+
+// Returns whether a conditional jump can be compiled to native code when it
+// follows an ALU instruction compiled to native code, using the host's flags.
+static bool CanEmitConditionalJump(
+    const Instruction* instruction, const JITALUInstruction* alu) {
+  enum {
+    // Opcodes of conditional jumps. JO is the first and JG the last.
+    kOpcodeJO = 0x70,
+    kOpcodeJB = 0x72,
+    kOpcodeJAE = 0x73,
+    kOpcodeJBE = 0x76,
+    kOpcodeJA = 0x77,
+    kOpcodeJG = 0x7F,
+  };
+  const uint8_t opcode = instruction->opcode;
+  if (instruction->prefix_size > 0 || opcode < kOpcodeJO ||
+      opcode > kOpcodeJG) {
+    return false;
+  }
+  // INC and DEC do not produce CF, so JB, JAE, JBE and JA need the 8086's CF.
+  const bool reads_cf = opcode == kOpcodeJB || opcode == kOpcodeJAE ||
+                        opcode == kOpcodeJBE || opcode == kOpcodeJA;
+  return !reads_cf || (alu->op != kJITALUInc && alu->op != kJITALUDec);
+}
+
+// Emit native code for a conditional jump that ends a block, given the host's
+// flags set by EmitALUInstruction(). ip_delta is the distance from IP in
+// CPUState to the instruction after the jump. If the jump is taken, its extra
+// clock cycles are added to the JIT's current_block_variable_clock_cycles.
+//
+// j<cc> taken
+// add word [rbx + IP], ip_delta
+// jmp done
+// taken:
+// add word [rbx + IP], ip_delta + rel8
+// mov rax, &jit->current_block_variable_clock_cycles
+// add dword [rax], taken_clock_cycles
+// done:
+static void EmitConditionalJump(
+    JITEmitter* emitter, CPUJIT* jit, const Instruction* instruction,
+    uint16_t ip_delta) {
+  static const uint8_t kAddDwordToRAX[] = {0x81, 0x00};
+  enum {
+    // Size of the code emitted by EmitAddIP.
+    kAddIPSize = 9,
+    // Size of the jmp to done.
+    kJumpSize = 2,
+    // Size of the code that counts the taken jump's clock cycles.
+    kAddClockCyclesSize = 16,
+  };
+  // Conditional jumps on the host have the same condition codes as on the
+  // 8086.
+  EmitByte(emitter, instruction->opcode);
+  EmitByte(emitter, kAddIPSize + kJumpSize);
+  EmitAddIP(emitter, ip_delta);
+  EmitByte(emitter, 0xEB);
+  EmitByte(emitter, kAddIPSize + kAddClockCyclesSize);
+  EmitAddIP(emitter, (uint16_t)(ip_delta + (int8_t)instruction->immediate[0]));
+  EmitByte(emitter, 0x48);
+  EmitByte(emitter, 0xB8);
+  EmitQword(
+      emitter, (uint64_t)(uintptr_t)&jit->current_block_variable_clock_cycles);
+  EmitBytes(emitter, kAddDwordToRAX, sizeof(kAddDwordToRAX));
+  EmitDword(emitter, GetBranchTakenVariableClockCycles(instruction));
+}
+
+// Emit native code for an instruction that only moves data between registers
+// or from an immediate to a register. Such instructions cannot fault, touch
+// memory or affect flags. Returns false if the instruction is not supported.
+static bool EmitNativeInstruction(
+    JITEmitter* emitter, const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M MOD field for register operands.
+    kModRMModRegister = 3,
+    // Value of the ModR/M REG field for CS.
+    kModRMRegCS = kCS - kES,
+  };
+  if (instruction->prefix_size > 0) {
+    return false;
+  }
+  const uint8_t opcode = instruction->opcode;
+  const ModRM* mod_rm = &instruction->mod_rm;
+  // NOP
+  if (opcode == 0x90) {
+    return true;
+  }
+  // MOV AL/CL/DL/BL/AH/CH/DH/BH, imm8
+  if (opcode >= 0xB0 && opcode <= 0xB7) {
+    EmitMoveImmediateByte(
+        emitter, GetByteRegisterDisplacement(opcode - 0xB0),
+        instruction->immediate[0]);
+    return true;
+  }
+  // MOV AX/CX/DX/BX/SP/BP/SI/DI, imm16
+  if (opcode >= 0xB8 && opcode <= 0xBF) {
+    EmitMoveImmediateWord(
+        emitter, GetRegisterDisplacement((RegisterIndex)(opcode - 0xB8), 0),
+        (uint16_t)(instruction->immediate[0] |
+                   (instruction->immediate[1] << 8)));
+    return true;
+  }
+  if (!instruction->has_mod_rm || mod_rm->mod != kModRMModRegister) {
+    return false;
+  }
+  switch (opcode) {
+    // MOV r/m8, r8
+    case 0x88:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->rm),
+          GetByteRegisterDisplacement(mod_rm->reg));
+      return true;
+    // MOV r8, r/m8
+    case 0x8A:
+      EmitMoveByte(
+          emitter, GetByteRegisterDisplacement(mod_rm->reg),
+          GetByteRegisterDisplacement(mod_rm->rm));
+      return true;
+    // MOV r/m16, r16
+    case 0x89:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0));
+      return true;
+    // MOV r16, r/m16
+    case 0x8B:
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->reg, 0),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    // MOV r/m16, sreg
+    case 0x8C:
+      if (mod_rm->reg >= kNumSegmentRegisters) {
+        return false;
+      }
+      EmitMoveWord(
+          emitter, GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0),
+          GetRegisterDisplacement((RegisterIndex)(kES + mod_rm->reg), 0));
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      if (mod_rm->reg >= kNumSegmentRegisters || mod_rm->reg == kModRMRegCS) {
+        return false;
+      }
+      EmitMoveSegmentRegister(
+          emitter, (RegisterIndex)(kES + mod_rm->reg),
+          GetRegisterDisplacement((RegisterIndex)mod_rm->rm, 0));
+      return true;
+    default:
+      return false;
+  }
+}
+
+YAX86_PRIVATE bool IsBlockCompiled(const CPUJIT* jit, const CPUBlock* block) {
+  return block->native_code && block->jit_epoch == jit->epoch;
+}
+
+YAX86_PRIVATE bool CompileBlock(
+    CPUJIT* jit, CPUBlock* block, JITInstructionHandler handler) {
+  if (jit->code_size < kCPUJITMaxBlockCodeSize) {
+    return false;
+  }
+  // Flush the code buffer if it is full. This invalidates the native code of
+  // all blocks compiled so far.
+  if (jit->code_size - jit->code_used < kCPUJITMaxBlockCodeSize) {
+    jit->code_used = 0;
+    ++jit->epoch;
+    ++jit->num_flushes;
+  }
+
+  JITEmitter emitter = {
+      .start = jit->code + jit->code_used,
+      .next = jit->code + jit->code_used,
+  };
+  EmitPrologue(&emitter);
+  // IP is only updated in CPUState before calling into the interpreter and at
+  // the end of the block.
+  uint16_t pending_ip_delta = 0;
+  for (uint8_t i = 0; i < block->num_instructions; ++i) {
+    const CPUBlockInstruction* entry = &block->instructions[i];
+    JITALUInstruction alu;
+    if (DecodeALUInstruction(&entry->instruction, &alu)) {
+      // A conditional jump that ends the block right after the ALU
+      // instruction is compiled together with it, using the host's flags.
+      const CPUBlockInstruction* jump =
+          i + 2 == block->num_instructions ? entry + 1 : NULL;
+      if (jump && !CanEmitConditionalJump(&jump->instruction, &alu)) {
+        jump = NULL;
+      }
+      EmitALUInstruction(&emitter, &alu, jump != NULL);
+      pending_ip_delta += entry->instruction.size;
+      if (jump) {
+        EmitConditionalJump(
+            &emitter, jit, &jump->instruction,
+            pending_ip_delta + jump->instruction.size);
+        pending_ip_delta = 0;
+        break;
+      }
+      continue;
+    }
+    if (EmitNativeInstruction(&emitter, &entry->instruction)) {
+      pending_ip_delta += entry->instruction.size;
+      continue;
+    }
+    if (pending_ip_delta) {
+      EmitAddIP(&emitter, pending_ip_delta);
+      pending_ip_delta = 0;
+    }
+    EmitInterpreterCall(&emitter, entry, handler, i + 1);
+  }
+  if (pending_ip_delta) {
+    EmitAddIP(&emitter, pending_ip_delta);
+  }
+  EmitReturn(&emitter, block->num_instructions);
+
+  block->native_code = emitter.start;
+  block->jit_epoch = jit->epoch;
+  jit->code_used += (uint32_t)(emitter.next - emitter.start);
+  ++jit->num_compiled_blocks;
+  return true;
+}
+
+// Signature of a compiled block.
+typedef uint32_t (*JITCompiledBlockFn)(CPUState* cpu);
+
+YAX86_PRIVATE uint32_t
+RunCompiledBlock(CPUJIT* jit, CPUState* cpu, CPUBlock* block) {
+  // ISO C does not allow casting a data pointer to a function pointer, so
+  // convert through a union instead.
+  union {
+    uint8_t* code;
+    JITCompiledBlockFn fn;
+  } native_code = {.code = block->native_code};
+  jit->current_block = block;
+  jit->status = kExecuteSuccess;
+  jit->stopped = false;
+  ++jit->num_native_executions;
+  return native_code.fn(cpu);
+}
+
+#endif  // YAX86_CPU_HAS_JIT
+
+
+// ==============================================================================
+// src/cpu/jit.c end
 // ==============================================================================
 
 // ==============================================================================
@@ -6180,9 +9911,14 @@ YAX86_PRIVATE OpcodeMetadata opcode_table[256] = {
 #line 1 "./src/cpu/cpu.c"
 #ifndef YAX86_IMPLEMENTATION
 #include "../util/common.h"
+#include "block_cache.h"
+#include "fusion.h"
+#include "instruction_cache.h"
 #include "instructions.h"
+#include "jit.h"
 #include "operands.h"
 #include "public.h"
+#include "timing.h"
 #include "types.h"
 #endif  // YAX86_IMPLEMENTATION
 
@@ -6198,6 +9934,14 @@ void CPUInit(CPUState* cpu, CPUConfig* config) {
   cpu->config = config;
 }
 
+// Derive the segment base addresses from the segment registers, which the host
+// may have written directly.
+static inline void SyncSegmentBases(CPUState* cpu) {
+  for (int i = kES; i <= kDS; ++i) {
+    CPUSetSegmentRegister(cpu, (RegisterIndex)i, cpu->registers[i]);
+  }
+}
+
 // ============================================================================
 // Instruction decoding
 // ============================================================================
@@ -6257,12 +10001,12 @@ static uint8_t GetImmediateSize(const OpcodeMetadata* metadata, uint8_t reg) {
   }
 }
 
-CPUFetchNextInstructionStatus CPUFetchNextInstruction(
-    CPUState* cpu, Instruction* dest_instruction) {
+// Decode the instruction at CS:original_ip from memory.
+static CPUFetchNextInstructionStatus DecodeInstruction(
+    CPUState* cpu, uint16_t original_ip, Instruction* dest_instruction) {
   Instruction instruction = {0};
   uint8_t current_byte;
-  const uint16_t original_ip = cpu->registers[kIP];
-  uint16_t ip = cpu->registers[kIP];
+  uint16_t ip = original_ip;
 
   // Prefix
   current_byte = ReadNextInstructionByte(cpu, &ip);
@@ -6302,60 +10046,137 @@ CPUFetchNextInstructionStatus CPUFetchNextInstruction(
   }
 
   instruction.size = ip - original_ip;
+  ResolveMemoryOperand(&instruction);
 
   *dest_instruction = instruction;
   return kFetchSuccess;
 }
 
+// Fetch the next instruction from CS:IP along with its opcode metadata, using
+// the instruction cache if available.
+static CPUFetchNextInstructionStatus FetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction,
+    const OpcodeMetadata** dest_metadata) {
+  CPUInstructionCache* cache = cpu->config->instruction_cache;
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  if (cache) {
+    const CPUInstructionCacheEntry* entry =
+        LookupInstructionCache(cache, address);
+    if (entry) {
+      *dest_instruction = entry->instruction;
+      *dest_metadata = entry->metadata;
+      return kFetchSuccess;
+    }
+  }
+
+  CPUFetchNextInstructionStatus status =
+      DecodeInstruction(cpu, ip, dest_instruction);
+  if (status != kFetchSuccess) {
+    return status;
+  }
+  *dest_metadata = &opcode_table[dest_instruction->opcode];
+  if (cache) {
+    FillInstructionCache(cache, address, ip, dest_instruction, *dest_metadata);
+  }
+  return kFetchSuccess;
+}
+
+CPUFetchNextInstructionStatus CPUFetchNextInstruction(
+    CPUState* cpu, Instruction* dest_instruction) {
+  const OpcodeMetadata* metadata;
+  SyncSegmentBases(cpu);
+  return FetchNextInstruction(cpu, dest_instruction, &metadata);
+}
+
 // ============================================================================
 // Execution
 // ============================================================================
 
-ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+// Returns the handler for a decoded instruction, preferring a handler
+// specialized for the addressing mode of its ModR/M byte if there is one.
+static inline OpcodeHandler GetOpcodeHandler(
+    const OpcodeMetadata* metadata, const Instruction* instruction) {
+  OpcodeHandler handler =
+      metadata->specialized_handlers
+          [instruction->mod_rm.mod == 3 ? kModRMClassRegister
+                                        : kModRMClassMemory];
+  return handler ? handler : metadata->handler;
+}
+
+// Run the handler for a decoded instruction, without any callbacks.
+static inline ExecuteStatus RunInstructionHandler(
+    CPUState* cpu, const Instruction* instruction,
+    const OpcodeMetadata* metadata) {
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = instruction,
+      .metadata = metadata,
+  };
+  return GetOpcodeHandler(metadata, instruction)(&context);
+}
+
+// Execute a single instruction. If metadata is provided, the instruction is
+// known to have been produced by the decoder and is not validated again.
+static ExecuteStatus ExecuteInstruction(
+    CPUState* cpu, Instruction* instruction, const OpcodeMetadata* metadata) {
   ExecuteStatus status;
 
   // Run the on_before_execute_instruction callback if provided.
-  if (cpu->config->on_before_execute_instruction &&
-      (status = cpu->config->on_before_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_before_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_before_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
+    // The callback may have modified the instruction.
+    metadata = NULL;
   }
 
-  const OpcodeMetadata* metadata = &opcode_table[instruction->opcode];
+  if (!metadata) {
+    metadata = &opcode_table[instruction->opcode];
+    // Check encoded instruction against expected instruction format.
+    if (metadata->handler &&
+        (instruction->has_mod_rm != metadata->has_modrm ||
+         instruction->immediate_size !=
+             (metadata->has_modrm
+                  ? GetImmediateSize(metadata, instruction->mod_rm.reg)
+                  : metadata->immediate_size))) {
+      return kExecuteInvalidInstruction;
+    }
+    ResolveMemoryOperand(instruction);
+  }
   if (!metadata->handler) {
     return kExecuteInvalidOpcode;
   }
 
-  // Check encoded instruction against expected instruction format.
-  if (instruction->has_mod_rm != metadata->has_modrm) {
-    return kExecuteInvalidInstruction;
-  }
-  if (instruction->immediate_size !=
-      (metadata->has_modrm ? GetImmediateSize(metadata, instruction->mod_rm.reg)
-                           : metadata->immediate_size)) {
-    return kExecuteInvalidInstruction;
-  }
-
   // Run the instruction handler.
-  InstructionContext context = {
-      .cpu = cpu,
-      .instruction = instruction,
-      .metadata = metadata,
-  };
-  if ((status = metadata->handler(&context)) != kExecuteSuccess) {
+  if ((status = RunInstructionHandler(cpu, instruction, metadata)) !=
+      kExecuteSuccess) {
     return status;
   }
 
   // Run the on_after_execute_instruction callback if provided.
-  if (cpu->config->on_after_execute_instruction &&
-      (status = cpu->config->on_after_execute_instruction(cpu, instruction)) !=
-          kExecuteSuccess) {
-    return status;
+  if (cpu->config->on_after_execute_instruction) {
+    CPUMaterializeFlags(cpu);
+    status = cpu->config->on_after_execute_instruction(cpu, instruction);
+    SyncSegmentBases(cpu);
+    if (status != kExecuteSuccess) {
+      return status;
+    }
   }
 
   return kExecuteSuccess;
 }
 
+ExecuteStatus CPUExecuteInstruction(CPUState* cpu, Instruction* instruction) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = ExecuteInstruction(cpu, instruction, NULL);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
 // Process pending interrupt, if any.
 static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   if (!cpu->has_pending_interrupt) {
@@ -6366,7 +10187,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
 
   // Prepare for interrupt processing.
   cpu->is_halted = false;
-  Push(cpu, WordValue(cpu->flags));
+  Push(cpu, WordValue(CPUGetFlags(cpu)));
   CPUSetFlag(cpu, kIF, false);
   CPUSetFlag(cpu, kTF, false);
   Push(cpu, WordValue(cpu->registers[kCS]));
@@ -6379,6 +10200,7 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       cpu->config->handle_interrupt
           ? cpu->config->handle_interrupt(cpu, interrupt_number)
           : kExecuteUnhandledInterrupt;
+  SyncSegmentBases(cpu);
 
   switch (interrupt_handler_status) {
     case kExecuteSuccess: {
@@ -6392,7 +10214,8 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
       // Table.
       uint16_t ivt_entry_offset = interrupt_number << 2;
       cpu->registers[kIP] = ReadRawMemoryWord(cpu, ivt_entry_offset);
-      cpu->registers[kCS] = ReadRawMemoryWord(cpu, ivt_entry_offset + 2);
+      CPUSetSegmentRegister(
+          cpu, kCS, ReadRawMemoryWord(cpu, ivt_entry_offset + 2));
       return kExecuteSuccess;
     }
     default:
@@ -6401,43 +10224,818 @@ static ExecuteStatus ExecutePendingInterrupt(CPUState* cpu) {
   }
 }
 
-ExecuteStatus CPUTick(CPUState* cpu) {
+// Handle pending interrupts and single-step execution at the end of an
+// instruction cycle.
+static ExecuteStatus FinishTick(CPUState* cpu) {
+  ExecuteStatus status;
+
+  // Step 3: Handle pending interrupts.
+  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+    return status;
+  }
+
+  // Step 4: If trap flag is set, handle single-step execution.
+  if (CPUGetFlag(cpu, kTF)) {
+    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
+    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+      return status;
+    }
+  }
+
+  return kExecuteSuccess;
+}
+
+// Count instruction cycles spent halted, each of which takes one clock cycle.
+static inline void CountHaltedCycles(CPUState* cpu, uint32_t num_cycles) {
+  cpu->cycles += num_cycles;
+  cpu->idle_cycles += num_cycles;
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += num_cycles;
+  }
+}
+
+// Count the clock cycles taken by an instruction that was just executed, on
+// top of the instruction cycle already counted, given IP after the instruction
+// was fetched and CX before it was executed. Returns the clock cycles taken.
+static inline uint32_t CountInstructionClockCycles(
+    CPUState* cpu, const Instruction* instruction, uint16_t next_ip,
+    uint16_t cx) {
+  const uint32_t clock_cycles =
+      GetInstructionClockCycles(cpu, instruction, next_ip, cx);
+  cpu->cycles += clock_cycles - 1;
+  cpu->clock_cycles += clock_cycles;
+  return clock_cycles;
+}
+
+// Run a single instruction cycle, leaving arithmetic flags pending.
+static ExecuteStatus Tick(CPUState* cpu) {
   ExecuteStatus status;
 
   // Execute next CPU instruction if not halted.
   if (!cpu->is_halted) {
+    ++cpu->cycles;
     // Step 1: Fetch the next instruction, and increment IP.
     Instruction instruction;
+    const OpcodeMetadata* metadata;
     CPUFetchNextInstructionStatus fetch_status =
-        CPUFetchNextInstruction(cpu, &instruction);
+        FetchNextInstruction(cpu, &instruction, &metadata);
     if (fetch_status != kFetchSuccess) {
       return kExecuteInvalidInstruction;
     }
     cpu->registers[kIP] += instruction.size;
+    const uint16_t next_ip = cpu->registers[kIP];
+    const uint16_t cx = cpu->registers[kCX];
+
+    // Step 2: Execute the instruction.
+    status = ExecuteInstruction(cpu, &instruction, metadata);
+    if (status != kExecuteSuccess && status != kExecuteHalt) {
+      return status;
+    }
+    if (cpu->config->use_clock_cycles) {
+      CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+    }
+  } else {
+    CountHaltedCycles(cpu, 1);
+  }
+
+  return FinishTick(cpu);
+}
+
+ExecuteStatus CPUTick(CPUState* cpu) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Tick(cpu);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Block execution
+// ============================================================================
+
+// Returns whether the string instruction has a REP or REPNZ prefix.
+static bool HasRepetitionPrefix(const Instruction* instruction) {
+  for (uint8_t i = 0; i < instruction->prefix_size; ++i) {
+    if (instruction->prefix[i] == kPrefixREP ||
+        instruction->prefix[i] == kPrefixREPNZ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns whether an instruction ends a block. This includes all control
+// transfers, REP string instructions, and instructions that may change CS,
+// halt the CPU or enable interrupts.
+static bool IsBlockTerminator(const Instruction* instruction) {
+  enum {
+    // Value of the ModR/M REG field for MOV sreg, r/m16 targeting CS.
+    kModRMRegCS = kCS - kES,
+  };
+  switch (instruction->opcode) {
+    // Jcc rel8
+    case 0x70:
+    case 0x71:
+    case 0x72:
+    case 0x73:
+    case 0x74:
+    case 0x75:
+    case 0x76:
+    case 0x77:
+    case 0x78:
+    case 0x79:
+    case 0x7A:
+    case 0x7B:
+    case 0x7C:
+    case 0x7D:
+    case 0x7E:
+    case 0x7F:
+    // CALL ptr16:16
+    case 0x9A:
+    // POPF
+    case 0x9D:
+    // RET imm16, RET, RETF imm16, RETF
+    case 0xC2:
+    case 0xC3:
+    case 0xCA:
+    case 0xCB:
+    // INT 3, INT imm8, INTO, IRET
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+    // LOOPNZ, LOOPZ, LOOP, JCXZ
+    case 0xE0:
+    case 0xE1:
+    case 0xE2:
+    case 0xE3:
+    // CALL rel16, JMP rel16, JMP ptr16:16, JMP rel8
+    case 0xE8:
+    case 0xE9:
+    case 0xEA:
+    case 0xEB:
+    // HLT
+    case 0xF4:
+    // STI
+    case 0xFB:
+    // POP CS
+    case 0x0F:
+      return true;
+    // MOV sreg, r/m16
+    case 0x8E:
+      return instruction->mod_rm.reg == kModRMRegCS;
+    // Group 5 - CALL and JMP through r/m16 or m16:16
+    case 0xFF:
+      return instruction->mod_rm.reg >= 2 && instruction->mod_rm.reg <= 5;
+    // MOVS, CMPS, STOS, LODS, SCAS
+    case 0xA4:
+    case 0xA5:
+    case 0xA6:
+    case 0xA7:
+    case 0xAA:
+    case 0xAB:
+    case 0xAC:
+    case 0xAD:
+    case 0xAE:
+    case 0xAF:
+      return HasRepetitionPrefix(instruction);
+    default:
+      return false;
+  }
+}
+
+// Translate the block starting at CS:IP. Returns NULL if not even the first
+// instruction could be added to a block, in which case the caller should fall
+// back to CPUTick().
+static CPUBlock* TranslateBlock(
+    CPUState* cpu, CPUBlockCache* cache, uint32_t address) {
+  uint16_t ip = cpu->registers[kIP];
+  uint32_t page_offset = address % kCPUInstructionCachePageSize;
+  CPUBlock* block = AllocateBlock(cache, address);
+  while (block->num_instructions < kCPUMaxBlockInstructions) {
+    CPUBlockInstruction* entry =
+        &block->instructions[block->num_instructions];
+    if (DecodeInstruction(cpu, ip, &entry->instruction) != kFetchSuccess) {
+      break;
+    }
+    uint8_t size = entry->instruction.size;
+    // Stop before instructions that wrap around the end of the code segment or
+    // straddle two pages, as in the instruction cache.
+    if ((uint32_t)ip + size > 0x10000 ||
+        page_offset + block->size + size > kCPUInstructionCachePageSize) {
+      break;
+    }
+    entry->metadata = &opcode_table[entry->instruction.opcode];
+    entry->has_variable_clock_cycles =
+        HasVariableClockCycles(&entry->instruction);
+    entry->clock_cycles =
+        (uint16_t)GetInstructionBaseClockCycles(&entry->instruction);
+    entry->block_clock_cycles =
+        block->num_instructions
+            ? entry[-1].block_clock_cycles + entry[-1].clock_cycles
+            : 0;
+    ++block->num_instructions;
+    block->size += size;
+    ip += size;
+    if (!entry->metadata->handler || IsBlockTerminator(&entry->instruction)) {
+      break;
+    }
+  }
+  if (block->num_instructions == 0) {
+    return NULL;
+  }
+  FuseBlockInstructions(block);
+  CommitBlock(cache, block);
+  return block;
+}
+
+// Returns the block starting at CS:IP, translating it if needed. If previous
+// is not NULL, the block is looked up through the previous block's successor
+// links first.
+static CPUBlock* GetBlock(
+    CPUState* cpu, CPUBlockCache* cache, CPUBlock* previous) {
+  const uint16_t ip = cpu->registers[kIP];
+  const uint32_t address = CPUGetSegmentBase(cpu, kCS) + ip;
+  CPUBlock* block =
+      previous ? LookupSuccessorBlock(cache, previous, address, ip)
+               : LookupBlockCache(cache, address, ip);
+  if (block) {
+    if (previous) {
+      LinkSuccessorBlock(previous, block);
+    }
+    return block;
+  }
+  block = TranslateBlock(cpu, cache, address);
+  // Translating the block may have evicted the previous block from the cache.
+  if (block && previous && previous != block) {
+    LinkSuccessorBlock(previous, block);
+  }
+  return block;
+}
+
+#ifdef YAX86_CPU_HAS_JIT
+
+// Execute an instruction on behalf of native code. Returns true if native
+// execution should stop after the instruction, under the same conditions as
+// CPUTickBlock().
+static bool ExecuteJITInstruction(
+    CPUState* cpu, const CPUBlockInstruction* entry) {
+  CPUJIT* jit = cpu->config->jit;
+  const CPUBlock* block = jit->current_block;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  Instruction instruction = entry->instruction;
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  cpu->cycles = jit->current_block_start_cycles +
+                (use_clock_cycles
+                     ? entry->block_clock_cycles +
+                           jit->current_block_variable_clock_cycles
+                     : (uint32_t)(entry - block->instructions)) +
+                1;
+  jit->status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+  jit->stopped = jit->status != kExecuteSuccess || cpu->is_halted ||
+                 cpu->has_pending_interrupt || cpu->stop_requested ||
+                 CPUGetFlag(cpu, kTF) ||
+                 !IsBlockValid(cpu->config->block_cache, block);
+  if (use_clock_cycles && entry->has_variable_clock_cycles) {
+    jit->current_block_variable_clock_cycles +=
+        GetInstructionVariableClockCycles(cpu, &instruction, next_ip, cx);
+    // Stop if the budget could run out before the last instruction, now that
+    // this instruction took longer than its base clock cycles.
+    const CPUBlockInstruction* last =
+        &block->instructions[block->num_instructions - 1];
+    if (entry != last && last->block_clock_cycles +
+                                 jit->current_block_variable_clock_cycles >=
+                             jit->current_block_max_cycles) {
+      jit->stopped = true;
+    }
+  }
+  return jit->stopped;
+}
+
+// Returns whether a block can be run as native code. Native code does not run
+// hooks or check for interrupts after instructions it translates itself, so
+// it must run the whole block without needing either. The budget must also
+// last until the block's last instruction, assuming each instruction takes
+// its base clock cycles with CPUConfig.use_clock_cycles.
+static bool CanRunCompiledBlock(
+    const CPUState* cpu, const CPUBlock* block, uint32_t max_block_cycles) {
+  const CPUBlockInstruction* last =
+      &block->instructions[block->num_instructions - 1];
+  const uint32_t cycles_before_last = cpu->config->use_clock_cycles
+                                          ? last->block_clock_cycles
+                                          : block->num_instructions - 1u;
+  return !cpu->config->on_before_execute_instruction &&
+         !cpu->config->on_after_execute_instruction &&
+         !cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF) &&
+         cycles_before_last < max_block_cycles;
+}
+
+// Run a block as native code if it is hot, compiling it if needed. Returns
+// false if the block should be interpreted instead.
+static bool TryRunCompiledBlock(
+    CPUState* cpu, CPUBlock* block, uint32_t max_block_cycles) {
+  CPUJIT* jit = cpu->config->jit;
+  if (block->execution_count < kCPUJITHotBlockThreshold) {
+    ++block->execution_count;
+    return false;
+  }
+  if (!CanRunCompiledBlock(cpu, block, max_block_cycles)) {
+    return false;
+  }
+  if (!IsBlockCompiled(jit, block) &&
+      !CompileBlock(jit, block, ExecuteJITInstruction)) {
+    return false;
+  }
+  jit->current_block_start_cycles = cpu->cycles;
+  jit->current_block_max_cycles = max_block_cycles;
+  jit->current_block_variable_clock_cycles = 0;
+  uint32_t block_instructions = RunCompiledBlock(jit, cpu, block);
+  if (cpu->config->use_clock_cycles) {
+    const CPUBlockInstruction* last =
+        &block->instructions[block_instructions - 1];
+    cpu->cycles = jit->current_block_start_cycles + last->block_clock_cycles +
+                  last->clock_cycles + jit->current_block_variable_clock_cycles;
+  } else {
+    cpu->cycles = jit->current_block_start_cycles + block_instructions;
+  }
+  return true;
+}
+
+#endif  // YAX86_CPU_HAS_JIT
+
+// Count the clock cycles taken by an instruction that was just executed from a
+// block, on top of the instruction cycle already counted, given IP after the
+// instruction was fetched and CX before it was executed.
+static inline void CountBlockInstructionClockCycles(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint16_t next_ip,
+    uint16_t cx) {
+  cpu->cycles += entry->clock_cycles - 1u;
+  if (entry->has_variable_clock_cycles) {
+    cpu->cycles += GetInstructionVariableClockCycles(
+        cpu, &entry->instruction, next_ip, cx);
+  }
+}
+
+// Execute the fused sequence starting at a block entry, as consecutive
+// instruction cycles without instruction callbacks. The first instruction of a
+// sequence never writes to memory or changes TF, so a pending interrupt or a
+// stop request are the only reasons to stop between the two instructions, in
+// which case only the first one is executed. Returns the number of
+// instructions executed in *num_executed.
+static ExecuteStatus ExecuteFusedSequence(
+    CPUState* cpu, const CPUBlockInstruction* entry, uint8_t* num_executed) {
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  const Instruction* first = &entry[0].instruction;
+  cpu->registers[kIP] += first->size;
+  cpu->cycles += use_clock_cycles ? entry[0].clock_cycles : 1;
+  *num_executed = 1;
+  if (entry->fusion == kCPUFusionZeroRegister) {
+    ExecuteFusedZeroRegister(cpu, first, entry->metadata->width);
+    return kExecuteSuccess;
+  }
+  ExecuteStatus status = RunInstructionHandler(cpu, first, entry->metadata);
+  if (status != kExecuteSuccess || cpu->has_pending_interrupt ||
+      cpu->stop_requested) {
+    return status;
+  }
+
+  const Instruction* second = &entry[1].instruction;
+  cpu->registers[kIP] += second->size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ++cpu->cycles;
+  *num_executed = 2;
+  // Resolve the conditional jump directly from the operands of the CMP, TEST,
+  // INC or DEC, leaving its flags pending.
+  bool is_taken;
+  if (entry->fusion != kCPUFusionLoadStore &&
+      EvaluateFusedJumpCondition(
+          &cpu->lazy_flags, second->opcode, &is_taken)) {
+    if (is_taken) {
+      cpu->registers[kIP] =
+          AddSignedOffsetByte(cpu->registers[kIP], second->immediate[0]);
+    }
+  } else {
+    status = RunInstructionHandler(cpu, second, entry[1].metadata);
+  }
+  if (use_clock_cycles) {
+    CountBlockInstructionClockCycles(cpu, &entry[1], next_ip, cx);
+  }
+  return status;
+}
+
+// Returns whether a loop block branched back to its own start.
+static inline bool IsLoopBack(const CPUState* cpu, const CPUBlock* block) {
+  return block->is_loop &&
+         CPUGetSegmentBase(cpu, kCS) + cpu->registers[kIP] == block->address;
+}
+
+// Skip iterations of a loop block that branched back to its own start, if
+// their effect is known in advance. Delay loops and loops that wait for memory
+// or a port to change can then use up the instruction budget at once. The last
+// iteration took iteration_cycles, leaving max_cycles of the budget.
+static void SkipLoopIterations(
+    CPUState* cpu, const CPUBlock* block, LoopSnapshot* snapshot,
+    uint32_t max_cycles, uint32_t iteration_cycles) {
+  const uint32_t num_iterations = FastForwardLoop(
+      cpu, block, snapshot, max_cycles / iteration_cycles, iteration_cycles);
+  cpu->config->block_cache->num_skipped_loop_iterations += num_iterations;
+}
+
+// Run instructions in translated blocks starting with the given block, until
+// max_cycles instruction cycles have been counted since start_cycles.
+static ExecuteStatus RunBlocks(
+    CPUState* cpu, CPUBlock* block, uint32_t start_cycles,
+    uint32_t max_cycles) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  // Fused sequences are only executed as a single step if no callback needs
+  // to see the individual instructions.
+  const bool can_fuse = !cpu->config->on_before_execute_instruction &&
+                        !cpu->config->on_after_execute_instruction;
+  LoopSnapshot snapshot = {0};
+
+  for (;;) {
+    const uint32_t block_start_cycles = cpu->cycles;
+#ifdef YAX86_CPU_HAS_JIT
+    if (cpu->config->jit &&
+        TryRunCompiledBlock(
+            cpu, block, max_cycles - (cpu->cycles - start_cycles))) {
+      CPUJIT* jit = cpu->config->jit;
+      if (jit->status != kExecuteSuccess && jit->status != kExecuteHalt) {
+        return jit->status;
+      }
+      if (jit->stopped || cpu->cycles - start_cycles >= max_cycles) {
+        return FinishTick(cpu);
+      }
+      if (IsLoopBack(cpu, block)) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      } else {
+        snapshot.block = NULL;
+      }
+      if (!(block = GetBlock(cpu, cache, block))) {
+        return kExecuteSuccess;
+      }
+      continue;
+    }
+#endif  // YAX86_CPU_HAS_JIT
+    for (uint8_t i = 0; i < block->num_instructions;) {
+      const CPUBlockInstruction* entry = &block->instructions[i];
+      const uint32_t remaining_cycles =
+          max_cycles - (cpu->cycles - start_cycles);
+      ExecuteStatus status;
+      uint8_t num_executed;
+      const uint8_t fusion_length =
+          GetFusionLength((CPUFusionKind)entry->fusion);
+      // The last instruction of a fused sequence must start within the budget.
+      if (entry->fusion != kCPUFusionNone && can_fuse &&
+          !CPUGetFlag(cpu, kTF) &&
+          (fusion_length == 1 ||
+           remaining_cycles > (use_clock_cycles ? entry->clock_cycles : 1u))) {
+        status = ExecuteFusedSequence(cpu, entry, &num_executed);
+        if (num_executed == fusion_length) {
+          ++cache->fusion_counts[entry->fusion];
+        }
+      } else {
+        // Copy the instruction, as the on_before_execute_instruction callback
+        // may modify it.
+        Instruction instruction = entry->instruction;
+        cpu->registers[kIP] += instruction.size;
+        const uint16_t next_ip = cpu->registers[kIP];
+        const uint16_t cx = cpu->registers[kCX];
+        ++cpu->cycles;
+        status = ExecuteInstruction(cpu, &instruction, entry->metadata);
+        if (use_clock_cycles) {
+          CountBlockInstructionClockCycles(cpu, entry, next_ip, cx);
+        }
+        num_executed = 1;
+      }
+      i += num_executed;
+      if (status != kExecuteSuccess && status != kExecuteHalt) {
+        return status;
+      }
+      // Stop at the end of the instruction cycle if it needs interrupt
+      // handling, if the host asked to stop, or if it wrote to the block's own
+      // code.
+      if (cpu->is_halted || cpu->has_pending_interrupt ||
+          cpu->stop_requested || CPUGetFlag(cpu, kTF) ||
+          cpu->cycles - start_cycles >= max_cycles ||
+          !IsBlockValid(cache, block)) {
+        return FinishTick(cpu);
+      }
+    }
+    // Run a loop block again directly if it branched back to its own start.
+    // Iterations are only skipped if no callback needs to see them.
+    if (IsLoopBack(cpu, block)) {
+      ++cache->fusion_counts[kCPUFusionLoop];
+      if (can_fuse) {
+        SkipLoopIterations(
+            cpu, block, &snapshot, max_cycles - (cpu->cycles - start_cycles),
+            cpu->cycles - block_start_cycles);
+        if (cpu->cycles - start_cycles >= max_cycles) {
+          return FinishTick(cpu);
+        }
+      }
+      continue;
+    }
+    // Follow the link to the next block.
+    snapshot.block = NULL;
+    if (!(block = GetBlock(cpu, cache, block))) {
+      return kExecuteSuccess;
+    }
+  }
+}
+
+// Run instructions in translated blocks, leaving arithmetic flags pending.
+static ExecuteStatus TickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  CPUBlockCache* cache = cpu->config->block_cache;
+  const uint32_t start_cycles = cpu->cycles;
+  *num_instructions = 0;
+  if (max_instructions == 0) {
+    return kExecuteSuccess;
+  }
+  CPUBlock* block =
+      (cache && !cpu->is_halted) ? GetBlock(cpu, cache, NULL) : NULL;
+  if (!block) {
+    ExecuteStatus status = Tick(cpu);
+    *num_instructions = cpu->cycles - start_cycles;
+    return status;
+  }
+  ExecuteStatus status = RunBlocks(cpu, block, start_cycles, max_instructions);
+  *num_instructions = cpu->cycles - start_cycles;
+  // Clock cycles are counted in instruction cycles while running blocks.
+  if (cpu->config->use_clock_cycles) {
+    cpu->clock_cycles += *num_instructions;
+  }
+  return status;
+}
+
+ExecuteStatus CPUTickBlock(
+    CPUState* cpu, uint32_t max_instructions, uint32_t* num_instructions) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = TickBlock(cpu, max_instructions, num_instructions);
+  CPUMaterializeFlags(cpu);
+  return status;
+}
+
+// ============================================================================
+// Batched execution
+// ============================================================================
 
-    // Step 2: Execute the instruction.
-    status = CPUExecuteInstruction(cpu, &instruction);
-    if (status != kExecuteSuccess && status != kExecuteHalt) {
-      return status;
-    }
+// Run a single instruction cycle like Tick(), but without checking for
+// instruction callbacks.
+static ExecuteStatus TickWithoutCallbacks(CPUState* cpu) {
+  ++cpu->cycles;
+  Instruction instruction;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, &instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
   }
-
-  // Step 3: Handle pending interrupts.
-  if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
+  cpu->registers[kIP] += instruction.size;
+  const uint16_t next_ip = cpu->registers[kIP];
+  const uint16_t cx = cpu->registers[kCX];
+  ExecuteStatus status =
+      metadata->handler
+          ? RunInstructionHandler(cpu, &instruction, metadata)
+          : kExecuteInvalidOpcode;
+  if (status != kExecuteSuccess && status != kExecuteHalt) {
     return status;
   }
+  if (cpu->config->use_clock_cycles) {
+    CountInstructionClockCycles(cpu, &instruction, next_ip, cx);
+  }
+  return FinishTick(cpu);
+}
+
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Labels of the opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_LABEL_ROW(row)                                           \
+  &&opcode_##row##0, &&opcode_##row##1, &&opcode_##row##2, &&opcode_##row##3, \
+      &&opcode_##row##4, &&opcode_##row##5, &&opcode_##row##6,                \
+      &&opcode_##row##7, &&opcode_##row##8, &&opcode_##row##9,                \
+      &&opcode_##row##A, &&opcode_##row##B, &&opcode_##row##C,                \
+      &&opcode_##row##D, &&opcode_##row##E, &&opcode_##row##F
+
+// Opcode handler in RunThreaded(). As the opcode is a constant, the compiler
+// can call the handler directly, and inline it with its metadata. Only
+// opcodes with specialized handlers check the ModR/M byte.
+#define YAX86_OPCODE_HANDLER(opcode)                                          \
+  opcode_##opcode:                                                            \
+  context.metadata = &opcode_table[0x##opcode];                               \
+  status = opcode_table[0x##opcode].handler                                   \
+               ? GetOpcodeHandler(&opcode_table[0x##opcode], &instruction)(   \
+                     &context)                                                \
+               : kExecuteInvalidOpcode;                                       \
+  YAX86_DISPATCH_NEXT_OPCODE()
+
+// Opcode handlers in RunThreaded(), for one row of 16 opcodes.
+#define YAX86_OPCODE_HANDLER_ROW(row)                                         \
+  YAX86_OPCODE_HANDLER(row##0)                                                \
+  YAX86_OPCODE_HANDLER(row##1)                                                \
+  YAX86_OPCODE_HANDLER(row##2)                                                \
+  YAX86_OPCODE_HANDLER(row##3)                                                \
+  YAX86_OPCODE_HANDLER(row##4)                                                \
+  YAX86_OPCODE_HANDLER(row##5)                                                \
+  YAX86_OPCODE_HANDLER(row##6)                                                \
+  YAX86_OPCODE_HANDLER(row##7)                                                \
+  YAX86_OPCODE_HANDLER(row##8)                                                \
+  YAX86_OPCODE_HANDLER(row##9)                                                \
+  YAX86_OPCODE_HANDLER(row##A)                                                \
+  YAX86_OPCODE_HANDLER(row##B)                                                \
+  YAX86_OPCODE_HANDLER(row##C)                                                \
+  YAX86_OPCODE_HANDLER(row##D)                                                \
+  YAX86_OPCODE_HANDLER(row##E)                                                \
+  YAX86_OPCODE_HANDLER(row##F)
+
+// Finish the current instruction cycle, then fetch the next instruction and
+// jump to the handler for its opcode. Each handler has its own copy of the
+// indirect jump, which lets the host predict opcode sequences.
+#define YAX86_DISPATCH_NEXT_OPCODE()                                          \
+  ++cycles;                                                                   \
+  if (status != kExecuteSuccess && status != kExecuteHalt) {                  \
+    goto done;                                                                \
+  }                                                                           \
+  if (use_clock_cycles) {                                                     \
+    cycles +=                                                                 \
+        CountInstructionClockCycles(cpu, &instruction, next_ip, cx) - 1;      \
+  }                                                                           \
+  if ((status = FinishTick(cpu)) != kExecuteSuccess ||                        \
+      cycles >= max_cycles || cpu->is_halted || cpu->stop_requested) {        \
+    goto done;                                                                \
+  }                                                                           \
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=               \
+      kExecuteSuccess) {                                                      \
+    ++cycles;                                                                 \
+    goto done;                                                                \
+  }                                                                           \
+  next_ip = cpu->registers[kIP];                                              \
+  cx = cpu->registers[kCX];                                                   \
+  goto *kOpcodeLabels[instruction.opcode];
+
+// Start an instruction cycle and fetch the next instruction for
+// RunThreaded().
+static inline ExecuteStatus FetchThreadedInstruction(
+    CPUState* cpu, Instruction* instruction) {
+  ++cpu->cycles;
+  const OpcodeMetadata* metadata;
+  if (FetchNextInstruction(cpu, instruction, &metadata) != kFetchSuccess) {
+    return kExecuteInvalidInstruction;
+  }
+  cpu->registers[kIP] += instruction->size;
+  return kExecuteSuccess;
+}
 
-  // Step 4: If trap flag is set, handle single-step execution.
-  if (CPUGetFlag(cpu, kTF)) {
-    CPUSetPendingInterrupt(cpu, kInterruptSingleStep);
-    if ((status = ExecutePendingInterrupt(cpu)) != kExecuteSuccess) {
-      return status;
+// Computed gotos are a GCC and Clang extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Run instruction cycles like TickWithoutCallbacks() until the budget is used
+// up, the CPU halts or execution needs to return to the host. Instead of
+// calling opcode handlers through the opcode table, this jumps directly from
+// one opcode's handler to the next with computed gotos.
+static ExecuteStatus RunThreaded(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  static const void* const kOpcodeLabels[256] = {
+      YAX86_OPCODE_LABEL_ROW(0),
+      YAX86_OPCODE_LABEL_ROW(1),
+      YAX86_OPCODE_LABEL_ROW(2),
+      YAX86_OPCODE_LABEL_ROW(3),
+      YAX86_OPCODE_LABEL_ROW(4),
+      YAX86_OPCODE_LABEL_ROW(5),
+      YAX86_OPCODE_LABEL_ROW(6),
+      YAX86_OPCODE_LABEL_ROW(7),
+      YAX86_OPCODE_LABEL_ROW(8),
+      YAX86_OPCODE_LABEL_ROW(9),
+      YAX86_OPCODE_LABEL_ROW(A),
+      YAX86_OPCODE_LABEL_ROW(B),
+      YAX86_OPCODE_LABEL_ROW(C),
+      YAX86_OPCODE_LABEL_ROW(D),
+      YAX86_OPCODE_LABEL_ROW(E),
+      YAX86_OPCODE_LABEL_ROW(F),
+  };
+  Instruction instruction;
+  InstructionContext context = {
+      .cpu = cpu,
+      .instruction = &instruction,
+      .metadata = NULL,
+  };
+  const bool use_clock_cycles = cpu->config->use_clock_cycles;
+  ExecuteStatus status;
+  uint32_t cycles = 0;
+  // IP after the current instruction was fetched, and CX before it was
+  // executed, for timing it in clock cycles.
+  uint16_t next_ip;
+  uint16_t cx;
+  if (max_cycles == 0) {
+    *num_cycles = 0;
+    return kExecuteSuccess;
+  }
+  if ((status = FetchThreadedInstruction(cpu, &instruction)) !=
+      kExecuteSuccess) {
+    *num_cycles = 1;
+    return status;
+  }
+  next_ip = cpu->registers[kIP];
+  cx = cpu->registers[kCX];
+  goto *kOpcodeLabels[instruction.opcode];
+
+  YAX86_OPCODE_HANDLER_ROW(0)
+  YAX86_OPCODE_HANDLER_ROW(1)
+  YAX86_OPCODE_HANDLER_ROW(2)
+  YAX86_OPCODE_HANDLER_ROW(3)
+  YAX86_OPCODE_HANDLER_ROW(4)
+  YAX86_OPCODE_HANDLER_ROW(5)
+  YAX86_OPCODE_HANDLER_ROW(6)
+  YAX86_OPCODE_HANDLER_ROW(7)
+  YAX86_OPCODE_HANDLER_ROW(8)
+  YAX86_OPCODE_HANDLER_ROW(9)
+  YAX86_OPCODE_HANDLER_ROW(A)
+  YAX86_OPCODE_HANDLER_ROW(B)
+  YAX86_OPCODE_HANDLER_ROW(C)
+  YAX86_OPCODE_HANDLER_ROW(D)
+  YAX86_OPCODE_HANDLER_ROW(E)
+  YAX86_OPCODE_HANDLER_ROW(F)
+
+done:
+  *num_cycles = cycles;
+  return status;
+}
+
+#pragma GCC diagnostic pop
+
+#undef YAX86_OPCODE_LABEL_ROW
+#undef YAX86_OPCODE_HANDLER
+#undef YAX86_OPCODE_HANDLER_ROW
+#undef YAX86_DISPATCH_NEXT_OPCODE
+
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+
+// Run instruction cycles until the budget is used up or execution needs to
+// return to the host, leaving arithmetic flags pending.
+static ExecuteStatus Run(
+    CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  CPUBlockCache* const cache = cpu->config->block_cache;
+  const bool has_callbacks = cpu->config->on_before_execute_instruction ||
+                             cpu->config->on_after_execute_instruction;
+  ExecuteStatus status = kExecuteSuccess;
+  uint32_t cycles = 0;
+  while (cycles < max_cycles && !cpu->stop_requested) {
+    if (cpu->is_halted) {
+      if (!cpu->has_pending_interrupt && !CPUGetFlag(cpu, kTF)) {
+        // Nothing can wake up the CPU until the host raises an interrupt.
+        CountHaltedCycles(cpu, max_cycles - cycles);
+        cycles = max_cycles;
+        break;
+      }
+      CountHaltedCycles(cpu, 1);
+      ++cycles;
+      if ((status = FinishTick(cpu)) != kExecuteSuccess) {
+        break;
+      }
+      continue;
+    }
+    if (cache) {
+      uint32_t block_cycles;
+      status = TickBlock(cpu, max_cycles - cycles, &block_cycles);
+      cycles += block_cycles;
+    } else if (has_callbacks) {
+      const uint32_t start_cycles = cpu->cycles;
+      status = Tick(cpu);
+      cycles += cpu->cycles - start_cycles;
+#ifdef YAX86_CPU_HAS_THREADED_DISPATCH
+    } else if (!cpu->config->use_portable_dispatch) {
+      uint32_t threaded_cycles;
+      status = RunThreaded(cpu, max_cycles - cycles, &threaded_cycles);
+      cycles += threaded_cycles;
+#endif  // YAX86_CPU_HAS_THREADED_DISPATCH
+    } else {
+      const uint32_t start_cycles = cpu->cycles;
+      status = TickWithoutCallbacks(cpu);
+      cycles += cpu->cycles - start_cycles;
+    }
+    if (status != kExecuteSuccess || cpu->is_halted) {
+      break;
     }
   }
-
-  return kExecuteSuccess;
+  *num_cycles = cycles;
+  return status;
 }
 
+ExecuteStatus CPURun(CPUState* cpu, uint32_t max_cycles, uint32_t* num_cycles) {
+  SyncSegmentBases(cpu);
+  ExecuteStatus status = Run(cpu, max_cycles, num_cycles);
+  cpu->stop_requested = false;
+  CPUMaterializeFlags(cpu);
+  return status;
+}
 
 
 // ==============================================================================
@@ -6675,6 +11273,19 @@ void DMAWritePort(DMAState* dma, uint16_t port, uint8_t value);
 // peripheral.
 void DMATransferByte(DMAState* dma, uint8_t channel_index);
 
+// Executes up to size single-byte transfers for the specified channel in one
+// step, exchanging data with a buffer instead of the device callbacks. If the
+// channel is programmed to write to memory, bytes are taken from data; if it
+// is programmed to read from memory, bytes are stored into data. The channel
+// registers, status register, mask register and terminal count callback end
+// up as if DMATransferByte() had been called once per byte. Stops after the
+// byte that reaches terminal count. Returns the number of bytes transferred,
+// or 0 if the controller is disabled, the channel is masked, or the channel's
+// transfer type is not transfer_type.
+uint16_t DMATransferBlock(
+    DMAState* dma, uint8_t channel_index, uint8_t transfer_type,
+    uint8_t* data, uint16_t size);
+
 #endif  // YAX86_DMA_PUBLIC_H
 
 
@@ -6856,21 +11467,56 @@ void DMAWritePort(DMAState* dma, uint16_t port, uint8_t value) {
   }
 }
 
-void DMATransferByte(DMAState* dma, uint8_t channel_index) {
-  if (channel_index >= kDMANumChannels) {
-    return;
-  }
+// Helper to check whether a channel can transfer data: the controller is
+// enabled (bit 2 of command register clear) and the channel is not masked.
+static inline bool DMAIsChannelReady(
+    const DMAState* dma, uint8_t channel_index) {
+  return channel_index < kDMANumChannels &&
+         (dma->command_register & 0x04) == 0 &&
+         (dma->mask_register & (1 << channel_index)) == 0;
+}
+
+// Helper to update the address and count registers after transferring a byte.
+// Returns true if the channel reached its Terminal Count (TC).
+static bool DMAAdvanceChannel(DMAState* dma, uint8_t channel_index) {
   DMAChannelState* channel = &dma->channels[channel_index];
 
-  // Check if controller is disabled (bit 2 of command register).
-  if ((dma->command_register & 0x04) != 0) {
-    return;
+  // Update address register
+  if ((channel->mode & kDMAModeAddressDecrement) == 0) {
+    ++channel->current_address;
+  } else {
+    --channel->current_address;
+  }
+
+  // Update count register and check for Terminal Count (TC)
+  --channel->current_count;
+  if (channel->current_count != 0xFFFF) {
+    return false;
+  }
+
+  // Set TC bit in status register
+  dma->status_register |= (1 << channel_index);
+
+  // Notify the system that TC has been reached.
+  if (dma->config->on_terminal_count) {
+    dma->config->on_terminal_count(dma->config->context, channel_index);
   }
 
-  // If channel is masked, do nothing.
-  if ((dma->mask_register & (1 << channel_index)) != 0) {
+  // Handle auto-initialization or mask the channel
+  if ((channel->mode & kDMAModeAutoInitialize) != 0) {
+    channel->current_address = channel->base_address;
+    channel->current_count = channel->base_count;
+  } else {
+    dma->mask_register |= (1 << channel_index);
+  }
+  return true;
+}
+
+void DMATransferByte(DMAState* dma, uint8_t channel_index) {
+  if (!DMAIsChannelReady(dma, channel_index)) {
     return;
   }
+  DMAChannelState* channel = &dma->channels[channel_index];
 
   // Construct full 20-bit memory address
   const uint32_t address =
@@ -6901,38 +11547,50 @@ void DMATransferByte(DMAState* dma, uint8_t channel_index) {
       break;
   }
 
+  DMAAdvanceChannel(dma, channel_index);
+}
 
-
-  // Update address register
-  if ((channel->mode & kDMAModeAddressDecrement) == 0) {
-    ++channel->current_address;
-  } else {
-    --channel->current_address;
+uint16_t DMATransferBlock(
+    DMAState* dma, uint8_t channel_index, uint8_t transfer_type,
+    uint8_t* data, uint16_t size) {
+  if (!DMAIsChannelReady(dma, channel_index)) {
+    return 0;
+  }
+  const DMAChannelState* channel = &dma->channels[channel_index];
+  if ((channel->mode & (0x03 << 2)) != transfer_type) {
+    return 0;
   }
 
-  // Update count register and check for Terminal Count (TC)
-  --channel->current_count;
-  if (channel->current_count == 0xFFFF) {
-    // Set TC bit in status register
-    dma->status_register |= (1 << channel_index);
-
-    // Notify the system that TC has been reached.
-    if (dma->config->on_terminal_count) {
-      dma->config->on_terminal_count(dma->config->context, channel_index);
+  uint16_t i = 0;
+  while (i < size) {
+    // Construct full 20-bit memory address
+    const uint32_t address =
+        ((uint32_t)channel->page_register << 16) | channel->current_address;
+    switch (transfer_type) {
+      case kDMAModeTransferTypeWrite:  // Write to memory (buffer -> memory)
+        if (dma->config->write_memory_byte) {
+          dma->config->write_memory_byte(
+              dma->config->context, address, data[i]);
+        }
+        break;
+      case kDMAModeTransferTypeRead:  // Read from memory (memory -> buffer)
+        data[i] = dma->config->read_memory_byte
+                      ? dma->config->read_memory_byte(
+                            dma->config->context, address)
+                      : 0xFF;
+        break;
+      default:
+        break;
     }
-
-    // Handle auto-initialization or mask the channel
-    if ((channel->mode & kDMAModeAutoInitialize) != 0) {
-      channel->current_address = channel->base_address;
-      channel->current_count = channel->base_count;
-    } else {
-      dma->mask_register |= (1 << channel_index);
+    ++i;
+    if (DMAAdvanceChannel(dma, channel_index)) {
+      break;
     }
   }
+  return i;
 }
 
 
-
 // ==============================================================================
 // src/dma/dma.c end
 // ==============================================================================
@@ -7099,6 +11757,8 @@ static const FDCDiskFormat kFDCFormat360KB = {
 };
 
 struct FDCState;
+struct FDCTrackCache;
+struct FDCWriteCache;
 
 enum {
   // Number of floppy drives supported by the FDC.
@@ -7107,6 +11767,16 @@ enum {
   kFDCCommandBufferSize = 9,
   // Maximum size of a command result.
   kFDCResultBufferSize = 7,
+  // Maximum sector size transferred with the transfer_dma_block callback.
+  kFDCBlockTransferBufferSize = 512,
+  // Maximum size of a track held in an FDCTrackCache, enough for a track of
+  // kFDCFormat360KB.
+  kFDCTrackCacheSize = 9 * 512,
+  // Number of sectors held in an FDCWriteCache, enough for both tracks of a
+  // cylinder of kFDCFormat360KB.
+  kFDCWriteCacheNumSectors = 18,
+  // Maximum size of a sector held in an FDCWriteCache.
+  kFDCWriteCacheSectorSize = 512,
 };
 
 // Command phases of the FDC.
@@ -7267,7 +11937,10 @@ typedef struct FDCConfig {
       // byte offset within the image
       uint32_t offset);
 
-  // Callback to write a byte to a floppy image.
+  // Callback to write a byte to a floppy image. If neither this nor
+  // write_image_bytes is set and get_image_sector does not return the bytes as
+  // writable, Write Data commands fail with Equipment Check set in ST0 (a
+  // write fault).
   void (*write_image_byte)(
       void* context,
       // 0 to kFDCNumDrives-1
@@ -7276,8 +11949,143 @@ typedef struct FDCConfig {
       uint32_t offset,
       // byte value to write
       uint8_t value);
+
+  // Optional callback to get a pointer to size bytes of a floppy image
+  // starting at offset, so that sectors can be read or written directly
+  // instead of one byte at a time through read_image_byte and
+  // write_image_byte. writable is true if the FDC will write to the bytes.
+  // The pointer is only used until the FDC call that requested it returns.
+  // Returns NULL if the bytes are not available, for example if they are out
+  // of range or the image is read-only, in which case the FDC falls back to
+  // read_image_byte and write_image_byte.
+  uint8_t* (*get_image_sector)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // number of bytes starting at offset
+      uint16_t size,
+      // whether the bytes will be written
+      bool writable);
+
+  // Optional callback to read size bytes of a floppy image starting at offset
+  // into data in one call. Used to fill track_cache. Returns false on error.
+  bool (*read_image_bytes)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // buffer to read into
+      uint8_t* data,
+      // number of bytes to read
+      uint16_t size);
+
+  // Optional callback to write size bytes from data to a floppy image
+  // starting at offset in one call. Used to flush write_cache.
+  void (*write_image_bytes)(
+      void* context,
+      // 0 to kFDCNumDrives-1
+      uint8_t drive,
+      // byte offset within the image
+      uint32_t offset,
+      // bytes to write
+      const uint8_t* data,
+      // number of bytes to write
+      uint16_t size);
+
+  // Optional cache of the last track read from each drive. If set, the cache
+  // must be initialized with FDCInitTrackCache() before use. Reads that
+  // get_image_sector does not serve fetch the whole track with
+  // read_image_bytes, or read_image_byte if not set, and later reads from the
+  // same track are served from the cache.
+  struct FDCTrackCache* track_cache;
+
+  // Optional write-back cache of sectors written to images. If set, the cache
+  // must be initialized with FDCInitWriteCache() before use. Writes are held
+  // in the cache until FDCFlush() is called, the disk is ejected, or the cache
+  // is full, and are then written with get_image_sector, write_image_bytes or
+  // write_image_byte, in one call per run of adjacent sectors on a track.
+  struct FDCWriteCache* write_cache;
+
+  // Optional callback to transfer a block of bytes to or from memory via DMA
+  // in one step, instead of one byte per request_dma call. If to_memory is
+  // true, transfers data to memory; otherwise, fills data from memory.
+  // Returns the number of bytes transferred, which is less than size if the
+  // DMA controller reached the terminal count (and called FDCHandleTC), or 0
+  // if the DMA channel is not ready, in which case the FDC falls back to
+  // transferring one byte at a time.
+  uint16_t (*transfer_dma_block)(
+      void* context, uint8_t* data, uint16_t size, bool to_memory);
 } FDCConfig;
 
+// A track held in an FDCTrackCache.
+typedef struct FDCCachedTrack {
+  // Whether data holds a track.
+  bool valid;
+  // Byte offset of the track within the image.
+  uint32_t offset;
+  // Size of the track in bytes.
+  uint16_t size;
+  // Contents of the track.
+  uint8_t data[kFDCTrackCacheSize];
+} FDCCachedTrack;
+
+// A read-ahead cache holding the last track read from each drive, so that
+// reading the sectors of a track takes one read from the image instead of one
+// per byte. Writes through the FDC are applied to both the image and the
+// cache. Images modified outside the FDC must be reported by re-initializing
+// the cache with FDCInitTrackCache().
+typedef struct FDCTrackCache {
+  // Cached track of each drive.
+  FDCCachedTrack tracks[kFDCNumDrives];
+
+  // Number of reads served from the cache.
+  uint32_t num_hits;
+  // Number of tracks read from images into the cache.
+  uint32_t num_fills;
+} FDCTrackCache;
+
+// Initialize or reset a track cache.
+void FDCInitTrackCache(FDCTrackCache* cache);
+
+// A sector held in an FDCWriteCache.
+typedef struct FDCCachedSector {
+  // Whether data holds a write that has not been written to the image yet.
+  bool dirty;
+  // Drive whose image the sector belongs to.
+  uint8_t drive;
+  // Byte offset of the sector within the image.
+  uint32_t offset;
+  // Size of the sector in bytes.
+  uint16_t size;
+  // Contents of the sector.
+  uint8_t data[kFDCWriteCacheSectorSize];
+} FDCCachedSector;
+
+// A write-back cache of sectors written to images, so that writes reach the
+// image in a few large writes instead of one write per byte. Reads through the
+// FDC see pending writes. Pending writes are written to the image when the disk
+// is ejected or another disk is inserted into its drive.
+typedef struct FDCWriteCache {
+  // Cached sectors.
+  FDCCachedSector sectors[kFDCWriteCacheNumSectors];
+  // Buffer for a run of adjacent sectors being written to an image.
+  uint8_t flush_buffer[kFDCTrackCacheSize];
+
+  // Number of times pending writes of a drive were flushed.
+  uint32_t num_flushes;
+  // Number of writes to images.
+  uint32_t num_image_writes;
+  // Number of bytes written to images together with a preceding sector,
+  // instead of in a write of their own.
+  uint32_t num_coalesced_bytes;
+} FDCWriteCache;
+
+// Initialize or reset a write cache, dropping any pending writes.
+void FDCInitWriteCache(FDCWriteCache* cache);
+
 STATIC_VECTOR_TYPE(FDCCommandBuffer, uint8_t, kFDCCommandBufferSize)
 STATIC_VECTOR_TYPE(FDCResultBuffer, uint8_t, kFDCResultBufferSize)
 
@@ -7330,6 +12138,8 @@ typedef struct FDCState {
     uint8_t data_register;  // Buffer for the byte currently being transferred.
     bool dma_request_active;  // DREQ is asserted, waiting for DMA access.
     bool tc_received;         // TC (Terminal Count) signal received from DMA.
+    // Buffer for the sector being transferred with transfer_dma_block.
+    uint8_t block_buffer[kFDCBlockTransferBufferSize];
   } transfer;
 } FDCState;
 
@@ -7346,11 +12156,23 @@ void FDCWritePort(FDCState* fdc, uint16_t port, uint8_t value);
 // This represents the TC signal.
 void FDCHandleTC(FDCState* fdc);
 
-// Inserts a disk with the given format into the specified drive.
-void FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format);
+// Inserts a disk with the given format into the specified drive. If the drive
+// already holds a disk, pending writes in FDCConfig.write_cache are written to
+// its image first, so the image callbacks must still refer to the previous
+// image when this is called. Returns false if any of them could not be
+// written; they are dropped along with the previous disk.
+bool FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format);
 
-// Ejects the disk from the specified drive.
-void FDCEjectDisk(FDCState* fdc, uint8_t drive);
+// Ejects the disk from the specified drive, writing any pending writes in
+// FDCConfig.write_cache to its image first. Returns false if any of them could
+// not be written; they are dropped along with the disk.
+bool FDCEjectDisk(FDCState* fdc, uint8_t drive);
+
+// Writes all pending writes in FDCConfig.write_cache to the disk images.
+// Returns false if any of them could not be written because no callback to
+// write to the image was set and get_image_sector returned NULL. Such writes
+// stay in the cache, and are written by a later call that succeeds.
+bool FDCFlush(FDCState* fdc);
 
 // Simulates a tick of the FDC, handling any timed operations.
 void FDCTick(FDCState* fdc);
@@ -7436,99 +12258,539 @@ static inline void FDCRaiseIRQ6(FDCState* fdc) {
   }
 }
 
-// Transition into execution phase.
-static inline void FDCStartCommandExecution(FDCState* fdc) {
-  fdc->phase = kFDCPhaseExecution;
-  fdc->current_command_ticks = 0;
-}
+// Transition into execution phase.
+static inline void FDCStartCommandExecution(FDCState* fdc) {
+  fdc->phase = kFDCPhaseExecution;
+  fdc->current_command_ticks = 0;
+}
+
+// Transition into result phase after command execution.
+static inline void FDCFinishCommandExecution(FDCState* fdc) {
+  if (FDCResultBufferLength(&fdc->result_buffer) == 0) {
+    // No result bytes to send, go back to idle phase.
+    fdc->phase = kFDCPhaseIdle;
+  } else {
+    // Has result bytes to send, go to result phase.
+    fdc->phase = kFDCPhaseResult;
+    fdc->next_result_byte_index = 0;
+  }
+}
+
+// Helper to perform a seek operation (for Seek and Recalibrate).
+static void FDCPerformSeek(
+    FDCState* fdc, uint8_t drive_index, uint8_t target_track) {
+  FDCDriveState* drive = &fdc->drives[drive_index];
+
+  // On initial tick, start seeking.
+  if (fdc->current_command_ticks == 0) {
+    drive->busy = true;
+    return;
+  }
+
+  // On 2nd tick, seek is complete.
+  drive->track = target_track;
+  drive->busy = false;
+
+  // Set Status Register 0 (ST0)
+  // Bits 7-6: Interrupt Code = 00 (Normal Termination)
+  // Bit 5: Seek End = 1
+  // Bits 1-0: Unit Select (Drive Index)
+  drive->st0 = kFDCST0NormalTermination | kFDCST0SeekEnd | drive_index;
+
+  // Set interrupt pending flag for this drive.
+  drive->has_pending_interrupt = true;
+
+  // Raise Interrupt (IRQ6).
+  FDCRaiseIRQ6(fdc);
+
+  FDCFinishCommandExecution(fdc);
+}
+
+// Compute the byte offset within a disk image for the given address. Returns
+// kFDCInvalidOffset if the address is out of range.
+//
+// In a raw image file, the data is laid out track by track, starting from the
+// outermost track (Track 0). Within each track, it reads all the data from the
+// first head (Head 0, the top side) and then all the data from the second head
+// (Head 1, the bottom side) before moving to the next track.
+// In other words, the layout is an array of
+// [num_tracks][num_heads][num_sectors_per_track].
+static inline uint32_t FDCComputeOffset(
+    FDCDiskFormat format, uint8_t head, uint8_t track, uint8_t sector,
+    uint16_t sector_offset) {
+  if (head >= format.num_heads || track >= format.num_tracks || sector == 0 ||
+      sector > format.num_sectors_per_track ||
+      sector_offset >= format.sector_size) {
+    return kFDCInvalidOffset;
+  }
+
+  uint32_t offset = 0;
+  // Seek to start of the track
+  offset += (uint32_t)track * format.num_heads * format.num_sectors_per_track *
+            format.sector_size;
+  // Seek to start of the head within the track
+  offset += (uint32_t)head * format.num_sectors_per_track * format.sector_size;
+  // Seek to start of the sector within the head
+  offset += (uint32_t)(sector - 1) * format.sector_size;
+  // Add byte offset within the sector
+  offset += (uint32_t)sector_offset;
+
+  return offset;
+}
+
+// Helper to finish a read/write command.
+static void FDCFinishReadWrite(
+    FDCState* fdc, uint8_t st0, uint8_t st1, uint8_t st2) {
+  FDCResultBufferAppend(&fdc->result_buffer, &st0);
+  FDCResultBufferAppend(&fdc->result_buffer, &st1);
+  FDCResultBufferAppend(&fdc->result_buffer, &st2);
+  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.cylinder);
+  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.head);
+  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.sector);
+  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.sector_size_code);
+
+  FDCRaiseIRQ6(fdc);
+  FDCFinishCommandExecution(fdc);
+}
+
+// Helper to finish a read/write command after the last byte was transferred.
+static void FDCFinishTransfer(FDCState* fdc) {
+  uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
+  uint8_t head_address = (fdc->transfer.head & 0x01);
+  FDCFinishReadWrite(
+      fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+}
+
+// Returns the size of each sector in the current read/write command.
+static uint16_t FDCGetSectorSize(FDCState* fdc) {
+  if (fdc->transfer.sector_size_code == 0) {
+    // DTL
+    return *FDCCommandBufferGet(&fdc->command_buffer, 8);
+  }
+  return 128 << fdc->transfer.sector_size_code;
+}
+
+// Helper to move on to the next sector after the last byte of a sector was
+// transferred. Returns false and sets tc_received if the transfer ends here.
+static bool FDCAdvanceSector(FDCState* fdc, uint8_t drive_index) {
+  if (fdc->transfer.sector >= fdc->transfer.eot) {
+    // End of Track reached.
+    if (!fdc->transfer.multi_track || (fdc->transfer.head & 1) != 0) {
+      // Standard termination (MT=0 or already on Head 1).
+      // Increment sector so result phase reports the *next* logical sector.
+      fdc->transfer.sector++;
+      fdc->transfer.tc_received = true;
+      return false;
+    }
+    // Multi-Track rollover: Side 0 -> Side 1.
+    fdc->transfer.head ^= 1;   // Flip to Head 1
+    fdc->transfer.sector = 1;  // Reset to Sector 1
+  } else {
+    // Move to next sector.
+    fdc->transfer.sector++;
+  }
+  fdc->transfer.sector_byte_index = 0;
+
+  // Recompute offset for new head/sector.
+  FDCDriveState* drive = &fdc->drives[drive_index];
+  fdc->transfer.current_offset = FDCComputeOffset(
+      *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
+      fdc->transfer.sector, 0);
+  if (fdc->transfer.current_offset == kFDCInvalidOffset) {
+    // Should not happen if EOT is correct, but if we ran off the end of the
+    // image despite EOT, terminate.
+    fdc->transfer.tc_received = true;
+    return false;
+  }
+  return true;
+}
+
+// Helper to check whether the rest of a sector can be transferred in one step
+// with the transfer_dma_block callback.
+static inline bool FDCCanTransferBlock(FDCState* fdc, uint16_t sector_size) {
+  return fdc->config && fdc->config->transfer_dma_block &&
+         sector_size <= kFDCBlockTransferBufferSize;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// with the get_image_sector callback. Returns NULL if not available.
+static inline uint8_t* FDCGetImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size,
+    bool writable) {
+  if (!fdc->config || !fdc->config->get_image_sector) {
+    return NULL;
+  }
+  return fdc->config->get_image_sector(
+      fdc->config->context, drive_index, offset, size, writable);
+}
+
+// Helper to check whether size bytes of a disk image starting at offset can be
+// written, either in place through get_image_sector or with a callback to
+// write to the image.
+static bool FDCCanWriteImage(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  if (fdc->config &&
+      (fdc->config->write_image_bytes || fdc->config->write_image_byte)) {
+    return true;
+  }
+  return FDCGetImageSector(fdc, drive_index, offset, size, true) != NULL;
+}
+
+// Helper to write bytes directly to a disk image, bypassing the write cache.
+// Returns false if the bytes could not be written.
+static bool FDCWriteImageDirect(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  uint8_t* sector = FDCGetImageSector(fdc, drive_index, offset, size, true);
+  if (sector) {
+    for (uint16_t i = 0; i < size; ++i) {
+      sector[i] = data[i];
+    }
+  } else if (fdc->config && fdc->config->write_image_bytes) {
+    fdc->config->write_image_bytes(
+        fdc->config->context, drive_index, offset, data, size);
+  } else if (fdc->config && fdc->config->write_image_byte) {
+    for (uint16_t i = 0; i < size; ++i) {
+      fdc->config->write_image_byte(
+          fdc->config->context, drive_index, offset + i, data[i]);
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Helper to get the sector size of a drive's disk if its sectors can be held
+// in the write cache, or 0 if there is no write cache or they cannot.
+static uint16_t FDCGetWriteCacheSectorSize(FDCState* fdc, uint8_t drive_index) {
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  if (!fdc->config || !fdc->config->write_cache || !format ||
+      format->sector_size == 0 ||
+      format->sector_size > kFDCWriteCacheSectorSize) {
+    return 0;
+  }
+  return format->sector_size;
+}
+
+// Helper to find the pending write of a sector starting at offset. Returns
+// NULL if the sector has no pending write.
+static FDCCachedSector* FDCFindCachedSector(
+    FDCWriteCache* cache, uint8_t drive_index, uint32_t offset) {
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    FDCCachedSector* sector = &cache->sectors[i];
+    if (sector->dirty && sector->drive == drive_index &&
+        sector->offset == offset) {
+      return sector;
+    }
+  }
+  return NULL;
+}
+
+// Helper to copy pending writes overlapping size bytes of a disk image starting
+// at offset into data. Returns whether any pending writes overlap.
+static bool FDCApplyPendingWrites(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint8_t* data,
+    uint16_t size) {
+  FDCWriteCache* cache = fdc->config ? fdc->config->write_cache : NULL;
+  if (!cache) {
+    return false;
+  }
+  bool has_pending_writes = false;
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    const FDCCachedSector* sector = &cache->sectors[i];
+    if (!sector->dirty || sector->drive != drive_index ||
+        sector->offset >= offset + size ||
+        sector->offset + sector->size <= offset) {
+      continue;
+    }
+    has_pending_writes = true;
+    if (!data) {
+      continue;
+    }
+    for (uint16_t j = 0; j < sector->size; ++j) {
+      const uint32_t byte_offset = sector->offset + j;
+      if (byte_offset >= offset && byte_offset < offset + size) {
+        data[byte_offset - offset] = sector->data[j];
+      }
+    }
+  }
+  return has_pending_writes;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// from a pending write. Returns NULL if the bytes are not all within a single
+// sector with a pending write.
+static uint8_t* FDCGetPendingWrite(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  const uint16_t sector_size = FDCGetWriteCacheSectorSize(fdc, drive_index);
+  if (sector_size == 0) {
+    return NULL;
+  }
+  const uint32_t sector_offset = offset - offset % sector_size;
+  if (offset + size > sector_offset + sector_size) {
+    return NULL;
+  }
+  FDCCachedSector* sector =
+      FDCFindCachedSector(fdc->config->write_cache, drive_index, sector_offset);
+  return sector ? sector->data + (offset - sector_offset) : NULL;
+}
+
+// Helper to read a track of a disk image into a track cache entry, including
+// pending writes. Returns false if the track could not be read.
+static bool FDCFillCachedTrack(
+    FDCState* fdc, uint8_t drive_index, FDCCachedTrack* track) {
+  if (fdc->config->read_image_bytes) {
+    if (!fdc->config->read_image_bytes(
+            fdc->config->context, drive_index, track->offset, track->data,
+            track->size)) {
+      return false;
+    }
+  } else if (fdc->config->read_image_byte) {
+    for (uint16_t i = 0; i < track->size; ++i) {
+      track->data[i] = fdc->config->read_image_byte(
+          fdc->config->context, drive_index, track->offset + i);
+    }
+  } else {
+    return false;
+  }
+  FDCApplyPendingWrites(
+      fdc, drive_index, track->offset, track->data, track->size);
+  return true;
+}
+
+// Helper to get a pointer to size bytes of a disk image starting at offset
+// from the track cache, reading the track into the cache if needed. Returns
+// NULL if there is no track cache, or if the bytes are not within a single
+// track that fits in the cache.
+static uint8_t* FDCGetCachedImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  FDCTrackCache* cache = fdc->config ? fdc->config->track_cache : NULL;
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  if (!cache || !format) {
+    return NULL;
+  }
+  const uint32_t track_size =
+      (uint32_t)format->num_sectors_per_track * format->sector_size;
+  if (track_size == 0 || track_size > kFDCTrackCacheSize) {
+    return NULL;
+  }
+  const uint32_t track_offset = offset - offset % track_size;
+  if (offset + size > track_offset + track_size) {
+    return NULL;
+  }
 
-// Transition into result phase after command execution.
-static inline void FDCFinishCommandExecution(FDCState* fdc) {
-  if (FDCResultBufferLength(&fdc->result_buffer) == 0) {
-    // No result bytes to send, go back to idle phase.
-    fdc->phase = kFDCPhaseIdle;
+  FDCCachedTrack* track = &cache->tracks[drive_index];
+  if (track->valid && track->offset == track_offset &&
+      track->size == track_size) {
+    ++cache->num_hits;
   } else {
-    // Has result bytes to send, go to result phase.
-    fdc->phase = kFDCPhaseResult;
-    fdc->next_result_byte_index = 0;
+    track->offset = track_offset;
+    track->size = (uint16_t)track_size;
+    track->valid = FDCFillCachedTrack(fdc, drive_index, track);
+    if (!track->valid) {
+      return NULL;
+    }
+    ++cache->num_fills;
   }
+  return track->data + (offset - track_offset);
 }
 
-// Helper to perform a seek operation (for Seek and Recalibrate).
-static void FDCPerformSeek(
-    FDCState* fdc, uint8_t drive_index, uint8_t target_track) {
-  FDCDriveState* drive = &fdc->drives[drive_index];
-
-  // On initial tick, start seeking.
-  if (fdc->current_command_ticks == 0) {
-    drive->busy = true;
+// Helper to apply a write to a disk image to the track cache.
+static void FDCUpdateCachedTrack(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  FDCTrackCache* cache = fdc->config ? fdc->config->track_cache : NULL;
+  if (!cache) {
     return;
   }
+  FDCCachedTrack* track = &cache->tracks[drive_index];
+  if (!track->valid) {
+    return;
+  }
+  for (uint16_t i = 0; i < size; ++i) {
+    if (offset + i >= track->offset &&
+        offset + i < track->offset + track->size) {
+      track->data[offset + i - track->offset] = data[i];
+    }
+  }
+}
 
-  // On 2nd tick, seek is complete.
-  drive->track = target_track;
-  drive->busy = false;
+// Helper to get a pointer to size bytes of a disk image starting at offset for
+// reading, from pending writes, get_image_sector or the track cache. Returns
+// NULL if not available, in which case the bytes must be read one at a time
+// with FDCReadImageByte().
+static uint8_t* FDCGetReadableImageSector(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, uint16_t size) {
+  uint8_t* sector = FDCGetPendingWrite(fdc, drive_index, offset, size);
+  if (sector) {
+    return sector;
+  }
+  if (FDCApplyPendingWrites(fdc, drive_index, offset, NULL, size)) {
+    // Some but not all of the bytes have pending writes.
+    return NULL;
+  }
+  sector = FDCGetImageSector(fdc, drive_index, offset, size, false);
+  if (sector) {
+    return sector;
+  }
+  return FDCGetCachedImageSector(fdc, drive_index, offset, size);
+}
 
-  // Set Status Register 0 (ST0)
-  // Bits 7-6: Interrupt Code = 00 (Normal Termination)
-  // Bit 5: Seek End = 1
-  // Bits 1-0: Unit Select (Drive Index)
-  drive->st0 = kFDCST0NormalTermination | kFDCST0SeekEnd | drive_index;
+// Helper to read a byte from a disk image.
+static uint8_t FDCReadImageByte(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset) {
+  const uint8_t* sector =
+      FDCGetReadableImageSector(fdc, drive_index, offset, 1);
+  if (sector) {
+    return *sector;
+  }
+  if (fdc->config && fdc->config->read_image_byte) {
+    return fdc->config->read_image_byte(
+        fdc->config->context, drive_index, offset);
+  }
+  return 0;
+}
 
-  // Set interrupt pending flag for this drive.
-  drive->has_pending_interrupt = true;
+// Helper to write the pending writes of a drive to its disk image. Pending
+// writes to adjacent sectors of the same track are written in one step.
+// Returns false if any of them could not be written, in which case they stay
+// in the cache.
+static bool FDCFlushPendingWrites(FDCState* fdc, uint8_t drive_index) {
+  FDCWriteCache* cache = fdc->config ? fdc->config->write_cache : NULL;
+  if (!cache) {
+    return true;
+  }
+  const FDCDiskFormat* format = fdc->drives[drive_index].format;
+  bool has_flushed = false;
+  bool success = true;
+  // Pending writes below this offset have been flushed or failed to flush.
+  uint32_t min_offset = 0;
+  for (;;) {
+    // Find the pending write with the lowest offset.
+    FDCCachedSector* first = NULL;
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      FDCCachedSector* sector = &cache->sectors[i];
+      if (sector->dirty && sector->drive == drive_index &&
+          sector->offset >= min_offset &&
+          (!first || sector->offset < first->offset)) {
+        first = sector;
+      }
+    }
+    if (!first) {
+      break;
+    }
 
-  // Raise Interrupt (IRQ6).
-  FDCRaiseIRQ6(fdc);
+    // Gather the pending writes to the following sectors of the same track.
+    const uint32_t track_size =
+        format ? (uint32_t)format->num_sectors_per_track * format->sector_size
+               : first->size;
+    const uint32_t track_end =
+        first->offset - first->offset % track_size + track_size;
+    const uint32_t offset = first->offset;
+    uint16_t size = 0;
+    FDCCachedSector* sector = first;
+    while (sector && offset + size + sector->size <= track_end &&
+           size + sector->size <= kFDCTrackCacheSize) {
+      for (uint16_t i = 0; i < sector->size; ++i) {
+        cache->flush_buffer[size + i] = sector->data[i];
+      }
+      size += sector->size;
+      sector = FDCFindCachedSector(cache, drive_index, offset + size);
+    }
+    min_offset = offset + size;
 
-  FDCFinishCommandExecution(fdc);
+    if (!FDCWriteImageDirect(
+            fdc, drive_index, offset, cache->flush_buffer, size)) {
+      success = false;
+      continue;
+    }
+    for (uint32_t i = offset; i < offset + size;) {
+      FDCCachedSector* flushed = FDCFindCachedSector(cache, drive_index, i);
+      flushed->dirty = false;
+      i += flushed->size;
+    }
+    ++cache->num_image_writes;
+    cache->num_coalesced_bytes += size - first->size;
+    has_flushed = true;
+  }
+  if (has_flushed) {
+    ++cache->num_flushes;
+  }
+  return success;
 }
 
-// Compute the byte offset within a disk image for the given address. Returns
-// kFDCInvalidOffset if the address is out of range.
-//
-// In a raw image file, the data is laid out track by track, starting from the
-// outermost track (Track 0). Within each track, it reads all the data from the
-// first head (Head 0, the top side) and then all the data from the second head
-// (Head 1, the bottom side) before moving to the next track.
-// In other words, the layout is an array of
-// [num_tracks][num_heads][num_sectors_per_track].
-static inline uint32_t FDCComputeOffset(
-    FDCDiskFormat format, uint8_t head, uint8_t track, uint8_t sector,
-    uint16_t sector_offset) {
-  if (head >= format.num_heads || track >= format.num_tracks || sector == 0 ||
-      sector > format.num_sectors_per_track ||
-      sector_offset >= format.sector_size) {
-    return kFDCInvalidOffset;
+// Helper to get a free write cache entry, flushing pending writes if the
+// cache is full. Returns NULL if none of the pending writes could be written.
+static FDCCachedSector* FDCAllocateCachedSector(FDCState* fdc) {
+  FDCWriteCache* cache = fdc->config->write_cache;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      if (!cache->sectors[i].dirty) {
+        return &cache->sectors[i];
+      }
+    }
+    if (pass == 0) {
+      FDCFlush(fdc);
+    }
   }
-
-  uint32_t offset = 0;
-  // Seek to start of the track
-  offset += (uint32_t)track * format.num_heads * format.num_sectors_per_track *
-            format.sector_size;
-  // Seek to start of the head within the track
-  offset += (uint32_t)head * format.num_sectors_per_track * format.sector_size;
-  // Seek to start of the sector within the head
-  offset += (uint32_t)(sector - 1) * format.sector_size;
-  // Add byte offset within the sector
-  offset += (uint32_t)sector_offset;
-
-  return offset;
+  return NULL;
 }
 
-// Helper to finish a read/write command.
-static void FDCFinishReadWrite(
-    FDCState* fdc, uint8_t st0, uint8_t st1, uint8_t st2) {
-  FDCResultBufferAppend(&fdc->result_buffer, &st0);
-  FDCResultBufferAppend(&fdc->result_buffer, &st1);
-  FDCResultBufferAppend(&fdc->result_buffer, &st2);
-  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.cylinder);
-  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.head);
-  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.sector);
-  FDCResultBufferAppend(&fdc->result_buffer, &fdc->transfer.sector_size_code);
+// Helper to write bytes to a disk image, via the write cache if set. Returns
+// false if the bytes, or pending writes flushed to make room for them, could
+// not be written.
+static bool FDCWriteImage(
+    FDCState* fdc, uint8_t drive_index, uint32_t offset, const uint8_t* data,
+    uint16_t size) {
+  const uint16_t sector_size = FDCGetWriteCacheSectorSize(fdc, drive_index);
+  if (sector_size == 0) {
+    FDCUpdateCachedTrack(fdc, drive_index, offset, data, size);
+    return FDCWriteImageDirect(fdc, drive_index, offset, data, size);
+  }
+  // Writes held in the cache could never be flushed.
+  if (!FDCCanWriteImage(fdc, drive_index, offset, size)) {
+    return false;
+  }
 
-  FDCRaiseIRQ6(fdc);
-  FDCFinishCommandExecution(fdc);
+  FDCWriteCache* cache = fdc->config->write_cache;
+  for (uint16_t i = 0; i < size;) {
+    const uint32_t sector_offset = (offset + i) - (offset + i) % sector_size;
+    uint16_t num_bytes = (uint16_t)(sector_offset + sector_size - offset - i);
+    if (num_bytes > size - i) {
+      num_bytes = size - i;
+    }
+    FDCCachedSector* sector =
+        FDCFindCachedSector(cache, drive_index, sector_offset);
+    if (!sector) {
+      sector = FDCAllocateCachedSector(fdc);
+      if (!sector) {
+        return false;
+      }
+      if (num_bytes < sector_size) {
+        // Read the rest of the sector from the image.
+        const uint8_t* image_sector = FDCGetReadableImageSector(
+            fdc, drive_index, sector_offset, sector_size);
+        for (uint16_t j = 0; j < sector_size; ++j) {
+          sector->data[j] =
+              image_sector ? image_sector[j]
+                           : FDCReadImageByte(
+                                 fdc, drive_index, sector_offset + j);
+        }
+      }
+      sector->dirty = true;
+      sector->drive = drive_index;
+      sector->offset = sector_offset;
+      sector->size = sector_size;
+    }
+    for (uint16_t j = 0; j < num_bytes; ++j) {
+      sector->data[offset + i - sector_offset + j] = data[i + j];
+    }
+    i += num_bytes;
+  }
+  // Reading the rest of a partially written sector may have filled the track
+  // cache, so the track cache is updated last.
+  FDCUpdateCachedTrack(fdc, drive_index, offset, data, size);
+  return true;
 }
 
 // Handler for Write Data command.
@@ -7585,13 +12847,10 @@ static void FDCHandleWriteData(FDCState* fdc) {
 
   // Execution Loop.
 
-  // Check for Terminal Count (TC).
-  if (fdc->transfer.tc_received) {
+  // Check for Terminal Count (TC) while waiting for the next byte.
+  if (fdc->transfer.tc_received && fdc->transfer.dma_request_active) {
     // Transfer complete.
-    uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-    uint8_t head_address = (fdc->transfer.head & 0x01);
-    FDCFinishReadWrite(
-        fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+    FDCFinishTransfer(fdc);
     return;
   }
 
@@ -7600,75 +12859,113 @@ static void FDCHandleWriteData(FDCState* fdc) {
     return;
   }
 
-  // Data has arrived in data_register. Write it to image.
   uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-  if (fdc->config && fdc->config->write_image_byte) {
-    fdc->config->write_image_byte(
-        fdc->config->context, drive_index, fdc->transfer.current_offset,
-        fdc->transfer.data_register);
-  }
+  const uint16_t sector_size = FDCGetSectorSize(fdc);
+  for (;;) {
+    // Data has arrived in data_register. In block transfer mode, fetch the
+    // rest of the sector along with it, directly into the image if possible.
+    uint16_t size = 1;
+    if (FDCCanTransferBlock(fdc, sector_size) && !fdc->transfer.tc_received) {
+      size = sector_size - fdc->transfer.sector_byte_index;
+    }
+    uint8_t* sector =
+        (size > 1 && !fdc->config->write_cache)
+            ? FDCGetImageSector(
+                  fdc, drive_index, fdc->transfer.current_offset, size, true)
+            : NULL;
+    uint8_t* data = sector ? sector : fdc->transfer.block_buffer;
+    uint16_t num_bytes = 1;
+    data[0] = fdc->transfer.data_register;
+    if (size > 1) {
+      num_bytes += fdc->config->transfer_dma_block(
+          fdc->config->context, data + 1, size - 1, false);
+      fdc->transfer.data_register = data[num_bytes - 1];
+    }
 
-  // Advance pointers.
-  fdc->transfer.current_offset++;
-  fdc->transfer.sector_byte_index++;
+    // Write data to image.
+    if (sector) {
+      FDCUpdateCachedTrack(
+          fdc, drive_index, fdc->transfer.current_offset, data, num_bytes);
+    } else if (!FDCWriteImage(
+                   fdc, drive_index, fdc->transfer.current_offset, data,
+                   num_bytes)) {
+      // Write fault.
+      FDCFinishReadWrite(
+          fdc,
+          kFDCST0AbnormalTermination | kFDCST0EquipmentCheck |
+              (fdc->transfer.head & 0x01) << 2 | drive_index,
+          0, 0);
+      return;
+    }
 
-  // Calculate sector size.
-  uint16_t sector_size;
-  uint8_t dtl = *FDCCommandBufferGet(&fdc->command_buffer, 8);
-  if (fdc->transfer.sector_size_code == 0) {
-    sector_size = dtl;
-  } else {
-    sector_size = 128 << fdc->transfer.sector_size_code;
+    // Advance pointers.
+    fdc->transfer.current_offset += num_bytes;
+    fdc->transfer.sector_byte_index += num_bytes;
+
+    // Check for sector boundary, and for the last byte before TC.
+    if ((fdc->transfer.sector_byte_index >= sector_size &&
+         !FDCAdvanceSector(fdc, drive_index)) ||
+        fdc->transfer.tc_received) {
+      FDCFinishTransfer(fdc);
+      return;
+    }
+
+    // Request next byte via DMA.
+    fdc->transfer.dma_request_active = true;
+    if (fdc->config && fdc->config->request_dma) {
+      fdc->config->request_dma(fdc->config->context);
+    }
+
+    // Without block transfers, only one byte is written per tick.
+    if (!FDCCanTransferBlock(fdc, sector_size) ||
+        fdc->transfer.dma_request_active) {
+      return;
+    }
   }
+}
 
-  // Check for sector boundary.
-  if (fdc->transfer.sector_byte_index >= sector_size) {
-    // Sector done.
-    if (fdc->transfer.sector >= fdc->transfer.eot) {
-      // End of Track reached.
-      if (fdc->transfer.multi_track && (fdc->transfer.head & 1) == 0) {
-        // Multi-Track rollover.
-        fdc->transfer.head ^= 1;
-        fdc->transfer.sector = 1;
-        fdc->transfer.sector_byte_index = 0;
-
-        // Recompute offset.
-        FDCDriveState* drive = &fdc->drives[drive_index];
-        fdc->transfer.current_offset = FDCComputeOffset(
-            *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-            fdc->transfer.sector, 0);
-
-        if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-          fdc->transfer.tc_received = true;
-          return;  // Stop here, don't request next byte.
-        }
-      } else {
-        // Terminate.
-        fdc->transfer.sector++;
-        fdc->transfer.tc_received = true;
-        return;  // Stop here.
-      }
-    } else {
-      // Next sector.
-      fdc->transfer.sector++;
-      fdc->transfer.sector_byte_index = 0;
-      FDCDriveState* drive = &fdc->drives[drive_index];
-      fdc->transfer.current_offset = FDCComputeOffset(
-          *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-          fdc->transfer.sector, 0);
-
-      if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-        fdc->transfer.tc_received = true;
-        return;
+// Helper to transfer the rest of the current sector and the following sectors
+// of a Read Data command in one step with the transfer_dma_block callback,
+// until TC or the end of the transfer. Returns false if DMA was not ready for a
+// block transfer, in which case nothing was transferred.
+static bool FDCReadDataBlocks(
+    FDCState* fdc, uint8_t drive_index, uint16_t sector_size) {
+  if (!FDCCanTransferBlock(fdc, sector_size)) {
+    return false;
+  }
+  bool has_transferred = false;
+  while (!fdc->transfer.tc_received) {
+    // Read the rest of the sector from the image, directly if possible.
+    const uint16_t size = sector_size - fdc->transfer.sector_byte_index;
+    uint8_t* data = FDCGetReadableImageSector(
+        fdc, drive_index, fdc->transfer.current_offset, size);
+    if (!data) {
+      data = fdc->transfer.block_buffer;
+      for (uint16_t i = 0; i < size; ++i) {
+        data[i] = FDCReadImageByte(
+            fdc, drive_index, fdc->transfer.current_offset + i);
       }
     }
-  }
 
-  // Request next byte via DMA.
-  fdc->transfer.dma_request_active = true;
-  if (fdc->config && fdc->config->request_dma) {
-    fdc->config->request_dma(fdc->config->context);
+    // Transfer it to memory. This stops early on TC.
+    const uint16_t num_bytes = fdc->config->transfer_dma_block(
+        fdc->config->context, data, size, true);
+    if (num_bytes == 0) {
+      break;
+    }
+    has_transferred = true;
+    fdc->transfer.data_register = data[num_bytes - 1];
+
+    // Advance pointers.
+    fdc->transfer.current_offset += num_bytes;
+    fdc->transfer.sector_byte_index += num_bytes;
+
+    // Check for sector boundary.
+    if (fdc->transfer.sector_byte_index >= sector_size) {
+      FDCAdvanceSector(fdc, drive_index);
+    }
   }
+  return has_transferred;
 }
 
 // Handler for Read Data command.
@@ -7728,10 +13025,7 @@ static void FDCHandleReadData(FDCState* fdc) {
   // Check for Terminal Count (TC).
   if (fdc->transfer.tc_received) {
     // Transfer complete.
-    uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-    uint8_t head_address = (fdc->transfer.head & 0x01);
-    FDCFinishReadWrite(
-        fdc, kFDCST0NormalTermination | head_address << 2 | drive_index, 0, 0);
+    FDCFinishTransfer(fdc);
     return;
   }
 
@@ -7740,15 +13034,16 @@ static void FDCHandleReadData(FDCState* fdc) {
     return;
   }
 
-  // Read next byte.
   uint8_t drive_index = *FDCCommandBufferGet(&fdc->command_buffer, 1) & 0x03;
-  if (fdc->config && fdc->config->read_image_byte) {
-    fdc->transfer.data_register = fdc->config->read_image_byte(
-        fdc->config->context, drive_index, fdc->transfer.current_offset);
-  } else {
-    fdc->transfer.data_register = 0;
+  const uint16_t sector_size = FDCGetSectorSize(fdc);
+  if (FDCReadDataBlocks(fdc, drive_index, sector_size)) {
+    return;
   }
 
+  // Read next byte.
+  fdc->transfer.data_register =
+      FDCReadImageByte(fdc, drive_index, fdc->transfer.current_offset);
+
   // Advance pointers.
   fdc->transfer.current_offset++;
   fdc->transfer.sector_byte_index++;
@@ -7759,57 +13054,9 @@ static void FDCHandleReadData(FDCState* fdc) {
     fdc->config->request_dma(fdc->config->context);
   }
 
-  // Calculate sector size again for boundary check.
-  uint16_t sector_size;
-  uint8_t dtl = *FDCCommandBufferGet(&fdc->command_buffer, 8);
-  if (fdc->transfer.sector_size_code == 0) {
-    sector_size = dtl;
-  } else {
-    sector_size = 128 << fdc->transfer.sector_size_code;
-  }
-
   // Check for sector boundary.
   if (fdc->transfer.sector_byte_index >= sector_size) {
-    // Sector done.
-    if (fdc->transfer.sector >= fdc->transfer.eot) {
-      // End of Track reached.
-      if (fdc->transfer.multi_track && (fdc->transfer.head & 1) == 0) {
-        // Multi-Track rollover: Side 0 -> Side 1.
-        fdc->transfer.head ^= 1;   // Flip to Head 1
-        fdc->transfer.sector = 1;  // Reset to Sector 1
-        fdc->transfer.sector_byte_index = 0;
-
-        // Recompute offset for new head/sector.
-        FDCDriveState* drive = &fdc->drives[drive_index];
-        fdc->transfer.current_offset = FDCComputeOffset(
-            *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-            fdc->transfer.sector, 0);
-
-        if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-          fdc->transfer.tc_received = true;
-        }
-      } else {
-        // Standard termination (MT=0 or already on Head 1).
-        // Increment sector so result phase reports the *next* logical sector.
-        fdc->transfer.sector++;
-        fdc->transfer.tc_received = true;
-      }
-    } else {
-      // Move to next sector.
-      fdc->transfer.sector++;
-      fdc->transfer.sector_byte_index = 0;
-      // Recompute offset for new sector.
-      FDCDriveState* drive = &fdc->drives[drive_index];
-      fdc->transfer.current_offset = FDCComputeOffset(
-          *drive->format, fdc->transfer.head, fdc->transfer.cylinder,
-          fdc->transfer.sector, 0);
-
-      if (fdc->transfer.current_offset == kFDCInvalidOffset) {
-        // Should not happen if EOT is correct, but if we ran off the end
-        // of the image despite EOT, terminate.
-        fdc->transfer.tc_received = true;
-      }
-    }
+    FDCAdvanceSector(fdc, drive_index);
   }
 }
 
@@ -7914,6 +13161,38 @@ void FDCInit(FDCState* fdc, FDCConfig* config) {
   fdc->config = config;
 }
 
+void FDCInitTrackCache(FDCTrackCache* cache) {
+  for (int i = 0; i < kFDCNumDrives; ++i) {
+    cache->tracks[i].valid = false;
+  }
+  cache->num_hits = 0;
+  cache->num_fills = 0;
+}
+
+void FDCInitWriteCache(FDCWriteCache* cache) {
+  for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+    cache->sectors[i].dirty = false;
+  }
+  cache->num_flushes = 0;
+  cache->num_image_writes = 0;
+  cache->num_coalesced_bytes = 0;
+}
+
+// Drop a drive's cached track and pending writes after its disk was changed.
+static void FDCInvalidateCaches(FDCState* fdc, uint8_t drive) {
+  if (fdc->config && fdc->config->track_cache) {
+    fdc->config->track_cache->tracks[drive].valid = false;
+  }
+  if (fdc->config && fdc->config->write_cache) {
+    for (int i = 0; i < kFDCWriteCacheNumSectors; ++i) {
+      FDCCachedSector* sector = &fdc->config->write_cache->sectors[i];
+      if (sector->drive == drive) {
+        sector->dirty = false;
+      }
+    }
+  }
+}
+
 // Looks up command metadata by opcode. Returns NULL if not found. This is a
 // linear search, but the command table is small enough that this is fine.
 static const FDCCommandMetadata* FDCFindCommandMetadata(uint8_t opcode) {
@@ -8105,24 +13384,41 @@ void FDCWritePort(FDCState* fdc, uint16_t port, uint8_t value) {
 
 void FDCHandleTC(FDCState* fdc) { fdc->transfer.tc_received = true; }
 
-void FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format) {
+bool FDCInsertDisk(FDCState* fdc, uint8_t drive, const FDCDiskFormat* format) {
   if (drive >= kFDCNumDrives) {
-    return;
+    return true;
   }
   FDCDriveState* drive_state = &fdc->drives[drive];
+  const bool success =
+      !drive_state->present || FDCFlushPendingWrites(fdc, drive);
   drive_state->present = true;
   drive_state->format = format;
   drive_state->head = 0;
   drive_state->track = 0;
+  FDCInvalidateCaches(fdc, drive);
+  return success;
 }
 
-void FDCEjectDisk(FDCState* fdc, uint8_t drive) {
+bool FDCEjectDisk(FDCState* fdc, uint8_t drive) {
   if (drive >= kFDCNumDrives) {
-    return;
+    return true;
   }
+  const bool success = FDCFlushPendingWrites(fdc, drive);
   FDCDriveState* drive_state = &fdc->drives[drive];
   drive_state->present = false;
   drive_state->format = NULL;
+  FDCInvalidateCaches(fdc, drive);
+  return success;
+}
+
+bool FDCFlush(FDCState* fdc) {
+  bool success = true;
+  for (uint8_t drive = 0; drive < kFDCNumDrives; ++drive) {
+    if (!FDCFlushPendingWrites(fdc, drive)) {
+      success = false;
+    }
+  }
+  return success;
 }
 
 void FDCTick(FDCState* fdc) {
@@ -8384,6 +13680,11 @@ void KeyboardHandleKeyPress(KeyboardState* keyboard, uint8_t scancode);
 // send buffered scancodes.
 void KeyboardTickMs(KeyboardState* keyboard);
 
+// Returns whether the next call to KeyboardTickMs() would do anything, i.e. a
+// reset timer is running or a buffered scancode can be sent. If this returns
+// false, the keyboard does not need to be ticked until its state changes.
+bool KeyboardNeedsTick(const KeyboardState* keyboard);
+
 #endif  // YAX86_KEYBOARD_PUBLIC_H
 
 
@@ -8520,6 +13821,16 @@ void KeyboardTickMs(KeyboardState* keyboard) {
   KeyboardSendNextScancode(keyboard);
 }
 
+bool KeyboardNeedsTick(const KeyboardState* keyboard) {
+  // Waiting for the clock line to be held low long enough to trigger reset.
+  if (keyboard->clock_low == false) {
+    return keyboard->clock_low_ms != kKeyboardResetTriggered;
+  }
+  // Waiting to send the next scancode.
+  return keyboard->enable_clear == false && !keyboard->waiting_for_ack &&
+         KeyboardBufferLength(&keyboard->buffer) > 0;
+}
+
 
 
 // ==============================================================================
@@ -8657,6 +13968,11 @@ typedef struct PICState {
   // The register to read on the next read from the data port.
   PICReadRegister read_register;
 
+  // Vector number of the interrupt that PICGetPendingInterrupt() would
+  // deliver, or kPICNoPendingInterrupt. Kept up to date whenever IRR, IMR or
+  // ISR change, so that the CPU does not need to poll the PIC.
+  uint8_t pending_interrupt;
+
   // Pointer to master PIC if this is a slave, or to slave PIC if this is a
   // master. NULL if this is a single PIC.
   struct PICState* cascade_pic;
@@ -8704,6 +14020,12 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value);
 // PIC as well. If no interrupts are pending, returns kPICNoPendingInterrupt.
 uint8_t PICGetPendingInterrupt(PICState* pic);
 
+// Returns whether PICGetPendingInterrupt() would deliver an interrupt. This is
+// cheap enough to check after every instruction.
+static inline bool PICHasPendingInterrupt(const PICState* pic) {
+  return pic->pending_interrupt != kPICNoPendingInterrupt;
+}
+
 #endif  // YAX86_PIC_PUBLIC_H
 
 
@@ -8763,6 +14085,27 @@ static const uint16_t kPICBasePorts[kPICNumModes] = {
     0xA0,  // kPICSlave
 };
 
+// Map a register value to the index of its lowest set bit, i.e. the highest
+// priority IRQ in the register. Maps 0 to 8.
+static const uint8_t kPICLowestSetBit[256] = {
+    8, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+    4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+
 // ============================================================================
 // Helper functions
 // ============================================================================
@@ -8809,6 +14152,35 @@ static inline uint8_t PICGetCascadeIRQ(PICState* pic) {
   return pic->icw3 & 0x07;
 }
 
+// Returns the highest priority IRQ that is requested, unmasked and has higher
+// priority than all interrupts in service, or 8 if there is none.
+static inline uint8_t PICGetDeliverableIRQ(PICState* pic) {
+  uint8_t irr = pic->irr & ~pic->imr;
+  // Only IRQs with a lower number than the highest priority in-service IRQ
+  // can interrupt it.
+  uint8_t priority_mask = (uint8_t)((1 << kPICLowestSetBit[pic->isr]) - 1);
+  return kPICLowestSetBit[irr & priority_mask];
+}
+
+// Recompute the cached pending interrupt vector after a change to IRR, IMR,
+// ISR or the ICWs. A slave PIC also updates its master, whose pending
+// interrupt vector depends on the slave's.
+static void PICUpdatePendingInterrupt(PICState* pic) {
+  uint8_t irq = PICGetDeliverableIRQ(pic);
+  if (irq >= 8) {
+    pic->pending_interrupt = kPICNoPendingInterrupt;
+  } else if (PICIsMaster(pic) && irq == kMasterCascadeIRQ &&
+             pic->cascade_pic) {
+    pic->pending_interrupt = pic->cascade_pic->pending_interrupt;
+  } else {
+    pic->pending_interrupt = (pic->icw2 & kICW2_BASE) + irq;
+  }
+
+  if (PICIsSlave(pic) && pic->cascade_pic) {
+    PICUpdatePendingInterrupt(pic->cascade_pic);
+  }
+}
+
 // ============================================================================
 // PIC initialization
 // ============================================================================
@@ -8821,6 +14193,7 @@ void PICInit(PICState* pic, PICConfig* config) {
 
   // All interrupts masked by default.
   pic->imr = 0xFF;
+  pic->pending_interrupt = kPICNoPendingInterrupt;
 }
 
 // ============================================================================
@@ -8832,6 +14205,7 @@ void PICRaiseIRQ(PICState* pic, uint8_t irq) {
     return;
   }
   pic->irr |= (1 << irq);
+  PICUpdatePendingInterrupt(pic);
 
   // If this is a slave PIC, also raise the cascade IRQ on the master.
   if (PICIsSlave(pic) && pic->cascade_pic) {
@@ -8844,6 +14218,7 @@ void PICLowerIRQ(PICState* pic, uint8_t irq) {
     return;
   }
   pic->irr &= ~(1 << irq);
+  PICUpdatePendingInterrupt(pic);
 
   // If this is a slave PIC and no interrupts are pending, lower the cascade
   // IRQ on the master.
@@ -8920,12 +14295,7 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
               pic->isr &= ~(1 << irq);
             } else {
               // Non-Specific EOI: clear highest priority ISR bit.
-              for (uint8_t i = 0, isr_mask = 1; i < 8; ++i, isr_mask <<= 1) {
-                if (pic->isr & isr_mask) {
-                  pic->isr &= ~isr_mask;
-                  break;
-                }
-              }
+              pic->isr &= pic->isr - 1;
             }
           } else {
             // Other OCW2 commands (Rotate) are not implemented as they are not
@@ -8974,8 +14344,10 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
 
     default:
       // Invalid port - ignore.
-      break;
+      return;
   }
+
+  PICUpdatePendingInterrupt(pic);
 }
 
 // ============================================================================
@@ -8983,32 +14355,13 @@ void PICWritePort(PICState* pic, uint16_t port, uint8_t value) {
 // ============================================================================
 
 uint8_t PICGetPendingInterrupt(PICState* pic) {
-  // Find highest priority requested and unmasked interrupt.
-  uint8_t irr = pic->irr & ~pic->imr;
-  if (irr == 0) {
+  // Find highest priority requested and unmasked interrupt that has higher
+  // priority than any interrupt already being serviced.
+  uint8_t pending_irq = PICGetDeliverableIRQ(pic);
+  if (pending_irq >= 8) {
     return kPICNoPendingInterrupt;
   }
-  uint8_t pending_irq = 0, pending_irq_mask = 1;
-  for (; pending_irq < 8; ++pending_irq, pending_irq_mask <<= 1) {
-    if (irr & pending_irq_mask) {
-      break;
-    }
-  }
-
-  // If there is already an interrupt being serviced, the new pending interrupt
-  // must have higher priority (lower IRQ number) to be serviced now.
-  if (pic->isr > 0) {
-    uint8_t in_service_irq = 0, in_service_irq_mask = 1;
-    for (; in_service_irq < 8; ++in_service_irq, in_service_irq_mask <<= 1) {
-      if (pic->isr & in_service_irq_mask) {
-        break;
-      }
-    }
-    if (pending_irq >= in_service_irq) {
-      // New interrupt does not have higher priority than in-service interrupt.
-      return kPICNoPendingInterrupt;
-    }
-  }
+  uint8_t pending_irq_mask = (uint8_t)(1 << pending_irq);
 
   // If this is the master PIC and the interrupt is from the slave, return the
   // slave PIC's interrupt vector.
@@ -9017,6 +14370,7 @@ uint8_t PICGetPendingInterrupt(PICState* pic) {
     uint8_t slave_vector = PICGetPendingInterrupt(pic->cascade_pic);
     if (slave_vector != kPICNoPendingInterrupt) {
       pic->isr |= pending_irq_mask;
+      PICUpdatePendingInterrupt(pic);
     }
     return slave_vector;
   }
@@ -9024,12 +14378,12 @@ uint8_t PICGetPendingInterrupt(PICState* pic) {
   // This is a normal interrupt on this PIC (or it's a slave reporting up).
   pic->isr |= pending_irq_mask;
   pic->irr &= ~pending_irq_mask;
+  PICUpdatePendingInterrupt(pic);
 
   return (pic->icw2 & kICW2_BASE) + pending_irq;
 }
 
 
-
 // ==============================================================================
 // src/pic/pic.c end
 // ==============================================================================
@@ -9147,6 +14501,10 @@ typedef struct PITChannelState {
   PITByte rw_byte;
   // Whether a latch command is active.
   bool latch_active;
+  // Value of PITState.ticks at which counter and output_state were last
+  // brought up to date. Channels are only updated when accessed, except for
+  // channel 0 which is updated by PITTick() and PITAdvance().
+  uint32_t sync_ticks;
 } PITChannelState;
 
 // State of the PIT.
@@ -9156,6 +14514,9 @@ typedef struct PITState {
 
   // The three timer channels.
   PITChannelState channels[kPITNumChannels];
+
+  // Number of ticks of the PIT's input clock so far.
+  uint32_t ticks;
 } PITState;
 
 // Initializes the PIT to its power-on state.
@@ -9171,6 +14532,22 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value);
 // invoked at a frequency of 1.193182 MHz for accurate timing.
 void PITTick(PITState* pit);
 
+// Simulates num_ticks ticks of the PIT's input clock, with the same result as
+// calling PITTick() num_ticks times. Counters are computed from the elapsed
+// time, so this only takes time proportional to the number of output changes.
+void PITAdvance(PITState* pit, uint32_t num_ticks);
+
+enum {
+  // Return value of PITGetTicksUntilIRQ0() when IRQ 0 will not be raised.
+  kPITNoIRQ0 = 0,
+};
+
+// Returns the number of ticks until channel 0 next raises IRQ 0, i.e. the
+// number of ticks to pass to PITAdvance() for the IRQ to be raised on the last
+// tick. Returns kPITNoIRQ0 if channel 0 will not raise IRQ 0 unless it is
+// reprogrammed.
+uint32_t PITGetTicksUntilIRQ0(PITState* pit);
+
 #endif  // YAX86_PIT_PUBLIC_H
 
 
@@ -9198,6 +14575,9 @@ enum {
   // Fallback reload value when 0 is written to the counter. The hardware
   // treats a reload value of 0 as 0x10000.
   kPITFallbackReloadValue = 0x10000,
+  // Channel index used when simulating a copy of a channel, so that output
+  // changes have no side effects.
+  kPITSimulatedChannel = -1,
 };
 
 // Specifies the behavior of a timer channel in a specific mode (0-5).
@@ -9207,6 +14587,14 @@ typedef struct PITModeMetadata {
   // Callback to handle a tick for this mode.
   void (*handle_tick)(
       PITState* pit, PITChannelState* channel, int channel_index);
+  // Amount the counter is decremented by on each tick.
+  uint8_t counter_step;
+  // Returns the number of ticks until the next tick on which handle_tick does
+  // more than decrement the counter by counter_step, or 0 if there is none.
+  uint32_t (*get_ticks_until_transition)(const PITChannelState* channel);
+  // Returns the number of ticks after which a channel that was just reloaded
+  // returns to the same state, or 0 if the mode is not periodic.
+  uint32_t (*get_period)(const PITChannelState* channel);
 } PITModeMetadata;
 
 // Metadata for unsupported modes (1, 4, 5).
@@ -9234,24 +14622,34 @@ static inline void PITChannelSetOutputState(
 // Tick handler for Mode 0: Interrupt on Terminal Count.
 static void PITMode0HandleTick(
     PITState* pit, PITChannelState* channel, int channel_index) {
-  // Since this is a one-shot timer, do nothing if the counter is already 0.
-  if (channel->counter == 0) {
-    return;
-  }
-
-  // Decrement the counter by 1.
+  // Decrement the counter by 1. Like the hardware, the counter keeps wrapping
+  // around after terminal count, so a count of 0 is treated as 0x10000.
   --channel->counter;
 
-  // If at terminal count, set output high and trigger terminal count.
+  // If at terminal count, set output high and trigger terminal count. The
+  // output then stays high until the channel is reprogrammed.
   if (channel->counter == 0) {
     PITChannelSetOutputState(pit, channel, channel_index, true);
   }
 }
 
+static uint32_t PITMode0GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  // Once the output is high, the channel only counts down.
+  if (channel->output_state) {
+    return 0;
+  }
+  // Terminal count is reached when the counter reaches 0.
+  return channel->counter ? channel->counter : kPITFallbackReloadValue;
+}
+
 // Metadata for Mode 0: Interrupt on Terminal Count.
 static const PITModeMetadata kPITMode0Metadata = {
     .initial_output_state = false,
     .handle_tick = PITMode0HandleTick,
+    .counter_step = 1,
+    .get_ticks_until_transition = PITMode0GetTicksUntilTransition,
+    .get_period = NULL,
 };
 
 // Tick handler for Mode 2: Rate Generator.
@@ -9275,10 +14673,26 @@ static void PITMode2HandleTick(
   }
 }
 
+static uint32_t PITMode2GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  // The next transition is when the counter is decremented to 1, or to 0 if
+  // it is already 1.
+  uint16_t ticks_until_one = channel->counter - 1;
+  return ticks_until_one ? ticks_until_one : 1;
+}
+
+static uint32_t PITMode2GetPeriod(const PITChannelState* channel) {
+  return channel->reload_value ? channel->reload_value
+                               : kPITFallbackReloadValue;
+}
+
 // Metadata for Mode 2: Rate Generator.
 static const PITModeMetadata kPITMode2Metadata = {
     .initial_output_state = true,
     .handle_tick = PITMode2HandleTick,
+    .counter_step = 1,
+    .get_ticks_until_transition = PITMode2GetTicksUntilTransition,
+    .get_period = PITMode2GetPeriod,
 };
 
 // Tick handler for Mode 3: Square Wave Generator.
@@ -9301,10 +14715,33 @@ static void PITMode3HandleTick(
   }
 }
 
+// Returns the number of ticks for a Mode 3 counter to count down from a value
+// to terminal count.
+static inline uint32_t PITMode3GetTicksUntilTerminalCount(uint16_t counter) {
+  if (counter == 0) {
+    return kPITFallbackReloadValue / 2;
+  }
+  // Even values reach 0, and odd values wrap around to 0xFFFF.
+  return ((uint32_t)counter + 1) / 2;
+}
+
+static uint32_t PITMode3GetTicksUntilTransition(
+    const PITChannelState* channel) {
+  return PITMode3GetTicksUntilTerminalCount(channel->counter);
+}
+
+static uint32_t PITMode3GetPeriod(const PITChannelState* channel) {
+  // The output toggles twice per period.
+  return 2 * PITMode3GetTicksUntilTerminalCount(channel->reload_value);
+}
+
 // Metadata for Mode 3: Square Wave Generator.
 static const PITModeMetadata kPITMode3Metadata = {
     .initial_output_state = true,
     .handle_tick = PITMode3HandleTick,
+    .counter_step = 2,
+    .get_ticks_until_transition = PITMode3GetTicksUntilTransition,
+    .get_period = PITMode3GetPeriod,
 };
 
 // Array of mode metadata indexed by mode number.
@@ -9317,6 +14754,54 @@ static const PITModeMetadata* kPITModeMetadata[kPITNumModes] = {
     &kPITUnsupportedMode,  // Mode 5 (unsupported)
 };
 
+// Returns the metadata for a channel's mode, or NULL if the channel does not
+// count in its mode.
+static inline const PITModeMetadata* PITGetCountingModeMetadata(
+    const PITChannelState* channel) {
+  if (channel->mode >= kPITNumModes) {
+    // Invalid mode - ignore.
+    return NULL;
+  }
+  const PITModeMetadata* mode_metadata = kPITModeMetadata[channel->mode];
+  return mode_metadata->handle_tick ? mode_metadata : NULL;
+}
+
+// Advance a channel by num_ticks ticks, with the same result as calling its
+// tick handler num_ticks times. Only ticks with transitions are handled one by
+// one, so this takes time proportional to the number of output transitions.
+static void PITChannelAdvance(
+    PITState* pit, PITChannelState* channel, int channel_index,
+    uint32_t num_ticks) {
+  const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+  if (!mode_metadata) {
+    return;
+  }
+  while (num_ticks > 0) {
+    uint32_t ticks = mode_metadata->get_ticks_until_transition(channel);
+    if (ticks == 0 || ticks > num_ticks) {
+      channel->counter -= (uint16_t)(num_ticks * mode_metadata->counter_step);
+      return;
+    }
+    channel->counter -= (uint16_t)((ticks - 1) * mode_metadata->counter_step);
+    mode_metadata->handle_tick(pit, channel, channel_index);
+    num_ticks -= ticks;
+    // If the channel was just reloaded and output changes have no side
+    // effects, skip over whole periods.
+    if (channel_index != 0 && mode_metadata->get_period &&
+        channel->counter == channel->reload_value) {
+      num_ticks %= mode_metadata->get_period(channel);
+    }
+  }
+}
+
+// Bring a channel's counter and output state up to date with the PIT's clock.
+static inline void PITChannelSync(
+    PITState* pit, PITChannelState* channel, int channel_index) {
+  uint32_t num_ticks = pit->ticks - channel->sync_ticks;
+  channel->sync_ticks = pit->ticks;
+  PITChannelAdvance(pit, channel, channel_index, num_ticks);
+}
+
 void PITInit(PITState* pit, PITConfig* config) {
   static const PITState zero_pit_state = {0};
   *pit = zero_pit_state;
@@ -9397,6 +14882,7 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value) {
         return;
       }
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
 
       PITAccessMode access_mode = (PITAccessMode)((value >> 4) & 0x03);
       if (access_mode == kPITAccessLatch) {
@@ -9424,6 +14910,7 @@ void PITWritePort(PITState* pit, uint16_t port, uint8_t value) {
       // Data port for a channel.
       int channel_index = port - kPITPortChannel0;
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
       PITChannelWritePort(pit, channel, channel_index, value);
       break;
     }
@@ -9484,6 +14971,7 @@ uint8_t PITReadPort(PITState* pit, uint16_t port) {
       // Data port for a channel.
       int channel_index = port - kPITPortChannel0;
       PITChannelState* channel = &pit->channels[channel_index];
+      PITChannelSync(pit, channel, channel_index);
       return PITChannelReadPort(pit, channel, channel_index);
     }
     default:
@@ -9493,17 +14981,52 @@ uint8_t PITReadPort(PITState* pit, uint16_t port) {
 }
 
 void PITTick(PITState* pit) {
+  // Bring all channels up to date, then run each channel's tick handler once.
   PITChannelState* channel = &pit->channels[0];
   for (int i = 0; i < kPITNumChannels; ++i, ++channel) {
-    if (channel->mode >= kPITNumModes) {
-      // Invalid mode - ignore.
-      continue;
-    }
-    const PITModeMetadata* mode_metadata = kPITModeMetadata[channel->mode];
-    if (mode_metadata->handle_tick) {
+    PITChannelSync(pit, channel, i);
+    channel->sync_ticks = pit->ticks + 1;
+    const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+    if (mode_metadata) {
       mode_metadata->handle_tick(pit, channel, i);
     }
   }
+  ++pit->ticks;
+}
+
+void PITAdvance(PITState* pit, uint32_t num_ticks) {
+  pit->ticks += num_ticks;
+  // Channel 0 raises IRQ 0, so bring it up to date right away. The other
+  // channels are brought up to date when accessed.
+  PITChannelSync(pit, &pit->channels[0], 0);
+}
+
+uint32_t PITGetTicksUntilIRQ0(PITState* pit) {
+  PITChannelState* channel = &pit->channels[0];
+  PITChannelSync(pit, channel, 0);
+  const PITModeMetadata* mode_metadata = PITGetCountingModeMetadata(channel);
+  if (!mode_metadata) {
+    return kPITNoIRQ0;
+  }
+  // Simulate a copy of the channel until the output rises. In every supported
+  // mode, this happens within 2 transitions if it happens at all.
+  PITChannelState simulated_channel = *channel;
+  uint32_t ticks = 0;
+  for (int i = 0; i < 2; ++i) {
+    uint32_t transition_ticks =
+        mode_metadata->get_ticks_until_transition(&simulated_channel);
+    if (transition_ticks == 0) {
+      break;
+    }
+    bool old_output_state = simulated_channel.output_state;
+    PITChannelAdvance(
+        pit, &simulated_channel, kPITSimulatedChannel, transition_ticks);
+    ticks += transition_ticks;
+    if (!old_output_state && simulated_channel.output_state) {
+      return ticks;
+    }
+  }
+  return kPITNoIRQ0;
 }
 
 
@@ -9671,10 +15194,22 @@ enum {
   // Conventional memory - first 640KB of physical memory, mapped to 0x00000 to
   // 0x9FFFF (640KB).
   kMemoryMapEntryConventional = 0,
+  // Open bus entry that unmapped addresses resolve to. Entries of this type
+  // cannot be registered.
+  kMemoryMapEntryNone = 0xFF,
 
   // Maximum number of memory map entries.
   kMaxMemoryMapEntries = 16,
 
+  // Size of the 8088's physical address space in bytes.
+  kMemoryAddressSpaceSize = kCPUMemoryAddressSpaceSize,
+  // Granularity of the memory map dispatch table in bytes. This matches the
+  // CPU's direct memory access page size so the same page tables can be
+  // shared with the CPU.
+  kMemoryMapPageSize = kCPUMemoryPageSize,
+  // Number of pages in the memory map dispatch table.
+  kNumMemoryMapPages = kMemoryAddressSpaceSize / kMemoryMapPageSize,
+
   // Maximum size of physical memory in bytes.
   kMaxPhysicalMemorySize = 640 * 1024,
   // Minimum size of physical memory in bytes.
@@ -9700,10 +15235,31 @@ typedef struct MemoryMapEntry {
   // address.
   void (*write_byte)(
       struct MemoryMapEntry* entry, uint32_t relative_address, uint8_t value);
+  // Optional callback to read a word from the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, read_byte is used.
+  uint16_t (*read_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address);
+  // Optional callback to write a word to the memory map entry, where address
+  // is relative to the start of the entry. Only invoked for words that lie
+  // entirely within the entry; otherwise, write_byte is used.
+  void (*write_word)(
+      struct MemoryMapEntry* entry, uint32_t relative_address, uint16_t value);
+
+  // Optional host memory backing the memory region, indexed by relative
+  // address. If set, reads are served directly from host memory and read_byte
+  // is not used.
+  const uint8_t* read_data;
+  // Optional writable host memory backing the memory region, indexed by
+  // relative address. If set, writes go directly to host memory and write_byte
+  // is not used. For RAM, this is typically the same buffer as read_data; for
+  // ROM, this should be left NULL.
+  uint8_t* write_data;
 } MemoryMapEntry;
 
 // Register a memory map entry in the platform state. Returns true if the entry
 // was successfully registered, or false if:
+//   - The entry's type is kMemoryMapEntryNone.
 //   - There already exists a memory map entry with the same type.
 //   - The new entry's memory region overlaps with an existing entry.
 //   - The number of memory map entries would exceed kMaxMemoryMapEntries.
@@ -9726,7 +15282,8 @@ MemoryMapEntry* GetMemoryMapEntryByType(
 // behavior.
 uint8_t ReadMemoryByte(struct PlatformState* platform, uint32_t address);
 // Read a word from a logical memory address by invoking the corresponding
-// memory map entry's read_byte callback.
+// memory map entry's read_word callback, or its read_byte callback if the word
+// straddles two memory map entries.
 uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 // Write a byte to a logical memory address by invoking the corresponding
 // memory map entry's write_byte callback.
@@ -9737,7 +15294,8 @@ uint16_t ReadMemoryWord(struct PlatformState* platform, uint32_t address);
 void WriteMemoryByte(
     struct PlatformState* platform, uint32_t address, uint8_t value);
 // Write a word to a logical memory address by invoking the corresponding
-// memory map entry's write_byte callback.
+// memory map entry's write_word callback, or its write_byte callback if the
+// word straddles two memory map entries.
 void WriteMemoryWord(
     struct PlatformState* platform, uint32_t address, uint16_t value);
 
@@ -9780,6 +15338,13 @@ typedef struct PortMapEntry {
   uint8_t (*read_byte)(struct PortMapEntry* entry, uint16_t port);
   // Callback to write a byte an I/O port within the range.
   void (*write_byte)(struct PortMapEntry* entry, uint16_t port, uint8_t value);
+  // Optional callback to read a word from an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, read_byte is used.
+  uint16_t (*read_word)(struct PortMapEntry* entry, uint16_t port);
+  // Optional callback to write a word to an I/O port and the next port. Only
+  // invoked if both ports are within the range; otherwise, write_byte is used.
+  void (*write_word)(
+      struct PortMapEntry* entry, uint16_t port, uint16_t value);
 } PortMapEntry;
 
 // Register an I/O port map entry in the platform state. Returns true if the
@@ -9801,14 +15366,17 @@ PortMapEntry* GetPortMapEntryByType(
 // entry's read_byte callback.
 uint8_t ReadPortByte(struct PlatformState* platform, uint16_t port);
 // Read a word from an I/O port by invoking the corresponding I/O port map
-// entry's read_byte callback. This reads two consecutive bytes from the port.
+// entry's read_word callback. This reads two consecutive ports, falling back to
+// read_byte if read_word is not set or the ports belong to different entries.
 uint16_t ReadPortWord(struct PlatformState* platform, uint16_t port);
 // Write a byte to an I/O port by invoking the corresponding I/O port map
 // entry's write_byte callback.
 void WritePortByte(
     struct PlatformState* platform, uint16_t port, uint8_t value);
 // Write a word to an I/O port by invoking the corresponding I/O port map
-// entry's write_byte callback. This writes two consecutive bytes to the port.
+// entry's write_word callback. This writes two consecutive ports, falling back
+// to write_byte if write_word is not set or the ports belong to different
+// entries.
 void WritePortWord(
     struct PlatformState* platform, uint16_t port, uint16_t value);
 
@@ -9816,6 +15384,38 @@ void WritePortWord(
 // Platform state
 // ============================================================================
 
+enum {
+  // Default maximum number of iterations of a repeated string instruction to
+  // run per CPU tick.
+  kPlatformDefaultMaxStringIterations = 64,
+  // BIOS keyboard services interrupt.
+  kPlatformKeyboardServiceInterrupt = 0x16,
+  // Maximum number of 8088 clock cycles between two INT 16h keyboard status
+  // checks for them to count as the same polling loop.
+  kPlatformMaxKeyboardPollInterval = 80000,
+  // Estimated average number of 8088 clock cycles per instruction, used to
+  // measure the time between keyboard status checks when
+  // PlatformConfig.use_clock_cycles is not set.
+  kPlatformAverageInstructionClockCycles = 8,
+};
+
+// BIOS keyboard services used by the guest to check for a key press, in AH.
+enum {
+  // Check for a key press.
+  kPlatformKeyboardServiceCheckKey = 0x01,
+  // Check for a key press on an enhanced keyboard.
+  kPlatformKeyboardServiceCheckExtendedKey = 0x11,
+};
+
+enum {
+  // Opcode of the INT imm8 instruction.
+  kPlatformINTOpcode = 0xCD,
+  // Address of the keyboard buffer head pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferHeadAddress = 0x41A,
+  // Address of the keyboard buffer tail pointer in the BIOS data area.
+  kPlatformBIOSKeyboardBufferTailAddress = 0x41C,
+};
+
 // Caller-provided runtime configuration.
 typedef struct PlatformConfig {
   // Custom data passed through to callbacks.
@@ -9824,6 +15424,61 @@ typedef struct PlatformConfig {
   // Physical memory size in bytes. Must be between 64K and 640K.
   uint32_t physical_memory_size;
 
+  // Optional host buffer of physical_memory_size bytes backing physical memory.
+  // If set, physical memory is accessed directly and the callbacks below are
+  // not used.
+  uint8_t* physical_memory;
+
+  // Optional cache of decoded instructions for the CPU. The platform
+  // initializes the cache and invalidates it on DMA writes.
+  CPUInstructionCache* instruction_cache;
+
+  // Optional cache of translated blocks for the CPU. The platform initializes
+  // the cache and invalidates it on DMA writes.
+  CPUBlockCache* block_cache;
+
+  // Optional JIT for the CPU, which must be initialized by the caller with
+  // CPUInitJIT(). Only used together with block_cache.
+  CPUJIT* jit;
+
+  // Optional track read-ahead cache for the FDC. The platform initializes the
+  // cache. See FDCConfig.track_cache.
+  FDCTrackCache* fdc_track_cache;
+
+  // Optional write-back cache for the FDC. The platform initializes the cache.
+  // See FDCConfig.write_cache.
+  FDCWriteCache* fdc_write_cache;
+
+  // Maximum number of iterations of a repeated string instruction to run per
+  // CPU tick, or 0 for kPlatformDefaultMaxStringIterations. See
+  // CPUConfig.max_string_iterations.
+  uint16_t max_string_iterations;
+
+  // Whether each CPU instruction should take as many ticks as it takes clock
+  // cycles on the 8088, so that ticks track the 4.77MHz clock and device
+  // timings relative to the CPU are accurate. See CPUConfig.use_clock_cycles.
+  // Otherwise, each instruction takes one tick. This keeps the block cache,
+  // the JIT and threaded dispatch, at the cost of timing each instruction, and
+  // of more ticks per instruction for the devices to catch up with.
+  bool use_clock_cycles;
+
+  // Number of consecutive INT 16h keyboard status checks that find the
+  // keyboard buffer empty, each within kPlatformMaxKeyboardPollInterval clock
+  // cycles of the last, after which the guest is treated as waiting for input,
+  // or 0 to never do so. The CPU is then halted at the INT 16h instruction
+  // until the next interrupt, and checks again when it resumes. This lets the
+  // host sleep while DOS polls for input at its prompt, which the CPU cannot
+  // detect as idle by itself as the polling loop spans DOS and the BIOS. A
+  // program that polls the keyboard this often while doing other work is
+  // slowed down to the rate of interrupts.
+  uint8_t idle_keyboard_polls;
+
+  // Whether the FDC should transfer the rest of a sector to or from memory via
+  // DMA in one step, instead of one byte per FDC tick. The guest sees the same
+  // memory, DMA and FDC state at the end of the transfer, but the transfer
+  // completes much sooner. See FDCConfig.transfer_dma_block.
+  bool use_bulk_disk_transfers;
+
   // Callback to read a byte from physical memory.
   //
   // On the 8086, accessing an invalid memory address will yield garbage data
@@ -9850,6 +15505,22 @@ typedef struct PlatformConfig {
 STATIC_VECTOR_TYPE(MemoryMap, MemoryMapEntry, kMaxMemoryMapEntries)
 STATIC_VECTOR_TYPE(PortMap, PortMapEntry, kMaxPortMapEntries)
 
+// Devices ticked by the platform, in the order they are ticked.
+typedef enum PlatformTimerType {
+  kPlatformTimerPIT = 0,
+  kPlatformTimerFDC,
+  kPlatformTimerKeyboard,
+  kNumPlatformTimers,
+} PlatformTimerType;
+
+// A device's next tick. Devices are only scheduled while they have work to do.
+typedef struct PlatformTimer {
+  // Whether the device is scheduled to tick.
+  bool active;
+  // Value of PlatformState.ticks on which the device ticks next.
+  uint32_t deadline;
+} PlatformTimer;
+
 // State of the platform.
 typedef struct PlatformState {
   // Pointer to caller-provided runtime configuration.
@@ -9896,11 +15567,48 @@ typedef struct PlatformState {
 
   // Memory map.
   MemoryMap memory_map;
+  // Page-granular dispatch table for the memory map, rebuilt whenever a memory
+  // map entry is registered. Each page points to the entry covering the entire
+  // page, to open_bus_memory_map_entry if the page is not mapped at all, or to
+  // NULL if the page is split across more than one entry.
+  MemoryMapEntry* memory_map_pages[kNumMemoryMapPages];
+  // Host memory backing each page for reads, or NULL if reads from the page
+  // must go through the memory map. Shared with the CPU.
+  const uint8_t* memory_read_pages[kNumMemoryMapPages];
+  // Host memory backing each page for writes, or NULL if writes to the page
+  // must go through the memory map. Shared with the CPU.
+  uint8_t* memory_write_pages[kNumMemoryMapPages];
+  // Memory map entry shared by all unmapped pages. Reads return 0xFF and writes
+  // are ignored.
+  MemoryMapEntry open_bus_memory_map_entry;
   // I/O port map.
   PortMap io_port_map;
 
   // How many ticks have run.
   uint32_t ticks;
+  // Next tick of each device, indexed by PlatformTimerType.
+  PlatformTimer timers[kNumPlatformTimers];
+  // Value of CPUState.cycles when ticks was last updated. Used to find the
+  // current tick while the CPU is running a batch of instructions.
+  uint32_t cpu_cycles;
+  // Tick up to which the PIT has been brought up to date, exclusive.
+  uint32_t pit_sync_tick;
+  // Whether the host has asked PlatformRun() to return early.
+  bool stop_requested;
+  // Number of ticks run by the last call to PlatformRun() during which the
+  // CPU was idle, i.e. halted or spinning in a loop that waits for an
+  // interrupt.
+  uint32_t idle_ticks;
+  // Whether the CPU was idle for the whole of the last batch of ticks run by
+  // PlatformRun().
+  bool is_idle;
+  // Number of consecutive INT 16h keyboard status checks that found the
+  // keyboard buffer empty. See PlatformConfig.idle_keyboard_polls.
+  uint8_t num_keyboard_polls;
+  // Time of the last INT 16h keyboard status check in 8088 clock cycles,
+  // estimated from CPUState.cycles if PlatformConfig.use_clock_cycles is not
+  // set. Wraps around.
+  uint32_t last_keyboard_poll_clock_cycles;
 } PlatformState;
 
 // Initialize the platform state with the provided configuration. Returns true
@@ -9912,10 +15620,35 @@ bool PlatformInit(PlatformState* platform, PlatformConfig* config);
 // IRQ was successfully raised, or false if the IRQ number is invalid.
 bool PlatformRaiseIRQ(PlatformState* platform, uint8_t irq);
 
-// Run a single cycle of the platform, including ticking all sub-modules. This
-// should be called at the CPU clock rate (4.77MHz for the 8088).
+// Run a single CPU instruction cycle of the platform, including ticking all
+// sub-modules. This takes one tick, or with PlatformConfig.use_clock_cycles,
+// as many ticks as the instruction's clock cycles.
 void PlatformTick(PlatformState* platform);
 
+// Run up to max_ticks ticks of the platform, with the same results as calling
+// PlatformTick() until max_ticks ticks have run. The CPU runs in batches up to
+// the next device tick, so this is much faster than calling PlatformTick() in a
+// loop. Returns the number of ticks run, which is less than max_ticks if the
+// CPU encountered an error or PlatformRequestStop() was called. With
+// PlatformConfig.use_clock_cycles, this may exceed max_ticks by up to the
+// length of the last instruction.
+uint32_t PlatformRun(PlatformState* platform, uint32_t max_ticks);
+
+// Ask PlatformRun() to return at the end of the current instruction cycle. Can
+// be called from callbacks invoked while running.
+void PlatformRequestStop(PlatformState* platform);
+
+// Returns whether the guest was waiting for an interrupt at the end of the last
+// call to PlatformRun(), so that nothing guest-visible happens until the next
+// device event or host input. The host may then sleep for up to
+// PlatformGetTicksUntilNextEvent() ticks, or until host input arrives.
+bool PlatformIsIdle(const PlatformState* platform);
+
+// Returns the number of ticks up to and including the next device event that
+// may interrupt the guest, or max_ticks if that is sooner.
+uint32_t PlatformGetTicksUntilNextEvent(
+    PlatformState* platform, uint32_t max_ticks);
+
 #endif  // YAX86_PLATFORM_PUBLIC_H
 
 
@@ -9978,14 +15711,95 @@ void PlatformTick(PlatformState* platform);
 #include "public.h"
 #endif  // YAX86_IMPLEMENTATION
 
+// Read callback for unmapped memory. The 8088 reads an undriven data bus as
+// all ones.
+static uint8_t OpenBusReadByte(
+    YAX86_UNUSED MemoryMapEntry* entry, YAX86_UNUSED uint32_t address) {
+  return 0xFF;
+}
+
+// Look up the memory region corresponding to an address by scanning all memory
+// map entries. Returns NULL if the address is not mapped.
+static MemoryMapEntry* ScanMemoryMapForAddress(
+    PlatformState* platform, uint32_t address) {
+  for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
+    MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
+    if (address >= entry->start && address <= entry->end) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Rebuild the page-granular dispatch table from the current memory map
+// entries.
+static void RebuildMemoryMapPages(PlatformState* platform) {
+  static const MemoryMapEntry kOpenBusMemoryMapEntry = {
+      .context = NULL,
+      .entry_type = kMemoryMapEntryNone,
+      .start = 0,
+      .end = kMemoryAddressSpaceSize - 1,
+      .read_byte = OpenBusReadByte,
+      .write_byte = NULL,
+  };
+  platform->open_bus_memory_map_entry = kOpenBusMemoryMapEntry;
+  for (uint32_t page = 0; page < kNumMemoryMapPages; ++page) {
+    uint32_t page_start = page * kMemoryMapPageSize;
+    uint32_t page_end = page_start + kMemoryMapPageSize - 1;
+    MemoryMapEntry* page_entry = &platform->open_bus_memory_map_entry;
+    const uint8_t* read_page = NULL;
+    uint8_t* write_page = NULL;
+    for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
+      MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
+      if (entry->start > page_end || page_start > entry->end) {
+        continue;
+      }
+      if (entry->start <= page_start && entry->end >= page_end) {
+        page_entry = entry;
+        if (entry->read_data) {
+          read_page = entry->read_data + (page_start - entry->start);
+        }
+        if (entry->write_data) {
+          write_page = entry->write_data + (page_start - entry->start);
+        }
+      } else {
+        // The page is only partially covered by this entry, so lookups within
+        // the page must fall back to a scan.
+        page_entry = NULL;
+      }
+      break;
+    }
+    platform->memory_map_pages[page] = page_entry;
+    platform->memory_read_pages[page] = read_page;
+    platform->memory_write_pages[page] = write_page;
+  }
+}
+
+// Look up the memory region corresponding to an address via the dispatch
+// table. Returns the open bus entry if the address is not mapped.
+static inline MemoryMapEntry* LookupMemoryMapPage(
+    PlatformState* platform, uint32_t address) {
+  MemoryMapEntry* entry = NULL;
+  if (address < kMemoryAddressSpaceSize) {
+    entry = platform->memory_map_pages[address / kMemoryMapPageSize];
+    if (entry) {
+      return entry;
+    }
+  }
+  entry = ScanMemoryMapForAddress(platform, address);
+  return entry ? entry : &platform->open_bus_memory_map_entry;
+}
+
 // Register a memory map entry in the platform state. Returns true if the entry
 // was successfully registered, or false if:
+//   - The entry's type is kMemoryMapEntryNone.
 //   - There already exists a memory map entry with the same type.
 //   - The new entry's memory region overlaps with an existing entry.
 //   - The number of memory map entries would exceed kMaxMemoryMapEntries.
 bool RegisterMemoryMapEntry(
     PlatformState* platform, const MemoryMapEntry* entry) {
-  if (MemoryMapLength(&platform->memory_map) >= kMaxMemoryMapEntries) {
+  if (entry->entry_type == kMemoryMapEntryNone ||
+      MemoryMapLength(&platform->memory_map) >= kMaxMemoryMapEntries) {
     return false;
   }
   for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
@@ -9998,22 +15812,19 @@ bool RegisterMemoryMapEntry(
       return false;
     }
   }
-  return MemoryMapAppend(&platform->memory_map, entry);
+  if (!MemoryMapAppend(&platform->memory_map, entry)) {
+    return false;
+  }
+  RebuildMemoryMapPages(platform);
+  return true;
 }
 
 // Look up the memory region corresponding to an address. Returns NULL if the
 // address is not mapped to a known memory region.
 MemoryMapEntry* GetMemoryMapEntryForAddress(
     PlatformState* platform, uint32_t address) {
-  // TODO: Use a more efficient data structure for lookups, such as a sorted
-  // array with binary search.
-  for (uint8_t i = 0; i < MemoryMapLength(&platform->memory_map); ++i) {
-    MemoryMapEntry* entry = MemoryMapGet(&platform->memory_map, i);
-    if (address >= entry->start && address <= entry->end) {
-      return entry;
-    }
-  }
-  return NULL;
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  return entry->entry_type == kMemoryMapEntryNone ? NULL : entry;
 }
 
 // Look up a memory region by type. Returns NULL if no region found with the
@@ -10031,8 +15842,18 @@ MemoryMapEntry* GetMemoryMapEntryByType(
 
 // Read a byte from a logical memory address.
 uint8_t ReadMemoryByte(PlatformState* platform, uint32_t address) {
-  MemoryMapEntry* entry = GetMemoryMapEntryForAddress(platform, address);
-  if (!entry || !entry->read_byte) {
+  if (address < kMemoryAddressSpaceSize) {
+    const uint8_t* page =
+        platform->memory_read_pages[address / kMemoryMapPageSize];
+    if (page) {
+      return page[address % kMemoryMapPageSize];
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (entry->read_data) {
+    return entry->read_data[address - entry->start];
+  }
+  if (!entry->read_byte) {
     return 0xFF;
   }
   return entry->read_byte(entry, address - entry->start);
@@ -10040,6 +15861,26 @@ uint8_t ReadMemoryByte(PlatformState* platform, uint32_t address) {
 
 // Read a word from a logical memory address.
 uint16_t ReadMemoryWord(PlatformState* platform, uint32_t address) {
+  uint32_t page_offset = address % kMemoryMapPageSize;
+  if (address < kMemoryAddressSpaceSize &&
+      page_offset < kMemoryMapPageSize - 1) {
+    const uint8_t* page =
+        platform->memory_read_pages[address / kMemoryMapPageSize];
+    if (page) {
+      return (page[page_offset + 1] << 8) | page[page_offset];
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (address < entry->end) {
+    uint32_t relative_address = address - entry->start;
+    if (entry->read_data) {
+      return (entry->read_data[relative_address + 1] << 8) |
+             entry->read_data[relative_address];
+    }
+    if (entry->read_word) {
+      return entry->read_word(entry, relative_address);
+    }
+  }
   uint8_t low_byte = ReadMemoryByte(platform, address);
   uint8_t high_byte = ReadMemoryByte(platform, address + 1);
   return (high_byte << 8) | low_byte;
@@ -10047,8 +15888,19 @@ uint16_t ReadMemoryWord(PlatformState* platform, uint32_t address) {
 
 // Write a byte to a logical memory address.
 void WriteMemoryByte(PlatformState* platform, uint32_t address, uint8_t value) {
-  MemoryMapEntry* entry = GetMemoryMapEntryForAddress(platform, address);
-  if (!entry || !entry->write_byte) {
+  if (address < kMemoryAddressSpaceSize) {
+    uint8_t* page = platform->memory_write_pages[address / kMemoryMapPageSize];
+    if (page) {
+      page[address % kMemoryMapPageSize] = value;
+      return;
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (entry->write_data) {
+    entry->write_data[address - entry->start] = value;
+    return;
+  }
+  if (!entry->write_byte) {
     return;
   }
   entry->write_byte(entry, address - entry->start, value);
@@ -10057,6 +15909,29 @@ void WriteMemoryByte(PlatformState* platform, uint32_t address, uint8_t value) {
 // Write a word to a logical memory address.
 void WriteMemoryWord(
     PlatformState* platform, uint32_t address, uint16_t value) {
+  uint32_t page_offset = address % kMemoryMapPageSize;
+  if (address < kMemoryAddressSpaceSize &&
+      page_offset < kMemoryMapPageSize - 1) {
+    uint8_t* page = platform->memory_write_pages[address / kMemoryMapPageSize];
+    if (page) {
+      page[page_offset] = value & 0xFF;
+      page[page_offset + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+  }
+  MemoryMapEntry* entry = LookupMemoryMapPage(platform, address);
+  if (address < entry->end) {
+    uint32_t relative_address = address - entry->start;
+    if (entry->write_data) {
+      entry->write_data[relative_address] = value & 0xFF;
+      entry->write_data[relative_address + 1] = (value >> 8) & 0xFF;
+      return;
+    }
+    if (entry->write_word) {
+      entry->write_word(entry, relative_address, value);
+      return;
+    }
+  }
   WriteMemoryByte(platform, address, value & 0xFF);
   WriteMemoryByte(platform, address + 1, (value >> 8) & 0xFF);
 }
@@ -10117,8 +15992,13 @@ uint8_t ReadPortByte(PlatformState* platform, uint16_t port) {
 }
 
 // Read a word from an I/O port by invoking the corresponding I/O port map
-// entry's read_byte callback. This reads two consecutive bytes from the port.
+// entry's read_word callback. This reads two consecutive ports, falling back to
+// read_byte if read_word is not set or the ports belong to different entries.
 uint16_t ReadPortWord(PlatformState* platform, uint16_t port) {
+  PortMapEntry* entry = GetPortMapEntryForPort(platform, port);
+  if (entry && entry->read_word && port < entry->end) {
+    return entry->read_word(entry, port);
+  }
   uint8_t low_byte = ReadPortByte(platform, port);
   uint8_t high_byte = ReadPortByte(platform, port + 1);
   return (high_byte << 8) | low_byte;
@@ -10135,8 +16015,15 @@ void WritePortByte(PlatformState* platform, uint16_t port, uint8_t value) {
 }
 
 // Write a word to an I/O port by invoking the corresponding I/O port map
-// entry's write_byte callback. This writes two consecutive bytes to the port.
+// entry's write_word callback. This writes two consecutive ports, falling back
+// to write_byte if write_word is not set or the ports belong to different
+// entries.
 void WritePortWord(PlatformState* platform, uint16_t port, uint16_t value) {
+  PortMapEntry* entry = GetPortMapEntryForPort(platform, port);
+  if (entry && entry->write_word && port < entry->end) {
+    entry->write_word(entry, port, value);
+    return;
+  }
   WritePortByte(platform, port, value & 0xFF);
   WritePortByte(platform, port + 1, (value >> 8) & 0xFF);
 }
@@ -10154,6 +16041,15 @@ static void CPUCallbackWriteMemoryByte(
   WriteMemoryByte((PlatformState*)cpu->config->context, address, value);
 }
 
+static uint16_t CPUCallbackReadMemoryWord(CPUState* cpu, uint32_t address) {
+  return ReadMemoryWord((PlatformState*)cpu->config->context, address);
+}
+
+static void CPUCallbackWriteMemoryWord(
+    CPUState* cpu, uint32_t address, uint16_t value) {
+  WriteMemoryWord((PlatformState*)cpu->config->context, address, value);
+}
+
 static uint8_t CPUCallbackReadPortByte(CPUState* cpu, uint16_t port) {
   return ReadPortByte((PlatformState*)cpu->config->context, port);
 }
@@ -10163,6 +16059,104 @@ static void CPUCallbackWritePortByte(
   WritePortByte((PlatformState*)cpu->config->context, port, value);
 }
 
+static uint16_t CPUCallbackReadPortWord(CPUState* cpu, uint16_t port) {
+  return ReadPortWord((PlatformState*)cpu->config->context, port);
+}
+
+static void CPUCallbackWritePortWord(
+    CPUState* cpu, uint16_t port, uint16_t value) {
+  WritePortWord((PlatformState*)cpu->config->context, port, value);
+}
+
+// Reads from the PIT depend on the current time, and reads from the DMA
+// controller and the FDC data register change their state. Reads from other
+// ports only change when the CPU writes to a port or when devices are ticked
+// between calls to CPURun().
+static bool CPUCallbackIsPortStable(CPUState* cpu, uint16_t port) {
+  PortMapEntry* entry =
+      GetPortMapEntryForPort((PlatformState*)cpu->config->context, port);
+  if (!entry) {
+    return true;
+  }
+  switch (entry->entry_type) {
+    case kPortMapEntryPIC:
+    case kPortMapEntryPPI:
+    case kPortMapEntryMDA:
+      return true;
+    case kPortMapEntryFDC:
+      return port == kFDCPortMSR;
+    default:
+      return false;
+  }
+}
+
+// Returns whether an interrupt that was just raised is an INT 16h instruction
+// checking for a key press with interrupts enabled, while the keyboard buffer
+// in the BIOS data area is empty. The CPU has pushed FLAGS, CS and IP.
+static bool IsEmptyKeyboardPoll(PlatformState* platform) {
+  CPUState* cpu = &platform->cpu;
+  const uint8_t function = cpu->registers[kAX] >> 8;
+  if (function != kPlatformKeyboardServiceCheckKey &&
+      function != kPlatformKeyboardServiceCheckExtendedKey) {
+    return false;
+  }
+  const uint32_t return_address =
+      ((uint32_t)cpu->registers[kCS] << 4) + cpu->registers[kIP];
+  if (ReadMemoryByte(platform, return_address - 2) != kPlatformINTOpcode ||
+      ReadMemoryByte(platform, return_address - 1) !=
+          kPlatformKeyboardServiceInterrupt) {
+    return false;
+  }
+  // FLAGS as pushed by the interrupt.
+  const uint32_t flags_address = ((uint32_t)cpu->registers[kSS] << 4) +
+                                 (uint16_t)(cpu->registers[kSP] + 4);
+  if (!(ReadMemoryWord(platform, flags_address) & kIF)) {
+    return false;
+  }
+  return ReadMemoryWord(platform, kPlatformBIOSKeyboardBufferHeadAddress) ==
+         ReadMemoryWord(platform, kPlatformBIOSKeyboardBufferTailAddress);
+}
+
+// Returns the number of 8088 clock cycles run so far, estimated from the
+// number of instructions if PlatformConfig.use_clock_cycles is not set. Wraps
+// around.
+static uint32_t GetKeyboardPollClockCycles(PlatformState* platform) {
+  if (platform->config->use_clock_cycles) {
+    return (uint32_t)platform->cpu.clock_cycles;
+  }
+  return platform->cpu.cycles * kPlatformAverageInstructionClockCycles;
+}
+
+// Halt the CPU at INT 16h instructions that keep finding the keyboard buffer
+// empty. See PlatformConfig.idle_keyboard_polls.
+static ExecuteStatus CPUCallbackHandleInterrupt(
+    CPUState* cpu, uint8_t interrupt_number) {
+  PlatformState* platform = (PlatformState*)cpu->config->context;
+  if (interrupt_number != kPlatformKeyboardServiceInterrupt) {
+    return kExecuteUnhandledInterrupt;
+  }
+  if (!IsEmptyKeyboardPoll(platform)) {
+    platform->num_keyboard_polls = 0;
+    return kExecuteUnhandledInterrupt;
+  }
+  const uint32_t clock_cycles = GetKeyboardPollClockCycles(platform);
+  if (clock_cycles - platform->last_keyboard_poll_clock_cycles >
+      kPlatformMaxKeyboardPollInterval) {
+    platform->num_keyboard_polls = 0;
+  }
+  platform->last_keyboard_poll_clock_cycles = clock_cycles;
+  if (platform->num_keyboard_polls < platform->config->idle_keyboard_polls) {
+    ++platform->num_keyboard_polls;
+    return kExecuteUnhandledInterrupt;
+  }
+  // Return to the INT 16h instruction, halted until the next interrupt.
+  const uint32_t stack_address =
+      ((uint32_t)cpu->registers[kSS] << 4) + cpu->registers[kSP];
+  WriteMemoryWord(platform, stack_address, cpu->registers[kIP] - 2);
+  cpu->is_halted = true;
+  return kExecuteSuccess;
+}
+
 static const CPUConfig kEmptyCPUConfig = {0};
 
 // ============================================================================
@@ -10184,17 +16178,188 @@ static void WritePhysicalMemoryByte(
   }
 }
 
+// ============================================================================
+// Device timers
+// ============================================================================
+
+enum {
+  // PIT ticks at 1.19MHz, CPU at 4.77MHz. 4.77 / 1.19 ~= 4.
+  kPITTickPeriod = 4,
+  // The main clock on the FDC is 8MHz. 8MHz / 4.77MHz ~= 2.
+  kFDCTickPeriod = 2,
+  // The keyboard ticks every 1ms.
+  kKeyboardTickPeriod = 4770,
+};
+
+// Returns the first tick at or after the given tick on which a device with the
+// given period ticks.
+static inline uint32_t GetNextDeviceTick(uint32_t ticks, uint32_t period) {
+  return ticks + (period - ticks % period) % period;
+}
+
+// Returns the tick that is currently running. While the CPU is executing an
+// instruction, this is the tick of that instruction.
+static inline uint32_t GetCurrentTick(const PlatformState* platform) {
+  uint32_t cycles = platform->cpu.cycles - platform->cpu_cycles;
+  return platform->ticks + (cycles ? cycles - 1 : 0);
+}
+
+// Bring the PIT up to date with all of its ticks before the given tick.
+static void SyncPIT(PlatformState* platform, uint32_t end_tick) {
+  uint32_t num_ticks = end_tick - platform->pit_sync_tick;
+  if (num_ticks == 0 || num_ticks > (uint32_t)INT32_MAX) {
+    // Already up to date.
+    return;
+  }
+  uint32_t first_pit_tick =
+      GetNextDeviceTick(platform->pit_sync_tick, kPITTickPeriod) -
+      platform->pit_sync_tick;
+  platform->pit_sync_tick = end_tick;
+  if (first_pit_tick < num_ticks) {
+    PITAdvance(
+        &platform->pit,
+        (num_ticks - 1 - first_pit_tick) / kPITTickPeriod + 1);
+  }
+}
+
+// The PIT is scheduled for the next tick on which channel 0 raises IRQ 0.
+// Counters are otherwise computed from the elapsed time when accessed.
+static bool PITTimerSchedule(
+    PlatformState* platform, YAX86_UNUSED uint32_t from_tick,
+    uint32_t* deadline) {
+  uint32_t pit_ticks = PITGetTicksUntilIRQ0(&platform->pit);
+  if (pit_ticks == kPITNoIRQ0) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(platform->pit_sync_tick, kPITTickPeriod) +
+              (pit_ticks - 1) * kPITTickPeriod;
+  return true;
+}
+
+static void PITTimerTick(PlatformState* platform) {
+  SyncPIT(platform, platform->ticks + 1);
+}
+
+static bool FDCTimerSchedule(
+    PlatformState* platform, uint32_t from_tick, uint32_t* deadline) {
+  if (platform->fdc.phase != kFDCPhaseExecution) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(from_tick, kFDCTickPeriod);
+  return true;
+}
+
+static void FDCTimerTick(PlatformState* platform) { FDCTick(&platform->fdc); }
+
+static bool KeyboardTimerSchedule(
+    PlatformState* platform, uint32_t from_tick, uint32_t* deadline) {
+  if (!KeyboardNeedsTick(&platform->keyboard)) {
+    return false;
+  }
+  *deadline = GetNextDeviceTick(from_tick, kKeyboardTickPeriod);
+  return true;
+}
+
+static void KeyboardTimerTick(PlatformState* platform) {
+  KeyboardTickMs(&platform->keyboard);
+}
+
+// How a device is ticked by the platform.
+typedef struct PlatformTimerMetadata {
+  // Returns whether the device has any work to do, and if so, stores the next
+  // tick at or after from_tick on which it should be ticked in deadline.
+  bool (*schedule)(
+      PlatformState* platform, uint32_t from_tick, uint32_t* deadline);
+  // Tick the device.
+  void (*tick)(PlatformState* platform);
+} PlatformTimerMetadata;
+
+// Device timer metadata, indexed by PlatformTimerType.
+static const PlatformTimerMetadata kPlatformTimerMetadata[] = {
+    {.schedule = PITTimerSchedule, .tick = PITTimerTick},
+    {.schedule = FDCTimerSchedule, .tick = FDCTimerTick},
+    {.schedule = KeyboardTimerSchedule, .tick = KeyboardTimerTick},
+};
+
+// Schedule devices that have work to do but are not scheduled yet.
+static void ScheduleTimers(PlatformState* platform) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    PlatformTimer* timer = &platform->timers[i];
+    if (!timer->active) {
+      timer->active = kPlatformTimerMetadata[i].schedule(
+          platform, platform->ticks, &timer->deadline);
+    }
+  }
+}
+
+// Tick devices whose deadline is at or before the current tick, and reschedule
+// them if they still have work to do. Deadlines are only passed when an
+// instruction takes more than one tick, in which case the device catches up on
+// the ticks it missed.
+static void RunDueTimers(PlatformState* platform) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    PlatformTimer* timer = &platform->timers[i];
+    const PlatformTimerMetadata* metadata = &kPlatformTimerMetadata[i];
+    while (timer->active &&
+           (int32_t)(platform->ticks - timer->deadline) >= 0) {
+      metadata->tick(platform);
+      timer->active =
+          metadata->schedule(platform, timer->deadline + 1, &timer->deadline);
+    }
+  }
+}
+
+// Returns the number of ticks from the current tick up to and including the
+// earliest device deadline, or max_ticks if that is sooner.
+static uint32_t GetTicksUntilNextTimer(
+    const PlatformState* platform, uint32_t max_ticks) {
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    const PlatformTimer* timer = &platform->timers[i];
+    if (timer->active) {
+      uint32_t ticks = timer->deadline - platform->ticks + 1;
+      if (ticks < max_ticks) {
+        max_ticks = ticks;
+      }
+    }
+  }
+  return max_ticks;
+}
+
+// Called when the CPU changes a device's state. If the device now has work to
+// do but is not scheduled, stop the CPU so that it can be scheduled.
+static void RequestStopIfTimerNeeded(
+    PlatformState* platform, PlatformTimerType type) {
+  uint32_t deadline;
+  if (!platform->timers[type].active &&
+      kPlatformTimerMetadata[type].schedule(
+          platform, GetCurrentTick(platform), &deadline)) {
+    CPURequestStop(&platform->cpu);
+  }
+}
+
+// Called when the CPU reprograms a device. Unschedule the device and stop the
+// CPU so that it can be scheduled again.
+static void RequestReschedule(PlatformState* platform, PlatformTimerType type) {
+  platform->timers[type].active = false;
+  CPURequestStop(&platform->cpu);
+}
+
 // ============================================================================
 // Callbacks for 8259 PIC module
 // ============================================================================
 
 static uint8_t PICCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
-  return PICReadPort((PICState*)entry->context, port);
+  PlatformState* platform = (PlatformState*)entry->context;
+  return PICReadPort(&platform->pic, port);
 }
 
 static void PICCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  PICWritePort((PICState*)entry->context, port, value);
+  PlatformState* platform = (PlatformState*)entry->context;
+  PICWritePort(&platform->pic, port, value);
+  // Unmasking an IRQ or ending an interrupt may let a pending IRQ through, so
+  // return to PlatformRun() to check the PIC.
+  CPURequestStop(&platform->cpu);
 }
 
 static void PICCallbackPlatformRaiseIRQ0(void* context) {
@@ -10207,12 +16372,17 @@ static void PICCallbackPlatformRaiseIRQ0(void* context) {
 // ============================================================================
 
 static uint8_t PITCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
-  return PITReadPort((PITState*)entry->context, port);
+  PlatformState* platform = (PlatformState*)entry->context;
+  SyncPIT(platform, GetCurrentTick(platform));
+  return PITReadPort(&platform->pit, port);
 }
 
 static void PITCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  PITWritePort((PITState*)entry->context, port, value);
+  PlatformState* platform = (PlatformState*)entry->context;
+  SyncPIT(platform, GetCurrentTick(platform));
+  PITWritePort(&platform->pit, port, value);
+  RequestReschedule(platform, kPlatformTimerPIT);
 }
 
 static void PITCallbackSetPCSpeakerFrequency(
@@ -10239,6 +16409,7 @@ static void PPICallbackSetKeyboardControl(
   PlatformState* platform = (PlatformState*)context;
   KeyboardHandleControl(
       &platform->keyboard, keyboard_enable_clear, keyboard_clock_low);
+  RequestStopIfTimerNeeded(platform, kPlatformTimerKeyboard);
 }
 
 // ============================================================================
@@ -10273,13 +16444,25 @@ static void FDCCallbackRequestDMA(void* context) {
   DMATransferByte(&platform->dma, kPlatformDMAChannelFloppy);
 }
 
+static uint16_t FDCCallbackTransferDMABlock(
+    void* context, uint8_t* data, uint16_t size, bool to_memory) {
+  PlatformState* platform = (PlatformState*)context;
+  return DMATransferBlock(
+      &platform->dma, kPlatformDMAChannelFloppy,
+      to_memory ? kDMAModeTransferTypeWrite : kDMAModeTransferTypeRead, data,
+      size);
+}
+
 static uint8_t FDCCallbackReadPortByte(PortMapEntry* entry, uint16_t port) {
   return FDCReadPort((FDCState*)entry->context, port);
 }
 
 static void FDCCallbackWritePortByte(
     PortMapEntry* entry, uint16_t port, uint8_t value) {
-  FDCWritePort((FDCState*)entry->context, port, value);
+  FDCState* fdc = (FDCState*)entry->context;
+  FDCWritePort(fdc, port, value);
+  RequestStopIfTimerNeeded(
+      (PlatformState*)fdc->config->context, kPlatformTimerFDC);
 }
 
 // ============================================================================
@@ -10294,6 +16477,7 @@ static uint8_t DMACallbackReadMemoryByte(void* context, uint32_t address) {
 static void DMACallbackWriteMemoryByte(
     void* context, uint32_t address, uint8_t value) {
   PlatformState* platform = (PlatformState*)context;
+  CPUInvalidateInstructionCache(&platform->cpu, address);
   WriteMemoryByte(platform, address, value);
 }
 
@@ -10384,6 +16568,8 @@ static void PlatformInitBIOS(PlatformState* platform) {
       .end = kBIOSROMStartAddress + bios_size - 1,
       .read_byte = BIOSCallbackReadROMByte,
       .write_byte = NULL,  // BIOS ROM is read-only.
+      .read_data = BIOSGetROMData(),
+      .write_data = NULL,
   };
   RegisterMemoryMapEntry(platform, &bios_rom);
 }
@@ -10395,6 +16581,30 @@ static void PlatformInitCPU(PlatformState* platform) {
   platform->cpu_config.write_memory_byte = CPUCallbackWriteMemoryByte;
   platform->cpu_config.read_port = CPUCallbackReadPortByte;
   platform->cpu_config.write_port = CPUCallbackWritePortByte;
+  platform->cpu_config.read_memory_word = CPUCallbackReadMemoryWord;
+  platform->cpu_config.write_memory_word = CPUCallbackWriteMemoryWord;
+  platform->cpu_config.read_port_word = CPUCallbackReadPortWord;
+  platform->cpu_config.write_port_word = CPUCallbackWritePortWord;
+  platform->cpu_config.is_port_stable = CPUCallbackIsPortStable;
+  if (platform->config->idle_keyboard_polls) {
+    platform->cpu_config.handle_interrupt = CPUCallbackHandleInterrupt;
+  }
+  platform->cpu_config.read_memory_pages = platform->memory_read_pages;
+  platform->cpu_config.write_memory_pages = platform->memory_write_pages;
+  platform->cpu_config.instruction_cache = platform->config->instruction_cache;
+  if (platform->cpu_config.instruction_cache) {
+    CPUInitInstructionCache(platform->cpu_config.instruction_cache);
+  }
+  platform->cpu_config.block_cache = platform->config->block_cache;
+  if (platform->cpu_config.block_cache) {
+    CPUInitBlockCache(platform->cpu_config.block_cache);
+  }
+  platform->cpu_config.jit = platform->config->jit;
+  platform->cpu_config.max_string_iterations =
+      platform->config->max_string_iterations
+          ? platform->config->max_string_iterations
+          : kPlatformDefaultMaxStringIterations;
+  platform->cpu_config.use_clock_cycles = platform->config->use_clock_cycles;
   CPUInit(&platform->cpu, &platform->cpu_config);
 
   // Initialize CPU registers.
@@ -10415,8 +16625,11 @@ static void PlatformInitMemoryMap(PlatformState* platform) {
       .start = 0x0000,
       .end = platform->config->physical_memory_size - 1,
       .read_byte = ReadPhysicalMemoryByte,
-      .write_byte = WritePhysicalMemoryByte};
-  MemoryMapAppend(&platform->memory_map, &conventional_memory);
+      .write_byte = WritePhysicalMemoryByte,
+      .read_data = platform->config->physical_memory,
+      .write_data = platform->config->physical_memory,
+  };
+  RegisterMemoryMapEntry(platform, &conventional_memory);
 }
 
 static void PlatformInitPIC(PlatformState* platform) {
@@ -10428,7 +16641,7 @@ static void PlatformInitPIC(PlatformState* platform) {
       .end = 0x21,
       .read_byte = PICCallbackReadPortByte,
       .write_byte = PICCallbackWritePortByte,
-      .context = &platform->pic,
+      .context = platform,
   };
   RegisterPortMapEntry(platform, &pic_entry);
 }
@@ -10445,7 +16658,7 @@ static void PlatformInitPIT(PlatformState* platform) {
       .end = 0x43,
       .read_byte = PITCallbackReadPortByte,
       .write_byte = PITCallbackWritePortByte,
-      .context = &platform->pit,
+      .context = platform,
   };
   RegisterPortMapEntry(platform, &pit_entry);
 }
@@ -10483,6 +16696,20 @@ static void PlatformInitFDC(PlatformState* platform) {
   platform->fdc_config.request_dma = FDCCallbackRequestDMA;
   platform->fdc_config.read_image_byte = NULL;
   platform->fdc_config.write_image_byte = NULL;
+  platform->fdc_config.get_image_sector = NULL;
+  platform->fdc_config.read_image_bytes = NULL;
+  platform->fdc_config.track_cache = platform->config->fdc_track_cache;
+  if (platform->fdc_config.track_cache) {
+    FDCInitTrackCache(platform->fdc_config.track_cache);
+  }
+  platform->fdc_config.write_image_bytes = NULL;
+  platform->fdc_config.write_cache = platform->config->fdc_write_cache;
+  if (platform->fdc_config.write_cache) {
+    FDCInitWriteCache(platform->fdc_config.write_cache);
+  }
+  platform->fdc_config.transfer_dma_block =
+      platform->config->use_bulk_disk_transfers ? FDCCallbackTransferDMABlock
+                                                : NULL;
   FDCInit(&platform->fdc, &platform->fdc_config);
   PortMapEntry fdc_entry = {
       .entry_type = (PortMapEntryType)kPortMapEntryFDC,
@@ -10572,6 +16799,18 @@ bool PlatformInit(PlatformState* platform, PlatformConfig* config) {
   PlatformInitMDA(platform);
 
   platform->ticks = 0;
+  platform->cpu_cycles = platform->cpu.cycles;
+  platform->pit_sync_tick = 0;
+  platform->stop_requested = false;
+  platform->idle_ticks = 0;
+  platform->is_idle = false;
+  platform->num_keyboard_polls = 0;
+  platform->last_keyboard_poll_clock_cycles =
+      GetKeyboardPollClockCycles(platform);
+  for (uint8_t i = 0; i < kNumPlatformTimers; ++i) {
+    platform->timers[i].active = false;
+  }
+  ScheduleTimers(platform);
 
   return true;
 }
@@ -10581,41 +16820,93 @@ bool PlatformRaiseIRQ(PlatformState* platform, uint8_t irq) {
     return false;
   }
   PICRaiseIRQ(&platform->pic, irq);
+  // If the CPU is running in PlatformRun(), return so the IRQ can be delivered.
+  CPURequestStop(&platform->cpu);
   return true;
 }
 
-void PlatformTick(PlatformState* platform) {
-  // Tick the CPU.
-  CPUTick(&platform->cpu);
+// Finish num_ticks ticks after the CPU has run them, by checking the PIC and
+// ticking devices at the end of the last tick. Device deadlines before the last
+// tick are only allowed within the CPU's last instruction.
+static void FinishTicks(PlatformState* platform, uint32_t num_ticks) {
+  platform->ticks += num_ticks - 1;
 
   // Check for pending interrupts from the PIC after an
   // instruction has been executed. This is how we connect the PIC to the CPU's
   // interrupt handling flow.
-  if (CPUGetFlag(&platform->cpu, kIF)) {
+  if (PICHasPendingInterrupt(&platform->pic) &&
+      CPUGetFlag(&platform->cpu, kIF)) {
     uint8_t interrupt_vector = PICGetPendingInterrupt(&platform->pic);
     if (interrupt_vector != kPICNoPendingInterrupt) {
       CPUSetPendingInterrupt(&platform->cpu, interrupt_vector);
     }
   }
 
-  // PIT ticks at 1.19MHz, CPU at 4.77MHz. 4.77 / 1.19 ~= 4.
-  if (platform->ticks % 4 == 0) {
-    PITTick(&platform->pit);
-  }
+  // Schedule devices that the CPU gave work to during the last tick, then tick
+  // devices that are due.
+  ScheduleTimers(platform);
+  RunDueTimers(platform);
 
-  // The main clock on the FDC is 8MHz. 8MHz / 4.77MHz ~= 2.
-  if (platform->ticks % 2 == 0) {
-    FDCTick(&platform->fdc);
-  }
+  ++platform->ticks;
+  platform->cpu_cycles = platform->cpu.cycles;
+}
 
-  // The keyboard ticks every 1ms.
-  if (platform->ticks % 4770 == 0) {
-    KeyboardTickMs(&platform->keyboard);
+void PlatformTick(PlatformState* platform) {
+  // Tick the CPU.
+  CPUTick(&platform->cpu);
+  FinishTicks(platform, platform->cpu.cycles - platform->cpu_cycles);
+}
+
+uint32_t PlatformRun(PlatformState* platform, uint32_t max_ticks) {
+  platform->stop_requested = false;
+  platform->idle_ticks = 0;
+  uint32_t ticks_run = 0;
+  while (ticks_run < max_ticks && !platform->stop_requested) {
+    // Run the CPU up to the next device tick. While an IRQ is waiting in the
+    // PIC, e.g. for the CPU to enable interrupts, check it after every tick.
+    ScheduleTimers(platform);
+    uint32_t max_cycles =
+        GetTicksUntilNextTimer(platform, max_ticks - ticks_run);
+    if (PICHasPendingInterrupt(&platform->pic)) {
+      max_cycles = 1;
+    }
+    uint32_t num_cycles;
+    const uint32_t start_idle_cycles = platform->cpu.idle_cycles;
+    ExecuteStatus status = CPURun(&platform->cpu, max_cycles, &num_cycles);
+    if (status != kExecuteSuccess && num_cycles == 0) {
+      // Count the failed instruction cycle, as PlatformTick() does.
+      num_cycles = 1;
+    }
+    if (num_cycles == 0) {
+      continue;
+    }
+    const uint32_t idle_cycles = platform->cpu.idle_cycles - start_idle_cycles;
+    platform->idle_ticks += idle_cycles;
+    platform->is_idle = idle_cycles == num_cycles;
+    FinishTicks(platform, num_cycles);
+    ticks_run += num_cycles;
+    if (status != kExecuteSuccess) {
+      break;
+    }
   }
+  return ticks_run;
+}
 
-  ++platform->ticks;
+void PlatformRequestStop(PlatformState* platform) {
+  platform->stop_requested = true;
+  CPURequestStop(&platform->cpu);
+}
+
+bool PlatformIsIdle(const PlatformState* platform) {
+  return platform->is_idle && !platform->cpu.has_pending_interrupt &&
+         !PICHasPendingInterrupt(&platform->pic);
 }
 
+uint32_t PlatformGetTicksUntilNextEvent(
+    PlatformState* platform, uint32_t max_ticks) {
+  ScheduleTimers(platform);
+  return GetTicksUntilNextTimer(platform, max_ticks);
+}
 
 
 // ==============================================================================
@@ -0,0 +1,214 @@
+#include "disk_image.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Disk formats recognized by image size.
+static const FDCDiskFormat* const kDiskImageFormats[] = {
+    &kFDCFormat360KB,
+};
+
+// Find the disk format matching an image size, or NULL if none matches.
+static const FDCDiskFormat* DiskImageFindFormat(size_t size) {
+  for (size_t i = 0;
+       i < sizeof(kDiskImageFormats) / sizeof(kDiskImageFormats[0]); ++i) {
+    const FDCDiskFormat* format = kDiskImageFormats[i];
+    if (size == (size_t)format->num_heads * format->num_tracks *
+                    format->num_sectors_per_track * format->sector_size) {
+      return format;
+    }
+  }
+  return NULL;
+}
+
+bool DiskImageOpen(DiskImage* image, const char* path, bool read_only) {
+  image->path = path;
+  image->data = NULL;
+  image->size = 0;
+  image->read_only = read_only;
+  image->format = NULL;
+
+  int fd = read_only ? -1 : open(path, O_RDWR);
+  if (fd < 0) {
+    fd = open(path, O_RDONLY);
+    image->read_only = true;
+  }
+  if (fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    close(fd);
+    return false;
+  }
+  image->format = DiskImageFindFormat((size_t)st.st_size);
+  if (!image->format) {
+    fprintf(stderr, "%s: unsupported disk image size\n", path);
+    close(fd);
+    return false;
+  }
+
+  // Writes go straight to the file through the shared mapping. The mapping
+  // stays valid after the file is closed. A read-only mapping shares its pages
+  // with other processes mapping the same file.
+  void* data = mmap(
+      NULL, (size_t)st.st_size,
+      image->read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+  image->data = (uint8_t*)data;
+  image->size = (size_t)st.st_size;
+  return true;
+}
+
+void DiskImageClose(DiskImage* image) {
+  if (!image->data) {
+    return;
+  }
+  if (!image->read_only) {
+    msync(image->data, image->size, MS_SYNC);
+  }
+  munmap(image->data, image->size);
+  image->data = NULL;
+  image->size = 0;
+}
+
+uint8_t* DiskImageGetSector(
+    DiskImage* image, uint32_t offset, uint16_t size, bool writable) {
+  if (!image->data || (writable && image->read_only) ||
+      (size_t)offset + size > image->size) {
+    return NULL;
+  }
+  return image->data + offset;
+}
+
+// Whether a sector has been written to an overlay.
+static inline bool DiskOverlayIsModified(
+    const DiskOverlay* overlay, uint32_t sector) {
+  return (overlay->modified[sector / 8] & (1 << (sector % 8))) != 0;
+}
+
+// Get a pointer to a modified sector in the sector store.
+static inline uint8_t* DiskOverlayGetStoredSector(
+    DiskOverlay* overlay, uint32_t sector) {
+  return overlay->store +
+         (size_t)overlay->slots[sector] * overlay->sector_size;
+}
+
+// Copy a sector from the base image into the sector store, growing the store
+// if needed. Returns false if out of memory.
+static bool DiskOverlayCopySector(DiskOverlay* overlay, uint32_t sector) {
+  if (overlay->num_stored_sectors == overlay->store_capacity) {
+    uint32_t capacity =
+        overlay->store_capacity ? overlay->store_capacity * 2 : 16;
+    if (capacity > overlay->num_sectors) {
+      capacity = overlay->num_sectors;
+    }
+    uint8_t* store = (uint8_t*)realloc(
+        overlay->store, (size_t)capacity * overlay->sector_size);
+    if (!store) {
+      return false;
+    }
+    overlay->store = store;
+    overlay->store_capacity = capacity;
+  }
+  overlay->slots[sector] = (uint16_t)overlay->num_stored_sectors++;
+  overlay->modified[sector / 8] |= (uint8_t)(1 << (sector % 8));
+  memcpy(
+      DiskOverlayGetStoredSector(overlay, sector),
+      overlay->base->data + (size_t)sector * overlay->sector_size,
+      overlay->sector_size);
+  return true;
+}
+
+bool DiskOverlayInit(DiskOverlay* overlay, DiskImage* base) {
+  memset(overlay, 0, sizeof(*overlay));
+  overlay->base = base;
+  overlay->sector_size = base->format->sector_size;
+  overlay->num_sectors = (uint32_t)(base->size / overlay->sector_size);
+  overlay->modified = (uint8_t*)calloc((overlay->num_sectors + 7) / 8, 1);
+  overlay->slots =
+      (uint16_t*)malloc(overlay->num_sectors * sizeof(overlay->slots[0]));
+  if (!overlay->modified || !overlay->slots) {
+    DiskOverlayDestroy(overlay);
+    return false;
+  }
+  return true;
+}
+
+void DiskOverlayDestroy(DiskOverlay* overlay) {
+  free(overlay->modified);
+  free(overlay->slots);
+  free(overlay->store);
+  overlay->modified = NULL;
+  overlay->slots = NULL;
+  overlay->store = NULL;
+  overlay->num_stored_sectors = 0;
+  overlay->store_capacity = 0;
+}
+
+void DiskOverlayDiscard(DiskOverlay* overlay) {
+  memset(overlay->modified, 0, (overlay->num_sectors + 7) / 8);
+  overlay->num_stored_sectors = 0;
+}
+
+bool DiskOverlayCommit(DiskOverlay* overlay) {
+  if (overlay->num_stored_sectors == 0) {
+    return true;
+  }
+  int fd = open(overlay->base->path, O_WRONLY);
+  if (fd < 0) {
+    perror(overlay->base->path);
+    return false;
+  }
+  bool ok = true;
+  for (uint32_t sector = 0; sector < overlay->num_sectors && ok; ++sector) {
+    if (!DiskOverlayIsModified(overlay, sector)) {
+      continue;
+    }
+    ok = lseek(fd, (off_t)sector * overlay->sector_size, SEEK_SET) >= 0 &&
+         write(
+             fd, DiskOverlayGetStoredSector(overlay, sector),
+             overlay->sector_size) == overlay->sector_size;
+  }
+  if (ok) {
+    ok = fsync(fd) == 0;
+  }
+  if (!ok) {
+    perror(overlay->base->path);
+  }
+  close(fd);
+  if (ok) {
+    DiskOverlayDiscard(overlay);
+  }
+  return ok;
+}
+
+uint8_t* DiskOverlayGetSector(
+    DiskOverlay* overlay, uint32_t offset, uint16_t size, bool writable) {
+  const uint32_t sector = offset / overlay->sector_size;
+  const uint32_t sector_offset = offset % overlay->sector_size;
+  if (size == 0 || sector >= overlay->num_sectors ||
+      sector_offset + size > overlay->sector_size) {
+    return NULL;
+  }
+  if (!DiskOverlayIsModified(overlay, sector)) {
+    if (!writable) {
+      return overlay->base->data + offset;
+    }
+    if (!DiskOverlayCopySector(overlay, sector)) {
+      return NULL;
+    }
+  }
+  return DiskOverlayGetStoredSector(overlay, sector) + sector_offset;
+}
@@ -0,0 +1,83 @@
+#ifndef YAX86_SDL_DISK_IMAGE_H
+#define YAX86_SDL_DISK_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/fdc.h"
+
+// A raw floppy disk image file (.IMG) mapped into memory, so that the FDC can
+// read and write its sectors in place without copying. A read-only image can
+// be shared by any number of DiskOverlays.
+typedef struct DiskImage {
+  // Path of the image file, which must outlive the image.
+  const char* path;
+  // Mapped contents of the image file, or NULL if no image is open.
+  uint8_t* data;
+  // Size of the image file in bytes.
+  size_t size;
+  // Whether the image could only be opened for reading.
+  bool read_only;
+  // Disk format matching the image size.
+  const FDCDiskFormat* format;
+} DiskImage;
+
+// Open and map an image file, read-write if possible and read-only otherwise,
+// or always read-only if read_only is true. Returns false if the file cannot be
+// mapped or its size does not match a supported disk format.
+bool DiskImageOpen(DiskImage* image, const char* path, bool read_only);
+
+// Unmap an image file, writing back any changes.
+void DiskImageClose(DiskImage* image);
+
+// Get a pointer to size bytes of an image starting at offset. Returns NULL if
+// the bytes are out of range, or if writable is true for a read-only image.
+// Matches FDCConfig.get_image_sector.
+uint8_t* DiskImageGetSector(
+    DiskImage* image, uint32_t offset, uint16_t size, bool writable);
+
+// A copy-on-write overlay over a shared disk image. Sectors are read from the
+// base image until they are first written, at which point they are copied into
+// the overlay. The base image is never written, except by DiskOverlayCommit(),
+// so memory use scales with the number of sectors written.
+typedef struct DiskOverlay {
+  // Base image, which is only read.
+  DiskImage* base;
+  // Size of a sector and number of sectors in the base image.
+  uint16_t sector_size;
+  uint32_t num_sectors;
+  // Bitmap of sectors written to the overlay, one bit per sector.
+  uint8_t* modified;
+  // Index of each modified sector in the sector store.
+  uint16_t* slots;
+  // Sector store holding the contents of modified sectors, which grows as
+  // sectors are written.
+  uint8_t* store;
+  // Number of sectors in the sector store, and how many it can hold.
+  uint32_t num_stored_sectors;
+  uint32_t store_capacity;
+} DiskOverlay;
+
+// Create an empty overlay over an open image. Returns false if out of memory.
+bool DiskOverlayInit(DiskOverlay* overlay, DiskImage* base);
+
+// Free an overlay's memory, discarding its contents.
+void DiskOverlayDestroy(DiskOverlay* overlay);
+
+// Discard the contents of an overlay, reverting to the base image.
+void DiskOverlayDiscard(DiskOverlay* overlay);
+
+// Write the contents of an overlay to the base image file, then discard them.
+// Returns false if the file cannot be written, in which case the overlay is
+// left unchanged.
+bool DiskOverlayCommit(DiskOverlay* overlay);
+
+// Get a pointer to size bytes of an overlay starting at offset, copying the
+// sector from the base image first if writable is true. Returns NULL if the
+// bytes are out of range or not within a single sector, or if out of memory.
+// Matches FDCConfig.get_image_sector.
+uint8_t* DiskOverlayGetSector(
+    DiskOverlay* overlay, uint32_t offset, uint16_t size, bool writable);
+
+#endif  // YAX86_SDL_DISK_IMAGE_H
@@ -8,6 +8,7 @@
 
 #include "core/platform.h"
 #include "core/video.h"
+#include "disk_image.h"
 #include "display.h"
 #include "input.h"
 
@@ -15,16 +16,48 @@
 #define INTERNAL_RAM_SIZE (1024 * 1024)
 static uint8_t g_memory[INTERNAL_RAM_SIZE];
 static PlatformState g_platform;
+static CPUInstructionCache g_instruction_cache;
+// Translated blocks, which also let the platform detect DOS and BIOS polling
+// loops as idle.
+static CPUBlockCache g_block_cache;
 static bool g_running = true;
+// Floppy disk image in drive A:, if any.
+static DiskImage g_disk_image;
+// Copy-on-write overlay over the disk image with --overlay or --commit. Writes
+// are discarded at exit with --overlay, and written to the image with --commit.
+static DiskOverlay g_disk_overlay;
 
-// CPU Speed: ~4.77 MHz
-// Target Instructions Per Frame (at 60 FPS):
-// Approx 4,770,000 / 60 = 79,500 cycles.
-// Assuming ~4-10 cycles per instruction on average for 8086.
-// Let's be conservative/simple and run a fixed batch.
-// 20,000 instructions per frame is a reasonable starting point for smooth
-// operation without blocking the UI thread too long.
-#define INSTRUCTIONS_PER_FRAME 20000
+// Frame period in milliseconds (~60 FPS).
+#define FRAME_MS 16
+// CPU Speed: ~4.77 MHz. The platform counts ticks in 8088 clock cycles, so
+// running this many ticks per frame keeps the guest at its original speed.
+#define TICKS_PER_FRAME (4770 * FRAME_MS)
+// Longest time to sleep at once while the guest is idle, in frames.
+#define MAX_IDLE_FRAMES 60
+// Interval between host CPU usage reports with --stats, in milliseconds.
+#define STATS_INTERVAL_MS 5000
+// Number of INT 16h keyboard status checks in a row that find no key, after
+// which the guest is treated as idle until the next interrupt.
+#define IDLE_KEYBOARD_POLLS 16
+
+// Number of ticks to run in the next frame. After sleeping through several
+// frames while the guest was idle, the next frame catches up on them.
+static uint32_t g_frame_ticks = TICKS_PER_FRAME;
+// Whether video RAM has been written since the last render.
+static bool g_display_dirty = true;
+
+// Host CPU usage statistics, reported with --stats.
+typedef struct MainStats {
+  // Start of the current reporting interval.
+  Uint64 start_ns;
+  // Time spent running and rendering frames, as opposed to sleeping.
+  Uint64 busy_ns;
+  // Number of ticks run, and how many of them the guest was idle.
+  uint64_t ticks;
+  uint64_t idle_ticks;
+} MainStats;
+static bool g_show_stats = false;
+static MainStats g_stats;
 
 static uint8_t MainReadMemory(PlatformState* platform, uint32_t address) {
   (void)platform;
@@ -51,6 +84,7 @@ static void MainWriteVRAM(
     struct MDAState* mda, uint32_t address, uint8_t value) {
   (void)mda;
   MainWriteMemory(&g_platform, 0xB0000 + address, value);
+  g_display_dirty = true;
 }
 
 static void MainWritePixel(struct MDAState* mda, Position position, RGB rgb) {
@@ -58,6 +92,19 @@ static void MainWritePixel(struct MDAState* mda, Position position, RGB rgb) {
   DisplayPutPixel(position.x, position.y, rgb.r, rgb.g, rgb.b);
 }
 
+static uint8_t* MainGetImageSector(
+    void* context, uint8_t drive, uint32_t offset, uint16_t size,
+    bool writable) {
+  (void)context;
+  if (drive != 0) {
+    return NULL;
+  }
+  if (g_disk_overlay.base) {
+    return DiskOverlayGetSector(&g_disk_overlay, offset, size, writable);
+  }
+  return DiskImageGetSector(&g_disk_image, offset, size, writable);
+}
+
 void MainTick(void) {
   SDL_Event event;
 
@@ -76,18 +123,96 @@ void MainTick(void) {
   if (!g_running) return;
 
   // 2. Run CPU Instructions
-  for (int i = 0; i < INSTRUCTIONS_PER_FRAME; ++i) {
-    PlatformTick(&g_platform);
+  uint32_t ticks = PlatformRun(&g_platform, g_frame_ticks);
+  g_stats.ticks += ticks;
+  g_stats.idle_ticks += g_platform.idle_ticks;
+  // The last instruction may run past the end of the frame, so take the extra
+  // ticks out of the next frame.
+  uint32_t overrun = ticks > g_frame_ticks ? ticks - g_frame_ticks : 0;
+  g_frame_ticks = overrun < TICKS_PER_FRAME ? TICKS_PER_FRAME - overrun : 1;
+
+  // 3. Render, unless the guest sat idle without touching video RAM
+  if (g_display_dirty || !PlatformIsIdle(&g_platform)) {
+    MDARender(&g_platform.mda);  // Update virtual buffer
+    DisplayRender();             // Update screen
+    g_display_dirty = false;
   }
+}
+
+#ifndef __EMSCRIPTEN__
 
-  // 3. Render
-  MDARender(&g_platform.mda);  // Update virtual buffer
-  DisplayRender();             // Update screen
+// Wait until the next frame. While the guest is idle, block until host input
+// arrives or the guest's next timer event is due instead of running empty
+// frames, and catch up on the frames slept through afterwards.
+static void MainWait(void) {
+  if (!PlatformIsIdle(&g_platform)) {
+    SDL_Delay(FRAME_MS);  // ~60 FPS cap
+    return;
+  }
+  uint32_t ticks = PlatformGetTicksUntilNextEvent(
+      &g_platform, MAX_IDLE_FRAMES * TICKS_PER_FRAME);
+  uint32_t max_frames = (ticks + TICKS_PER_FRAME - 1) / TICKS_PER_FRAME;
+  Uint64 start_ms = SDL_GetTicks();
+  SDL_WaitEventTimeout(NULL, (Sint32)(max_frames * FRAME_MS));
+  Uint64 frames = (SDL_GetTicks() - start_ms) / FRAME_MS;
+  if (frames > max_frames) {
+    frames = max_frames;
+  }
+  if (frames > 1) {
+    g_frame_ticks = (uint32_t)frames * TICKS_PER_FRAME;
+  }
 }
 
+// Report host CPU usage and guest idle time at the end of each interval.
+static void MainReportStats(void) {
+  Uint64 now_ns = SDL_GetTicksNS();
+  Uint64 elapsed_ns = now_ns - g_stats.start_ns;
+  if (elapsed_ns < (Uint64)STATS_INTERVAL_MS * 1000000) {
+    return;
+  }
+  if (g_show_stats && g_stats.ticks > 0) {
+    SDL_Log(
+        "Host CPU usage: %.1f%%, guest idle: %.1f%%",
+        100.0 * (double)g_stats.busy_ns / (double)elapsed_ns,
+        100.0 * (double)g_stats.idle_ticks / (double)g_stats.ticks);
+  }
+  g_stats.start_ns = now_ns;
+  g_stats.busy_ns = 0;
+  g_stats.ticks = 0;
+  g_stats.idle_ticks = 0;
+}
+
+#endif  // __EMSCRIPTEN__
+
 int main(int argc, char* argv[]) {
-  (void)argc;
-  (void)argv;
+  // Path to a floppy disk image to insert in drive A:.
+  const char* disk_image_path = NULL;
+  // Whether to write to a copy-on-write overlay instead of the image file, and
+  // whether to commit the overlay to the image file at exit.
+  bool use_disk_overlay = false;
+  bool commit_disk_overlay = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      g_show_stats = true;
+    } else if (strcmp(argv[i], "--overlay") == 0) {
+      use_disk_overlay = true;
+    } else if (strcmp(argv[i], "--commit") == 0) {
+      use_disk_overlay = true;
+      commit_disk_overlay = true;
+    } else {
+      disk_image_path = argv[i];
+    }
+  }
+  if (disk_image_path) {
+    if (!DiskImageOpen(&g_disk_image, disk_image_path, use_disk_overlay)) {
+      return 1;
+    }
+    if (use_disk_overlay && !DiskOverlayInit(&g_disk_overlay, &g_disk_image)) {
+      fprintf(stderr, "Failed to create disk overlay\n");
+      DiskImageClose(&g_disk_image);
+      return 1;
+    }
+  }
 
   if (!DisplayInit()) {
     fprintf(stderr, "Failed to init display\n");
@@ -101,6 +226,13 @@ int main(int argc, char* argv[]) {
   PlatformConfig config = {0};
   config.physical_memory_size =
       640 * 1024;  // Use max allowed conventional memory
+  // Let the core access conventional memory directly without callbacks.
+  config.physical_memory = g_memory;
+  config.instruction_cache = &g_instruction_cache;
+  config.block_cache = &g_block_cache;
+  config.idle_keyboard_polls = IDLE_KEYBOARD_POLLS;
+  config.use_clock_cycles = true;
+  config.use_bulk_disk_transfers = true;
   config.read_physical_memory_byte = MainReadMemory;
   config.write_physical_memory_byte = MainWriteMemory;
 
@@ -116,16 +248,37 @@ int main(int argc, char* argv[]) {
   g_platform.mda_config.write_vram_byte = MainWriteVRAM;
   g_platform.mda_config.write_pixel = MainWritePixel;
 
+  // Hook up the disk image, whose sectors the FDC accesses in place.
+  if (g_disk_image.data) {
+    g_platform.fdc_config.get_image_sector = MainGetImageSector;
+    FDCInsertDisk(&g_platform.fdc, 0, g_disk_image.format);
+  }
+
 #ifdef __EMSCRIPTEN__
   emscripten_set_main_loop(MainTick, 0, 1);
 #else
+  g_stats.start_ns = SDL_GetTicksNS();
   while (g_running) {
+    Uint64 start_ns = SDL_GetTicksNS();
     MainTick();
+    g_stats.busy_ns += SDL_GetTicksNS() - start_ns;
     // 4. Delay
-    SDL_Delay(16);  // ~60 FPS cap
+    MainWait();
+    MainReportStats();
   }
 #endif
 
+  int exit_code = 0;
+  if (g_disk_overlay.base) {
+    if (commit_disk_overlay && !DiskOverlayCommit(&g_disk_overlay)) {
+      fprintf(
+          stderr, "%s: failed to commit disk writes, changes were lost\n",
+          disk_image_path);
+      exit_code = 1;
+    }
+    DiskOverlayDestroy(&g_disk_overlay);
+  }
+  DiskImageClose(&g_disk_image);
   DisplayQuit();
-  return 0;
+  return exit_code;
 }